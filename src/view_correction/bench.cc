@@ -0,0 +1,442 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// Replays a recorded session through ViewCorrectionDisplay as fast as
+// possible and reports the per-stage timings, the end-to-end frame times, and
+// the inpainting statistics for each of the given inpainting methods.
+//
+// A session is a directory containing the following text files:
+//
+//   intrinsics.txt: Two lines "<camera> width height fx fy cx cy [k1 k2 k3]"
+//                   with camera being "depth" and "color". The optional radial
+//                   distortion coefficients default to zero.
+//   poses.txt:      Lines "timestamp_ns tx ty tz qx qy qz qw" of the color
+//                   camera-to-global transformation.
+//   depth.txt:      Lines "timestamp_ns path" of 16-bit depth images in
+//                   millimeters, with paths relative to the session directory.
+//   color.txt:      Lines "timestamp_ns path" of color images.
+//
+// Alternatively, the session may be a session file as recorded with
+// --vc_record_session (see session_file.h). It is memory-mapped, and its
+// images are passed to the display without decoding or copying them.
+//
+// Only depth camera input is supported. All images are loaded (or, for session
+// files, prefetched) before the replay starts, such that the measurements do
+// not include file I/O.
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+#include <sys/stat.h>
+
+#include <gflags/gflags.h>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "view_correction/cuda_util.h"
+#include "view_correction/flags.h"
+#include "view_correction/latency_metrics.h"
+#include "view_correction/offscreen_context.h"
+#include "view_correction/opengl_util.h"
+#include "view_correction/pose_history.h"
+#include "view_correction/session_file.h"
+#include "view_correction/view_correction_display.h"
+
+#include <GLFW/glfw3.h>
+
+DEFINE_string(bench_session, "",
+              "Directory or session file of the recorded session to replay.");
+DEFINE_string(bench_inpainting_methods, "convolution,TV",
+              "Comma-separated list of the values of --vc_inpainting_method "
+              "to benchmark.");
+DEFINE_int32(bench_warmup_frames, 10,
+             "Number of frames at the start of each run which are excluded "
+             "from the statistics.");
+DEFINE_int32(bench_max_frames, 0,
+             "Maximum number of depth frames to replay. 0 replays all.");
+DEFINE_string(bench_output_prefix, "",
+              "If set, the statistics of each run are additionally written to "
+              "<prefix><method>.csv.");
+
+using namespace view_correction;
+using namespace std::chrono;
+
+namespace {
+
+struct TimestampedPath {
+  uint64_t timestamp_ns;
+  std::string path;
+};
+
+struct Session {
+  Intrinsics depth_intrinsics;
+  Intrinsics color_intrinsics;
+  std::vector<DepthImage> depth_images;
+  std::vector<ColorImage> color_images;
+  std::unique_ptr<PoseHistory> poses;
+  
+  // If the session was loaded from a session file, the images refer to its
+  // mapping, and they are passed to the display directly.
+  std::unique_ptr<SessionReader> reader;
+};
+
+bool ReadIntrinsics(const std::string& path, Session* session) {
+  std::ifstream file_stream(path, std::ios::in);
+  bool have_depth = false;
+  bool have_color = false;
+  std::string line;
+  while (std::getline(file_stream, line)) {
+    std::istringstream line_stream(line);
+    std::string camera;
+    Intrinsics intrinsics;
+    line_stream >> camera >> intrinsics.width >> intrinsics.height
+                >> intrinsics.fx >> intrinsics.fy >> intrinsics.cx >> intrinsics.cy;
+    if (!line_stream) {
+      continue;
+    }
+    float k1, k2, k3;
+    if (line_stream >> k1 >> k2 >> k3) {
+      intrinsics.k1 = k1;
+      intrinsics.k2 = k2;
+      intrinsics.k3 = k3;
+    }
+    if (camera == "depth") {
+      session->depth_intrinsics = intrinsics;
+      have_depth = true;
+    } else if (camera == "color") {
+      session->color_intrinsics = intrinsics;
+      have_color = true;
+    }
+  }
+  return have_depth && have_color;
+}
+
+bool ReadImageList(const std::string& path, std::vector<TimestampedPath>* list) {
+  std::ifstream file_stream(path, std::ios::in);
+  if (!file_stream) {
+    return false;
+  }
+  std::string line;
+  while (std::getline(file_stream, line)) {
+    std::istringstream line_stream(line);
+    TimestampedPath item;
+    line_stream >> item.timestamp_ns >> item.path;
+    if (line_stream) {
+      list->push_back(item);
+    }
+  }
+  return true;
+}
+
+bool LoadSessionFile(const std::string& path, Session* session) {
+  session->reader.reset(new SessionReader());
+  SessionReader* reader = session->reader.get();
+  if (!reader->Open(path)) {
+    return false;
+  }
+  session->depth_intrinsics = reader->depth_intrinsics();
+  session->color_intrinsics = reader->color_intrinsics();
+  
+  session->poses.reset(new PoseHistory(std::max(1, reader->camera_pose_count())));
+  for (int i = 0; i < reader->camera_pose_count(); ++ i) {
+    Sophus::SE3f G_T_C;
+    uint64_t timestamp_ns;
+    reader->GetCameraPose(i, &G_T_C, &timestamp_ns);
+    session->poses->AddPose(G_T_C, timestamp_ns);
+  }
+  if (session->poses->size() == 0) {
+    LOG(ERROR) << "The session file contains no camera poses.";
+    return false;
+  }
+  
+  int depth_image_count = reader->depth_image_count();
+  if (FLAGS_bench_max_frames > 0) {
+    depth_image_count = std::min(depth_image_count, FLAGS_bench_max_frames);
+  }
+  for (int i = 0; i < depth_image_count; ++ i) {
+    DepthImage image;
+    reader->GetDepthImage(i, &image);
+    session->depth_images.push_back(image);
+  }
+  const uint64_t last_depth_timestamp =
+      session->depth_images.empty() ? 0 : session->depth_images.back().timestamp_ns();
+  for (int i = 0; i < reader->color_image_count(); ++ i) {
+    ColorImage image;
+    reader->GetColorImage(i, &image);
+    session->color_images.push_back(image);
+    if (image.timestamp_ns() > last_depth_timestamp) {
+      break;
+    }
+  }
+  reader->Prefetch();
+  
+  LOG(INFO) << "Mapped " << session->depth_images.size() << " depth images and "
+            << session->color_images.size() << " color images.";
+  return !session->depth_images.empty() && !session->color_images.empty();
+}
+
+bool LoadSession(const std::string& directory, Session* session) {
+  struct stat path_status;
+  if (stat(directory.c_str(), &path_status) == 0 && S_ISREG(path_status.st_mode)) {
+    return LoadSessionFile(directory, session);
+  }
+  
+  if (!ReadIntrinsics(directory + "/intrinsics.txt", session)) {
+    LOG(ERROR) << "Cannot read the depth and color intrinsics.";
+    return false;
+  }
+  
+  std::vector<std::pair<uint64_t, Sophus::SE3f>> poses;
+  std::ifstream pose_stream(directory + "/poses.txt", std::ios::in);
+  std::string line;
+  while (std::getline(pose_stream, line)) {
+    std::istringstream line_stream(line);
+    uint64_t timestamp_ns;
+    Eigen::Vector3f translation;
+    Eigen::Quaternionf rotation;
+    line_stream >> timestamp_ns >> translation.x() >> translation.y() >> translation.z()
+                >> rotation.x() >> rotation.y() >> rotation.z() >> rotation.w();
+    if (line_stream) {
+      poses.emplace_back(timestamp_ns, Sophus::SE3f(rotation.normalized(), translation));
+    }
+  }
+  if (poses.empty()) {
+    LOG(ERROR) << "Cannot read the poses.";
+    return false;
+  }
+  session->poses.reset(new PoseHistory(poses.size()));
+  for (const auto& pose : poses) {
+    session->poses->AddPose(pose.second, pose.first);
+  }
+  
+  std::vector<TimestampedPath> depth_list;
+  std::vector<TimestampedPath> color_list;
+  if (!ReadImageList(directory + "/depth.txt", &depth_list) ||
+      !ReadImageList(directory + "/color.txt", &color_list)) {
+    LOG(ERROR) << "Cannot read the image lists.";
+    return false;
+  }
+  if (FLAGS_bench_max_frames > 0 &&
+      static_cast<int>(depth_list.size()) > FLAGS_bench_max_frames) {
+    depth_list.resize(FLAGS_bench_max_frames);
+  }
+  
+  for (const TimestampedPath& item : depth_list) {
+    cv::Mat mat = cv::imread(directory + "/" + item.path, cv::IMREAD_ANYDEPTH);
+    if (mat.type() != CV_16UC1) {
+      LOG(ERROR) << "Cannot read 16-bit depth image: " << item.path;
+      return false;
+    }
+    DepthImage image;
+    image.cv::Mat_<uint16_t>::operator=(mat);
+    image.set_timestamp_ns(item.timestamp_ns);
+    session->depth_images.push_back(image);
+  }
+  
+  // Only load the color images up to the one after the last depth image.
+  const uint64_t last_depth_timestamp =
+      session->depth_images.empty() ? 0 : session->depth_images.back().timestamp_ns();
+  for (const TimestampedPath& item : color_list) {
+    cv::Mat mat = cv::imread(directory + "/" + item.path, cv::IMREAD_COLOR);
+    if (mat.empty()) {
+      LOG(ERROR) << "Cannot read color image: " << item.path;
+      return false;
+    }
+    ColorImage image;
+    cv::cvtColor(mat, image, cv::COLOR_BGR2RGB);
+    image.set_timestamp_ns(item.timestamp_ns);
+    Sophus::SE3f G_T_C;
+    session->poses->GetPose(item.timestamp_ns, 0, &G_T_C);
+    image.set_G_T_C(G_T_C);
+    session->color_images.push_back(image);
+    if (item.timestamp_ns > last_depth_timestamp) {
+      break;
+    }
+  }
+  
+  LOG(INFO) << "Loaded " << session->depth_images.size() << " depth images and "
+            << session->color_images.size() << " color images.";
+  return !session->depth_images.empty() && !session->color_images.empty();
+}
+
+// Replays the session once with the current flags and writes the statistics
+// to the output stream, and to the file at output_path if it is not empty.
+void RunBenchmark(const Session& session, const std::string& output_path,
+                  std::ostream* output) {
+  constexpr int kWidth = 800;
+  constexpr int kHeight = 600;
+  
+  std::shared_ptr<ViewCorrectionDisplay> display(new ViewCorrectionDisplay(
+      kWidth, kHeight, 0, 0,
+      ViewCorrectionDisplay::TargetViewMode::kFixedOffset,
+      session.depth_intrinsics,
+      session.color_intrinsics));
+  display->Init();
+  LatencyMetrics* metrics = display->latency_metrics();
+  
+  // Replay the frames as if they were received live, with the display's
+  // clock following the depth image timestamps.
+  size_t next_color_index = 0;
+  for (size_t frame = 0; frame < session.depth_images.size(); ++ frame) {
+    const DepthImage& source_depth = session.depth_images[frame];
+    const uint64_t timestamp = source_depth.timestamp_ns();
+    
+    // Pass in the color images up to the first one after the depth image,
+    // such that the closest one can be chosen.
+    while (next_color_index < session.color_images.size()) {
+      const ColorImage& source_color = session.color_images[next_color_index];
+      if (session.reader) {
+        display->YUVImageCallback(source_color);
+      } else {
+        ColorImage color_image;
+        display->AllocateColorImage(source_color.rows, source_color.cols, &color_image);
+        source_color.copyTo(color_image);
+        color_image.set_timestamp_ns(source_color.timestamp_ns());
+        color_image.set_G_T_C(source_color.G_T_C());
+        display->YUVImageCallback(color_image);
+      }
+      ++ next_color_index;
+      if (source_color.timestamp_ns() > timestamp) {
+        break;
+      }
+    }
+    
+    Sophus::SE3f G_T_C;
+    session.poses->GetPose(timestamp, 0, &G_T_C);
+    display->ColorCameraPoseCallback(G_T_C, timestamp);
+    
+    if (session.reader) {
+      display->DepthImageCallback(source_depth);
+    } else {
+      DepthImage depth_image;
+      display->AllocateDepthImage(source_depth.rows, source_depth.cols, &depth_image);
+      source_depth.copyTo(depth_image);
+      depth_image.set_timestamp_ns(timestamp);
+      display->DepthImageCallback(depth_image);
+    }
+    
+    display->SetStartTime(steady_clock::now() - nanoseconds(timestamp));
+    
+    if (static_cast<int>(frame) == FLAGS_bench_warmup_frames) {
+      metrics->Clear();
+    }
+    
+    steady_clock::time_point frame_start = steady_clock::now();
+    display->Render();
+    glFinish();
+    metrics->AddSample(
+        "frame_time",
+        duration<double, std::milli>(steady_clock::now() - frame_start).count());
+  }
+  
+  MetricSummary frame_time;
+  if (metrics->GetSummary("frame_time", &frame_time)) {
+    *output << "=== " << FLAGS_vc_inpainting_method << ": " << frame_time.count
+            << " frames, frame time mean " << frame_time.mean << " ms, p50 "
+            << frame_time.p50 << " ms, p95 " << frame_time.p95 << " ms, p99 "
+            << frame_time.p99 << " ms ===" << std::endl;
+  }
+  metrics->WriteCSV(output);
+  if (!output_path.empty() && !metrics->WriteToFile(output_path)) {
+    LOG(ERROR) << "Cannot write results to " << output_path;
+  }
+  
+  display.reset();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  
+  if (FLAGS_bench_session.empty()) {
+    LOG(ERROR) << "Pass the session to replay with --bench_session.";
+    return 1;
+  }
+  FLAGS_vc_depth_source = vc_depth_source::depth_camera;
+  
+  Session session;
+  if (!LoadSession(FLAGS_bench_session, &session)) {
+    LOG(ERROR) << "Cannot load session: " << FLAGS_bench_session;
+    return 1;
+  }
+  
+  // Create an offscreen context on the current CUDA device with
+  // --vc_headless, or a hidden window for the OpenGL context otherwise.
+  OffscreenContext offscreen_context;
+  if (FLAGS_vc_headless) {
+    int cuda_device;
+    CUDA_CHECKED_CALL(cudaGetDevice(&cuda_device));
+    if (!offscreen_context.Create(cuda_device)) {
+      LOG(ERROR) << "Cannot create offscreen OpenGL context. Aborting.";
+      return 1;
+    }
+  } else {
+    if (!glfwInit()) {
+      LOG(ERROR) << "Cannot initialize GLFW. Aborting.";
+      return 1;
+    }
+    glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+    GLFWwindow* window = glfwCreateWindow(800, 600, "View correction benchmark", NULL, NULL);
+    if (!window) {
+      LOG(ERROR) << "Cannot create GLFW window. Aborting.";
+      glfwTerminate();
+      return 1;
+    }
+    glfwMakeContextCurrent(window);
+    glewInit();
+  }
+  
+  // Compute the statistics over all frames of a run.
+  FLAGS_vc_do_timings = true;
+  FLAGS_vc_timings_window = std::max<int>(FLAGS_vc_timings_window, session.depth_images.size());
+  FLAGS_vc_timings_interval = std::numeric_limits<int>::max();
+  
+  std::istringstream method_stream(FLAGS_bench_inpainting_methods);
+  std::string method;
+  while (std::getline(method_stream, method, ',')) {
+    if (method != vc_inpainting_method::convolution &&
+        method != vc_inpainting_method::TV) {
+      LOG(ERROR) << "Skipping unknown inpainting method: " << method;
+      continue;
+    }
+    FLAGS_vc_inpainting_method = method;
+    RunBenchmark(session,
+                 FLAGS_bench_output_prefix.empty() ? "" : (FLAGS_bench_output_prefix + method + ".csv"),
+                 &std::cout);
+  }
+  
+  if (!FLAGS_vc_headless) {
+    glfwTerminate();
+  }
+  return 0;
+}
@@ -0,0 +1,246 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "view_correction/cuda_block_compaction.cuh"
+
+#include <algorithm>
+
+#include <cub/cub.cuh>
+#include <glog/logging.h>
+
+#include "view_correction/cuda_util.h"
+
+namespace view_correction {
+
+BlockCompactionBuffers::BlockCompactionBuffers(int max_block_count)
+    : max_block_count(max_block_count),
+      persistent_kernel_share(1) {
+  packed_block_coordinates.reset(new CUDABuffer<int>(1, max_block_count));
+  block_flags.reset(new CUDABuffer<uint8_t>(1, max_block_count));
+  block_pixel_counts.reset(new CUDABuffer<int>(1, max_block_count));
+  counters.reset(new CUDABuffer<int>(1, kBlockCompactionCounterCount));
+  any_block_changing.reset(new CUDABuffer<uint8_t>(1, 1));
+  
+  // Determine the temporary storage size required by the CUB algorithms
+  // used (no work is done if passing a null pointer).
+  size_t select_bytes = 0;
+  CUDA_CHECKED_CALL(cub::DeviceSelect::Flagged(
+      nullptr, select_bytes, packed_block_coordinates->ToCUDA().address(),
+      block_flags->ToCUDA().address(),
+      packed_block_coordinates->ToCUDA().address(),
+      counters->ToCUDA().address(), max_block_count));
+  size_t sum_bytes = 0;
+  CUDA_CHECKED_CALL(cub::DeviceReduce::Sum(
+      nullptr, sum_bytes, block_pixel_counts->ToCUDA().address(),
+      counters->ToCUDA().address(), max_block_count));
+  size_t max_bytes = 0;
+  CUDA_CHECKED_CALL(cub::DeviceReduce::Max(
+      nullptr, max_bytes, block_flags->ToCUDA().address(),
+      any_block_changing->ToCUDA().address(), max_block_count));
+  cub_temp_storage_bytes = std::max(select_bytes, std::max(sum_bytes, max_bytes));
+  cub_temp_storage.reset(new CUDABuffer<uint8_t>(1, cub_temp_storage_bytes));
+  
+  grid_barrier_flags.reset(new CUDABuffer<int>(1, max_block_count));
+  CUDA_CHECKED_CALL(cudaMemset(grid_barrier_flags->ToCUDA().address(), 0,
+                               max_block_count * sizeof(int)));
+}
+
+void BlockCompactionBuffers::DownloadStatistics(
+    cudaStream_t stream,
+    uint32_t* pixel_to_inpaint_count,
+    int* converged_iteration) {
+  int counters_cpu[kBlockCompactionCounterCount];
+  counters->DownloadAsync(stream, counters_cpu);
+  cudaStreamSynchronize(stream);
+  if (pixel_to_inpaint_count) {
+    *pixel_to_inpaint_count = counters_cpu[kPixelToInpaintCountIndex];
+  }
+  if (converged_iteration) {
+    *converged_iteration = counters_cpu[kConvergedIterationIndex];
+  }
+}
+
+int BlockCompactionBuffers::DownloadActiveBlockCount(cudaStream_t stream) {
+  int active_block_count;
+  counters->DownloadPartAsync(kActiveBlockCountIndex * sizeof(int), sizeof(int),
+                              stream, &active_block_count);
+  cudaStreamSynchronize(stream);
+  return active_block_count;
+}
+
+int* ActiveBlockCountPointer(BlockCompactionBuffers* buffers) {
+  return buffers->counters->ToCUDA().address() + kActiveBlockCountIndex;
+}
+
+__global__ void PrepareBlockSelectionCUDAKernel(
+    int grid_dim_x,
+    int block_count,
+    int block_output_size_x,
+    int block_output_size_y,
+    CUDABuffer_<uint16_t> block_activity,
+    CUDABuffer_<int> packed_block_coordinates,
+    CUDABuffer_<uint8_t> block_flags,
+    CUDABuffer_<int> block_pixel_counts,
+    CUDABuffer_<int> counters) {
+  const int block_index = blockIdx.x * blockDim.x + threadIdx.x;
+  
+  if (block_index < block_count) {
+    const int x = block_output_size_x * (block_index % grid_dim_x);
+    const int y = block_output_size_y * (block_index / grid_dim_x);
+    const uint16_t pixel_count = block_activity(0, block_index);
+    packed_block_coordinates(0, block_index) = x | (y << 16);
+    block_flags(0, block_index) = (pixel_count > 0) ? 1 : 0;
+    block_pixel_counts(0, block_index) = pixel_count;
+  }
+  
+  if (block_index == 0) {
+    counters(0, kConvergedIterationIndex) = -1;
+  }
+}
+
+void SelectActiveBlocksCUDA(
+    cudaStream_t stream,
+    int grid_dim_x,
+    int grid_dim_y,
+    int block_output_size_x,
+    int block_output_size_y,
+    CUDABuffer<uint16_t>* block_coordinates,
+    BlockCompactionBuffers* buffers) {
+  const int block_count = grid_dim_x * grid_dim_y;
+  CHECK_LE(block_count, buffers->max_block_count);
+  CHECK_GE(block_coordinates->width(), 2 * block_count);
+  
+  constexpr int kBlockWidth = 256;
+  PrepareBlockSelectionCUDAKernel<<<cuda_util::GetBlockCount(block_count, kBlockWidth), kBlockWidth, 0, stream>>>(
+      grid_dim_x, block_count, block_output_size_x, block_output_size_y,
+      block_coordinates->ToCUDA(),
+      buffers->packed_block_coordinates->ToCUDA(),
+      buffers->block_flags->ToCUDA(),
+      buffers->block_pixel_counts->ToCUDA(),
+      buffers->counters->ToCUDA());
+  CHECK_CUDA_NO_ERROR();
+  
+  int* counters = buffers->counters->ToCUDA().address();
+  CUDA_CHECKED_CALL(cub::DeviceReduce::Sum(
+      buffers->cub_temp_storage->ToCUDA().address(),
+      buffers->cub_temp_storage_bytes,
+      buffers->block_pixel_counts->ToCUDA().address(),
+      counters + kPixelToInpaintCountIndex, block_count, stream));
+  
+  // The (x, y) uint16_t coordinate pairs in block_coordinates are written as
+  // packed 32 bit values (on the little-endian GPU, x comes first).
+  CUDA_CHECKED_CALL(cub::DeviceSelect::Flagged(
+      buffers->cub_temp_storage->ToCUDA().address(),
+      buffers->cub_temp_storage_bytes,
+      buffers->packed_block_coordinates->ToCUDA().address(),
+      buffers->block_flags->ToCUDA().address(),
+      reinterpret_cast<int*>(block_coordinates->ToCUDA().address()),
+      counters + kActiveBlockCountIndex, block_count, stream));
+}
+
+__global__ void UpdateBlockConvergenceCUDAKernel(
+    int iteration,
+    CUDABuffer_<uint8_t> any_block_changing,
+    CUDABuffer_<int> counters) {
+  if (any_block_changing(0, 0) == 0) {
+    counters(0, kActiveBlockCountIndex) = 0;
+    if (counters(0, kConvergedIterationIndex) < 0) {
+      counters(0, kConvergedIterationIndex) = iteration;
+    }
+  }
+}
+
+void UpdateBlockConvergenceCUDA(
+    cudaStream_t stream,
+    int iteration,
+    int block_count,
+    const CUDABuffer<uint8_t>& max_change,
+    BlockCompactionBuffers* buffers) {
+  CUDA_CHECKED_CALL(cub::DeviceReduce::Max(
+      buffers->cub_temp_storage->ToCUDA().address(),
+      buffers->cub_temp_storage_bytes,
+      max_change.ToCUDA().address(),
+      buffers->any_block_changing->ToCUDA().address(),
+      block_count, stream));
+  
+  UpdateBlockConvergenceCUDAKernel<<<1, 1, 0, stream>>>(
+      iteration,
+      buffers->any_block_changing->ToCUDA(),
+      buffers->counters->ToCUDA());
+  CHECK_CUDA_NO_ERROR();
+}
+
+__global__ void FlagUnconvergedBlocksCUDAKernel(
+    int block_count,
+    float max_change_rate_threshold,
+    CUDABuffer_<float> max_change,
+    CUDABuffer_<uint8_t> block_flags) {
+  const int block_index = blockIdx.x * blockDim.x + threadIdx.x;
+  
+  if (block_index < block_count) {
+    block_flags(0, block_index) =
+        (max_change(0, block_index) > max_change_rate_threshold) ? 1 : 0;
+  }
+}
+
+void RetireConvergedBlocksCUDA(
+    cudaStream_t stream,
+    int block_count,
+    float max_change_rate_threshold,
+    const CUDABuffer<float>& max_change,
+    CUDABuffer<uint16_t>* block_coordinates,
+    BlockCompactionBuffers* buffers) {
+  CHECK_LE(block_count, buffers->max_block_count);
+  
+  constexpr int kBlockWidth = 256;
+  FlagUnconvergedBlocksCUDAKernel<<<cuda_util::GetBlockCount(block_count, kBlockWidth), kBlockWidth, 0, stream>>>(
+      block_count, max_change_rate_threshold,
+      max_change.ToCUDA(),
+      buffers->block_flags->ToCUDA());
+  CHECK_CUDA_NO_ERROR();
+  
+  // The selection cannot be done in-place, so copy the current coordinates
+  // (as packed 32 bit values) to the scratch buffer first.
+  int* block_coordinates_packed =
+      reinterpret_cast<int*>(block_coordinates->ToCUDA().address());
+  CUDA_CHECKED_CALL(cudaMemcpyAsync(
+      buffers->packed_block_coordinates->ToCUDA().address(),
+      block_coordinates_packed, block_count * sizeof(int),
+      cudaMemcpyDeviceToDevice, stream));
+  
+  CUDA_CHECKED_CALL(cub::DeviceSelect::Flagged(
+      buffers->cub_temp_storage->ToCUDA().address(),
+      buffers->cub_temp_storage_bytes,
+      buffers->packed_block_coordinates->ToCUDA().address(),
+      buffers->block_flags->ToCUDA().address(),
+      block_coordinates_packed,
+      buffers->counters->ToCUDA().address() + kActiveBlockCountIndex,
+      block_count, stream));
+}
+
+}  // namespace view_correction
@@ -0,0 +1,139 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef VIEW_CORRECTION_CUDA_BLOCK_COMPACTION_CUH_
+#define VIEW_CORRECTION_CUDA_BLOCK_COMPACTION_CUH_
+
+#include <cuda_runtime.h>
+
+#include "view_correction/cuda_buffer.h"
+#include "view_correction/forward_declarations.h"
+
+namespace view_correction {
+
+// Buffers for selecting the active blocks of the block based convolution
+// inpainting functions and for tracking their convergence on the GPU. If
+// passed to these functions, they run without synchronizing with the host.
+struct BlockCompactionBuffers {
+  // Allocates the buffers for up to max_block_count blocks.
+  explicit BlockCompactionBuffers(int max_block_count);
+  
+  // Downloads the statistics of the last inpainting run which used these
+  // buffers. Synchronizes with the stream. Either pointer may be null.
+  // converged_iteration is set to -1 if the run did not converge.
+  void DownloadStatistics(cudaStream_t stream,
+                          uint32_t* pixel_to_inpaint_count,
+                          int* converged_iteration);
+  
+  // Downloads the device-side active block count. Synchronizes with the
+  // stream.
+  int DownloadActiveBlockCount(cudaStream_t stream);
+  
+  int max_block_count;
+  
+  // Packed (x | (y << 16)) pixel coordinates of the top-left corner of each
+  // block's output area, and whether this block is selected.
+  CUDABufferPtr<int> packed_block_coordinates;
+  CUDABufferPtr<uint8_t> block_flags;
+  // Number of pixels to inpaint in each block.
+  CUDABufferPtr<int> block_pixel_counts;
+  
+  // Indexed by the k...Index constants below.
+  CUDABufferPtr<int> counters;
+  // Result of the last convergence check (1 if any block is still changing).
+  CUDABufferPtr<uint8_t> any_block_changing;
+  
+  CUDABufferPtr<uint8_t> cub_temp_storage;
+  size_t cub_temp_storage_bytes;
+  
+  // Flags of the grid barrier used by the persistent inpainting kernels, one
+  // per thread block. They are zero outside of the kernels.
+  CUDABufferPtr<int> grid_barrier_flags;
+  
+  // Number of persistent inpainting kernels which may run on the device at
+  // the same time as the one using these buffers (including it). Each of
+  // them sizes its grid to this fraction of the thread blocks which can be
+  // resident on the device, such that they can run side by side. Defaults
+  // to 1.
+  int persistent_kernel_share;
+};
+
+// Indices into BlockCompactionBuffers::counters.
+constexpr int kActiveBlockCountIndex = 0;
+constexpr int kPixelToInpaintCountIndex = 1;
+constexpr int kConvergedIterationIndex = 2;
+constexpr int kBlockCompactionCounterCount = 3;
+
+// Returns a device pointer to the number of active blocks. Kernels launched
+// with a grid of max_block_count blocks must return early for
+// blockIdx.x >= *active_block_count.
+int* ActiveBlockCountPointer(BlockCompactionBuffers* buffers);
+
+// Given the number of pixels to inpaint for each block in
+// block_coordinates(0, x + y * grid_dim_x), as written by the initialization
+// kernels of the convolution inpainting functions, replaces the content of
+// block_coordinates with the (x, y) coordinates of the blocks having at least
+// one pixel to inpaint, and sets the device-side active block and pixel counts.
+void SelectActiveBlocksCUDA(
+    cudaStream_t stream,
+    int grid_dim_x,
+    int grid_dim_y,
+    int block_output_size_x,
+    int block_output_size_y,
+    CUDABuffer<uint16_t>* block_coordinates,
+    BlockCompactionBuffers* buffers);
+
+// Checks the per-block convergence flags max_change(0, i) for i < block_count
+// written by a convergence-checking iteration (1 if the block is still
+// changing). If no block is changing anymore, sets the active block count to
+// zero, such that all following iterations return immediately, and records
+// iteration as the converged iteration (unless already converged before).
+// max_change must be zeroed for these entries before the checking iteration.
+void UpdateBlockConvergenceCUDA(
+    cudaStream_t stream,
+    int iteration,
+    int block_count,
+    const CUDABuffer<uint8_t>& max_change,
+    BlockCompactionBuffers* buffers);
+
+// Removes the blocks which have converged from the list of active blocks
+// given by the first block_count (x, y) coordinate pairs in block_coordinates,
+// keeping the order of the remaining blocks. A block has converged if its
+// entry max_change(0, i) is not larger than max_change_rate_threshold. Sets
+// the device-side active block count to the number of remaining blocks.
+void RetireConvergedBlocksCUDA(
+    cudaStream_t stream,
+    int block_count,
+    float max_change_rate_threshold,
+    const CUDABuffer<float>& max_change,
+    CUDABuffer<uint16_t>* block_coordinates,
+    BlockCompactionBuffers* buffers);
+
+}  // namespace view_correction
+
+#endif  // VIEW_CORRECTION_CUDA_BLOCK_COMPACTION_CUH_
@@ -103,6 +103,7 @@ template class CUDABuffer_<uint16_t>;
 template class CUDABuffer_<char2>;
 template class CUDABuffer_<char4>;
 template class CUDABuffer_<uchar4>;
+template class CUDABuffer_<uint2>;
 template class CUDABuffer_<curandState>;
 
 }  // namespace view_correction
@@ -40,7 +40,11 @@ class CUDABuffer;
 template<typename T>
 class CUDABuffer_ {
  public:
-  inline CUDABuffer_() {}
+  inline CUDABuffer_()
+      : address_(nullptr),
+        height_(0),
+        width_(0),
+        pitch_(0) {}
   inline CUDABuffer_(T* address, int height, int width, size_t pitch)
       : address_(address),
         height_(height),
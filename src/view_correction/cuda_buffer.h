@@ -46,9 +46,17 @@ class CUDABuffer {
   typedef T Type;
 
   // Allocates a new CUDA buffer with the given size and undefined content.
+  // The memory is taken from a caching allocator (see
+  // cuda_device_allocator.h), such that temporary buffers are cheap.
   CUDABuffer(int height, int width);
 
-  // Frees the device buffer.
+  // Creates a buffer which refers to existing device memory with the given
+  // pitch (in bytes) without taking ownership of it. This is used to
+  // sub-allocate buffers from a larger allocation (see
+  // inpainting_workspace.h). The memory must outlive the buffer.
+  CUDABuffer(int height, int width, T* address, size_t pitch);
+
+  // Returns the device buffer to the caching allocator (if it is owned).
   ~CUDABuffer();
 
   // Uploads the (non-pitched) data to the device buffer.
@@ -136,6 +144,10 @@ class CUDABuffer {
 
   // Data that will be passed to CUDA code.
   CUDABuffer_<T> data_;
+  
+  // Allocation containing the buffer, to be returned to the allocator. Null
+  // if the memory is not owned by the buffer.
+  void* allocation_;
 
   // Cached texture object.
   cudaTextureObject_t texture_object_;
@@ -30,6 +30,7 @@
 #define VIEW_CORRECTION_CUDA_BUFFER_ADAPTER_H_
 
 #include "view_correction/cuda_buffer.h"
+#include "view_correction/pinned_host_memory_pool.h"
 
 namespace view_correction {
 
@@ -51,6 +52,15 @@ class CUDABufferAdapter_ {
   void UploadAsync(cudaStream_t stream,
                    const cv::Mat_<T>& image);
   
+  // Uploads the data from the cv::Mat_ asynchronously to the device buffer
+  // without synchronizing with the host. If the image is stored in a slab of
+  // the staging pool, it is uploaded directly. Otherwise, it is copied to a
+  // free slab first. If no slab is free (or the pool is null), this falls back
+  // to uploading from pageable memory.
+  void UploadAsync(cudaStream_t stream,
+                   const cv::Mat_<T>& image,
+                   PinnedHostMemoryPool* staging_pool);
+  
   // Uploads a rectangular area of the image to the device buffer.
   void UploadRectAsync(int src_y, int src_x, int height, int width,
                        int dest_y, int dest_x, cudaStream_t stream,
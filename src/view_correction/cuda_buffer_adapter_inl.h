@@ -29,6 +29,8 @@
 #ifndef VIEW_CORRECTION_CUDA_BUFFER_ADAPTER_INL_H_
 #define VIEW_CORRECTION_CUDA_BUFFER_ADAPTER_INL_H_
 
+#include <cstring>
+
 #include <glog/logging.h>
 
 #include "view_correction/cuda_util.h"
@@ -53,6 +55,37 @@ void CUDABufferAdapter_<T>::UploadAsync(
                               reinterpret_cast<const T*>(image.data));
 }
 
+template <typename T>
+void CUDABufferAdapter_<T>::UploadAsync(
+    cudaStream_t stream, const cv::Mat_<T>& image,
+    PinnedHostMemoryPool* staging_pool) {
+  if (!staging_pool) {
+    UploadAsync(stream, image);
+    return;
+  }
+  if (staging_pool->Contains(image.data)) {
+    UploadAsync(stream, image);
+    staging_pool->RecordUse(image.data, stream);
+    return;
+  }
+  
+  const size_t row_size = image.cols * sizeof(T);
+  std::shared_ptr<uint8_t> slab;
+  if (row_size * image.rows <= staging_pool->slab_size()) {
+    slab = staging_pool->Acquire();
+  }
+  if (!slab) {
+    UploadAsync(stream, image);
+    return;
+  }
+  for (int y = 0; y < image.rows; ++ y) {
+    memcpy(slab.get() + y * row_size, image.ptr(y), row_size);
+  }
+  buffer_->UploadPitchedAsync(stream, row_size,
+                              reinterpret_cast<const T*>(slab.get()));
+  staging_pool->RecordUse(slab.get(), stream);
+}
+
 template <typename T>
 void CUDABufferAdapter_<T>::UploadRectAsync(int src_y, int src_x, int height, int width,
                       int dest_y, int dest_x, cudaStream_t stream,
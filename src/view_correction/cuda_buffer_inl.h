@@ -32,6 +32,7 @@
 #include <glog/logging.h>
 #include <opencv2/core/core.hpp>
 
+#include "view_correction/cuda_device_allocator.h"
 #include "view_correction/cuda_util.h"
 
 namespace view_correction {
@@ -40,8 +41,10 @@ template <typename T>
 CUDABuffer<T>::CUDABuffer(int height, int width)
     : data_(0, height, width, 0),
       texture_object_allocated_(false) {
-  CUDA_CHECKED_CALL(cudaMallocPitch(&data_.address_, &data_.pitch_,
-                                    data_.width_ * sizeof(T), data_.height_));
+  void* address;
+  allocation_ = AllocateCUDAPitchedMemory(data_.width_ * sizeof(T), data_.height_,
+                                          &address, &data_.pitch_);
+  data_.address_ = static_cast<T*>(address);
   if (data_.pitch_ != data_.width_ * sizeof(T)) {
     LOG(WARNING) << "Pitch does not match width. Width in bytes: "
                  << data_.width_ * sizeof(T)
@@ -51,6 +54,14 @@ CUDABuffer<T>::CUDABuffer(int height, int width)
   }
 }
 
+template <typename T>
+CUDABuffer<T>::CUDABuffer(int height, int width, T* address, size_t pitch)
+    : data_(address, height, width, pitch),
+      allocation_(nullptr),
+      texture_object_allocated_(false) {
+  CHECK_GE(pitch, width * sizeof(T));
+}
+
 template <typename T>
 CUDABuffer<T>::~CUDABuffer() {
   if (texture_object_allocated_) {
@@ -58,7 +69,7 @@ CUDABuffer<T>::~CUDABuffer() {
     texture_object_allocated_ = false;
   }
 
-  CUDA_CHECKED_CALL(cudaFree(reinterpret_cast<void*>(data_.address_)));
+  FreeCUDAPitchedMemory(allocation_);
 }
 
 template <typename T>
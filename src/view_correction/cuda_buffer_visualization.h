@@ -33,6 +33,8 @@
 
 namespace view_correction {
 
+class ImageWriter;
+
 // Utility class which can be used for debug visualizations of
 // CUDABuffer objects.
 template <typename T>
@@ -40,16 +42,22 @@ class CUDABufferVisualization_ {
  public:
   explicit CUDABufferVisualization_(const CUDABuffer<T>& buffer);
 
-  // Downloads the buffer and displays it in an OpenCV window.
+  // Displays the buffer in an OpenCV window, converted to 8-bit grayscale on
+  // the GPU. If write_path is given, the image is written to it instead with
+  // 16-bit precision, in the background if writer is given.
   void Display(float min_value, float max_value, const char* window_title,
-               bool wait_key, const char* write_path) const;
+               bool wait_key, const char* write_path,
+               ImageWriter* writer = nullptr) const;
 
   // Downloads the buffer and displays it as an inverse depth map with JET
   // colors in an OpenCV window.
   void DisplayInvDepthMap(float min_depth, float max_depth,
                           const char* window_title, bool wait_key, const char* write_path) const;
+  // Colorizes the depth map by inverse depth on the GPU (see
+  // InvDepthColormapCUDA()) and displays or writes the result.
   void DisplayDepthMap(float min_depth, float max_depth,
-                       const char* window_title, bool wait_key, const char* write_path) const;
+                       const char* window_title, bool wait_key, const char* write_path,
+                       ImageWriter* writer = nullptr) const;
 
  private:
   const CUDABuffer<T>& buffer_;
@@ -31,12 +31,25 @@
 
 #include <glog/logging.h>
 #include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
 
 #include "view_correction/cuda_buffer_adapter.h"
+#include "view_correction/cuda_visualization.cuh"
+#include "view_correction/image_writer.h"
 #include "view_correction/util.h"
 
 namespace view_correction {
 
+// Downloads an image in BGRA channel order, as output by the functions in
+// cuda_visualization.cuh, and returns it as an 8-bit BGR image.
+inline cv::Mat DownloadBGRAImageAsBGR(const CUDABuffer<uchar4>& image) {
+  cv::Mat_<cv::Vec4b> bgra_image(image.height(), image.width());
+  image.Download(reinterpret_cast<cv::Mat_<uchar4>*>(&bgra_image));
+  cv::Mat bgr_image;
+  cv::cvtColor(bgra_image, bgr_image, CV_BGRA2BGR);
+  return bgr_image;
+}
+
 template <typename T>
 CUDABufferVisualization_<T>::CUDABufferVisualization_(
     const CUDABuffer<T>& buffer)
@@ -45,29 +58,37 @@ CUDABufferVisualization_<T>::CUDABufferVisualization_(
 template <typename T>
 void CUDABufferVisualization_<T>::Display(float min_value, float max_value,
                                           const char* window_title,
-                                          bool wait_key, const char* write_path) const {
+                                          bool wait_key, const char* write_path,
+                                          ImageWriter* writer) const {
 #if defined(ANDROID)
   (void)wait_key;
   (void)min_value;
   (void)max_value;
   (void)window_title;
   (void)write_path;
+  (void)writer;
   LOG(FATAL) << "Not supported on Android.";
 #else
-  cv::Mat_<T> mat(buffer_.height(), buffer_.width());
-  buffer_.Download(&mat);
-  cv::Mat_<float> float_mat;
-  mat.convertTo(float_mat, CV_32F);
-  float_mat -= min_value;
-  float_mat /= (max_value - min_value);
-
   if (write_path) {
+    cv::Mat_<T> mat(buffer_.height(), buffer_.width());
+    buffer_.Download(&mat);
+    cv::Mat_<float> float_mat;
+    mat.convertTo(float_mat, CV_32F);
+    float_mat -= min_value;
+    float_mat /= (max_value - min_value);
+    
     cv::Mat_<float> scaled_float_mat = std::numeric_limits<uint16_t>::max() * float_mat;
     cv::Mat_<uint16_t> uint16_t_mat;
     scaled_float_mat.convertTo(uint16_t_mat, CV_16UC1);
-    cv::imwrite(write_path, uint16_t_mat);
+    if (writer) {
+      writer->Write(write_path, uint16_t_mat);
+    } else {
+      cv::imwrite(write_path, uint16_t_mat);
+    }
   } else {
-    cv::imshow(window_title, float_mat);
+    CUDABuffer<uchar4> gray_image(buffer_.height(), buffer_.width());
+    GrayscaleRangeCUDA(/*stream*/ 0, buffer_, min_value, max_value, &gray_image);
+    cv::imshow(window_title, DownloadBGRAImageAsBGR(gray_image));
   }
   if (wait_key) {
     cv::waitKey(0);
@@ -115,22 +136,26 @@ template <typename T>
 void CUDABufferVisualization_<T>::DisplayDepthMap(float min_depth,
                                                   float max_depth,
                                                   const char* window_title,
-                                                  bool wait_key, const char* write_path) const {
+                                                  bool wait_key, const char* write_path,
+                                                  ImageWriter* writer) const {
 #if defined(ANDROID)
   (void)wait_key;
   (void)min_depth;
   (void)max_depth;
   (void)window_title;
   (void)write_path;
+  (void)writer;
   LOG(FATAL) << "Not supported on Android.";
 #else
-  cv::Mat_<float> buffer_cpu(buffer_.height(), buffer_.width());
-  CUDABufferAdapter(const_cast<CUDABuffer<T>*>(&buffer_))
-      .DebugDownload(&buffer_cpu);
-  cv::Mat mat =
-      util::GetInvDepthColoredDepthmapMat(buffer_cpu, min_depth, max_depth);
+  CUDABuffer<uchar4> colormap(buffer_.height(), buffer_.width());
+  InvDepthColormapCUDA(/*stream*/ 0, buffer_, 1.f, min_depth, max_depth, &colormap);
+  cv::Mat mat = DownloadBGRAImageAsBGR(colormap);
   if (write_path) {
-    cv::imwrite(write_path, mat);
+    if (writer) {
+      writer->Write(write_path, mat);
+    } else {
+      cv::imwrite(write_path, mat);
+    }
   } else {
     cv::imshow(window_title, mat);
   }
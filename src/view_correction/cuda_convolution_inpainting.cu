@@ -28,77 +28,115 @@
 
 #include "view_correction/cuda_convolution_inpainting.cuh"
 
+#include <algorithm>
+
 #include <cub/cub.cuh>
+#include <cub/grid/grid_barrier.cuh>
 #include <glog/logging.h>
 
+#include "view_correction/cuda_block_compaction.cuh"
+#include "view_correction/cuda_hole_map.cuh"
 #include "view_correction/cuda_util.h"
+#include "view_correction/host_scratch_arena.h"
+#include "view_correction/nvtx_range.h"
 
 namespace view_correction {
 
-constexpr int kIterationsPerKernelCall = 4;
+// Minimum number of iterations between two convergence checks.
+constexpr int kConvergenceCheckInterval = 25;
 
-const int kBlockWidth = 32;
-const int kBlockHeight = 32;
+// Size of the tiles of the update_tiles flags.
+constexpr int kUpdateTileSize = 32;
 
 constexpr float kSqrt2 = 1.4142135623731f;
 
-template<int block_size_x, int block_size_y>
+template<int block_size_x, int block_size_y, int iterations_per_call>
 __global__ void ConvolutionInpaintingInitializeVariablesKernel(
     int grid_dim_x,
     float depth_input_scaling_factor,
     cudaTextureObject_t depth_map_input,
+    CUDABuffer_<float> depth_map_initial_guess,
+    CUDABuffer_<uint8_t> update_tiles,
+    HoleMap_ hole_map,
     CUDABuffer_<float> depth_map_output,
     CUDABuffer_<uint16_t> block_coordinates) {
   const int width = depth_map_output.width();
   const int height = depth_map_output.height();
   
-  const int kBlockOutputSizeX = block_size_x - 2 * kIterationsPerKernelCall;
-  const int kBlockOutputSizeY = block_size_y - 2 * kIterationsPerKernelCall;
-  unsigned int x = blockIdx.x * kBlockOutputSizeX + threadIdx.x - kIterationsPerKernelCall;
-  unsigned int y = blockIdx.y * kBlockOutputSizeY + threadIdx.y - kIterationsPerKernelCall;
+  const int kBlockOutputSizeX = block_size_x - 2 * iterations_per_call;
+  const int kBlockOutputSizeY = block_size_y - 2 * iterations_per_call;
+  unsigned int x = blockIdx.x * kBlockOutputSizeX + threadIdx.x - iterations_per_call;
+  unsigned int y = blockIdx.y * kBlockOutputSizeY + threadIdx.y - iterations_per_call;
   
   const bool kOutput =
-      threadIdx.x >= kIterationsPerKernelCall &&
-      threadIdx.y >= kIterationsPerKernelCall &&
-      threadIdx.x < block_size_x - kIterationsPerKernelCall &&
-      threadIdx.y < block_size_y - kIterationsPerKernelCall &&
+      threadIdx.x >= iterations_per_call &&
+      threadIdx.y >= iterations_per_call &&
+      threadIdx.x < block_size_x - iterations_per_call &&
+      threadIdx.y < block_size_y - iterations_per_call &&
       x < width &&
       y < height;
   
   bool thread_is_active = false;
-  if (kOutput) {
+  // Pixels in tiles which are not updated keep their previous output.
+  if (kOutput &&
+      (update_tiles.address() == nullptr ||
+       update_tiles(0, x / kUpdateTileSize + (y / kUpdateTileSize) *
+                           ((width + kUpdateTileSize - 1) / kUpdateTileSize)) != 0)) {
     const float depth_input = depth_input_scaling_factor * tex2D<float>(depth_map_input, x, y);
-    depth_map_output(y, x) = depth_input;
     thread_is_active = (depth_input == 0);
+    float initial_value = depth_input;
+    if (thread_is_active && depth_map_initial_guess.address() != nullptr) {
+      // Start from the given guess where it is valid. The pixel remains a
+      // pixel to inpaint since this is determined from depth_map_input.
+      initial_value = max(0.f, depth_map_initial_guess(y, x));
+    }
+    depth_map_output(y, x) = initial_value;
   }
   
   typedef cub::BlockReduce<
       int, block_size_x, cub::BLOCK_REDUCE_WARP_REDUCTIONS, block_size_y> BlockReduceInt;
   __shared__ typename BlockReduceInt::TempStorage int_storage;
+  // Blocks without holes in their output (according to the hole map, which
+  // is the same for all threads of the block) skip the reduction. They still
+  // copied their input above, since depth_map_output is a separate buffer
+  // which the iterations of neighboring blocks and the result read.
+  if (!hole_map.MayContainHoles(
+          kDepthHoleMap,
+          blockIdx.x * kBlockOutputSizeX, blockIdx.y * kBlockOutputSizeY,
+          (blockIdx.x + 1) * kBlockOutputSizeX - 1,
+          (blockIdx.y + 1) * kBlockOutputSizeY - 1)) {
+    if (threadIdx.x == 0 && threadIdx.y == 0) {
+      block_coordinates(0, blockIdx.x + blockIdx.y * grid_dim_x) = 0;
+    }
+    return;
+  }
   int num_active_threads = BlockReduceInt(int_storage).Sum(thread_is_active ? 1 : 0);
   if (threadIdx.x == 0 && threadIdx.y == 0) {
     block_coordinates(0, blockIdx.x + blockIdx.y * grid_dim_x) = num_active_threads;
   }
 }
 
-template<int block_size_x, int block_size_y, bool check_convergence>
-__global__ void ConvolutionInpaintingKernel(
-    CUDABuffer_<uint16_t> block_coordinates,
+// Runs iterations_per_call iterations on the block with the given index
+// in block_coordinates. Must be called by all threads of the thread block.
+template<int block_size_x, int block_size_y, int iterations_per_call, bool check_convergence>
+__device__ __forceinline__ void ConvolutionInpaintingBlock(
+    int block_index,
+    const CUDABuffer_<uint16_t>& block_coordinates,
     cudaTextureObject_t depth_map_input,
-    CUDABuffer_<uint8_t> max_change,
+    CUDABuffer_<uint8_t>& max_change,
     float max_change_rate_threshold,
-    CUDABuffer_<float> depth_map_output) {
-  const int x = max(0, min(depth_map_output.width() - 1, block_coordinates(0, 2 * blockIdx.x + 0) + threadIdx.x - kIterationsPerKernelCall));
-  const int y = max(0, min(depth_map_output.height() - 1, block_coordinates(0, 2 * blockIdx.x + 1) + threadIdx.y - kIterationsPerKernelCall));
+    CUDABuffer_<float>& depth_map_output) {
+  const int x = max(0, min(depth_map_output.width() - 1, block_coordinates(0, 2 * block_index + 0) + threadIdx.x - iterations_per_call));
+  const int y = max(0, min(depth_map_output.height() - 1, block_coordinates(0, 2 * block_index + 1) + threadIdx.y - iterations_per_call));
   
   const bool kIsPixelToInpaint = (tex2D<float>(depth_map_input, x, y) <= 0);
   const bool kOutput =
-      threadIdx.x >= kIterationsPerKernelCall &&
-      threadIdx.y >= kIterationsPerKernelCall &&
-      threadIdx.x < block_size_x - kIterationsPerKernelCall &&
-      threadIdx.y < block_size_y - kIterationsPerKernelCall &&
-      block_coordinates(0, 2 * blockIdx.x + 0) + threadIdx.x - kIterationsPerKernelCall < depth_map_output.width() &&
-      block_coordinates(0, 2 * blockIdx.x + 1) + threadIdx.y - kIterationsPerKernelCall < depth_map_output.height();
+      threadIdx.x >= iterations_per_call &&
+      threadIdx.y >= iterations_per_call &&
+      threadIdx.x < block_size_x - iterations_per_call &&
+      threadIdx.y < block_size_y - iterations_per_call &&
+      block_coordinates(0, 2 * block_index + 0) + threadIdx.x - iterations_per_call < depth_map_output.width() &&
+      block_coordinates(0, 2 * block_index + 1) + threadIdx.y - iterations_per_call < depth_map_output.height();
   
   // Load inputs into private or shared memory.
   __shared__ float depth_shared[block_size_x * block_size_y];
@@ -109,7 +147,7 @@ __global__ void ConvolutionInpaintingKernel(
   __syncthreads();
   
 #pragma unroll
-  for (int i = 0; i < kIterationsPerKernelCall; ++ i) {
+  for (int i = 0; i < iterations_per_call; ++ i) {
     float result = 0;
     float weight = 0;
     float pixel_weight;
@@ -192,7 +230,7 @@ __global__ void ConvolutionInpaintingKernel(
     
     // Convergence test.
     float change = 0;
-    if (check_convergence && kOutput && kIsPixelToInpaint && i == kIterationsPerKernelCall - 1) {
+    if (check_convergence && kOutput && kIsPixelToInpaint && i == iterations_per_call - 1) {
       change = fabs((new_depth - depth_shared[shared_mem_index]) / depth_shared[shared_mem_index]);
     }
     if (check_convergence) {
@@ -201,7 +239,7 @@ __global__ void ConvolutionInpaintingKernel(
       __shared__ typename BlockReduceInt::TempStorage int_storage;
       int active_pixels = BlockReduceInt(int_storage).Sum(change > max_change_rate_threshold);
       if (threadIdx.x == 0 && threadIdx.y == 0) {
-        max_change(0, blockIdx.x) = (active_pixels > 0) ? 1 : 0;
+        max_change(0, block_index) = (active_pixels > 0) ? 1 : 0;
       }
     }
     
@@ -216,16 +254,19 @@ __global__ void ConvolutionInpaintingKernel(
   }
 }
 
-template<int block_size_x, int block_size_y, bool check_convergence>
-__global__ void ConvolutionInpaintingKernelWithWeighting(
-    CUDABuffer_<uint16_t> block_coordinates,
+// Variant of ConvolutionInpaintingBlock() which weights the neighbors
+// according to the gradient magnitudes.
+template<int block_size_x, int block_size_y, int iterations_per_call, bool check_convergence>
+__device__ __forceinline__ void ConvolutionInpaintingBlockWithWeighting(
+    int block_index,
+    const CUDABuffer_<uint16_t>& block_coordinates,
     cudaTextureObject_t depth_map_input,
     cudaTextureObject_t gradient_magnitude_div_sqrt2,
-    CUDABuffer_<uint8_t> max_change,
+    CUDABuffer_<uint8_t>& max_change,
     float max_change_rate_threshold,
-    CUDABuffer_<float> depth_map_output) {
-  const int raw_x = block_coordinates(0, 2 * blockIdx.x + 0) + threadIdx.x - kIterationsPerKernelCall;
-  const int raw_y = block_coordinates(0, 2 * blockIdx.x + 1) + threadIdx.y - kIterationsPerKernelCall;
+    CUDABuffer_<float>& depth_map_output) {
+  const int raw_x = block_coordinates(0, 2 * block_index + 0) + threadIdx.x - iterations_per_call;
+  const int raw_y = block_coordinates(0, 2 * block_index + 1) + threadIdx.y - iterations_per_call;
   const bool kInImage =
       raw_x >= 0 &&
       raw_y >= 0 &&
@@ -236,10 +277,10 @@ __global__ void ConvolutionInpaintingKernelWithWeighting(
   
   const bool kIsPixelToInpaint = (tex2D<float>(depth_map_input, x, y) <= 0);
   const bool kOutput =
-      threadIdx.x >= kIterationsPerKernelCall &&
-      threadIdx.y >= kIterationsPerKernelCall &&
-      threadIdx.x < block_size_x - kIterationsPerKernelCall &&
-      threadIdx.y < block_size_y - kIterationsPerKernelCall &&
+      threadIdx.x >= iterations_per_call &&
+      threadIdx.y >= iterations_per_call &&
+      threadIdx.x < block_size_x - iterations_per_call &&
+      threadIdx.y < block_size_y - iterations_per_call &&
       kInImage && kIsPixelToInpaint;
   
   // Load inputs into private or shared memory.
@@ -254,7 +295,7 @@ __global__ void ConvolutionInpaintingKernelWithWeighting(
   __syncthreads();
   
 #pragma unroll
-  for (int i = 0; i < kIterationsPerKernelCall; ++ i) {
+  for (int i = 0; i < iterations_per_call; ++ i) {
     float new_depth = 0;
     if (kIsPixelToInpaint &&
         threadIdx.x > 0 &&
@@ -321,7 +362,7 @@ __global__ void ConvolutionInpaintingKernelWithWeighting(
     __syncthreads();
     
     // Convergence test.
-    if (check_convergence && i == kIterationsPerKernelCall - 1) {
+    if (check_convergence && i == iterations_per_call - 1) {
       float change = 0;
       if (kOutput) {
         change = fabs((new_depth - depth_shared[shared_mem_index]) / depth_shared[shared_mem_index]);
@@ -332,17 +373,17 @@ __global__ void ConvolutionInpaintingKernelWithWeighting(
       __shared__ typename BlockReduceInt::TempStorage int_storage;
       int active_pixels = BlockReduceInt(int_storage).Sum(change > max_change_rate_threshold);
       if (threadIdx.x == 0 && threadIdx.y == 0) {
-        max_change(0, blockIdx.x) = (active_pixels > 0) ? 1 : 0;
+        max_change(0, block_index) = (active_pixels > 0) ? 1 : 0;
       }
     }
     
     if (kIsPixelToInpaint && new_depth > 0) {
       depth_shared[shared_mem_index] = new_depth;
-      if (i < kIterationsPerKernelCall - 1) {
+      if (i < iterations_per_call - 1) {
         weights_shared[shared_mem_index] = base_weight * (new_depth > 0);
       }
     }
-    if (i < kIterationsPerKernelCall - 1) {
+    if (i < iterations_per_call - 1) {
       __syncthreads();
     }
   }
@@ -352,7 +393,352 @@ __global__ void ConvolutionInpaintingKernelWithWeighting(
   }
 }
 
-int InpaintDepthMapWithConvolutionCUDA(
+// If active_block_count is not null, the grid may contain more blocks than
+// there are active blocks, and blocks beyond the active count return early.
+template<int block_size_x, int block_size_y, int iterations_per_call, bool check_convergence>
+__global__ void ConvolutionInpaintingKernel(
+    const int* active_block_count,
+    CUDABuffer_<uint16_t> block_coordinates,
+    cudaTextureObject_t depth_map_input,
+    CUDABuffer_<uint8_t> max_change,
+    float max_change_rate_threshold,
+    CUDABuffer_<float> depth_map_output) {
+  if (active_block_count && blockIdx.x >= *active_block_count) {
+    return;
+  }
+  ConvolutionInpaintingBlock<block_size_x, block_size_y, iterations_per_call, check_convergence>(
+      blockIdx.x, block_coordinates, depth_map_input, max_change,
+      max_change_rate_threshold, depth_map_output);
+}
+
+template<int block_size_x, int block_size_y, int iterations_per_call, bool check_convergence>
+__global__ void ConvolutionInpaintingKernelWithWeighting(
+    const int* active_block_count,
+    CUDABuffer_<uint16_t> block_coordinates,
+    cudaTextureObject_t depth_map_input,
+    cudaTextureObject_t gradient_magnitude_div_sqrt2,
+    CUDABuffer_<uint8_t> max_change,
+    float max_change_rate_threshold,
+    CUDABuffer_<float> depth_map_output) {
+  if (active_block_count && blockIdx.x >= *active_block_count) {
+    return;
+  }
+  ConvolutionInpaintingBlockWithWeighting<block_size_x, block_size_y, iterations_per_call, check_convergence>(
+      blockIdx.x, block_coordinates, depth_map_input,
+      gradient_magnitude_div_sqrt2, max_change, max_change_rate_threshold,
+      depth_map_output);
+}
+
+// Grid barrier which uses the flags allocated in BlockCompactionBuffers.
+class InpaintingGridBarrier : public cub::GridBarrier {
+ public:
+  explicit InpaintingGridBarrier(int* flags) {
+    d_sync = reinterpret_cast<SyncFlag*>(flags);
+  }
+};
+
+// Persistent variant of the kernels above which runs all iterations in a
+// single launch. In each step of iterations_per_call iterations, thread
+// block b processes the active blocks b, b + gridDim.x, ..., and the steps are
+// separated by a grid barrier. This requires all thread blocks of the grid to
+// be resident at the same time, so it must be launched with
+// cudaLaunchCooperativeKernel(). Convergence is checked on the device at the
+// same iterations as in the launch loop. Once no block changes anymore, all
+// thread blocks return and the converged iteration is written to counters.
+template<int block_size_x, int block_size_y, int iterations_per_call, bool use_weighting>
+__global__ void
+__launch_bounds__(block_size_x * block_size_y, 1)
+PersistentConvolutionInpaintingKernel(
+    int max_num_iterations,
+    const int* active_block_count,
+    CUDABuffer_<uint16_t> block_coordinates,
+    cudaTextureObject_t depth_map_input,
+    cudaTextureObject_t gradient_magnitude_div_sqrt2,
+    CUDABuffer_<uint8_t> max_change,
+    float max_change_rate_threshold,
+    CUDABuffer_<float> depth_map_output,
+    cub::GridBarrier grid_barrier,
+    CUDABuffer_<int> counters) {
+  const int block_count = *active_block_count;
+  const int thread_index = threadIdx.x + block_size_x * threadIdx.y;
+  
+  int last_convergence_check_iteration = -9999;
+  for (int i = 0; i < max_num_iterations; i += iterations_per_call) {
+    const bool check_convergence = (i - last_convergence_check_iteration >= kConvergenceCheckInterval);
+    
+    for (int block_index = blockIdx.x; block_index < block_count; block_index += gridDim.x) {
+      if (use_weighting) {
+        if (check_convergence) {
+          ConvolutionInpaintingBlockWithWeighting<block_size_x, block_size_y, iterations_per_call, true>(
+              block_index, block_coordinates, depth_map_input,
+              gradient_magnitude_div_sqrt2, max_change,
+              max_change_rate_threshold, depth_map_output);
+        } else {
+          ConvolutionInpaintingBlockWithWeighting<block_size_x, block_size_y, iterations_per_call, false>(
+              block_index, block_coordinates, depth_map_input,
+              gradient_magnitude_div_sqrt2, max_change,
+              max_change_rate_threshold, depth_map_output);
+        }
+      } else {
+        if (check_convergence) {
+          ConvolutionInpaintingBlock<block_size_x, block_size_y, iterations_per_call, true>(
+              block_index, block_coordinates, depth_map_input, max_change,
+              max_change_rate_threshold, depth_map_output);
+        } else {
+          ConvolutionInpaintingBlock<block_size_x, block_size_y, iterations_per_call, false>(
+              block_index, block_coordinates, depth_map_input, max_change,
+              max_change_rate_threshold, depth_map_output);
+        }
+      }
+      // The shared memory is re-used for the next block.
+      __syncthreads();
+    }
+    
+    grid_barrier.Sync();
+    
+    if (check_convergence) {
+      // All thread blocks read the same flags and thus return in the same
+      // iteration. The flags are written again only after at least one more
+      // grid barrier.
+      bool any_block_changing = false;
+      for (int j = thread_index; j < block_count; j += block_size_x * block_size_y) {
+        any_block_changing |= (max_change(0, j) != 0);
+      }
+      if (!__syncthreads_or(any_block_changing)) {
+        if (blockIdx.x == 0 && thread_index == 0) {
+          counters(0, kConvergedIterationIndex) = i + iterations_per_call;
+        }
+        return;
+      }
+      last_convergence_check_iteration = i;
+    }
+  }
+}
+
+const std::vector<ConvolutionInpaintingConfig>& GetConvolutionInpaintingConfigs() {
+  // Each configuration must be handled in the switches of
+  // InpaintDepthMapWithConvolutionCUDA() and
+  // GetConvolutionInpaintingKernelOccupancy().
+  static const std::vector<ConvolutionInpaintingConfig> configs = {
+      ConvolutionInpaintingConfig(32, 4),
+      ConvolutionInpaintingConfig(32, 2),
+      ConvolutionInpaintingConfig(32, 8),
+      ConvolutionInpaintingConfig(16, 2),
+      ConvolutionInpaintingConfig(16, 4)};
+  return configs;
+}
+
+// Returns an index which identifies the supported configuration in switches.
+static int GetConfigIndex(const ConvolutionInpaintingConfig& config) {
+  const std::vector<ConvolutionInpaintingConfig>& configs =
+      GetConvolutionInpaintingConfigs();
+  for (std::size_t i = 0; i < configs.size(); ++ i) {
+    if (configs[i] == config) {
+      return i;
+    }
+  }
+  LOG(FATAL) << "Unsupported convolution inpainting configuration: block size "
+             << config.block_size << ", " << config.iterations_per_call
+             << " iterations per call";
+  return -1;
+}
+
+int GetConvolutionInpaintingBlockCount(int width, int height) {
+  // Use the configuration with the smallest blocks, such that the buffers
+  // can be used with all configurations.
+  int block_count = 0;
+  for (const ConvolutionInpaintingConfig& config : GetConvolutionInpaintingConfigs()) {
+    block_count = std::max(block_count,
+                           GetConvolutionInpaintingBlockCount(width, height, config));
+  }
+  return block_count;
+}
+
+int GetConvolutionInpaintingBlockCount(
+    int width, int height, const ConvolutionInpaintingConfig& config) {
+  const int block_output_size = config.block_size - 2 * config.iterations_per_call;
+  return cuda_util::GetBlockCount(width, block_output_size) *
+         cuda_util::GetBlockCount(height, block_output_size);
+}
+
+template<int block_size, int iterations_per_call>
+static KernelOccupancy GetConvolutionInpaintingKernelOccupancyImpl(
+    bool use_weighting, bool use_persistent_kernel) {
+  const int thread_count = block_size * block_size;
+  if (use_persistent_kernel) {
+    return use_weighting ?
+        cuda_util::ComputeKernelOccupancy(
+            PersistentConvolutionInpaintingKernel<block_size, block_size, iterations_per_call, true>, thread_count, 0) :
+        cuda_util::ComputeKernelOccupancy(
+            PersistentConvolutionInpaintingKernel<block_size, block_size, iterations_per_call, false>, thread_count, 0);
+  } else if (use_weighting) {
+    return cuda_util::ComputeKernelOccupancy(
+        ConvolutionInpaintingKernelWithWeighting<block_size, block_size, iterations_per_call, false>, thread_count, 0);
+  } else {
+    return cuda_util::ComputeKernelOccupancy(
+        ConvolutionInpaintingKernel<block_size, block_size, iterations_per_call, false>, thread_count, 0);
+  }
+}
+
+KernelOccupancy GetConvolutionInpaintingKernelOccupancy(
+    bool use_weighting, bool use_persistent_kernel,
+    const ConvolutionInpaintingConfig& config) {
+  switch (GetConfigIndex(config)) {
+    case 0: return GetConvolutionInpaintingKernelOccupancyImpl<32, 4>(use_weighting, use_persistent_kernel);
+    case 1: return GetConvolutionInpaintingKernelOccupancyImpl<32, 2>(use_weighting, use_persistent_kernel);
+    case 2: return GetConvolutionInpaintingKernelOccupancyImpl<32, 8>(use_weighting, use_persistent_kernel);
+    case 3: return GetConvolutionInpaintingKernelOccupancyImpl<16, 2>(use_weighting, use_persistent_kernel);
+    default: return GetConvolutionInpaintingKernelOccupancyImpl<16, 4>(use_weighting, use_persistent_kernel);
+  }
+}
+
+// Runs iterations_per_call iterations on the blocks given by
+// block_coordinates.
+template<int block_size, int iterations_per_call>
+static void RunConvolutionInpaintingIteration(
+    cudaStream_t stream,
+    bool use_weighting,
+    bool check_convergence,
+    const dim3& grid_dim_active,
+    const int* active_block_count,
+    cudaTextureObject_t gradient_magnitude_div_sqrt2,
+    cudaTextureObject_t depth_map_input,
+    float max_change_rate_threshold,
+    CUDABuffer<uint8_t>* max_change,
+    CUDABuffer<float>* depth_map_output,
+    CUDABuffer<uint16_t>* block_coordinates) {
+  const dim3 block_dim(block_size, block_size);
+  if (use_weighting) {
+    if (check_convergence) {
+      ConvolutionInpaintingKernelWithWeighting<block_size, block_size, iterations_per_call, true><<<grid_dim_active, block_dim, 0, stream>>>(
+          active_block_count,
+          block_coordinates->ToCUDA(),
+          depth_map_input,
+          gradient_magnitude_div_sqrt2,
+          max_change->ToCUDA(),
+          max_change_rate_threshold,
+          depth_map_output->ToCUDA());
+    } else {
+      ConvolutionInpaintingKernelWithWeighting<block_size, block_size, iterations_per_call, false><<<grid_dim_active, block_dim, 0, stream>>>(
+          active_block_count,
+          block_coordinates->ToCUDA(),
+          depth_map_input,
+          gradient_magnitude_div_sqrt2,
+          max_change->ToCUDA(),
+          max_change_rate_threshold,
+          depth_map_output->ToCUDA());
+    }
+  } else {
+    if (check_convergence) {
+      ConvolutionInpaintingKernel<block_size, block_size, iterations_per_call, true><<<grid_dim_active, block_dim, 0, stream>>>(
+          active_block_count,
+          block_coordinates->ToCUDA(),
+          depth_map_input,
+          max_change->ToCUDA(),
+          max_change_rate_threshold,
+          depth_map_output->ToCUDA());
+    } else {
+      ConvolutionInpaintingKernel<block_size, block_size, iterations_per_call, false><<<grid_dim_active, block_dim, 0, stream>>>(
+          active_block_count,
+          block_coordinates->ToCUDA(),
+          depth_map_input,
+          max_change->ToCUDA(),
+          max_change_rate_threshold,
+          depth_map_output->ToCUDA());
+    }
+  }
+  CHECK_CUDA_NO_ERROR();
+}
+
+// Returns the number of thread blocks of the given persistent kernel which
+// can be resident on the device at the same time, divided by share (the
+// number of persistent kernels which may run concurrently) and limited to
+// max_block_count.
+template <typename KernelT>
+static int GetPersistentGridSize(KernelT* kernel, int thread_count, int share,
+                                 int max_block_count) {
+  CHECK_GT(share, 0);
+  int device;
+  CUDA_CHECKED_CALL(cudaGetDevice(&device));
+  int multiprocessor_count;
+  CUDA_CHECKED_CALL(cudaDeviceGetAttribute(
+      &multiprocessor_count, cudaDevAttrMultiProcessorCount, device));
+  int blocks_per_multiprocessor;
+  CUDA_CHECKED_CALL(cudaOccupancyMaxActiveBlocksPerMultiprocessor(
+      &blocks_per_multiprocessor, kernel, thread_count, 0));
+  CHECK_GT(blocks_per_multiprocessor, 0);
+  return std::max(1, std::min(max_block_count,
+                              blocks_per_multiprocessor * multiprocessor_count / share));
+}
+
+// Runs all iterations on the active blocks selected in compaction_buffers with
+// PersistentConvolutionInpaintingKernel. The kernel is launched as a
+// cooperative kernel, which guarantees that all of its thread blocks are
+// resident at the same time, as required by its grid barrier (also if other
+// kernels, for example of a concurrent inpainting pass, are running). Returns
+// false without doing anything if the device does not support cooperative
+// launches.
+template<int block_size, int iterations_per_call>
+static bool RunPersistentConvolutionInpainting(
+    cudaStream_t stream,
+    bool use_weighting,
+    int max_num_iterations,
+    int block_count,
+    const int* active_block_count,
+    cudaTextureObject_t gradient_magnitude_div_sqrt2,
+    cudaTextureObject_t depth_map_input,
+    float max_change_rate_threshold,
+    CUDABuffer<uint8_t>* max_change,
+    CUDABuffer<float>* depth_map_output,
+    CUDABuffer<uint16_t>* block_coordinates,
+    BlockCompactionBuffers* compaction_buffers) {
+  int device;
+  CUDA_CHECKED_CALL(cudaGetDevice(&device));
+  int supports_cooperative_launch;
+  CUDA_CHECKED_CALL(cudaDeviceGetAttribute(
+      &supports_cooperative_launch, cudaDevAttrCooperativeLaunch, device));
+  if (!supports_cooperative_launch) {
+    LOG_FIRST_N(WARNING, 1) << "Device " << device << " does not support"
+                            << " cooperative launches, running the persistent"
+                            << " inpainting with one launch per step instead.";
+    return false;
+  }
+  
+  auto kernel = use_weighting ?
+      PersistentConvolutionInpaintingKernel<block_size, block_size, iterations_per_call, true> :
+      PersistentConvolutionInpaintingKernel<block_size, block_size, iterations_per_call, false>;
+  const dim3 block_dim(block_size, block_size);
+  const int grid_size = GetPersistentGridSize(
+      kernel, block_size * block_size,
+      compaction_buffers->persistent_kernel_share, block_count);
+  CHECK_LE(grid_size, compaction_buffers->grid_barrier_flags->width());
+  
+  // cudaLaunchCooperativeKernel() takes the addresses of the arguments.
+  CUDABuffer_<uint16_t> block_coordinates_cuda = block_coordinates->ToCUDA();
+  CUDABuffer_<uint8_t> max_change_cuda = max_change->ToCUDA();
+  CUDABuffer_<float> depth_map_output_cuda = depth_map_output->ToCUDA();
+  cub::GridBarrier grid_barrier = InpaintingGridBarrier(
+      compaction_buffers->grid_barrier_flags->ToCUDA().address());
+  CUDABuffer_<int> counters_cuda = compaction_buffers->counters->ToCUDA();
+  void* arguments[] = {
+      &max_num_iterations,
+      &active_block_count,
+      &block_coordinates_cuda,
+      &depth_map_input,
+      &gradient_magnitude_div_sqrt2,
+      &max_change_cuda,
+      &max_change_rate_threshold,
+      &depth_map_output_cuda,
+      &grid_barrier,
+      &counters_cuda};
+  CUDA_CHECKED_CALL(cudaLaunchCooperativeKernel(
+      reinterpret_cast<const void*>(kernel), dim3(grid_size), block_dim,
+      arguments, 0, stream));
+  return true;
+}
+
+template<int block_size, int iterations_per_call>
+static int InpaintDepthMapWithConvolutionCUDAImpl(
     cudaStream_t stream,
     bool use_weighting,
     int max_num_iterations,
@@ -360,97 +746,145 @@ int InpaintDepthMapWithConvolutionCUDA(
     float depth_input_scaling_factor,
     cudaTextureObject_t gradient_magnitude_div_sqrt2,
     cudaTextureObject_t depth_map_input,
+    const CUDABuffer<float>* depth_map_initial_guess,
+    const CUDABuffer<uint8_t>* update_tiles,
     CUDABuffer<uint8_t>* max_change,
     CUDABuffer<float>* depth_map_output,
     CUDABuffer<uint16_t>* block_coordinates,
-    uint32_t* pixel_to_inpaint_count) {
+    uint32_t* pixel_to_inpaint_count,
+    BlockCompactionBuffers* compaction_buffers,
+    bool use_persistent_kernel,
+    const InpaintingDeadline* deadline,
+    InpaintingResidual* residual,
+    HoleMap* hole_map) {
+  CHECK(!use_persistent_kernel || compaction_buffers);
+  if (deadline) {
+    max_num_iterations = deadline->LimitIterations(
+        max_num_iterations, kConvergenceCheckInterval);
+  }
+  if (residual) {
+    *residual = InpaintingResidual();
+  }
   const int width = depth_map_output->width();
   const int height = depth_map_output->height();
   
-  const dim3 block_dim(kBlockWidth, kBlockHeight);
+  const dim3 block_dim(block_size, block_size);
   
-  const int kBlockOutputSizeX = kBlockWidth - 2 * kIterationsPerKernelCall;
-  const int kBlockOutputSizeY = kBlockHeight - 2 * kIterationsPerKernelCall;
+  const int kBlockOutputSizeX = block_size - 2 * iterations_per_call;
+  const int kBlockOutputSizeY = block_size - 2 * iterations_per_call;
   dim3 grid_dim(cuda_util::GetBlockCount(width, kBlockOutputSizeX),
                 cuda_util::GetBlockCount(height, kBlockOutputSizeY));
   
   // Initialize variables.
-  CHECK_EQ(kBlockWidth, 32);
-  CHECK_EQ(kBlockHeight, 32);
-  ConvolutionInpaintingInitializeVariablesKernel<32, 32><<<grid_dim, block_dim, 0, stream>>>(
-      grid_dim.x, depth_input_scaling_factor, depth_map_input, depth_map_output->ToCUDA(), block_coordinates->ToCUDA());
+  ConvolutionInpaintingInitializeVariablesKernel<block_size, block_size, iterations_per_call><<<grid_dim, block_dim, 0, stream>>>(
+      grid_dim.x, depth_input_scaling_factor, depth_map_input,
+      depth_map_initial_guess ? depth_map_initial_guess->ToCUDA() : CUDABuffer_<float>(),
+      update_tiles ? update_tiles->ToCUDA() : CUDABuffer_<uint8_t>(),
+      hole_map ? hole_map->ToCUDA() : HoleMap_(),
+      depth_map_output->ToCUDA(), block_coordinates->ToCUDA());
   CHECK_CUDA_NO_ERROR();
   
-  uint16_t* block_activity = new uint16_t[grid_dim.x * grid_dim.y];
-  block_coordinates->DownloadPartAsync(0, grid_dim.x * grid_dim.y * sizeof(uint16_t), stream, block_activity);
-  cudaStreamSynchronize(stream);
+  if (compaction_buffers) {
+    // Select the active blocks and check for convergence on the GPU. All
+    // iterations are enqueued with a grid that covers all blocks. Blocks
+    // beyond the active block count return immediately, which includes all
+    // blocks once convergence has been detected.
+    const int block_count = grid_dim.x * grid_dim.y;
+    SelectActiveBlocksCUDA(stream, grid_dim.x, grid_dim.y, kBlockOutputSizeX,
+                           kBlockOutputSizeY, block_coordinates,
+                           compaction_buffers);
+    const int* active_block_count = ActiveBlockCountPointer(compaction_buffers);
+    
+    if (use_persistent_kernel &&
+        RunPersistentConvolutionInpainting<block_size, iterations_per_call>(
+            stream, use_weighting, max_num_iterations, block_count,
+            active_block_count, gradient_magnitude_div_sqrt2, depth_map_input,
+            max_change_rate_threshold, max_change, depth_map_output,
+            block_coordinates, compaction_buffers)) {
+      *pixel_to_inpaint_count = 0;
+      return cuda_util::GetBlockCount(max_num_iterations, iterations_per_call) *
+             iterations_per_call;
+    }
+    
+    int i = 0;
+    int last_convergence_check_iteration = -9999;
+    for (i = 0; i < max_num_iterations; i += iterations_per_call) {
+      const bool check_convergence = (i - last_convergence_check_iteration >= kConvergenceCheckInterval);
+      if (check_convergence) {
+        CUDA_CHECKED_CALL(cudaMemsetAsync(max_change->ToCUDA().address(), 0,
+                                          block_count * sizeof(uint8_t), stream));
+      }
+      
+      RunConvolutionInpaintingIteration<block_size, iterations_per_call>(
+          stream, use_weighting, check_convergence, dim3(block_count),
+          active_block_count, gradient_magnitude_div_sqrt2, depth_map_input,
+          max_change_rate_threshold, max_change, depth_map_output,
+          block_coordinates);
+      
+      if (check_convergence) {
+        UpdateBlockConvergenceCUDA(stream, i + iterations_per_call,
+                                   block_count, *max_change,
+                                   compaction_buffers);
+        last_convergence_check_iteration = i;
+      }
+    }
+    
+    // The actual statistics are only available on the GPU.
+    *pixel_to_inpaint_count = 0;
+    return i;
+  }
+  
+  // Temporary host arrays, reused between calls.
+  HostScratchScope scratch;
   int active_block_count = 0;
   *pixel_to_inpaint_count = 0;
-  uint16_t* block_coordinates_cpu = new uint16_t[2 * grid_dim.x * grid_dim.y];
-  for (size_t y = 0; y < grid_dim.y; ++ y) {
-    for (size_t x = 0; x < grid_dim.x; ++ x) {
-      if (block_activity[x + y * grid_dim.x] > 0) {
-        block_coordinates_cpu[2 * active_block_count + 0] = x * kBlockOutputSizeX;
-        block_coordinates_cpu[2 * active_block_count + 1] = y * kBlockOutputSizeY;
-        ++ active_block_count;
-        *pixel_to_inpaint_count += block_activity[x + y * grid_dim.x];
+  uint16_t* block_coordinates_cpu = scratch.Allocate<uint16_t>(2 * grid_dim.x * grid_dim.y);
+  if (hole_map && !update_tiles) {
+    // The block list follows from the hole map without downloading the block
+    // activities.
+    active_block_count = hole_map->SelectActiveBlocks(
+        stream, kDepthHoleMap, kBlockOutputSizeX, kBlockOutputSizeY, 0,
+        grid_dim.x, grid_dim.y, block_coordinates_cpu, pixel_to_inpaint_count);
+  } else {
+    uint16_t* block_activity = scratch.Allocate<uint16_t>(grid_dim.x * grid_dim.y);
+    block_coordinates->DownloadPartAsync(0, grid_dim.x * grid_dim.y * sizeof(uint16_t), stream, block_activity);
+    cudaStreamSynchronize(stream);
+    for (size_t y = 0; y < grid_dim.y; ++ y) {
+      for (size_t x = 0; x < grid_dim.x; ++ x) {
+        if (block_activity[x + y * grid_dim.x] > 0) {
+          block_coordinates_cpu[2 * active_block_count + 0] = x * kBlockOutputSizeX;
+          block_coordinates_cpu[2 * active_block_count + 1] = y * kBlockOutputSizeY;
+          ++ active_block_count;
+          *pixel_to_inpaint_count += block_activity[x + y * grid_dim.x];
+        }
       }
     }
   }
-  delete[] block_activity;
+  AddNVTXValue("active blocks", active_block_count);
   if (active_block_count == 0) {
-    delete[] block_coordinates_cpu;
     LOG(INFO) << "Depth inpainting converged after iteration: 0";
+    if (residual) {
+      residual->unconverged_block_fraction = 0;
+    }
     return 0;
   }
   block_coordinates->UploadPartAsync(0, 2 * active_block_count * sizeof(uint16_t), stream, block_coordinates_cpu);
   
-  uint8_t* max_change_cpu = new uint8_t[grid_dim.x * grid_dim.y];
+  uint8_t* max_change_cpu = scratch.Allocate<uint8_t>(grid_dim.x * grid_dim.y);
   
   // Run convolution iterations.
+  int unconverged_block_count = active_block_count;
+  bool deadline_reached = false;
   int i = 0;
   int last_convergence_check_iteration = -9999;
-  for (i = 0; i < max_num_iterations; i += kIterationsPerKernelCall) {
-    const bool check_convergence = (i - last_convergence_check_iteration >= 25);
+  for (i = 0; i < max_num_iterations; i += iterations_per_call) {
+    const bool check_convergence = (i - last_convergence_check_iteration >= kConvergenceCheckInterval);
     
-    dim3 grid_dim_active(active_block_count);
-    CHECK_EQ(kBlockWidth, 32);
-    CHECK_EQ(kBlockHeight, 32);
-    if (use_weighting) {
-      if (check_convergence) {
-        ConvolutionInpaintingKernelWithWeighting<32, 32, true><<<grid_dim_active, block_dim, 0, stream>>>(
-            block_coordinates->ToCUDA(),
-            depth_map_input,
-            gradient_magnitude_div_sqrt2,
-            max_change->ToCUDA(),
-            max_change_rate_threshold,
-            depth_map_output->ToCUDA());
-      } else {
-        ConvolutionInpaintingKernelWithWeighting<32, 32, false><<<grid_dim_active, block_dim, 0, stream>>>(
-            block_coordinates->ToCUDA(),
-            depth_map_input,
-            gradient_magnitude_div_sqrt2,
-            max_change->ToCUDA(),
-            max_change_rate_threshold,
-            depth_map_output->ToCUDA());
-      }
-    } else {
-      if (check_convergence) {
-        ConvolutionInpaintingKernel<32, 32, true><<<grid_dim_active, block_dim, 0, stream>>>(
-            block_coordinates->ToCUDA(),
-            depth_map_input,
-            max_change->ToCUDA(),
-            max_change_rate_threshold,
-            depth_map_output->ToCUDA());
-      } else {
-        ConvolutionInpaintingKernel<32, 32, false><<<grid_dim_active, block_dim, 0, stream>>>(
-            block_coordinates->ToCUDA(),
-            depth_map_input,
-            max_change->ToCUDA(),
-            max_change_rate_threshold,
-            depth_map_output->ToCUDA());
-      }
-    }
+    RunConvolutionInpaintingIteration<block_size, iterations_per_call>(
+        stream, use_weighting, check_convergence, dim3(active_block_count),
+        nullptr, gradient_magnitude_div_sqrt2, depth_map_input,
+        max_change_rate_threshold, max_change, depth_map_output,
+        block_coordinates);
     
     if (check_convergence) {
       max_change->DownloadPartAsync(0, active_block_count * sizeof(uint8_t), stream, max_change_cpu);
@@ -461,19 +895,33 @@ int InpaintDepthMapWithConvolutionCUDA(
           ++ new_active_block_count;
         }
       }
+      unconverged_block_count = new_active_block_count;
       if (new_active_block_count == 0) {
-        i += kIterationsPerKernelCall;  // For correct iteration count logging.
+        i += iterations_per_call;  // For correct iteration count logging.
         break;
       }
       last_convergence_check_iteration = i;
+      if (deadline && deadline->Reached()) {
+        i += iterations_per_call;
+        deadline_reached = true;
+        break;
+      }
     }
   }
   
-  delete[] max_change_cpu;
-  delete[] block_coordinates_cpu;
   CHECK_CUDA_NO_ERROR();
   
-  if (i < max_num_iterations) {
+  if (residual) {
+    residual->unconverged_block_fraction =
+        unconverged_block_count / static_cast<float>(active_block_count);
+    residual->deadline_reached = deadline_reached;
+  }
+  
+  if (deadline_reached) {
+    LOG(INFO) << "Depth inpainting stopped at the deadline after iteration: " << i
+              << " (unconverged blocks: " << unconverged_block_count << " / "
+              << active_block_count << ")";
+  } else if (i < max_num_iterations) {
     LOG(INFO) << "Depth inpainting converged after iteration: " << i;
   } else {
     LOG(WARNING) << "Depth inpainting used maximum iteration count: " << i;
@@ -481,4 +929,50 @@ int InpaintDepthMapWithConvolutionCUDA(
   return i;
 }
 
+int InpaintDepthMapWithConvolutionCUDA(
+    cudaStream_t stream,
+    bool use_weighting,
+    int max_num_iterations,
+    float max_change_rate_threshold,
+    float depth_input_scaling_factor,
+    cudaTextureObject_t gradient_magnitude_div_sqrt2,
+    cudaTextureObject_t depth_map_input,
+    const CUDABuffer<float>* depth_map_initial_guess,
+    const CUDABuffer<uint8_t>* update_tiles,
+    CUDABuffer<uint8_t>* max_change,
+    CUDABuffer<float>* depth_map_output,
+    CUDABuffer<uint16_t>* block_coordinates,
+    uint32_t* pixel_to_inpaint_count,
+    BlockCompactionBuffers* compaction_buffers,
+    bool use_persistent_kernel,
+    const InpaintingDeadline* deadline,
+    InpaintingResidual* residual,
+    HoleMap* hole_map,
+    const ConvolutionInpaintingConfig& config) {
+  NVTXRange range("InpaintDepthMapWithConvolutionCUDA");
+  range.AddValue("block size", config.block_size);
+  int iterations;
+#define INPAINT_WITH_CONFIG(block_size, iterations_per_call)              \
+    iterations = InpaintDepthMapWithConvolutionCUDAImpl<block_size, iterations_per_call>( \
+        stream, use_weighting, max_num_iterations, max_change_rate_threshold, \
+        depth_input_scaling_factor, gradient_magnitude_div_sqrt2,         \
+        depth_map_input, depth_map_initial_guess, update_tiles, max_change, \
+        depth_map_output, block_coordinates, pixel_to_inpaint_count,      \
+        compaction_buffers, use_persistent_kernel, deadline, residual,    \
+        hole_map)
+  switch (GetConfigIndex(config)) {
+    case 0: INPAINT_WITH_CONFIG(32, 4); break;
+    case 1: INPAINT_WITH_CONFIG(32, 2); break;
+    case 2: INPAINT_WITH_CONFIG(32, 8); break;
+    case 3: INPAINT_WITH_CONFIG(16, 2); break;
+    default: INPAINT_WITH_CONFIG(16, 4); break;
+  }
+#undef INPAINT_WITH_CONFIG
+  // Without synchronization with the host, these are the enqueued iterations
+  // and no pixel count.
+  range.AddValue("iterations", iterations);
+  range.AddValue("pixels to inpaint", *pixel_to_inpaint_count);
+  return iterations;
+}
+
 }
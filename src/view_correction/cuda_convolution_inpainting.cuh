@@ -29,14 +29,98 @@
 #ifndef VIEW_CORRECTION_CUDA_CONVOLUTION_INPAINTING_CUH_
 #define VIEW_CORRECTION_CUDA_CONVOLUTION_INPAINTING_CUH_
 
+#include <vector>
+
 #include <cuda_runtime.h>
 
+#include "view_correction/cuda_block_compaction.cuh"
 #include "view_correction/cuda_buffer.h"
+#include "view_correction/cuda_hole_map.cuh"
+#include "view_correction/cuda_util.h"
+#include "view_correction/inpainting_deadline.h"
 
 namespace view_correction {
 
+// Kernel configuration of InpaintDepthMapWithConvolutionCUDA(): the side
+// length of the square thread blocks and the number of iterations which each
+// kernel call runs on them. The blocks overlap by iterations_per_call pixels
+// on each side, so more iterations per call need fewer launches (or grid
+// barriers) but recompute more pixels. The best trade-off depends on the GPU,
+// see InpaintingAutotuner.
+struct ConvolutionInpaintingConfig {
+  ConvolutionInpaintingConfig()
+      : block_size(32), iterations_per_call(4) {}
+  
+  ConvolutionInpaintingConfig(int block_size, int iterations_per_call)
+      : block_size(block_size), iterations_per_call(iterations_per_call) {}
+  
+  inline bool operator==(const ConvolutionInpaintingConfig& other) const {
+    return block_size == other.block_size &&
+           iterations_per_call == other.iterations_per_call;
+  }
+  
+  int block_size;
+  int iterations_per_call;
+};
+
+// Returns the configurations for which the kernels are instantiated. The first
+// one is the default configuration.
+const std::vector<ConvolutionInpaintingConfig>& GetConvolutionInpaintingConfigs();
+
+// Returns the number of blocks into which InpaintDepthMapWithConvolutionCUDA()
+// (with any configuration) and InpaintImageWithConvolutionCUDA() divide an
+// image of the given size at most (for allocating BlockCompactionBuffers).
+int GetConvolutionInpaintingBlockCount(int width, int height);
+
+// Returns the number of blocks into which InpaintDepthMapWithConvolutionCUDA()
+// with the given configuration divides an image of the given size. For
+// allocating BlockCompactionBuffers which are only used with this
+// configuration (InpaintImageWithConvolutionCUDA() uses the blocks of the
+// default configuration).
+int GetConvolutionInpaintingBlockCount(
+    int width, int height, const ConvolutionInpaintingConfig& config);
+
+// Returns the theoretical occupancy of the inpainting kernel which is used by
+// InpaintDepthMapWithConvolutionCUDA() (for benchmarking).
+KernelOccupancy GetConvolutionInpaintingKernelOccupancy(
+    bool use_weighting, bool use_persistent_kernel,
+    const ConvolutionInpaintingConfig& config = ConvolutionInpaintingConfig());
+
 // Returns the number of iterations done.
 // Pixels with input_depth == 0 will be inpainted.
+// If depth_map_initial_guess is not null, the pixels to inpaint start from its
+// values instead of zero (pixels with a guess <= 0 still start uninitialized).
+// This warm start, e.g., with the reprojected solution of the previous frame,
+// lets the iterations converge much earlier.
+// If update_tiles is not null, it must contain one flag for each 32x32 pixel
+// tile of the image (in row-major order, with the number of tiles in each
+// dimension rounded up). Only the pixels in tiles with a non-zero flag are then
+// initialized from the input, and only the blocks which contain pixels to
+// inpaint in these tiles are iterated. All other pixels keep the result of the
+// previous call in depth_map_output, which thus must not have been modified in
+// between.
+// If compaction_buffers is not null, the function runs without synchronizing
+// with the host. It then returns the number of enqueued iterations and sets
+// pixel_to_inpaint_count to zero. The actual statistics can be retrieved
+// with compaction_buffers->DownloadStatistics() later.
+// If use_persistent_kernel is true (which requires compaction_buffers), all
+// iterations run in a single kernel launch whose thread blocks stay resident
+// and synchronize with a grid barrier, instead of launching a kernel for each
+// few iterations.
+// If deadline is not null, the iterations are limited to the ones which fit
+// into the remaining time if the deadline has a cost estimate, and the
+// host-synchronized variant also stops at the first convergence check after
+// the deadline (see inpainting_deadline.h). If residual is not null, it is set
+// to the convergence state at the end (which is not available without
+// synchronizing with the host).
+// If hole_map is not null, it must describe the depth holes of
+// depth_map_input. The initialization of the blocks without holes then only
+// copies their input to depth_map_output (which the iterations of neighboring
+// blocks and the result read) and skips the counting of their pixels to
+// inpaint, and the host-synchronized variant selects the active blocks from
+// the map instead of downloading the block activities (unless update_tiles is
+// given).
+// config must be one of GetConvolutionInpaintingConfigs().
 int InpaintDepthMapWithConvolutionCUDA(
     cudaStream_t stream,
     bool use_weighting,
@@ -45,10 +129,18 @@ int InpaintDepthMapWithConvolutionCUDA(
     float depth_input_scaling_factor,
     cudaTextureObject_t gradient_magnitude_div_sqrt2,
     cudaTextureObject_t depth_map_input,
+    const CUDABuffer<float>* depth_map_initial_guess,
+    const CUDABuffer<uint8_t>* update_tiles,
     CUDABuffer<uint8_t>* max_change,
     CUDABuffer<float>* depth_map_output,
     CUDABuffer<uint16_t>* block_coordinates,
-    uint32_t* pixel_to_inpaint_count);
+    uint32_t* pixel_to_inpaint_count,
+    BlockCompactionBuffers* compaction_buffers,
+    bool use_persistent_kernel,
+    const InpaintingDeadline* deadline,
+    InpaintingResidual* residual,
+    HoleMap* hole_map,
+    const ConvolutionInpaintingConfig& config = ConvolutionInpaintingConfig());
 
 } // namespace view_correction
 
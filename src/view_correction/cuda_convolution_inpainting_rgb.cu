@@ -31,8 +31,12 @@
 #include <cub/cub.cuh>
 #include <glog/logging.h>
 
+#include "view_correction/cuda_block_compaction.cuh"
+#include "view_correction/cuda_hole_map.cuh"
 #include "view_correction/cuda_util.h"
 #include "view_correction/helper_math.h"
+#include "view_correction/host_scratch_arena.h"
+#include "view_correction/nvtx_range.h"
 
 namespace view_correction {
 
@@ -47,6 +51,8 @@ template<int block_size_x, int block_size_y>
 __global__ void RGBConvolutionInpaintingInitializeVariablesKernel(
     int grid_dim_x,
     CUDABuffer_<uchar4> input,
+    CUDABuffer_<uchar4> initial_guess,
+    HoleMap_ hole_map,
     CUDABuffer_<uchar4> output,
     CUDABuffer_<uint16_t> block_coordinates) {
   const int width = output.width();
@@ -67,13 +73,36 @@ __global__ void RGBConvolutionInpaintingInitializeVariablesKernel(
   
   bool thread_is_active = false;
   if (kOutput) {
-    output(y, x) = input(y, x);
-    thread_is_active = (input(y, x).w == 0);
+    const uchar4 input_color = input(y, x);
+    thread_is_active = (input_color.w == 0);
+    uchar4 initial_value = input_color;
+    if (thread_is_active && initial_guess.address() != nullptr) {
+      // Pixels with guess.w != 0 are treated as initialized by the iterations.
+      // The pixel remains a pixel to inpaint since this is determined from
+      // the input.
+      const uchar4 guess = initial_guess(y, x);
+      if (guess.w != 0) {
+        initial_value = guess;
+      }
+    }
+    output(y, x) = initial_value;
   }
   
   typedef cub::BlockReduce<
       int, block_size_x, cub::BLOCK_REDUCE_WARP_REDUCTIONS, block_size_y> BlockReduceInt;
   __shared__ typename BlockReduceInt::TempStorage int_storage;
+  // Blocks without holes in their output skip the reduction, see
+  // ConvolutionInpaintingInitializeVariablesKernel().
+  if (!hole_map.MayContainHoles(
+          kColorHoleMap,
+          blockIdx.x * kBlockOutputSizeX, blockIdx.y * kBlockOutputSizeY,
+          (blockIdx.x + 1) * kBlockOutputSizeX - 1,
+          (blockIdx.y + 1) * kBlockOutputSizeY - 1)) {
+    if (threadIdx.x == 0 && threadIdx.y == 0) {
+      block_coordinates(0, blockIdx.x + blockIdx.y * grid_dim_x) = 0;
+    }
+    return;
+  }
   int num_active_threads = BlockReduceInt(int_storage).Sum(thread_is_active ? 1 : 0);
   if (threadIdx.x == 0 && threadIdx.y == 0) {
     block_coordinates(0, blockIdx.x + blockIdx.y * grid_dim_x) = num_active_threads;
@@ -88,13 +117,20 @@ __forceinline__ __device__ uchar4 float4ToUchar4(const float4& input) {
   return make_uchar4(input.x, input.y, input.z, input.w);
 }
 
+// If active_block_count is not null, the grid may contain more blocks than
+// there are active blocks, and blocks beyond the active count return early.
 template<int block_size_x, int block_size_y, bool check_convergence>
 __global__ void RGBConvolutionInpaintingKernel(
+    const int* active_block_count,
     CUDABuffer_<uint16_t> block_coordinates,
     CUDABuffer_<uchar4> input,
     CUDABuffer_<uint8_t> max_change,
     float max_change_rate_threshold,
     CUDABuffer_<uchar4> output) {
+  if (active_block_count && blockIdx.x >= *active_block_count) {
+    return;
+  }
+  
   const int x = max(0, min(output.width() - 1, block_coordinates(0, 2 * blockIdx.x + 0) + threadIdx.x - kIterationsPerKernelCall));
   const int y = max(0, min(output.height() - 1, block_coordinates(0, 2 * blockIdx.x + 1) + threadIdx.y - kIterationsPerKernelCall));
   
@@ -221,12 +257,17 @@ template<int block_size_x, int block_size_y, bool check_convergence>
 __global__ void
 __launch_bounds__(32*32, 1)
 RGBConvolutionInpaintingKernelWithWeighting(
+    const int* active_block_count,
     CUDABuffer_<uint16_t> block_coordinates,
     CUDABuffer_<uchar4> input,
     cudaTextureObject_t gradient_magnitude_div_sqrt2,
     CUDABuffer_<uint8_t> max_change,
     float max_change_rate_threshold,
     CUDABuffer_<uchar4> output) {
+  if (active_block_count && blockIdx.x >= *active_block_count) {
+    return;
+  }
+  
   __shared__ float4 color_shared[block_size_x * block_size_y];
   __shared__ float weights_shared[block_size_x * block_size_y];
   
@@ -375,6 +416,76 @@ RGBConvolutionInpaintingKernelWithWeighting(
   }
 }
 
+KernelOccupancy GetRGBConvolutionInpaintingKernelOccupancy(bool use_weighting) {
+  const int block_size = kBlockWidth * kBlockHeight;
+  if (use_weighting) {
+    return cuda_util::ComputeKernelOccupancy(
+        RGBConvolutionInpaintingKernelWithWeighting<32, 32, false>, block_size, 0);
+  } else {
+    return cuda_util::ComputeKernelOccupancy(
+        RGBConvolutionInpaintingKernel<32, 32, false>, block_size, 0);
+  }
+}
+
+// Runs kIterationsPerKernelCall iterations on the blocks given by
+// block_coordinates.
+static void RunRGBConvolutionInpaintingIteration(
+    cudaStream_t stream,
+    bool use_weighting,
+    bool check_convergence,
+    const dim3& grid_dim_active,
+    const int* active_block_count,
+    cudaTextureObject_t gradient_magnitude_div_sqrt2,
+    const CUDABuffer<uchar4>& input,
+    float max_change_rate_threshold,
+    CUDABuffer<uint8_t>* max_change,
+    CUDABuffer<uchar4>* output,
+    CUDABuffer<uint16_t>* block_coordinates) {
+  const dim3 block_dim(kBlockWidth, kBlockHeight);
+  CHECK_EQ(kBlockWidth, 32);
+  CHECK_EQ(kBlockHeight, 32);
+  if (use_weighting) {
+    if (check_convergence) {
+      RGBConvolutionInpaintingKernelWithWeighting<32, 32, true><<<grid_dim_active, block_dim, 0, stream>>>(
+          active_block_count,
+          block_coordinates->ToCUDA(),
+          input.ToCUDA(),
+          gradient_magnitude_div_sqrt2,
+          max_change->ToCUDA(),
+          max_change_rate_threshold,
+          output->ToCUDA());
+    } else {
+      RGBConvolutionInpaintingKernelWithWeighting<32, 32, false><<<grid_dim_active, block_dim, 0, stream>>>(
+          active_block_count,
+          block_coordinates->ToCUDA(),
+          input.ToCUDA(),
+          gradient_magnitude_div_sqrt2,
+          max_change->ToCUDA(),
+          max_change_rate_threshold,
+          output->ToCUDA());
+    }
+  } else {
+    if (check_convergence) {
+      RGBConvolutionInpaintingKernel<32, 32, true><<<grid_dim_active, block_dim, 0, stream>>>(
+          active_block_count,
+          block_coordinates->ToCUDA(),
+          input.ToCUDA(),
+          max_change->ToCUDA(),
+          max_change_rate_threshold,
+          output->ToCUDA());
+    } else {
+      RGBConvolutionInpaintingKernel<32, 32, false><<<grid_dim_active, block_dim, 0, stream>>>(
+          active_block_count,
+          block_coordinates->ToCUDA(),
+          input.ToCUDA(),
+          max_change->ToCUDA(),
+          max_change_rate_threshold,
+          output->ToCUDA());
+    }
+  }
+  CHECK_CUDA_NO_ERROR();
+}
+
 int InpaintImageWithConvolutionCUDA(
     cudaStream_t stream,
     bool use_weighting,
@@ -382,12 +493,25 @@ int InpaintImageWithConvolutionCUDA(
     float max_change_rate_threshold,
     cudaTextureObject_t gradient_magnitude_div_sqrt2,
     const CUDABuffer<uchar4>& input,
+    const CUDABuffer<uchar4>* initial_guess,
     CUDABuffer<uint8_t>* max_change,
     CUDABuffer<uchar4>* output,
     CUDABuffer<uint16_t>* block_coordinates,
-    uint32_t* pixel_to_inpaint_count) {
+    uint32_t* pixel_to_inpaint_count,
+    BlockCompactionBuffers* compaction_buffers,
+    const InpaintingDeadline* deadline,
+    InpaintingResidual* residual,
+    HoleMap* hole_map) {
+  NVTXRange range("InpaintImageWithConvolutionCUDA");
   const int width = output->width();
   const int height = output->height();
+  if (deadline) {
+    max_num_iterations = deadline->LimitIterations(
+        max_num_iterations, 25);
+  }
+  if (residual) {
+    *residual = InpaintingResidual();
+  }
   
   const dim3 block_dim(kBlockWidth, kBlockHeight);
   
@@ -400,79 +524,100 @@ int InpaintImageWithConvolutionCUDA(
   CHECK_EQ(kBlockWidth, 32);
   CHECK_EQ(kBlockHeight, 32);
   RGBConvolutionInpaintingInitializeVariablesKernel<32, 32><<<grid_dim, block_dim, 0, stream>>>(
-      grid_dim.x, input.ToCUDA(), output->ToCUDA(), block_coordinates->ToCUDA());
+      grid_dim.x, input.ToCUDA(),
+      initial_guess ? initial_guess->ToCUDA() : CUDABuffer_<uchar4>(),
+      hole_map ? hole_map->ToCUDA() : HoleMap_(),
+      output->ToCUDA(), block_coordinates->ToCUDA());
   CHECK_CUDA_NO_ERROR();
   
-  uint16_t* block_activity = new uint16_t[grid_dim.x * grid_dim.y];
-  block_coordinates->DownloadPartAsync(0, grid_dim.x * grid_dim.y * sizeof(uint16_t), stream, block_activity);
-  cudaStreamSynchronize(stream);
+  if (compaction_buffers) {
+    // Select the active blocks and check for convergence on the GPU, see
+    // InpaintDepthMapWithConvolutionCUDA().
+    const int block_count = grid_dim.x * grid_dim.y;
+    SelectActiveBlocksCUDA(stream, grid_dim.x, grid_dim.y, kBlockOutputSizeX,
+                           kBlockOutputSizeY, block_coordinates,
+                           compaction_buffers);
+    const int* active_block_count = ActiveBlockCountPointer(compaction_buffers);
+    
+    int i = 0;
+    int last_convergence_check_iteration = -9999;
+    for (i = 0; i < max_num_iterations; i += kIterationsPerKernelCall) {
+      const bool check_convergence = (i - last_convergence_check_iteration >= 25);
+      if (check_convergence) {
+        CUDA_CHECKED_CALL(cudaMemsetAsync(max_change->ToCUDA().address(), 0,
+                                          block_count * sizeof(uint8_t), stream));
+      }
+      
+      RunRGBConvolutionInpaintingIteration(
+          stream, use_weighting, check_convergence, dim3(block_count),
+          active_block_count, gradient_magnitude_div_sqrt2, input,
+          max_change_rate_threshold, max_change, output, block_coordinates);
+      
+      if (check_convergence) {
+        UpdateBlockConvergenceCUDA(stream, i + kIterationsPerKernelCall,
+                                   block_count, *max_change,
+                                   compaction_buffers);
+        last_convergence_check_iteration = i;
+      }
+    }
+    
+    // The actual statistics are only available on the GPU.
+    *pixel_to_inpaint_count = 0;
+    range.AddValue("iterations", i);
+    return i;
+  }
+  
+  // Temporary host arrays, reused between calls.
+  HostScratchScope scratch;
   int active_block_count = 0;
   *pixel_to_inpaint_count = 0;
-  uint16_t* block_coordinates_cpu = new uint16_t[2 * grid_dim.x * grid_dim.y];
-  for (size_t y = 0; y < grid_dim.y; ++ y) {
-    for (size_t x = 0; x < grid_dim.x; ++ x) {
-      if (block_activity[x + y * grid_dim.x] > 0) {
-        block_coordinates_cpu[2 * active_block_count + 0] = x * kBlockOutputSizeX;
-        block_coordinates_cpu[2 * active_block_count + 1] = y * kBlockOutputSizeY;
-        ++ active_block_count;
-        *pixel_to_inpaint_count += block_activity[x + y * grid_dim.x];
+  uint16_t* block_coordinates_cpu = scratch.Allocate<uint16_t>(2 * grid_dim.x * grid_dim.y);
+  if (hole_map) {
+    // If the depth inpainting used the same hole map, this does not
+    // synchronize with the stream.
+    active_block_count = hole_map->SelectActiveBlocks(
+        stream, kColorHoleMap, kBlockOutputSizeX, kBlockOutputSizeY, 0,
+        grid_dim.x, grid_dim.y, block_coordinates_cpu, pixel_to_inpaint_count);
+  } else {
+    uint16_t* block_activity = scratch.Allocate<uint16_t>(grid_dim.x * grid_dim.y);
+    block_coordinates->DownloadPartAsync(0, grid_dim.x * grid_dim.y * sizeof(uint16_t), stream, block_activity);
+    cudaStreamSynchronize(stream);
+    for (size_t y = 0; y < grid_dim.y; ++ y) {
+      for (size_t x = 0; x < grid_dim.x; ++ x) {
+        if (block_activity[x + y * grid_dim.x] > 0) {
+          block_coordinates_cpu[2 * active_block_count + 0] = x * kBlockOutputSizeX;
+          block_coordinates_cpu[2 * active_block_count + 1] = y * kBlockOutputSizeY;
+          ++ active_block_count;
+          *pixel_to_inpaint_count += block_activity[x + y * grid_dim.x];
+        }
       }
     }
   }
-  delete[] block_activity;
+  range.AddValue("active blocks", active_block_count);
+  range.AddValue("pixels to inpaint", *pixel_to_inpaint_count);
   if (active_block_count == 0) {
-    delete[] block_coordinates_cpu;
     LOG(INFO) << "Color inpainting converged after iteration: 0";
+    if (residual) {
+      residual->unconverged_block_fraction = 0;
+    }
     return 0;
   }
   block_coordinates->UploadPartAsync(0, 2 * active_block_count * sizeof(uint16_t), stream, block_coordinates_cpu);
   
-  uint8_t* max_change_cpu = new uint8_t[grid_dim.x * grid_dim.y];
+  uint8_t* max_change_cpu = scratch.Allocate<uint8_t>(grid_dim.x * grid_dim.y);
   
   // Run convolution iterations.
+  int unconverged_block_count = active_block_count;
+  bool deadline_reached = false;
   int i = 0;
   int last_convergence_check_iteration = -9999;
   for (i = 0; i < max_num_iterations; i += kIterationsPerKernelCall) {
     const bool check_convergence = (i - last_convergence_check_iteration >= 25);
     
-    dim3 grid_dim_active(active_block_count);
-    CHECK_EQ(kBlockWidth, 32);
-    CHECK_EQ(kBlockHeight, 32);
-    if (use_weighting) {
-      if (check_convergence) {
-        RGBConvolutionInpaintingKernelWithWeighting<32, 32, true><<<grid_dim_active, block_dim, 0, stream>>>(
-            block_coordinates->ToCUDA(),
-            input.ToCUDA(),
-            gradient_magnitude_div_sqrt2,
-            max_change->ToCUDA(),
-            max_change_rate_threshold,
-            output->ToCUDA());
-      } else {
-        RGBConvolutionInpaintingKernelWithWeighting<32, 32, false><<<grid_dim_active, block_dim, 0, stream>>>(
-            block_coordinates->ToCUDA(),
-            input.ToCUDA(),
-            gradient_magnitude_div_sqrt2,
-            max_change->ToCUDA(),
-            max_change_rate_threshold,
-            output->ToCUDA());
-      }
-    } else {
-      if (check_convergence) {
-        RGBConvolutionInpaintingKernel<32, 32, true><<<grid_dim_active, block_dim, 0, stream>>>(
-            block_coordinates->ToCUDA(),
-            input.ToCUDA(),
-            max_change->ToCUDA(),
-            max_change_rate_threshold,
-            output->ToCUDA());
-      } else {
-        RGBConvolutionInpaintingKernel<32, 32, false><<<grid_dim_active, block_dim, 0, stream>>>(
-            block_coordinates->ToCUDA(),
-            input.ToCUDA(),
-            max_change->ToCUDA(),
-            max_change_rate_threshold,
-            output->ToCUDA());
-      }
-    }
+    RunRGBConvolutionInpaintingIteration(
+        stream, use_weighting, check_convergence, dim3(active_block_count),
+        nullptr, gradient_magnitude_div_sqrt2, input,
+        max_change_rate_threshold, max_change, output, block_coordinates);
     
     if (check_convergence) {
       max_change->DownloadPartAsync(0, active_block_count * sizeof(uint8_t), stream, max_change_cpu);
@@ -483,23 +628,38 @@ int InpaintImageWithConvolutionCUDA(
           ++ new_active_block_count;
         }
       }
+      unconverged_block_count = new_active_block_count;
       if (new_active_block_count == 0) {
         i += kIterationsPerKernelCall;  // For correct iteration count logging.
         break;
       }
       last_convergence_check_iteration = i;
+      if (deadline && deadline->Reached()) {
+        i += kIterationsPerKernelCall;
+        deadline_reached = true;
+        break;
+      }
     }
   }
   
-  delete[] max_change_cpu;
-  delete[] block_coordinates_cpu;
   CHECK_CUDA_NO_ERROR();
   
-  if (i < max_num_iterations) {
+  if (residual) {
+    residual->unconverged_block_fraction =
+        unconverged_block_count / static_cast<float>(active_block_count);
+    residual->deadline_reached = deadline_reached;
+  }
+  
+  if (deadline_reached) {
+    LOG(INFO) << "Color inpainting stopped at the deadline after iteration: " << i
+              << " (unconverged blocks: " << unconverged_block_count << " / "
+              << active_block_count << ")";
+  } else if (i < max_num_iterations) {
     LOG(INFO) << "Color inpainting converged after iteration: " << i;
   } else {
     LOG(WARNING) << "Color inpainting used maximum iteration count: " << i;
   }
+  range.AddValue("iterations", i);
   return i;
 }
 
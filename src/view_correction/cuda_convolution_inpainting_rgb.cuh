@@ -31,12 +31,28 @@
 
 #include <cuda_runtime.h>
 
+#include "view_correction/cuda_block_compaction.cuh"
 #include "view_correction/cuda_buffer.h"
+#include "view_correction/cuda_hole_map.cuh"
+#include "view_correction/cuda_util.h"
+#include "view_correction/inpainting_deadline.h"
 
 namespace view_correction {
 
+// Returns the theoretical occupancy of the inpainting kernel which is used by
+// InpaintImageWithConvolutionCUDA() (for benchmarking).
+KernelOccupancy GetRGBConvolutionInpaintingKernelOccupancy(bool use_weighting);
+
 // Returns the number of iterations done.
 // Pixels with input.w == 0 will be inpainted.
+// If initial_guess is not null, the pixels to inpaint which have
+// initial_guess.w != 0 start from its colors (see
+// InpaintDepthMapWithConvolutionCUDA()).
+// If compaction_buffers is not null, runs without synchronizing with the host,
+// see InpaintDepthMapWithConvolutionCUDA(). The deadline and residual are
+// handled as in InpaintDepthMapWithConvolutionCUDA(). If hole_map is not
+// null, it must describe the color holes of input and is used as in
+// InpaintDepthMapWithConvolutionCUDA().
 int InpaintImageWithConvolutionCUDA(
     cudaStream_t stream,
     bool use_weighting,
@@ -44,10 +60,15 @@ int InpaintImageWithConvolutionCUDA(
     float max_change_rate_threshold,
     cudaTextureObject_t gradient_magnitude_div_sqrt2,
     const CUDABuffer<uchar4>& input,
+    const CUDABuffer<uchar4>* initial_guess,
     CUDABuffer<uint8_t>* max_change,
     CUDABuffer<uchar4>* output,
     CUDABuffer<uint16_t>* block_coordinates,
-    uint32_t* pixel_to_inpaint_count);
+    uint32_t* pixel_to_inpaint_count,
+    BlockCompactionBuffers* compaction_buffers,
+    const InpaintingDeadline* deadline,
+    InpaintingResidual* residual,
+    HoleMap* hole_map);
 
 } // namespace view_correction
 
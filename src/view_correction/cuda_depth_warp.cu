@@ -0,0 +1,237 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "view_correction/cuda_depth_warp.cuh"
+
+#include <glog/logging.h>
+
+#include "view_correction/helper_math.h"
+
+namespace view_correction {
+
+// Number of triangles per thread block of WarpMeshDepthCUDAKernel().
+constexpr int kWarpBlockSize = 256;
+
+// Z-buffer value of pixels without geometry.
+constexpr unsigned long long kEmptyZBufferValue = 0xffffffffffffffffull;
+
+__device__ __forceinline__ float3 TransformPoint(
+    const CUDAMatrix3x4& T, const float3& p) {
+  return make_float3(
+      T.row0.x * p.x + T.row0.y * p.y + T.row0.z * p.z + T.row0.w,
+      T.row1.x * p.x + T.row1.y * p.y + T.row1.z * p.z + T.row1.w,
+      T.row2.x * p.x + T.row2.y * p.y + T.row2.z * p.z + T.row2.w);
+}
+
+// Returns twice the signed area of the triangle (a, b, p).
+__device__ __forceinline__ float EdgeFunction(
+    const float2& a, const float2& b, const float2& p) {
+  return (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x);
+}
+
+__global__ void WarpMeshDepthCUDAKernel(
+    const float* vertex_buffer,
+    const uint8_t* color_buffer,
+    const uint32_t* index_buffer,
+    int num_triangles,
+    bool triangle_strip,
+    CUDAMatrix3x4 target_T_src,
+    float fx, float fy, float cx, float cy,
+    float min_depth, float max_depth,
+    CUDABuffer_<uint2> z_buffer) {
+  const int triangle = blockIdx.x * blockDim.x + threadIdx.x;
+  if (triangle >= num_triangles) {
+    return;
+  }
+  
+  const int first_index = triangle_strip ? triangle : (3 * triangle);
+  const uint32_t indices[3] = {index_buffer[first_index + 0],
+                               index_buffer[first_index + 1],
+                               index_buffer[first_index + 2]};
+  if (indices[0] == indices[1] || indices[1] == indices[2] ||
+      indices[0] == indices[2]) {
+    // Degenerate triangle (e.g., in the triangle strip).
+    return;
+  }
+  
+  float2 pixel[3];
+  float inv_depth[3];
+  float intensity[3];
+  for (int i = 0; i < 3; ++ i) {
+    const float3 src_point = make_float3(vertex_buffer[3 * indices[i] + 0],
+                                         vertex_buffer[3 * indices[i] + 1],
+                                         vertex_buffer[3 * indices[i] + 2]);
+    const float3 point = TransformPoint(target_T_src, src_point);
+    if (!(point.z >= min_depth && point.z <= max_depth)) {
+      return;
+    }
+    inv_depth[i] = 1.f / point.z;
+    pixel[i] = make_float2(fx * point.x * inv_depth[i] + cx,
+                           fy * point.y * inv_depth[i] + cy);
+    intensity[i] = color_buffer[indices[i]];
+  }
+  
+  const float area = EdgeFunction(pixel[0], pixel[1], pixel[2]);
+  if (area == 0) {
+    return;
+  }
+  const float inv_area = 1.f / area;
+  
+  // Pixel centers within the triangle bounding box.
+  const int width = z_buffer.width();
+  const int height = z_buffer.height();
+  const int min_x = ::max(0, static_cast<int>(ceilf(fminf(pixel[0].x, fminf(pixel[1].x, pixel[2].x)))));
+  const int min_y = ::max(0, static_cast<int>(ceilf(fminf(pixel[0].y, fminf(pixel[1].y, pixel[2].y)))));
+  const int max_x = ::min(width - 1, static_cast<int>(floorf(fmaxf(pixel[0].x, fmaxf(pixel[1].x, pixel[2].x)))));
+  const int max_y = ::min(height - 1, static_cast<int>(floorf(fmaxf(pixel[0].y, fmaxf(pixel[1].y, pixel[2].y)))));
+  
+  for (int y = min_y; y <= max_y; ++ y) {
+    for (int x = min_x; x <= max_x; ++ x) {
+      const float2 p = make_float2(x, y);
+      // Barycentric coordinates, positive inside for both orientations.
+      const float b0 = EdgeFunction(pixel[1], pixel[2], p) * inv_area;
+      const float b1 = EdgeFunction(pixel[2], pixel[0], p) * inv_area;
+      const float b2 = 1.f - b0 - b1;
+      if (b0 < 0 || b1 < 0 || b2 < 0) {
+        continue;
+      }
+      
+      // Perspective-correct interpolation.
+      const float w0 = b0 * inv_depth[0];
+      const float w1 = b1 * inv_depth[1];
+      const float w2 = b2 * inv_depth[2];
+      const float depth = 1.f / (w0 + w1 + w2);
+      const float interpolated_intensity =
+          depth * (w0 * intensity[0] + w1 * intensity[1] + w2 * intensity[2]);
+      
+      // Positive floats compare like their bit patterns.
+      const unsigned long long value =
+          (static_cast<unsigned long long>(__float_as_uint(depth)) << 32) |
+          ((interpolated_intensity > 0) ? 255u : 0u);
+      atomicMin(reinterpret_cast<unsigned long long*>(&z_buffer(y, x)), value);
+    }
+  }
+}
+
+__global__ void ResolveZBufferCUDAKernel(
+    CUDABuffer_<uint2> z_buffer,
+    CUDABuffer_<float> depth_output,
+    CUDABuffer_<uint8_t> intensity_output) {
+  const int x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+  if (x < z_buffer.width() && y < z_buffer.height()) {
+    // .x holds the lower and .y the upper 32 bits.
+    const uint2 value = z_buffer(y, x);
+    const bool empty = (value.x == 0xffffffffu && value.y == 0xffffffffu);
+    depth_output(y, x) = empty ? 0.f : __uint_as_float(value.y);
+    intensity_output(y, x) = empty ? 0 : value.x;
+  }
+}
+
+void WarpMeshDepthCUDA(
+    cudaStream_t stream,
+    const float* vertex_buffer,
+    const uint8_t* color_buffer,
+    const uint32_t* index_buffer,
+    int num_indices,
+    bool triangle_strip,
+    const CUDAMatrix3x4& target_T_src,
+    float fx, float fy, float cx, float cy,
+    float min_depth, float max_depth,
+    CUDABuffer<uint2>* z_buffer,
+    CUDABuffer<float>* depth_output,
+    CUDABuffer<uint8_t>* intensity_output) {
+  CHECK_EQ(z_buffer->width(), depth_output->width());
+  CHECK_EQ(z_buffer->height(), depth_output->height());
+  CHECK_EQ(z_buffer->width(), intensity_output->width());
+  CHECK_EQ(z_buffer->height(), intensity_output->height());
+  
+  z_buffer->Clear(make_uint2(static_cast<unsigned int>(kEmptyZBufferValue),
+                             static_cast<unsigned int>(kEmptyZBufferValue >> 32)),
+                  stream);
+  
+  const int num_triangles =
+      triangle_strip ? ::max(0, num_indices - 2) : (num_indices / 3);
+  if (num_triangles > 0) {
+    WarpMeshDepthCUDAKernel<<<cuda_util::GetBlockCount(num_triangles, kWarpBlockSize),
+                              kWarpBlockSize, 0, stream>>>(
+        vertex_buffer, color_buffer, index_buffer, num_triangles,
+        triangle_strip, target_T_src, fx, fy, cx, cy, min_depth, max_depth,
+        z_buffer->ToCUDA());
+    CHECK_CUDA_NO_ERROR();
+  }
+  
+  constexpr int kBlockWidth = 32;
+  constexpr int kBlockHeight = 8;
+  const dim3 grid_dim(cuda_util::GetBlockCount(z_buffer->width(), kBlockWidth),
+                      cuda_util::GetBlockCount(z_buffer->height(), kBlockHeight));
+  const dim3 block_dim(kBlockWidth, kBlockHeight);
+  ResolveZBufferCUDAKernel<<<grid_dim, block_dim, 0, stream>>>(
+      z_buffer->ToCUDA(), depth_output->ToCUDA(), intensity_output->ToCUDA());
+  CHECK_CUDA_NO_ERROR();
+}
+
+void WarpMeshDepthCUDA(
+    cudaStream_t stream,
+    cudaGraphicsResource_t vertex_buffer,
+    cudaGraphicsResource_t color_buffer,
+    cudaGraphicsResource_t index_buffer,
+    int num_indices,
+    bool triangle_strip,
+    const CUDAMatrix3x4& target_T_src,
+    float fx, float fy, float cx, float cy,
+    float min_depth, float max_depth,
+    CUDABuffer<uint2>* z_buffer,
+    CUDABuffer<float>* depth_output,
+    CUDABuffer<uint8_t>* intensity_output) {
+  cudaGraphicsResource_t resources[3] = {vertex_buffer, color_buffer, index_buffer};
+  CUDA_CHECKED_CALL(cudaGraphicsMapResources(3, resources, stream));
+  void* pointers[3];
+  for (int i = 0; i < 3; ++ i) {
+    size_t size;
+    CUDA_CHECKED_CALL(cudaGraphicsResourceGetMappedPointer(
+        &pointers[i], &size, resources[i]));
+  }
+  
+  WarpMeshDepthCUDA(
+      stream,
+      static_cast<const float*>(pointers[0]),
+      static_cast<const uint8_t*>(pointers[1]),
+      static_cast<const uint32_t*>(pointers[2]),
+      num_indices, triangle_strip, target_T_src, fx, fy, cx, cy,
+      min_depth, max_depth, z_buffer, depth_output, intensity_output);
+  
+  CUDA_CHECKED_CALL(cudaGraphicsUnmapResources(3, resources, stream));
+}
+
+KernelOccupancy GetWarpMeshDepthKernelOccupancy() {
+  return cuda_util::ComputeKernelOccupancy(
+      WarpMeshDepthCUDAKernel, kWarpBlockSize, 0);
+}
+
+}  // namespace view_correction
@@ -0,0 +1,92 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef VIEW_CORRECTION_CUDA_DEPTH_WARP_CUH_
+#define VIEW_CORRECTION_CUDA_DEPTH_WARP_CUH_
+
+#include <cuda_runtime.h>
+
+#include "view_correction/cuda_buffer.h"
+#include "view_correction/cuda_util.h"
+
+namespace view_correction {
+
+// Renders the depth map mesh output by MeshDepthmapCUDA() into the target
+// view with CUDA, as an alternative to MeshRenderer::RenderMesh() which does
+// not need a framebuffer or texture interop. Each thread rasterizes one
+// triangle and writes its pixels with an atomic minimum on a 64-bit z-buffer
+// which holds the depth in the upper and the intensity in the lower 32 bits,
+// such that the nearest triangle wins for both. The results match the OpenGL
+// rendering: the depth is interpolated perspective-correctly, pixels are
+// sampled at their centers (origin-at-pixel-center convention for the
+// intrinsics), the intensity output is 255 where the interpolated vertex
+// intensity is positive and 0 otherwise, and pixels without geometry get depth
+// 0. Triangles with a vertex outside of [min_depth, max_depth] are dropped
+// (instead of being clipped as in OpenGL).
+//
+// The mesh is given by the vertex, color and index buffers as for
+// MeshDepthmapCUDA(). If triangle_strip is true, the indices are a triangle
+// strip (degenerate triangles are skipped), otherwise a triangle list.
+// z_buffer is a scratch buffer of the output size.
+void WarpMeshDepthCUDA(
+    cudaStream_t stream,
+    const float* vertex_buffer,
+    const uint8_t* color_buffer,
+    const uint32_t* index_buffer,
+    int num_indices,
+    bool triangle_strip,
+    const CUDAMatrix3x4& target_T_src,
+    float fx, float fy, float cx, float cy,
+    float min_depth, float max_depth,
+    CUDABuffer<uint2>* z_buffer,
+    CUDABuffer<float>* depth_output,
+    CUDABuffer<uint8_t>* intensity_output);
+
+// Variant of WarpMeshDepthCUDA() which maps the mesh buffers registered from
+// OpenGL for the duration of the call.
+void WarpMeshDepthCUDA(
+    cudaStream_t stream,
+    cudaGraphicsResource_t vertex_buffer,
+    cudaGraphicsResource_t color_buffer,
+    cudaGraphicsResource_t index_buffer,
+    int num_indices,
+    bool triangle_strip,
+    const CUDAMatrix3x4& target_T_src,
+    float fx, float fy, float cx, float cy,
+    float min_depth, float max_depth,
+    CUDABuffer<uint2>* z_buffer,
+    CUDABuffer<float>* depth_output,
+    CUDABuffer<uint8_t>* intensity_output);
+
+// Returns the theoretical occupancy of the rasterization kernel of
+// WarpMeshDepthCUDA().
+KernelOccupancy GetWarpMeshDepthKernelOccupancy();
+
+}  // namespace view_correction
+
+#endif  // VIEW_CORRECTION_CUDA_DEPTH_WARP_CUH_
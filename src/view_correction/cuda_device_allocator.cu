@@ -0,0 +1,172 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "view_correction/cuda_device_allocator.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include <cub/util_allocator.cuh>
+#include <glog/logging.h>
+
+#include "view_correction/cuda_util.h"
+
+namespace view_correction {
+
+namespace {
+
+// Alignment of the memory returned by cudaMalloc(), which the allocator uses.
+constexpr int kCUDAMallocAlignment = 256;
+
+// The cached block sizes are powers of two from 256 bytes to 16 MiB. Larger
+// allocations are not cached.
+constexpr unsigned int kBinGrowth = 2;
+constexpr unsigned int kMinBin = 8;
+constexpr unsigned int kMaxBin = 24;
+constexpr size_t kMaxCachedBytes = 256 * 1024 * 1024;
+
+struct PendingFree {
+  void* allocation;
+  int device;
+  // Recorded on the legacy default stream, which waits for all work enqueued
+  // before on the other (blocking) streams.
+  cudaEvent_t event;
+};
+
+struct DeviceAllocatorState {
+  DeviceAllocatorState()
+      : allocator(kBinGrowth, kMinBin, kMaxBin, kMaxCachedBytes,
+                  /*skip_cleanup*/ true) {}
+  
+  cub::CachingDeviceAllocator allocator;
+  
+  // Protects the members below.
+  std::mutex mutex;
+  // Freed allocations which may still be in use by pending work, in the
+  // order they were freed.
+  std::deque<PendingFree> pending_frees;
+  // Events which are not in use by pending_frees.
+  std::vector<cudaEvent_t> unused_events;
+};
+
+DeviceAllocatorState* GetDeviceAllocatorState() {
+  // Never destroyed, since the CUDA runtime may already be shut down when
+  // static objects are destroyed.
+  static DeviceAllocatorState* state = new DeviceAllocatorState();
+  return state;
+}
+
+// Returns the freed allocations which are not in use anymore to the
+// allocator. Must be called with the state's mutex locked.
+void ReturnCompletedFrees(DeviceAllocatorState* state) {
+  while (!state->pending_frees.empty()) {
+    PendingFree& pending_free = state->pending_frees.front();
+    cudaError_t status = cudaEventQuery(pending_free.event);
+    if (status == cudaErrorNotReady) {
+      break;
+    }
+    CUDA_CHECKED_CALL(status);
+    CUDA_CHECKED_CALL(state->allocator.DeviceFree(
+        pending_free.device, pending_free.allocation));
+    state->unused_events.push_back(pending_free.event);
+    state->pending_frees.pop_front();
+  }
+}
+
+}  // namespace
+
+void GetCUDAPitchedMemoryAlignment(size_t* pitch_alignment,
+                                   size_t* address_alignment) {
+  int device;
+  CUDA_CHECKED_CALL(cudaGetDevice(&device));
+  int value;
+  CUDA_CHECKED_CALL(cudaDeviceGetAttribute(
+      &value, cudaDevAttrTexturePitchAlignment, device));
+  *pitch_alignment = value;
+  CUDA_CHECKED_CALL(cudaDeviceGetAttribute(
+      &value, cudaDevAttrTextureAlignment, device));
+  *address_alignment = value;
+}
+
+void* AllocateCUDAPitchedMemory(size_t width_in_bytes, size_t height,
+                                void** address, size_t* pitch) {
+  int device;
+  CUDA_CHECKED_CALL(cudaGetDevice(&device));
+  size_t pitch_alignment;
+  size_t texture_alignment;
+  GetCUDAPitchedMemoryAlignment(&pitch_alignment, &texture_alignment);
+  
+  *pitch = ((width_in_bytes + pitch_alignment - 1) / pitch_alignment) * pitch_alignment;
+  // Leave space for aligning the start address.
+  const size_t size = height * *pitch +
+      std::max<size_t>(kCUDAMallocAlignment, texture_alignment) -
+      kCUDAMallocAlignment;
+  
+  DeviceAllocatorState* state = GetDeviceAllocatorState();
+  void* allocation;
+  std::unique_lock<std::mutex> lock(state->mutex);
+  ReturnCompletedFrees(state);
+  lock.unlock();
+  CUDA_CHECKED_CALL(state->allocator.DeviceAllocate(
+      device, &allocation, size, /*active_stream*/ 0));
+  
+  const uintptr_t aligned_address =
+      ((reinterpret_cast<uintptr_t>(allocation) + texture_alignment - 1) /
+       texture_alignment) * texture_alignment;
+  *address = reinterpret_cast<void*>(aligned_address);
+  return allocation;
+}
+
+void FreeCUDAPitchedMemory(void* allocation) {
+  if (!allocation) {
+    return;
+  }
+  
+  DeviceAllocatorState* state = GetDeviceAllocatorState();
+  std::lock_guard<std::mutex> lock(state->mutex);
+  
+  PendingFree pending_free;
+  pending_free.allocation = allocation;
+  CUDA_CHECKED_CALL(cudaGetDevice(&pending_free.device));
+  if (state->unused_events.empty()) {
+    CUDA_CHECKED_CALL(cudaEventCreateWithFlags(
+        &pending_free.event, cudaEventDisableTiming));
+  } else {
+    pending_free.event = state->unused_events.back();
+    state->unused_events.pop_back();
+  }
+  CUDA_CHECKED_CALL(cudaEventRecord(pending_free.event, cudaStreamLegacy));
+  state->pending_frees.push_back(pending_free);
+  
+  ReturnCompletedFrees(state);
+}
+
+}  // namespace view_correction
@@ -0,0 +1,65 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef VIEW_CORRECTION_CUDA_DEVICE_ALLOCATOR_H_
+#define VIEW_CORRECTION_CUDA_DEVICE_ALLOCATOR_H_
+
+#include <cstddef>
+
+namespace view_correction {
+
+// Returns the alignment of the pitch and of the start address of the memory
+// returned by AllocateCUDAPitchedMemory() for the current device. Pitched
+// memory which is sub-allocated from a larger allocation must follow these
+// to be usable with textures.
+void GetCUDAPitchedMemoryAlignment(size_t* pitch_alignment,
+                                   size_t* address_alignment);
+
+// Allocates height rows of width_in_bytes bytes of pitched device memory from
+// a process-wide cub::CachingDeviceAllocator, which is used for all
+// CUDABuffer objects. Other than cudaMallocPitch() / cudaFree(), this does
+// not allocate (or synchronize) in the steady state where buffers of similar
+// sizes are freed and allocated again. *address is aligned for binding
+// textures and *pitch is a multiple of the texture pitch alignment. Returns
+// the allocation which must be passed to FreeCUDAPitchedMemory().
+//
+// Thread-safe.
+void* AllocateCUDAPitchedMemory(size_t width_in_bytes, size_t height,
+                                void** address, size_t* pitch);
+
+// Returns memory allocated with AllocateCUDAPitchedMemory() to the cache.
+// Like with cudaFree(), work which is still pending may access the memory;
+// it is only handed out again once all work that was enqueued on the device
+// before this call has completed.
+//
+// Thread-safe.
+void FreeCUDAPitchedMemory(void* allocation);
+
+}  // namespace view_correction
+
+#endif  // VIEW_CORRECTION_CUDA_DEVICE_ALLOCATOR_H_
@@ -0,0 +1,146 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "view_correction/cuda_distortion_lut.cuh"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <glog/logging.h>
+
+#include "view_correction/cuda_util.h"
+
+namespace view_correction {
+
+namespace {
+
+// Number of fixed-point iterations for undistorting the image border.
+constexpr int kUndistortionIterations = 20;
+
+__host__ __device__ __forceinline__ float DistortionFactor(
+    float r2, float k1, float k2, float k3) {
+  return 1.0f + r2 * (k1 + r2 * (k2 + r2 * k3));
+}
+
+// Computes the undistorted normalized coordinates of the distorted normalized
+// coordinates (*x, *y) in place, by fixed-point iteration on
+// x_u = x_d / factor(r_u^2).
+void Undistort(float k1, float k2, float k3, float* x, float* y) {
+  const float distorted_x = *x;
+  const float distorted_y = *y;
+  for (int i = 0; i < kUndistortionIterations; ++ i) {
+    const float r2 = *x * *x + *y * *y;
+    const float factor = DistortionFactor(r2, k1, k2, k3);
+    *x = distorted_x / factor;
+    *y = distorted_y / factor;
+  }
+}
+
+__global__ void ComputeDistortionLUTCUDAKernel(
+    float fx, float fy, float cx, float cy,
+    float k1, float k2, float k3,
+    float min_x, float min_y, float step_x, float step_y,
+    CUDABuffer_<float2> lut) {
+  const int x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+  if (x < lut.width() && y < lut.height()) {
+    const float nx = min_x + x * step_x;
+    const float ny = min_y + y * step_y;
+    const float factor = DistortionFactor(nx * nx + ny * ny, k1, k2, k3);
+    lut(y, x) = make_float2(fx * factor * nx + cx, fy * factor * ny + cy);
+  }
+}
+
+}  // namespace
+
+DistortionLUT::DistortionLUT(
+    cudaStream_t stream, int image_width, int image_height,
+    float fx, float fy, float cx, float cy,
+    float k1, float k2, float k3) {
+  // Find the bounding box of the undistorted image border, which contains the
+  // normalized coordinates of all points that project into the image.
+  float min_x = std::numeric_limits<float>::infinity();
+  float min_y = std::numeric_limits<float>::infinity();
+  float max_x = -std::numeric_limits<float>::infinity();
+  float max_y = -std::numeric_limits<float>::infinity();
+  auto add_border_pixel = [&](float px, float py) {
+    float nx = (px - cx) / fx;
+    float ny = (py - cy) / fy;
+    Undistort(k1, k2, k3, &nx, &ny);
+    min_x = std::min(min_x, nx);
+    min_y = std::min(min_y, ny);
+    max_x = std::max(max_x, nx);
+    max_y = std::max(max_y, ny);
+  };
+  for (int x = 0; x <= image_width; ++ x) {
+    add_border_pixel(x, 0);
+    add_border_pixel(x, image_height);
+  }
+  for (int y = 0; y <= image_height; ++ y) {
+    add_border_pixel(0, y);
+    add_border_pixel(image_width, y);
+  }
+  CHECK(std::isfinite(min_x) && std::isfinite(min_y) &&
+        std::isfinite(max_x) && std::isfinite(max_y))
+      << "Cannot undistort the image border, are the distortion coefficients valid?";
+  
+  const int lut_width = image_width;
+  const int lut_height = image_height;
+  const float step_x = (max_x - min_x) / (lut_width - 1);
+  const float step_y = (max_y - min_y) / (lut_height - 1);
+  
+  lut_.reset(new CUDABuffer<float2>(lut_height, lut_width));
+  constexpr int kBlockWidth = 32;
+  constexpr int kBlockHeight = 8;
+  const dim3 grid_dim(cuda_util::GetBlockCount(lut_width, kBlockWidth),
+                      cuda_util::GetBlockCount(lut_height, kBlockHeight));
+  const dim3 block_dim(kBlockWidth, kBlockHeight);
+  ComputeDistortionLUTCUDAKernel<<<grid_dim, block_dim, 0, stream>>>(
+      fx, fy, cx, cy, k1, k2, k3, min_x, min_y, step_x, step_y,
+      lut_->ToCUDA());
+  CHECK_CUDA_NO_ERROR();
+  
+  lut_->CreateTextureObject(
+      cudaAddressModeClamp, cudaAddressModeClamp, cudaFilterModeLinear,
+      cudaReadModeElementType, false, &data_.texture);
+  // Texel i has its center at i + 0.5 and holds the value for the normalized
+  // coordinate min + i * step.
+  data_.scale_x = 1.f / step_x;
+  data_.scale_y = 1.f / step_y;
+  data_.offset_x = 0.5f - min_x / step_x;
+  data_.offset_y = 0.5f - min_y / step_y;
+  data_.width = lut_width;
+  data_.height = lut_height;
+}
+
+DistortionLUT::~DistortionLUT() {
+  cudaDestroyTextureObject(data_.texture);
+}
+
+}  // namespace view_correction
@@ -0,0 +1,88 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef VIEW_CORRECTION_CUDA_DISTORTION_LUT_CUH_
+#define VIEW_CORRECTION_CUDA_DISTORTION_LUT_CUH_
+
+#include <cuda_runtime.h>
+
+#include "view_correction/cuda_buffer.h"
+
+namespace view_correction {
+
+// Device-side view of a DistortionLUT which can be passed to kernels. A
+// default-constructed object (with texture == 0) stands for a pinhole camera,
+// for which the projection is computed directly from the intrinsics.
+struct DistortionLUT_ {
+  __host__ __device__ DistortionLUT_()
+      : texture(0), scale_x(0), scale_y(0), offset_x(0), offset_y(0),
+        width(0), height(0) {}
+  
+  // Texture with the pixel coordinates in the distorted image, with linear
+  // filtering and non-normalized coordinates.
+  cudaTextureObject_t texture;
+  
+  // Maps normalized image coordinates (x / z, y / z) to texture coordinates
+  // of the LUT as scale * normalized + offset.
+  float scale_x;
+  float scale_y;
+  float offset_x;
+  float offset_y;
+  
+  // Size of the LUT. Texture coordinates outside of [0.5, width - 0.5] x
+  // [0.5, height - 0.5] are not covered by the LUT, and the corresponding
+  // points project outside of the image.
+  int width;
+  int height;
+};
+
+// Lookup table for the projection of a camera with radial polynomial
+// distortion, x_d = (1 + k1 r^2 + k2 r^4 + k3 r^6) x_u with r = |x_u|. It maps
+// normalized (undistorted) image coordinates to pixel coordinates in the
+// distorted image, such that projecting a point costs a single filtered
+// texture lookup. The LUT covers the normalized coordinates of all points
+// which project into the image and has the resolution of the image. It is
+// computed once on construction.
+class DistortionLUT {
+ public:
+  DistortionLUT(cudaStream_t stream, int image_width, int image_height,
+                float fx, float fy, float cx, float cy,
+                float k1, float k2, float k3);
+  ~DistortionLUT();
+  
+  // Returns the object that can be passed to CUDA code.
+  inline const DistortionLUT_& ToCUDA() const { return data_; }
+  
+ private:
+  CUDABufferPtr<float2> lut_;
+  DistortionLUT_ data_;
+};
+
+}  // namespace view_correction
+
+#endif  // VIEW_CORRECTION_CUDA_DISTORTION_LUT_CUH_
@@ -0,0 +1,300 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "view_correction/cuda_evaluation.cuh"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <cub/cub.cuh>
+#include <glog/logging.h>
+
+#include "view_correction/cuda_util.h"
+#include "view_correction/helper_math.h"
+
+namespace view_correction {
+
+// Half size of the SSIM window.
+constexpr int kSSIMRadius = 3;
+
+// Reduction operator for cub::DeviceReduce::Reduce(). cub::Sum does not find
+// the float4 operator+ of helper_math.h, which is in this namespace.
+struct Float4Sum {
+  __forceinline__ __host__ __device__ float4 operator()(const float4& a, const float4& b) const {
+    return a + b;
+  }
+};
+
+ImageComparisonBuffers::ImageComparisonBuffers(int width, int height) {
+  pixel_errors.reset(new CUDABuffer<float4>(1, width * height));
+  error_sums.reset(new CUDABuffer<float4>(1, 1));
+  
+  // Determine the temporary storage size (no work is done if passing a null
+  // pointer).
+  cub_temp_storage_bytes = 0;
+  CUDA_CHECKED_CALL(cub::DeviceReduce::Reduce(
+      nullptr, cub_temp_storage_bytes, pixel_errors->ToCUDA().address(),
+      error_sums->ToCUDA().address(), width * height, Float4Sum(),
+      make_float4(0, 0, 0, 0)));
+  cub_temp_storage.reset(new CUDABuffer<uint8_t>(1, cub_temp_storage_bytes));
+}
+
+__global__ void ResizeRGBImageAreaCUDAKernel(
+    CUDABuffer_<uint8_t> input,
+    float scale_x,
+    float scale_y,
+    CUDABuffer_<uchar4> output) {
+  const int x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+  if (x < output.width() && y < output.height()) {
+    const int input_width = input.width() / 3;
+    const float min_x = x * scale_x;
+    const float max_x = (x + 1) * scale_x;
+    const float min_y = y * scale_y;
+    const float max_y = (y + 1) * scale_y;
+    const int max_input_x = ::min(input_width, static_cast<int>(::ceil(max_x)));
+    const int max_input_y = ::min(input.height(), static_cast<int>(::ceil(max_y)));
+    
+    // Weight each input pixel by the part of it which is covered by the
+    // output pixel.
+    float3 sum = make_float3(0, 0, 0);
+    float weight_sum = 0;
+    for (int input_y = min_y; input_y < max_input_y; ++ input_y) {
+      const float weight_y = ::min(input_y + 1.f, max_y) - ::max(static_cast<float>(input_y), min_y);
+      for (int input_x = min_x; input_x < max_input_x; ++ input_x) {
+        const float weight = weight_y *
+            (::min(input_x + 1.f, max_x) - ::max(static_cast<float>(input_x), min_x));
+        sum += weight * make_float3(input(input_y, 3 * input_x + 0),
+                                    input(input_y, 3 * input_x + 1),
+                                    input(input_y, 3 * input_x + 2));
+        weight_sum += weight;
+      }
+    }
+    sum /= weight_sum;
+    output(y, x) = make_uchar4(::min(255.f, sum.x + 0.5f),
+                               ::min(255.f, sum.y + 0.5f),
+                               ::min(255.f, sum.z + 0.5f), 255);
+  }
+}
+
+void ResizeRGBImageAreaCUDA(
+    cudaStream_t stream,
+    const CUDABuffer<uint8_t>& input,
+    CUDABuffer<uchar4>* output) {
+  CHECK_EQ(input.width() % 3, 0);
+  constexpr int kBlockWidth = 32;
+  constexpr int kBlockHeight = 8;
+  const dim3 grid_dim(cuda_util::GetBlockCount(output->width(), kBlockWidth),
+                      cuda_util::GetBlockCount(output->height(), kBlockHeight));
+  const dim3 block_dim(kBlockWidth, kBlockHeight);
+  ResizeRGBImageAreaCUDAKernel<<<grid_dim, block_dim, 0, stream>>>(
+      input.ToCUDA(),
+      (input.width() / 3) / static_cast<float>(output->width()),
+      input.height() / static_cast<float>(output->height()),
+      output->ToCUDA());
+  CHECK_CUDA_NO_ERROR();
+}
+
+// Returns the first three channels of a pixel in [0, 255]. The float channels
+// are quantized like for writing the images.
+__forceinline__ __device__ float3 GetRGB(const uchar4& value) {
+  return make_float3(value.x, value.y, value.z);
+}
+
+__forceinline__ __device__ float3 GetRGB(const float4& value) {
+  return make_float3(static_cast<uint8_t>(255.99f * ::min(1.f, ::max(0.f, value.x))),
+                     static_cast<uint8_t>(255.99f * ::min(1.f, ::max(0.f, value.y))),
+                     static_cast<uint8_t>(255.99f * ::min(1.f, ::max(0.f, value.z))));
+}
+
+__forceinline__ __device__ float GetLuminance(const float3& rgb) {
+  return 0.299f * rgb.x + 0.587f * rgb.y + 0.114f * rgb.z;
+}
+
+template <typename T>
+__device__ float ComputeSSIM(
+    int x, int y,
+    const CUDABuffer_<T>& prediction,
+    const CUDABuffer_<uchar4>& reference) {
+  constexpr float kC1 = (0.01f * 255) * (0.01f * 255);
+  constexpr float kC2 = (0.03f * 255) * (0.03f * 255);
+  
+  float sum_p = 0;
+  float sum_r = 0;
+  float sum_pp = 0;
+  float sum_rr = 0;
+  float sum_pr = 0;
+  int count = 0;
+  for (int window_y = ::max(0, y - kSSIMRadius);
+       window_y <= ::min(prediction.height() - 1, y + kSSIMRadius); ++ window_y) {
+    for (int window_x = ::max(0, x - kSSIMRadius);
+         window_x <= ::min(prediction.width() - 1, x + kSSIMRadius); ++ window_x) {
+      const float p = GetLuminance(GetRGB(prediction(window_y, window_x)));
+      const float r = GetLuminance(GetRGB(reference(window_y, window_x)));
+      sum_p += p;
+      sum_r += r;
+      sum_pp += p * p;
+      sum_rr += r * r;
+      sum_pr += p * r;
+      ++ count;
+    }
+  }
+  const float mean_p = sum_p / count;
+  const float mean_r = sum_r / count;
+  const float variance_p = sum_pp / count - mean_p * mean_p;
+  const float variance_r = sum_rr / count - mean_r * mean_r;
+  const float covariance = sum_pr / count - mean_p * mean_r;
+  return ((2 * mean_p * mean_r + kC1) * (2 * covariance + kC2)) /
+         ((mean_p * mean_p + mean_r * mean_r + kC1) * (variance_p + variance_r + kC2));
+}
+
+template <typename T, bool compute_ssim, bool write_difference_image>
+__global__ void CompareImagesCUDAKernel(
+    CUDABuffer_<T> prediction,
+    CUDABuffer_<uchar4> reference,
+    int border_size,
+    CUDABuffer_<float4> pixel_errors,
+    CUDABuffer_<uchar4> difference_image) {
+  const int x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+  if (x < prediction.width() && y < prediction.height()) {
+    const bool in_border =
+        x < border_size || y < border_size ||
+        x >= prediction.width() - border_size ||
+        y >= prediction.height() - border_size;
+    float4 errors = make_float4(0, 0, 0, 0);
+    float3 difference = make_float3(0, 0, 0);
+    if (!in_border) {
+      difference = GetRGB(prediction(y, x)) - GetRGB(reference(y, x));
+      difference = make_float3(::fabs(difference.x), ::fabs(difference.y), ::fabs(difference.z));
+      errors.x = difference.x + difference.y + difference.z;
+      errors.y = difference.x * difference.x + difference.y * difference.y +
+                 difference.z * difference.z;
+      if (compute_ssim) {
+        errors.z = ComputeSSIM(x, y, prediction, reference);
+      }
+    }
+    pixel_errors(0, x + y * prediction.width()) = errors;
+    if (write_difference_image) {
+      difference_image(y, x) = make_uchar4(difference.z, difference.y, difference.x, 255);
+    }
+  }
+}
+
+template <typename T, bool compute_ssim>
+void CompareImagesCUDAImpl(
+    cudaStream_t stream,
+    const CUDABuffer<T>& prediction,
+    const CUDABuffer<uchar4>& reference,
+    int border_size,
+    ImageComparisonBuffers* buffers,
+    CUDABuffer<uchar4>* difference_image) {
+  constexpr int kBlockWidth = 32;
+  constexpr int kBlockHeight = 8;
+  const dim3 grid_dim(cuda_util::GetBlockCount(prediction.width(), kBlockWidth),
+                      cuda_util::GetBlockCount(prediction.height(), kBlockHeight));
+  const dim3 block_dim(kBlockWidth, kBlockHeight);
+  if (difference_image) {
+    CompareImagesCUDAKernel<T, compute_ssim, true><<<grid_dim, block_dim, 0, stream>>>(
+        prediction.ToCUDA(), reference.ToCUDA(), border_size,
+        buffers->pixel_errors->ToCUDA(), difference_image->ToCUDA());
+  } else {
+    CompareImagesCUDAKernel<T, compute_ssim, false><<<grid_dim, block_dim, 0, stream>>>(
+        prediction.ToCUDA(), reference.ToCUDA(), border_size,
+        buffers->pixel_errors->ToCUDA(), CUDABuffer_<uchar4>());
+  }
+  CHECK_CUDA_NO_ERROR();
+}
+
+template <typename T>
+void CompareImagesCUDA(
+    cudaStream_t stream,
+    const CUDABuffer<T>& prediction,
+    const CUDABuffer<uchar4>& reference,
+    int border_size,
+    bool compute_ssim,
+    ImageComparisonBuffers* buffers,
+    CUDABuffer<uchar4>* difference_image,
+    ImageComparisonMetrics* metrics) {
+  const int width = prediction.width();
+  const int height = prediction.height();
+  CHECK_EQ(reference.width(), width);
+  CHECK_EQ(reference.height(), height);
+  CHECK_GE(buffers->pixel_errors->width(), width * height);
+  if (difference_image) {
+    CHECK_EQ(difference_image->width(), width);
+    CHECK_EQ(difference_image->height(), height);
+  }
+  
+  if (compute_ssim) {
+    CompareImagesCUDAImpl<T, true>(stream, prediction, reference, border_size,
+                                   buffers, difference_image);
+  } else {
+    CompareImagesCUDAImpl<T, false>(stream, prediction, reference, border_size,
+                                    buffers, difference_image);
+  }
+  
+  CUDA_CHECKED_CALL(cub::DeviceReduce::Reduce(
+      buffers->cub_temp_storage->ToCUDA().address(),
+      buffers->cub_temp_storage_bytes,
+      buffers->pixel_errors->ToCUDA().address(),
+      buffers->error_sums->ToCUDA().address(),
+      width * height, Float4Sum(), make_float4(0, 0, 0, 0), stream));
+  float4 sums;
+  buffers->error_sums->DownloadAsync(stream, &sums);
+  cudaStreamSynchronize(stream);
+  
+  metrics->pixel_count =
+      std::max(0, width - 2 * border_size) * std::max(0, height - 2 * border_size);
+  if (metrics->pixel_count == 0) {
+    metrics->mean_l1 = 0;
+    metrics->psnr = std::numeric_limits<float>::infinity();
+    metrics->ssim = compute_ssim ? 1 : -1;
+    return;
+  }
+  metrics->mean_l1 = sums.x / metrics->pixel_count;
+  const float mean_squared_error = sums.y / (3 * metrics->pixel_count);
+  metrics->psnr = (mean_squared_error > 0) ?
+      (10 * std::log10(255 * 255 / mean_squared_error)) :
+      std::numeric_limits<float>::infinity();
+  metrics->ssim = compute_ssim ? (sums.z / metrics->pixel_count) : -1;
+}
+
+template void CompareImagesCUDA<uchar4>(
+    cudaStream_t stream, const CUDABuffer<uchar4>& prediction,
+    const CUDABuffer<uchar4>& reference, int border_size, bool compute_ssim,
+    ImageComparisonBuffers* buffers, CUDABuffer<uchar4>* difference_image,
+    ImageComparisonMetrics* metrics);
+template void CompareImagesCUDA<float4>(
+    cudaStream_t stream, const CUDABuffer<float4>& prediction,
+    const CUDABuffer<uchar4>& reference, int border_size, bool compute_ssim,
+    ImageComparisonBuffers* buffers, CUDABuffer<uchar4>* difference_image,
+    ImageComparisonMetrics* metrics);
+
+}  // namespace view_correction
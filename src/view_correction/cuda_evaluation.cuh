@@ -0,0 +1,99 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef VIEW_CORRECTION_CUDA_EVALUATION_CUH_
+#define VIEW_CORRECTION_CUDA_EVALUATION_CUH_
+
+#include <cuda_runtime.h>
+
+#include "view_correction/cuda_buffer.h"
+
+namespace view_correction {
+
+// Quality metrics of a predicted image compared to a reference image, see
+// CompareImagesCUDA().
+struct ImageComparisonMetrics {
+  // Mean over the compared pixels of the sum of the absolute channel
+  // differences (in [0, 3 * 255]).
+  float mean_l1;
+  
+  // Peak signal-to-noise ratio in dB, with the mean squared error over all
+  // channels. Infinite for identical images.
+  float psnr;
+  
+  // Mean structural similarity of the luminance, or -1 if not computed.
+  float ssim;
+  
+  int pixel_count;
+};
+
+// Scratch buffers of CompareImagesCUDA() for images of a given size.
+struct ImageComparisonBuffers {
+  ImageComparisonBuffers(int width, int height);
+  
+  // Per-pixel L1 error, squared error and SSIM (zero outside of the compared
+  // area), and their sums.
+  CUDABufferPtr<float4> pixel_errors;
+  CUDABufferPtr<float4> error_sums;
+  
+  // Temporary storage for cub::DeviceReduce.
+  CUDABufferPtr<uint8_t> cub_temp_storage;
+  size_t cub_temp_storage_bytes;
+};
+
+// Resizes an image with interleaved 8-bit RGB channels (i.e., with 3 * width
+// columns, as uploaded to rgb_image_gpu) to the size of output by averaging
+// the input pixels covered by each output pixel's area, like cv::resize()
+// with CV_INTER_AREA. The alpha channel of the output is set to 255.
+void ResizeRGBImageAreaCUDA(
+    cudaStream_t stream,
+    const CUDABuffer<uint8_t>& input,
+    CUDABuffer<uchar4>* output);
+
+// Compares prediction to reference, excluding a border of border_size pixels
+// at each side of the image. T is uchar4 for 8-bit channels or float4 for
+// channels in [0, 1]. The first three channels of both images are compared
+// with each other in order. If compute_ssim is true, the SSIM is computed on
+// the luminance with a 7x7 box window. If difference_image is not null, the
+// absolute channel differences are written to it for visualization, with
+// OpenCV's BGRA channel order and alpha 255 (and black in the border).
+// Synchronizes with the stream to download the metrics.
+template <typename T>
+void CompareImagesCUDA(
+    cudaStream_t stream,
+    const CUDABuffer<T>& prediction,
+    const CUDABuffer<uchar4>& reference,
+    int border_size,
+    bool compute_ssim,
+    ImageComparisonBuffers* buffers,
+    CUDABuffer<uchar4>* difference_image,
+    ImageComparisonMetrics* metrics);
+
+}  // namespace view_correction
+
+#endif  // VIEW_CORRECTION_CUDA_EVALUATION_CUH_
@@ -0,0 +1,254 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "view_correction/cuda_foveated_inpainting.cuh"
+
+#include <algorithm>
+
+#include <glog/logging.h>
+
+#include "view_correction/cuda_convolution_inpainting.cuh"
+#include "view_correction/cuda_convolution_inpainting_rgb.cuh"
+#include "view_correction/cuda_util.h"
+#include "view_correction/helper_math.h"
+
+namespace view_correction {
+
+FoveatedInpaintingBuffers::FoveatedInpaintingBuffers(
+    int width, int height, int downsampling_factor)
+    : downsampling_factor(downsampling_factor) {
+  CHECK_GE(downsampling_factor, 2);
+  const int coarse_width = cuda_util::GetBlockCount(width, downsampling_factor);
+  const int coarse_height = cuda_util::GetBlockCount(height, downsampling_factor);
+  
+  depth_input.reset(new CUDABuffer<float>(coarse_height, coarse_width));
+  depth_input->CreateTextureObject(
+      cudaAddressModeClamp, cudaAddressModeClamp, cudaFilterModePoint,
+      cudaReadModeElementType, false, &depth_input_texture);
+  depth_output.reset(new CUDABuffer<float>(coarse_height, coarse_width));
+  color_input.reset(new CUDABuffer<uchar4>(coarse_height, coarse_width));
+  color_output.reset(new CUDABuffer<uchar4>(coarse_height, coarse_width));
+  
+  max_change.reset(new CUDABuffer<uint8_t>(1, coarse_height * coarse_width));
+  block_coordinates.reset(new CUDABuffer<uint16_t>(1, coarse_height * coarse_width));
+  compaction_buffers.reset(new BlockCompactionBuffers(
+      GetConvolutionInpaintingBlockCount(coarse_width, coarse_height)));
+}
+
+FoveatedInpaintingBuffers::~FoveatedInpaintingBuffers() {
+  cudaDestroyTextureObject(depth_input_texture);
+}
+
+// Averages the valid depths and colors within each factor x factor pixel area.
+__global__ void DownsampleForFoveatedInpaintingCUDAKernel(
+    int factor,
+    CUDABuffer_<float> depth,
+    CUDABuffer_<uchar4> color,
+    CUDABuffer_<float> coarse_depth,
+    CUDABuffer_<uchar4> coarse_color) {
+  const int x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+  if (x < coarse_depth.width() && y < coarse_depth.height()) {
+    const int max_fine_x = ::min(depth.width(), (x + 1) * factor);
+    const int max_fine_y = ::min(depth.height(), (y + 1) * factor);
+    
+    float depth_sum = 0;
+    int depth_count = 0;
+    float3 color_sum = make_float3(0, 0, 0);
+    int color_count = 0;
+    for (int fine_y = y * factor; fine_y < max_fine_y; ++ fine_y) {
+      for (int fine_x = x * factor; fine_x < max_fine_x; ++ fine_x) {
+        const float fine_depth = depth(fine_y, fine_x);
+        if (fine_depth > 0) {
+          depth_sum += fine_depth;
+          ++ depth_count;
+        }
+        const uchar4 fine_color = color(fine_y, fine_x);
+        if (fine_color.w != 0) {
+          color_sum += make_float3(fine_color.x, fine_color.y, fine_color.z);
+          ++ color_count;
+        }
+      }
+    }
+    
+    coarse_depth(y, x) = (depth_count > 0) ? (depth_sum / depth_count) : 0.f;
+    if (color_count > 0) {
+      color_sum /= color_count;
+      coarse_color(y, x) = make_uchar4(color_sum.x + 0.5f, color_sum.y + 0.5f, color_sum.z + 0.5f, 255);
+    } else {
+      coarse_color(y, x) = make_uchar4(0, 0, 0, 0);
+    }
+  }
+}
+
+// Sets the holes outside of the region to the bilinear interpolation of the
+// valid coarse solution samples around them.
+__global__ void FillPeripheryFromCoarseLevelCUDAKernel(
+    float center_x,
+    float center_y,
+    float squared_radius,
+    int factor,
+    CUDABuffer_<float> coarse_depth,
+    CUDABuffer_<uchar4> coarse_color,
+    CUDABuffer_<float> depth,
+    CUDABuffer_<uchar4> color) {
+  const int x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+  if (x >= depth.width() || y >= depth.height()) {
+    return;
+  }
+  const float dx = x + 0.5f - center_x;
+  const float dy = y + 0.5f - center_y;
+  if (dx * dx + dy * dy <= squared_radius) {
+    return;
+  }
+  const bool fill_depth = !(depth(y, x) > 0);
+  const bool fill_color = (color(y, x).w == 0);
+  if (!fill_depth && !fill_color) {
+    return;
+  }
+  
+  const float coarse_x = (x + 0.5f) / factor - 0.5f;
+  const float coarse_y = (y + 0.5f) / factor - 0.5f;
+  const int x0 = ::max(0, ::min(coarse_depth.width() - 1, static_cast<int>(::floor(coarse_x))));
+  const int y0 = ::max(0, ::min(coarse_depth.height() - 1, static_cast<int>(::floor(coarse_y))));
+  const int x1 = ::min(coarse_depth.width() - 1, x0 + 1);
+  const int y1 = ::min(coarse_depth.height() - 1, y0 + 1);
+  const float fx = ::max(0.f, ::min(1.f, coarse_x - x0));
+  const float fy = ::max(0.f, ::min(1.f, coarse_y - y0));
+  
+  const int sample_x[4] = {x0, x1, x0, x1};
+  const int sample_y[4] = {y0, y0, y1, y1};
+  const float sample_weight[4] = {(1 - fx) * (1 - fy), fx * (1 - fy), (1 - fx) * fy, fx * fy};
+  
+  float depth_sum = 0;
+  float depth_weight = 0;
+  float3 color_sum = make_float3(0, 0, 0);
+  float color_weight = 0;
+  for (int i = 0; i < 4; ++ i) {
+    const float sample_depth = coarse_depth(sample_y[i], sample_x[i]);
+    if (sample_depth > 0) {
+      depth_sum += sample_weight[i] * sample_depth;
+      depth_weight += sample_weight[i];
+    }
+    const uchar4 sample_color = coarse_color(sample_y[i], sample_x[i]);
+    if (sample_color.w != 0) {
+      color_sum += sample_weight[i] * make_float3(sample_color.x, sample_color.y, sample_color.z);
+      color_weight += sample_weight[i];
+    }
+  }
+  
+  if (fill_depth && depth_weight > 0) {
+    depth(y, x) = depth_sum / depth_weight;
+  }
+  if (fill_color && color_weight > 0) {
+    color_sum /= color_weight;
+    color(y, x) = make_uchar4(::min(255.f, color_sum.x + 0.5f),
+                              ::min(255.f, color_sum.y + 0.5f),
+                              ::min(255.f, color_sum.z + 0.5f), 255);
+  }
+}
+
+void InpaintPeripheryCUDA(
+    cudaStream_t stream,
+    const FoveationRegion& region,
+    CUDABuffer<float>* depth,
+    CUDABuffer<uchar4>* color,
+    FoveatedInpaintingBuffers* buffers) {
+  CHECK_EQ(depth->width(), color->width());
+  CHECK_EQ(depth->height(), color->height());
+  constexpr int kBlockWidth = 32;
+  constexpr int kBlockHeight = 8;
+  const dim3 block_dim(kBlockWidth, kBlockHeight);
+  const int coarse_width = buffers->depth_input->width();
+  const int coarse_height = buffers->depth_input->height();
+  
+  const dim3 coarse_grid_dim(cuda_util::GetBlockCount(coarse_width, kBlockWidth),
+                             cuda_util::GetBlockCount(coarse_height, kBlockHeight));
+  DownsampleForFoveatedInpaintingCUDAKernel<<<coarse_grid_dim, block_dim, 0, stream>>>(
+      buffers->downsampling_factor,
+      depth->ToCUDA(),
+      color->ToCUDA(),
+      buffers->depth_input->ToCUDA(),
+      buffers->color_input->ToCUDA());
+  CHECK_CUDA_NO_ERROR();
+  
+  // The coarse level is small, so it is inpainted without the gradient
+  // weighting (which would require a guidance image on this level).
+  uint32_t pixel_to_inpaint_count;
+  InpaintDepthMapWithConvolutionCUDA(
+      stream,
+      /*use_weighting*/ false,
+      std::max(coarse_width, coarse_height),
+      1e-3f,
+      1.0f,
+      /*gradient_magnitude_div_sqrt2*/ 0,
+      buffers->depth_input_texture,
+      nullptr,
+      nullptr,
+      buffers->max_change.get(),
+      buffers->depth_output.get(),
+      buffers->block_coordinates.get(),
+      &pixel_to_inpaint_count,
+      buffers->compaction_buffers.get(),
+      /*use_persistent_kernel*/ false,
+      nullptr,
+      nullptr,
+      nullptr);
+  InpaintImageWithConvolutionCUDA(
+      stream,
+      /*use_weighting*/ false,
+      std::max(coarse_width, coarse_height),
+      1e-2f,
+      /*gradient_magnitude_div_sqrt2*/ 0,
+      *buffers->color_input,
+      nullptr,
+      buffers->max_change.get(),
+      buffers->color_output.get(),
+      buffers->block_coordinates.get(),
+      &pixel_to_inpaint_count,
+      buffers->compaction_buffers.get(),
+      nullptr,
+      nullptr,
+      nullptr);
+  
+  const dim3 grid_dim(cuda_util::GetBlockCount(depth->width(), kBlockWidth),
+                      cuda_util::GetBlockCount(depth->height(), kBlockHeight));
+  FillPeripheryFromCoarseLevelCUDAKernel<<<grid_dim, block_dim, 0, stream>>>(
+      region.center_x,
+      region.center_y,
+      region.radius * region.radius,
+      buffers->downsampling_factor,
+      buffers->depth_output->ToCUDA(),
+      buffers->color_output->ToCUDA(),
+      depth->ToCUDA(),
+      color->ToCUDA());
+  CHECK_CUDA_NO_ERROR();
+}
+
+}  // namespace view_correction
@@ -0,0 +1,88 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef VIEW_CORRECTION_CUDA_FOVEATED_INPAINTING_CUH_
+#define VIEW_CORRECTION_CUDA_FOVEATED_INPAINTING_CUH_
+
+#include <memory>
+
+#include <cuda_runtime.h>
+
+#include "view_correction/cuda_block_compaction.cuh"
+#include "view_correction/cuda_buffer.h"
+
+namespace view_correction {
+
+// Region of the target frame which is inpainted at full resolution with
+// foveated inpainting, in pixels of the target frame: all pixels within radius
+// of the center.
+struct FoveationRegion {
+  float center_x;
+  float center_y;
+  float radius;
+};
+
+// Coarse level buffers of InpaintPeripheryCUDA() for a target frame of the
+// given size, which is downsampled by downsampling_factor in each dimension
+// (rounded up).
+struct FoveatedInpaintingBuffers {
+  FoveatedInpaintingBuffers(int width, int height, int downsampling_factor);
+  ~FoveatedInpaintingBuffers();
+  
+  int downsampling_factor;
+  
+  CUDABufferPtr<float> depth_input;
+  cudaTextureObject_t depth_input_texture;
+  CUDABufferPtr<float> depth_output;
+  CUDABufferPtr<uchar4> color_input;
+  CUDABufferPtr<uchar4> color_output;
+  
+  // Shared by the depth and color inpainting, which run one after another.
+  CUDABufferPtr<uint8_t> max_change;
+  CUDABufferPtr<uint16_t> block_coordinates;
+  std::unique_ptr<BlockCompactionBuffers> compaction_buffers;
+};
+
+// Fills the holes of the target frame outside of the region with a cheap
+// solution: depth (pixels with depth == 0 are holes) and color (pixels with
+// w == 0 are holes) are downsampled to the coarse level, inpainted there with
+// the convolution inpainting, and the holes outside of the region are set to
+// the bilinearly upsampled coarse solution (with color.w = 255). Afterwards,
+// only the holes within the region remain for the full-resolution
+// inpainting, which then uses the filled periphery as boundary condition. Runs
+// without synchronizing with the host.
+void InpaintPeripheryCUDA(
+    cudaStream_t stream,
+    const FoveationRegion& region,
+    CUDABuffer<float>* depth,
+    CUDABuffer<uchar4>* color,
+    FoveatedInpaintingBuffers* buffers);
+
+}  // namespace view_correction
+
+#endif  // VIEW_CORRECTION_CUDA_FOVEATED_INPAINTING_CUH_
@@ -0,0 +1,228 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "view_correction/cuda_hole_map.cuh"
+
+#include <algorithm>
+
+#include <glog/logging.h>
+
+#include "view_correction/cuda_util.h"
+
+namespace view_correction {
+
+namespace {
+
+// Sums the counts of each 2x2 cells of a level into the next coarser level.
+__global__ void BuildHoleMapLevelCUDAKernel(
+    CUDABuffer_<uint16_t> finer_depth_holes,
+    CUDABuffer_<uint16_t> finer_color_holes,
+    CUDABuffer_<uint16_t> depth_holes,
+    CUDABuffer_<uint16_t> color_holes) {
+  const int x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+  if (x < depth_holes.width() && y < depth_holes.height()) {
+    const int finer_x = 2 * x;
+    const int finer_y = 2 * y;
+    const bool have_right = finer_x + 1 < finer_depth_holes.width();
+    const bool have_bottom = finer_y + 1 < finer_depth_holes.height();
+    int depth_count = finer_depth_holes(finer_y, finer_x);
+    int color_count = finer_color_holes(finer_y, finer_x);
+    if (have_right) {
+      depth_count += finer_depth_holes(finer_y, finer_x + 1);
+      color_count += finer_color_holes(finer_y, finer_x + 1);
+    }
+    if (have_bottom) {
+      depth_count += finer_depth_holes(finer_y + 1, finer_x);
+      color_count += finer_color_holes(finer_y + 1, finer_x);
+    }
+    if (have_right && have_bottom) {
+      depth_count += finer_depth_holes(finer_y + 1, finer_x + 1);
+      color_count += finer_color_holes(finer_y + 1, finer_x + 1);
+    }
+    depth_holes(y, x) = depth_count;
+    color_holes(y, x) = color_count;
+  }
+}
+
+// Computes level 0 of a HoleMap. Must be launched with 32x32 blocks.
+__global__ void CountHolesCUDAKernel(
+    CUDABuffer_<float> depth_map,
+    CUDABuffer_<uchar4> color_image,
+    CUDABuffer_<uint16_t> depth_cells,
+    CUDABuffer_<uint16_t> color_cells) {
+  const int x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+  const bool in_image = x < depth_map.width() && y < depth_map.height();
+  CountHoleMapCells(
+      in_image && depth_map(y, x) == 0,
+      in_image && color_image(y, x).w == 0,
+      depth_cells, color_cells);
+}
+
+}  // namespace
+
+HoleMap::HoleMap(int width, int height)
+    : width_(width),
+      height_(height),
+      level0_cpu_valid_(false) {
+  static_assert((kHoleMapCellSize << (kMaxHoleMapLevels - 1)) *
+                (kHoleMapCellSize << (kMaxHoleMapLevels - 1)) <= 65535,
+                "The hole counts of the coarsest level must fit into 16 bits.");
+  int level_width = cuda_util::GetBlockCount(width, kHoleMapCellSize);
+  int level_height = cuda_util::GetBlockCount(height, kHoleMapCellSize);
+  data_.level_count = 0;
+  while (data_.level_count < kMaxHoleMapLevels) {
+    for (int kind = 0; kind < 2; ++ kind) {
+      levels_[kind][data_.level_count].reset(
+          new CUDABuffer<uint16_t>(level_height, level_width));
+      data_.counts[kind][data_.level_count] =
+          levels_[kind][data_.level_count]->ToCUDA();
+    }
+    ++ data_.level_count;
+    if (level_width == 1 && level_height == 1) {
+      break;
+    }
+    level_width = cuda_util::GetBlockCount(level_width, 2);
+    level_height = cuda_util::GetBlockCount(level_height, 2);
+  }
+  
+  const CUDABuffer<uint16_t>& level0 = *levels_[kDepthHoleMap][0];
+  CUDA_CHECKED_CALL(cudaHostAlloc(
+      reinterpret_cast<void**>(&level0_cpu_),
+      2 * level0.width() * level0.height() * sizeof(uint16_t),
+      cudaHostAllocDefault));
+}
+
+HoleMap::~HoleMap() {
+  cudaFreeHost(level0_cpu_);
+}
+
+void HoleMap::BuildPyramid(cudaStream_t stream) {
+  level0_cpu_valid_ = false;
+  constexpr int kBlockWidth = 32;
+  constexpr int kBlockHeight = 8;
+  for (int level = 1; level < data_.level_count; ++ level) {
+    const CUDABuffer_<uint16_t>& depth_holes = data_.counts[kDepthHoleMap][level];
+    const dim3 grid_dim(cuda_util::GetBlockCount(depth_holes.width(), kBlockWidth),
+                        cuda_util::GetBlockCount(depth_holes.height(), kBlockHeight));
+    const dim3 block_dim(kBlockWidth, kBlockHeight);
+    BuildHoleMapLevelCUDAKernel<<<grid_dim, block_dim, 0, stream>>>(
+        data_.counts[kDepthHoleMap][level - 1],
+        data_.counts[kColorHoleMap][level - 1],
+        depth_holes,
+        data_.counts[kColorHoleMap][level]);
+    CHECK_CUDA_NO_ERROR();
+  }
+}
+
+void HoleMap::Compute(
+    cudaStream_t stream,
+    const CUDABuffer<float>& depth_map,
+    const CUDABuffer<uchar4>& color_image) {
+  CHECK_EQ(depth_map.width(), width_);
+  CHECK_EQ(depth_map.height(), height_);
+  CHECK_EQ(color_image.width(), width_);
+  CHECK_EQ(color_image.height(), height_);
+  constexpr int kBlockWidth = 32;
+  constexpr int kBlockHeight = 32;
+  const dim3 grid_dim(cuda_util::GetBlockCount(width_, kBlockWidth),
+                      cuda_util::GetBlockCount(height_, kBlockHeight));
+  const dim3 block_dim(kBlockWidth, kBlockHeight);
+  CountHolesCUDAKernel<<<grid_dim, block_dim, 0, stream>>>(
+      depth_map.ToCUDA(),
+      color_image.ToCUDA(),
+      data_.counts[kDepthHoleMap][0],
+      data_.counts[kColorHoleMap][0]);
+  CHECK_CUDA_NO_ERROR();
+  
+  BuildPyramid(stream);
+}
+
+int HoleMap::SelectActiveBlocks(
+    cudaStream_t stream,
+    HoleMapKind kind,
+    int block_output_width,
+    int block_output_height,
+    int border,
+    int grid_dim_x,
+    int grid_dim_y,
+    uint16_t* block_coordinates,
+    uint32_t* pixel_count) {
+  CHECK_EQ(block_output_width % kHoleMapCellSize, 0);
+  CHECK_EQ(block_output_height % kHoleMapCellSize, 0);
+  const CUDABuffer<uint16_t>& depth_level0 = *levels_[kDepthHoleMap][0];
+  const int cells_x = depth_level0.width();
+  const int cells_y = depth_level0.height();
+  if (!level0_cpu_valid_) {
+    depth_level0.DownloadAsync(stream, level0_cpu_);
+    levels_[kColorHoleMap][0]->DownloadAsync(stream, level0_cpu_ + cells_x * cells_y);
+    cudaStreamSynchronize(stream);
+    level0_cpu_valid_ = true;
+  }
+  const uint16_t* cells = level0_cpu_ + kind * cells_x * cells_y;
+  
+  const int block_cells_x = block_output_width / kHoleMapCellSize;
+  const int block_cells_y = block_output_height / kHoleMapCellSize;
+  const int border_cells = cuda_util::GetBlockCount(border, kHoleMapCellSize);
+  int active_block_count = 0;
+  for (int block_y = 0; block_y < grid_dim_y; ++ block_y) {
+    for (int block_x = 0; block_x < grid_dim_x; ++ block_x) {
+      // The cells of the block, and the ones around it up to the border.
+      const int min_cell_x = block_x * block_cells_x;
+      const int min_cell_y = block_y * block_cells_y;
+      const int end_cell_x = std::min(cells_x, min_cell_x + block_cells_x);
+      const int end_cell_y = std::min(cells_y, min_cell_y + block_cells_y);
+      bool active = false;
+      uint32_t block_pixel_count = 0;
+      for (int cell_y = std::max(0, min_cell_y - border_cells);
+           cell_y < std::min(cells_y, end_cell_y + border_cells); ++ cell_y) {
+        for (int cell_x = std::max(0, min_cell_x - border_cells);
+             cell_x < std::min(cells_x, end_cell_x + border_cells); ++ cell_x) {
+          const uint16_t count = cells[cell_x + cell_y * cells_x];
+          active |= (count != 0);
+          if (cell_x >= min_cell_x && cell_x < end_cell_x &&
+              cell_y >= min_cell_y && cell_y < end_cell_y) {
+            block_pixel_count += count;
+          }
+        }
+      }
+      if (active) {
+        block_coordinates[2 * active_block_count + 0] = block_x * block_output_width;
+        block_coordinates[2 * active_block_count + 1] = block_y * block_output_height;
+        ++ active_block_count;
+        if (pixel_count) {
+          *pixel_count += block_pixel_count;
+        }
+      }
+    }
+  }
+  return active_block_count;
+}
+
+}  // namespace view_correction
@@ -0,0 +1,213 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef VIEW_CORRECTION_CUDA_HOLE_MAP_CUH_
+#define VIEW_CORRECTION_CUDA_HOLE_MAP_CUH_
+
+#include <cuda_runtime.h>
+
+#include "view_correction/cuda_buffer.h"
+#include "view_correction/forward_declarations.h"
+
+namespace view_correction {
+
+// Side length in pixels of the cells on the finest level of a HoleMap. The
+// output blocks of all inpainting kernels have a multiple of this size.
+constexpr int kHoleMapCellSize = 4;
+
+// Maximum number of levels of a HoleMap. The cells of the coarsest level are
+// kHoleMapCellSize << (kMaxHoleMapLevels - 1) pixels wide, such that their
+// hole counts still fit into 16 bits.
+constexpr int kMaxHoleMapLevels = 6;
+
+// The kinds of holes counted by a HoleMap: pixels with a depth of zero, and
+// pixels with a color whose w component is zero. The inpainting functions use
+// the same definitions for the pixels to inpaint.
+enum HoleMapKind {
+  kDepthHoleMap = 0,
+  kColorHoleMap = 1
+};
+
+// Device-side view of a HoleMap which can be passed to kernels. A
+// default-constructed object (with level_count == 0) stands for a missing
+// map, for which every region may contain holes.
+struct HoleMap_ {
+  HoleMap_() : level_count(0) {}
+  
+#ifdef __CUDACC__
+  // Returns whether the pixels in [min_x, max_x] x [min_y, max_y] (which is
+  // clamped to the image) may contain holes of the given kind. A false result
+  // is exact, while a true result may also be caused by holes close to the
+  // region. Reads at most four cells, on the coarsest level whose cells are
+  // at least as large as the region.
+  __forceinline__ __device__ bool MayContainHoles(
+      HoleMapKind kind, int min_x, int min_y, int max_x, int max_y) const {
+    if (level_count == 0) {
+      return true;
+    }
+    const int extent = ::max(max_x - min_x, max_y - min_y) + 1;
+    int level = 0;
+    while (level < level_count - 1 && (kHoleMapCellSize << level) < extent) {
+      ++ level;
+    }
+    const CUDABuffer_<uint16_t>& cells = counts[kind][level];
+    const int cell_size = kHoleMapCellSize << level;
+    const int min_cell_x = ::max(0, min_x) / cell_size;
+    const int min_cell_y = ::max(0, min_y) / cell_size;
+    const int max_cell_x = ::min(cells.width() - 1, ::max(0, max_x) / cell_size);
+    const int max_cell_y = ::min(cells.height() - 1, ::max(0, max_y) / cell_size);
+    for (int cell_y = min_cell_y; cell_y <= max_cell_y; ++ cell_y) {
+      for (int cell_x = min_cell_x; cell_x <= max_cell_x; ++ cell_x) {
+        if (cells(cell_y, cell_x) != 0) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+#endif
+  
+  // Hole counts of the cells of each level for each HoleMapKind. The cells of
+  // level i are kHoleMapCellSize << i pixels wide.
+  CUDABuffer_<uint16_t> counts[2][kMaxHoleMapLevels];
+  int level_count;
+};
+
+#ifdef __CUDACC__
+// Counts the holes of the 32x32 pixels covered by the calling thread block
+// into the level 0 cells depth_cells and color_cells of a HoleMap. Must be
+// called by all threads of a 32x32 thread block, where depth_hole and
+// color_hole are false for the threads outside of the image.
+__forceinline__ __device__ void CountHoleMapCells(
+    bool depth_hole,
+    bool color_hole,
+    CUDABuffer_<uint16_t>& depth_cells,
+    CUDABuffer_<uint16_t>& color_cells) {
+  constexpr int kBlockCells = 32 / kHoleMapCellSize;
+  __shared__ int depth_counts[kBlockCells * kBlockCells];
+  __shared__ int color_counts[kBlockCells * kBlockCells];
+  const int thread_index = threadIdx.x + 32 * threadIdx.y;
+  if (thread_index < kBlockCells * kBlockCells) {
+    depth_counts[thread_index] = 0;
+    color_counts[thread_index] = 0;
+  }
+  __syncthreads();
+  
+  const int cell_index = threadIdx.x / kHoleMapCellSize +
+                         kBlockCells * (threadIdx.y / kHoleMapCellSize);
+  if (depth_hole) {
+    atomicAdd(&depth_counts[cell_index], 1);
+  }
+  if (color_hole) {
+    atomicAdd(&color_counts[cell_index], 1);
+  }
+  __syncthreads();
+  
+  const int cell_x = blockIdx.x * kBlockCells + thread_index % kBlockCells;
+  const int cell_y = blockIdx.y * kBlockCells + thread_index / kBlockCells;
+  if (thread_index < kBlockCells * kBlockCells &&
+      cell_x < depth_cells.width() && cell_y < depth_cells.height()) {
+    depth_cells(cell_y, cell_x) = depth_counts[thread_index];
+    color_cells(cell_y, cell_x) = color_counts[thread_index];
+  }
+}
+#endif
+
+// Pyramid of the numbers of depth and color holes in the cells of an image,
+// which lets the inpainting functions exclude the regions without holes from
+// their active blocks without scanning them (their input is still copied to
+// the output). Level 0 is written by PrepareTargetFrameCUDA() together with
+// the target frame (or by Compute() from an existing image), after which
+// BuildPyramid() computes the coarser levels.
+// All inpainting passes on this frame then share the map, and the passes which
+// select their active blocks on the host share a single download of it.
+class HoleMap {
+ public:
+  // Allocates the map for an image of the given size.
+  HoleMap(int width, int height);
+  
+  ~HoleMap();
+  
+  // Computes the coarser levels from level 0. Must be called after each
+  // update of level 0.
+  void BuildPyramid(cudaStream_t stream);
+  
+  // Recomputes the whole map from a depth map and color image of the map's
+  // size. This is only required if the holes are changed after they have been
+  // counted together with the target frame.
+  void Compute(cudaStream_t stream,
+               const CUDABuffer<float>& depth_map,
+               const CUDABuffer<uchar4>& color_image);
+  
+  // Selects the blocks to inpaint for an inpainting function which divides the
+  // image into a grid of grid_dim_x * grid_dim_y blocks, with
+  // block_output_width * block_output_height pixels each. A block is
+  // selected if it may contain holes of the given kind in its output pixels
+  // expanded by border pixels on each side. Writes the pixel coordinates of
+  // the selected blocks interleaved to block_coordinates, adds the number of
+  // holes in them to pixel_count (if not null), and returns the number of
+  // selected blocks. block_output_width and block_output_height must be
+  // multiples of kHoleMapCellSize. Downloads level 0 and waits for it if this
+  // has not happened since the last BuildPyramid(), such that further calls
+  // do not synchronize with the stream.
+  int SelectActiveBlocks(
+      cudaStream_t stream,
+      HoleMapKind kind,
+      int block_output_width,
+      int block_output_height,
+      int border,
+      int grid_dim_x,
+      int grid_dim_y,
+      uint16_t* block_coordinates,
+      uint32_t* pixel_count);
+  
+  // Returns the buffers of level 0, which have one cell for each
+  // kHoleMapCellSize x kHoleMapCellSize pixels of the image.
+  inline CUDABuffer<uint16_t>* level0(HoleMapKind kind) { return levels_[kind][0].get(); }
+  
+  // Returns the object that can be passed to CUDA code.
+  inline const HoleMap_& ToCUDA() const { return data_; }
+  
+ private:
+  HoleMap(const HoleMap&) = delete;
+  HoleMap& operator=(const HoleMap&) = delete;
+  
+  int width_;
+  int height_;
+  CUDABufferPtr<uint16_t> levels_[2][kMaxHoleMapLevels];
+  HoleMap_ data_;
+  
+  // Page-locked copy of level 0 for both kinds (depth first) and whether it
+  // is up to date.
+  uint16_t* level0_cpu_;
+  bool level0_cpu_valid_;
+};
+
+}  // namespace view_correction
+
+#endif  // VIEW_CORRECTION_CUDA_HOLE_MAP_CUH_
@@ -0,0 +1,106 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef VIEW_CORRECTION_CUDA_INPAINTING_STORAGE_CUH_
+#define VIEW_CORRECTION_CUDA_INPAINTING_STORAGE_CUH_
+
+#include <cuda_fp16.h>
+#include <cuda_runtime.h>
+
+namespace view_correction {
+
+// Four half-precision values, the storage counterpart of float4 for the RGB
+// color inpainting state (w is unused).
+struct __align__(8) Half4 {
+  __half x;
+  __half y;
+  __half z;
+  __half w;
+};
+
+// Storage types of the auxiliary TV inpainting state buffers (the over-relaxed
+// primal variable u_bar of depth TV, and the dual variables and u_bar of color
+// TV). The solvers always compute in fp32 and only convert when loading and
+// storing these buffers, so half-precision storage halves their memory traffic
+// at the cost of rounding the state to 11 significant bits. The inpainting
+// functions are instantiated for both variants, these typedefs select the one
+// which the display uses. Configure with
+// -DVIEW_CORRECTION_HALF_INPAINTING_STORAGE=ON to use half precision.
+#ifdef VIEW_CORRECTION_HALF_INPAINTING_STORAGE
+typedef __half InpaintingStateT;
+typedef Half4 InpaintingColorStateT;
+#else
+typedef float InpaintingStateT;
+typedef float4 InpaintingColorStateT;
+#endif
+
+#ifdef __CUDACC__
+// Conversions between the fp32 values used for computation and the storage
+// types. Color values are RGB and stored in the x, y, z components.
+__forceinline__ __device__ float LoadInpaintingState(const float& value) {
+  return value;
+}
+
+__forceinline__ __device__ float LoadInpaintingState(const __half& value) {
+  return __half2float(value);
+}
+
+__forceinline__ __device__ float3 LoadInpaintingState(const float4& value) {
+  return make_float3(value.x, value.y, value.z);
+}
+
+__forceinline__ __device__ float3 LoadInpaintingState(const Half4& value) {
+  return make_float3(__half2float(value.x), __half2float(value.y),
+                     __half2float(value.z));
+}
+
+__forceinline__ __device__ void StoreInpaintingState(float value, float* dest) {
+  *dest = value;
+}
+
+__forceinline__ __device__ void StoreInpaintingState(float value, __half* dest) {
+  *dest = __float2half(value);
+}
+
+__forceinline__ __device__ void StoreInpaintingState(const float3& value, float4* dest) {
+  *dest = make_float4(value.x, value.y, value.z, 0.f);
+}
+
+__forceinline__ __device__ void StoreInpaintingState(const float3& value, Half4* dest) {
+  Half4 result;
+  result.x = __float2half(value.x);
+  result.y = __float2half(value.y);
+  result.z = __float2half(value.z);
+  result.w = __float2half(0.f);
+  *dest = result;
+}
+#endif
+
+}  // namespace view_correction
+
+#endif  // VIEW_CORRECTION_CUDA_INPAINTING_STORAGE_CUH_
@@ -0,0 +1,110 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+#include "view_correction/cuda_interop_cache.h"
+
+#include <string.h>
+
+#include <glog/logging.h>
+
+#include "view_correction/cuda_util.h"
+
+namespace view_correction {
+
+void MapGraphicsResourceArrays(
+    int count,
+    cudaGraphicsResource_t* resources,
+    cudaStream_t stream,
+    cudaArray_t* arrays) {
+  CUDA_CHECKED_CALL(cudaGraphicsMapResources(count, resources, stream));
+  for (int i = 0; i < count; ++ i) {
+    CUDA_CHECKED_CALL(cudaGraphicsSubResourceGetMappedArray(
+        &arrays[i], resources[i], 0, 0));
+  }
+}
+
+CUDAArrayObjectCache::CUDAArrayObjectCache()
+    : texture_array_(nullptr),
+      texture_(0),
+      surface_array_(nullptr),
+      surface_(0) {
+  memset(&texture_description_, 0, sizeof(texture_description_));
+}
+
+CUDAArrayObjectCache::~CUDAArrayObjectCache() {
+  if (texture_array_) {
+    cudaDestroyTextureObject(texture_);
+  }
+  if (surface_array_) {
+    cudaDestroySurfaceObject(surface_);
+  }
+}
+
+cudaTextureObject_t CUDAArrayObjectCache::GetTextureObject(
+    cudaArray_t array, const cudaTextureDesc& texture_description) {
+  CHECK_NOTNULL(array);
+  if (array == texture_array_ &&
+      memcmp(&texture_description, &texture_description_,
+             sizeof(texture_description)) == 0) {
+    return texture_;
+  }
+  
+  if (texture_array_) {
+    CUDA_CHECKED_CALL(cudaDestroyTextureObject(texture_));
+  }
+  
+  struct cudaResourceDesc resource_description;
+  memset(&resource_description, 0, sizeof(resource_description));
+  resource_description.resType = cudaResourceTypeArray;
+  resource_description.res.array.array = array;
+  CUDA_CHECKED_CALL(cudaCreateTextureObject(
+      &texture_, &resource_description, &texture_description, NULL));
+  texture_array_ = array;
+  texture_description_ = texture_description;
+  return texture_;
+}
+
+cudaSurfaceObject_t CUDAArrayObjectCache::GetSurfaceObject(cudaArray_t array) {
+  CHECK_NOTNULL(array);
+  if (array == surface_array_) {
+    return surface_;
+  }
+  
+  if (surface_array_) {
+    CUDA_CHECKED_CALL(cudaDestroySurfaceObject(surface_));
+  }
+  
+  struct cudaResourceDesc resource_description;
+  memset(&resource_description, 0, sizeof(resource_description));
+  resource_description.resType = cudaResourceTypeArray;
+  resource_description.res.array.array = array;
+  CUDA_CHECKED_CALL(cudaCreateSurfaceObject(&surface_, &resource_description));
+  surface_array_ = array;
+  return surface_;
+}
+
+}  // namespace view_correction
@@ -0,0 +1,75 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+#ifndef VIEW_CORRECTION_CUDA_INTEROP_CACHE_H_
+#define VIEW_CORRECTION_CUDA_INTEROP_CACHE_H_
+
+#include <cuda_runtime.h>
+
+namespace view_correction {
+
+// Maps count graphics resources with a single call and returns the array of
+// the first subresource of each.
+void MapGraphicsResourceArrays(
+    int count,
+    cudaGraphicsResource_t* resources,
+    cudaStream_t stream,
+    cudaArray_t* arrays);
+
+// Caches a texture object and a surface object for the array of a mapped
+// graphics resource. The array of a registered OpenGL texture normally stays
+// the same each time it is mapped, so the objects are only re-created if the
+// array (or the texture description) changes, instead of creating and
+// destroying them for each use. The returned objects must only be used while
+// the resource is mapped.
+class CUDAArrayObjectCache {
+ public:
+  CUDAArrayObjectCache();
+  
+  // Destroys the cached objects.
+  ~CUDAArrayObjectCache();
+  
+  cudaTextureObject_t GetTextureObject(
+      cudaArray_t array, const cudaTextureDesc& texture_description);
+  
+  cudaSurfaceObject_t GetSurfaceObject(cudaArray_t array);
+  
+ private:
+  CUDAArrayObjectCache(const CUDAArrayObjectCache&) = delete;
+  CUDAArrayObjectCache& operator=(const CUDAArrayObjectCache&) = delete;
+  
+  cudaArray_t texture_array_;
+  cudaTextureDesc texture_description_;
+  cudaTextureObject_t texture_;
+  
+  cudaArray_t surface_array_;
+  cudaSurfaceObject_t surface_;
+};
+
+}  // namespace view_correction
+
+#endif  // VIEW_CORRECTION_CUDA_INTEROP_CACHE_H_
@@ -28,11 +28,18 @@
 
 #include "view_correction/cuda_tv_inpainting_functions.cuh"
 
+#include <algorithm>
+
 #include <cub/cub.cuh>
 #include <glog/logging.h>
 
+#include "view_correction/cuda_block_compaction.cuh"
+#include "view_correction/cuda_hole_map.cuh"
+#include "view_correction/cuda_inpainting_storage.cuh"
 #include "view_correction/cuda_util.h"
 #include "view_correction/helper_math.h"
+#include "view_correction/host_scratch_arena.h"
+#include "view_correction/nvtx_range.h"
 
 namespace view_correction {
 
@@ -46,6 +53,73 @@ constexpr float kDualIntToFloat = 2.f / 32767;  // std::numeric_limits<int16_t>:
 // would complicate the code unnecessarily.
 constexpr int kIterationsPerKernelCall = 4;
 
+// Iterations between the convergence checks. If the variables are initialized
+// close to the solution (from a coarser pyramid level or from an initial
+// guess), convergence is checked more often to stop earlier.
+constexpr int kConvergenceCheckInterval = 200;
+constexpr int kWarmStartConvergenceCheckInterval = 20;
+
+// Maximum iterations of the levels of the coarse-to-fine modes which are
+// initialized from the solution of the next coarser level, and the interval
+// of their convergence checks in kIMCoarseToFineAdaptive mode. Only the
+// coarsest level gets the full iteration budget.
+constexpr int kCoarseToFineRefinementIterations = 40;
+constexpr int kCoarseToFineRefinementCheckInterval = 8;
+
+int GetTVInpaintingBlockCount(int width, int height) {
+  // InpaintAdaptiveDepthMapCUDA() uses overlapping blocks which produce
+  // output for (32 - 2 * kIterationsPerKernelCall)^2 pixels each, while
+  // InpaintImageCUDA() uses non-overlapping 32x32 blocks. Return the larger
+  // count.
+  constexpr int kBlockOutputSize = 32 - 2 * kIterationsPerKernelCall;
+  return cuda_util::GetBlockCount(width, kBlockOutputSize) *
+         cuda_util::GetBlockCount(height, kBlockOutputSize);
+}
+
+// Removes the converged blocks from the first active_block_count entries of
+// block_coordinates, given the per-block changes in tv_max_change, and returns
+// the new active block count. Compacts on the GPU if compaction_buffers is
+// given, otherwise on the CPU using block_coordinates_cpu (which must mirror
+// the content of block_coordinates) and max_change_cpu as scratch space.
+static int RetireConvergedTVBlocks(
+    cudaStream_t stream,
+    int active_block_count,
+    float max_change_rate_threshold,
+    const CUDABuffer<float>& tv_max_change,
+    CUDABuffer<uint16_t>* block_coordinates,
+    BlockCompactionBuffers* compaction_buffers,
+    uint16_t* block_coordinates_cpu,
+    float* max_change_cpu,
+    float* max_change_rate) {
+  if (compaction_buffers) {
+    RetireConvergedBlocksCUDA(
+        stream, active_block_count, max_change_rate_threshold,
+        tv_max_change, block_coordinates, compaction_buffers);
+    *max_change_rate = -1;
+    return compaction_buffers->DownloadActiveBlockCount(stream);
+  }
+  
+  tv_max_change.DownloadPartAsync(0, active_block_count * sizeof(float), stream, max_change_cpu);
+  cudaStreamSynchronize(stream);
+  int new_active_block_count = 0;
+  *max_change_rate = 0;
+  for (int j = 0; j < active_block_count; ++ j) {
+    *max_change_rate = std::max(*max_change_rate, max_change_cpu[j]);
+    if (max_change_cpu[j] > max_change_rate_threshold) {
+      block_coordinates_cpu[2 * new_active_block_count + 0] = block_coordinates_cpu[2 * j + 0];
+      block_coordinates_cpu[2 * new_active_block_count + 1] = block_coordinates_cpu[2 * j + 1];
+      ++ new_active_block_count;
+    }
+  }
+  if (new_active_block_count > 0 && new_active_block_count < active_block_count) {
+    // The stream is synchronized before block_coordinates_cpu is modified
+    // again, so the asynchronous upload is safe.
+    block_coordinates->UploadPartAsync(0, 2 * new_active_block_count * sizeof(uint16_t), stream, block_coordinates_cpu);
+  }
+  return new_active_block_count;
+}
+
+template<typename UBarT>
 __global__ void TVInpaintingInitializeVariablesKernel(
     int grid_dim_x,
     bool kUseSingleKernel,
@@ -56,8 +130,11 @@ __global__ void TVInpaintingInitializeVariablesKernel(
     CUDABuffer_<int16_t> tv_dual_x,
     CUDABuffer_<int16_t> tv_dual_y,
     CUDABuffer_<float> tv_u,
-    CUDABuffer_<float> tv_u_bar,
-    CUDABuffer_<uint16_t> block_coordinates) {
+    CUDABuffer_<UBarT> tv_u_bar,
+    CUDABuffer_<uint16_t> block_coordinates,
+    CUDABuffer_<float> initial_guess,
+    CUDABuffer_<float> coarser_solution,
+    HoleMap_ hole_map) {
   const int width = tv_u.width();
   const int height = tv_u.height();
   
@@ -79,6 +156,15 @@ __global__ void TVInpaintingInitializeVariablesKernel(
       threadIdx.y < 32 - kIterationsPerKernelCall &&
       x < width &&
       y < height;
+  
+  // If the hole map shows no holes in the output pixels of the block and
+  // their neighbors, no pixel can be active and the search is skipped.
+  const int block_min_x = x - threadIdx.x + kIterationsPerKernelCall;
+  const int block_min_y = y - threadIdx.y + kIterationsPerKernelCall;
+  const bool block_may_contain_holes = hole_map.MayContainHoles(
+      kDepthHoleMap, block_min_x - 1, block_min_y - 1,
+      block_min_x + min(static_cast<int>(blockDim.x), 32 - kIterationsPerKernelCall) - kIterationsPerKernelCall,
+      block_min_y + min(static_cast<int>(blockDim.y), 32 - kIterationsPerKernelCall) - kIterationsPerKernelCall);
 
   bool thread_is_active = false;
   if (kOutput) {
@@ -86,17 +172,36 @@ __global__ void TVInpaintingInitializeVariablesKernel(
     tv_dual_y(y, x) = 0;
     const float depth_input = depth_input_scaling_factor * tex2D<float>(depth_map_input, x, y);
     tv_flag(y, x) = (depth_input == 0);
-    thread_is_active =
+    thread_is_active = block_may_contain_holes &&
         (depth_input == 0 ||
          (x > 0 && tex2D<float>(depth_map_input, x - 1, y) == 0) ||
          (y > 0 && tex2D<float>(depth_map_input, x, y - 1) == 0) ||
          (x < width - 1 && tex2D<float>(depth_map_input, x + 1, y) == 0) ||
          (y < height - 1 && tex2D<float>(depth_map_input, x, y + 1) == 0));
     tv_dual_flag(y, x) = thread_is_active;
-    tv_u(y, x) = depth_input;
-    tv_u_bar(y, x) = depth_input;
+    float initial_value = depth_input;
+    if (depth_input == 0 && initial_guess.address() != nullptr &&
+        initial_guess(y, x) > 0) {
+      // Initialize the pixels to inpaint with the given guess where it is
+      // valid. tv_flag is still determined from the input only.
+      initial_value = initial_guess(y, x);
+    } else if (depth_input == 0 && coarser_solution.address() != nullptr) {
+      // Initialize the pixels to inpaint with the solution of the next
+      // coarser pyramid level.
+      initial_value = coarser_solution(
+          min(y / 2, coarser_solution.height() - 1),
+          min(x / 2, coarser_solution.width() - 1));
+    }
+    tv_u(y, x) = initial_value;
+    StoreInpaintingState(initial_value, &tv_u_bar(y, x));
   }
   
+  if (!block_may_contain_holes) {
+    if (threadIdx.x == 0 && threadIdx.y == 0) {
+      reinterpret_cast<uint8_t*>(block_coordinates.address())[blockIdx.x + blockIdx.y * grid_dim_x] = 0;
+    }
+    return;
+  }
   typedef cub::BlockReduce<
       int, 32, cub::BLOCK_REDUCE_WARP_REDUCTIONS, 32> BlockReduceInt;
   __shared__ typename BlockReduceInt::TempStorage int_storage;
@@ -198,14 +303,14 @@ __device__ void UpdateBlockActivations(
 // performs primal update and extrapolation step:
 // u^{k+1} = u^k + tau* div(p^{k+1})
 // \bar{u}^{k+1} = 2*u^{k+1} - u^k
-template<bool check_convergence, bool block_adaptive>
+template<bool check_convergence, bool block_adaptive, typename UBarT>
 __global__ void TVInpaintingPrimalStepKernel(
     const float cell_change_threshold,
     CUDABuffer_<bool> d_tv_flag,
     CUDABuffer_<int16_t> d_dualTVX,
     CUDABuffer_<int16_t> d_dualTVY,
     CUDABuffer_<float> d_u,
-    CUDABuffer_<float> d_u_bar,
+    CUDABuffer_<UBarT> d_u_bar,
     CUDABuffer_<float> d_m,
     CUDABuffer_<unsigned char> d_block_activities) {
   if (block_adaptive) {
@@ -248,7 +353,7 @@ __global__ void TVInpaintingPrimalStepKernel(
     update += kGamma * (update - u);
 
     d_u(y, x) = update;
-    d_u_bar(y, x) = 2 * update - u;
+    StoreInpaintingState(2 * update - u, &d_u_bar(y, x));
     
     if (check_convergence) {
       d_m(y, x) = fabs((update - u) / u);
@@ -266,12 +371,12 @@ __global__ void TVInpaintingPrimalStepKernel(
 // performs dual update step
 // p^{k=1} = \Pi_{|p|<=g} [ p^k + \sigma * \nabla \bar{u}^k ]
 // p^{k=1} = \Pi_{|p|<=g} [ (p^k + \sigma * \nabla \bar{u}^k) / (1+\sigma*huberEpsilon) ]
-template<bool use_weighting, bool block_adaptive>
+template<bool use_weighting, bool block_adaptive, typename UBarT>
 __global__ void TVInpaintingDualStepKernel(
     const float huber_epsilon,
     const float cell_change_threshold,
     CUDABuffer_<bool> d_tv_dual_flag,
-    CUDABuffer_<float> d_u,
+    CUDABuffer_<UBarT> d_u,
     cudaTextureObject_t d_tvWeight,
     CUDABuffer_<int16_t> d_dualTVX,
     CUDABuffer_<int16_t> d_dualTVY,
@@ -289,15 +394,15 @@ __global__ void TVInpaintingDualStepKernel(
     // update using the gradient of u
     constexpr float kDualStepWidth = 1.f;
     const float huberFactor = 1.0f / (1.0f + kDualStepWidth * 0.5f * huber_epsilon);
-    const float u = d_u(y, x);
+    const float u = LoadInpaintingState(d_u(y, x));
     dualTVX = kDualIntToFloat * d_dualTVX(y, x);
     dualTVY = kDualIntToFloat * d_dualTVY(y, x);
     resultX =
         huberFactor * (dualTVX + kDualStepWidth * 0.5f *
-        ( (x < d_u.width() - 1) ? (d_u(y, x + 1)  - u) : 0 ));
+        ( (x < d_u.width() - 1) ? (LoadInpaintingState(d_u(y, x + 1))  - u) : 0 ));
     resultY =
         huberFactor * (dualTVY + kDualStepWidth * 0.5f *
-        ( (y < d_u.height() - 1) ? (d_u(y + 1, x) - u) : 0 ));
+        ( (y < d_u.height() - 1) ? (LoadInpaintingState(d_u(y + 1, x)) - u) : 0 ));
     
     // project onto the g-unit ball
     float denom;
@@ -332,7 +437,7 @@ __global__ void TVInpaintingDualStepKernel(
 
 // This kernel does not produce output for the first kIterationsPerKernelCall
 // rows and columns and for the last kIterationsPerKernelCall rows and columns.
-template<int block_size_x, int block_size_y, bool use_weighting, bool check_convergence>
+template<int block_size_x, int block_size_y, bool use_weighting, bool check_convergence, typename UBarT>
 __global__ void TVInpaintingDualAndPrimalStepsKernel(
     const float huber_epsilon,
     CUDABuffer_<uint16_t> block_coordinates,
@@ -342,7 +447,7 @@ __global__ void TVInpaintingDualAndPrimalStepsKernel(
     CUDABuffer_<int16_t> d_dualTVX,
     CUDABuffer_<int16_t> d_dualTVY,
     CUDABuffer_<float> d_u,
-    CUDABuffer_<float> d_u_bar,
+    CUDABuffer_<UBarT> d_u_bar,
     CUDABuffer_<float> d_m) {
   const int x = max(0, min(d_u.width() - 1, block_coordinates(0, 2 * blockIdx.x + 0) + threadIdx.x - kIterationsPerKernelCall));
   const int y = max(0, min(d_u.height() - 1, block_coordinates(0, 2 * blockIdx.x + 1) + threadIdx.y - kIterationsPerKernelCall));
@@ -367,7 +472,7 @@ __global__ void TVInpaintingDualAndPrimalStepsKernel(
   __shared__ float dual_y_shared[block_size_x * block_size_y];
 
   int shared_mem_index = threadIdx.x + block_size_x * threadIdx.y;
-  float u_bar = d_u_bar(y, x);
+  float u_bar = LoadInpaintingState(d_u_bar(y, x));
   float dualTVX = kDualIntToFloat * d_dualTVX(y, x);
   float dualTVY = kDualIntToFloat * d_dualTVY(y, x);
   float u = d_u(y, x);
@@ -465,7 +570,7 @@ __global__ void TVInpaintingDualAndPrimalStepsKernel(
   if (kOutput) {
     if (kPrimalFlag) {
       d_u(y, x) = u;
-      d_u_bar(y, x) = u_bar;
+      StoreInpaintingState(u_bar, &d_u_bar(y, x));
     }
     if (kDualFlag) {
       d_dualTVX(y, x) = dualTVX * 1.f / kDualIntToFloat;
@@ -474,6 +579,19 @@ __global__ void TVInpaintingDualAndPrimalStepsKernel(
   }
 }
 
+KernelOccupancy GetTVInpaintingKernelOccupancy(bool half_storage) {
+  if (half_storage) {
+    return cuda_util::ComputeKernelOccupancy(
+        TVInpaintingDualAndPrimalStepsKernel<32, 32, true, false, __half>,
+        32 * 32, 0);
+  } else {
+    return cuda_util::ComputeKernelOccupancy(
+        TVInpaintingDualAndPrimalStepsKernel<32, 32, true, false, float>,
+        32 * 32, 0);
+  }
+}
+
+template<typename UBarT>
 int InpaintAdaptiveDepthMapCUDA(
     cudaStream_t stream,
     int max_num_iterations,
@@ -487,11 +605,20 @@ int InpaintAdaptiveDepthMapCUDA(
     CUDABuffer<bool>* tv_dual_flag,
     CUDABuffer<int16_t>* tv_dual_x,
     CUDABuffer<int16_t>* tv_dual_y,
-    CUDABuffer<float>* tv_u_bar,
+    CUDABuffer<UBarT>* tv_u_bar,
     CUDABuffer<float>* tv_max_change,
     CUDABuffer<float>* depth_map_output,
     CUDABuffer<uint16_t>* block_coordinates,
-    CUDABuffer<unsigned char>* block_activities) {
+    CUDABuffer<unsigned char>* block_activities,
+    BlockCompactionBuffers* compaction_buffers,
+    int* saved_block_iterations,
+    int convergence_check_interval,
+    const CUDABuffer<float>* initial_guess,
+    const CUDABuffer<float>* coarser_solution,
+    const InpaintingDeadline* deadline,
+    InpaintingResidual* residual,
+    HoleMap* hole_map) {
+  NVTXRange range("InpaintAdaptiveDepthMapCUDA");
   const int width = depth_map_output->width();
   const int height = depth_map_output->height();
   const int kBlockWidth = block_adaptive ? 16 : 32;
@@ -512,7 +639,10 @@ int InpaintAdaptiveDepthMapCUDA(
   // Initialize variables.
   TVInpaintingInitializeVariablesKernel<<<grid_dim, block_dim, 0, stream>>>(
       grid_dim.x, kUseSingleKernel, depth_input_scaling_factor, depth_map_input, tv_flag->ToCUDA(), tv_dual_flag->ToCUDA(), tv_dual_x->ToCUDA(),
-      tv_dual_y->ToCUDA(), tv_u->ToCUDA(), tv_u_bar->ToCUDA(), block_coordinates->ToCUDA());
+      tv_dual_y->ToCUDA(), tv_u->ToCUDA(), tv_u_bar->ToCUDA(), block_coordinates->ToCUDA(),
+      initial_guess ? initial_guess->ToCUDA() : CUDABuffer_<float>(),
+      coarser_solution ? coarser_solution->ToCUDA() : CUDABuffer_<float>(),
+      hole_map ? hole_map->ToCUDA() : HoleMap_());
   CHECK_CUDA_NO_ERROR();
 
   if (block_adaptive) {
@@ -523,33 +653,61 @@ int InpaintAdaptiveDepthMapCUDA(
     CHECK_CUDA_NO_ERROR();
   }
   
-  uint8_t* block_activity = new uint8_t[grid_dim.x * grid_dim.y];
-  block_coordinates->DownloadPartAsync(0, grid_dim.x * grid_dim.y * sizeof(uint8_t), stream, reinterpret_cast<uint16_t*>(block_activity));
-  cudaStreamSynchronize(stream);
+  // Temporary host arrays, reused between calls.
+  HostScratchScope scratch;
   int active_block_count = 0;
-  uint16_t* block_coordinates_cpu = new uint16_t[2 * grid_dim.x * grid_dim.y];
-  for (size_t y = 0; y < grid_dim.y; ++ y) {
-    for (size_t x = 0; x < grid_dim.x; ++ x) {
-      if (block_activity[x + y * grid_dim.x] > 0) {
-        block_coordinates_cpu[2 * active_block_count + 0] = x * (kUseSingleKernel ? kBlockOutputSizeX : kBlockWidth);
-        block_coordinates_cpu[2 * active_block_count + 1] = y * (kUseSingleKernel ? kBlockOutputSizeY : kBlockHeight);
-        ++ active_block_count;
+  uint16_t* block_coordinates_cpu = scratch.Allocate<uint16_t>(2 * grid_dim.x * grid_dim.y);
+  if (hole_map && kUseSingleKernel && !block_adaptive) {
+    // Blocks with holes up to kHoleMapCellSize pixels away from their output
+    // are selected as well. These few blocks without active pixels retire at
+    // the first convergence check.
+    active_block_count = hole_map->SelectActiveBlocks(
+        stream, kDepthHoleMap, kBlockOutputSizeX, kBlockOutputSizeY, 1,
+        grid_dim.x, grid_dim.y, block_coordinates_cpu, nullptr);
+  } else {
+    uint8_t* block_activity = scratch.Allocate<uint8_t>(grid_dim.x * grid_dim.y);
+    block_coordinates->DownloadPartAsync(0, grid_dim.x * grid_dim.y * sizeof(uint8_t), stream, reinterpret_cast<uint16_t*>(block_activity));
+    cudaStreamSynchronize(stream);
+    for (size_t y = 0; y < grid_dim.y; ++ y) {
+      for (size_t x = 0; x < grid_dim.x; ++ x) {
+        if (block_activity[x + y * grid_dim.x] > 0) {
+          block_coordinates_cpu[2 * active_block_count + 0] = x * (kUseSingleKernel ? kBlockOutputSizeX : kBlockWidth);
+          block_coordinates_cpu[2 * active_block_count + 1] = y * (kUseSingleKernel ? kBlockOutputSizeY : kBlockHeight);
+          ++ active_block_count;
+        }
       }
     }
   }
-  delete[] block_activity;
+  range.AddValue("active blocks", active_block_count);
+  if (saved_block_iterations) {
+    *saved_block_iterations = 0;
+  }
+  if (residual) {
+    *residual = InpaintingResidual();
+    residual->unconverged_block_fraction = 0;
+  }
   if (active_block_count == 0) {
-    delete[] block_coordinates_cpu;
     return 0;
   }
   block_coordinates->UploadPartAsync(0, 2 * active_block_count * sizeof(uint16_t), stream, block_coordinates_cpu);
-  float* max_change = new float[grid_dim.x * grid_dim.y];
+  float* max_change = scratch.Allocate<float>(grid_dim.x * grid_dim.y);
   
   // Run optimization iterations.
+  if (deadline) {
+    max_num_iterations = deadline->LimitIterations(
+        max_num_iterations, convergence_check_interval);
+  }
+  const int initial_active_block_count = active_block_count;
+  const int iterations_per_step = kUseSingleKernel ? kIterationsPerKernelCall : 1;
+  float max_change_rate = -1;
+  bool deadline_reached = false;
+  int saved = 0;
   int i = 0;
-  int last_convergence_check_iteration = -180;
-  for (i = 0; i < max_num_iterations; i += (kUseSingleKernel ? kIterationsPerKernelCall : 1)) {
-    const bool check_convergence = (i - last_convergence_check_iteration >= 200);
+  int last_convergence_check_iteration = 20 - convergence_check_interval;
+  for (i = 0; i < max_num_iterations; i += iterations_per_step) {
+    const bool check_convergence = (i - last_convergence_check_iteration >= convergence_check_interval);
+    // Count the block iterations which are skipped for retired blocks.
+    saved += (initial_active_block_count - active_block_count) * iterations_per_step;
     
     if (kUseSingleKernel) {
       dim3 grid_dim_single_kernel(active_block_count);
@@ -651,38 +809,214 @@ int InpaintAdaptiveDepthMapCUDA(
     }  // if (kUseSingleKernel)
 
     if (check_convergence) {
-      tv_max_change->DownloadPartAsync(0, active_block_count * sizeof(float), stream, max_change);
-      cudaStreamSynchronize(stream);
-      int new_active_block_count = 0;
-      for (int j = 0, end = active_block_count; j < end; j ++) {
-        if (max_change[j] > max_change_rate_threshold) {
-          // block_coordinates_cpu[2 * new_active_block_count + 0] = block_coordinates_cpu[2 * j + 0];
-          // block_coordinates_cpu[2 * new_active_block_count + 1] = block_coordinates_cpu[2 * j + 1];
-          ++ new_active_block_count;
-        }
-      }
+      // Retire the blocks which have converged, such that only the remaining
+      // ones are launched in the following iterations.
+      const int new_active_block_count = RetireConvergedTVBlocks(
+          stream, active_block_count, max_change_rate_threshold, *tv_max_change,
+          block_coordinates, compaction_buffers, block_coordinates_cpu,
+          max_change, &max_change_rate);
       //LOG(INFO) << "[" << i << "] Active blocks: " << active_block_count << " -> " << new_active_block_count;
-      //LOG(INFO) << "max_change_rate: " << max_change_rate << " / " << max_change_rate_threshold;
+      active_block_count = new_active_block_count;
       if (new_active_block_count == 0) {
         break;
       }
-      //active_block_count = new_active_block_count;
-      //block_coordinates->UploadPartAsync(0, 2 * active_block_count * sizeof(uint16_t), stream, block_coordinates_cpu);
       last_convergence_check_iteration = i;
+      if (deadline && deadline->Reached()) {
+        deadline_reached = true;
+        break;
+      }
     } // if (check_convergence)
   } // for (i = 0; i < max_num_iterations; ++i)
-  delete[] max_change;
-  delete[] block_coordinates_cpu;
   CHECK_CUDA_NO_ERROR();
   
-  if (i < max_num_iterations) {
-    LOG(INFO) << "TV converged after iteration: " << i;
+  if (saved_block_iterations) {
+    *saved_block_iterations = saved;
+  }
+  if (residual) {
+    residual->max_change_rate = max_change_rate;
+    residual->unconverged_block_fraction =
+        active_block_count / static_cast<float>(initial_active_block_count);
+    residual->deadline_reached = deadline_reached;
+  }
+  
+  if (deadline_reached) {
+    LOG(INFO) << "TV stopped at the deadline after iteration: " << i << " (unconverged blocks: " << active_block_count << " / " << initial_active_block_count << ")";
+  } else if (i < max_num_iterations) {
+    LOG(INFO) << "TV converged after iteration: " << i << " (saved block iterations: " << saved << ")";
   } else {
-    LOG(WARNING) << "TV used maximum iteration count: " << i;
+    LOG(WARNING) << "TV used maximum iteration count: " << i << " (saved block iterations: " << saved << ")";
   }
+  range.AddValue("iterations", i);
   return i;
 }
 
+__global__ void DownsampleDepthMapForInpaintingCUDAKernel(
+    float depth_input_scaling_factor,
+    cudaTextureObject_t depth_map_input,
+    int input_width,
+    int input_height,
+    CUDABuffer_<float> output) {
+  const unsigned int x = blockIdx.x * blockDim.x + threadIdx.x;
+  const unsigned int y = blockIdx.y * blockDim.y + threadIdx.y;
+  
+  if (x < output.width() && y < output.height()) {
+    // Average the valid depths of the 2x2 pixel block. The result is invalid
+    // (zero) only if all of them are invalid.
+    float sum = 0;
+    int count = 0;
+    for (int dy = 0; dy < 2; ++ dy) {
+      for (int dx = 0; dx < 2; ++ dx) {
+        const int input_x = 2 * x + dx;
+        const int input_y = 2 * y + dy;
+        if (input_x < input_width && input_y < input_height) {
+          const float depth = tex2D<float>(depth_map_input, input_x, input_y);
+          if (depth != 0) {
+            sum += depth;
+            ++ count;
+          }
+        }
+      }
+    }
+    output(y, x) = (count > 0) ? (depth_input_scaling_factor * sum / count) : 0;
+  }
+}
+
+TVInpaintingPyramid::TVInpaintingPyramid(int width, int height, int num_levels) {
+  levels.resize(num_levels);
+  for (int i = 0; i < num_levels; ++ i) {
+    width = (width + 1) / 2;
+    height = (height + 1) / 2;
+    Level& level = levels[i];
+    level.depth_input.reset(new CUDABuffer<float>(height, width));
+    level.depth_input->CreateTextureObject(
+        cudaAddressModeClamp, cudaAddressModeClamp, cudaFilterModePoint,
+        cudaReadModeElementType, false, &level.depth_input_texture);
+    level.gradient_magnitude_div_sqrt2.reset(new CUDABuffer<uint8_t>(height, width));
+    level.gradient_magnitude_div_sqrt2->CreateTextureObject(
+        cudaAddressModeClamp, cudaAddressModeClamp, cudaFilterModePoint,
+        cudaReadModeElementType, false, &level.gradient_magnitude_div_sqrt2_texture);
+    level.tv_flag.reset(new CUDABuffer<bool>(height, width));
+    level.tv_dual_flag.reset(new CUDABuffer<bool>(height, width));
+    level.tv_dual_x.reset(new CUDABuffer<int16_t>(height, width));
+    level.tv_dual_y.reset(new CUDABuffer<int16_t>(height, width));
+    level.tv_u_bar.reset(new CUDABuffer<float>(height, width));
+    level.tv_max_change.reset(new CUDABuffer<float>(1, height * width));
+    level.depth_map_output.reset(new CUDABuffer<float>(height, width));
+    level.block_coordinates.reset(new CUDABuffer<uint16_t>(1, height * width));
+    level.block_activities.reset(new CUDABuffer<unsigned char>(height, width));
+  }
+}
+
+TVInpaintingPyramid::~TVInpaintingPyramid() {
+  for (Level& level : levels) {
+    cudaDestroyTextureObject(level.depth_input_texture);
+    cudaDestroyTextureObject(level.gradient_magnitude_div_sqrt2_texture);
+  }
+}
+
+template<typename UBarT>
+int InpaintCoarseToFineDepthMapCUDA(
+    cudaStream_t stream,
+    int max_num_iterations,
+    float max_change_rate_threshold,
+    float depth_input_scaling_factor,
+    bool adaptive,
+    bool use_tv_weights,
+    cudaTextureObject_t gradient_magnitude_div_sqrt2,
+    cudaTextureObject_t depth_map_input,
+    CUDABuffer<bool>* tv_flag,
+    CUDABuffer<bool>* tv_dual_flag,
+    CUDABuffer<int16_t>* tv_dual_x,
+    CUDABuffer<int16_t>* tv_dual_y,
+    CUDABuffer<UBarT>* tv_u_bar,
+    CUDABuffer<float>* tv_max_change,
+    CUDABuffer<float>* depth_map_output,
+    CUDABuffer<uint16_t>* block_coordinates,
+    CUDABuffer<unsigned char>* block_activities,
+    TVInpaintingPyramid* pyramid,
+    const CUDABuffer<float>* initial_guess,
+    BlockCompactionBuffers* compaction_buffers,
+    int* saved_block_iterations,
+    const InpaintingDeadline* deadline,
+    InpaintingResidual* residual) {
+  CHECK_NOTNULL(pyramid);
+  
+  // Build the depth map pyramid by averaging the valid depths.
+  constexpr int kBlockWidth = 32;
+  constexpr int kBlockHeight = 32;
+  cudaTextureObject_t finer_depth_map = depth_map_input;
+  float finer_depth_scaling_factor = depth_input_scaling_factor;
+  int finer_width = depth_map_output->width();
+  int finer_height = depth_map_output->height();
+  for (TVInpaintingPyramid::Level& level : pyramid->levels) {
+    CUDABuffer<float>* coarse_depth = level.depth_input.get();
+    dim3 grid_dim(cuda_util::GetBlockCount(coarse_depth->width(), kBlockWidth),
+                  cuda_util::GetBlockCount(coarse_depth->height(), kBlockHeight));
+    dim3 block_dim(kBlockWidth, kBlockHeight);
+    DownsampleDepthMapForInpaintingCUDAKernel<<<grid_dim, block_dim, 0, stream>>>(
+        finer_depth_scaling_factor, finer_depth_map, finer_width, finer_height,
+        coarse_depth->ToCUDA());
+    CHECK_CUDA_NO_ERROR();
+    
+    finer_depth_map = level.depth_input_texture;
+    finer_depth_scaling_factor = 1.f;
+    finer_width = coarse_depth->width();
+    finer_height = coarse_depth->height();
+  }
+  
+  // Solve from the coarsest to the finest level, initializing each level with
+  // the solution of the next coarser one. Since the initialization of the
+  // finer levels is already close to their solution, they only run a few
+  // refinement iterations, and the adaptive variant checks for convergence
+  // within these to stop earlier. The initial guess is only used on the
+  // full-resolution level, where it takes precedence over the coarser
+  // solution.
+  const int refinement_iterations =
+      std::min(max_num_iterations, kCoarseToFineRefinementIterations);
+  const int warm_start_interval =
+      adaptive ? kCoarseToFineRefinementCheckInterval : kConvergenceCheckInterval;
+  int total_saved_block_iterations = 0;
+  int level_saved_block_iterations;
+  const CUDABuffer<float>* coarser_solution = nullptr;
+  for (int i = static_cast<int>(pyramid->levels.size()) - 1; i >= 0; -- i) {
+    TVInpaintingPyramid::Level& level = pyramid->levels[i];
+    InpaintAdaptiveDepthMapCUDA(
+        stream,
+        coarser_solution ? refinement_iterations : max_num_iterations,
+        max_change_rate_threshold, 1.f,
+        false, use_tv_weights,
+        level.gradient_magnitude_div_sqrt2_texture, level.depth_input_texture,
+        level.tv_flag.get(), level.tv_dual_flag.get(),
+        level.tv_dual_x.get(), level.tv_dual_y.get(), level.tv_u_bar.get(),
+        level.tv_max_change.get(), level.depth_map_output.get(),
+        level.block_coordinates.get(), level.block_activities.get(),
+        compaction_buffers, &level_saved_block_iterations,
+        coarser_solution ? warm_start_interval : kConvergenceCheckInterval,
+        nullptr, coarser_solution, deadline, nullptr, nullptr);
+    total_saved_block_iterations += level_saved_block_iterations;
+    coarser_solution = level.depth_map_output.get();
+  }
+  
+  const int iterations = InpaintAdaptiveDepthMapCUDA(
+      stream,
+      coarser_solution ? refinement_iterations : max_num_iterations,
+      max_change_rate_threshold, depth_input_scaling_factor,
+      false, use_tv_weights,
+      gradient_magnitude_div_sqrt2, depth_map_input,
+      tv_flag, tv_dual_flag, tv_dual_x, tv_dual_y, tv_u_bar, tv_max_change,
+      depth_map_output, block_coordinates, block_activities,
+      compaction_buffers, &level_saved_block_iterations,
+      (coarser_solution || initial_guess) ? warm_start_interval : kConvergenceCheckInterval,
+      initial_guess, coarser_solution, deadline, residual, nullptr);
+  total_saved_block_iterations += level_saved_block_iterations;
+  
+  if (saved_block_iterations) {
+    *saved_block_iterations = total_saved_block_iterations;
+  }
+  return iterations;
+}
+
+template<typename UBarT>
 int InpaintDepthMapCUDA(
     cudaStream_t stream,
     InpaintingMode inpainting_mode,
@@ -696,11 +1030,20 @@ int InpaintDepthMapCUDA(
     CUDABuffer<bool>* tv_dual_flag,
     CUDABuffer<int16_t>* tv_dual_x,
     CUDABuffer<int16_t>* tv_dual_y,
-    CUDABuffer<float>* tv_u_bar,
+    CUDABuffer<UBarT>* tv_u_bar,
     CUDABuffer<float>* tv_max_change,
     CUDABuffer<float>* depth_map_output,
     CUDABuffer<uint16_t>* block_coordinates,
-    CUDABuffer<unsigned char>* block_activities) {
+    CUDABuffer<unsigned char>* block_activities,
+    TVInpaintingPyramid* pyramid,
+    const CUDABuffer<float>* initial_guess,
+    BlockCompactionBuffers* compaction_buffers,
+    int* saved_block_iterations,
+    const InpaintingDeadline* deadline,
+    InpaintingResidual* residual,
+    HoleMap* hole_map) {
+  const int convergence_check_interval =
+      initial_guess ? kWarmStartConvergenceCheckInterval : kConvergenceCheckInterval;
   switch(inpainting_mode) {
     case kIMClassic:
       return InpaintAdaptiveDepthMapCUDA(
@@ -709,7 +1052,10 @@ int InpaintDepthMapCUDA(
           false, use_tv_weights,
           gradient_magnitude_div_sqrt2, depth_map_input,
           tv_flag, tv_dual_flag, tv_dual_x, tv_dual_y, tv_u_bar, tv_max_change,
-          depth_map_output, block_coordinates, block_activities);
+          depth_map_output, block_coordinates, block_activities,
+          compaction_buffers, saved_block_iterations,
+          convergence_check_interval, initial_guess, nullptr,
+          deadline, residual, hole_map);
     case kIMAdaptive:
       return InpaintAdaptiveDepthMapCUDA(
           stream, 
@@ -717,7 +1063,21 @@ int InpaintDepthMapCUDA(
           true, use_tv_weights,
           gradient_magnitude_div_sqrt2, depth_map_input,
           tv_flag, tv_dual_flag, tv_dual_x, tv_dual_y, tv_u_bar, tv_max_change,
-          depth_map_output, block_coordinates, block_activities);
+          depth_map_output, block_coordinates, block_activities,
+          compaction_buffers, saved_block_iterations,
+          convergence_check_interval, initial_guess, nullptr,
+          deadline, residual, hole_map);
+    case kIMCoarseToFine:
+    case kIMCoarseToFineAdaptive:
+      return InpaintCoarseToFineDepthMapCUDA(
+          stream,
+          max_num_iterations, max_change_rate_threshold, depth_input_scaling_factor,
+          inpainting_mode == kIMCoarseToFineAdaptive, use_tv_weights,
+          gradient_magnitude_div_sqrt2, depth_map_input,
+          tv_flag, tv_dual_flag, tv_dual_x, tv_dual_y, tv_u_bar, tv_max_change,
+          depth_map_output, block_coordinates, block_activities,
+          pyramid, initial_guess, compaction_buffers, saved_block_iterations,
+          deadline, residual);
     default:
       return InpaintAdaptiveDepthMapCUDA(
           stream, 
@@ -725,62 +1085,75 @@ int InpaintDepthMapCUDA(
           false, use_tv_weights,
           gradient_magnitude_div_sqrt2, depth_map_input,
           tv_flag, tv_dual_flag, tv_dual_x, tv_dual_y, tv_u_bar, tv_max_change,
-          depth_map_output, block_coordinates, block_activities);
+          depth_map_output, block_coordinates, block_activities,
+          compaction_buffers, saved_block_iterations,
+          convergence_check_interval, initial_guess, nullptr,
+          deadline, residual, hole_map);
   } // switch(inpainting_mode)
 }
 
+// The color TV variables are stored interleaved with the RGB channels in
+// x, y, z (w is unused), such that each access to a pixel's variables is a
+// single vectorized memory transaction. The output u is always float4, the
+// other variables use StateT (float4 or Half4).
+template<typename StateT>
 __global__ void TVInpaintingInitializeVariablesKernel(
     int grid_dim_x,
     CUDABuffer_<uchar4> input,
+    CUDABuffer_<uchar4> initial_guess,
     CUDABuffer_<bool> tv_flag,
     CUDABuffer_<bool> tv_dual_flag,
-    CUDABuffer_<float> tv_dual_x_r,
-    CUDABuffer_<float> tv_dual_x_g,
-    CUDABuffer_<float> tv_dual_x_b,
-    CUDABuffer_<float> tv_dual_y_r,
-    CUDABuffer_<float> tv_dual_y_g,
-    CUDABuffer_<float> tv_dual_y_b,
-    CUDABuffer_<float> tv_u_r,
-    CUDABuffer_<float> tv_u_g,
-    CUDABuffer_<float> tv_u_b,
-    CUDABuffer_<float> tv_u_bar_r,
-    CUDABuffer_<float> tv_u_bar_g,
-    CUDABuffer_<float> tv_u_bar_b,
-    CUDABuffer_<uint16_t> block_coordinates) {
+    CUDABuffer_<StateT> tv_dual_x,
+    CUDABuffer_<StateT> tv_dual_y,
+    CUDABuffer_<float4> tv_u,
+    CUDABuffer_<StateT> tv_u_bar,
+    CUDABuffer_<uint16_t> block_coordinates,
+    HoleMap_ hole_map) {
   const unsigned int x = blockIdx.x * blockDim.x + threadIdx.x;
   const unsigned int y = blockIdx.y * blockDim.y + threadIdx.y;
 
-  const int width = tv_u_r.width();
-  const int height = tv_u_r.height();
+  const int width = tv_u.width();
+  const int height = tv_u.height();
+  // Skips the search for active pixels if the hole map shows no holes in the
+  // block and its neighbor pixels, see the depth variant of this kernel.
+  const bool block_may_contain_holes = hole_map.MayContainHoles(
+      kColorHoleMap,
+      blockIdx.x * blockDim.x - 1, blockIdx.y * blockDim.y - 1,
+      (blockIdx.x + 1) * blockDim.x, (blockIdx.y + 1) * blockDim.y);
   bool thread_is_active = false;
   if (x < width && y < height) {
-    tv_dual_x_r(y, x) = 0.f;
-    tv_dual_x_g(y, x) = 0.f;
-    tv_dual_x_b(y, x) = 0.f;
-    tv_dual_y_r(y, x) = 0.f;
-    tv_dual_y_g(y, x) = 0.f;
-    tv_dual_y_b(y, x) = 0.f;
+    StoreInpaintingState(make_float3(0.f, 0.f, 0.f), &tv_dual_x(y, x));
+    StoreInpaintingState(make_float3(0.f, 0.f, 0.f), &tv_dual_y(y, x));
     const uchar4 f_input = input(y, x);
     tv_flag(y, x) = (f_input.w == 0);
-    thread_is_active =
+    thread_is_active = block_may_contain_holes &&
         (f_input.w == 0 ||
          (x > 0 && input(y, x - 1).w == 0) ||
          (y > 0 && input(y - 1, x).w == 0) ||
          (x < input.width() - 1 && input(y, x + 1).w == 0) ||
          (y < input.height() - 1 && input(y + 1, x).w == 0));
     tv_dual_flag(y, x) = thread_is_active;
+    uchar4 initial_value = f_input;
+    if (f_input.w == 0 && initial_guess.address() != nullptr &&
+        initial_guess(y, x).w != 0) {
+      // Initialize the pixels to inpaint with the given guess where it is
+      // valid.
+      initial_value = initial_guess(y, x);
+    }
     const float3 f_input_float = make_float3(
-        (1.f / 255.f) * f_input.x,
-        (1.f / 255.f) * f_input.y,
-        (1.f / 255.f) * f_input.z);
-    tv_u_r(y, x) = f_input_float.x;
-    tv_u_g(y, x) = f_input_float.y;
-    tv_u_b(y, x) = f_input_float.z;
-    tv_u_bar_r(y, x) = f_input_float.x;
-    tv_u_bar_g(y, x) = f_input_float.y;
-    tv_u_bar_b(y, x) = f_input_float.z;
+        (1.f / 255.f) * initial_value.x,
+        (1.f / 255.f) * initial_value.y,
+        (1.f / 255.f) * initial_value.z);
+    StoreInpaintingState(f_input_float, &tv_u(y, x));
+    StoreInpaintingState(f_input_float, &tv_u_bar(y, x));
   }
   
+  if (!block_may_contain_holes) {
+    if (threadIdx.x == 0 && threadIdx.y == 0) {
+      reinterpret_cast<uint8_t*>(block_coordinates.address())[blockIdx.x + blockIdx.y * grid_dim_x] = 0;
+    }
+    return;
+  }
   typedef cub::BlockReduce<
       int, 32, cub::BLOCK_REDUCE_WARP_REDUCTIONS, 32> BlockReduceInt;
   __shared__ typename BlockReduceInt::TempStorage int_storage;
@@ -793,22 +1166,14 @@ __global__ void TVInpaintingInitializeVariablesKernel(
 // performs primal update and extrapolation step:
 // u^{k+1} = u^k + tau* div(p^{k+1})
 // \bar{u}^{k+1} = 2*u^{k+1} - u^k
-template<bool check_convergence>
+template<bool check_convergence, typename StateT>
 __global__ void TVInpaintingPrimalStepKernel(
     CUDABuffer_<uint16_t> block_coordinates,
     CUDABuffer_<bool> tv_flag,
-    CUDABuffer_<float> d_dualTVX_r,
-    CUDABuffer_<float> d_dualTVX_g,
-    CUDABuffer_<float> d_dualTVX_b,
-    CUDABuffer_<float> d_dualTVY_r,
-    CUDABuffer_<float> d_dualTVY_g,
-    CUDABuffer_<float> d_dualTVY_b,
-    CUDABuffer_<float> d_u_r,
-    CUDABuffer_<float> d_u_g,
-    CUDABuffer_<float> d_u_b,
-    CUDABuffer_<float> d_u_bar_r,
-    CUDABuffer_<float> d_u_bar_g,
-    CUDABuffer_<float> d_u_bar_b,
+    CUDABuffer_<StateT> d_dualTVX,
+    CUDABuffer_<StateT> d_dualTVY,
+    CUDABuffer_<float4> d_u,
+    CUDABuffer_<StateT> d_u_bar,
     CUDABuffer_<float> d_m) {
   const int x = block_coordinates(0, 2 * blockIdx.x + 0) + threadIdx.x;
   const int y = block_coordinates(0, 2 * blockIdx.x + 1) + threadIdx.y;
@@ -819,7 +1184,7 @@ __global__ void TVInpaintingPrimalStepKernel(
   
   // only update within the inpainting region (f == 0)
   float max_change = 0;
-  if (x < d_u_r.width() && y < d_u_r.height() && tv_flag(y, x)) {
+  if (x < d_u.width() && y < d_u.height() && tv_flag(y, x)) {
     // this will accumulate the update step for the primal variable
     float3 update = make_float3(0, 0, 0);
     // this will accumulate all row entries of the linear operator for the preconditioned step width
@@ -827,36 +1192,25 @@ __global__ void TVInpaintingPrimalStepKernel(
 
     // compute divergence update of dualTV - Neumann boundary conditions,
     // keep track of row sum for preconditioning
-    update.x += d_dualTVX_r(y, x) + d_dualTVY_r(y, x);
-    update.y += d_dualTVX_g(y, x) + d_dualTVY_g(y, x);
-    update.z += d_dualTVX_b(y, x) + d_dualTVY_b(y, x);
+    update += LoadInpaintingState(d_dualTVX(y, x)) + LoadInpaintingState(d_dualTVY(y, x));
     rowSum += 2;
     if (x > 0) {
-      update.x -= d_dualTVX_r(y, x - 1);
-      update.y -= d_dualTVX_g(y, x - 1);
-      update.z -= d_dualTVX_b(y, x - 1);
+      update = update - LoadInpaintingState(d_dualTVX(y, x - 1));
       rowSum++;
     }
     if (y > 0) {
-      update.x -= d_dualTVY_r(y - 1, x);
-      update.y -= d_dualTVY_g(y - 1, x);
-      update.z -= d_dualTVY_b(y - 1, x);
+      update = update - LoadInpaintingState(d_dualTVY(y - 1, x));
       rowSum++;
     }
 
     constexpr float kPrimalStepWidth = 1.f;
     const float tau = kPrimalStepWidth / rowSum;
-    const float3 u = make_float3(d_u_r(y, x), d_u_g(y, x), d_u_b(y, x));
+    const float3 u = LoadInpaintingState(d_u(y, x));
 
     update = u + tau * update;
 
-    d_u_r(y, x) = update.x;
-    d_u_g(y, x) = update.y;
-    d_u_b(y, x) = update.z;
-    float3 u_bar = 2 * update - u;
-    d_u_bar_r(y, x) = u_bar.x;
-    d_u_bar_g(y, x) = u_bar.y;
-    d_u_bar_b(y, x) = u_bar.z;
+    StoreInpaintingState(update, &d_u(y, x));
+    StoreInpaintingState(2 * update - u, &d_u_bar(y, x));
     
     if (check_convergence) {
       max_change = max(max(fabs((update.x - u.x) / u.x),
@@ -875,43 +1229,37 @@ __global__ void TVInpaintingPrimalStepKernel(
 
 // performs dual update step
 // p^{k=1} = \Pi_{|p|<=g} [ p^k + \sigma * \nabla \bar{u}^k ]
-template<bool use_weighting>
+template<bool use_weighting, typename StateT>
 __global__ void TVInpaintingDualStepKernel(
     CUDABuffer_<uint16_t> block_coordinates,
     CUDABuffer_<bool> tv_dual_flag,
-    CUDABuffer_<float> d_u_r,
-    CUDABuffer_<float> d_u_g,
-    CUDABuffer_<float> d_u_b,
+    CUDABuffer_<StateT> d_u,
     cudaTextureObject_t d_tvWeight,
-    CUDABuffer_<float> d_dualTVX_r,
-    CUDABuffer_<float> d_dualTVX_g,
-    CUDABuffer_<float> d_dualTVX_b,
-    CUDABuffer_<float> d_dualTVY_r,
-    CUDABuffer_<float> d_dualTVY_g,
-    CUDABuffer_<float> d_dualTVY_b) {
+    CUDABuffer_<StateT> d_dualTVX,
+    CUDABuffer_<StateT> d_dualTVY) {
   const int x = block_coordinates(0, 2 * blockIdx.x + 0) + threadIdx.x;
   const int y = block_coordinates(0, 2 * blockIdx.x + 1) + threadIdx.y;
   
-  if (x < d_u_r.width() && y < d_u_r.height() && tv_dual_flag(y, x)) {
+  if (x < d_u.width() && y < d_u.height() && tv_dual_flag(y, x)) {
     const float dualStepWidth = 1.0f;
     const float HUBER_EPS = 0.01f;
     const float huberFactor = 1.0f / (1.0f + dualStepWidth * 0.5f * HUBER_EPS);
     
     // update using the gradient of u
-    const float3 u = make_float3(d_u_r(y, x), d_u_g(y, x), d_u_b(y, x));
+    const float3 u = LoadInpaintingState(d_u(y, x));
     constexpr float kDualStepWidth = 1.f;
     
     float3 u_plusx_minus_u = make_float3(0, 0, 0);
-    if (x < d_u_r.width() - 1) {
-      u_plusx_minus_u = make_float3(d_u_r(y, x + 1), d_u_g(y, x + 1), d_u_b(y, x + 1)) - u;
+    if (x < d_u.width() - 1) {
+      u_plusx_minus_u = LoadInpaintingState(d_u(y, x + 1)) - u;
     }
-    const float3 dualTVX = make_float3(d_dualTVX_r(y, x), d_dualTVX_g(y, x), d_dualTVX_b(y, x));
+    const float3 dualTVX = LoadInpaintingState(d_dualTVX(y, x));
     
     float3 u_plusy_minus_u = make_float3(0, 0, 0);
-    if (y < d_u_r.height() - 1) {
-      u_plusy_minus_u = make_float3(d_u_r(y + 1, x), d_u_g(y + 1, x), d_u_b(y + 1, x)) - u;
+    if (y < d_u.height() - 1) {
+      u_plusy_minus_u = LoadInpaintingState(d_u(y + 1, x)) - u;
     }
-    const float3 dualTVY = make_float3(d_dualTVY_r(y, x), d_dualTVY_g(y, x), d_dualTVY_b(y, x));
+    const float3 dualTVY = LoadInpaintingState(d_dualTVY(y, x));
     
     float3 resultX =
         huberFactor * (dualTVX + kDualStepWidth * 0.5f * u_plusx_minus_u);
@@ -935,180 +1283,252 @@ __global__ void TVInpaintingDualStepKernel(
     resultY /= denom;
 
     // write result back into global memory
-    d_dualTVX_r(y, x) = resultX.x;
-    d_dualTVX_g(y, x) = resultX.y;
-    d_dualTVX_b(y, x) = resultX.z;
-    d_dualTVY_r(y, x) = resultY.x;
-    d_dualTVY_g(y, x) = resultY.y;
-    d_dualTVY_b(y, x) = resultY.z;
+    StoreInpaintingState(resultX, &d_dualTVX(y, x));
+    StoreInpaintingState(resultY, &d_dualTVY(y, x));
   }
 }
 
+template<typename StateT>
 int InpaintImageCUDA(
     cudaStream_t stream,
     int max_num_iterations,
     float max_change_rate_threshold,
     cudaTextureObject_t gradient_magnitude_div_sqrt2,
     const CUDABuffer<uchar4>& input,
+    const CUDABuffer<uchar4>* initial_guess,
     CUDABuffer<bool>* tv_flag,
     CUDABuffer<bool>* tv_dual_flag,
-    CUDABuffer<float>* tv_dual_x_r,
-    CUDABuffer<float>* tv_dual_x_g,
-    CUDABuffer<float>* tv_dual_x_b,
-    CUDABuffer<float>* tv_dual_y_r,
-    CUDABuffer<float>* tv_dual_y_g,
-    CUDABuffer<float>* tv_dual_y_b,
-    CUDABuffer<float>* tv_u_bar_r,
-    CUDABuffer<float>* tv_u_bar_g,
-    CUDABuffer<float>* tv_u_bar_b,
+    CUDABuffer<StateT>* tv_dual_x,
+    CUDABuffer<StateT>* tv_dual_y,
+    CUDABuffer<StateT>* tv_u_bar,
     CUDABuffer<float>* tv_max_change,
-    CUDABuffer<float>* output_r,
-    CUDABuffer<float>* output_g,
-    CUDABuffer<float>* output_b,
-    CUDABuffer<uint16_t>* block_coordinates) {
-  const int width = output_r->width();
-  const int height = output_r->height();
+    CUDABuffer<float4>* output,
+    CUDABuffer<uint16_t>* block_coordinates,
+    BlockCompactionBuffers* compaction_buffers,
+    int* saved_block_iterations,
+    const InpaintingDeadline* deadline,
+    InpaintingResidual* residual,
+    HoleMap* hole_map) {
+  NVTXRange range("InpaintImageCUDA");
+  const int width = output->width();
+  const int height = output->height();
   constexpr int kBlockWidth = 32;
   constexpr int kBlockHeight = 32;
   dim3 grid_dim(cuda_util::GetBlockCount(width, kBlockWidth),
                 cuda_util::GetBlockCount(height, kBlockHeight));
   const dim3 block_dim(kBlockWidth, kBlockHeight);
   
-  CUDABuffer<float>* tv_u_r = output_r;
-  CUDABuffer<float>* tv_u_g = output_g;
-  CUDABuffer<float>* tv_u_b = output_b;
+  CUDABuffer<float4>* tv_u = output;
   
   // Initialize variables.
   TVInpaintingInitializeVariablesKernel<<<grid_dim, block_dim, 0, stream>>>(
       grid_dim.x,
       input.ToCUDA(),
+      initial_guess ? initial_guess->ToCUDA() : CUDABuffer_<uchar4>(),
       tv_flag->ToCUDA(),
       tv_dual_flag->ToCUDA(),
-      tv_dual_x_r->ToCUDA(),
-      tv_dual_x_g->ToCUDA(),
-      tv_dual_x_b->ToCUDA(),
-      tv_dual_y_r->ToCUDA(),
-      tv_dual_y_g->ToCUDA(),
-      tv_dual_y_b->ToCUDA(),
-      tv_u_r->ToCUDA(),
-      tv_u_g->ToCUDA(),
-      tv_u_b->ToCUDA(),
-      tv_u_bar_r->ToCUDA(),
-      tv_u_bar_g->ToCUDA(),
-      tv_u_bar_b->ToCUDA(),
-      block_coordinates->ToCUDA());
+      tv_dual_x->ToCUDA(),
+      tv_dual_y->ToCUDA(),
+      tv_u->ToCUDA(),
+      tv_u_bar->ToCUDA(),
+      block_coordinates->ToCUDA(),
+      hole_map ? hole_map->ToCUDA() : HoleMap_());
   CHECK_CUDA_NO_ERROR();
   
-  uint8_t* block_activity = new uint8_t[grid_dim.x * grid_dim.y];
-  block_coordinates->DownloadPartAsync(0, grid_dim.x * grid_dim.y * sizeof(uint8_t), stream, reinterpret_cast<uint16_t*>(block_activity));
-  cudaStreamSynchronize(stream);
+  // Temporary host arrays, reused between calls.
+  HostScratchScope scratch;
   int active_block_count = 0;
-  uint16_t* block_coordinates_cpu = new uint16_t[2 * grid_dim.x * grid_dim.y];
-  for (size_t y = 0; y < grid_dim.y; ++ y) {
-    for (size_t x = 0; x < grid_dim.x; ++ x) {
-      if (block_activity[x + y * grid_dim.x] > 0) {
-        block_coordinates_cpu[2 * active_block_count + 0] = x * kBlockWidth;
-        block_coordinates_cpu[2 * active_block_count + 1] = y * kBlockHeight;
-        ++ active_block_count;
+  uint16_t* block_coordinates_cpu = scratch.Allocate<uint16_t>(2 * grid_dim.x * grid_dim.y);
+  if (hole_map) {
+    // See InpaintAdaptiveDepthMapCUDA(). If the depth inpainting used the same
+    // hole map, this does not synchronize with the stream.
+    active_block_count = hole_map->SelectActiveBlocks(
+        stream, kColorHoleMap, kBlockWidth, kBlockHeight, 1,
+        grid_dim.x, grid_dim.y, block_coordinates_cpu, nullptr);
+  } else {
+    uint8_t* block_activity = scratch.Allocate<uint8_t>(grid_dim.x * grid_dim.y);
+    block_coordinates->DownloadPartAsync(0, grid_dim.x * grid_dim.y * sizeof(uint8_t), stream, reinterpret_cast<uint16_t*>(block_activity));
+    cudaStreamSynchronize(stream);
+    for (size_t y = 0; y < grid_dim.y; ++ y) {
+      for (size_t x = 0; x < grid_dim.x; ++ x) {
+        if (block_activity[x + y * grid_dim.x] > 0) {
+          block_coordinates_cpu[2 * active_block_count + 0] = x * kBlockWidth;
+          block_coordinates_cpu[2 * active_block_count + 1] = y * kBlockHeight;
+          ++ active_block_count;
+        }
       }
     }
   }
-  delete[] block_activity;
+  range.AddValue("active blocks", active_block_count);
+  if (saved_block_iterations) {
+    *saved_block_iterations = 0;
+  }
+  if (residual) {
+    *residual = InpaintingResidual();
+    residual->unconverged_block_fraction = 0;
+  }
   if (active_block_count == 0) {
     return 0;
   }
   block_coordinates->UploadPartAsync(0, 2 * active_block_count * sizeof(uint16_t), stream, block_coordinates_cpu);
-  float* max_change = new float[grid_dim.x * grid_dim.y];
+  float* max_change = scratch.Allocate<float>(grid_dim.x * grid_dim.y);
   
   // Run optimization iterations.
+  const int convergence_check_interval =
+      initial_guess ? kWarmStartConvergenceCheckInterval : kConvergenceCheckInterval;
+  if (deadline) {
+    max_num_iterations = deadline->LimitIterations(
+        max_num_iterations, convergence_check_interval);
+  }
+  const int initial_active_block_count = active_block_count;
+  float max_change_rate = -1;
+  bool deadline_reached = false;
+  int saved = 0;
   int i = 0;
-  int last_convergence_check_iteration = -180;
+  int last_convergence_check_iteration = 20 - convergence_check_interval;
   for (i = 0; i < max_num_iterations; i += 1) {
     // TODO: HACK: Minimum iteration count is necessary since it exits too early in some cases
-    const bool check_convergence = (i - last_convergence_check_iteration >= 200) /*&& (i >= 500)*/;
+    const bool check_convergence = (i - last_convergence_check_iteration >= convergence_check_interval) /*&& (i >= 500)*/;
     dim3 grid_dim_active(active_block_count);
+    // Count the block iterations which are skipped for retired blocks.
+    saved += initial_active_block_count - active_block_count;
     
     TVInpaintingDualStepKernel<true><<<grid_dim_active, block_dim, 0, stream>>>(
         block_coordinates->ToCUDA(),
         tv_dual_flag->ToCUDA(),
-        tv_u_bar_r->ToCUDA(),
-        tv_u_bar_g->ToCUDA(),
-        tv_u_bar_b->ToCUDA(),
+        tv_u_bar->ToCUDA(),
         gradient_magnitude_div_sqrt2,
-        tv_dual_x_r->ToCUDA(),
-        tv_dual_x_g->ToCUDA(),
-        tv_dual_x_b->ToCUDA(),
-        tv_dual_y_r->ToCUDA(),
-        tv_dual_y_g->ToCUDA(),
-        tv_dual_y_b->ToCUDA());
+        tv_dual_x->ToCUDA(),
+        tv_dual_y->ToCUDA());
 
     if (check_convergence) {
       TVInpaintingPrimalStepKernel<true><<<grid_dim_active, block_dim, 0, stream>>>(
           block_coordinates->ToCUDA(),
           tv_flag->ToCUDA(),
-          tv_dual_x_r->ToCUDA(),
-          tv_dual_x_g->ToCUDA(),
-          tv_dual_x_b->ToCUDA(),
-          tv_dual_y_r->ToCUDA(),
-          tv_dual_y_g->ToCUDA(),
-          tv_dual_y_b->ToCUDA(),
-          tv_u_r->ToCUDA(),
-          tv_u_g->ToCUDA(),
-          tv_u_b->ToCUDA(),
-          tv_u_bar_r->ToCUDA(),
-          tv_u_bar_g->ToCUDA(),
-          tv_u_bar_b->ToCUDA(),
+          tv_dual_x->ToCUDA(),
+          tv_dual_y->ToCUDA(),
+          tv_u->ToCUDA(),
+          tv_u_bar->ToCUDA(),
           tv_max_change->ToCUDA());
     } else {
       TVInpaintingPrimalStepKernel<false><<<grid_dim_active, block_dim, 0, stream>>>(
           block_coordinates->ToCUDA(),
           tv_flag->ToCUDA(),
-          tv_dual_x_r->ToCUDA(),
-          tv_dual_x_g->ToCUDA(),
-          tv_dual_x_b->ToCUDA(),
-          tv_dual_y_r->ToCUDA(),
-          tv_dual_y_g->ToCUDA(),
-          tv_dual_y_b->ToCUDA(),
-          tv_u_r->ToCUDA(),
-          tv_u_g->ToCUDA(),
-          tv_u_b->ToCUDA(),
-          tv_u_bar_r->ToCUDA(),
-          tv_u_bar_g->ToCUDA(),
-          tv_u_bar_b->ToCUDA(),
+          tv_dual_x->ToCUDA(),
+          tv_dual_y->ToCUDA(),
+          tv_u->ToCUDA(),
+          tv_u_bar->ToCUDA(),
           CUDABuffer_<float>());
     }
     
     if (check_convergence) {
-      tv_max_change->DownloadPartAsync(0, active_block_count * sizeof(float), stream, max_change);
-      cudaStreamSynchronize(stream);
-      int new_active_block_count = 0;
-      for (int j = 0, end = active_block_count; j < end; j ++) {
-        if (max_change[j] > max_change_rate_threshold) {
-          // block_coordinates_cpu[2 * new_active_block_count + 0] = block_coordinates_cpu[2 * j + 0];
-          // block_coordinates_cpu[2 * new_active_block_count + 1] = block_coordinates_cpu[2 * j + 1];
-          ++ new_active_block_count;
-        }
-      }
+      // Retire the blocks which have converged, such that only the remaining
+      // ones are launched in the following iterations.
+      const int new_active_block_count = RetireConvergedTVBlocks(
+          stream, active_block_count, max_change_rate_threshold, *tv_max_change,
+          block_coordinates, compaction_buffers, block_coordinates_cpu,
+          max_change, &max_change_rate);
       //LOG(INFO) << "[" << i << "] Active blocks: " << active_block_count << " -> " << new_active_block_count;
-      //LOG(INFO) << "max_change_rate: " << max_change_rate << " / " << max_change_rate_threshold;
+      active_block_count = new_active_block_count;
       if (new_active_block_count == 0) {
         break;
       }
-      //active_block_count = new_active_block_count;
-      //block_coordinates->UploadPartAsync(0, 2 * active_block_count * sizeof(uint16_t), stream, block_coordinates_cpu);
       last_convergence_check_iteration = i;
+      if (deadline && deadline->Reached()) {
+        deadline_reached = true;
+        break;
+      }
     } // if (check_convergence)
   }
-  delete[] max_change;
-  delete[] block_coordinates_cpu;
   CHECK_CUDA_NO_ERROR();
   
-  if (i < max_num_iterations) {
-    LOG(INFO) << "Color TV converged after iteration: " << i;
+  if (saved_block_iterations) {
+    *saved_block_iterations = saved;
+  }
+  if (residual) {
+    residual->max_change_rate = max_change_rate;
+    residual->unconverged_block_fraction =
+        active_block_count / static_cast<float>(initial_active_block_count);
+    residual->deadline_reached = deadline_reached;
+  }
+  
+  if (deadline_reached) {
+    LOG(INFO) << "Color TV stopped at the deadline after iteration: " << i << " (unconverged blocks: " << active_block_count << " / " << initial_active_block_count << ")";
+  } else if (i < max_num_iterations) {
+    LOG(INFO) << "Color TV converged after iteration: " << i << " (saved block iterations: " << saved << ")";
   } else {
-    LOG(WARNING) << "Color TV used maximum iteration count: " << i;
+    LOG(WARNING) << "Color TV used maximum iteration count: " << i << " (saved block iterations: " << saved << ")";
   }
+  range.AddValue("iterations", i);
   return i;
 }
 
+KernelOccupancy GetColorTVInpaintingKernelOccupancy(bool half_storage) {
+  if (half_storage) {
+    return cuda_util::ComputeKernelOccupancy(
+        TVInpaintingDualStepKernel<true, Half4>, 32 * 32, 0);
+  } else {
+    return cuda_util::ComputeKernelOccupancy(
+        TVInpaintingDualStepKernel<true, float4>, 32 * 32, 0);
+  }
+}
+
+template int InpaintDepthMapCUDA<float>(
+    cudaStream_t stream, InpaintingMode inpainting_mode, bool use_tv_weights,
+    int max_num_iterations, float max_change_rate_threshold,
+    float depth_input_scaling_factor,
+    cudaTextureObject_t gradient_magnitude_div_sqrt2,
+    cudaTextureObject_t depth_map_input, CUDABuffer<bool>* tv_flag,
+    CUDABuffer<bool>* tv_dual_flag, CUDABuffer<int16_t>* tv_dual_x,
+    CUDABuffer<int16_t>* tv_dual_y, CUDABuffer<float>* tv_u_bar,
+    CUDABuffer<float>* tv_max_change, CUDABuffer<float>* depth_map_output,
+    CUDABuffer<uint16_t>* block_coordinates,
+    CUDABuffer<unsigned char>* block_activities, TVInpaintingPyramid* pyramid,
+    const CUDABuffer<float>* initial_guess,
+    BlockCompactionBuffers* compaction_buffers, int* saved_block_iterations,
+    const InpaintingDeadline* deadline, InpaintingResidual* residual,
+    HoleMap* hole_map);
+template int InpaintDepthMapCUDA<__half>(
+    cudaStream_t stream, InpaintingMode inpainting_mode, bool use_tv_weights,
+    int max_num_iterations, float max_change_rate_threshold,
+    float depth_input_scaling_factor,
+    cudaTextureObject_t gradient_magnitude_div_sqrt2,
+    cudaTextureObject_t depth_map_input, CUDABuffer<bool>* tv_flag,
+    CUDABuffer<bool>* tv_dual_flag, CUDABuffer<int16_t>* tv_dual_x,
+    CUDABuffer<int16_t>* tv_dual_y, CUDABuffer<__half>* tv_u_bar,
+    CUDABuffer<float>* tv_max_change, CUDABuffer<float>* depth_map_output,
+    CUDABuffer<uint16_t>* block_coordinates,
+    CUDABuffer<unsigned char>* block_activities, TVInpaintingPyramid* pyramid,
+    const CUDABuffer<float>* initial_guess,
+    BlockCompactionBuffers* compaction_buffers, int* saved_block_iterations,
+    const InpaintingDeadline* deadline, InpaintingResidual* residual,
+    HoleMap* hole_map);
+
+template int InpaintImageCUDA<float4>(
+    cudaStream_t stream, int max_num_iterations,
+    float max_change_rate_threshold,
+    cudaTextureObject_t gradient_magnitude_div_sqrt2,
+    const CUDABuffer<uchar4>& input, const CUDABuffer<uchar4>* initial_guess,
+    CUDABuffer<bool>* tv_flag,
+    CUDABuffer<bool>* tv_dual_flag, CUDABuffer<float4>* tv_dual_x,
+    CUDABuffer<float4>* tv_dual_y, CUDABuffer<float4>* tv_u_bar,
+    CUDABuffer<float>* tv_max_change, CUDABuffer<float4>* output,
+    CUDABuffer<uint16_t>* block_coordinates,
+    BlockCompactionBuffers* compaction_buffers, int* saved_block_iterations,
+    const InpaintingDeadline* deadline, InpaintingResidual* residual,
+    HoleMap* hole_map);
+template int InpaintImageCUDA<Half4>(
+    cudaStream_t stream, int max_num_iterations,
+    float max_change_rate_threshold,
+    cudaTextureObject_t gradient_magnitude_div_sqrt2,
+    const CUDABuffer<uchar4>& input, const CUDABuffer<uchar4>* initial_guess,
+    CUDABuffer<bool>* tv_flag,
+    CUDABuffer<bool>* tv_dual_flag, CUDABuffer<Half4>* tv_dual_x,
+    CUDABuffer<Half4>* tv_dual_y, CUDABuffer<Half4>* tv_u_bar,
+    CUDABuffer<float>* tv_max_change, CUDABuffer<float4>* output,
+    CUDABuffer<uint16_t>* block_coordinates,
+    BlockCompactionBuffers* compaction_buffers, int* saved_block_iterations,
+    const InpaintingDeadline* deadline, InpaintingResidual* residual,
+    HoleMap* hole_map);
+
 } // namespace view_correction
@@ -29,9 +29,15 @@
 #ifndef VIEW_CORRECTION_CUDA_TV_INPAINTING_FUNCTIONS_CUH_
 #define VIEW_CORRECTION_CUDA_TV_INPAINTING_FUNCTIONS_CUH_
 
+#include <vector>
+
 #include <cuda_runtime.h>
 
 #include "view_correction/cuda_buffer.h"
+#include "view_correction/cuda_inpainting_storage.cuh"
+#include "view_correction/cuda_util.h"
+#include "view_correction/forward_declarations.h"
+#include "view_correction/inpainting_deadline.h"
 
 namespace view_correction {
 
@@ -43,7 +49,79 @@ enum InpaintingMode {
   kIMCoarseToFineAdaptive = 4,
 };
 
-// Returns the number of iterations done.
+// Buffers for the coarser pyramid levels used by the kIMCoarseToFine and
+// kIMCoarseToFineAdaptive modes of InpaintDepthMapCUDA(). levels[0] has half
+// the resolution (rounded up) of the full-resolution depth map, each further
+// level has half the resolution of the previous one.
+struct TVInpaintingPyramid {
+  // Allocates num_levels coarser levels for a full-resolution depth map of
+  // the given size.
+  TVInpaintingPyramid(int width, int height, int num_levels);
+  ~TVInpaintingPyramid();
+  
+  struct Level {
+    // Downsampled input depth map (already scaled), set by
+    // InpaintDepthMapCUDA().
+    CUDABufferPtr<float> depth_input;
+    cudaTextureObject_t depth_input_texture;
+    
+    // Guidance gradient magnitudes for this level. Must be set by the caller
+    // before calling InpaintDepthMapCUDA().
+    CUDABufferPtr<uint8_t> gradient_magnitude_div_sqrt2;
+    cudaTextureObject_t gradient_magnitude_div_sqrt2_texture;
+    
+    CUDABufferPtr<bool> tv_flag;
+    CUDABufferPtr<bool> tv_dual_flag;
+    CUDABufferPtr<int16_t> tv_dual_x;
+    CUDABufferPtr<int16_t> tv_dual_y;
+    // The coarser levels are small, so they always store u_bar in fp32.
+    CUDABufferPtr<float> tv_u_bar;
+    CUDABufferPtr<float> tv_max_change;
+    CUDABufferPtr<float> depth_map_output;
+    CUDABufferPtr<uint16_t> block_coordinates;
+    CUDABufferPtr<unsigned char> block_activities;
+  };
+  std::vector<Level> levels;
+};
+
+// Returns the maximum number of blocks used by InpaintDepthMapCUDA() and
+// InpaintImageCUDA() for an image of the given size (for allocating
+// BlockCompactionBuffers).
+int GetTVInpaintingBlockCount(int width, int height);
+
+// Return the theoretical occupancy of the combined dual and primal step
+// kernel which is used by InpaintDepthMapCUDA(), and of the dual step kernel
+// which is used by InpaintImageCUDA(), with fp32 or half-precision state
+// storage (for benchmarking).
+KernelOccupancy GetTVInpaintingKernelOccupancy(bool half_storage);
+KernelOccupancy GetColorTVInpaintingKernelOccupancy(bool half_storage);
+
+// Returns the number of iterations done. Blocks which have converged at a
+// convergence check are not processed anymore in the following iterations.
+// If compaction_buffers is given, the converged blocks are removed on the GPU,
+// otherwise on the CPU. If saved_block_iterations is non-null, it is set to the
+// number of block iterations which were skipped this way.
+// The coarse-to-fine modes solve the coarsest level of the pyramid first and
+// initialize each finer level with the solution of the next coarser one, such
+// that only few iterations are required on the fine levels. They require the
+// pyramid to be given, the other modes ignore it.
+// If initial_guess is not null, the pixels to inpaint which have a guess > 0
+// (given in the scaled output units) are initialized with it instead of the cold start, and convergence is
+// checked more often (a warm start, e.g., from the reprojected solution of the
+// previous frame).
+// If deadline is not null, the iterations stop at the first convergence
+// check after the deadline, and are limited to the ones which fit into the
+// remaining time if the deadline has a cost estimate (see
+// inpainting_deadline.h). If residual is not null, it is set to the
+// convergence state at the end.
+// If hole_map is not null, it must describe the depth holes of
+// depth_map_input. The initialization of the blocks without holes then only
+// copies their input and skips the search for active pixels, and the
+// kIMClassic mode selects the active blocks from the map instead of
+// downloading the block activities. The coarse-to-fine modes ignore it.
+// UBarT is the storage type of tv_u_bar (float or __half, see
+// cuda_inpainting_storage.cuh).
+template<typename UBarT>
 int InpaintDepthMapCUDA(
     cudaStream_t stream,    
     InpaintingMode inpainting_mode,
@@ -57,35 +135,50 @@ int InpaintDepthMapCUDA(
     CUDABuffer<bool>* tv_dual_flag,
     CUDABuffer<int16_t>* tv_dual_x,
     CUDABuffer<int16_t>* tv_dual_y,
-    CUDABuffer<float>* tv_u_bar,
+    CUDABuffer<UBarT>* tv_u_bar,
     CUDABuffer<float>* tv_max_change,
     CUDABuffer<float>* depth_map_output,
     CUDABuffer<uint16_t>* block_coordinates,
-    CUDABuffer<unsigned char>* block_activities);
+    CUDABuffer<unsigned char>* block_activities,
+    TVInpaintingPyramid* pyramid,
+    const CUDABuffer<float>* initial_guess,
+    BlockCompactionBuffers* compaction_buffers,
+    int* saved_block_iterations,
+    const InpaintingDeadline* deadline,
+    InpaintingResidual* residual,
+    HoleMap* hole_map);
 
-// Returns the number of iterations done.
+// Returns the number of iterations done. Converged blocks are retired as in
+// InpaintDepthMapCUDA(). The dual variables, tv_u_bar, and the output store the
+// RGB channels interleaved in x, y, z (w is unused); the output colors are in
+// [0, 1]. StateT is the storage type of the dual variables and tv_u_bar
+// (float4 or Half4, see cuda_inpainting_storage.cuh).
+// If initial_guess is not null, the pixels to inpaint which have
+// initial_guess.w != 0 are initialized with its colors, see
+// InpaintDepthMapCUDA(). The deadline and residual are handled as in
+// InpaintDepthMapCUDA(). If hole_map is not null, it must describe the color
+// holes of input and is used as in InpaintDepthMapCUDA().
+template<typename StateT>
 int InpaintImageCUDA(
     cudaStream_t stream,
     int max_num_iterations,
     float max_change_rate_threshold,
     cudaTextureObject_t gradient_magnitude_div_sqrt2,
     const CUDABuffer<uchar4>& input,
+    const CUDABuffer<uchar4>* initial_guess,
     CUDABuffer<bool>* tv_flag,
     CUDABuffer<bool>* tv_dual_flag,
-    CUDABuffer<float>* tv_dual_x_r,
-    CUDABuffer<float>* tv_dual_x_g,
-    CUDABuffer<float>* tv_dual_x_b,
-    CUDABuffer<float>* tv_dual_y_r,
-    CUDABuffer<float>* tv_dual_y_g,
-    CUDABuffer<float>* tv_dual_y_b,
-    CUDABuffer<float>* tv_u_bar_r,
-    CUDABuffer<float>* tv_u_bar_g,
-    CUDABuffer<float>* tv_u_bar_b,
+    CUDABuffer<StateT>* tv_dual_x,
+    CUDABuffer<StateT>* tv_dual_y,
+    CUDABuffer<StateT>* tv_u_bar,
     CUDABuffer<float>* tv_max_change,
-    CUDABuffer<float>* output_r,
-    CUDABuffer<float>* output_g,
-    CUDABuffer<float>* output_b,
-    CUDABuffer<uint16_t>* block_coordinates);
+    CUDABuffer<float4>* output,
+    CUDABuffer<uint16_t>* block_coordinates,
+    BlockCompactionBuffers* compaction_buffers,
+    int* saved_block_iterations,
+    const InpaintingDeadline* deadline,
+    InpaintingResidual* residual,
+    HoleMap* hole_map);
 
 } // namespace view_correction
 
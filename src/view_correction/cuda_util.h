@@ -79,6 +79,20 @@ __host__ __device__ CUDAMatrix3x4() {}
   float4 row2;
 };
 
+// Theoretical occupancy of a kernel for a given launch configuration, as
+// determined by the CUDA occupancy calculator.
+struct KernelOccupancy {
+  int block_size;
+  int dynamic_shared_memory_size;
+  int registers_per_thread;
+  int static_shared_memory_size;
+  int active_blocks_per_multiprocessor;
+  
+  // Ratio of the active warps to the maximum number of resident warps per
+  // multiprocessor.
+  float occupancy;
+};
+
 namespace cuda_util {
 
 // Returns the required number of CUDA blocks to cover a given domain size,
@@ -89,6 +103,38 @@ inline int GetBlockCount(int domain_size, int block_size) {
   return (domain_size+block_size-1) / block_size; // avoid costly mod-operator
 }
 
+// Computes the theoretical occupancy of the given kernel on the current
+// device for launches with the given block size and dynamic shared memory.
+template <typename KernelT>
+KernelOccupancy ComputeKernelOccupancy(KernelT* kernel, int block_size,
+                                       int dynamic_shared_memory_size) {
+  KernelOccupancy result;
+  result.block_size = block_size;
+  result.dynamic_shared_memory_size = dynamic_shared_memory_size;
+  
+  cudaFuncAttributes attributes;
+  CUDA_CHECKED_CALL(cudaFuncGetAttributes(&attributes, kernel));
+  result.registers_per_thread = attributes.numRegs;
+  result.static_shared_memory_size = attributes.sharedSizeBytes;
+  
+  CUDA_CHECKED_CALL(cudaOccupancyMaxActiveBlocksPerMultiprocessor(
+      &result.active_blocks_per_multiprocessor, kernel, block_size,
+      dynamic_shared_memory_size));
+  
+  int device;
+  CUDA_CHECKED_CALL(cudaGetDevice(&device));
+  cudaDeviceProp properties;
+  CUDA_CHECKED_CALL(cudaGetDeviceProperties(&properties, device));
+  const int warps_per_block =
+      GetBlockCount(block_size, properties.warpSize);
+  const int max_warps =
+      properties.maxThreadsPerMultiProcessor / properties.warpSize;
+  result.occupancy =
+      (result.active_blocks_per_multiprocessor * warps_per_block) /
+      static_cast<float>(max_warps);
+  return result;
+}
+
 }  // namespace cuda_util
 
 }  // namespace view_correction
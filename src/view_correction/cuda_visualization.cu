@@ -0,0 +1,138 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "view_correction/cuda_visualization.cuh"
+
+#include <glog/logging.h>
+
+#include "view_correction/cuda_util.h"
+
+namespace view_correction {
+
+template <typename T>
+__global__ void InvDepthColormapCUDAKernel(
+    CUDABuffer_<T> depth_map,
+    float depth_scale,
+    float min_inv_depth_minus_max,
+    float max_inv_depth,
+    CUDABuffer_<uchar4> output) {
+  const int x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+  if (x < output.width() && y < output.height()) {
+    const float depth = depth_scale * depth_map(y, x);
+    uint8_t value = 0;
+    if (depth > 0.f) {
+      const float factor =
+          ::max(0.f, ::min(1 / depth - max_inv_depth, min_inv_depth_minus_max) /
+                         min_inv_depth_minus_max);
+      value = 255 * factor + 0.5f;
+    }
+    output(y, x) = make_uchar4(value, value, value, 255);
+  }
+}
+
+template <typename T>
+void InvDepthColormapCUDA(
+    cudaStream_t stream,
+    const CUDABuffer<T>& depth_map,
+    float depth_scale,
+    float min_depth,
+    float max_depth,
+    CUDABuffer<uchar4>* output) {
+  CHECK_EQ(depth_map.width(), output->width());
+  CHECK_EQ(depth_map.height(), output->height());
+  constexpr int kBlockWidth = 32;
+  constexpr int kBlockHeight = 8;
+  const dim3 grid_dim(cuda_util::GetBlockCount(output->width(), kBlockWidth),
+                      cuda_util::GetBlockCount(output->height(), kBlockHeight));
+  const dim3 block_dim(kBlockWidth, kBlockHeight);
+  InvDepthColormapCUDAKernel<<<grid_dim, block_dim, 0, stream>>>(
+      depth_map.ToCUDA(),
+      depth_scale,
+      1 / min_depth - 1 / max_depth,
+      1 / max_depth,
+      output->ToCUDA());
+  CHECK_CUDA_NO_ERROR();
+}
+
+template void InvDepthColormapCUDA<float>(
+    cudaStream_t stream, const CUDABuffer<float>& depth_map, float depth_scale,
+    float min_depth, float max_depth, CUDABuffer<uchar4>* output);
+template void InvDepthColormapCUDA<uint16_t>(
+    cudaStream_t stream, const CUDABuffer<uint16_t>& depth_map,
+    float depth_scale, float min_depth, float max_depth,
+    CUDABuffer<uchar4>* output);
+
+template <typename T>
+__global__ void GrayscaleRangeCUDAKernel(
+    CUDABuffer_<T> input,
+    float min_value,
+    float scale,
+    CUDABuffer_<uchar4> output) {
+  const int x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+  if (x < output.width() && y < output.height()) {
+    const float factor = ::max(0.f, ::min(1.f, scale * (input(y, x) - min_value)));
+    const uint8_t value = 255 * factor + 0.5f;
+    output(y, x) = make_uchar4(value, value, value, 255);
+  }
+}
+
+template <typename T>
+void GrayscaleRangeCUDA(
+    cudaStream_t stream,
+    const CUDABuffer<T>& input,
+    float min_value,
+    float max_value,
+    CUDABuffer<uchar4>* output) {
+  CHECK_EQ(input.width(), output->width());
+  CHECK_EQ(input.height(), output->height());
+  constexpr int kBlockWidth = 32;
+  constexpr int kBlockHeight = 8;
+  const dim3 grid_dim(cuda_util::GetBlockCount(output->width(), kBlockWidth),
+                      cuda_util::GetBlockCount(output->height(), kBlockHeight));
+  const dim3 block_dim(kBlockWidth, kBlockHeight);
+  GrayscaleRangeCUDAKernel<<<grid_dim, block_dim, 0, stream>>>(
+      input.ToCUDA(),
+      min_value,
+      1 / (max_value - min_value),
+      output->ToCUDA());
+  CHECK_CUDA_NO_ERROR();
+}
+
+template void GrayscaleRangeCUDA<float>(
+    cudaStream_t stream, const CUDABuffer<float>& input, float min_value,
+    float max_value, CUDABuffer<uchar4>* output);
+template void GrayscaleRangeCUDA<uint8_t>(
+    cudaStream_t stream, const CUDABuffer<uint8_t>& input, float min_value,
+    float max_value, CUDABuffer<uchar4>* output);
+template void GrayscaleRangeCUDA<uint16_t>(
+    cudaStream_t stream, const CUDABuffer<uint16_t>& input, float min_value,
+    float max_value, CUDABuffer<uchar4>* output);
+
+}  // namespace view_correction
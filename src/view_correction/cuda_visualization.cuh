@@ -0,0 +1,67 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef VIEW_CORRECTION_CUDA_VISUALIZATION_CUH_
+#define VIEW_CORRECTION_CUDA_VISUALIZATION_CUH_
+
+#include <cuda_runtime.h>
+
+#include "view_correction/cuda_buffer.h"
+
+namespace view_correction {
+
+// Colorizes a depth map for debug visualization on the GPU, such that only
+// the 8-bit result needs to be downloaded. The depth of a pixel is
+// depth_scale times its value. Valid depths are mapped by inverse depth to
+// gray values, from white at min_depth to black at max_depth, and pixels
+// without depth are black. This matches
+// util::GetInvDepthColoredDepthmapMat(). The output has OpenCV's BGRA channel
+// order with alpha 255.
+template <typename T>
+void InvDepthColormapCUDA(
+    cudaStream_t stream,
+    const CUDABuffer<T>& depth_map,
+    float depth_scale,
+    float min_depth,
+    float max_depth,
+    CUDABuffer<uchar4>* output);
+
+// Maps the values in [min_value, max_value] linearly to gray values in
+// [0, 255], clamping values outside of the range. The output has OpenCV's
+// BGRA channel order with alpha 255.
+template <typename T>
+void GrayscaleRangeCUDA(
+    cudaStream_t stream,
+    const CUDABuffer<T>& input,
+    float min_value,
+    float max_value,
+    CUDABuffer<uchar4>* output);
+
+}  // namespace view_correction
+
+#endif  // VIEW_CORRECTION_CUDA_VISUALIZATION_CUH_
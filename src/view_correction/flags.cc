@@ -38,6 +38,12 @@ DEFINE_string(vc_depth_source, "mesh",
 
 DEFINE_string(vc_inpainting_method, "convolution",
               "One of \"convolution\", \"TV\"");
+DEFINE_string(vc_tv_inpainting_mode, "classic",
+              "Mode for TV inpainting of the source depth map. One of "
+              "\"classic\", \"coarse_to_fine\", \"coarse_to_fine_adaptive\"");
+DEFINE_int32(vc_tv_pyramid_levels, 3,
+             "Number of coarser pyramid levels for the coarse-to-fine TV "
+             "inpainting modes.");
 
 DEFINE_bool(vc_evaluate_rgb_frame_inpainting, false, "");
 DEFINE_bool(vc_evaluate_vs_previous_frame, false, "");
@@ -47,8 +53,308 @@ DEFINE_bool(vc_ensure_target_frame_temporal_consistency, true, "");
 
 DEFINE_bool(vc_do_timings, false, "");
 DEFINE_bool(vc_save_timings, false, "");
+DEFINE_string(vc_timings_file, "",
+              "File to which the timings are written periodically if "
+              "--vc_save_timings is set. Uses JSON if the name ends with "
+              "\".json\", and CSV otherwise. Defaults to "
+              "view_correction_timings.csv.");
+DEFINE_int32(vc_timings_window, 1000,
+             "Number of latest samples over which the timing statistics are "
+             "computed.");
+DEFINE_int32(vc_timings_interval, 100,
+             "Number of frames between logging or writing the timings. 0 "
+             "disables the periodic output (the timings are still collected "
+             "in the latency metrics).");
 
 DEFINE_bool(vc_evaluate_stereo, false, "");
 DEFINE_bool(vc_write_stereo_result, false, "");
 
 DEFINE_bool(vc_use_weights_for_inpainting, true, "");
+
+DEFINE_bool(vc_async_source_meshing, false,
+            "Create the meshed inpainted source depth map in a background "
+            "thread on a separate CUDA stream instead of in the render loop. "
+            "Ignored if debugging or evaluation flags are set.");
+DEFINE_bool(vc_device_resident_inpainting, false,
+            "Select active blocks and check for convergence on the GPU in "
+            "convolution inpainting to avoid synchronizing with the host.");
+DEFINE_bool(vc_average_uv, false,
+            "Compute the subsampled UV channels of the source color image "
+            "from the average of each 2x2 pixel block instead of its top-left "
+            "pixel.");
+DEFINE_bool(vc_project_rgb_image, false,
+            "Project the source RGB image onto the target frame directly "
+            "instead of converting it to YUV first.");
+DEFINE_int32(vc_pinned_input_slab_count, 8,
+             "Number of page-locked memory slabs (each of the size of an input "
+             "image) for input images in use by the pipeline and for upload "
+             "staging, in addition to one slab for each image which the input "
+             "image rings can hold. 0 disables the use of page-locked memory.");
+DEFINE_double(vc_display_time_offset_ms, 16.7,
+              "Expected time from the start of a rendering iteration until its "
+              "result is displayed. The target view is rendered with the color "
+              "camera pose predicted for this point in time. The default is "
+              "one frame at 60 Hz. 0 renders with the latest received pose.");
+DEFINE_double(vc_max_pose_extrapolation_ms, 50,
+              "Maximum time for which the color camera pose is extrapolated "
+              "beyond the latest received pose.");
+DEFINE_bool(vc_target_cuda_graph, false,
+            "Capture the CUDA work of the target frame pipeline (color "
+            "projection, temporal consistency reprojection and inpainting) "
+            "into a CUDA graph and launch it as a whole. The executable graph "
+            "is re-instantiated only if the sequence of operations changes. "
+            "Requires --vc_device_resident_inpainting and convolution "
+            "inpainting, and is not used together with debug output, "
+            "inpainting time budgets or rendering the TSDF reconstruction "
+            "into the target view.");
+DEFINE_bool(vc_persistent_inpainting_kernel, false,
+            "Run all iterations of the device-resident convolution depth "
+            "inpainting in a single persistent kernel whose thread blocks "
+            "synchronize with a grid barrier, instead of launching a kernel "
+            "for every few iterations. The kernel is launched cooperatively, "
+            "falling back to the launch loop on devices without support for "
+            "this. Requires --vc_device_resident_inpainting.");
+DEFINE_bool(vc_compact_mesh_indices, false,
+            "Output the meshed source depth map as a compacted list of "
+            "triangles which only contains its valid quads, and render it "
+            "with the actual triangle count instead of as a triangle strip "
+            "with degenerate triangles for the invalid quads. Without "
+            "--vc_async_source_meshing, rendering waits for the triangle "
+            "count to be downloaded.");
+DEFINE_bool(vc_decimate_mesh, false,
+            "Merge planar regions of the meshed source depth map into larger "
+            "cells of up to 32x32 pixels, keeping the full resolution at "
+            "depth jumps, to reduce the number of triangles rendered for the "
+            "target view. Implies --vc_compact_mesh_indices.");
+DEFINE_double(vc_mesh_decimation_threshold, 0.002,
+              "Maximum deviation of the depth of a vertex from the decimated "
+              "mesh, relative to the depth, for --vc_decimate_mesh.");
+DEFINE_bool(vc_warm_start_target_inpainting, false,
+            "Reproject the previous target frame's inpainted result into the "
+            "current target frame and use it as the initial guess for the "
+            "pixels to inpaint, instead of starting the depth and color "
+            "inpainting from scratch. Other than "
+            "--vc_ensure_target_frame_temporal_consistency, the reprojected "
+            "values are not fixed, and the solvers check for convergence more "
+            "often to stop earlier. Takes precedence over "
+            "--vc_ensure_target_frame_temporal_consistency.");
+DEFINE_bool(vc_incremental_source_update, false,
+            "Track which 32x32 pixel tiles of the source depth map and Y image "
+            "changed since the last frame, and re-inpaint only the changed "
+            "tiles plus a halo around them, keeping the previous result "
+            "elsewhere. Without --vc_async_source_meshing, only the "
+            "affected tiles are re-meshed as well (unless using "
+            "--vc_decimate_mesh). Only supported for convolution "
+            "inpainting.");
+DEFINE_double(vc_dirty_tile_depth_threshold, 0.01,
+              "Relative depth change above which a tile is re-processed with "
+              "--vc_incremental_source_update.");
+DEFINE_int32(vc_dirty_tile_intensity_threshold, 8,
+             "Intensity change (of the Y image at depth resolution, in "
+             "[0, 255]) above which a tile is re-processed with "
+             "--vc_incremental_source_update.");
+DEFINE_int32(vc_display_ring_size, 1,
+             "Number of display texture slots which the target frame results "
+             "are written to in turn. With more than one slot, the screen "
+             "shows the latest finished result of an earlier frame instead of "
+             "waiting for the current one, such that the GPU can already work "
+             "on the next frame while a frame is displayed. This adds up to "
+             "(ring size - 1) frames of latency. The render thread waits "
+             "before reusing a slot whose result has not been written yet.");
+DEFINE_int32(vc_image_writer_threads, 2,
+             "Number of background threads which encode and write the images "
+             "for --vc_write_images and --vc_write_stereo_result.");
+DEFINE_int32(vc_image_writer_queue_size, 32,
+             "Maximum number of images waiting to be written. If the image "
+             "writer threads cannot keep up, rendering blocks once this many "
+             "images are queued.");
+DEFINE_bool(vc_dynamic_resolution, false,
+            "Adapt the target frame render resolution at runtime, choosing "
+            "from --vc_dynamic_resolution_ladder such that the GPU time of "
+            "the target frame pipeline (stages R1 to R4) stays within "
+            "--vc_dynamic_resolution_budget_ms. Not supported with the "
+            "evaluation flags.");
+DEFINE_string(vc_dynamic_resolution_ladder, "384x240,480x300,640x400,960x600",
+              "Comma-separated list of target frame resolutions for "
+              "--vc_dynamic_resolution. Rendering starts with the largest one "
+              "which does not exceed the default resolution.");
+DEFINE_double(vc_dynamic_resolution_budget_ms, 12,
+              "GPU time budget of the target frame pipeline in milliseconds "
+              "for --vc_dynamic_resolution. The resolution is lowered if the "
+              "average time exceeds it.");
+DEFINE_double(vc_dynamic_resolution_upscale_fraction, 0.8,
+              "The resolution is raised if the average time, scaled to the "
+              "pixel count of the next resolution, stays below this fraction "
+              "of --vc_dynamic_resolution_budget_ms. Smaller values leave "
+              "more headroom against oscillating between two resolutions.");
+DEFINE_int32(vc_dynamic_resolution_window, 30,
+             "Number of frames whose times are averaged before each decision "
+             "of --vc_dynamic_resolution.");
+DEFINE_double(vc_target_inpainting_budget_ms, 0,
+              "Time budget of the target frame depth and color inpainting in "
+              "milliseconds. The solvers stop iterating once it is used up, "
+              "and their iteration counts are limited up front using the GPU "
+              "time per iteration measured in previous frames. 0 disables the "
+              "budget.");
+DEFINE_double(vc_target_depth_inpainting_budget_fraction, 0.5,
+              "Fraction of --vc_target_inpainting_budget_ms given to the depth "
+              "inpainting. The color inpainting gets the remainder.");
+DEFINE_double(vc_source_inpainting_budget_ms, 0,
+              "Time budget of the source frame depth inpainting in "
+              "milliseconds, see --vc_target_inpainting_budget_ms. 0 disables "
+              "the budget.");
+DEFINE_bool(vc_cuda_depth_warp, false,
+            "Render the meshed depth map into the target frame with a CUDA "
+            "rasterizer (WarpMeshDepthCUDA()) instead of with OpenGL. This "
+            "avoids the framebuffer and texture interop with OpenGL, but the "
+            "mesh buffers are still OpenGL buffers.");
+DEFINE_bool(vc_headless, false,
+            "Run without a default framebuffer, for example in an offscreen "
+            "context created with OffscreenContext. The results are not "
+            "drawn to the screen but kept in CUDA buffers, see "
+            "ViewCorrectionDisplay::GetHeadlessResult(). The final images "
+            "are not written with --vc_write_images in this mode.");
+DEFINE_bool(vc_stereo, false,
+            "Render a left and a right eye image side by side, like "
+            "--vc_evaluate_stereo, but share work between the eyes: the mesh "
+            "is rendered into both target views with a single instanced draw "
+            "call, and the left eye result is used as initial guess for the "
+            "right eye inpainting.");
+DEFINE_int32(vc_max_target_views, 1,
+             "Maximum number of target views which may be passed to "
+             "ViewCorrectionDisplay::RenderViews(). The views are rendered "
+             "into one render target stacked on top of each other, which is "
+             "allocated for this number of views.");
+DEFINE_bool(vc_autotune_inpainting_kernels, false,
+            "Select the block size and the number of iterations per kernel "
+            "call of the convolution depth inpainting by timing all "
+            "instantiated variants on the current GPU at initialization (see "
+            "InpaintingAutotuner). Otherwise, the default configuration is "
+            "used.");
+DEFINE_string(vc_inpainting_autotune_cache, "inpainting_autotune.txt",
+              "File in which the selections of "
+              "--vc_autotune_inpainting_kernels are cached per GPU and "
+              "resolution. Pass an empty string to tune on every start.");
+DEFINE_bool(vc_evaluate_ssim, false,
+            "With --vc_evaluate_vs_previous_frame, also compute the SSIM of "
+            "the luminance (which is slower than the L1 error and PSNR).");
+DEFINE_string(vc_evaluation_results_path, "evaluation_vs_previous_frame.txt",
+              "File to which --vc_evaluate_vs_previous_frame writes the "
+              "metrics of each evaluated frame and their mean over the run.");
+DEFINE_string(vc_record_session, "",
+              "If set, the input images and the camera and observer poses are "
+              "recorded to a session file at this path (see session_file.h), "
+              "which can be replayed with view_correction_bench or with "
+              "--vc_replay_session.");
+DEFINE_string(vc_replay_session, "",
+              "Session file (see session_file.h) which the view_correction "
+              "application replays in a loop instead of using synthetic "
+              "input.");
+DEFINE_bool(vc_foveated_inpainting, false,
+            "Inpaint the target frame at full resolution only around the gaze "
+            "point (see ViewCorrectionDisplay::SetGazePoint()), and fill the "
+            "holes in the periphery with a solution on a coarser level.");
+DEFINE_double(vc_foveation_radius, 0.25,
+              "Radius of the full-resolution region of --vc_foveated_inpainting "
+              "as a fraction of the larger target frame dimension.");
+DEFINE_int32(vc_foveation_downsampling, 4,
+             "Downsampling factor of the coarse level on which "
+             "--vc_foveated_inpainting inpaints the periphery.");
+DEFINE_bool(vc_reuse_frames, false,
+            "Re-present the previous frame instead of rendering the target "
+            "frame again if no new input was meshed since then and the target "
+            "view moved less than --vc_reuse_frames_max_rotation_deg and "
+            "--vc_reuse_frames_max_translation. Not used with stereo rendering, "
+            "RenderViews(), the evaluation modes, or "
+            "--vc_render_tsdf_in_target.");
+DEFINE_double(vc_reuse_frames_max_rotation_deg, 0.05,
+              "Largest rotation of the target view in degrees for which "
+              "--vc_reuse_frames re-presents the previous frame.");
+DEFINE_double(vc_reuse_frames_max_translation, 0.0005,
+              "Largest translation of the target view in meters for which "
+              "--vc_reuse_frames re-presents the previous frame.");
+DEFINE_string(vc_shader_cache_directory, "shader_cache",
+              "Directory in which the linked OpenGL shader program binaries "
+              "are cached per driver, such that later starts do not compile "
+              "the shaders again (see ShaderProgramCache). Pass an empty "
+              "string to compile them on every start.");
+DEFINE_bool(vc_frame_pacing, false,
+            "Delay the start of each frame in the render loop such that it "
+            "finishes just before the vsync at which it is displayed, and "
+            "render it with the pose predicted for this vsync (see "
+            "FramePacer). Replaces --vc_display_time_offset_ms. Requires a "
+            "window, i.e., is not used with --vc_headless.");
+DEFINE_double(vc_frame_pacing_margin_ms, 2,
+              "Safety margin of --vc_frame_pacing in milliseconds between the "
+              "estimated end of a frame and its vsync.");
+DEFINE_string(vc_video_output, "",
+              "If set, the final images are encoded with the GPU's hardware "
+              "video encoder from device memory and the elementary stream is "
+              "written to this file (which may be a named pipe for streaming "
+              "it). Requires building with the VIEW_CORRECTION_NVENC CMake "
+              "option.");
+DEFINE_string(vc_video_codec, "h264",
+              "Codec of --vc_video_output, h264 or hevc.");
+DEFINE_int32(vc_video_bitrate_kbps, 8000,
+             "Constant bitrate of --vc_video_output in kbit/s.");
+DEFINE_int32(vc_video_frame_rate, 60,
+             "Frame rate which the rate control of --vc_video_output assumes.");
+DEFINE_double(vc_video_vbv_frames, 1,
+              "Size of the rate control buffer of --vc_video_output in frames. "
+              "Smaller values reduce the latency of transmitting the stream "
+              "at the cost of quality.");
+DEFINE_int32(vc_video_idr_interval, 60,
+             "Number of frames between two IDR frames of --vc_video_output, "
+             "which allow observers to join the stream, or 0 to only start "
+             "with one.");
+DEFINE_int32(vc_video_buffer_count, 2,
+             "Number of frames of --vc_video_output which may be in the "
+             "encoder before the render thread waits for the oldest one. "
+             "Encoded frames are written out as soon as they are done, so "
+             "this only limits how far the encoder may fall behind.");
+DEFINE_bool(vc_adaptive_meshing, false,
+            "Only mesh a new depth and color input frame if the camera moved "
+            "or the depth changed enough since the frame of the current mesh "
+            "(see MeshingScheduler), otherwise keep the current mesh. The "
+            "decisions are reported as the S_* timings metrics. Requires depth "
+            "camera input.");
+DEFINE_double(vc_adaptive_meshing_max_rotation_deg, 1,
+              "Camera rotation in degrees since the current mesh which always "
+              "causes re-meshing with --vc_adaptive_meshing.");
+DEFINE_double(vc_adaptive_meshing_max_translation, 0.01,
+              "Camera translation since the current mesh which always causes "
+              "re-meshing with --vc_adaptive_meshing.");
+DEFINE_double(vc_adaptive_meshing_max_depth_change, 0.05,
+              "Fraction of changed depth samples since the current mesh which "
+              "always causes re-meshing with --vc_adaptive_meshing.");
+DEFINE_int32(vc_adaptive_meshing_max_skipped_frames, 10,
+             "Maximum number of input frames which --vc_adaptive_meshing skips "
+             "in a row, or 0 for no limit.");
+DEFINE_double(vc_adaptive_meshing_budget_ms, 0,
+              "GPU time budget per frame in milliseconds. If the average GPU "
+              "times of meshing and rendering fit into it together, "
+              "--vc_adaptive_meshing also re-meshes frames with smaller "
+              "changes. 0 disables this.");
+DEFINE_int32(vc_meshing_device, -1,
+             "CUDA device to run the asynchronous source frame meshing on. The "
+             "target frame rendering stays on the device of the OpenGL "
+             "context, and the meshes are copied to it peer-to-peer. -1 "
+             "meshes on the render device. Requires "
+             "--vc_async_source_meshing and depth camera input.");
+DEFINE_int32(vc_occlusion_safety_radius, 0,
+             "Deletes the source frame pixels which are more than "
+             "--vc_occlusion_safety_threshold behind the closest pixel within "
+             "this radius (in pixels, at most 4) while meshing, which reduces "
+             "the bleeding of foreground objects onto the background at "
+             "imprecise occlusion boundaries. 0 disables this.");
+DEFINE_double(vc_occlusion_safety_threshold, 0.14,
+              "Depth difference in meters for --vc_occlusion_safety_radius.");
+DEFINE_bool(vc_target_hole_map, true,
+            "Counts the holes of the target frame into a hierarchical map while "
+            "preparing it, which lets the target frame inpainting exclude the "
+            "blocks without holes from its iterations and select the active "
+            "blocks of the depth and color passes with a single download.");
+DEFINE_int32(vc_record_session_queue_size, 30,
+             "Maximum number of images which wait to be written to the "
+             "--vc_record_session file. Images which arrive while the queue "
+             "is full are dropped from the recording.");
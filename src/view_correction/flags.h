@@ -36,6 +36,8 @@ DECLARE_bool(vc_write_images);
 DECLARE_string(vc_depth_source);
 
 DECLARE_string(vc_inpainting_method);
+DECLARE_string(vc_tv_inpainting_mode);
+DECLARE_int32(vc_tv_pyramid_levels);
 
 DECLARE_bool(vc_evaluate_rgb_frame_inpainting);
 DECLARE_bool(vc_evaluate_vs_previous_frame);
@@ -45,11 +47,79 @@ DECLARE_bool(vc_ensure_target_frame_temporal_consistency);
 
 DECLARE_bool(vc_do_timings);
 DECLARE_bool(vc_save_timings);
+DECLARE_string(vc_timings_file);
+DECLARE_int32(vc_timings_window);
+DECLARE_int32(vc_timings_interval);
 
 DECLARE_bool(vc_evaluate_stereo);
 DECLARE_bool(vc_write_stereo_result);
 DECLARE_bool(vc_use_weights_for_inpainting);
 
+DECLARE_bool(vc_async_source_meshing);
+DECLARE_bool(vc_device_resident_inpainting);
+DECLARE_bool(vc_average_uv);
+DECLARE_bool(vc_project_rgb_image);
+DECLARE_int32(vc_pinned_input_slab_count);
+DECLARE_double(vc_display_time_offset_ms);
+DECLARE_double(vc_max_pose_extrapolation_ms);
+DECLARE_bool(vc_target_cuda_graph);
+DECLARE_bool(vc_persistent_inpainting_kernel);
+DECLARE_bool(vc_compact_mesh_indices);
+DECLARE_bool(vc_decimate_mesh);
+DECLARE_double(vc_mesh_decimation_threshold);
+DECLARE_bool(vc_warm_start_target_inpainting);
+DECLARE_bool(vc_incremental_source_update);
+DECLARE_double(vc_dirty_tile_depth_threshold);
+DECLARE_int32(vc_dirty_tile_intensity_threshold);
+DECLARE_int32(vc_display_ring_size);
+DECLARE_int32(vc_image_writer_threads);
+DECLARE_int32(vc_image_writer_queue_size);
+DECLARE_bool(vc_dynamic_resolution);
+DECLARE_string(vc_dynamic_resolution_ladder);
+DECLARE_double(vc_dynamic_resolution_budget_ms);
+DECLARE_double(vc_dynamic_resolution_upscale_fraction);
+DECLARE_int32(vc_dynamic_resolution_window);
+DECLARE_double(vc_target_inpainting_budget_ms);
+DECLARE_double(vc_target_depth_inpainting_budget_fraction);
+DECLARE_double(vc_source_inpainting_budget_ms);
+DECLARE_bool(vc_cuda_depth_warp);
+DECLARE_bool(vc_headless);
+DECLARE_bool(vc_stereo);
+DECLARE_int32(vc_max_target_views);
+DECLARE_bool(vc_autotune_inpainting_kernels);
+DECLARE_string(vc_inpainting_autotune_cache);
+DECLARE_bool(vc_evaluate_ssim);
+DECLARE_string(vc_evaluation_results_path);
+DECLARE_string(vc_record_session);
+DECLARE_string(vc_replay_session);
+DECLARE_bool(vc_foveated_inpainting);
+DECLARE_double(vc_foveation_radius);
+DECLARE_int32(vc_foveation_downsampling);
+DECLARE_bool(vc_reuse_frames);
+DECLARE_double(vc_reuse_frames_max_rotation_deg);
+DECLARE_double(vc_reuse_frames_max_translation);
+DECLARE_string(vc_shader_cache_directory);
+DECLARE_bool(vc_frame_pacing);
+DECLARE_double(vc_frame_pacing_margin_ms);
+DECLARE_string(vc_video_output);
+DECLARE_string(vc_video_codec);
+DECLARE_int32(vc_video_bitrate_kbps);
+DECLARE_int32(vc_video_frame_rate);
+DECLARE_double(vc_video_vbv_frames);
+DECLARE_int32(vc_video_idr_interval);
+DECLARE_int32(vc_video_buffer_count);
+DECLARE_bool(vc_adaptive_meshing);
+DECLARE_double(vc_adaptive_meshing_max_rotation_deg);
+DECLARE_double(vc_adaptive_meshing_max_translation);
+DECLARE_double(vc_adaptive_meshing_max_depth_change);
+DECLARE_int32(vc_adaptive_meshing_max_skipped_frames);
+DECLARE_double(vc_adaptive_meshing_budget_ms);
+DECLARE_int32(vc_meshing_device);
+DECLARE_int32(vc_occlusion_safety_radius);
+DECLARE_double(vc_occlusion_safety_threshold);
+DECLARE_bool(vc_target_hole_map);
+DECLARE_int32(vc_record_session_queue_size);
+
 namespace view_correction {
 
 // Define possible values for enum-like string flags to avoid having them in
@@ -64,6 +134,17 @@ struct vc_inpainting_method {
   static constexpr const char* TV = "TV";
 };
 
+struct vc_video_codec {
+  static constexpr const char* h264 = "h264";
+  static constexpr const char* hevc = "hevc";
+};
+
+struct vc_tv_inpainting_mode {
+  static constexpr const char* classic = "classic";
+  static constexpr const char* coarse_to_fine = "coarse_to_fine";
+  static constexpr const char* coarse_to_fine_adaptive = "coarse_to_fine_adaptive";
+};
+
 inline bool UsingDepthCameraInput() {
   return FLAGS_vc_depth_source == view_correction::vc_depth_source::depth_camera;
 }
@@ -72,6 +153,12 @@ inline bool UsingMeshInput() {
   return FLAGS_vc_depth_source == view_correction::vc_depth_source::mesh;
 }
 
+// Returns whether separate left and right eye images are rendered, either
+// for evaluation or with the shared-work stereo mode.
+inline bool RenderingStereo() {
+  return FLAGS_vc_evaluate_stereo || FLAGS_vc_stereo;
+}
+
 }
 
 #endif // VIEW_CORRECTION_FLAGS_H_
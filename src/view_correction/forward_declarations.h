@@ -34,6 +34,8 @@
 // Forward declares important classes (and declares pointer types).
 namespace view_correction {
 
+struct BlockCompactionBuffers;
+
 class CameraBase;
 typedef std::shared_ptr<CameraBase> CameraBasePtr;
 typedef std::shared_ptr<const CameraBase> CameraBaseConstPtr;
@@ -55,6 +57,10 @@ class FrameDeviceBuffers;
 typedef std::shared_ptr<FrameDeviceBuffers> FrameDeviceBuffersPtr;
 typedef std::shared_ptr<const FrameDeviceBuffers> FrameDeviceBuffersConstPtr;
 
+class HoleMap;
+
+class InpaintingArena;
+
 struct SceneEstimate;
 
 class ViewCorrection;
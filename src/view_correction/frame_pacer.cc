@@ -0,0 +1,136 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "view_correction/frame_pacer.h"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include <glog/logging.h>
+
+namespace view_correction {
+
+namespace {
+
+// Number of swap intervals which need to be measured before pacing the frames.
+constexpr int kMinSwapIntervals = 8;
+
+// Factor by which the extra margin after missed vsyncs decays per frame.
+constexpr float kMissMarginDecay = 0.95f;
+
+}  // namespace
+
+FramePacer::FramePacer(float margin_ms, int window_size)
+    : margin_(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::duration<float, std::milli>(margin_ms))),
+      window_size_(window_size),
+      miss_margin_(0),
+      have_last_swap_(false),
+      have_target_vsync_(false) {
+  CHECK_GE(margin_ms, 0);
+  CHECK_GE(window_size, 1);
+}
+
+FramePacer::TimePoint FramePacer::WaitForFrameStart() {
+  const std::chrono::steady_clock::duration refresh_interval = EstimateRefreshInterval();
+  TimePoint now = std::chrono::steady_clock::now();
+  if (refresh_interval.count() == 0 || frame_durations_.empty()) {
+    have_target_vsync_ = false;
+    frame_start_ = now;
+    return now;
+  }
+  
+  // Find the earliest vsync after the last swap for which the frame can be
+  // finished when starting it now.
+  const std::chrono::steady_clock::duration frame_duration =
+      *std::max_element(frame_durations_.begin(), frame_durations_.end()) +
+      margin_ + miss_margin_;
+  const int64_t intervals_until_ready =
+      (now + frame_duration - last_swap_) / refresh_interval;
+  target_vsync_ = last_swap_ + (intervals_until_ready + 1) * refresh_interval;
+  have_target_vsync_ = true;
+  
+  // Start the frame as late as possible for this vsync.
+  const TimePoint start_time = target_vsync_ - frame_duration;
+  if (start_time > now) {
+    std::this_thread::sleep_until(start_time);
+    now = std::chrono::steady_clock::now();
+  }
+  frame_start_ = now;
+  return target_vsync_;
+}
+
+void FramePacer::FrameSubmitted() {
+  frame_durations_.push_back(std::chrono::steady_clock::now() - frame_start_);
+  if (static_cast<int>(frame_durations_.size()) > window_size_) {
+    frame_durations_.pop_front();
+  }
+}
+
+void FramePacer::FrameSwapped() {
+  const TimePoint now = std::chrono::steady_clock::now();
+  const std::chrono::steady_clock::duration refresh_interval = EstimateRefreshInterval();
+  
+  if (have_target_vsync_) {
+    if (now > target_vsync_ + refresh_interval / 2) {
+      // The frame missed its vsync.
+      miss_margin_ += refresh_interval / 4;
+    } else {
+      miss_margin_ = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          miss_margin_ * kMissMarginDecay);
+    }
+  }
+  
+  if (have_last_swap_) {
+    swap_intervals_.push_back(now - last_swap_);
+    if (static_cast<int>(swap_intervals_.size()) > window_size_) {
+      swap_intervals_.pop_front();
+    }
+  }
+  last_swap_ = now;
+  have_last_swap_ = true;
+}
+
+float FramePacer::refresh_interval_ms() const {
+  return std::chrono::duration<float, std::milli>(EstimateRefreshInterval()).count();
+}
+
+std::chrono::steady_clock::duration FramePacer::EstimateRefreshInterval() const {
+  if (static_cast<int>(swap_intervals_.size()) < kMinSwapIntervals) {
+    return std::chrono::steady_clock::duration(0);
+  }
+  // The median is robust against the doubled intervals of missed vsyncs.
+  std::vector<std::chrono::steady_clock::duration> intervals(
+      swap_intervals_.begin(), swap_intervals_.end());
+  std::nth_element(intervals.begin(), intervals.begin() + intervals.size() / 2,
+                   intervals.end());
+  return intervals[intervals.size() / 2];
+}
+
+}  // namespace view_correction
@@ -0,0 +1,106 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef VIEW_CORRECTION_FRAME_PACER_H_
+#define VIEW_CORRECTION_FRAME_PACER_H_
+
+#include <chrono>
+#include <deque>
+
+namespace view_correction {
+
+// Delays the start of each frame of a render loop with a vsync-blocking buffer
+// swap such that the frame is finished just before the vsync at which it is
+// displayed. Compared to starting each frame right after the previous swap,
+// the inputs (in particular the poses) are then sampled up to a refresh
+// interval later, which reduces the motion-to-photon latency without any
+// additional GPU work.
+//
+// The refresh interval is estimated as the median interval between the
+// returns of the swaps, which happen at the vsyncs. The time needed for a
+// frame is estimated as the maximum over a window of frames of the time from
+// the frame start to the swap call, plus a safety margin. Each frame which
+// is displayed at a later vsync than targeted increases the margin by a
+// quarter of the refresh interval, and this extra margin decays again over
+// the following frames.
+//
+// Usage in the render loop:
+//   display_time = pacer.WaitForFrameStart();
+//   ... poll the inputs and render the frame for display_time ...
+//   pacer.FrameSubmitted();
+//   SwapBuffers();
+//   pacer.FrameSwapped();
+//
+// Not thread-safe.
+class FramePacer {
+ public:
+  typedef std::chrono::steady_clock::time_point TimePoint;
+  
+  FramePacer(float margin_ms, int window_size);
+  
+  // Waits until the frame should be started and returns the predicted time of
+  // the vsync at which it will be displayed. Does not wait until enough swaps
+  // have been measured to predict the vsyncs, and then returns the earliest
+  // possible display time (i.e., the current time).
+  TimePoint WaitForFrameStart();
+  
+  // Must be called right before the buffer swap.
+  void FrameSubmitted();
+  
+  // Must be called right after the buffer swap returned.
+  void FrameSwapped();
+  
+  // Returns the estimated refresh interval in milliseconds, or 0 if it has
+  // not been measured yet.
+  float refresh_interval_ms() const;
+  
+ private:
+  // Returns the estimated refresh interval, or zero if unknown.
+  std::chrono::steady_clock::duration EstimateRefreshInterval() const;
+  
+  std::chrono::steady_clock::duration margin_;
+  int window_size_;
+  
+  // Additional margin after frames which missed their vsync.
+  std::chrono::steady_clock::duration miss_margin_;
+  
+  // Intervals between the swap returns and frame durations (from the frame
+  // start to the swap call) of the last window_size_ frames.
+  std::deque<std::chrono::steady_clock::duration> swap_intervals_;
+  std::deque<std::chrono::steady_clock::duration> frame_durations_;
+  
+  TimePoint frame_start_;
+  TimePoint target_vsync_;
+  TimePoint last_swap_;
+  bool have_last_swap_;
+  bool have_target_vsync_;
+};
+
+}  // namespace view_correction
+
+#endif  // VIEW_CORRECTION_FRAME_PACER_H_
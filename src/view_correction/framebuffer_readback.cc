@@ -0,0 +1,150 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "view_correction/framebuffer_readback.h"
+
+#include <cstring>
+
+#include <glog/logging.h>
+#include <opencv2/core/core.hpp>
+#ifdef ANDROID
+#include <opencv2/imgproc/imgproc.hpp>
+#endif
+
+#include "view_correction/image_writer.h"
+
+namespace view_correction {
+
+FramebufferReadback::FramebufferReadback(int buffer_count, ImageWriter* writer)
+    : oldest_index_(0),
+      pending_count_(0),
+      writer_(writer) {
+  CHECK_GT(buffer_count, 0);
+  CHECK_NOTNULL(writer);
+  buffers_.resize(buffer_count);
+  for (PixelBuffer& buffer : buffers_) {
+    glGenBuffers(1, &buffer.buffer);
+    buffer.size = 0;
+    buffer.fence = nullptr;
+  }
+  CHECK_OPENGL_NO_ERROR();
+}
+
+FramebufferReadback::~FramebufferReadback() {
+  while (pending_count_ > 0) {
+    FinishOldest(true);
+  }
+  for (PixelBuffer& buffer : buffers_) {
+    glDeleteBuffers(1, &buffer.buffer);
+  }
+}
+
+void FramebufferReadback::Read(int x, int y, int width, int height, const std::string& path) {
+  const int buffer_count = buffers_.size();
+  if (pending_count_ == buffer_count) {
+    FinishOldest(true);
+  }
+  PixelBuffer* buffer = &buffers_[(oldest_index_ + pending_count_) % buffer_count];
+  
+  const size_t size = 3 * width * height;
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer->buffer);
+  if (buffer->size != size) {
+    glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+    buffer->size = size;
+  }
+  
+  // With a pixel pack buffer bound, glReadPixels() returns without waiting
+  // for the transfer. The channel order is swapped as part of the transfer
+  // on desktop OpenGL (OpenCV expects BGR), GLES only supports RGB.
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+#ifdef ANDROID
+  glReadPixels(x, y, width, height, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+#else
+  glReadPixels(x, y, width, height, GL_BGR, GL_UNSIGNED_BYTE, nullptr);
+#endif
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  buffer->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  CHECK_OPENGL_NO_ERROR();
+  
+  buffer->width = width;
+  buffer->height = height;
+  buffer->path = path;
+  ++ pending_count_;
+}
+
+void FramebufferReadback::Poll() {
+  while (pending_count_ > 0 && FinishOldest(false)) {}
+}
+
+bool FramebufferReadback::FinishOldest(bool wait) {
+  PixelBuffer* buffer = &buffers_[oldest_index_];
+  
+  // Flush the fence when waiting, since otherwise it might never be signaled.
+  constexpr GLuint64 kWaitTimeoutNanoseconds = 1000 * 1000 * 1000;
+  GLenum status = glClientWaitSync(
+      buffer->fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0,
+      wait ? kWaitTimeoutNanoseconds : 0);
+  while (wait && status == GL_TIMEOUT_EXPIRED) {
+    status = glClientWaitSync(buffer->fence, 0, kWaitTimeoutNanoseconds);
+  }
+  if (status == GL_TIMEOUT_EXPIRED) {
+    return false;
+  } else if (status == GL_WAIT_FAILED) {
+    LOG(ERROR) << "glClientWaitSync() failed, dropping image: " << buffer->path;
+  } else {
+    // Copy the image out of the buffer, flipping it vertically.
+    cv::Mat_<cv::Vec3b> image(buffer->height, buffer->width);
+    const size_t row_size = 3 * buffer->width;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer->buffer);
+    const uint8_t* data = static_cast<const uint8_t*>(
+        glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, buffer->size, GL_MAP_READ_BIT));
+    if (data) {
+      for (int y = 0; y < buffer->height; ++ y) {
+        memcpy(image.ptr(buffer->height - 1 - y), data + y * row_size, row_size);
+      }
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+#ifdef ANDROID
+      cv::cvtColor(image, image, CV_RGB2BGR);
+#endif
+      writer_->Write(buffer->path, image);
+    } else {
+      LOG(ERROR) << "Cannot map pixel buffer, dropping image: " << buffer->path;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    CHECK_OPENGL_NO_ERROR();
+  }
+  
+  glDeleteSync(buffer->fence);
+  buffer->fence = nullptr;
+  oldest_index_ = (oldest_index_ + 1) % buffers_.size();
+  -- pending_count_;
+  return true;
+}
+
+}  // namespace view_correction
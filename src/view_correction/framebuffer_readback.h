@@ -0,0 +1,90 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef VIEW_CORRECTION_FRAMEBUFFER_READBACK_H_
+#define VIEW_CORRECTION_FRAMEBUFFER_READBACK_H_
+
+#include <string>
+#include <vector>
+
+#include "view_correction/opengl_util.h"
+
+namespace view_correction {
+
+class ImageWriter;
+
+// Reads back regions of the default framebuffer asynchronously and writes
+// them to image files. Each Read() only enqueues a transfer into the next of
+// a ring of pixel buffer objects, followed by a fence. Poll() copies finished
+// transfers out of their buffers (flipping them vertically, since OpenGL's
+// origin is at the bottom left) and hands them to the ImageWriter. If the
+// ring is full, Read() first waits for the oldest transfer.
+//
+// Must only be used from the thread which has the OpenGL context.
+class FramebufferReadback {
+ public:
+  FramebufferReadback(int buffer_count, ImageWriter* writer);
+  
+  // Waits for and writes the remaining transfers.
+  ~FramebufferReadback();
+  
+  // Enqueues reading back the given region as an 8-bit BGR image, which will
+  // be written to path.
+  void Read(int x, int y, int width, int height, const std::string& path);
+  
+  // Writes the transfers which have finished, in the order they were read.
+  void Poll();
+  
+ private:
+  struct PixelBuffer {
+    GLuint buffer;
+    size_t size;
+    // Non-null while a transfer is pending.
+    GLsync fence;
+    int width;
+    int height;
+    std::string path;
+  };
+  
+  FramebufferReadback(const FramebufferReadback&) = delete;
+  FramebufferReadback& operator=(const FramebufferReadback&) = delete;
+  
+  // Waits for the oldest pending transfer if wait is set, and writes it if it
+  // has finished. Returns whether it has been written.
+  bool FinishOldest(bool wait);
+  
+  std::vector<PixelBuffer> buffers_;
+  // Index of the oldest pending transfer.
+  int oldest_index_;
+  int pending_count_;
+  ImageWriter* writer_;
+};
+
+}  // namespace view_correction
+
+#endif  // VIEW_CORRECTION_FRAMEBUFFER_READBACK_H_
@@ -0,0 +1,84 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "view_correction/host_scratch_arena.h"
+
+#include <algorithm>
+
+namespace view_correction {
+
+// Alignment of every allocation, sufficient for all fundamental types and
+// the CUDA vector types.
+constexpr size_t kHostScratchAlignment = 16;
+// Minimum size of the arena's blocks.
+constexpr size_t kMinHostScratchBlockSize = 64 * 1024;
+
+HostScratchScope::HostScratchScope()
+    : arena_(ThreadArena()),
+      saved_block_index_(arena_->block_index),
+      saved_offset_(arena_->offset) {}
+
+HostScratchScope::~HostScratchScope() {
+  arena_->block_index = saved_block_index_;
+  arena_->offset = saved_offset_;
+}
+
+HostScratchScope::Arena* HostScratchScope::ThreadArena() {
+  static thread_local Arena arena;
+  return &arena;
+}
+
+void* HostScratchScope::AllocateBytes(size_t size) {
+  size = std::max<size_t>(1, (size + kHostScratchAlignment - 1) /
+                                 kHostScratchAlignment * kHostScratchAlignment);
+  
+  // Continue in the current block if it has enough space left, otherwise
+  // move on to the next block. Blocks from which nothing is allocated
+  // currently can be replaced if they are too small.
+  if (arena_->block_index < static_cast<int>(arena_->blocks.size()) &&
+      arena_->offset > 0 &&
+      arena_->offset + size > arena_->block_sizes[arena_->block_index]) {
+    ++ arena_->block_index;
+    arena_->offset = 0;
+  }
+  if (arena_->block_index == static_cast<int>(arena_->blocks.size())) {
+    arena_->blocks.emplace_back();
+    arena_->block_sizes.push_back(0);
+  }
+  if (arena_->block_sizes[arena_->block_index] < size) {
+    const size_t block_size = std::max(size, kMinHostScratchBlockSize);
+    arena_->blocks[arena_->block_index].reset(new uint8_t[block_size]);
+    arena_->block_sizes[arena_->block_index] = block_size;
+  }
+  
+  uint8_t* result = arena_->blocks[arena_->block_index].get() + arena_->offset;
+  arena_->offset += size;
+  return result;
+}
+
+}  // namespace view_correction
@@ -0,0 +1,80 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef VIEW_CORRECTION_HOST_SCRATCH_ARENA_H_
+#define VIEW_CORRECTION_HOST_SCRATCH_ARENA_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace view_correction {
+
+// Scope for allocating temporary host arrays from a thread-local arena, for
+// example for staging data downloaded from the GPU in the inpainting
+// functions. The arrays remain valid until the scope is destroyed, which
+// makes their memory available to the next scope. The arena keeps its memory,
+// so once it has grown to the sizes required, no more allocations happen.
+// Scopes may be nested.
+class HostScratchScope {
+ public:
+  HostScratchScope();
+  
+  ~HostScratchScope();
+  
+  // Returns an uninitialized array of count elements.
+  template <typename T>
+  T* Allocate(size_t count) {
+    return reinterpret_cast<T*>(AllocateBytes(count * sizeof(T)));
+  }
+  
+ private:
+  struct Arena {
+    std::vector<std::unique_ptr<uint8_t[]>> blocks;
+    std::vector<size_t> block_sizes;
+    // Position at which the next allocation starts.
+    int block_index = 0;
+    size_t offset = 0;
+  };
+  
+  HostScratchScope(const HostScratchScope&) = delete;
+  HostScratchScope& operator=(const HostScratchScope&) = delete;
+  
+  static Arena* ThreadArena();
+  
+  void* AllocateBytes(size_t size);
+  
+  Arena* arena_;
+  int saved_block_index_;
+  size_t saved_offset_;
+};
+
+}  // namespace view_correction
+
+#endif  // VIEW_CORRECTION_HOST_SCRATCH_ARENA_H_
@@ -0,0 +1,107 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "view_correction/image_writer.h"
+
+#include <utility>
+
+#include <glog/logging.h>
+#include <opencv2/highgui/highgui.hpp>
+
+namespace view_correction {
+
+ImageWriter::ImageWriter(int thread_count, int max_queued_images)
+    : max_queued_images_(max_queued_images),
+      active_job_count_(0),
+      quit_requested_(false) {
+  CHECK_GT(thread_count, 0);
+  CHECK_GT(max_queued_images, 0);
+  threads_.reserve(thread_count);
+  for (int i = 0; i < thread_count; ++ i) {
+    threads_.emplace_back(&ImageWriter::ThreadMain, this);
+  }
+}
+
+ImageWriter::~ImageWriter() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  quit_requested_ = true;
+  lock.unlock();
+  job_available_condition_.notify_all();
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+}
+
+void ImageWriter::Write(const std::string& path, const cv::Mat& image) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (static_cast<int>(queue_.size()) >= max_queued_images_) {
+    job_taken_condition_.wait(lock);
+  }
+  queue_.emplace_back();
+  queue_.back().path = path;
+  queue_.back().image = image;
+  lock.unlock();
+  job_available_condition_.notify_one();
+}
+
+void ImageWriter::WaitUntilIdle() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!queue_.empty() || active_job_count_ > 0) {
+    job_taken_condition_.wait(lock);
+  }
+}
+
+void ImageWriter::ThreadMain() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    // The remaining jobs are still done if quitting, such that no images get
+    // lost at exit.
+    while (queue_.empty() && !quit_requested_) {
+      job_available_condition_.wait(lock);
+    }
+    if (queue_.empty()) {
+      return;
+    }
+    
+    Job job = std::move(queue_.front());
+    queue_.pop_front();
+    ++ active_job_count_;
+    lock.unlock();
+    job_taken_condition_.notify_all();
+    
+    if (!cv::imwrite(job.path, job.image)) {
+      LOG(ERROR) << "Cannot write image: " << job.path;
+    }
+    
+    lock.lock();
+    -- active_job_count_;
+    job_taken_condition_.notify_all();
+  }
+}
+
+}  // namespace view_correction
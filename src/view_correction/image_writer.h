@@ -0,0 +1,89 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef VIEW_CORRECTION_IMAGE_WRITER_H_
+#define VIEW_CORRECTION_IMAGE_WRITER_H_
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+namespace view_correction {
+
+// Pool of background threads which encode images and write them to files,
+// such that recording debug or result images does not stall the render
+// thread. The queue is bounded: Write() blocks while max_queued_images images
+// are waiting to be written, which limits the memory use if the threads
+// cannot keep up.
+//
+// Thread-safe.
+class ImageWriter {
+ public:
+  ImageWriter(int thread_count, int max_queued_images);
+  
+  // Writes all images which are still queued and stops the threads.
+  ~ImageWriter();
+  
+  // Queues the image to be written to path (with cv::imwrite()). The image
+  // data is shared, not copied, so it must not be modified afterwards.
+  void Write(const std::string& path, const cv::Mat& image);
+  
+  // Blocks until all queued images have been written.
+  void WaitUntilIdle();
+  
+ private:
+  struct Job {
+    std::string path;
+    cv::Mat image;
+  };
+  
+  ImageWriter(const ImageWriter&) = delete;
+  ImageWriter& operator=(const ImageWriter&) = delete;
+  
+  void ThreadMain();
+  
+  int max_queued_images_;
+  std::mutex mutex_;
+  // Signaled when a job is queued or quit_requested_ is set.
+  std::condition_variable job_available_condition_;
+  // Signaled when a job is taken from the queue or finished.
+  std::condition_variable job_taken_condition_;
+  std::deque<Job> queue_;
+  int active_job_count_;
+  bool quit_requested_;
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace view_correction
+
+#endif  // VIEW_CORRECTION_IMAGE_WRITER_H_
@@ -0,0 +1,243 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "view_correction/inpainting_autotuner.h"
+
+#include <fstream>
+#include <limits>
+#include <random>
+#include <sstream>
+
+#include <glog/logging.h>
+
+#include "view_correction/cuda_block_compaction.cuh"
+#include "view_correction/cuda_buffer.h"
+#include "view_correction/cuda_util.h"
+
+namespace view_correction {
+
+namespace {
+
+// Number of iterations per timed inpainting call. Divisible by all
+// iterations_per_call values such that all configurations do the same work.
+constexpr int kTuningIterations = 200;
+
+// Number of timed calls per configuration, after one warm-up call.
+constexpr int kTuningRepetitions = 5;
+
+// Side length of the square holes of the synthetic depth map (which roughly
+// corresponds to holes due to disocclusions) and the fraction of holes.
+constexpr int kHoleSize = 24;
+constexpr float kHoleRatio = 0.3f;
+
+// Returns the name of the current CUDA device.
+std::string GetCurrentDeviceName() {
+  int device;
+  CUDA_CHECKED_CALL(cudaGetDevice(&device));
+  cudaDeviceProp properties;
+  CUDA_CHECKED_CALL(cudaGetDeviceProperties(&properties, device));
+  return properties.name;
+}
+
+}  // namespace
+
+InpaintingAutotuner::InpaintingAutotuner(const std::string& cache_path)
+    : cache_path_(cache_path) {
+  LoadCache();
+}
+
+ConvolutionInpaintingConfig InpaintingAutotuner::SelectConvolutionConfig(
+    cudaStream_t stream, int width, int height, bool use_weighting,
+    bool use_persistent_kernel) {
+  // The pipeline may tune for several devices (see --vc_meshing_device).
+  const std::string device_name = GetCurrentDeviceName();
+  for (const Entry& entry : entries_) {
+    if (entry.device_name == device_name &&
+        entry.width == width &&
+        entry.height == height &&
+        entry.use_weighting == use_weighting &&
+        entry.use_persistent_kernel == use_persistent_kernel) {
+      return entry.config;
+    }
+  }
+  
+  Entry entry;
+  entry.device_name = device_name;
+  entry.width = width;
+  entry.height = height;
+  entry.use_weighting = use_weighting;
+  entry.use_persistent_kernel = use_persistent_kernel;
+  entry.config = Tune(stream, width, height, use_weighting, use_persistent_kernel);
+  entries_.push_back(entry);
+  SaveCache();
+  return entry.config;
+}
+
+ConvolutionInpaintingConfig InpaintingAutotuner::Tune(
+    cudaStream_t stream, int width, int height, bool use_weighting,
+    bool use_persistent_kernel) {
+  // Create a slanted plane with random square holes and a gradient magnitude
+  // image with an edge, using a fixed seed such that the selection only
+  // depends on the timings.
+  std::mt19937 generator(0);
+  std::bernoulli_distribution hole_distribution(kHoleRatio);
+  const int tiles_x = cuda_util::GetBlockCount(width, kHoleSize);
+  const int tiles_y = cuda_util::GetBlockCount(height, kHoleSize);
+  std::vector<bool> hole_tiles(tiles_x * tiles_y);
+  for (std::size_t i = 0; i < hole_tiles.size(); ++ i) {
+    hole_tiles[i] = hole_distribution(generator);
+  }
+  std::vector<float> depth_cpu(width * height);
+  std::vector<uint8_t> gradient_cpu(width * height);
+  for (int y = 0; y < height; ++ y) {
+    for (int x = 0; x < width; ++ x) {
+      const int i = x + y * width;
+      const bool hole = hole_tiles[x / kHoleSize + (y / kHoleSize) * tiles_x];
+      depth_cpu[i] = hole ? 0.f : (1.f + x / static_cast<float>(width));
+      gradient_cpu[i] = (x == width / 2) ? 255 : 0;
+    }
+  }
+  
+  CUDABuffer<float> depth(height, width);
+  depth.DebugUpload(depth_cpu.data());
+  cudaTextureObject_t depth_texture;
+  depth.CreateTextureObject(
+      cudaAddressModeClamp, cudaAddressModeClamp, cudaFilterModePoint,
+      cudaReadModeElementType, false, &depth_texture);
+  CUDABuffer<uint8_t> gradient_magnitude_div_sqrt2(height, width);
+  gradient_magnitude_div_sqrt2.DebugUpload(gradient_cpu.data());
+  cudaTextureObject_t gradient_magnitude_div_sqrt2_texture;
+  gradient_magnitude_div_sqrt2.CreateTextureObject(
+      cudaAddressModeClamp, cudaAddressModeClamp, cudaFilterModePoint,
+      cudaReadModeElementType, false, &gradient_magnitude_div_sqrt2_texture);
+  
+  CUDABuffer<uint8_t> max_change(1, width * height);
+  CUDABuffer<float> depth_output(height, width);
+  CUDABuffer<uint16_t> block_coordinates(1, width * height);
+  BlockCompactionBuffers compaction_buffers(
+      GetConvolutionInpaintingBlockCount(width, height));
+  
+  cudaEvent_t start_event;
+  cudaEvent_t end_event;
+  CUDA_CHECKED_CALL(cudaEventCreate(&start_event));
+  CUDA_CHECKED_CALL(cudaEventCreate(&end_event));
+  
+  ConvolutionInpaintingConfig best_config;
+  float best_time_ms = std::numeric_limits<float>::infinity();
+  for (const ConvolutionInpaintingConfig& config : GetConvolutionInpaintingConfigs()) {
+    float total_ms = 0;
+    for (int repetition = -1; repetition < kTuningRepetitions; ++ repetition) {
+      uint32_t pixel_to_inpaint_count;
+      CUDA_CHECKED_CALL(cudaEventRecord(start_event, stream));
+      // A negative convergence threshold runs all iterations.
+      InpaintDepthMapWithConvolutionCUDA(
+          stream, use_weighting, kTuningIterations, -1.f, 1.0f,
+          gradient_magnitude_div_sqrt2_texture, depth_texture, nullptr,
+          nullptr, &max_change, &depth_output, &block_coordinates,
+          &pixel_to_inpaint_count, &compaction_buffers, use_persistent_kernel,
+          nullptr, nullptr, nullptr, config);
+      CUDA_CHECKED_CALL(cudaEventRecord(end_event, stream));
+      CUDA_CHECKED_CALL(cudaEventSynchronize(end_event));
+      if (repetition >= 0) {
+        float elapsed_ms;
+        CUDA_CHECKED_CALL(cudaEventElapsedTime(&elapsed_ms, start_event, end_event));
+        total_ms += elapsed_ms;
+      }
+    }
+    const float time_ms = total_ms / kTuningRepetitions;
+    VLOG(1) << "Convolution inpainting at " << width << " x " << height
+            << " with block size " << config.block_size << ", "
+            << config.iterations_per_call << " iterations per call: "
+            << time_ms << " ms";
+    if (time_ms < best_time_ms) {
+      best_time_ms = time_ms;
+      best_config = config;
+    }
+  }
+  
+  cudaEventDestroy(start_event);
+  cudaEventDestroy(end_event);
+  cudaDestroyTextureObject(depth_texture);
+  cudaDestroyTextureObject(gradient_magnitude_div_sqrt2_texture);
+  
+  LOG(INFO) << "Selected convolution inpainting kernels for " << width << " x "
+            << height << " on " << GetCurrentDeviceName() << ": block size "
+            << best_config.block_size << ", " << best_config.iterations_per_call
+            << " iterations per call (" << best_time_ms << " ms for "
+            << kTuningIterations << " iterations)";
+  return best_config;
+}
+
+void InpaintingAutotuner::LoadCache() {
+  if (cache_path_.empty()) {
+    return;
+  }
+  std::ifstream file_stream(cache_path_, std::ios::in);
+  std::string line;
+  while (std::getline(file_stream, line)) {
+    // Format: width height use_weighting use_persistent_kernel block_size
+    // iterations_per_call device name (which may contain spaces).
+    std::istringstream line_stream(line);
+    Entry entry;
+    line_stream >> entry.width >> entry.height >> entry.use_weighting
+                >> entry.use_persistent_kernel >> entry.config.block_size
+                >> entry.config.iterations_per_call >> std::ws;
+    std::getline(line_stream, entry.device_name);
+    if (!line_stream || entry.device_name.empty()) {
+      continue;
+    }
+    bool supported = false;
+    for (const ConvolutionInpaintingConfig& config : GetConvolutionInpaintingConfigs()) {
+      supported |= (config == entry.config);
+    }
+    if (!supported) {
+      // The entry stems from a build with other kernel instantiations.
+      continue;
+    }
+    entries_.push_back(entry);
+  }
+}
+
+void InpaintingAutotuner::SaveCache() const {
+  if (cache_path_.empty()) {
+    return;
+  }
+  std::ofstream file_stream(cache_path_, std::ios::out | std::ios::trunc);
+  for (const Entry& entry : entries_) {
+    file_stream << entry.width << " " << entry.height << " "
+                << entry.use_weighting << " " << entry.use_persistent_kernel
+                << " " << entry.config.block_size << " "
+                << entry.config.iterations_per_call << " "
+                << entry.device_name << std::endl;
+  }
+  if (!file_stream) {
+    LOG(WARNING) << "Cannot write the inpainting autotuning cache: " << cache_path_;
+  }
+}
+
+}  // namespace view_correction
@@ -0,0 +1,90 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef VIEW_CORRECTION_INPAINTING_AUTOTUNER_H_
+#define VIEW_CORRECTION_INPAINTING_AUTOTUNER_H_
+
+#include <string>
+#include <vector>
+
+#include <cuda_runtime.h>
+
+#include "view_correction/cuda_convolution_inpainting.cuh"
+
+namespace view_correction {
+
+// Selects the fastest kernel configuration of the convolution depth
+// inpainting (see ConvolutionInpaintingConfig) for the current CUDA device and
+// an image resolution. Each configuration is timed on a synthetic depth map
+// with holes for a fixed number of iterations. The selections are stored in a
+// cache file, keyed by device name, resolution and kernel variant, such that
+// later runs on the same device reuse them without tuning. The file may hold
+// the selections of several devices.
+//
+// Not thread-safe.
+class InpaintingAutotuner {
+ public:
+  // Loads the cache file if it exists. If cache_path is empty, the selections
+  // are not persisted.
+  explicit InpaintingAutotuner(const std::string& cache_path);
+  
+  // Returns the configuration for images of the given size on the current
+  // CUDA device, tuning it on the given stream (which must belong to this
+  // device and is synchronized with) if it is not cached yet.
+  ConvolutionInpaintingConfig SelectConvolutionConfig(
+      cudaStream_t stream, int width, int height, bool use_weighting,
+      bool use_persistent_kernel);
+  
+ private:
+  struct Entry {
+    std::string device_name;
+    int width;
+    int height;
+    bool use_weighting;
+    bool use_persistent_kernel;
+    ConvolutionInpaintingConfig config;
+  };
+  
+  InpaintingAutotuner(const InpaintingAutotuner&) = delete;
+  InpaintingAutotuner& operator=(const InpaintingAutotuner&) = delete;
+  
+  // Times all configurations and returns the fastest one.
+  ConvolutionInpaintingConfig Tune(
+      cudaStream_t stream, int width, int height, bool use_weighting,
+      bool use_persistent_kernel);
+  
+  void LoadCache();
+  void SaveCache() const;
+  
+  std::string cache_path_;
+  std::vector<Entry> entries_;
+};
+
+}  // namespace view_correction
+
+#endif  // VIEW_CORRECTION_INPAINTING_AUTOTUNER_H_
@@ -0,0 +1,133 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef VIEW_CORRECTION_INPAINTING_DEADLINE_H_
+#define VIEW_CORRECTION_INPAINTING_DEADLINE_H_
+
+#include <algorithm>
+#include <chrono>
+
+namespace view_correction {
+
+// Time budget of an inpainting solver call. The solvers which check for
+// convergence on the host stop at the first convergence check after the
+// deadline, at which point the host has waited for the GPU, such that the
+// host time reflects the progress on the GPU. If an estimate of the GPU time
+// per iteration is given, the iteration count is additionally limited up front
+// to the iterations which fit into the time remaining at the call, which also
+// bounds the solvers which do not synchronize with the host.
+struct InpaintingDeadline {
+  // Host time at which the solver should stop iterating.
+  std::chrono::steady_clock::time_point time;
+  
+  // Estimated GPU time of one iteration in milliseconds (e.g., learned from
+  // previous frames with IterationCostEstimate), or 0 if unknown.
+  float ms_per_iteration = 0;
+  
+  // Returns whether the deadline has passed.
+  inline bool Reached() const {
+    return std::chrono::steady_clock::now() >= time;
+  }
+  
+  // Returns max_num_iterations, limited to the number of iterations which fit
+  // into the remaining time if ms_per_iteration is known. At least
+  // min_num_iterations are always done, such that the result is usable. The
+  // limit is rounded down to a multiple of min_num_iterations, such that it
+  // only changes in coarse steps from frame to frame (which keeps captured
+  // CUDA graphs updatable).
+  inline int LimitIterations(int max_num_iterations,
+                             int min_num_iterations) const {
+    if (ms_per_iteration <= 0) {
+      return max_num_iterations;
+    }
+    const float remaining_ms = std::chrono::duration<float, std::milli>(
+        time - std::chrono::steady_clock::now()).count();
+    int affordable_iterations =
+        static_cast<int>(std::max(0.f, remaining_ms) / ms_per_iteration);
+    affordable_iterations -= affordable_iterations % min_num_iterations;
+    return std::min(max_num_iterations,
+                    std::max(min_num_iterations, affordable_iterations));
+  }
+};
+
+// Returns a deadline budget_ms milliseconds from now.
+inline InpaintingDeadline MakeInpaintingDeadline(float budget_ms,
+                                                 float ms_per_iteration) {
+  InpaintingDeadline deadline;
+  deadline.time = std::chrono::steady_clock::now() +
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::duration<float, std::milli>(budget_ms));
+  deadline.ms_per_iteration = ms_per_iteration;
+  return deadline;
+}
+
+// Convergence state of an inpainting solver when it stopped, for monitoring
+// the quality achieved within a deadline. Values which are not available
+// (e.g., since the solver did not synchronize with the host) are negative.
+struct InpaintingResidual {
+  // Largest change rate of the blocks which were still active at the last
+  // convergence check (compared to max_change_rate_threshold by the solvers).
+  // Only available if the converged blocks are retired on the CPU.
+  float max_change_rate = -1;
+  
+  // Fraction of the initially active blocks which had not converged when the
+  // solver stopped. 0 if it converged.
+  float unconverged_block_fraction = -1;
+  
+  // Whether the solver stopped because the deadline was reached.
+  bool deadline_reached = false;
+};
+
+// Running estimate of the GPU time per iteration of a solver, an exponential
+// moving average over the measured frames.
+class IterationCostEstimate {
+ public:
+  // Adds the measured GPU time of a solver call with the given number of
+  // iterations. Calls without iterations are ignored.
+  inline void AddSample(float milliseconds, int iterations) {
+    if (iterations <= 0 || milliseconds <= 0) {
+      return;
+    }
+    const float sample = milliseconds / iterations;
+    ms_per_iteration_ = (ms_per_iteration_ > 0) ?
+        ((1 - kSmoothing) * ms_per_iteration_ + kSmoothing * sample) :
+        sample;
+  }
+  
+  // Returns the estimate in milliseconds, or 0 if there was no sample yet.
+  inline float ms_per_iteration() const { return ms_per_iteration_; }
+  
+ private:
+  static constexpr float kSmoothing = 0.1f;
+  
+  float ms_per_iteration_ = 0;
+};
+
+}  // namespace view_correction
+
+#endif  // VIEW_CORRECTION_INPAINTING_DEADLINE_H_
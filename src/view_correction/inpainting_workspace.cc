@@ -0,0 +1,153 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "view_correction/inpainting_workspace.h"
+
+#include <algorithm>
+
+#include <glog/logging.h>
+
+#include "view_correction/cuda_device_allocator.h"
+
+namespace view_correction {
+
+constexpr int InpaintingWorkspace::kAllPhases;
+
+InpaintingArena::InpaintingArena()
+    : size_(0) {}
+
+InpaintingArena::~InpaintingArena() {
+  CHECK(workspaces_.empty()) << "Workspaces are still attached to the arena.";
+}
+
+void InpaintingArena::Attach(InpaintingWorkspace* workspace) {
+  workspaces_.push_back(workspace);
+  if (workspace->size() > size_) {
+    // Grow the memory and move the buffers of all attached workspaces to it.
+    // The old memory is only handed out again after the work which is still
+    // pending on it has completed (see FreeCUDAPitchedMemory()).
+    size_ = workspace->size();
+    memory_.reset(new CUDABuffer<uint8_t>(1, static_cast<int>(size_)));
+    for (InpaintingWorkspace* attached_workspace : workspaces_) {
+      attached_workspace->CreateBuffers(memory_->ToCUDA().address());
+    }
+    VLOG(1) << "Shared inpainting arena: " << size_ << " bytes for "
+            << workspaces_.size() << " workspaces";
+  } else if (memory_) {
+    workspace->CreateBuffers(memory_->ToCUDA().address());
+  }
+}
+
+void InpaintingArena::Detach(InpaintingWorkspace* workspace) {
+  auto it = std::find(workspaces_.begin(), workspaces_.end(), workspace);
+  CHECK(it != workspaces_.end());
+  workspaces_.erase(it);
+}
+
+InpaintingWorkspace::InpaintingWorkspace()
+    : shared_size_(0),
+      arena_size_(0),
+      shared_arena_(nullptr),
+      allocated_(false) {
+  GetCUDAPitchedMemoryAlignment(&pitch_alignment_, &address_alignment_);
+}
+
+InpaintingWorkspace::~InpaintingWorkspace() {
+  if (shared_arena_) {
+    shared_arena_->Detach(this);
+  }
+}
+
+size_t InpaintingWorkspace::GetPitch(size_t width_in_bytes) const {
+  return ((width_in_bytes + pitch_alignment_ - 1) / pitch_alignment_) *
+         pitch_alignment_;
+}
+
+void InpaintingWorkspace::Reserve(
+    int phase, size_t size, const std::function<void(uint8_t*)>& create) {
+  CHECK(!allocated_) << "Buffers must be added before calling Allocate().";
+  CHECK_GE(phase, kAllPhases);
+  
+  size_t* used_size;
+  if (phase == kAllPhases) {
+    used_size = &shared_size_;
+  } else {
+    if (phase >= static_cast<int>(phase_sizes_.size())) {
+      phase_sizes_.resize(phase + 1, 0);
+    }
+    used_size = &phase_sizes_[phase];
+  }
+  
+  Entry entry;
+  entry.phase = phase;
+  entry.offset = *used_size;
+  entry.create = create;
+  entries_.push_back(entry);
+  
+  // Keep the start of the next buffer aligned for binding textures.
+  *used_size += ((size + address_alignment_ - 1) / address_alignment_) *
+                address_alignment_;
+}
+
+void InpaintingWorkspace::Allocate(InpaintingArena* shared_arena) {
+  CHECK(!allocated_) << "Allocate() must only be called once.";
+  allocated_ = true;
+  
+  size_t max_phase_size = 0;
+  for (size_t phase_size : phase_sizes_) {
+    max_phase_size = std::max(max_phase_size, phase_size);
+  }
+  arena_size_ = GetPitch(shared_size_ + max_phase_size);
+  
+  VLOG(1) << "Inpainting workspace: " << arena_size_ << " bytes ("
+          << shared_size_ << " bytes not aliased)";
+  
+  if (shared_arena) {
+    // The entries are kept, since the arena may re-create the buffers.
+    shared_arena_ = shared_arena;
+    shared_arena_->Attach(this);
+    return;
+  }
+  if (arena_size_ == 0) {
+    return;
+  }
+  
+  // The arena's start address has the alignment required for textures.
+  arena_.reset(new CUDABuffer<uint8_t>(1, static_cast<int>(arena_size_)));
+  CreateBuffers(arena_->ToCUDA().address());
+  entries_.clear();
+}
+
+void InpaintingWorkspace::CreateBuffers(uint8_t* base) {
+  for (Entry& entry : entries_) {
+    entry.create(base + (entry.phase == kAllPhases ? 0 : shared_size_) +
+                 entry.offset);
+  }
+}
+
+}  // namespace view_correction
@@ -0,0 +1,155 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef VIEW_CORRECTION_INPAINTING_WORKSPACE_H_
+#define VIEW_CORRECTION_INPAINTING_WORKSPACE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "view_correction/cuda_buffer.h"
+#include "view_correction/forward_declarations.h"
+
+namespace view_correction {
+
+// Plans the device memory of the inpainting solvers' scratch buffers, which
+// are only needed during a single solver invocation, and places all of them
+// in one allocation. Each buffer is added with the phase in which it is used.
+// Buffers used in different phases share memory, buffers of the same phase
+// and buffers added with kAllPhases get disjoint memory. Phases must thus
+// only be used for solver invocations which never overlap on the device, for
+// example ones which run one after another on the same stream.
+//
+// Usage: Add() all buffers, then call Allocate(), which creates them.
+class InpaintingWorkspace {
+ public:
+  // Phase of buffers which must not be aliased with any other buffer.
+  static constexpr int kAllPhases = -1;
+  
+  InpaintingWorkspace();
+  
+  // Detaches from the shared arena, if any.
+  ~InpaintingWorkspace();
+  
+  // Adds a height x width buffer which is used in the given phase (an index
+  // >= 0, or kAllPhases). *buffer is set by Allocate().
+  template <typename T>
+  void Add(int phase, int height, int width, CUDABufferPtr<T>* buffer) {
+    const size_t pitch = GetPitch(width * sizeof(T));
+    Reserve(phase, height * pitch, [=](uint8_t* address) {
+      buffer->reset(new CUDABuffer<T>(
+          height, width, reinterpret_cast<T*>(address), pitch));
+    });
+  }
+  
+  // Allocates the workspace memory and creates all added buffers. The
+  // buffers must not be used after the workspace is destroyed. If
+  // shared_arena is given, the buffers are placed in its memory instead of in
+  // an own allocation.
+  void Allocate(InpaintingArena* shared_arena = nullptr);
+  
+  // Returns the size of the workspace memory in bytes (which is allocated
+  // from the shared arena if one is used).
+  inline size_t size() const { return arena_size_; }
+  
+ private:
+  InpaintingWorkspace(const InpaintingWorkspace&) = delete;
+  InpaintingWorkspace& operator=(const InpaintingWorkspace&) = delete;
+  
+  struct Entry {
+    int phase;
+    // Offset from the start of the phase's memory.
+    size_t offset;
+    // Creates the buffer at the given address.
+    std::function<void(uint8_t*)> create;
+  };
+  
+  friend class InpaintingArena;
+  
+  size_t GetPitch(size_t width_in_bytes) const;
+  
+  // Creates all buffers in the memory starting at base.
+  void CreateBuffers(uint8_t* base);
+  
+  void Reserve(int phase, size_t size,
+               const std::function<void(uint8_t*)>& create);
+  
+  size_t pitch_alignment_;
+  size_t address_alignment_;
+  
+  std::vector<Entry> entries_;
+  // Size of the buffers of kAllPhases, which are placed first.
+  size_t shared_size_;
+  // Sizes of the buffers of each phase, indexed by phase. All phases start
+  // after the shared buffers.
+  std::vector<size_t> phase_sizes_;
+  
+  size_t arena_size_;
+  CUDABufferPtr<uint8_t> arena_;
+  InpaintingArena* shared_arena_;
+  bool allocated_;
+};
+
+// Device memory which is shared by the InpaintingWorkspaces attached to it,
+// such that all of them alias the same scratch memory. Like the phases of a
+// workspace, this must only be used for workspaces whose solver invocations
+// never overlap on the device, for example ones of displays which run on the
+// same stream (see ViewCorrectionServer). The memory has the size of the
+// largest attached workspace. If it has to grow, the buffers of all attached
+// workspaces are re-created in the new memory, so they must not be in use
+// when a workspace is attached.
+class InpaintingArena {
+ public:
+  InpaintingArena();
+  
+  // All attached workspaces must have been destroyed before.
+  ~InpaintingArena();
+  
+  // Returns the size of the arena memory in bytes.
+  inline size_t size() const { return size_; }
+  
+ private:
+  friend class InpaintingWorkspace;
+  
+  InpaintingArena(const InpaintingArena&) = delete;
+  InpaintingArena& operator=(const InpaintingArena&) = delete;
+  
+  // Called by InpaintingWorkspace::Allocate() and the workspace destructor.
+  void Attach(InpaintingWorkspace* workspace);
+  void Detach(InpaintingWorkspace* workspace);
+  
+  std::vector<InpaintingWorkspace*> workspaces_;
+  size_t size_;
+  CUDABufferPtr<uint8_t> memory_;
+};
+
+}  // namespace view_correction
+
+#endif  // VIEW_CORRECTION_INPAINTING_WORKSPACE_H_
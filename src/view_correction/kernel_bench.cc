@@ -0,0 +1,885 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// Times the inpainting, meshing and reprojection kernels in isolation on
+// synthetic input for several resolutions and hole ratios, and reports the
+// time per call, the achieved bandwidth and the theoretical occupancy of each
+// kernel (similar to the output of CUB's tune programs). The CUDA mesh warp
+// is additionally compared to rendering the mesh with OpenGL in an offscreen
+// context (see --kernel_bench_gl_warp).
+//
+// The kernels are timed through their host launchers with CUDA events, such
+// that the measurements include the auxiliary kernels of the launchers (for
+// example the initialization and block compaction kernels of the inpainting
+// functions). The inpainting functions run a fixed number of iterations since
+// the convergence threshold is set such that they never converge, except in
+// the TV_coarse_to_fine group, which compares the TV inpainting modes until
+// convergence. The
+// bandwidth is computed from the bytes per pixel which each call (or each
+// iteration, for the inpainting functions) has to read and write at least
+// (counting the input and output buffers once), see kBytesPerPixel below.
+// For the half-precision TV inpainting variants, the difference of their
+// results to the fp32 results is reported as well.
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <cuda_runtime.h>
+#include <Eigen/Core>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "view_correction/cuda_block_compaction.cuh"
+#include "view_correction/cuda_buffer.h"
+#include "view_correction/cuda_convolution_inpainting.cuh"
+#include "view_correction/cuda_convolution_inpainting_rgb.cuh"
+#include "view_correction/cuda_depth_warp.cuh"
+#include "view_correction/cuda_hole_map.cuh"
+#include "view_correction/cuda_tv_inpainting_functions.cuh"
+#include "view_correction/cuda_util.h"
+#include "view_correction/flags.h"
+#include "view_correction/mesh_renderer.h"
+#include "view_correction/offscreen_context.h"
+#include "view_correction/opengl_util.h"
+#include "view_correction/view_correction_display.cuh"
+
+DEFINE_int32(kernel_bench_repetitions, 20,
+             "Number of timed calls of each kernel per configuration (after "
+             "one untimed warmup call).");
+DEFINE_int32(kernel_bench_inpainting_iterations, 100,
+             "Number of iterations which the inpainting functions run per "
+             "call.");
+DEFINE_string(kernel_bench_hole_ratios, "0.1,0.3,0.5",
+              "Comma-separated list of the fractions of pixels to mark as "
+              "invalid in the synthetic input.");
+DEFINE_bool(kernel_bench_gl_warp, true,
+            "Also time rendering the mesh with OpenGL in an offscreen "
+            "context, for comparison with the CUDA warp. Skipped if no "
+            "offscreen context can be created.");
+DEFINE_string(kernel_bench_kernels, "",
+              "Comma-separated list of the kernel groups to benchmark "
+              "(convolution, TV, TV_coarse_to_fine, meshing, reprojection, "
+              "warp). Empty runs all.");
+
+using namespace view_correction;
+
+namespace {
+
+// Minimum number of bytes read and written per pixel by one call of each
+// benchmarked function, or by one iteration of the inpainting functions.
+// Inpainting: depth or color input (4), gradient magnitude (1), output (4).
+constexpr int kInpaintingBytesPerPixel = 4 + 1 + 4;
+// Meshing: depth (4), vertex position (12), vertex color (1), indices (16).
+constexpr int kMeshingBytesPerPixel = 4 + 12 + 1 + 16;
+// Color projection: depth (4), RGB color (3), output (4).
+constexpr int kProjectionBytesPerPixel = 4 + 3 + 4;
+// Target frame preparation: color projection and depth output (4).
+constexpr int kPreparationBytesPerPixel = kProjectionBytesPerPixel + 4;
+// Forward reprojection: source depth and color (8), destination depth and
+// color (8).
+constexpr int kForwardReprojectionBytesPerPixel = 8 + 8;
+// Mesh warping (per source pixel): vertex position (12), vertex color (1),
+// indices of the triangle strip (16).
+constexpr int kWarpBytesPerPixel = 12 + 1 + 16;
+
+// Size of the square tiles which are marked as holes.
+constexpr int kHoleTileSize = 8;
+
+struct Resolution {
+  int width;
+  int height;
+};
+
+// Source (depth camera) and target (display) resolutions. The inpainting
+// functions are used at both.
+const std::vector<Resolution> kSourceResolutions = {
+    {160, 120}, {320, 240}, {640, 480}};
+const std::vector<Resolution> kTargetResolutions = {
+    {480, 300}, {960, 600}, {1920, 1200}};
+
+// Synthetic input for one resolution and hole ratio.
+struct BenchmarkInput {
+  BenchmarkInput(int width, int height, float hole_ratio, cudaStream_t stream);
+  ~BenchmarkInput();
+  
+  int width;
+  int height;
+  
+  // Pinhole intrinsics with a horizontal field of view of 90 degrees.
+  float fx;
+  float fy;
+  float cx;
+  float cy;
+  
+  // Slanted plane with a depth step, with depth 0 in the holes.
+  CUDABufferPtr<float> depth;
+  cudaTextureObject_t depth_texture;
+  // Color image with alpha 0 in the holes.
+  CUDABufferPtr<uchar4> color;
+  // Interleaved RGB image without holes.
+  CUDABufferPtr<uint8_t> rgb;
+  // Intensity of the color image, from which the gradient magnitudes are
+  // computed.
+  CUDABufferPtr<uint8_t> intensity;
+  CUDABufferPtr<uint8_t> gradient_magnitude_div_sqrt2;
+  cudaTextureObject_t gradient_magnitude_div_sqrt2_texture;
+};
+
+BenchmarkInput::BenchmarkInput(int width, int height, float hole_ratio,
+                               cudaStream_t stream)
+    : width(width), height(height) {
+  fx = 0.5f * width;
+  fy = fx;
+  cx = 0.5f * width - 0.5f;
+  cy = 0.5f * height - 0.5f;
+  
+  // Mark random tiles as holes, using a fixed seed such that all kernels see
+  // the same input.
+  std::mt19937 generator(0);
+  std::bernoulli_distribution hole_distribution(hole_ratio);
+  const int tiles_x = cuda_util::GetBlockCount(width, kHoleTileSize);
+  const int tiles_y = cuda_util::GetBlockCount(height, kHoleTileSize);
+  std::vector<bool> hole_tiles(tiles_x * tiles_y);
+  for (size_t i = 0; i < hole_tiles.size(); ++ i) {
+    hole_tiles[i] = hole_distribution(generator);
+  }
+  
+  std::vector<float> depth_cpu(width * height);
+  std::vector<uchar4> color_cpu(width * height);
+  std::vector<uint8_t> rgb_cpu(3 * width * height);
+  std::vector<uint8_t> intensity_cpu(width * height);
+  for (int y = 0; y < height; ++ y) {
+    for (int x = 0; x < width; ++ x) {
+      const int i = x + y * width;
+      const bool hole = hole_tiles[x / kHoleTileSize + (y / kHoleTileSize) * tiles_x];
+      const bool foreground = (x > width / 3 && x < width / 2);
+      depth_cpu[i] = hole ? 0.f : ((foreground ? 1.f : 2.f) + x / static_cast<float>(width));
+      const uint8_t r = (255 * x) / width;
+      const uint8_t g = (255 * y) / height;
+      const uint8_t b = foreground ? 255 : 0;
+      color_cpu[i] = make_uchar4(r, g, b, hole ? 0 : 255);
+      rgb_cpu[3 * i + 0] = r;
+      rgb_cpu[3 * i + 1] = g;
+      rgb_cpu[3 * i + 2] = b;
+      intensity_cpu[i] = (r + g + b) / 3;
+    }
+  }
+  
+  depth.reset(new CUDABuffer<float>(height, width));
+  depth->DebugUpload(depth_cpu.data());
+  depth->CreateTextureObject(
+      cudaAddressModeClamp, cudaAddressModeClamp, cudaFilterModePoint,
+      cudaReadModeElementType, false, &depth_texture);
+  color.reset(new CUDABuffer<uchar4>(height, width));
+  color->DebugUpload(color_cpu.data());
+  rgb.reset(new CUDABuffer<uint8_t>(height, 3 * width));
+  rgb->DebugUpload(rgb_cpu.data());
+  
+  intensity.reset(new CUDABuffer<uint8_t>(height, width));
+  intensity->DebugUpload(intensity_cpu.data());
+  gradient_magnitude_div_sqrt2.reset(new CUDABuffer<uint8_t>(height, width));
+  ComputeGradientMagnitudeDiv2CUDA(stream, *intensity,
+                                   gradient_magnitude_div_sqrt2.get());
+  gradient_magnitude_div_sqrt2->CreateTextureObject(
+      cudaAddressModeClamp, cudaAddressModeClamp, cudaFilterModePoint,
+      cudaReadModeElementType, false, &gradient_magnitude_div_sqrt2_texture);
+  CUDA_CHECKED_CALL(cudaStreamSynchronize(stream));
+}
+
+BenchmarkInput::~BenchmarkInput() {
+  cudaDestroyTextureObject(depth_texture);
+  cudaDestroyTextureObject(gradient_magnitude_div_sqrt2_texture);
+}
+
+// Calls run() once for warmup and then FLAGS_kernel_bench_repetitions times,
+// and returns the average GPU time of the timed calls in milliseconds.
+// prepare() is called before each call of run() outside of the timed region
+// and may be null.
+float TimeCalls(cudaStream_t stream,
+                const std::function<void()>& prepare,
+                const std::function<void()>& run) {
+  cudaEvent_t start_event;
+  cudaEvent_t end_event;
+  CUDA_CHECKED_CALL(cudaEventCreate(&start_event));
+  CUDA_CHECKED_CALL(cudaEventCreate(&end_event));
+  
+  float total_ms = 0;
+  for (int repetition = -1; repetition < FLAGS_kernel_bench_repetitions; ++ repetition) {
+    if (prepare) {
+      prepare();
+    }
+    CUDA_CHECKED_CALL(cudaEventRecord(start_event, stream));
+    run();
+    CUDA_CHECKED_CALL(cudaEventRecord(end_event, stream));
+    CUDA_CHECKED_CALL(cudaEventSynchronize(end_event));
+    if (repetition >= 0) {
+      float elapsed_ms;
+      CUDA_CHECKED_CALL(cudaEventElapsedTime(&elapsed_ms, start_event, end_event));
+      total_ms += elapsed_ms;
+    }
+  }
+  
+  cudaEventDestroy(start_event);
+  cudaEventDestroy(end_event);
+  return total_ms / std::max(1, FLAGS_kernel_bench_repetitions);
+}
+
+void PrintHeader() {
+  std::cout << "kernel,width,height,hole_ratio,iterations,time_ms,"
+            << "time_per_iteration_ms,bandwidth_gb_per_s,block_size,"
+            << "registers_per_thread,static_shared_memory_bytes,"
+            << "dynamic_shared_memory_bytes,active_blocks_per_sm,occupancy,"
+            << "max_difference,mean_difference" << std::endl;
+}
+
+// bytes_per_pixel is the traffic of one iteration, such that the bandwidth of
+// the inpainting functions accounts for all iterations of the call.
+// max_difference and mean_difference are the errors of the result to a
+// reference result (see BenchmarkTVInpainting()), and are left empty if
+// negative.
+void PrintResult(const char* kernel, const BenchmarkInput& input,
+                 float hole_ratio, int iterations, float time_ms,
+                 int bytes_per_pixel, const KernelOccupancy& occupancy,
+                 float max_difference = -1.f, float mean_difference = -1.f) {
+  const double bytes = static_cast<double>(bytes_per_pixel) * input.width *
+                       input.height * std::max(1, iterations);
+  std::cout << kernel << "," << input.width << "," << input.height << ","
+            << hole_ratio << "," << iterations << "," << time_ms << ","
+            << (time_ms / std::max(1, iterations)) << ","
+            << (bytes / (1e6 * time_ms)) << "," << occupancy.block_size << ","
+            << occupancy.registers_per_thread << ","
+            << occupancy.static_shared_memory_size << ","
+            << occupancy.dynamic_shared_memory_size << ","
+            << occupancy.active_blocks_per_multiprocessor << ","
+            << occupancy.occupancy << ",";
+  if (max_difference >= 0) {
+    std::cout << max_difference << "," << mean_difference;
+  } else {
+    std::cout << ",";
+  }
+  std::cout << std::endl;
+}
+
+void BenchmarkConvolutionInpainting(cudaStream_t stream,
+                                    const BenchmarkInput& input,
+                                    float hole_ratio) {
+  const int width = input.width;
+  const int height = input.height;
+  CUDABuffer<uint8_t> max_change(1, width * height);
+  CUDABuffer<float> depth_output(height, width);
+  CUDABuffer<uchar4> color_output(height, width);
+  CUDABuffer<uint16_t> block_coordinates(1, width * height);
+  BlockCompactionBuffers compaction_buffers(
+      GetConvolutionInpaintingBlockCount(width, height));
+  
+  for (int use_weighting = 0; use_weighting <= 1; ++ use_weighting) {
+    int iterations = 0;
+    uint32_t pixel_to_inpaint_count;
+    float time_ms;
+    for (int persistent = 0; persistent <= 1; ++ persistent) {
+      for (const ConvolutionInpaintingConfig& config :
+           GetConvolutionInpaintingConfigs()) {
+        time_ms = TimeCalls(stream, nullptr, [&]() {
+          iterations = InpaintDepthMapWithConvolutionCUDA(
+              stream, use_weighting, FLAGS_kernel_bench_inpainting_iterations,
+              -1.f, 1.0f, input.gradient_magnitude_div_sqrt2_texture,
+              input.depth_texture, nullptr, nullptr, &max_change, &depth_output,
+              &block_coordinates, &pixel_to_inpaint_count, &compaction_buffers,
+              persistent, nullptr, nullptr, nullptr, config);
+        });
+        std::string name = std::string(persistent ? "Persistent" : "") +
+                           "ConvolutionInpaintingKernel" +
+                           (use_weighting ? "WithWeighting" : "") + "_" +
+                           std::to_string(config.block_size) + "x" +
+                           std::to_string(config.iterations_per_call);
+        PrintResult(name.c_str(), input, hole_ratio, iterations, time_ms,
+                    kInpaintingBytesPerPixel,
+                    GetConvolutionInpaintingKernelOccupancy(
+                        use_weighting, persistent, config));
+      }
+    }
+    
+    time_ms = TimeCalls(stream, nullptr, [&]() {
+      iterations = InpaintImageWithConvolutionCUDA(
+          stream, use_weighting, FLAGS_kernel_bench_inpainting_iterations,
+          -1.f, input.gradient_magnitude_div_sqrt2_texture, *input.color,
+          nullptr, &max_change, &color_output, &block_coordinates,
+          &pixel_to_inpaint_count, &compaction_buffers, nullptr, nullptr,
+          nullptr);
+    });
+    PrintResult(use_weighting ? "RGBConvolutionInpaintingKernelWithWeighting" :
+                                "RGBConvolutionInpaintingKernel",
+                input, hole_ratio, iterations, time_ms,
+                kInpaintingBytesPerPixel,
+                GetRGBConvolutionInpaintingKernelOccupancy(use_weighting));
+  }
+}
+
+// Returns the maximum and mean absolute difference over all pixels of the
+// first components (which must be float) of two images.
+template<typename T>
+void ComputeImageDifference(const CUDABuffer<T>& a, const CUDABuffer<T>& b,
+                            int components, float* max_difference,
+                            float* mean_difference) {
+  std::vector<T> a_cpu(a.width() * a.height());
+  std::vector<T> b_cpu(b.width() * b.height());
+  a.DebugDownload(a_cpu.data());
+  b.DebugDownload(b_cpu.data());
+  *max_difference = 0;
+  double sum = 0;
+  for (size_t i = 0; i < a_cpu.size(); ++ i) {
+    const float* a_values = reinterpret_cast<const float*>(&a_cpu[i]);
+    const float* b_values = reinterpret_cast<const float*>(&b_cpu[i]);
+    for (int c = 0; c < components; ++ c) {
+      const float difference = std::fabs(a_values[c] - b_values[c]);
+      *max_difference = std::max(*max_difference, difference);
+      sum += difference;
+    }
+  }
+  *mean_difference = sum / std::max<size_t>(1, components * a_cpu.size());
+}
+
+// Runs depth TV inpainting with u_bar stored as UBarT and returns its
+// average time.
+template<typename UBarT>
+float RunDepthTVInpainting(cudaStream_t stream, const BenchmarkInput& input,
+                           CUDABuffer<float>* depth_output, int* iterations) {
+  const int width = input.width;
+  const int height = input.height;
+  CUDABuffer<bool> tv_flag(height, width);
+  CUDABuffer<bool> tv_dual_flag(height, width);
+  CUDABuffer<int16_t> tv_dual_x(height, width);
+  CUDABuffer<int16_t> tv_dual_y(height, width);
+  CUDABuffer<UBarT> tv_u_bar(height, width);
+  CUDABuffer<float> tv_max_change(1, width * height);
+  CUDABuffer<uint16_t> block_coordinates(1, width * height);
+  CUDABuffer<unsigned char> block_activities(height, width);
+  BlockCompactionBuffers compaction_buffers(
+      GetTVInpaintingBlockCount(width, height));
+  
+  return TimeCalls(stream, nullptr, [&]() {
+    *iterations = InpaintDepthMapCUDA(
+        stream, kIMClassic, true, FLAGS_kernel_bench_inpainting_iterations,
+        -1.f, 1.0f, input.gradient_magnitude_div_sqrt2_texture,
+        input.depth_texture, &tv_flag, &tv_dual_flag, &tv_dual_x, &tv_dual_y,
+        &tv_u_bar, &tv_max_change, depth_output, &block_coordinates,
+        &block_activities, nullptr, nullptr, &compaction_buffers, nullptr,
+        nullptr, nullptr, nullptr);
+  });
+}
+
+// Runs color TV inpainting with the dual variables and u_bar stored as
+// StateT and returns its average time.
+template<typename StateT>
+float RunColorTVInpainting(cudaStream_t stream, const BenchmarkInput& input,
+                           CUDABuffer<float4>* color_output, int* iterations) {
+  const int width = input.width;
+  const int height = input.height;
+  CUDABuffer<bool> tv_flag(height, width);
+  CUDABuffer<bool> tv_dual_flag(height, width);
+  CUDABuffer<StateT> tv_dual_x(height, width);
+  CUDABuffer<StateT> tv_dual_y(height, width);
+  CUDABuffer<StateT> tv_u_bar(height, width);
+  CUDABuffer<float> tv_max_change(1, width * height);
+  CUDABuffer<uint16_t> block_coordinates(1, width * height);
+  BlockCompactionBuffers compaction_buffers(
+      GetTVInpaintingBlockCount(width, height));
+  
+  return TimeCalls(stream, nullptr, [&]() {
+    *iterations = InpaintImageCUDA(
+        stream, FLAGS_kernel_bench_inpainting_iterations, -1.f,
+        input.gradient_magnitude_div_sqrt2_texture, *input.color, nullptr,
+        &tv_flag, &tv_dual_flag, &tv_dual_x, &tv_dual_y, &tv_u_bar, &tv_max_change,
+        color_output, &block_coordinates, &compaction_buffers, nullptr,
+        nullptr, nullptr, nullptr);
+  });
+}
+
+// Benchmarks depth and color TV inpainting with fp32 and half-precision state
+// storage. The rows of the half-precision variants contain the difference of
+// their results to the fp32 results.
+void BenchmarkTVInpainting(cudaStream_t stream,
+                           const BenchmarkInput& input,
+                           float hole_ratio) {
+  const int width = input.width;
+  const int height = input.height;
+  int iterations;
+  int iterations_half;
+  float max_difference;
+  float mean_difference;
+  
+  CUDABuffer<float> depth_output(height, width);
+  CUDABuffer<float> depth_output_half(height, width);
+  float time_ms = RunDepthTVInpainting<float>(
+      stream, input, &depth_output, &iterations);
+  float time_ms_half = RunDepthTVInpainting<__half>(
+      stream, input, &depth_output_half, &iterations_half);
+  ComputeImageDifference(depth_output, depth_output_half, 1, &max_difference,
+                         &mean_difference);
+  PrintResult("TVInpaintingDualAndPrimalStepsKernel", input, hole_ratio,
+              iterations, time_ms, kInpaintingBytesPerPixel,
+              GetTVInpaintingKernelOccupancy(false));
+  PrintResult("TVInpaintingDualAndPrimalStepsKernelHalf", input, hole_ratio,
+              iterations_half, time_ms_half, kInpaintingBytesPerPixel,
+              GetTVInpaintingKernelOccupancy(true), max_difference,
+              mean_difference);
+  
+  CUDABuffer<float4> color_output(height, width);
+  CUDABuffer<float4> color_output_half(height, width);
+  time_ms = RunColorTVInpainting<float4>(
+      stream, input, &color_output, &iterations);
+  time_ms_half = RunColorTVInpainting<Half4>(
+      stream, input, &color_output_half, &iterations_half);
+  ComputeImageDifference(color_output, color_output_half, 3, &max_difference,
+                         &mean_difference);
+  PrintResult("ColorTVInpaintingKernels", input, hole_ratio, iterations,
+              time_ms, kInpaintingBytesPerPixel,
+              GetColorTVInpaintingKernelOccupancy(false));
+  PrintResult("ColorTVInpaintingKernelsHalf", input, hole_ratio,
+              iterations_half, time_ms_half, kInpaintingBytesPerPixel,
+              GetColorTVInpaintingKernelOccupancy(true), max_difference,
+              mean_difference);
+}
+
+// Benchmarks depth TV inpainting until convergence with the settings of the
+// source frame inpainting, in the classic and the coarse-to-fine modes. The
+// iterations of the coarse-to-fine modes are those of the full-resolution
+// level, while the time includes all levels.
+void BenchmarkCoarseToFineTVInpainting(cudaStream_t stream,
+                                       const BenchmarkInput& input,
+                                       float hole_ratio) {
+  constexpr int kMaxIterations = 1500;
+  constexpr float kMaxChangeRateThreshold = 1e-3f;
+  const int width = input.width;
+  const int height = input.height;
+  CUDABuffer<bool> tv_flag(height, width);
+  CUDABuffer<bool> tv_dual_flag(height, width);
+  CUDABuffer<int16_t> tv_dual_x(height, width);
+  CUDABuffer<int16_t> tv_dual_y(height, width);
+  CUDABuffer<float> tv_u_bar(height, width);
+  CUDABuffer<float> tv_max_change(1, width * height);
+  CUDABuffer<float> depth_output(height, width);
+  CUDABuffer<uint16_t> block_coordinates(1, width * height);
+  CUDABuffer<unsigned char> block_activities(height, width);
+  BlockCompactionBuffers compaction_buffers(
+      GetTVInpaintingBlockCount(width, height));
+  
+  // Compute the gradient magnitudes of the pyramid levels like the display
+  // does, by continuing the intensity pyramid.
+  TVInpaintingPyramid pyramid(width, height, FLAGS_vc_tv_pyramid_levels);
+  std::vector<CUDABufferPtr<uint8_t>> coarse_intensity;
+  const CUDABuffer<uint8_t>* finer_intensity = input.intensity.get();
+  for (TVInpaintingPyramid::Level& level : pyramid.levels) {
+    coarse_intensity.emplace_back(new CUDABuffer<uint8_t>(
+        level.depth_input->height(), level.depth_input->width()));
+    DownsampleImageToHalfSizeCUDA(stream, *finer_intensity,
+                                  coarse_intensity.back().get());
+    finer_intensity = coarse_intensity.back().get();
+    ComputeGradientMagnitudeDiv2CUDA(stream, *finer_intensity,
+                                     level.gradient_magnitude_div_sqrt2.get());
+  }
+  
+  const std::pair<InpaintingMode, const char*> kModes[] = {
+      {kIMClassic, "TVInpaintingConvergedClassic"},
+      {kIMCoarseToFine, "TVInpaintingConvergedCoarseToFine"},
+      {kIMCoarseToFineAdaptive, "TVInpaintingConvergedCoarseToFineAdaptive"}};
+  for (const std::pair<InpaintingMode, const char*>& mode : kModes) {
+    int iterations = 0;
+    float time_ms = TimeCalls(stream, nullptr, [&]() {
+      iterations = InpaintDepthMapCUDA(
+          stream, mode.first, true, kMaxIterations, kMaxChangeRateThreshold,
+          1.0f, input.gradient_magnitude_div_sqrt2_texture,
+          input.depth_texture, &tv_flag, &tv_dual_flag, &tv_dual_x,
+          &tv_dual_y, &tv_u_bar, &tv_max_change, &depth_output,
+          &block_coordinates, &block_activities, &pyramid, nullptr,
+          &compaction_buffers, nullptr, nullptr, nullptr, nullptr);
+    });
+    PrintResult(mode.second, input, hole_ratio, iterations, time_ms,
+                kInpaintingBytesPerPixel,
+                GetTVInpaintingKernelOccupancy(false));
+  }
+}
+
+void BenchmarkMeshing(cudaStream_t stream,
+                      const BenchmarkInput& input,
+                      float hole_ratio) {
+  const int width = input.width;
+  const int height = input.height;
+  float* vertex_buffer;
+  uint8_t* color_buffer;
+  uint32_t* index_buffer;
+  CUDA_CHECKED_CALL(cudaMalloc(&vertex_buffer, 3 * width * height * sizeof(float)));
+  CUDA_CHECKED_CALL(cudaMalloc(&color_buffer, width * height * sizeof(uint8_t)));
+  const int strip_index_count =
+      2 + 4 * (height - 2) + 4 * (width - 1) * (height - 1);
+  const int max_triangle_index_count = 6 * (width - 1) * (height - 1);
+  CUDA_CHECKED_CALL(cudaMalloc(&index_buffer,
+      std::max(strip_index_count, max_triangle_index_count) * sizeof(uint32_t)));
+  MeshIndexCompactionBuffers compaction_buffers(width, height);
+  
+  for (int compact_indices = 0; compact_indices <= 1; ++ compact_indices) {
+    float time_ms = TimeCalls(stream, nullptr, [&]() {
+      MeshDepthmapCUDA(
+          input.depth->ToCUDA(), 1.f / input.fx, 1.f / input.fy,
+          -input.cx / input.fx, -input.cy / input.fy, stream,
+          vertex_buffer, color_buffer, index_buffer, nullptr,
+          compact_indices ? &compaction_buffers : nullptr,
+          OcclusionSafetyFilter());
+    });
+    PrintResult(compact_indices ? "MeshDepthmapCUDAKernelCompactIndices" :
+                                  "MeshDepthmapCUDAKernel",
+                input, hole_ratio, 1, time_ms, kMeshingBytesPerPixel,
+                GetMeshDepthmapKernelOccupancy(compact_indices, false));
+  }
+  
+  // The occlusion safety filter with the settings of the pipeline
+  // (--vc_occlusion_safety_radius and --vc_occlusion_safety_threshold). If
+  // the filter is disabled there, the largest radius is used, which reads the
+  // most pixels per tile.
+  OcclusionSafetyFilter occlusion_filter;
+  occlusion_filter.radius = (FLAGS_vc_occlusion_safety_radius > 0) ?
+      std::min(kMaxOcclusionSafetyRadius, FLAGS_vc_occlusion_safety_radius) :
+      kMaxOcclusionSafetyRadius;
+  occlusion_filter.threshold = FLAGS_vc_occlusion_safety_threshold;
+  float filter_time_ms = TimeCalls(stream, nullptr, [&]() {
+    MeshDepthmapCUDA(
+        input.depth->ToCUDA(), 1.f / input.fx, 1.f / input.fy,
+        -input.cx / input.fx, -input.cy / input.fy, stream,
+        vertex_buffer, color_buffer, index_buffer, nullptr,
+        &compaction_buffers, occlusion_filter);
+  });
+  PrintResult("MeshDepthmapCUDAKernelOcclusionFilter",
+              input, hole_ratio, 1, filter_time_ms, kMeshingBytesPerPixel,
+              GetMeshDepthmapKernelOccupancy(true, true));
+  LOG(INFO) << "Compacted mesh index count: "
+            << compaction_buffers.WaitForIndexCount() << " of "
+            << max_triangle_index_count;
+  
+  // Decimate with the threshold of the pipeline (--vc_mesh_decimation_threshold).
+  float time_ms = TimeCalls(stream, nullptr, [&]() {
+    MeshDepthmapDecimatedCUDA(
+        input.depth->ToCUDA(), 1.f / input.fx, 1.f / input.fy,
+        -input.cx / input.fx, -input.cy / input.fy,
+        FLAGS_vc_mesh_decimation_threshold,
+        stream, vertex_buffer, color_buffer, index_buffer,
+        &compaction_buffers, OcclusionSafetyFilter());
+  });
+  PrintResult("DecimateMeshCUDAKernel", input, hole_ratio, 1, time_ms,
+              kMeshingBytesPerPixel, GetDecimateMeshKernelOccupancy());
+  LOG(INFO) << "Decimated mesh index count: "
+            << compaction_buffers.WaitForIndexCount() << " of "
+            << max_triangle_index_count;
+  
+  cudaFree(vertex_buffer);
+  cudaFree(color_buffer);
+  cudaFree(index_buffer);
+}
+
+void BenchmarkReprojection(cudaStream_t stream,
+                           const BenchmarkInput& input,
+                           float hole_ratio) {
+  const int width = input.width;
+  const int height = input.height;
+  const float fx_inv = 1.f / input.fx;
+  const float fy_inv = 1.f / input.fy;
+  const float cx_inv = -input.cx / input.fx;
+  const float cy_inv = -input.cy / input.fy;
+  
+  // Project the color image onto the depth map from a slightly shifted
+  // viewpoint.
+  Eigen::Matrix<float, 3, 4> depth_frame_to_color_frame;
+  depth_frame_to_color_frame << 1, 0, 0, 0.05f,
+                                0, 1, 0, 0,
+                                0, 0, 1, 0;
+  const CUDAMatrix3x4 transformation(depth_frame_to_color_frame);
+  
+  CUDABuffer<uchar4> projected_color(height, width);
+  float time_ms = TimeCalls(stream, nullptr, [&]() {
+    ProjectImageOntoDepthMapCUDA(
+        stream, input.depth_texture, *input.rgb,
+        input.fx, input.fy, input.cx, input.cy, DistortionLUT_(),
+        fx_inv, fy_inv, cx_inv, cy_inv, transformation, &projected_color);
+  });
+  PrintResult("ProjectImageOntoDepthMapCUDAKernel", input, hole_ratio, 1,
+              time_ms, kProjectionBytesPerPixel,
+              GetProjectImageOntoDepthMapKernelOccupancy(true));
+  
+  // The same with the fused target frame preparation, which additionally
+  // writes the depth map (and replaces a separate copy of it).
+  CUDABuffer<float> prepared_depth(height, width);
+  time_ms = TimeCalls(stream, nullptr, [&]() {
+    PrepareTargetFrameCUDA(
+        stream, input.depth_texture, 0, 0, *input.rgb,
+        input.fx, input.fy, input.cx, input.cy, DistortionLUT_(),
+        fx_inv, fy_inv, cx_inv, cy_inv, transformation,
+        &prepared_depth, &projected_color, nullptr);
+  });
+  PrintResult("PrepareTargetFrameCUDAKernel", input, hole_ratio, 1,
+              time_ms, kPreparationBytesPerPixel,
+              GetPrepareTargetFrameKernelOccupancy(true));
+  
+  // The same, additionally building the hole map for the inpainting.
+  HoleMap hole_map(width, height);
+  time_ms = TimeCalls(stream, nullptr, [&]() {
+    PrepareTargetFrameCUDA(
+        stream, input.depth_texture, 0, 0, *input.rgb,
+        input.fx, input.fy, input.cx, input.cy, DistortionLUT_(),
+        fx_inv, fy_inv, cx_inv, cy_inv, transformation,
+        &prepared_depth, &projected_color, &hole_map);
+  });
+  PrintResult("PrepareTargetFrameCUDAKernelWithHoleMap", input, hole_ratio, 1,
+              time_ms, kPreparationBytesPerPixel,
+              GetPrepareTargetFrameKernelOccupancy(true));
+  
+  // Forward-reproject a hole-free image into the holes of the input. The
+  // destination is reset before each call, since the reprojection fills it.
+  CUDABuffer<float> src_depth(height, width);
+  src_depth.Clear(1.5f, stream);
+  CUDABuffer<float> dest_depth(height, width);
+  CUDABuffer<uchar4> dest_color(height, width);
+  time_ms = TimeCalls(stream, [&]() {
+    dest_depth.SetTo(*input.depth, stream);
+    dest_color.SetTo(*input.color, stream);
+  }, [&]() {
+    ForwardReprojectToInvalidPixelsCUDA(
+        stream, transformation, fx_inv, fy_inv, cx_inv, cy_inv,
+        src_depth, *input.color, input.fx, input.fy, input.cx, input.cy,
+        &dest_depth, &dest_color);
+  });
+  PrintResult("ForwardReprojectToInvalidPixelsCUDAKernel", input, hole_ratio,
+              1, time_ms, kForwardReprojectionBytesPerPixel,
+              GetForwardReprojectToInvalidPixelsKernelOccupancy(false));
+}
+
+// Copies the mesh in the given device buffers into OpenGL buffer objects and
+// renders it with MeshRenderer into the same target view as
+// BenchmarkWarp(). The time includes copying the results into CUDA buffers,
+// which waits for the rendering, as in stage R1 of the pipeline.
+void BenchmarkOpenGLWarp(cudaStream_t stream,
+                         const BenchmarkInput& input,
+                         float hole_ratio,
+                         const float* vertex_buffer,
+                         const uint8_t* color_buffer,
+                         const uint32_t* index_buffer,
+                         int index_count,
+                         const Resolution& target,
+                         const Sophus::SE3f& target_T_src) {
+  const int vertex_count = input.width * input.height;
+  GLuint gl_buffers[3];
+  const GLenum targets[3] = {GL_ARRAY_BUFFER, GL_ARRAY_BUFFER, GL_ELEMENT_ARRAY_BUFFER};
+  const size_t sizes[3] = {3 * vertex_count * sizeof(float),
+                           vertex_count * sizeof(uint8_t),
+                           index_count * sizeof(uint32_t)};
+  const void* sources[3] = {vertex_buffer, color_buffer, index_buffer};
+  glGenBuffers(3, gl_buffers);
+  for (int i = 0; i < 3; ++ i) {
+    glBindBuffer(targets[i], gl_buffers[i]);
+    glBufferData(targets[i], sizes[i], nullptr, GL_STATIC_DRAW);
+    glBindBuffer(targets[i], 0);
+    CHECK_OPENGL_NO_ERROR();
+    
+    cudaGraphicsResource_t resource;
+    CUDA_CHECKED_CALL(cudaGraphicsGLRegisterBuffer(
+        &resource, gl_buffers[i], cudaGraphicsRegisterFlagsWriteDiscard));
+    CUDA_CHECKED_CALL(cudaGraphicsMapResources(1, &resource, stream));
+    void* mapped;
+    size_t mapped_size;
+    CUDA_CHECKED_CALL(cudaGraphicsResourceGetMappedPointer(
+        &mapped, &mapped_size, resource));
+    CUDA_CHECKED_CALL(cudaMemcpyAsync(mapped, sources[i], sizes[i],
+                                      cudaMemcpyDeviceToDevice, stream));
+    CUDA_CHECKED_CALL(cudaGraphicsUnmapResources(1, &resource, stream));
+    CUDA_CHECKED_CALL(cudaGraphicsUnregisterResource(resource));
+  }
+  CUDA_CHECKED_CALL(cudaStreamSynchronize(stream));
+  
+  const float target_fx = 0.5f * target.width;
+  MeshRenderer renderer(target.width, target.height,
+                        MeshRenderer::kRenderDepthAndIntensity);
+  CUDABuffer<float> depth(target.height, target.width);
+  CUDABuffer<uint8_t> intensity(target.height, target.width);
+  CUDABuffer<float>* depth_pointer = &depth;
+  CUDABuffer<uint8_t>* intensity_pointer = &intensity;
+  float time_ms = TimeCalls(stream, nullptr, [&]() {
+    renderer.RenderMesh(
+        gl_buffers[0], gl_buffers[1], gl_buffers[2], index_count,
+        GL_TRIANGLE_STRIP, target_T_src, target_fx, target_fx,
+        0.5f * target.width - 0.5f, 0.5f * target.height - 0.5f,
+        0.1f, 50.f);
+    renderer.CopyDepthAndIntensityResults(stream, 1, &depth_pointer,
+                                          &intensity_pointer);
+  });
+  KernelOccupancy no_occupancy = {};
+  PrintResult("MeshRendererOpenGL", input, hole_ratio, 1, time_ms,
+              kWarpBytesPerPixel, no_occupancy);
+  
+  glDeleteBuffers(3, gl_buffers);
+  CHECK_OPENGL_NO_ERROR();
+}
+
+// Renders the mesh of the input depth map into a target view at the
+// smallest target resolution with WarpMeshDepthCUDA(), the CUDA alternative
+// to rendering it with OpenGL (which is measured as stage R1 of the pipeline
+// timings, see --vc_cuda_depth_warp). If have_gl_context is true, the OpenGL
+// rendering is timed as well for comparison (see BenchmarkOpenGLWarp()).
+void BenchmarkWarp(cudaStream_t stream,
+                   const BenchmarkInput& input,
+                   float hole_ratio,
+                   bool have_gl_context) {
+  const int width = input.width;
+  const int height = input.height;
+  float* vertex_buffer;
+  uint8_t* color_buffer;
+  uint32_t* index_buffer;
+  CUDA_CHECKED_CALL(cudaMalloc(&vertex_buffer, 3 * width * height * sizeof(float)));
+  CUDA_CHECKED_CALL(cudaMalloc(&color_buffer, width * height * sizeof(uint8_t)));
+  const int strip_index_count =
+      2 + 4 * (height - 2) + 4 * (width - 1) * (height - 1);
+  CUDA_CHECKED_CALL(cudaMalloc(&index_buffer, strip_index_count * sizeof(uint32_t)));
+  MeshDepthmapCUDA(
+      input.depth->ToCUDA(), 1.f / input.fx, 1.f / input.fy,
+      -input.cx / input.fx, -input.cy / input.fy, stream,
+      vertex_buffer, color_buffer, index_buffer, nullptr, nullptr,
+      OcclusionSafetyFilter());
+  
+  // View the mesh from a slightly shifted viewpoint.
+  const Resolution& target = kTargetResolutions.front();
+  const float target_fx = 0.5f * target.width;
+  Eigen::Matrix<float, 3, 4> target_T_src;
+  target_T_src << 1, 0, 0, 0.05f,
+                  0, 1, 0, 0,
+                  0, 0, 1, 0.1f;
+  CUDABuffer<uint2> z_buffer(target.height, target.width);
+  CUDABuffer<float> depth(target.height, target.width);
+  CUDABuffer<uint8_t> intensity(target.height, target.width);
+  float time_ms = TimeCalls(stream, nullptr, [&]() {
+    WarpMeshDepthCUDA(
+        stream, vertex_buffer, color_buffer, index_buffer, strip_index_count,
+        true, CUDAMatrix3x4(target_T_src), target_fx, target_fx,
+        0.5f * target.width - 0.5f, 0.5f * target.height - 0.5f,
+        0.1f, 50.f, &z_buffer, &depth, &intensity);
+  });
+  PrintResult("WarpMeshDepthCUDAKernel", input, hole_ratio, 1, time_ms,
+              kWarpBytesPerPixel, GetWarpMeshDepthKernelOccupancy());
+  
+  if (have_gl_context) {
+    BenchmarkOpenGLWarp(
+        stream, input, hole_ratio, vertex_buffer, color_buffer, index_buffer,
+        strip_index_count, target,
+        Sophus::SE3f(Eigen::Matrix3f::Identity(), Eigen::Vector3f(0.05f, 0, 0.1f)));
+  }
+  
+  cudaFree(vertex_buffer);
+  cudaFree(color_buffer);
+  cudaFree(index_buffer);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  
+  std::vector<float> hole_ratios;
+  std::istringstream hole_ratio_stream(FLAGS_kernel_bench_hole_ratios);
+  std::string hole_ratio;
+  while (std::getline(hole_ratio_stream, hole_ratio, ',')) {
+    hole_ratios.push_back(std::stof(hole_ratio));
+  }
+  
+  std::vector<std::string> kernels;
+  std::istringstream kernel_stream(FLAGS_kernel_bench_kernels);
+  std::string kernel;
+  while (std::getline(kernel_stream, kernel, ',')) {
+    kernels.push_back(kernel);
+  }
+  auto enabled = [&](const char* name) {
+    return kernels.empty() ||
+           std::find(kernels.begin(), kernels.end(), name) != kernels.end();
+  };
+  
+  cudaDeviceProp properties;
+  CUDA_CHECKED_CALL(cudaGetDeviceProperties(&properties, 0));
+  LOG(INFO) << "Device: " << properties.name << " (compute capability "
+            << properties.major << "." << properties.minor << ", "
+            << properties.multiProcessorCount << " multiprocessors)";
+  
+  cudaStream_t stream;
+  CUDA_CHECKED_CALL(cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking));
+  
+  // The OpenGL comparison of the warp runs in an offscreen context on the
+  // same device.
+  OffscreenContext offscreen_context;
+  bool have_gl_context = false;
+  if (enabled("warp") && FLAGS_kernel_bench_gl_warp) {
+    have_gl_context = offscreen_context.Create(0);
+    if (!have_gl_context) {
+      LOG(WARNING) << "Cannot create offscreen OpenGL context, skipping the"
+                   << " OpenGL warp comparison.";
+    }
+  }
+  
+  PrintHeader();
+  for (bool target : {false, true}) {
+    for (const Resolution& resolution :
+         target ? kTargetResolutions : kSourceResolutions) {
+      for (float hole_ratio : hole_ratios) {
+        BenchmarkInput input(resolution.width, resolution.height, hole_ratio,
+                             stream);
+        if (enabled("convolution")) {
+          BenchmarkConvolutionInpainting(stream, input, hole_ratio);
+        }
+        if (enabled("TV")) {
+          BenchmarkTVInpainting(stream, input, hole_ratio);
+        }
+        if (!target && enabled("TV_coarse_to_fine")) {
+          BenchmarkCoarseToFineTVInpainting(stream, input, hole_ratio);
+        }
+        if (!target && enabled("meshing")) {
+          BenchmarkMeshing(stream, input, hole_ratio);
+        }
+        if (!target && enabled("warp")) {
+          BenchmarkWarp(stream, input, hole_ratio, have_gl_context);
+        }
+        if (target && enabled("reprojection")) {
+          BenchmarkReprojection(stream, input, hole_ratio);
+        }
+      }
+    }
+  }
+  
+  cudaStreamDestroy(stream);
+  return 0;
+}
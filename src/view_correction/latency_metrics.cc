@@ -0,0 +1,155 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "view_correction/latency_metrics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iterator>
+
+#include <glog/logging.h>
+
+namespace view_correction {
+
+LatencyMetrics::LatencyMetrics(int window_size)
+    : window_size_(window_size) {
+  CHECK_GT(window_size, 0);
+}
+
+void LatencyMetrics::AddSample(const std::string& name, double value) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Series& series = series_[name];
+  if (static_cast<int>(series.samples.size()) < window_size_) {
+    series.samples.push_back(value);
+  } else {
+    series.samples[series.next_index] = value;
+  }
+  series.next_index = (series.next_index + 1) % window_size_;
+  ++ series.total_count;
+}
+
+void LatencyMetrics::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  series_.clear();
+}
+
+bool LatencyMetrics::GetSummary(const std::string& name, MetricSummary* summary) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = series_.find(name);
+  if (it == series_.end()) {
+    return false;
+  }
+  ComputeSummary(it->second, summary);
+  return true;
+}
+
+std::vector<std::string> LatencyMetrics::GetMetricNames() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<std::string> names;
+  names.reserve(series_.size());
+  for (const auto& item : series_) {
+    names.push_back(item.first);
+  }
+  return names;
+}
+
+void LatencyMetrics::WriteCSV(std::ostream* stream) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  *stream << "name,count,total_count,mean,min,max,p50,p95,p99" << std::endl;
+  for (const auto& item : series_) {
+    MetricSummary summary;
+    ComputeSummary(item.second, &summary);
+    *stream << item.first << "," << summary.count << "," << summary.total_count
+            << "," << summary.mean << "," << summary.min << "," << summary.max
+            << "," << summary.p50 << "," << summary.p95 << "," << summary.p99
+            << std::endl;
+  }
+}
+
+void LatencyMetrics::WriteJSON(std::ostream* stream) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  *stream << "{" << std::endl;
+  for (auto it = series_.begin(); it != series_.end(); ++ it) {
+    MetricSummary summary;
+    ComputeSummary(it->second, &summary);
+    *stream << "  \"" << it->first << "\": {"
+            << "\"count\": " << summary.count << ", "
+            << "\"total_count\": " << summary.total_count << ", "
+            << "\"mean\": " << summary.mean << ", "
+            << "\"min\": " << summary.min << ", "
+            << "\"max\": " << summary.max << ", "
+            << "\"p50\": " << summary.p50 << ", "
+            << "\"p95\": " << summary.p95 << ", "
+            << "\"p99\": " << summary.p99 << "}"
+            << (std::next(it) == series_.end() ? "" : ",") << std::endl;
+  }
+  *stream << "}" << std::endl;
+}
+
+bool LatencyMetrics::WriteToFile(const std::string& path) const {
+  std::ofstream file_stream(path, std::ios::out | std::ios::trunc);
+  if (!file_stream) {
+    return false;
+  }
+  const std::string json_extension = ".json";
+  if (path.size() >= json_extension.size() &&
+      path.compare(path.size() - json_extension.size(), json_extension.size(),
+                   json_extension) == 0) {
+    WriteJSON(&file_stream);
+  } else {
+    WriteCSV(&file_stream);
+  }
+  return static_cast<bool>(file_stream);
+}
+
+void LatencyMetrics::ComputeSummary(const Series& series, MetricSummary* summary) {
+  std::vector<double> sorted_samples = series.samples;
+  std::sort(sorted_samples.begin(), sorted_samples.end());
+  
+  summary->count = sorted_samples.size();
+  summary->total_count = series.total_count;
+  double sum = 0;
+  for (double sample : sorted_samples) {
+    sum += sample;
+  }
+  summary->mean = sum / sorted_samples.size();
+  summary->min = sorted_samples.front();
+  summary->max = sorted_samples.back();
+  
+  // Nearest-rank percentiles.
+  auto percentile = [&](double p) {
+    int rank = static_cast<int>(std::ceil(p * sorted_samples.size()));
+    return sorted_samples[std::max(0, std::min<int>(sorted_samples.size() - 1, rank - 1))];
+  };
+  summary->p50 = percentile(0.5);
+  summary->p95 = percentile(0.95);
+  summary->p99 = percentile(0.99);
+}
+
+}  // namespace view_correction
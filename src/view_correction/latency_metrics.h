@@ -0,0 +1,107 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef VIEW_CORRECTION_LATENCY_METRICS_H_
+#define VIEW_CORRECTION_LATENCY_METRICS_H_
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace view_correction {
+
+// Statistics over the samples in the rolling window of a metric.
+struct MetricSummary {
+  // Number of samples in the window.
+  int count;
+  // Number of samples added in total.
+  int64_t total_count;
+  double mean;
+  double min;
+  double max;
+  double p50;
+  double p95;
+  double p99;
+};
+
+// In-memory registry of named metrics, such as the duration of a pipeline
+// stage in milliseconds or the number of pixels to inpaint. For each metric,
+// the latest window_size samples are kept to compute percentiles over.
+//
+// Thread-safe, such that it may be queried from other threads than the one
+// adding samples.
+class LatencyMetrics {
+ public:
+  explicit LatencyMetrics(int window_size);
+  
+  // Adds a sample to the metric with the given name, creating it if it does
+  // not exist yet.
+  void AddSample(const std::string& name, double value);
+  
+  // Removes all metrics.
+  void Clear();
+  
+  // Returns false if no sample was added to this metric yet.
+  bool GetSummary(const std::string& name, MetricSummary* summary) const;
+  
+  // Returns the names of all metrics in alphabetical order.
+  std::vector<std::string> GetMetricNames() const;
+  
+  // Writes the summaries of all metrics, one per line, with a header line.
+  void WriteCSV(std::ostream* stream) const;
+  
+  // Writes the summaries of all metrics as a JSON object mapping the metric
+  // names to their summaries.
+  void WriteJSON(std::ostream* stream) const;
+  
+  // Overwrites the file at path with the summaries of all metrics. The JSON
+  // format is used if the path ends with ".json", and CSV otherwise. Returns
+  // false if the file cannot be written.
+  bool WriteToFile(const std::string& path) const;
+  
+ private:
+  struct Series {
+    // Ring buffer containing up to window_size_ samples.
+    std::vector<double> samples;
+    int next_index = 0;
+    int64_t total_count = 0;
+  };
+  
+  static void ComputeSummary(const Series& series, MetricSummary* summary);
+  
+  int window_size_;
+  std::map<std::string, Series> series_;
+  mutable std::mutex mutex_;
+};
+
+}  // namespace view_correction
+
+#endif  // VIEW_CORRECTION_LATENCY_METRICS_H_
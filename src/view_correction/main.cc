@@ -26,12 +26,19 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+#include <algorithm>
 #include <chrono>
+#include <limits>
+#include <memory>
 
 #include <gflags/gflags.h>
 
+#include "view_correction/cuda_util.h"
 #include "view_correction/flags.h"
+#include "view_correction/frame_pacer.h"
+#include "view_correction/offscreen_context.h"
 #include "view_correction/opengl_util.h"
+#include "view_correction/session_file.h"
 #include "view_correction/view_correction_display.h"
 
 #include <GLFW/glfw3.h>
@@ -39,6 +46,125 @@
 using namespace view_correction;
 using namespace std::chrono;
 
+namespace {
+
+// Feeds the camera poses, observer poses and images of a session file (see
+// session_file.h) to the display at their recorded rate, restarting at the
+// beginning when the end is reached. The images are passed without copying
+// them out of the mapping. The observer poses are only passed if
+// replay_observer_poses is true, which requires the display to use
+// TargetViewMode::kObserverPoseCallback.
+class SessionReplay {
+ public:
+  SessionReplay(const SessionReader* reader, bool replay_observer_poses)
+      : reader_(reader),
+        replay_observer_poses_(replay_observer_poses),
+        next_pose_(0),
+        next_observer_pose_(0),
+        next_color_(0),
+        next_depth_(0),
+        loop_start_ns_(0) {
+    first_timestamp_ns_ = std::numeric_limits<uint64_t>::max();
+    last_timestamp_ns_ = 0;
+    for (int i = 0; i < reader->camera_pose_count(); ++ i) {
+      Sophus::SE3f G_T_C;
+      uint64_t timestamp_ns;
+      reader->GetCameraPose(i, &G_T_C, &timestamp_ns);
+      first_timestamp_ns_ = std::min(first_timestamp_ns_, timestamp_ns);
+      last_timestamp_ns_ = std::max(last_timestamp_ns_, timestamp_ns);
+    }
+    if (reader->depth_image_count() > 0) {
+      DepthImage image;
+      reader->GetDepthImage(reader->depth_image_count() - 1, &image);
+      last_timestamp_ns_ = std::max(last_timestamp_ns_, image.timestamp_ns());
+      reader->GetDepthImage(0, &image);
+      first_timestamp_ns_ = std::min(first_timestamp_ns_, image.timestamp_ns());
+    }
+    if (first_timestamp_ns_ > last_timestamp_ns_) {
+      first_timestamp_ns_ = last_timestamp_ns_;
+    }
+  }
+  
+  // Passes all inputs recorded up to the given time since the start of the
+  // replay to the display. The timestamps are shifted into the replay's time.
+  void Update(uint64_t nanoseconds, ViewCorrectionDisplay* display) {
+    // Restart once the whole session has been passed on.
+    uint64_t session_duration_ns = last_timestamp_ns_ - first_timestamp_ns_ + 1;
+    if (nanoseconds - loop_start_ns_ >= session_duration_ns) {
+      loop_start_ns_ = nanoseconds;
+      next_pose_ = 0;
+      next_observer_pose_ = 0;
+      next_color_ = 0;
+      next_depth_ = 0;
+    }
+    uint64_t end_ns = first_timestamp_ns_ + (nanoseconds - loop_start_ns_);
+    
+    Sophus::SE3f G_T_C;
+    uint64_t timestamp_ns;
+    while (next_pose_ < reader_->camera_pose_count()) {
+      reader_->GetCameraPose(next_pose_, &G_T_C, &timestamp_ns);
+      if (timestamp_ns > end_ns) {
+        break;
+      }
+      display->ColorCameraPoseCallback(G_T_C, ToReplayTime(timestamp_ns));
+      ++ next_pose_;
+    }
+    
+    while (replay_observer_poses_ &&
+           next_observer_pose_ < reader_->observer_pose_count()) {
+      Sophus::SE3f G_T_observer;
+      reader_->GetObserverPose(next_observer_pose_, &G_T_observer, &timestamp_ns);
+      if (timestamp_ns > end_ns) {
+        break;
+      }
+      // Poses recorded before the first camera pose are passed right away.
+      display->ObserverPoseCallback(
+          G_T_observer,
+          ToReplayTime(std::max(timestamp_ns, first_timestamp_ns_)));
+      ++ next_observer_pose_;
+    }
+    
+    ColorImage color_image;
+    while (next_color_ < reader_->color_image_count()) {
+      reader_->GetColorImage(next_color_, &color_image);
+      if (color_image.timestamp_ns() > end_ns) {
+        break;
+      }
+      color_image.set_timestamp_ns(ToReplayTime(color_image.timestamp_ns()));
+      display->YUVImageCallback(color_image);
+      ++ next_color_;
+    }
+    
+    DepthImage depth_image;
+    while (next_depth_ < reader_->depth_image_count()) {
+      reader_->GetDepthImage(next_depth_, &depth_image);
+      if (depth_image.timestamp_ns() > end_ns) {
+        break;
+      }
+      depth_image.set_timestamp_ns(ToReplayTime(depth_image.timestamp_ns()));
+      display->DepthImageCallback(depth_image);
+      ++ next_depth_;
+    }
+  }
+  
+ private:
+  inline uint64_t ToReplayTime(uint64_t recorded_timestamp_ns) const {
+    return loop_start_ns_ + (recorded_timestamp_ns - first_timestamp_ns_);
+  }
+  
+  const SessionReader* reader_;
+  bool replay_observer_poses_;
+  int next_pose_;
+  int next_observer_pose_;
+  int next_color_;
+  int next_depth_;
+  uint64_t first_timestamp_ns_;
+  uint64_t last_timestamp_ns_;
+  uint64_t loop_start_ns_;
+};
+
+}  // namespace
+
 int main(int argc, char** argv) {
   google::ParseCommandLineFlags(&argc, &argv, true);
   
@@ -59,6 +185,25 @@ int main(int argc, char** argv) {
   constexpr int kSyntheticImageWidth = 400;
   constexpr int kSyntheticImageHeight = 300;
   
+  // With --vc_replay_session, the input is replayed from a recorded session
+  // file instead of being synthesized below.
+  SessionReader session_reader;
+  std::unique_ptr<SessionReplay> session_replay;
+  if (!FLAGS_vc_replay_session.empty()) {
+    if (!session_reader.Open(FLAGS_vc_replay_session)) {
+      LOG(ERROR) << "Cannot open the session file " << FLAGS_vc_replay_session << ". Aborting.";
+      return 1;
+    }
+    session_reader.Prefetch();
+    // Replay the recorded observer poses if there are any, instead of using
+    // the fixed offset.
+    const bool replay_observer_poses = session_reader.observer_pose_count() > 0;
+    if (replay_observer_poses) {
+      view_mode = ViewCorrectionDisplay::TargetViewMode::kObserverPoseCallback;
+    }
+    session_replay.reset(new SessionReplay(&session_reader, replay_observer_poses));
+  }
+  
   // Load depth intrinsics.
   Intrinsics depth_intrinsics;
   LOG(ERROR) << "Stub: load depth camera intrinsics here.";
@@ -83,6 +228,11 @@ int main(int argc, char** argv) {
   color_intrinsics.width = kSyntheticImageWidth;
   color_intrinsics.height = kSyntheticImageHeight;
   
+  if (session_replay) {
+    depth_intrinsics = session_reader.depth_intrinsics();
+    color_intrinsics = session_reader.color_intrinsics();
+  }
+  
   // Create ViewCorrectionDisplay
   std::shared_ptr<ViewCorrectionDisplay> display(new ViewCorrectionDisplay(
       width, height, offset_x, offset_y,
@@ -91,21 +241,45 @@ int main(int argc, char** argv) {
       color_intrinsics));
   
   // Create OpenGL context and window and make the context current.
-  // We use the GLFW library here for convenience.
-  if (!glfwInit()) {
-    LOG(ERROR) << "Cannot initialize GLFW. Aborting.";
-    return 1;
-  }
-  GLFWwindow* window = glfwCreateWindow(width, height, "View correction stub", NULL, NULL);
-  if (!window) {
-    LOG(ERROR) << "Cannot create GLFW window. Aborting.";
-    glfwTerminate();
-    return 1;
+  // We use the GLFW library here for convenience. With --vc_headless, an
+  // offscreen context without a window is created on the current CUDA device
+  // instead (which also initializes GLEW).
+  OffscreenContext offscreen_context;
+  GLFWwindow* window = nullptr;
+  if (FLAGS_vc_headless) {
+    int cuda_device;
+    CUDA_CHECKED_CALL(cudaGetDevice(&cuda_device));
+    if (!offscreen_context.Create(cuda_device)) {
+      LOG(ERROR) << "Cannot create offscreen OpenGL context. Aborting.";
+      return 1;
+    }
+  } else {
+    if (!glfwInit()) {
+      LOG(ERROR) << "Cannot initialize GLFW. Aborting.";
+      return 1;
+    }
+    window = glfwCreateWindow(width, height, "View correction stub", NULL, NULL);
+    if (!window) {
+      LOG(ERROR) << "Cannot create GLFW window. Aborting.";
+      glfwTerminate();
+      return 1;
+    }
+    glfwMakeContextCurrent(window);
+    
+    // Initializing GLEW for the OpenGL context is required by the view correction code.
+    glewInit();
   }
-  glfwMakeContextCurrent(window);
   
-  // Initializing GLEW for the OpenGL context is required by the view correction code.
-  glewInit();
+  // With frame pacing, the buffer swap must block until the vsync.
+  std::unique_ptr<FramePacer> frame_pacer;
+  if (FLAGS_vc_frame_pacing) {
+    if (window) {
+      glfwSwapInterval(1);
+      frame_pacer.reset(new FramePacer(FLAGS_vc_frame_pacing_margin_ms, 60));
+    } else {
+      LOG(WARNING) << "Frame pacing is not used in headless mode.";
+    }
+  }
   
   // Perform OpenGL initializations of ViewCorrectionDisplay.
   display->Init();
@@ -114,13 +288,35 @@ int main(int argc, char** argv) {
   steady_clock::time_point start_time = steady_clock::now();
   display->SetStartTime(start_time);
   
-  while (!glfwWindowShouldClose(window)) {
+  while (!window || !glfwWindowShouldClose(window)) {
+    // Delay the frame such that it finishes just before the vsync at which it
+    // is displayed, and predict the pose for this vsync.
+    if (frame_pacer) {
+      display->SetNextDisplayTime(frame_pacer->WaitForFrameStart());
+    }
+    
     // Update the display with new input, if available.
     // This could also be done asynchronously from different threads.
     steady_clock::time_point now = steady_clock::now();
     uint64_t nanoseconds = duration<double, std::nano>(now - start_time).count();
     double seconds = 1e-9 * nanoseconds;
     
+    if (session_replay) {
+      session_replay->Update(nanoseconds, display.get());
+      display->Render();
+      if (window) {
+        if (frame_pacer) {
+          frame_pacer->FrameSubmitted();
+        }
+        glfwSwapBuffers(window);
+        if (frame_pacer) {
+          frame_pacer->FrameSwapped();
+        }
+        glfwPollEvents();
+      }
+      continue;
+    }
+    
     
     LOG(ERROR) << "Stub: update the display with new poses";
     // TODO: Use the following function to insert your poses:
@@ -139,8 +335,10 @@ int main(int argc, char** argv) {
     // display->YUVImageCallback(const ColorImage& image);
     
     // Synthetic example for testing purposes:
+    // (Allocating the image with AllocateColorImage() allows to upload it
+    //  without staging. Using create() works as well.)
     ColorImage synthetic_color_image;
-    synthetic_color_image.create(kSyntheticImageHeight, kSyntheticImageWidth);
+    display->AllocateColorImage(kSyntheticImageHeight, kSyntheticImageWidth, &synthetic_color_image);
     synthetic_color_image.set_timestamp_ns(nanoseconds);
     synthetic_color_image.set_G_T_C(G_T_C);
     for (int y = 0; y < kSyntheticImageHeight; ++ y) {
@@ -160,6 +358,9 @@ int main(int argc, char** argv) {
       LOG(ERROR) << "Stub: update the display with new scene reconstructions";
       // TODO: Use the following function to insert your meshes:
       // display->MeshCallback(const std::shared_ptr<MeshStub>& mesh);
+      // or, for reconstructions divided into chunks, to upload only the
+      // changed chunks:
+      // display->MeshChunkCallback(const MeshChunkUpdates& updates);
       
       // Synthetic example for testing purposes:
       static std::vector<float> vertex_data = { 1, -1, 1,
@@ -189,7 +390,7 @@ int main(int argc, char** argv) {
       
       // Synthetic example for testing purposes:
       DepthImage synthetic_depth_image;
-      synthetic_depth_image.create(kSyntheticImageHeight, kSyntheticImageWidth);
+      display->AllocateDepthImage(kSyntheticImageHeight, kSyntheticImageWidth, &synthetic_depth_image);
       synthetic_depth_image.set_timestamp_ns(nanoseconds);
       for (int y = 0; y < kSyntheticImageHeight; ++ y) {
         for (int x = 0; x < kSyntheticImageWidth; ++ x) {
@@ -204,14 +405,34 @@ int main(int argc, char** argv) {
     // Given the latest input data, render the corrected view.
     display->Render();
     
-    // GLFW buffer swap and event polling.
-    glfwSwapBuffers(window);
-    glfwPollEvents();
+    if (window) {
+      // GLFW buffer swap and event polling.
+      if (frame_pacer) {
+        frame_pacer->FrameSubmitted();
+      }
+      glfwSwapBuffers(window);
+      if (frame_pacer) {
+        frame_pacer->FrameSwapped();
+      }
+      glfwPollEvents();
+    } else {
+      LOG(ERROR) << "Stub: use the headless result here";
+      // TODO: Read the result from the CUDA buffers, for example:
+      // const CUDABuffer<uchar4>* color;
+      // const CUDABuffer<float>* depth;
+      // cudaEvent_t ready_event;
+      // if (display->GetHeadlessResult(&color, &depth, &ready_event)) {
+      //   cudaStreamWaitEvent(your_stream, ready_event, 0);
+      //   ...
+      // }
+    }
   }
   
   // Destroy the display while the OpenGL context is still active.
   display.reset();
   
-  glfwTerminate();
+  if (window) {
+    glfwTerminate();
+  }
   return 0;
 }
@@ -0,0 +1,154 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "view_correction/mesh_chunk_cache.h"
+
+#include <glog/logging.h>
+
+#include "view_correction/mesh_renderer.h"
+#include "view_correction/opengl_util.h"
+#include "view_correction/view_frustum.h"
+
+namespace view_correction {
+
+MeshChunkCache::MeshChunkCache()
+    : last_upload_size_(0) {}
+
+MeshChunkCache::~MeshChunkCache() {
+  for (auto& item : chunks_) {
+    DeleteChunkBuffers(&item.second);
+  }
+}
+
+void MeshChunkCache::Update(const MeshChunkUpdates& updates) {
+  last_upload_size_ = 0;
+  for (const auto& update : updates) {
+    auto it = chunks_.find(update.first);
+    const MeshChunk* chunk = update.second.get();
+    if (!chunk || chunk->indices.empty()) {
+      if (it != chunks_.end()) {
+        DeleteChunkBuffers(&it->second);
+        chunks_.erase(it);
+      }
+      continue;
+    }
+    
+    CHECK_EQ(chunk->indices.size() % 3, 0u);
+    CHECK_EQ(chunk->vertex_colors.size() / 4, chunk->vertex_positions.size() / 3);
+    
+    if (it == chunks_.end()) {
+      ChunkBuffers buffers;
+      GLuint names[3];
+      glGenBuffers(3, names);
+      buffers.vertex_buffer = names[0];
+      buffers.color_buffer = names[1];
+      buffers.index_buffer = names[2];
+      buffers.vertex_buffer_size = 0;
+      buffers.color_buffer_size = 0;
+      buffers.index_buffer_size = 0;
+      it = chunks_.emplace(update.first, buffers).first;
+    }
+    ChunkBuffers* buffers = &it->second;
+    
+    UploadToBuffer(GL_ARRAY_BUFFER, buffers->vertex_buffer,
+                   chunk->vertex_positions.data(),
+                   chunk->vertex_positions.size() * sizeof(float),
+                   &buffers->vertex_buffer_size);
+    UploadToBuffer(GL_ARRAY_BUFFER, buffers->color_buffer,
+                   chunk->vertex_colors.data(),
+                   chunk->vertex_colors.size() * sizeof(uint8_t),
+                   &buffers->color_buffer_size);
+    UploadToBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers->index_buffer,
+                   chunk->indices.data(),
+                   chunk->indices.size() * sizeof(uint32_t),
+                   &buffers->index_buffer_size);
+    buffers->face_count = chunk->indices.size() / 3;
+    
+    buffers->bounding_box.setEmpty();
+    for (size_t i = 0; i + 2 < chunk->vertex_positions.size(); i += 3) {
+      buffers->bounding_box.extend(
+          Eigen::Map<const Eigen::Vector3f>(&chunk->vertex_positions[i]));
+    }
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  CHECK_OPENGL_NO_ERROR();
+}
+
+int MeshChunkCache::RenderDepth(
+    const ViewFrustum& frustum, MeshRenderer* renderer) const {
+  int drawn_chunk_count = 0;
+  for (const auto& item : chunks_) {
+    const ChunkBuffers& buffers = item.second;
+    if (!frustum.Intersects(buffers.bounding_box)) {
+      continue;
+    }
+    renderer->RenderMeshDepth(buffers.vertex_buffer, buffers.index_buffer,
+                              buffers.face_count);
+    ++ drawn_chunk_count;
+  }
+  return drawn_chunk_count;
+}
+
+int MeshChunkCache::RenderDepthAndColor(
+    const ViewFrustum& frustum, MeshRenderer* renderer) const {
+  int drawn_chunk_count = 0;
+  for (const auto& item : chunks_) {
+    const ChunkBuffers& buffers = item.second;
+    if (!frustum.Intersects(buffers.bounding_box)) {
+      continue;
+    }
+    renderer->RenderMeshDepthAndColor(
+        buffers.vertex_buffer, buffers.color_buffer, buffers.index_buffer,
+        buffers.face_count);
+    ++ drawn_chunk_count;
+  }
+  return drawn_chunk_count;
+}
+
+void MeshChunkCache::UploadToBuffer(
+    GLenum target, GLuint buffer, const void* data, size_t size,
+    size_t* allocated_size) {
+  glBindBuffer(target, buffer);
+  if (size > *allocated_size) {
+    // Grow by some extra space, since reconstructed chunks tend to grow
+    // gradually.
+    *allocated_size = size + size / 4;
+    glBufferData(target, *allocated_size, nullptr, GL_DYNAMIC_DRAW);
+  }
+  glBufferSubData(target, 0, size, data);
+  last_upload_size_ += size;
+}
+
+void MeshChunkCache::DeleteChunkBuffers(ChunkBuffers* buffers) {
+  GLuint names[3] = {buffers->vertex_buffer, buffers->color_buffer,
+                     buffers->index_buffer};
+  glDeleteBuffers(3, names);
+}
+
+}  // namespace view_correction
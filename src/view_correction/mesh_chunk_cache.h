@@ -0,0 +1,129 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef VIEW_CORRECTION_MESH_CHUNK_CACHE_H_
+#define VIEW_CORRECTION_MESH_CHUNK_CACHE_H_
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#ifdef ANDROID
+#include <EGL/egl.h>
+#include <GLES3/gl3.h>
+#else
+#include <GL/glew.h>
+#include <GL/gl.h>
+#endif
+
+#include <Eigen/Geometry>
+
+namespace view_correction {
+
+class MeshRenderer;
+class ViewFrustum;
+
+// Part of a scene reconstruction (for example, one TSDF block) which is
+// updated independently of the others.
+struct MeshChunk {
+  // Vertex positions (x, y, z) in the global frame.
+  std::vector<float> vertex_positions;
+  // Vertex colors (r, g, b, unused), 4 bytes per vertex.
+  std::vector<uint8_t> vertex_colors;
+  // Triangle list with indices into the chunk's vertices.
+  std::vector<uint32_t> indices;
+};
+
+// Chunk updates by chunk ID. A null chunk removes the chunk.
+typedef std::unordered_map<uint64_t, std::shared_ptr<const MeshChunk>>
+    MeshChunkUpdates;
+
+// Keeps a scene reconstruction in persistent OpenGL buffer objects, one set
+// per chunk, such that only the changed chunks have to be uploaded instead of
+// re-sending the whole reconstruction to the GPU for every draw. The buffers
+// of updated chunks are re-used if they are large enough. The bounding box of
+// each chunk is kept as well, such that chunks outside of the view frustum are
+// not drawn.
+//
+// All functions must be called with the OpenGL context current.
+class MeshChunkCache {
+ public:
+  MeshChunkCache();
+  ~MeshChunkCache();
+  
+  // Uploads the given chunks and removes the chunks given as null.
+  void Update(const MeshChunkUpdates& updates);
+  
+  // Draws the chunks which intersect the frustum with a renderer between its
+  // BeginRenderingMeshesDepth() and EndRenderingMeshesDepth() calls. Returns
+  // the number of drawn chunks.
+  int RenderDepth(const ViewFrustum& frustum, MeshRenderer* renderer) const;
+  
+  // Draws the chunks which intersect the frustum with a renderer between its
+  // BeginRenderingMeshesDepthAndColor() and EndRenderingMeshesDepthAndColor()
+  // calls. Returns the number of drawn chunks.
+  int RenderDepthAndColor(const ViewFrustum& frustum,
+                          MeshRenderer* renderer) const;
+  
+  inline bool empty() const { return chunks_.empty(); }
+  inline int chunk_count() const { return chunks_.size(); }
+  
+  // Returns the number of bytes uploaded by the last call to Update().
+  inline size_t last_upload_size() const { return last_upload_size_; }
+  
+ private:
+  struct ChunkBuffers {
+    GLuint vertex_buffer;
+    GLuint color_buffer;
+    GLuint index_buffer;
+    // Allocated sizes of the buffers in bytes.
+    size_t vertex_buffer_size;
+    size_t color_buffer_size;
+    size_t index_buffer_size;
+    int face_count;
+    // Bounding box of the vertices in the global frame.
+    Eigen::AlignedBox3f bounding_box;
+  };
+  
+  // Uploads data to buffer, growing its allocation if required.
+  void UploadToBuffer(GLenum target, GLuint buffer, const void* data,
+                      size_t size, size_t* allocated_size);
+  
+  static void DeleteChunkBuffers(ChunkBuffers* buffers);
+  
+  std::unordered_map<uint64_t, ChunkBuffers> chunks_;
+  size_t last_upload_size_;
+  
+  MeshChunkCache(const MeshChunkCache& other) = delete;
+  MeshChunkCache& operator=(const MeshChunkCache& other) = delete;
+};
+
+}  // namespace view_correction
+
+#endif  // VIEW_CORRECTION_MESH_CHUNK_CACHE_H_
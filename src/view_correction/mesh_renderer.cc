@@ -28,31 +28,42 @@
 
 #include "view_correction/mesh_renderer.h"
 
+#include <string>
+#include <vector>
+
+#include "view_correction/cuda_buffer.h"
 #include "view_correction/cuda_util.h"
 #include "view_correction/opengl_util.h"
 #include "view_correction/util.h"
 
 namespace view_correction {
 
-MeshRenderer::MeshRenderer(int width, int height, Type type) {
+MeshRenderer::MeshRenderer(int width, int height, Type type, int view_count,
+                           ShaderProgramCache* program_cache) {
   CHECK_OPENGL_NO_ERROR();
+  CHECK_GE(view_count, 1);
+  CHECK(view_count == 1 || type == kRenderDepthAndIntensity);
   width_ = width;
   height_ = height;
+  view_count_ = view_count;
   type_ = type;
   
+  if (program_cache) {
+    program_cache_ = program_cache;
+  } else {
+    own_program_cache_.reset(new ShaderProgramCache(""));
+    program_cache_ = own_program_cache_.get();
+  }
+  
   CreateFrameBufferObject(type);
   
   if (type == kRenderDepthOnly) {
-    CreateDepthVertexShader();
-    CreateDepthFragmentShader();
     CreateDepthProgram();
-  } else if (type == kRenderDepthAndIntensity) {
-    CreateVertexShader();
-    CreateFragmentShader();
+  } else if (type == kRenderDepthAndIntensity && view_count == 1) {
     CreateProgram();
+  } else if (type == kRenderDepthAndIntensity) {
+    CreateMultiViewProgram();
   } else if (type == kRenderDepthAndColor) {
-    CreateDepthAndColorVertexShader();
-    CreateDepthAndColorFragmentShader();
     CreateDepthAndColorProgram();
   }
 }
@@ -63,25 +74,8 @@ MeshRenderer::~MeshRenderer() {
     CUDA_CHECKED_CALL(cudaGraphicsUnregisterResource(rendertarget_1_resource_cuda_));
   }
 
-  if (type_ == kRenderDepthOnly) {
-    glDetachShader(depth_shader_program_, depth_vertex_shader_);
-    glDetachShader(depth_shader_program_, depth_fragment_shader_);
-    glDeleteShader(depth_vertex_shader_);
-    glDeleteShader(depth_fragment_shader_);
-    glDeleteProgram(depth_shader_program_);
-  } else if (type_ == kRenderDepthAndIntensity) {
-    glDetachShader(shader_program_, vertex_shader_);
-    glDetachShader(shader_program_, fragment_shader_);
-    glDeleteShader(vertex_shader_);
-    glDeleteShader(fragment_shader_);
-    glDeleteProgram(shader_program_);
-  } else if (type_ == kRenderDepthAndColor) {
-    glDetachShader(depth_color_shader_program_, depth_color_vertex_shader_);
-    glDetachShader(depth_color_shader_program_, depth_color_fragment_shader_);
-    glDeleteShader(depth_color_vertex_shader_);
-    glDeleteShader(depth_color_fragment_shader_);
-    glDeleteProgram(depth_color_shader_program_);
-  }
+  // The programs are owned by the program cache (and deleted with
+  // own_program_cache_ if not shared).
 
   glDeleteTextures(1, &rendertarget_0_texture_);
   if (type_ != kRenderDepthOnly) {
@@ -96,11 +90,13 @@ MeshRenderer::~MeshRenderer() {
 
 void MeshRenderer::RenderMesh(
     GLuint vertex_buffer, GLuint color_buffer, GLuint index_buffer,
-    int num_indices,
+    int num_indices, GLenum mode,
     const Sophus::SE3f& transformation,
     const float fx, const float fy, const float cx, const float cy,
     float min_depth, float max_depth) {
   CHECK_EQ(type_, kRenderDepthAndIntensity);
+  CHECK_EQ(view_count_, 1);
+  CHECK(mode == GL_TRIANGLE_STRIP || mode == GL_TRIANGLES);
   
   CHECK_OPENGL_NO_ERROR();
   
@@ -153,7 +149,7 @@ void MeshRenderer::RenderMesh(
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
   CHECK_OPENGL_NO_ERROR();
 
-  glDrawElements(GL_TRIANGLE_STRIP, num_indices, GL_UNSIGNED_INT,
+  glDrawElements(mode, num_indices, GL_UNSIGNED_INT,
                  reinterpret_cast<char*>(0) + 0);
   CHECK_OPENGL_NO_ERROR();
 
@@ -166,6 +162,99 @@ void MeshRenderer::RenderMesh(
   CHECK_OPENGL_NO_ERROR();
 }
 
+void MeshRenderer::RenderMeshViews(
+    int count,
+    GLuint vertex_buffer, GLuint color_buffer, GLuint index_buffer,
+    int num_indices, GLenum mode,
+    const Sophus::SE3f* transformations,
+    const float* fx, const float* fy, const float* cx, const float* cy,
+    float min_depth, float max_depth) {
+  CHECK_EQ(type_, kRenderDepthAndIntensity);
+  CHECK_GE(count, 1);
+  CHECK_LE(count, view_count_);
+  if (view_count_ == 1) {
+    RenderMesh(vertex_buffer, color_buffer, index_buffer, num_indices, mode,
+               transformations[0], fx[0], fy[0], cx[0], cy[0],
+               min_depth, max_depth);
+    return;
+  }
+  CHECK(mode == GL_TRIANGLE_STRIP || mode == GL_TRIANGLES);
+  
+  CHECK_OPENGL_NO_ERROR();
+  
+  // Set states.
+  glClearColor(0.0, 0.0, 0.0, 0.0);
+  glDisable(GL_BLEND);
+  glEnable(GL_DEPTH_TEST);
+  glDepthFunc(GL_LEQUAL);
+  glDisable(GL_CULL_FACE);
+  CHECK_OPENGL_NO_ERROR();
+
+  // Setup framebuffer and shaders.
+  glBindFramebuffer(GL_FRAMEBUFFER, frame_buffer_object_);
+  CHECK_OPENGL_NO_ERROR();
+
+  GLenum buffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+  glDrawBuffers(2, buffers);
+  CHECK_OPENGL_NO_ERROR();
+
+  // Clear buffers (of all views).
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+  // Render geometry.
+  glUseProgram(multi_view_shader_program_);
+  
+  // Setup the projections of the views. The shader selects them by the
+  // instance index.
+  std::vector<float> projection_matrices(16 * count);
+  std::vector<float> model_view_matrices(16 * count);
+  for (int view = 0; view < count; ++ view) {
+    ComputeProjection(transformations[view], fx[view], fy[view], cx[view],
+                      cy[view], min_depth, max_depth,
+                      projection_matrices.data() + 16 * view,
+                      model_view_matrices.data() + 16 * view);
+  }
+  glUniformMatrix4fv(multi_view_u_projection_matrix_location_, count, GL_FALSE,
+                     projection_matrices.data());
+  glUniformMatrix4fv(multi_view_u_model_view_matrix_location_, count, GL_FALSE,
+                     model_view_matrices.data());
+  glUniform1i(multi_view_u_view_height_location_, height_);
+  glViewport(0, 0, width_, view_count_ * height_);
+  CHECK_OPENGL_NO_ERROR();
+
+  glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+  glEnableVertexAttribArray(multi_view_a_position_location_);
+  glVertexAttribPointer(multi_view_a_position_location_, 3, GL_FLOAT, GL_FALSE,
+                        3 * sizeof(float),  // NOLINT
+                        reinterpret_cast<char*>(0) + 0);
+  CHECK_OPENGL_NO_ERROR();
+
+  glBindBuffer(GL_ARRAY_BUFFER, color_buffer);
+  glEnableVertexAttribArray(multi_view_a_intensity_location_);
+  glVertexAttribPointer(multi_view_a_intensity_location_, 1, GL_UNSIGNED_BYTE, GL_TRUE,
+                        1 * sizeof(uint8_t),  // NOLINT
+                        reinterpret_cast<char*>(0) + 0);
+  CHECK_OPENGL_NO_ERROR();
+
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+  CHECK_OPENGL_NO_ERROR();
+
+  // Draw one instance per view, such that the vertex data is only fetched by
+  // a single draw call for all views.
+  glDrawElementsInstanced(mode, num_indices, GL_UNSIGNED_INT,
+                          reinterpret_cast<char*>(0) + 0, count);
+  CHECK_OPENGL_NO_ERROR();
+
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  glDisableVertexAttribArray(multi_view_a_intensity_location_);
+  glDisableVertexAttribArray(multi_view_a_position_location_);
+  CHECK_OPENGL_NO_ERROR();
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  CHECK_OPENGL_NO_ERROR();
+}
+
 void MeshRenderer::BeginRenderingMeshesDepth(
     const Sophus::SE3f& transformation, const float fx,
     const float fy, const float cx, const float cy, float min_depth,
@@ -206,6 +295,8 @@ void MeshRenderer::RenderMeshDepth(
   CHECK_EQ(type_, kRenderDepthOnly);
   
   // Render from CPU memory.
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
   glVertexAttribPointer(depth_a_position_location_, 3, GL_FLOAT, GL_FALSE,
                         3 * sizeof(float),  // NOLINT
                         vertex_data);
@@ -213,10 +304,25 @@ void MeshRenderer::RenderMeshDepth(
                  face_data);
 }
 
+void MeshRenderer::RenderMeshDepth(
+    GLuint vertex_buffer, GLuint index_buffer, int num_faces) {
+  CHECK_EQ(type_, kRenderDepthOnly);
+  
+  glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+  glVertexAttribPointer(depth_a_position_location_, 3, GL_FLOAT, GL_FALSE,
+                        3 * sizeof(float),  // NOLINT
+                        reinterpret_cast<char*>(0) + 0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+  glDrawElements(GL_TRIANGLES, 3 * num_faces, GL_UNSIGNED_INT,
+                 reinterpret_cast<char*>(0) + 0);
+}
+
 void MeshRenderer::EndRenderingMeshesDepth() {
   CHECK_EQ(type_, kRenderDepthOnly);
   
   glDisableVertexAttribArray(depth_a_position_location_);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
   CHECK_OPENGL_NO_ERROR();
   
@@ -276,6 +382,8 @@ void MeshRenderer::RenderMeshDepthAndColor(
   CHECK_EQ(type_, kRenderDepthAndColor);
   
   // Render from CPU memory.
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
   glVertexAttribPointer(depth_color_a_position_location_, 3, GL_FLOAT, GL_FALSE,
                         3 * sizeof(float),  // NOLINT
                         vertex_data);
@@ -286,15 +394,42 @@ void MeshRenderer::RenderMeshDepthAndColor(
                  face_data);
 }
 
+void MeshRenderer::RenderMeshDepthAndColor(
+    GLuint vertex_buffer, GLuint color_buffer, GLuint index_buffer, int num_faces) {
+  CHECK_EQ(type_, kRenderDepthAndColor);
+  
+  glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+  glVertexAttribPointer(depth_color_a_position_location_, 3, GL_FLOAT, GL_FALSE,
+                        3 * sizeof(float),  // NOLINT
+                        reinterpret_cast<char*>(0) + 0);
+  glBindBuffer(GL_ARRAY_BUFFER, color_buffer);
+  glVertexAttribPointer(depth_color_a_color_location_, 3, GL_UNSIGNED_BYTE, GL_TRUE,
+                        4 * sizeof(uint8_t),  // NOLINT
+                        reinterpret_cast<char*>(0) + 0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+  glDrawElements(GL_TRIANGLES, 3 * num_faces, GL_UNSIGNED_INT,
+                 reinterpret_cast<char*>(0) + 0);
+}
+
 void MeshRenderer::EndRenderingMeshesDepthAndColor() {
   CHECK_EQ(type_, kRenderDepthAndColor);
   
   glDisableVertexAttribArray(depth_color_a_position_location_);
   glDisableVertexAttribArray(depth_color_a_color_location_);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
   CHECK_OPENGL_NO_ERROR();
 }
 
+ViewFrustum MeshRenderer::GetViewFrustum(
+    const Sophus::SE3f& transformation,
+    const float fx, const float fy, const float cx, const float cy,
+    float min_depth, float max_depth) const {
+  return ViewFrustum(transformation, fx, fy, cx, cy, width_, height_,
+                     min_depth, max_depth);
+}
+
 cudaGraphicsResource_t MeshRenderer::result_resource_depth() const {
   return rendertarget_0_resource_cuda_;
 }
@@ -303,39 +438,32 @@ cudaGraphicsResource_t MeshRenderer::result_resource_intensity() const {
   return rendertarget_1_resource_cuda_;
 }
 
+static cudaTextureDesc CreateTextureDescription(
+    cudaTextureAddressMode address_mode_x,
+    cudaTextureAddressMode address_mode_y, cudaTextureFilterMode filter_mode,
+    cudaTextureReadMode read_mode, bool normalized_coordinate_access) {
+  struct cudaTextureDesc texture_description;
+  memset(&texture_description, 0, sizeof(texture_description));
+  texture_description.addressMode[0] = address_mode_x;
+  texture_description.addressMode[1] = address_mode_y;
+  texture_description.filterMode = filter_mode;
+  texture_description.readMode = read_mode;
+  texture_description.normalizedCoords = normalized_coordinate_access ? 1 : 0;
+  return texture_description;
+}
+
 cudaTextureObject_t MeshRenderer::MapDepthResultAsTexture(
     cudaTextureAddressMode address_mode_x,
     cudaTextureAddressMode address_mode_y, cudaTextureFilterMode filter_mode,
     bool normalized_coordinate_access, cudaStream_t stream) {
-  // Map the resource.
   cudaArray_t warped_depth_array;
-  CUDA_CHECKED_CALL(cudaGraphicsMapResources(1, &rendertarget_0_resource_cuda_, stream));
-  CUDA_CHECKED_CALL(cudaGraphicsSubResourceGetMappedArray(
-      &warped_depth_array, rendertarget_0_resource_cuda_, 0, 0));
-
-  // Create resource description.
-  struct cudaResourceDesc warped_depth_resource_description;
-  memset(&warped_depth_resource_description, 0,
-         sizeof(warped_depth_resource_description));
-  warped_depth_resource_description.resType = cudaResourceTypeArray;
-  warped_depth_resource_description.res.array.array = warped_depth_array;
-
-  // Create texture object.
-  struct cudaTextureDesc warped_depth_texture_description;
-  memset(&warped_depth_texture_description, 0,
-         sizeof(warped_depth_texture_description));
-  warped_depth_texture_description.addressMode[0] = address_mode_x;
-  warped_depth_texture_description.addressMode[1] = address_mode_y;
-  warped_depth_texture_description.filterMode = filter_mode;
-  warped_depth_texture_description.readMode = cudaReadModeElementType;
-  warped_depth_texture_description.normalizedCoords =
-      normalized_coordinate_access ? 1 : 0;
-  cudaTextureObject_t warped_depth_texture;
-  CUDA_CHECKED_CALL(cudaCreateTextureObject(
-      &warped_depth_texture, &warped_depth_resource_description,
-      &warped_depth_texture_description, NULL));
-
-  return warped_depth_texture;
+  MapGraphicsResourceArrays(1, &rendertarget_0_resource_cuda_, stream,
+                            &warped_depth_array);
+  return rendertarget_0_object_cache_.GetTextureObject(
+      warped_depth_array,
+      CreateTextureDescription(address_mode_x, address_mode_y, filter_mode,
+                               cudaReadModeElementType,
+                               normalized_coordinate_access));
 }
 
 cudaTextureObject_t MeshRenderer::MapIntensityResultAsTexture(
@@ -343,35 +471,13 @@ cudaTextureObject_t MeshRenderer::MapIntensityResultAsTexture(
     cudaTextureAddressMode address_mode_y, cudaTextureFilterMode filter_mode,
     cudaTextureReadMode read_mode,
     bool normalized_coordinate_access, cudaStream_t stream) {
-  // Map the resource.
   cudaArray_t result_array;
-  CUDA_CHECKED_CALL(cudaGraphicsMapResources(1, &rendertarget_1_resource_cuda_, stream));
-  CUDA_CHECKED_CALL(cudaGraphicsSubResourceGetMappedArray(
-      &result_array, rendertarget_1_resource_cuda_, 0, 0));
-
-  // Create resource description.
-  struct cudaResourceDesc result_resource_description;
-  memset(&result_resource_description, 0,
-         sizeof(result_resource_description));
-  result_resource_description.resType = cudaResourceTypeArray;
-  result_resource_description.res.array.array = result_array;
-
-  // Create texture object.
-  struct cudaTextureDesc result_texture_description;
-  memset(&result_texture_description, 0,
-         sizeof(result_texture_description));
-  result_texture_description.addressMode[0] = address_mode_x;
-  result_texture_description.addressMode[1] = address_mode_y;
-  result_texture_description.filterMode = filter_mode;
-  result_texture_description.readMode = read_mode;
-  result_texture_description.normalizedCoords =
-      normalized_coordinate_access ? 1 : 0;
-  cudaTextureObject_t result_texture;
-  CUDA_CHECKED_CALL(cudaCreateTextureObject(
-      &result_texture, &result_resource_description,
-      &result_texture_description, NULL));
-
-  return result_texture;
+  MapGraphicsResourceArrays(1, &rendertarget_1_resource_cuda_, stream,
+                            &result_array);
+  return rendertarget_1_object_cache_.GetTextureObject(
+      result_array,
+      CreateTextureDescription(address_mode_x, address_mode_y, filter_mode,
+                               read_mode, normalized_coordinate_access));
 }
 
 cudaTextureObject_t MeshRenderer::MapColorResultAsTexture(
@@ -381,67 +487,104 @@ cudaTextureObject_t MeshRenderer::MapColorResultAsTexture(
     cudaTextureReadMode read_mode,
     bool normalized_coordinate_access,
     cudaStream_t stream) {
-  // Map the resource.
-  cudaArray_t result_array;
-  CUDA_CHECKED_CALL(cudaGraphicsMapResources(1, &rendertarget_1_resource_cuda_, stream));
-  CUDA_CHECKED_CALL(cudaGraphicsSubResourceGetMappedArray(
-      &result_array, rendertarget_1_resource_cuda_, 0, 0));
-
-  // Create resource description.
-  struct cudaResourceDesc result_resource_description;
-  memset(&result_resource_description, 0,
-         sizeof(result_resource_description));
-  result_resource_description.resType = cudaResourceTypeArray;
-  result_resource_description.res.array.array = result_array;
-
-  // Create texture object.
-  struct cudaTextureDesc result_texture_description;
-  memset(&result_texture_description, 0,
-         sizeof(result_texture_description));
-  result_texture_description.addressMode[0] = address_mode_x;
-  result_texture_description.addressMode[1] = address_mode_y;
-  result_texture_description.filterMode = filter_mode;
-  result_texture_description.readMode = read_mode;
-  result_texture_description.normalizedCoords =
-      normalized_coordinate_access ? 1 : 0;
-  cudaTextureObject_t result_texture;
-  CUDA_CHECKED_CALL(cudaCreateTextureObject(
-      &result_texture, &result_resource_description,
-      &result_texture_description, NULL));
-
-  return result_texture;
+  // The color result uses the same render target as the intensity result.
+  return MapIntensityResultAsTexture(
+      address_mode_x, address_mode_y, filter_mode, read_mode,
+      normalized_coordinate_access, stream);
+}
+
+void MeshRenderer::MapDepthAndIntensityResultsAsTextures(
+    cudaTextureAddressMode address_mode_x,
+    cudaTextureAddressMode address_mode_y, cudaTextureFilterMode filter_mode,
+    cudaTextureReadMode intensity_read_mode,
+    bool normalized_coordinate_access, cudaStream_t stream,
+    cudaTextureObject_t* depth_texture,
+    cudaTextureObject_t* intensity_texture) {
+  CHECK_EQ(type_, kRenderDepthAndIntensity);
+  cudaGraphicsResource_t resources[2] = {
+      rendertarget_0_resource_cuda_, rendertarget_1_resource_cuda_};
+  cudaArray_t arrays[2];
+  MapGraphicsResourceArrays(2, resources, stream, arrays);
+  *depth_texture = rendertarget_0_object_cache_.GetTextureObject(
+      arrays[0],
+      CreateTextureDescription(address_mode_x, address_mode_y, filter_mode,
+                               cudaReadModeElementType,
+                               normalized_coordinate_access));
+  *intensity_texture = rendertarget_1_object_cache_.GetTextureObject(
+      arrays[1],
+      CreateTextureDescription(address_mode_x, address_mode_y, filter_mode,
+                               intensity_read_mode,
+                               normalized_coordinate_access));
 }
 
 void MeshRenderer::UnmapDepthResult(
-    cudaTextureObject_t texture, cudaStream_t stream) {
-  CUDA_CHECKED_CALL(cudaDestroyTextureObject(texture));
+    cudaTextureObject_t /*texture*/, cudaStream_t stream) {
   CUDA_CHECKED_CALL(
       cudaGraphicsUnmapResources(1, &rendertarget_0_resource_cuda_, stream));
 }
 
 void MeshRenderer::UnmapIntensityResult(
-    cudaTextureObject_t texture, cudaStream_t stream) {
-  CUDA_CHECKED_CALL(cudaDestroyTextureObject(texture));
+    cudaTextureObject_t /*texture*/, cudaStream_t stream) {
   CUDA_CHECKED_CALL(
       cudaGraphicsUnmapResources(1, &rendertarget_1_resource_cuda_, stream));
 }
 
-void MeshRenderer::UnmapColorResult(cudaTextureObject_t texture, cudaStream_t stream) {
-  CUDA_CHECKED_CALL(cudaDestroyTextureObject(texture));
+void MeshRenderer::UnmapColorResult(cudaTextureObject_t /*texture*/, cudaStream_t stream) {
   CUDA_CHECKED_CALL(
       cudaGraphicsUnmapResources(1, &rendertarget_1_resource_cuda_, stream));
 }
 
+void MeshRenderer::UnmapDepthAndIntensityResults(cudaStream_t stream) {
+  cudaGraphicsResource_t resources[2] = {
+      rendertarget_0_resource_cuda_, rendertarget_1_resource_cuda_};
+  CUDA_CHECKED_CALL(cudaGraphicsUnmapResources(2, resources, stream));
+}
+
+void MeshRenderer::CopyDepthAndIntensityResults(
+    cudaStream_t stream,
+    int count,
+    CUDABuffer<float>* const depth[],
+    CUDABuffer<uint8_t>* const intensity[]) {
+  CHECK_EQ(type_, kRenderDepthAndIntensity);
+  CHECK_LE(count, view_count_);
+  cudaGraphicsResource_t resources[2] = {
+      rendertarget_0_resource_cuda_, rendertarget_1_resource_cuda_};
+  cudaArray_t arrays[2];
+  MapGraphicsResourceArrays(2, resources, stream, arrays);
+  for (int view = 0; view < count; ++ view) {
+    CHECK_EQ(depth[view]->width(), width_);
+    CHECK_EQ(depth[view]->height(), height_);
+    CHECK_EQ(intensity[view]->width(), width_);
+    CHECK_EQ(intensity[view]->height(), height_);
+    CUDA_CHECKED_CALL(cudaMemcpy2DFromArrayAsync(
+        depth[view]->ToCUDA().address(), depth[view]->ToCUDA().pitch(),
+        arrays[0], 0, view * height_, width_ * sizeof(float), height_,
+        cudaMemcpyDeviceToDevice, stream));
+    CUDA_CHECKED_CALL(cudaMemcpy2DFromArrayAsync(
+        intensity[view]->ToCUDA().address(), intensity[view]->ToCUDA().pitch(),
+        arrays[1], 0, view * height_, width_ * sizeof(uint8_t), height_,
+        cudaMemcpyDeviceToDevice, stream));
+  }
+  CUDA_CHECKED_CALL(cudaGraphicsUnmapResources(2, resources, stream));
+}
+
 void MeshRenderer::CreateFrameBufferObject(Type type) {
   glGenFramebuffers(1, &frame_buffer_object_);
   CHECK_OPENGL_NO_ERROR();
   glBindFramebuffer(GL_FRAMEBUFFER, frame_buffer_object_);
   CHECK_OPENGL_NO_ERROR();
 
+  // The views are stacked vertically.
+  GLint max_texture_size;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+  CHECK_LE(view_count_ * height_, max_texture_size)
+      << "Too many views for the render target size limit.";
+  
   // Add a depth buffer to the frame buffer object.
   glGenRenderbuffers(1, &depth_buffer_);
   glBindRenderbuffer(GL_RENDERBUFFER, depth_buffer_);
-  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, width_, height_);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, width_,
+                        view_count_ * height_);
   glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
                             GL_RENDERBUFFER, depth_buffer_);
   glBindRenderbuffer(GL_RENDERBUFFER, 0);
@@ -454,8 +597,8 @@ void MeshRenderer::CreateFrameBufferObject(Type type) {
   // efficiency might benefit from removing the additional color texture.
   glGenTextures(1, &rendertarget_0_texture_);
   glBindTexture(GL_TEXTURE_2D, rendertarget_0_texture_);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, width_, height_, 0, GL_RED, GL_FLOAT,
-               0);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, width_, view_count_ * height_, 0,
+               GL_RED, GL_FLOAT, 0);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
   glBindTexture(GL_TEXTURE_2D, 0);
@@ -466,8 +609,8 @@ void MeshRenderer::CreateFrameBufferObject(Type type) {
   if (type == kRenderDepthAndIntensity) {
     glGenTextures(1, &rendertarget_1_texture_);
     glBindTexture(GL_TEXTURE_2D, rendertarget_1_texture_);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, width_, height_, 0, GL_RED,
-                GL_UNSIGNED_BYTE, 0);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, width_, view_count_ * height_, 0,
+                GL_RED, GL_UNSIGNED_BYTE, 0);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glBindTexture(GL_TEXTURE_2D, 0);
@@ -505,7 +648,7 @@ void MeshRenderer::CreateFrameBufferObject(Type type) {
   }
 }
 
-void MeshRenderer::CreateVertexShader() {
+void MeshRenderer::CreateProgram() {
   const std::string vertex_shader_src =
       "#version 300 es\n"
       "uniform mat4 u_model_view_matrix;\n"
@@ -523,25 +666,6 @@ void MeshRenderer::CreateVertexShader() {
       "   gl_Position = u_projection_matrix * local_point;\n"
       "}\n";
 
-  vertex_shader_ = glCreateShader(GL_VERTEX_SHADER);
-  const GLchar* vertex_shader_src_ptr =
-      static_cast<const GLchar*>(vertex_shader_src.c_str());
-  glShaderSource(vertex_shader_, 1, &vertex_shader_src_ptr, NULL);
-  glCompileShader(vertex_shader_);
-
-  GLint compiled;
-  glGetShaderiv(vertex_shader_, GL_COMPILE_STATUS, &compiled);
-  if (!compiled) {
-    GLint length;
-    glGetShaderiv(vertex_shader_, GL_INFO_LOG_LENGTH, &length);
-    std::unique_ptr<GLchar[]> log(
-        reinterpret_cast<GLchar*>(new uint8_t[length]));
-    glGetShaderInfoLog(vertex_shader_, length, &length, log.get());
-    LOG(FATAL) << "GL Shader Compilation Error: " << log.get();
-  }
-}
-
-void MeshRenderer::CreateFragmentShader() {
   const std::string fragment_shader_src =
       "#version 300 es\n"
       "in highp float var_depth;\n"
@@ -554,40 +678,8 @@ void MeshRenderer::CreateFragmentShader() {
       "   out_intensity = (var_intensity > 0.0) ? 1.0 : 0.0;\n"
       "}\n";
 
-  fragment_shader_ = glCreateShader(GL_FRAGMENT_SHADER);
-  const GLchar* fragment_shader_src_ptr =
-      static_cast<const GLchar*>(fragment_shader_src.c_str());
-  glShaderSource(fragment_shader_, 1, &fragment_shader_src_ptr, NULL);
-  glCompileShader(fragment_shader_);
-
-  GLint compiled;
-  glGetShaderiv(fragment_shader_, GL_COMPILE_STATUS, &compiled);
-  if (!compiled) {
-    GLint length;
-    glGetShaderiv(fragment_shader_, GL_INFO_LOG_LENGTH, &length);
-    std::unique_ptr<GLchar[]> log(
-        reinterpret_cast<GLchar*>(new uint8_t[length]));
-    glGetShaderInfoLog(fragment_shader_, length, &length, log.get());
-    LOG(FATAL) << "GL Shader Compilation Error: " << log.get();
-  }
-}
-
-void MeshRenderer::CreateProgram() {
-  shader_program_ = glCreateProgram();
-  glAttachShader(shader_program_, fragment_shader_);
-  glAttachShader(shader_program_, vertex_shader_);
-  glLinkProgram(shader_program_);
-
-  GLint linked;
-  glGetProgramiv(shader_program_, GL_LINK_STATUS, &linked);
-  if (!linked) {
-    GLint length;
-    glGetProgramiv(shader_program_, GL_INFO_LOG_LENGTH, &length);
-    std::unique_ptr<GLchar[]> log(
-        reinterpret_cast<GLchar*>(new uint8_t[length]));
-    glGetProgramInfoLog(shader_program_, length, &length, log.get());
-    LOG(FATAL) << "GL Program Linker Error: " << log.get();
-  }
+  shader_program_ =
+      program_cache_->GetProgram(vertex_shader_src, fragment_shader_src);
 
   glUseProgram(shader_program_);
   CHECK_OPENGL_NO_ERROR();
@@ -609,7 +701,7 @@ void MeshRenderer::CreateProgram() {
   CHECK_OPENGL_NO_ERROR();
 }
 
-void MeshRenderer::CreateDepthVertexShader() {
+void MeshRenderer::CreateDepthProgram() {
   const std::string depth_vertex_shader_src =
       "#version 300 es\n"
       "uniform mat4 u_model_view_matrix;\n"
@@ -624,25 +716,6 @@ void MeshRenderer::CreateDepthVertexShader() {
       "   gl_Position = u_projection_matrix * local_point;\n"
       "}\n";
 
-  depth_vertex_shader_ = glCreateShader(GL_VERTEX_SHADER);
-  const GLchar* depth_vertex_shader_src_ptr =
-      static_cast<const GLchar*>(depth_vertex_shader_src.c_str());
-  glShaderSource(depth_vertex_shader_, 1, &depth_vertex_shader_src_ptr, NULL);
-  glCompileShader(depth_vertex_shader_);
-
-  GLint compiled;
-  glGetShaderiv(depth_vertex_shader_, GL_COMPILE_STATUS, &compiled);
-  if (!compiled) {
-    GLint length;
-    glGetShaderiv(depth_vertex_shader_, GL_INFO_LOG_LENGTH, &length);
-    std::unique_ptr<GLchar[]> log(
-        reinterpret_cast<GLchar*>(new uint8_t[length]));
-    glGetShaderInfoLog(depth_vertex_shader_, length, &length, log.get());
-    LOG(FATAL) << "GL Shader Compilation Error: " << log.get();
-  }
-}
-
-void MeshRenderer::CreateDepthFragmentShader() {
   const std::string depth_fragment_shader_src =
       "#version 300 es\n"
       "in highp float var_depth;\n"
@@ -652,40 +725,8 @@ void MeshRenderer::CreateDepthFragmentShader() {
       "   out_depth = var_depth;\n"
       "}\n";
 
-  depth_fragment_shader_ = glCreateShader(GL_FRAGMENT_SHADER);
-  const GLchar* depth_fragment_shader_src_ptr =
-      static_cast<const GLchar*>(depth_fragment_shader_src.c_str());
-  glShaderSource(depth_fragment_shader_, 1, &depth_fragment_shader_src_ptr, NULL);
-  glCompileShader(depth_fragment_shader_);
-
-  GLint compiled;
-  glGetShaderiv(depth_fragment_shader_, GL_COMPILE_STATUS, &compiled);
-  if (!compiled) {
-    GLint length;
-    glGetShaderiv(depth_fragment_shader_, GL_INFO_LOG_LENGTH, &length);
-    std::unique_ptr<GLchar[]> log(
-        reinterpret_cast<GLchar*>(new uint8_t[length]));
-    glGetShaderInfoLog(depth_fragment_shader_, length, &length, log.get());
-    LOG(FATAL) << "GL Shader Compilation Error: " << log.get();
-  }
-}
-
-void MeshRenderer::CreateDepthProgram() {
-  depth_shader_program_ = glCreateProgram();
-  glAttachShader(depth_shader_program_, depth_fragment_shader_);
-  glAttachShader(depth_shader_program_, depth_vertex_shader_);
-  glLinkProgram(depth_shader_program_);
-
-  GLint linked;
-  glGetProgramiv(depth_shader_program_, GL_LINK_STATUS, &linked);
-  if (!linked) {
-    GLint length;
-    glGetProgramiv(depth_shader_program_, GL_INFO_LOG_LENGTH, &length);
-    std::unique_ptr<GLchar[]> log(
-        reinterpret_cast<GLchar*>(new uint8_t[length]));
-    glGetProgramInfoLog(depth_shader_program_, length, &length, log.get());
-    LOG(FATAL) << "GL Program Linker Error: " << log.get();
-  }
+  depth_shader_program_ =
+      program_cache_->GetProgram(depth_vertex_shader_src, depth_fragment_shader_src);
 
   glUseProgram(depth_shader_program_);
   CHECK_OPENGL_NO_ERROR();
@@ -704,7 +745,7 @@ void MeshRenderer::CreateDepthProgram() {
   CHECK_OPENGL_NO_ERROR();
 }
 
-void MeshRenderer::CreateDepthAndColorVertexShader() {
+void MeshRenderer::CreateDepthAndColorProgram() {
   const std::string vertex_shader_src =
       "#version 300 es\n"
       "uniform mat4 u_model_view_matrix;\n"
@@ -722,25 +763,6 @@ void MeshRenderer::CreateDepthAndColorVertexShader() {
       "   gl_Position = u_projection_matrix * local_point;\n"
       "}\n";
 
-  depth_color_vertex_shader_ = glCreateShader(GL_VERTEX_SHADER);
-  const GLchar* vertex_shader_src_ptr =
-      static_cast<const GLchar*>(vertex_shader_src.c_str());
-  glShaderSource(depth_color_vertex_shader_, 1, &vertex_shader_src_ptr, NULL);
-  glCompileShader(depth_color_vertex_shader_);
-
-  GLint compiled;
-  glGetShaderiv(depth_color_vertex_shader_, GL_COMPILE_STATUS, &compiled);
-  if (!compiled) {
-    GLint length;
-    glGetShaderiv(depth_color_vertex_shader_, GL_INFO_LOG_LENGTH, &length);
-    std::unique_ptr<GLchar[]> log(
-        reinterpret_cast<GLchar*>(new uint8_t[length]));
-    glGetShaderInfoLog(depth_color_vertex_shader_, length, &length, log.get());
-    LOG(FATAL) << "GL Shader Compilation Error: " << log.get();
-  }
-}
-
-void MeshRenderer::CreateDepthAndColorFragmentShader() {
   const std::string fragment_shader_src =
       "#version 300 es\n"
       "in highp float var_depth;\n"
@@ -753,40 +775,8 @@ void MeshRenderer::CreateDepthAndColorFragmentShader() {
       "   out_color = vec4(var_color, 1);\n"
       "}\n";
 
-  depth_color_fragment_shader_ = glCreateShader(GL_FRAGMENT_SHADER);
-  const GLchar* fragment_shader_src_ptr =
-      static_cast<const GLchar*>(fragment_shader_src.c_str());
-  glShaderSource(depth_color_fragment_shader_, 1, &fragment_shader_src_ptr, NULL);
-  glCompileShader(depth_color_fragment_shader_);
-
-  GLint compiled;
-  glGetShaderiv(depth_color_fragment_shader_, GL_COMPILE_STATUS, &compiled);
-  if (!compiled) {
-    GLint length;
-    glGetShaderiv(depth_color_fragment_shader_, GL_INFO_LOG_LENGTH, &length);
-    std::unique_ptr<GLchar[]> log(
-        reinterpret_cast<GLchar*>(new uint8_t[length]));
-    glGetShaderInfoLog(depth_color_fragment_shader_, length, &length, log.get());
-    LOG(FATAL) << "GL Shader Compilation Error: " << log.get();
-  }
-}
-
-void MeshRenderer::CreateDepthAndColorProgram() {
-  depth_color_shader_program_ = glCreateProgram();
-  glAttachShader(depth_color_shader_program_, depth_color_fragment_shader_);
-  glAttachShader(depth_color_shader_program_, depth_color_vertex_shader_);
-  glLinkProgram(depth_color_shader_program_);
-
-  GLint linked;
-  glGetProgramiv(depth_color_shader_program_, GL_LINK_STATUS, &linked);
-  if (!linked) {
-    GLint length;
-    glGetProgramiv(depth_color_shader_program_, GL_INFO_LOG_LENGTH, &length);
-    std::unique_ptr<GLchar[]> log(
-        reinterpret_cast<GLchar*>(new uint8_t[length]));
-    glGetProgramInfoLog(depth_color_shader_program_, length, &length, log.get());
-    LOG(FATAL) << "GL Program Linker Error: " << log.get();
-  }
+  depth_color_shader_program_ =
+      program_cache_->GetProgram(vertex_shader_src, fragment_shader_src);
 
   glUseProgram(depth_color_shader_program_);
   CHECK_OPENGL_NO_ERROR();
@@ -808,16 +798,87 @@ void MeshRenderer::CreateDepthAndColorProgram() {
   CHECK_OPENGL_NO_ERROR();
 }
 
-void MeshRenderer::SetupProjection(
+void MeshRenderer::CreateMultiViewProgram() {
+  // The views are drawn as separate instances of the mesh. Each instance
+  // uses the matrices of its view and is moved into the part of the render
+  // target which belongs to the view.
+  const std::string view_count = std::to_string(view_count_);
+  const std::string vertex_shader_src =
+      "#version 300 es\n"
+      "uniform mat4 u_model_view_matrix[" + view_count + "];\n"
+      "uniform mat4 u_projection_matrix[" + view_count + "];\n"
+      "in vec4 in_position;\n"
+      "in float in_intensity;\n"
+      "out float var_depth;\n"
+      "out float var_intensity;\n"
+      "flat out int var_view;\n"
+      "void main() {\n"
+      "   var_view = gl_InstanceID;\n"
+      "   var_intensity = in_intensity;\n"
+      "   vec4 local_point = u_model_view_matrix[gl_InstanceID] * in_position;\n"
+      "   local_point.xyz /= local_point.w;\n"
+      "   var_depth = local_point.z;\n"
+      "   local_point.w = 1.0;\n"
+      "   gl_Position = u_projection_matrix[gl_InstanceID] * local_point;\n"
+      "   gl_Position.y = (gl_Position.y + (float(2 * gl_InstanceID + 1) - " + view_count + ".0) * gl_Position.w) / " + view_count + ".0;\n"
+      "}\n";
+
+  // Triangles are only clipped against the whole render target, so fragments
+  // which fall into other views are discarded here.
+  const std::string fragment_shader_src =
+      "#version 300 es\n"
+      "uniform int u_view_height;\n"
+      "in highp float var_depth;\n"
+      "in lowp float var_intensity;\n"
+      "flat in int var_view;\n"
+      "layout(location = 0) out highp float out_depth;\n"
+      "layout(location = 1) out lowp float out_intensity;\n"
+      "void main()\n"
+      "{\n"
+      "   if (int(gl_FragCoord.y) / u_view_height != var_view) {\n"
+      "     discard;\n"
+      "   }\n"
+      "   out_depth = var_depth;\n"
+      "   out_intensity = (var_intensity > 0.0) ? 1.0 : 0.0;\n"
+      "}\n";
+
+  multi_view_shader_program_ =
+      program_cache_->GetProgram(vertex_shader_src, fragment_shader_src);
+
+  glUseProgram(multi_view_shader_program_);
+  CHECK_OPENGL_NO_ERROR();
+
+  // Get attributes.
+  multi_view_a_position_location_ = glGetAttribLocation(multi_view_shader_program_, "in_position");
+  CHECK_OPENGL_NO_ERROR();
+  CHECK_GE(multi_view_a_position_location_, 0) << "Attribute needs to be used";
+  multi_view_a_intensity_location_ = glGetAttribLocation(multi_view_shader_program_, "in_intensity");
+  CHECK_OPENGL_NO_ERROR();
+  CHECK_GE(multi_view_a_intensity_location_, 0) << "Attribute needs to be used";
+
+  multi_view_u_model_view_matrix_location_ =
+      glGetUniformLocation(multi_view_shader_program_, "u_model_view_matrix");
+  CHECK_OPENGL_NO_ERROR();
+
+  multi_view_u_projection_matrix_location_ =
+      glGetUniformLocation(multi_view_shader_program_, "u_projection_matrix");
+  CHECK_OPENGL_NO_ERROR();
+  
+  multi_view_u_view_height_location_ =
+      glGetUniformLocation(multi_view_shader_program_, "u_view_height");
+  CHECK_OPENGL_NO_ERROR();
+}
+
+void MeshRenderer::ComputeProjection(
     const Sophus::SE3f& transformation,
     const float fx, const float fy, const float cx, const float cy,
-    float min_depth, float max_depth, GLint u_projection_matrix_location,
-    GLint u_model_view_matrix_location) {
+    float min_depth, float max_depth,
+    float* projection_matrix, float* model_view_matrix) {
   CHECK_GT(max_depth, min_depth);
   CHECK_GT(min_depth, 0);
 
   // Row-wise projection matrix construction.
-  float matrix[16];
+  float* matrix = projection_matrix;
   matrix[0] = (2 * fx) / width_;
   matrix[4] = 0;
   matrix[8] = 2 * (0.5f + cx) / width_ - 1.0f;
@@ -838,10 +899,8 @@ void MeshRenderer::SetupProjection(
   matrix[11] = 1;
   matrix[15] = 0;
 
-  glUniformMatrix4fv(u_projection_matrix_location, 1, GL_FALSE, matrix);
-  CHECK_OPENGL_NO_ERROR();
-
   // Model-view matrix construction.
+  matrix = model_view_matrix;
   for (int i = 0; i < 3; i++) {
     for (int j = 0; j < 3; j++) {
       matrix[i + j * 4] = transformation.rotationMatrix()(i, j);
@@ -852,8 +911,22 @@ void MeshRenderer::SetupProjection(
   matrix[7] = 0;
   matrix[11] = 0;
   matrix[15] = 1;
+}
+
+void MeshRenderer::SetupProjection(
+    const Sophus::SE3f& transformation,
+    const float fx, const float fy, const float cx, const float cy,
+    float min_depth, float max_depth, GLint u_projection_matrix_location,
+    GLint u_model_view_matrix_location) {
+  float projection_matrix[16];
+  float model_view_matrix[16];
+  ComputeProjection(transformation, fx, fy, cx, cy, min_depth, max_depth,
+                    projection_matrix, model_view_matrix);
+  
+  glUniformMatrix4fv(u_projection_matrix_location, 1, GL_FALSE, projection_matrix);
+  CHECK_OPENGL_NO_ERROR();
 
-  glUniformMatrix4fv(u_model_view_matrix_location, 1, GL_FALSE, matrix);
+  glUniformMatrix4fv(u_model_view_matrix_location, 1, GL_FALSE, model_view_matrix);
   CHECK_OPENGL_NO_ERROR();
 
   // Set viewport.
@@ -868,4 +941,9 @@ int MeshRenderer::GetIndexCount(int width, int height) {
   return quad_index_count + newline_index_count + kStartIndexCount;
 }
 
+int MeshRenderer::GetMaxTriangleIndexCount(int width, int height) {
+  constexpr int kIndicesPerQuad = 6;
+  return (width - 1) * (height - 1) * kIndicesPerQuad;
+}
+
 }  // namespace view_correction
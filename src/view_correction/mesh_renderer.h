@@ -38,11 +38,16 @@
 #include <GL/gl.h>
 #endif
 
+#include <memory>
+
 #include <cuda_gl_interop.h>
 #include <cuda_runtime.h>
 #include <sophus/se3.hpp>
 
+#include "view_correction/cuda_interop_cache.h"
 #include "view_correction/forward_declarations.h"
+#include "view_correction/shader_program_cache.h"
+#include "view_correction/view_frustum.h"
 
 namespace view_correction {
 
@@ -60,7 +65,14 @@ class MeshRenderer {
   
   // Creates OpenGL objects
   // (i.e., must be called with the correct OpenGL context).
-  MeshRenderer(int width, int height, Type type);
+  // With a view_count larger than 1 (only supported for
+  // kRenderDepthAndIntensity), the render target holds this number of views
+  // of the given size stacked vertically, which are rendered together by
+  // RenderMeshViews(). The shader programs are taken from program_cache if
+  // given (which must outlive the renderer), such that they are shared with
+  // other renderers, and compiled for this renderer otherwise.
+  MeshRenderer(int width, int height, Type type, int view_count = 1,
+               ShaderProgramCache* program_cache = nullptr);
 
   // Destructor.
   ~MeshRenderer();
@@ -69,20 +81,37 @@ class MeshRenderer {
   // transformed into the target camera frame with the given transformation.
   // min_depth and max_depth give the z range for the view frustum used for
   // rendering. Their units correspond to what is passed in for camera poses
-  // and vertices.
+  // and vertices. mode is the primitive type of the index buffer, either
+  // GL_TRIANGLE_STRIP or GL_TRIANGLES.
   void RenderMesh(
       GLuint vertex_buffer, GLuint color_buffer, GLuint index_buffer,
-      int num_indices,
+      int num_indices, GLenum mode,
       const Sophus::SE3f& transformation,
       const float fx, const float fy, const float cx, const float cy,
       float min_depth, float max_depth);
   
+  // Variant of RenderMesh() which renders the mesh into the first count views
+  // (at most view_count) with a single instanced draw call. The arrays give
+  // the parameters of each view. The results must be retrieved with
+  // CopyDepthAndIntensityResults().
+  void RenderMeshViews(
+      int count,
+      GLuint vertex_buffer, GLuint color_buffer, GLuint index_buffer,
+      int num_indices, GLenum mode,
+      const Sophus::SE3f* transformations,
+      const float* fx, const float* fy, const float* cx, const float* cy,
+      float min_depth, float max_depth);
+  
   void BeginRenderingMeshesDepth(
       const Sophus::SE3f& transformation,
       const float fx, const float fy, const float cx, const float cy,
       float min_depth, float max_depth);
   void RenderMeshDepth(
       const void* vertex_data, const void* face_data, int num_faces);
+  // Variant for meshes stored in buffer objects (see MeshChunkCache), which
+  // avoids copying the mesh to the GPU for every draw.
+  void RenderMeshDepth(
+      GLuint vertex_buffer, GLuint index_buffer, int num_faces);
   void EndRenderingMeshesDepth();
   
   void BeginRenderingMeshesDepthAndColor(
@@ -91,14 +120,24 @@ class MeshRenderer {
       float min_depth, float max_depth);
   void RenderMeshDepthAndColor(
       const void* vertex_data, const void* color_data, const void* face_data, int num_faces);
+  void RenderMeshDepthAndColor(
+      GLuint vertex_buffer, GLuint color_buffer, GLuint index_buffer, int num_faces);
   void EndRenderingMeshesDepthAndColor();
 
+  // Returns the view frustum of rendering with the given parameters (as passed
+  // to the BeginRendering functions), for culling geometry before drawing it.
+  ViewFrustum GetViewFrustum(
+      const Sophus::SE3f& transformation,
+      const float fx, const float fy, const float cx, const float cy,
+      float min_depth, float max_depth) const;
+  
   // Returns the result color resource as a cudaGraphicsResource_t.
   cudaGraphicsResource_t result_resource_depth() const;
   cudaGraphicsResource_t result_resource_intensity() const;
 
   // Waits for the result to be available and returns it as a CUDA texture.
-  // Call UnmapResult() when finished with using the result.
+  // Call UnmapResult() when finished with using the result. The texture
+  // objects are owned by the renderer and are re-used across frames.
   cudaTextureObject_t MapDepthResultAsTexture(
       cudaTextureAddressMode address_mode_x,
       cudaTextureAddressMode address_mode_y, cudaTextureFilterMode filter_mode,
@@ -113,34 +152,60 @@ class MeshRenderer {
       cudaTextureAddressMode address_mode_y, cudaTextureFilterMode filter_mode,
       cudaTextureReadMode read_mode,
       bool normalized_coordinate_access, cudaStream_t stream);
+  
+  // Maps the depth and intensity results with a single call. Call
+  // UnmapDepthAndIntensityResults() when finished with using them.
+  void MapDepthAndIntensityResultsAsTextures(
+      cudaTextureAddressMode address_mode_x,
+      cudaTextureAddressMode address_mode_y, cudaTextureFilterMode filter_mode,
+      cudaTextureReadMode intensity_read_mode,
+      bool normalized_coordinate_access, cudaStream_t stream,
+      cudaTextureObject_t* depth_texture,
+      cudaTextureObject_t* intensity_texture);
 
   void UnmapDepthResult(cudaTextureObject_t texture, cudaStream_t stream);
   void UnmapIntensityResult(cudaTextureObject_t texture, cudaStream_t stream);
   void UnmapColorResult(cudaTextureObject_t texture, cudaStream_t stream);
+  void UnmapDepthAndIntensityResults(cudaStream_t stream);
   
+  // Copies the depth and intensity results of the first count views into the
+  // given buffers (one per view), mapping the results only once for all views.
+  void CopyDepthAndIntensityResults(
+      cudaStream_t stream,
+      int count,
+      CUDABuffer<float>* const depth[],
+      CUDABuffer<uint8_t>* const intensity[]);
+  
+  // Returns the number of indices of the triangle strip for a depth map of
+  // the given size, as output by MeshDepthmapCUDA().
   static int GetIndexCount(int width, int height);
+  
+  // Returns the maximum number of indices of the triangle list for a depth
+  // map of the given size, as output by MeshDepthmapCUDA() with compaction.
+  static int GetMaxTriangleIndexCount(int width, int height);
 
  private:
   void CreateFrameBufferObject(Type type);
   
-  void CreateVertexShader();
-  void CreateFragmentShader();
   void CreateProgram();
-  
-  void CreateDepthVertexShader();
-  void CreateDepthFragmentShader();
   void CreateDepthProgram();
-  
-  void CreateDepthAndColorVertexShader();
-  void CreateDepthAndColorFragmentShader();
   void CreateDepthAndColorProgram();
+  void CreateMultiViewProgram();
 
+  void ComputeProjection(const Sophus::SE3f& transformation,
+                         const float fx, const float fy, const float cx,
+                         const float cy, float min_depth, float max_depth,
+                         float* projection_matrix, float* model_view_matrix);
   void SetupProjection(const Sophus::SE3f& transformation,
                        const float fx, const float fy, const float cx,
                        const float cy, float min_depth, float max_depth,
                        GLint u_projection_matrix_location,
                        GLint u_model_view_matrix_location);
 
+  // Owned by the renderer if no program cache was given to the constructor.
+  std::unique_ptr<ShaderProgramCache> own_program_cache_;
+  ShaderProgramCache* program_cache_;
+  
   // Rendering target.
   GLuint frame_buffer_object_;
   GLuint depth_buffer_;
@@ -148,10 +213,10 @@ class MeshRenderer {
   GLuint rendertarget_1_texture_;
   cudaGraphicsResource_t rendertarget_0_resource_cuda_;
   cudaGraphicsResource_t rendertarget_1_resource_cuda_;
+  CUDAArrayObjectCache rendertarget_0_object_cache_;
+  CUDAArrayObjectCache rendertarget_1_object_cache_;
   
   // Depth + color shader.
-  GLuint depth_color_fragment_shader_;
-  GLuint depth_color_vertex_shader_;
   GLuint depth_color_shader_program_;
   GLint depth_color_a_position_location_;
   GLint depth_color_a_color_location_;
@@ -159,8 +224,6 @@ class MeshRenderer {
   GLint depth_color_u_projection_matrix_location_;
 
   // Depth + intensity shader.
-  GLuint fragment_shader_;
-  GLuint vertex_shader_;
   GLuint shader_program_;
   GLint a_position_location_;
   GLint a_intensity_location_;
@@ -168,16 +231,23 @@ class MeshRenderer {
   GLint u_projection_matrix_location_;
   
   // Depth shader.
-  GLuint depth_fragment_shader_;
-  GLuint depth_vertex_shader_;
   GLuint depth_shader_program_;
   GLint depth_a_position_location_;
   GLint depth_u_model_view_matrix_location_;
   GLint depth_u_projection_matrix_location_;
+  
+  // Multi-view depth + intensity shader.
+  GLuint multi_view_shader_program_;
+  GLint multi_view_a_position_location_;
+  GLint multi_view_a_intensity_location_;
+  GLint multi_view_u_model_view_matrix_location_;
+  GLint multi_view_u_projection_matrix_location_;
+  GLint multi_view_u_view_height_location_;
 
   // Settings.
   int width_;
-  int height_;
+  int height_;  // Height of a single view.
+  int view_count_;
   Type type_;
 };
 
@@ -0,0 +1,180 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "view_correction/meshing_scheduler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#include <glog/logging.h>
+
+namespace view_correction {
+
+namespace {
+
+// Distance between the compared depth samples in pixels.
+constexpr int kDepthSampleStep = 8;
+
+// A depth sample counts as changed if its validity changed, or if it changed
+// by more than this fraction of its depth or by at least the minimum.
+constexpr float kRelativeDepthChange = 0.02f;
+constexpr int kMinDepthChangeMillimeters = 10;
+
+// Minimum change score for meshing frames in unused GPU time.
+constexpr float kMinScoreWithinBudget = 0.25f;
+
+// Weight of a new sample in the moving averages of the GPU times.
+constexpr float kTimeAveragingWeight = 0.1f;
+
+inline void UpdateAverage(float sample, float* average) {
+  if (*average < 0) {
+    *average = sample;
+  } else {
+    *average += kTimeAveragingWeight * (sample - *average);
+  }
+}
+
+}  // namespace
+
+MeshingScheduler::MeshingScheduler(
+    float max_rotation_deg, float max_translation,
+    float max_depth_change_ratio, int max_skipped_frames, float budget_ms)
+    : max_rotation_deg_(max_rotation_deg),
+      max_translation_(max_translation),
+      max_depth_change_ratio_(max_depth_change_ratio),
+      max_skipped_frames_(max_skipped_frames),
+      budget_ms_(budget_ms),
+      have_reference_(false),
+      reference_depth_width_(0),
+      reference_depth_height_(0),
+      average_meshing_time_ms_(-1),
+      average_rendering_time_ms_(-1),
+      skipped_in_a_row_(0),
+      last_change_score_(0),
+      last_depth_change_ratio_(0),
+      meshed_frame_count_(0),
+      skipped_frame_count_(0) {
+  CHECK_GT(max_rotation_deg, 0);
+  CHECK_GT(max_translation, 0);
+  CHECK_GT(max_depth_change_ratio, 0);
+  CHECK_GE(max_skipped_frames, 0);
+  CHECK_GE(budget_ms, 0);
+}
+
+bool MeshingScheduler::ShouldMesh(
+    const Sophus::SE3f& G_T_C, const cv::Mat_<uint16_t>& depth_image) {
+  bool mesh = true;
+  if (have_reference_) {
+    const Sophus::SE3f motion = reference_G_T_C_.inverse() * G_T_C;
+    const float rotation_deg = motion.so3().log().norm() * 180.f / M_PI;
+    const float translation = motion.translation().norm();
+    last_depth_change_ratio_ = ComputeDepthChangeRatio(depth_image);
+    last_change_score_ = std::max(
+        std::max(rotation_deg / max_rotation_deg_, translation / max_translation_),
+        last_depth_change_ratio_ / max_depth_change_ratio_);
+    
+    const bool within_budget =
+        budget_ms_ > 0 &&
+        average_meshing_time_ms_ >= 0 && average_rendering_time_ms_ >= 0 &&
+        average_meshing_time_ms_ + average_rendering_time_ms_ <= budget_ms_;
+    mesh = last_change_score_ >= 1 ||
+           (max_skipped_frames_ > 0 && skipped_in_a_row_ >= max_skipped_frames_) ||
+           (within_budget && last_change_score_ >= kMinScoreWithinBudget);
+  } else {
+    last_change_score_ = 0;
+    last_depth_change_ratio_ = 0;
+  }
+  
+  if (!mesh) {
+    ++ skipped_in_a_row_;
+    ++ skipped_frame_count_;
+    return false;
+  }
+  
+  have_reference_ = true;
+  reference_G_T_C_ = G_T_C;
+  SetReferenceDepth(depth_image);
+  skipped_in_a_row_ = 0;
+  ++ meshed_frame_count_;
+  return true;
+}
+
+void MeshingScheduler::AddMeshingTime(float milliseconds) {
+  UpdateAverage(milliseconds, &average_meshing_time_ms_);
+}
+
+void MeshingScheduler::AddRenderingTime(float milliseconds) {
+  UpdateAverage(milliseconds, &average_rendering_time_ms_);
+}
+
+float MeshingScheduler::ComputeDepthChangeRatio(
+    const cv::Mat_<uint16_t>& depth_image) const {
+  if (depth_image.empty() ||
+      depth_image.cols != reference_depth_width_ ||
+      depth_image.rows != reference_depth_height_) {
+    return 0;
+  }
+  
+  int changed_count = 0;
+  const uint16_t* reference_sample = reference_depth_samples_.data();
+  for (int y = kDepthSampleStep / 2; y < depth_image.rows; y += kDepthSampleStep) {
+    const uint16_t* row = depth_image[y];
+    for (int x = kDepthSampleStep / 2; x < depth_image.cols; x += kDepthSampleStep) {
+      const int depth = row[x];
+      const int reference_depth = *reference_sample;
+      ++ reference_sample;
+      if ((depth == 0) != (reference_depth == 0)) {
+        ++ changed_count;
+      } else if (depth != 0) {
+        const int threshold = std::max(
+            kMinDepthChangeMillimeters,
+            static_cast<int>(kRelativeDepthChange * reference_depth));
+        if (std::abs(depth - reference_depth) > threshold) {
+          ++ changed_count;
+        }
+      }
+    }
+  }
+  return reference_depth_samples_.empty() ? 0.f :
+      changed_count / static_cast<float>(reference_depth_samples_.size());
+}
+
+void MeshingScheduler::SetReferenceDepth(const cv::Mat_<uint16_t>& depth_image) {
+  reference_depth_width_ = depth_image.cols;
+  reference_depth_height_ = depth_image.rows;
+  reference_depth_samples_.clear();
+  for (int y = kDepthSampleStep / 2; y < depth_image.rows; y += kDepthSampleStep) {
+    const uint16_t* row = depth_image[y];
+    for (int x = kDepthSampleStep / 2; x < depth_image.cols; x += kDepthSampleStep) {
+      reference_depth_samples_.push_back(row[x]);
+    }
+  }
+}
+
+}  // namespace view_correction
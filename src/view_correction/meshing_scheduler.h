@@ -0,0 +1,115 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef VIEW_CORRECTION_MESHING_SCHEDULER_H_
+#define VIEW_CORRECTION_MESHING_SCHEDULER_H_
+
+#include <cstdint>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <sophus/se3.hpp>
+
+namespace view_correction {
+
+// Decides for each new depth and color input frame whether the source frame
+// is meshed again, or whether the current mesh is kept. For a static scene
+// observed from a barely moving camera, re-meshing mostly reproduces the
+// current mesh, so this GPU time is saved.
+//
+// A frame is compared with the frame of the current mesh. Its change score is
+// the maximum of the camera rotation, the camera translation and the fraction
+// of changed depth samples, each relative to its threshold. With a score of
+// at least one, the frame is meshed. Below that, it is still meshed if
+// max_skipped_frames frames have been skipped in a row (such that the color
+// stays up to date), or if the score is at least a quarter and the average
+// GPU times of meshing and of the target frame pipeline fit into the budget
+// together.
+//
+// Not thread-safe.
+class MeshingScheduler {
+ public:
+  // A budget_ms of 0 disables meshing because of unused GPU time.
+  MeshingScheduler(float max_rotation_deg, float max_translation,
+                   float max_depth_change_ratio, int max_skipped_frames,
+                   float budget_ms);
+  
+  // Decides whether the frame with the given pose and depth image (in
+  // millimeters) is meshed. If it is, the frame becomes the reference for the
+  // following decisions. The depth image may be empty if it is not in host
+  // memory, in which case the depth change is not taken into account.
+  bool ShouldMesh(const Sophus::SE3f& G_T_C, const cv::Mat_<uint16_t>& depth_image);
+  
+  // Add the measured GPU times of meshing a source frame and of the target
+  // frame pipeline.
+  void AddMeshingTime(float milliseconds);
+  void AddRenderingTime(float milliseconds);
+  
+  // Values from the last call to ShouldMesh().
+  inline float last_change_score() const { return last_change_score_; }
+  inline float last_depth_change_ratio() const { return last_depth_change_ratio_; }
+  
+  inline int64_t meshed_frame_count() const { return meshed_frame_count_; }
+  inline int64_t skipped_frame_count() const { return skipped_frame_count_; }
+  
+ private:
+  // Returns the fraction of depth samples which changed compared to the
+  // reference samples.
+  float ComputeDepthChangeRatio(const cv::Mat_<uint16_t>& depth_image) const;
+  
+  // Stores the depth samples of the given image as the reference.
+  void SetReferenceDepth(const cv::Mat_<uint16_t>& depth_image);
+  
+  float max_rotation_deg_;
+  float max_translation_;
+  float max_depth_change_ratio_;
+  int max_skipped_frames_;
+  float budget_ms_;
+  
+  // The frame of the current mesh.
+  bool have_reference_;
+  Sophus::SE3f reference_G_T_C_;
+  int reference_depth_width_;
+  int reference_depth_height_;
+  std::vector<uint16_t> reference_depth_samples_;
+  
+  // Exponential moving averages of the GPU times, negative until the first
+  // sample.
+  float average_meshing_time_ms_;
+  float average_rendering_time_ms_;
+  
+  int skipped_in_a_row_;
+  float last_change_score_;
+  float last_depth_change_ratio_;
+  int64_t meshed_frame_count_;
+  int64_t skipped_frame_count_;
+};
+
+}  // namespace view_correction
+
+#endif  // VIEW_CORRECTION_MESHING_SCHEDULER_H_
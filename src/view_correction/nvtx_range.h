@@ -0,0 +1,123 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef VIEW_CORRECTION_NVTX_RANGE_H_
+#define VIEW_CORRECTION_NVTX_RANGE_H_
+
+#include <stdint.h>
+
+#ifdef VIEW_CORRECTION_NVTX
+#include <nvToolsExt.h>
+#endif
+
+namespace view_correction {
+
+// Annotations for the timeline of profilers such as Nsight Systems. They only
+// have an effect if the VIEW_CORRECTION_NVTX CMake option is enabled, which
+// links against the NVTX library. Otherwise, all functions are empty and are
+// compiled out.
+
+// Adds a marker with a named integer value (for example, an iteration count)
+// at the current time on the calling thread. Markers which are added while a
+// range is open are shown within that range.
+inline void AddNVTXValue(const char* name, int64_t value) {
+#ifdef VIEW_CORRECTION_NVTX
+  nvtxEventAttributes_t attributes = {0};
+  attributes.version = NVTX_VERSION;
+  attributes.size = NVTX_EVENT_ATTRIB_STRUCT_SIZE;
+  attributes.payloadType = NVTX_PAYLOAD_TYPE_INT64;
+  attributes.payload.llValue = value;
+  attributes.messageType = NVTX_MESSAGE_TYPE_ASCII;
+  attributes.message.ascii = name;
+  nvtxMarkEx(&attributes);
+#else
+  (void) name;
+  (void) value;
+#endif
+}
+
+// Marks a named range on the calling thread, from the construction of the
+// object until its destruction or until End() is called. Ranges may be nested.
+// The name must be a string literal (or otherwise outlive the range). The
+// range's color is derived from the name, such that the same stage has the
+// same color in every frame.
+class NVTXRange {
+ public:
+  explicit NVTXRange(const char* name) {
+#ifdef VIEW_CORRECTION_NVTX
+    // FNV-1a hash of the name for choosing the color.
+    uint32_t hash = 2166136261u;
+    for (const char* c = name; *c; ++ c) {
+      hash = (hash ^ static_cast<uint8_t>(*c)) * 16777619u;
+    }
+    nvtxEventAttributes_t attributes = {0};
+    attributes.version = NVTX_VERSION;
+    attributes.size = NVTX_EVENT_ATTRIB_STRUCT_SIZE;
+    attributes.colorType = NVTX_COLOR_ARGB;
+    attributes.color = 0xff000000u | (hash & 0x00ffffffu) | 0x00404040u;
+    attributes.messageType = NVTX_MESSAGE_TYPE_ASCII;
+    attributes.message.ascii = name;
+    nvtxRangePushEx(&attributes);
+    open_ = true;
+#else
+    (void) name;
+#endif
+  }
+  
+  ~NVTXRange() {
+    End();
+  }
+  
+  // Adds a named value to the range, see AddNVTXValue().
+  inline void AddValue(const char* name, int64_t value) const {
+    AddNVTXValue(name, value);
+  }
+  
+  // Ends the range before the object is destroyed. Does nothing if the range
+  // has already ended.
+  inline void End() {
+#ifdef VIEW_CORRECTION_NVTX
+    if (open_) {
+      nvtxRangePop();
+      open_ = false;
+    }
+#endif
+  }
+  
+ private:
+  NVTXRange(const NVTXRange&) = delete;
+  NVTXRange& operator=(const NVTXRange&) = delete;
+  
+#ifdef VIEW_CORRECTION_NVTX
+  bool open_;
+#endif
+};
+
+}  // namespace view_correction
+
+#endif  // VIEW_CORRECTION_NVTX_RANGE_H_
@@ -0,0 +1,214 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "view_correction/offscreen_context.h"
+
+#include <cstring>
+#include <vector>
+
+#include <EGL/eglext.h>
+#include <GL/glew.h>
+#include <glog/logging.h>
+
+namespace view_correction {
+
+namespace {
+
+// Returns whether the space-separated extension list contains the extension.
+bool HasExtension(const char* extensions, const char* extension) {
+  if (!extensions) {
+    return false;
+  }
+  const size_t length = strlen(extension);
+  for (const char* start = extensions; (start = strstr(start, extension)) != nullptr; start += length) {
+    if ((start == extensions || start[-1] == ' ') &&
+        (start[length] == ' ' || start[length] == '\0')) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns the EGL device which is the given CUDA device, or EGL_NO_DEVICE_EXT.
+EGLDeviceEXT FindEGLDevice(int cuda_device) {
+  PFNEGLQUERYDEVICESEXTPROC eglQueryDevicesEXT =
+      reinterpret_cast<PFNEGLQUERYDEVICESEXTPROC>(
+          eglGetProcAddress("eglQueryDevicesEXT"));
+  PFNEGLQUERYDEVICEATTRIBEXTPROC eglQueryDeviceAttribEXT =
+      reinterpret_cast<PFNEGLQUERYDEVICEATTRIBEXTPROC>(
+          eglGetProcAddress("eglQueryDeviceAttribEXT"));
+  PFNEGLQUERYDEVICESTRINGEXTPROC eglQueryDeviceStringEXT =
+      reinterpret_cast<PFNEGLQUERYDEVICESTRINGEXTPROC>(
+          eglGetProcAddress("eglQueryDeviceStringEXT"));
+  if (!eglQueryDevicesEXT || !eglQueryDeviceAttribEXT || !eglQueryDeviceStringEXT) {
+    LOG(ERROR) << "EGL_EXT_device_enumeration is not available.";
+    return EGL_NO_DEVICE_EXT;
+  }
+  
+  EGLint device_count;
+  if (!eglQueryDevicesEXT(0, nullptr, &device_count) || device_count <= 0) {
+    LOG(ERROR) << "No EGL devices found.";
+    return EGL_NO_DEVICE_EXT;
+  }
+  std::vector<EGLDeviceEXT> devices(device_count);
+  eglQueryDevicesEXT(device_count, devices.data(), &device_count);
+  
+  for (EGLint i = 0; i < device_count; ++ i) {
+    // Match by the CUDA device index which NVIDIA's driver reports for its
+    // devices (EGL_NV_device_cuda).
+    const char* extensions = eglQueryDeviceStringEXT(devices[i], EGL_EXTENSIONS);
+    if (!HasExtension(extensions, "EGL_NV_device_cuda")) {
+      continue;
+    }
+    EGLAttrib device_cuda_device;
+    if (eglQueryDeviceAttribEXT(devices[i], EGL_CUDA_DEVICE_NV, &device_cuda_device) &&
+        device_cuda_device == cuda_device) {
+      return devices[i];
+    }
+  }
+  LOG(ERROR) << "No EGL device found for CUDA device " << cuda_device << ".";
+  return EGL_NO_DEVICE_EXT;
+}
+
+}  // namespace
+
+OffscreenContext::OffscreenContext()
+    : display_(EGL_NO_DISPLAY),
+      context_(EGL_NO_CONTEXT) {}
+
+OffscreenContext::~OffscreenContext() {
+  if (context_ != EGL_NO_CONTEXT) {
+    if (eglGetCurrentContext() == context_) {
+      ReleaseCurrent();
+    }
+    eglDestroyContext(display_, context_);
+  }
+  if (display_ != EGL_NO_DISPLAY) {
+    eglTerminate(display_);
+  }
+}
+
+bool OffscreenContext::Create(int cuda_device) {
+  CHECK(context_ == EGL_NO_CONTEXT) << "The context was created already.";
+  
+  EGLDeviceEXT device = FindEGLDevice(cuda_device);
+  if (device == EGL_NO_DEVICE_EXT) {
+    return false;
+  }
+  PFNEGLGETPLATFORMDISPLAYEXTPROC eglGetPlatformDisplayEXT =
+      reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
+          eglGetProcAddress("eglGetPlatformDisplayEXT"));
+  if (!eglGetPlatformDisplayEXT) {
+    LOG(ERROR) << "EGL_EXT_platform_base is not available.";
+    return false;
+  }
+  display_ = eglGetPlatformDisplayEXT(EGL_PLATFORM_DEVICE_EXT, device, nullptr);
+  EGLint major_version;
+  EGLint minor_version;
+  if (display_ == EGL_NO_DISPLAY ||
+      !eglInitialize(display_, &major_version, &minor_version)) {
+    LOG(ERROR) << "Cannot initialize the EGL display (error 0x" << std::hex
+               << eglGetError() << std::dec << ").";
+    display_ = EGL_NO_DISPLAY;
+    return false;
+  }
+  if (!HasExtension(eglQueryString(display_, EGL_EXTENSIONS),
+                    "EGL_KHR_surfaceless_context")) {
+    LOG(ERROR) << "EGL_KHR_surfaceless_context is not available.";
+    return false;
+  }
+  
+  // The configuration is only used for creating the context, since there is
+  // no surface.
+  const EGLint config_attributes[] = {
+      EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+      EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+      EGL_RED_SIZE, 8,
+      EGL_GREEN_SIZE, 8,
+      EGL_BLUE_SIZE, 8,
+      EGL_DEPTH_SIZE, 24,
+      EGL_NONE};
+  EGLConfig config;
+  EGLint config_count;
+  if (!eglChooseConfig(display_, config_attributes, &config, 1, &config_count) ||
+      config_count < 1) {
+    LOG(ERROR) << "No suitable EGL configuration found.";
+    return false;
+  }
+  
+  if (!eglBindAPI(EGL_OPENGL_API)) {
+    LOG(ERROR) << "Cannot bind the OpenGL API.";
+    return false;
+  }
+  context_ = eglCreateContext(display_, config, EGL_NO_CONTEXT, nullptr);
+  if (context_ == EGL_NO_CONTEXT) {
+    LOG(ERROR) << "Cannot create the EGL context (error 0x" << std::hex
+               << eglGetError() << std::dec << ").";
+    return false;
+  }
+  if (!MakeCurrent()) {
+    return false;
+  }
+  
+  // GLEW is usually built for GLX, in which case glewInit() loads the OpenGL
+  // functions and then fails to find a GLX display, which does not matter
+  // here.
+  glewExperimental = GL_TRUE;
+  GLenum glew_result = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+  if (glew_result == GLEW_ERROR_NO_GLX_DISPLAY) {
+    glew_result = GLEW_OK;
+  }
+#endif
+  if (glew_result != GLEW_OK) {
+    LOG(ERROR) << "Cannot initialize GLEW: " << glewGetErrorString(glew_result);
+    return false;
+  }
+  // glewInit() may leave an error behind.
+  while (glGetError() != GL_NO_ERROR);
+  
+  LOG(INFO) << "Created offscreen OpenGL context with EGL " << major_version
+            << "." << minor_version << " on CUDA device " << cuda_device
+            << ": " << glGetString(GL_RENDERER);
+  return true;
+}
+
+bool OffscreenContext::MakeCurrent() {
+  if (!eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE, context_)) {
+    LOG(ERROR) << "Cannot make the EGL context current (error 0x" << std::hex
+               << eglGetError() << std::dec << ").";
+    return false;
+  }
+  return true;
+}
+
+void OffscreenContext::ReleaseCurrent() {
+  eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+}
+
+}  // namespace view_correction
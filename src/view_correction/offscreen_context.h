@@ -0,0 +1,74 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef VIEW_CORRECTION_OFFSCREEN_CONTEXT_H_
+#define VIEW_CORRECTION_OFFSCREEN_CONTEXT_H_
+
+#include <EGL/egl.h>
+
+namespace view_correction {
+
+// OpenGL context without a window or a display server, for running the view
+// correction on headless GPU servers (see --vc_headless). The context is
+// created with EGL on the device platform (EGL_EXT_platform_device) for the
+// GPU which is the given CUDA device, such that the CUDA-OpenGL interop
+// stays on one GPU. It uses the desktop OpenGL API and has no surface
+// (EGL_KHR_surfaceless_context), i.e., there is no default framebuffer and
+// all rendering must go to framebuffer objects.
+//
+// Several contexts may be created in one process, for example one per
+// session, each made current on the thread which renders with it.
+class OffscreenContext {
+ public:
+  OffscreenContext();
+  
+  // Destroys the context if it was created.
+  ~OffscreenContext();
+  
+  // Creates the context for the given CUDA device, makes it current on the
+  // calling thread and initializes GLEW for it. Returns false if no suitable
+  // EGL device or configuration is available.
+  bool Create(int cuda_device);
+  
+  // Makes the context current on the calling thread.
+  bool MakeCurrent();
+  
+  // Releases the context from the calling thread.
+  void ReleaseCurrent();
+  
+ private:
+  OffscreenContext(const OffscreenContext&) = delete;
+  OffscreenContext& operator=(const OffscreenContext&) = delete;
+  
+  EGLDisplay display_;
+  EGLContext context_;
+};
+
+}  // namespace view_correction
+
+#endif  // VIEW_CORRECTION_OFFSCREEN_CONTEXT_H_
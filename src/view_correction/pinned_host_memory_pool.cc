@@ -0,0 +1,116 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "view_correction/pinned_host_memory_pool.h"
+
+#include <glog/logging.h>
+
+#include "view_correction/cuda_util.h"
+
+namespace view_correction {
+
+PinnedHostMemoryPool::PinnedHostMemoryPool(size_t slab_size, int slab_count)
+    : slab_size_(slab_size),
+      state_(new State()) {
+  CHECK_GT(slab_count, 0);
+  state_->next_slab_index = 0;
+  state_->exhausted_count = 0;
+  state_->slabs.resize(slab_count);
+  for (Slab& slab : state_->slabs) {
+    void* memory;
+    CUDA_CHECKED_CALL(cudaHostAlloc(&memory, slab_size, cudaHostAllocPortable));
+    slab.memory = static_cast<uint8_t*>(memory);
+    CUDA_CHECKED_CALL(cudaEventCreateWithFlags(&slab.last_use_event, cudaEventDisableTiming));
+    slab.in_use = false;
+  }
+}
+
+PinnedHostMemoryPool::State::~State() {
+  for (Slab& slab : slabs) {
+    cudaEventSynchronize(slab.last_use_event);
+    cudaEventDestroy(slab.last_use_event);
+    cudaFreeHost(slab.memory);
+  }
+}
+
+std::shared_ptr<uint8_t> PinnedHostMemoryPool::Acquire() {
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  const int slab_count = state_->slabs.size();
+  for (int i = 0; i < slab_count; ++ i) {
+    const int slab_index = (state_->next_slab_index + i) % slab_count;
+    Slab& slab = state_->slabs[slab_index];
+    if (slab.in_use) {
+      continue;
+    }
+    cudaError_t status = cudaEventQuery(slab.last_use_event);
+    if (status == cudaErrorNotReady) {
+      continue;
+    }
+    CUDA_CHECKED_CALL(status);
+    
+    slab.in_use = true;
+    state_->next_slab_index = (slab_index + 1) % slab_count;
+    std::shared_ptr<State> state = state_;
+    return std::shared_ptr<uint8_t>(slab.memory, [state, slab_index](uint8_t* /*memory*/) {
+      std::lock_guard<std::mutex> lock(state->mutex);
+      state->slabs[slab_index].in_use = false;
+    });
+  }
+  ++ state_->exhausted_count;
+  return std::shared_ptr<uint8_t>();
+}
+
+void PinnedHostMemoryPool::RecordUse(const void* address, cudaStream_t stream) {
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  const int slab_index = FindSlab(address);
+  CHECK_GE(slab_index, 0) << "Address is not in a slab of this pool.";
+  CUDA_CHECKED_CALL(cudaEventRecord(state_->slabs[slab_index].last_use_event, stream));
+}
+
+int PinnedHostMemoryPool::exhausted_count() const {
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  return state_->exhausted_count;
+}
+
+bool PinnedHostMemoryPool::Contains(const void* address) const {
+  // The slab addresses never change, so no locking is required.
+  return FindSlab(address) >= 0;
+}
+
+int PinnedHostMemoryPool::FindSlab(const void* address) const {
+  const uint8_t* byte_address = static_cast<const uint8_t*>(address);
+  for (int i = 0; i < static_cast<int>(state_->slabs.size()); ++ i) {
+    const uint8_t* memory = state_->slabs[i].memory;
+    if (byte_address >= memory && byte_address < memory + slab_size_) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+}  // namespace view_correction
@@ -0,0 +1,97 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef VIEW_CORRECTION_PINNED_HOST_MEMORY_POOL_H_
+#define VIEW_CORRECTION_PINNED_HOST_MEMORY_POOL_H_
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <cuda_runtime.h>
+
+namespace view_correction {
+
+// Ring of equally sized slabs of page-locked (pinned) host memory. Transfers
+// between pinned memory and the GPU are truly asynchronous, while transfers
+// from pageable memory are staged by the driver and serialize with the host.
+// Slabs can either be used to store input images directly (such that they
+// can be uploaded without staging), or as staging memory for pageable data.
+//
+// Thread-safe. Slabs which were handed out may outlive the pool.
+class PinnedHostMemoryPool {
+ public:
+  // Allocates slab_count slabs of slab_size bytes each.
+  PinnedHostMemoryPool(size_t slab_size, int slab_count);
+  
+  // Returns a free slab, or null if all slabs are in use. A slab is free if
+  // no copy of the returned pointer exists anymore and all transfers recorded
+  // for it with RecordUse() have completed. Slabs are handed out in ring
+  // order to give pending transfers the most time to complete.
+  std::shared_ptr<uint8_t> Acquire();
+  
+  // Records that a transfer accessing the slab that contains address was
+  // enqueued on the stream. The slab will not be handed out again before
+  // that transfer has completed.
+  void RecordUse(const void* address, cudaStream_t stream);
+  
+  // Returns whether address points into one of the slabs.
+  bool Contains(const void* address) const;
+  
+  // Returns the number of calls to Acquire() which returned null.
+  int exhausted_count() const;
+  
+  inline size_t slab_size() const { return slab_size_; }
+  inline int slab_count() const { return state_->slabs.size(); }
+  
+ private:
+  struct Slab {
+    uint8_t* memory;
+    cudaEvent_t last_use_event;
+    bool in_use;
+  };
+  
+  struct State {
+    ~State();
+    
+    std::mutex mutex;
+    std::vector<Slab> slabs;
+    int next_slab_index;
+    int exhausted_count;
+  };
+  
+  int FindSlab(const void* address) const;
+  
+  size_t slab_size_;
+  // Shared with the deleters of the handed out slabs.
+  std::shared_ptr<State> state_;
+};
+
+}  // namespace view_correction
+
+#endif  // VIEW_CORRECTION_PINNED_HOST_MEMORY_POOL_H_
@@ -0,0 +1,124 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "view_correction/pose_history.h"
+
+#include <algorithm>
+
+#include <glog/logging.h>
+#include <sophus/interpolate.hpp>
+
+namespace view_correction {
+
+PoseHistory::PoseHistory(int capacity)
+    : poses_(capacity),
+      begin_(0),
+      size_(0) {
+  CHECK_GT(capacity, 0);
+}
+
+void PoseHistory::AddPose(const Sophus::SE3f& G_T_C, uint64_t timestamp_ns) {
+  if (size_ > 0 && timestamp_ns <= pose(size_ - 1).timestamp_ns) {
+    return;
+  }
+  
+  if (size_ == static_cast<int>(poses_.size())) {
+    begin_ = (begin_ + 1) % poses_.size();
+    -- size_;
+  }
+  TimestampedPose& new_pose = poses_[(begin_ + size_) % poses_.size()];
+  new_pose.G_T_C = G_T_C;
+  new_pose.timestamp_ns = timestamp_ns;
+  ++ size_;
+}
+
+bool PoseHistory::GetLatestPose(Sophus::SE3f* G_T_C, uint64_t* timestamp_ns) const {
+  if (size_ == 0) {
+    return false;
+  }
+  *G_T_C = pose(size_ - 1).G_T_C;
+  *timestamp_ns = pose(size_ - 1).timestamp_ns;
+  return true;
+}
+
+bool PoseHistory::GetPose(uint64_t timestamp_ns, uint64_t max_extrapolation_ns,
+                          Sophus::SE3f* G_T_C) const {
+  if (size_ == 0) {
+    return false;
+  }
+  
+  const TimestampedPose& oldest = pose(0);
+  const TimestampedPose& latest = pose(size_ - 1);
+  if (timestamp_ns <= oldest.timestamp_ns) {
+    *G_T_C = oldest.G_T_C;
+    return true;
+  }
+  
+  if (timestamp_ns >= latest.timestamp_ns) {
+    if (size_ == 1) {
+      *G_T_C = latest.G_T_C;
+      return true;
+    }
+    
+    // Extrapolate with the relative motion between the two latest poses.
+    // Sophus::interpolate() only supports factors in [0, 1], so this applies
+    // the same formula with a factor larger than 1.
+    const TimestampedPose& previous = pose(size_ - 2);
+    const uint64_t extrapolation_ns =
+        std::min(timestamp_ns - latest.timestamp_ns, max_extrapolation_ns);
+    const double factor = extrapolation_ns /
+        static_cast<double>(latest.timestamp_ns - previous.timestamp_ns);
+    *G_T_C = latest.G_T_C * Sophus::SE3f::exp(
+        static_cast<float>(factor) *
+        (previous.G_T_C.inverse() * latest.G_T_C).log());
+    return true;
+  }
+  
+  // Binary search for the first pose which is newer than the timestamp. Since
+  // the timestamp is within (oldest, latest), this is in [1, size_ - 1].
+  int first = 1;
+  int last = size_ - 1;
+  while (first < last) {
+    int middle = (first + last) / 2;
+    if (pose(middle).timestamp_ns <= timestamp_ns) {
+      first = middle + 1;
+    } else {
+      last = middle;
+    }
+  }
+  
+  const TimestampedPose& previous = pose(first - 1);
+  const TimestampedPose& next = pose(first);
+  const double factor = (timestamp_ns - previous.timestamp_ns) /
+      static_cast<double>(next.timestamp_ns - previous.timestamp_ns);
+  *G_T_C = Sophus::interpolate(previous.G_T_C, next.G_T_C,
+                               static_cast<float>(factor));
+  return true;
+}
+
+}  // namespace view_correction
@@ -0,0 +1,86 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef VIEW_CORRECTION_POSE_HISTORY_H_
+#define VIEW_CORRECTION_POSE_HISTORY_H_
+
+#include <cstdint>
+#include <vector>
+
+#include <sophus/se3.hpp>
+
+namespace view_correction {
+
+// Bounded history of timestamped camera poses which allows to query the pose
+// at arbitrary points in time. Between two recorded poses, the pose is
+// interpolated on SE3. After the latest recorded pose, it is extrapolated with
+// the constant velocity given by the two latest poses. This is used to predict
+// the pose at the time at which a rendered frame will be displayed.
+//
+// Not thread-safe.
+class PoseHistory {
+ public:
+  // Keeps at most capacity poses, dropping the oldest ones.
+  explicit PoseHistory(int capacity);
+  
+  // Records the camera-to-global transformation G_T_C at the given timestamp.
+  // Poses which are not newer than the latest recorded pose are ignored.
+  void AddPose(const Sophus::SE3f& G_T_C, uint64_t timestamp_ns);
+  
+  // Returns the latest recorded pose. Returns false if no pose was recorded
+  // yet.
+  bool GetLatestPose(Sophus::SE3f* G_T_C, uint64_t* timestamp_ns) const;
+  
+  // Returns the pose at the given timestamp. Extrapolation is limited to at
+  // most max_extrapolation_ns after the latest pose, and no extrapolation is
+  // done before the oldest pose. Returns false if no pose was recorded yet.
+  bool GetPose(uint64_t timestamp_ns, uint64_t max_extrapolation_ns,
+               Sophus::SE3f* G_T_C) const;
+  
+  inline int size() const { return size_; }
+  
+ private:
+  struct TimestampedPose {
+    Sophus::SE3f G_T_C;
+    uint64_t timestamp_ns;
+  };
+  
+  // Returns the i-th oldest pose.
+  inline const TimestampedPose& pose(int i) const {
+    return poses_[(begin_ + i) % poses_.size()];
+  }
+  
+  // Ring buffer of poses with size_ valid entries starting at begin_.
+  std::vector<TimestampedPose> poses_;
+  int begin_;
+  int size_;
+};
+
+}  // namespace view_correction
+
+#endif  // VIEW_CORRECTION_POSE_HISTORY_H_
@@ -28,12 +28,17 @@
 
 #include "view_correction/position_receiver.h"
 
+#include <algorithm>
 #include <arpa/inet.h>
+#include <chrono>
+#include <errno.h>
 #include <glog/logging.h>
 #include <limits>
 #include <netinet/in.h>
+#include <poll.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <unistd.h>
 
 namespace view_correction {
 
@@ -43,12 +48,37 @@ struct UDPPosePacket {
       quaternion_x, quaternion_y, quaternion_z, quaternion_w;
 };
 
+// Maximum number of packets received with one recvmmsg() call.
+static constexpr int kReceiveBatchSize = 32;
+
+constexpr int PositionReceiver::kHistorySize;
+
 PositionReceiver::PositionReceiver()
-    : received_any_observer_position_(false),
-      last_received_pose_timestamp_(-std::numeric_limits<float>::infinity()),
-      udp_socket_fd_(-1) {}
+    : last_received_pose_timestamp_(-std::numeric_limits<float>::infinity()),
+      sequence_(0),
+      published_(0),
+      udp_socket_fd_(-1),
+      quit_requested_(false) {
+  pending_history_.count = 0;
+  history_.count = 0;
+  wake_pipe_fds_[0] = -1;
+  wake_pipe_fds_[1] = -1;
+}
 
 PositionReceiver::~PositionReceiver() {
+  if (receive_thread_) {
+    quit_requested_ = true;
+    const char wake_byte = 0;
+    if (write(wake_pipe_fds_[1], &wake_byte, 1) != 1) {
+      LOG(ERROR) << "Cannot wake up the pose receive thread.";
+    }
+    receive_thread_->join();
+  }
+  for (int i = 0; i < 2; ++ i) {
+    if (wake_pipe_fds_[i] >= 0) {
+      close(wake_pipe_fds_[i]);
+    }
+  }
   if (udp_socket_fd_ >= 0) {
     close(udp_socket_fd_);
   }
@@ -76,70 +106,188 @@ bool PositionReceiver::Initialize(uint16_t port) {
 }
 
 void PositionReceiver::StartReceiveThread() {
+  if (pipe(wake_pipe_fds_) != 0) {
+    LOG(FATAL) << "Cannot create the wake-up pipe of the pose receive thread.";
+  }
   receive_thread_.reset(new std::thread(
       std::bind(&PositionReceiver::ReceiveThreadMain, this)));
 }
 
 void PositionReceiver::ReceiveNonBlocking() {
-  constexpr int kBufferSize = 1024;
-  uint8_t buffer[kBufferSize];
+  ReceivePendingPackets();
+}
+
+void PositionReceiver::AddObserverPose(
+    const Sophus::SE3f& G_T_observer, uint64_t receive_timestamp_ns) {
+  ObserverPose& pose =
+      pending_history_.poses[pending_history_.count % kHistorySize];
+  pose.G_T_observer = G_T_observer;
+  pose.sender_timestamp = 0;
+  pose.receive_timestamp_ns = receive_timestamp_ns;
+  ++ pending_history_.count;
+  PublishPendingHistory();
+}
+
+bool PositionReceiver::GetLatestObserverPose(ObserverPose* pose) const {
+  if (!received_any_observer_position()) {
+    return false;
+  }
+  History history;
+  ReadHistory(&history);
+  *pose = history.poses[(history.count - 1) % kHistorySize];
+  return true;
+}
+
+void PositionReceiver::GetObserverPoseHistory(
+    std::vector<ObserverPose>* history) const {
+  history->clear();
+  if (!received_any_observer_position()) {
+    return;
+  }
+  History copy;
+  ReadHistory(&copy);
+  const uint64_t size = std::min<uint64_t>(copy.count, kHistorySize);
+  history->reserve(size);
+  for (uint64_t i = copy.count - size; i < copy.count; ++ i) {
+    history->push_back(copy.poses[i % kHistorySize]);
+  }
+}
+
+void PositionReceiver::ReadHistory(History* history) const {
   while (true) {
-    int received_bytes = recv(udp_socket_fd_, buffer, kBufferSize, MSG_DONTWAIT);
-    if (received_bytes <= 0) {
-      break;
+    const uint32_t sequence_before = sequence_.load(std::memory_order_acquire);
+    if (sequence_before & 1) {
+      // A write is in progress.
+      std::this_thread::yield();
+      continue;
+    }
+    *history = history_;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (sequence_.load(std::memory_order_relaxed) == sequence_before) {
+      return;
+    }
+  }
+}
+
+void PositionReceiver::ReceiveThreadMain() {
+  struct pollfd poll_fds[2];
+  poll_fds[0].fd = udp_socket_fd_;
+  poll_fds[0].events = POLLIN;
+  poll_fds[1].fd = wake_pipe_fds_[0];
+  poll_fds[1].events = POLLIN;
+  
+  while (!quit_requested_) {
+    // Block until a packet arrives or the thread is asked to quit.
+    if (poll(poll_fds, 2, -1) < 0) {
+      if (errno != EINTR) {
+        PLOG(ERROR) << "poll() on the pose socket failed, stopping to receive poses";
+        return;
+      }
+      continue;
+    }
+    if (quit_requested_ || (poll_fds[1].revents & POLLIN)) {
+      return;
     }
     
-    if (received_bytes == sizeof(UDPPosePacket)) {
-      UDPPosePacket* packet = reinterpret_cast<UDPPosePacket*>(buffer);
-      
-      LOG(INFO) << "Received pose message with timestamp: " << packet->timestamp;
-      if (packet->timestamp <= last_received_pose_timestamp_) {
-        // Packets may arrive out of order with UDP. Skip old packets.
-        LOG(INFO) << "Received out-of-order pose message.";
-        continue;
+    if (poll_fds[0].revents & (POLLIN | POLLERR)) {
+      if (!ReceivePendingPackets()) {
+        // Prevent spinning on a persistent error.
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
       }
-      
-      std::unique_lock<std::mutex> lock(access_mutex_);
-      received_any_observer_position_= true;
-      last_received_pose_timestamp_ = packet->timestamp;
-      last_received_observer_position_ =
-          Eigen::Vector3f(packet->position_x_meters, packet->position_y_meters,
-                          packet->position_z_meters);
-    } else {
-      LOG(WARNING) << "Received message on pose port with wrong size.";
     }
   }
 }
 
-void PositionReceiver::ReceiveThreadMain() {
-  constexpr int kBufferSize = 1024;
-  uint8_t buffer[kBufferSize];
+bool PositionReceiver::ReceivePendingPackets() {
+  // One extra byte per buffer to detect packets which are too large.
+  constexpr int kBufferSize = sizeof(UDPPosePacket) + 1;
+  uint8_t buffers[kReceiveBatchSize][kBufferSize];
+  struct iovec iovecs[kReceiveBatchSize];
+  struct mmsghdr messages[kReceiveBatchSize];
+  
+  bool success = true;
+  bool have_new_poses = false;
   while (true) {
-    int received_bytes = recv(udp_socket_fd_, buffer, kBufferSize, 0);
-    if (received_bytes <= 0) {
-      continue;
+    memset(messages, 0, sizeof(messages));
+    for (int i = 0; i < kReceiveBatchSize; ++ i) {
+      iovecs[i].iov_base = buffers[i];
+      iovecs[i].iov_len = kBufferSize;
+      messages[i].msg_hdr.msg_iov = &iovecs[i];
+      messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    
+    const int message_count = recvmmsg(udp_socket_fd_, messages,
+                                       kReceiveBatchSize, MSG_DONTWAIT, nullptr);
+    if (message_count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        PLOG(WARNING) << "Receiving pose messages failed";
+        success = false;
+      }
+      break;
     }
     
-    if (received_bytes == sizeof(UDPPosePacket)) {
-      UDPPosePacket* packet = reinterpret_cast<UDPPosePacket*>(buffer);
+    const uint64_t receive_timestamp_ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    for (int m = 0; m < message_count; ++ m) {
+      if (messages[m].msg_len != sizeof(UDPPosePacket) ||
+          (messages[m].msg_hdr.msg_flags & MSG_TRUNC)) {
+        LOG(WARNING) << "Received message on pose port with wrong size.";
+        continue;
+      }
+      UDPPosePacket packet;
+      memcpy(&packet, buffers[m], sizeof(UDPPosePacket));
       
-      LOG(INFO) << "Received pose message with timestamp: " << packet->timestamp;
-      if (packet->timestamp <= last_received_pose_timestamp_) {
+      VLOG(2) << "Received pose message with timestamp: " << packet.timestamp;
+      if (packet.timestamp <= last_received_pose_timestamp_) {
         // Packets may arrive out of order with UDP. Skip old packets.
-        LOG(INFO) << "Received out-of-order pose message.";
+        VLOG(1) << "Received out-of-order pose message.";
         continue;
       }
+      last_received_pose_timestamp_ = packet.timestamp;
+      
+      Eigen::Quaternionf rotation(packet.quaternion_w, packet.quaternion_x,
+                                  packet.quaternion_y, packet.quaternion_z);
+      if (!(rotation.squaredNorm() > 1e-6f)) {
+        // Some senders only fill in the position.
+        rotation = Eigen::Quaternionf::Identity();
+      }
+      rotation.normalize();
       
-      std::unique_lock<std::mutex> lock(access_mutex_);
-      received_any_observer_position_= true;
-      last_received_pose_timestamp_ = packet->timestamp;
-      last_received_observer_position_ =
-          Eigen::Vector3f(packet->position_x_meters, packet->position_y_meters,
-                          packet->position_z_meters);
-    } else {
-      LOG(WARNING) << "Received message on pose port with wrong size.";
+      ObserverPose& pose =
+          pending_history_.poses[pending_history_.count % kHistorySize];
+      pose.G_T_observer = Sophus::SE3f(
+          rotation, Eigen::Vector3f(packet.position_x_meters,
+                                    packet.position_y_meters,
+                                    packet.position_z_meters));
+      pose.sender_timestamp = packet.timestamp;
+      pose.receive_timestamp_ns = receive_timestamp_ns;
+      ++ pending_history_.count;
+      have_new_poses = true;
+    }
+    
+    if (message_count < kReceiveBatchSize) {
+      break;
     }
   }
+  
+  // Publish all new poses at once.
+  if (have_new_poses) {
+    PublishPendingHistory();
+  }
+  return success;
+}
+
+void PositionReceiver::PublishPendingHistory() {
+  const uint32_t sequence = sequence_.load(std::memory_order_relaxed);
+  sequence_.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  history_ = pending_history_;
+  sequence_.store(sequence + 2, std::memory_order_release);
+  published_.store(pending_history_.count, std::memory_order_release);
 }
 
 }  // namespace view_correction
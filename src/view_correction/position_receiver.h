@@ -29,43 +29,105 @@
 #ifndef VIEW_CORRECTION_POSITION_RECEIVER_H_
 #define VIEW_CORRECTION_POSITION_RECEIVER_H_
 
-#include <mutex>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
 #include <thread>
+#include <vector>
 
-#include <Eigen/Core>
+#include <sophus/se3.hpp>
 
 namespace view_correction {
 
+// Observer pose as received from the UDP pose server.
+struct ObserverPose {
+  // Transformation from the observer frame to the global frame.
+  Sophus::SE3f G_T_observer;
+  
+  // Timestamp given by the sender (in the sender's time base).
+  float sender_timestamp;
+  
+  // Time at which the packet was received, in nanoseconds of
+  // std::chrono::steady_clock. All packets received in one batch share it.
+  uint64_t receive_timestamp_ns;
+};
+
+// Receives observer poses over UDP. The latest poses are kept in a small
+// history which is published with a seqlock: the receiving side never waits
+// for the readers, and the readers never take a lock (they only retry in the
+// rare case that a batch of poses was published while they were copying).
+//
+// The receiving side (StartReceiveThread(), ReceiveNonBlocking() or
+// AddObserverPose()) must only be used from one thread at a time, while the
+// accessors may be called from any thread.
 class PositionReceiver {
  public:
+  // Number of poses kept in the history.
+  static constexpr int kHistorySize = 16;
+  
   PositionReceiver();
   ~PositionReceiver();
   
   bool Initialize(uint16_t port);
   
-  // Call only one of the following.
+  // Call only one of the following. The receive thread is stopped by the
+  // destructor.
   void StartReceiveThread();
   void ReceiveNonBlocking();
   
+  // Alternative to receiving the poses over UDP (without calling
+  // Initialize()): publishes a pose from another source, for example a
+  // replayed session. receive_timestamp_ns is in nanoseconds of
+  // std::chrono::steady_clock like for the received poses.
+  void AddObserverPose(const Sophus::SE3f& G_T_observer, uint64_t receive_timestamp_ns);
+  
+  // Returns the latest received pose. Returns false if no pose was received
+  // yet.
+  bool GetLatestObserverPose(ObserverPose* pose) const;
+  
+  // Returns the retained poses, ordered from the oldest to the latest one.
+  void GetObserverPoseHistory(std::vector<ObserverPose>* history) const;
+  
   inline bool received_any_observer_position() const {
-    std::unique_lock<std::mutex> lock(access_mutex_);
-    return received_any_observer_position_;
-  }
-  inline const Eigen::Vector3f last_received_observer_position() const {
-    std::unique_lock<std::mutex> lock(access_mutex_);
-    return last_received_observer_position_;
+    return published_.load(std::memory_order_acquire) > 0;
   }
   
  private:
+  struct History {
+    std::array<ObserverPose, kHistorySize> poses;
+    // Total number of poses added so far. The latest one is at index
+    // (count - 1) % kHistorySize.
+    uint64_t count;
+  };
+  
   void ReceiveThreadMain();
   
-  bool received_any_observer_position_;
+  // Receives all pending packets with as few system calls as possible and
+  // publishes the new poses. Returns false if the socket returned an error
+  // other than having no more data.
+  bool ReceivePendingPackets();
+  
+  // Publishes pending_history_ to the readers.
+  void PublishPendingHistory();
+  
+  // Copies the published history, retrying if it changes while copying.
+  void ReadHistory(History* history) const;
+  
+  // Receiving side state.
   float last_received_pose_timestamp_;
-  Eigen::Vector3f last_received_observer_position_;
+  History pending_history_;
+  
+  // Published state. sequence_ is odd while history_ is being written.
+  std::atomic<uint32_t> sequence_;
+  History history_;
+  std::atomic<uint64_t> published_;
   
   int udp_socket_fd_;
   
-  mutable std::mutex access_mutex_;
+  // Written to wake up the receive thread for shutdown.
+  int wake_pipe_fds_[2];
+  std::atomic<bool> quit_requested_;
   std::unique_ptr<std::thread> receive_thread_;
 };
 
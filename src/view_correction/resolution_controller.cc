@@ -0,0 +1,141 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "view_correction/resolution_controller.h"
+
+#include <algorithm>
+#include <sstream>
+
+#include <glog/logging.h>
+
+namespace view_correction {
+
+namespace {
+
+// Number of frame time samples after a resolution change which may still
+// stem from frames at the previous resolution. The frame timings are
+// collected one frame late, and the change itself takes effect in the
+// following frame.
+constexpr int kSamplesToSkipAfterChange = 2;
+
+inline int PixelCount(const TargetResolution& resolution) {
+  return resolution.width * resolution.height;
+}
+
+}  // namespace
+
+ResolutionController::ResolutionController(
+    const std::vector<TargetResolution>& ladder, int initial_level,
+    float budget_ms, float upscale_fraction, int window_size)
+    : ladder_(ladder),
+      budget_ms_(budget_ms),
+      upscale_fraction_(upscale_fraction),
+      window_size_(window_size) {
+  CHECK(!ladder_.empty());
+  CHECK_GE(initial_level, 0);
+  CHECK_LT(initial_level, static_cast<int>(ladder_.size()));
+  CHECK_GT(budget_ms, 0);
+  CHECK_GT(upscale_fraction, 0);
+  CHECK_LE(upscale_fraction, 1);
+  CHECK_GE(window_size, 1);
+  ChangeLevel(initial_level);
+}
+
+bool ResolutionController::AddFrameTime(float milliseconds) {
+  if (samples_to_skip_ > 0) {
+    -- samples_to_skip_;
+    return false;
+  }
+  
+  window_sum_ms_ += milliseconds;
+  ++ window_count_;
+  if (window_count_ < window_size_) {
+    return false;
+  }
+  
+  const double mean_ms = window_sum_ms_ / window_count_;
+  window_sum_ms_ = 0;
+  window_count_ = 0;
+  if (mean_ms > budget_ms_ && level_ > 0) {
+    ChangeLevel(level_ - 1);
+    return true;
+  }
+  if (level_ + 1 < static_cast<int>(ladder_.size())) {
+    // Assume that the time scales with the pixel count.
+    const double predicted_ms = mean_ms *
+        PixelCount(ladder_[level_ + 1]) / static_cast<double>(PixelCount(ladder_[level_]));
+    if (predicted_ms < upscale_fraction_ * budget_ms_) {
+      ChangeLevel(level_ + 1);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ResolutionController::ParseLadder(
+    const std::string& text, std::vector<TargetResolution>* ladder) {
+  ladder->clear();
+  std::istringstream stream(text);
+  std::string entry;
+  while (std::getline(stream, entry, ',')) {
+    TargetResolution resolution;
+    char separator;
+    std::istringstream entry_stream(entry);
+    if (!(entry_stream >> resolution.width >> separator >> resolution.height) ||
+        separator != 'x' || resolution.width <= 0 || resolution.height <= 0) {
+      return false;
+    }
+    ladder->push_back(resolution);
+  }
+  std::sort(ladder->begin(), ladder->end(),
+            [](const TargetResolution& a, const TargetResolution& b) {
+              return PixelCount(a) < PixelCount(b);
+            });
+  return !ladder->empty();
+}
+
+int ResolutionController::FindLevel(
+    const std::vector<TargetResolution>& ladder,
+    const TargetResolution& resolution) {
+  int level = 0;
+  for (int i = 0; i < static_cast<int>(ladder.size()); ++ i) {
+    if (PixelCount(ladder[i]) <= PixelCount(resolution)) {
+      level = i;
+    }
+  }
+  return level;
+}
+
+void ResolutionController::ChangeLevel(int level) {
+  level_ = level;
+  window_sum_ms_ = 0;
+  window_count_ = 0;
+  samples_to_skip_ = kSamplesToSkipAfterChange;
+}
+
+}  // namespace view_correction
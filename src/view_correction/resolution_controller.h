@@ -0,0 +1,98 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef VIEW_CORRECTION_RESOLUTION_CONTROLLER_H_
+#define VIEW_CORRECTION_RESOLUTION_CONTROLLER_H_
+
+#include <string>
+#include <vector>
+
+namespace view_correction {
+
+struct TargetResolution {
+  int width;
+  int height;
+};
+
+// Chooses the target frame render resolution from a ladder of resolutions
+// such that the GPU time of the target frame pipeline stays within a budget.
+// The frame times are averaged over a window of frames. If the average
+// exceeds the budget, the next lower resolution is chosen. If the average,
+// scaled to the pixel count of the next higher resolution, stays below
+// upscale_fraction times the budget, the next higher resolution is chosen.
+// This gap between the thresholds, and restarting the window after each
+// change, avoids oscillating between two resolutions.
+//
+// Not thread-safe.
+class ResolutionController {
+ public:
+  // The ladder must be ordered by increasing pixel count.
+  // initial_level is the index of the starting resolution in the ladder.
+  ResolutionController(const std::vector<TargetResolution>& ladder,
+                       int initial_level, float budget_ms,
+                       float upscale_fraction, int window_size);
+  
+  // Adds the measured GPU time of one target frame. Returns true if the
+  // resolution changed. The given number of samples after a change are
+  // ignored, since they may still stem from frames at the previous
+  // resolution.
+  bool AddFrameTime(float milliseconds);
+  
+  // Parses a comma-separated list of resolutions such as "480x300,640x400"
+  // and sorts it by pixel count. Returns false if the list cannot be parsed.
+  static bool ParseLadder(const std::string& text,
+                          std::vector<TargetResolution>* ladder);
+  
+  // Returns the index of the ladder entry with the largest pixel count which
+  // does not exceed the one of the given resolution, or 0 if there is none.
+  static int FindLevel(const std::vector<TargetResolution>& ladder,
+                       const TargetResolution& resolution);
+  
+  inline const TargetResolution& resolution() const { return ladder_[level_]; }
+  inline const std::vector<TargetResolution>& ladder() const { return ladder_; }
+  inline int level() const { return level_; }
+  
+ private:
+  void ChangeLevel(int level);
+  
+  std::vector<TargetResolution> ladder_;
+  int level_;
+  float budget_ms_;
+  float upscale_fraction_;
+  int window_size_;
+  
+  // Sum and number of the frame times in the current window.
+  double window_sum_ms_;
+  int window_count_;
+  // Number of samples to ignore before starting the window.
+  int samples_to_skip_;
+};
+
+}  // namespace view_correction
+
+#endif  // VIEW_CORRECTION_RESOLUTION_CONTROLLER_H_
@@ -0,0 +1,502 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "view_correction/session_file.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <glog/logging.h>
+
+namespace view_correction {
+
+namespace {
+
+constexpr char kSessionMagic[8] = {'V', 'C', 'S', 'E', 'S', 'S', 'N', '\0'};
+constexpr uint32_t kSessionVersion = 2;
+
+// Values of SessionIndexEntry::type.
+constexpr uint32_t kSessionDepthImageRecord = 0;
+constexpr uint32_t kSessionColorImageRecord = 1;
+constexpr uint32_t kSessionCameraPoseRecord = 2;
+constexpr uint32_t kSessionObserverPoseRecord = 3;
+
+// Header at the start of the file.
+struct SessionFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t index_entry_count;
+  // Zero while the recording is not closed.
+  uint64_t index_offset;
+  // Intrinsics as (width, height) and (fx, fy, cx, cy, k1, k2, k3).
+  int32_t depth_size[2];
+  float depth_parameters[7];
+  int32_t color_size[2];
+  float color_parameters[7];
+};
+
+static_assert(sizeof(SessionFileHeader) == 96, "Unexpected header padding");
+static_assert(sizeof(SessionIndexEntry) == 72, "Unexpected index entry padding");
+
+void WriteIntrinsics(const Intrinsics& intrinsics, int32_t* size, float* parameters) {
+  size[0] = intrinsics.width;
+  size[1] = intrinsics.height;
+  parameters[0] = intrinsics.fx;
+  parameters[1] = intrinsics.fy;
+  parameters[2] = intrinsics.cx;
+  parameters[3] = intrinsics.cy;
+  parameters[4] = intrinsics.k1;
+  parameters[5] = intrinsics.k2;
+  parameters[6] = intrinsics.k3;
+}
+
+Intrinsics ReadIntrinsics(const int32_t* size, const float* parameters) {
+  Intrinsics intrinsics;
+  intrinsics.width = size[0];
+  intrinsics.height = size[1];
+  intrinsics.fx = parameters[0];
+  intrinsics.fy = parameters[1];
+  intrinsics.cx = parameters[2];
+  intrinsics.cy = parameters[3];
+  intrinsics.k1 = parameters[4];
+  intrinsics.k2 = parameters[5];
+  intrinsics.k3 = parameters[6];
+  return intrinsics;
+}
+
+void WritePose(const Sophus::SE3f& pose, float* data) {
+  const Eigen::Vector3f& translation = pose.translation();
+  const Eigen::Quaternionf& rotation = pose.unit_quaternion();
+  data[0] = translation.x();
+  data[1] = translation.y();
+  data[2] = translation.z();
+  data[3] = rotation.x();
+  data[4] = rotation.y();
+  data[5] = rotation.z();
+  data[6] = rotation.w();
+}
+
+Sophus::SE3f ReadPose(const float* data) {
+  return Sophus::SE3f(
+      Eigen::Quaternionf(data[6], data[3], data[4], data[5]).normalized(),
+      Eigen::Vector3f(data[0], data[1], data[2]));
+}
+
+// Pads the file to the next multiple of kSessionDataAlignment.
+void WritePadding(std::ofstream* file, uint64_t* file_size) {
+  static const char kZeros[kSessionDataAlignment] = {0};
+  const uint64_t padding =
+      (kSessionDataAlignment - *file_size % kSessionDataAlignment) % kSessionDataAlignment;
+  file->write(kZeros, padding);
+  *file_size += padding;
+}
+
+}  // namespace
+
+SessionRecorder::SessionRecorder(int max_queued_images)
+    : max_queued_images_(max_queued_images),
+      queued_image_count_(0),
+      dropped_image_count_(0),
+      open_(false),
+      quit_requested_(false),
+      last_observer_pose_timestamp_(0),
+      file_size_(0),
+      write_failed_(false) {
+  CHECK_GT(max_queued_images, 0);
+}
+
+SessionRecorder::~SessionRecorder() {
+  Close();
+}
+
+bool SessionRecorder::Open(const std::string& path,
+                           const Intrinsics& depth_intrinsics,
+                           const Intrinsics& color_intrinsics) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  CHECK(!open_);
+  file_.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!file_) {
+    LOG(ERROR) << "Cannot create session file: " << path;
+    return false;
+  }
+  
+  // The index location is filled in when closing.
+  SessionFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kSessionMagic, sizeof(header.magic));
+  header.version = kSessionVersion;
+  WriteIntrinsics(depth_intrinsics, header.depth_size, header.depth_parameters);
+  WriteIntrinsics(color_intrinsics, header.color_size, header.color_parameters);
+  file_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file_size_ = sizeof(header);
+  WritePadding(&file_, &file_size_);
+  write_failed_ = !file_;
+  if (write_failed_) {
+    file_.close();
+    return false;
+  }
+  
+  index_.clear();
+  queued_image_count_ = 0;
+  dropped_image_count_ = 0;
+  last_observer_pose_timestamp_ = 0;
+  open_ = true;
+  quit_requested_ = false;
+  lock.unlock();
+  writer_thread_.reset(new std::thread(
+      std::bind(&SessionRecorder::WriterThreadMain, this)));
+  return true;
+}
+
+bool SessionRecorder::Close() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!open_) {
+    return false;
+  }
+  
+  // Let the writer thread write the remaining queued records and exit.
+  open_ = false;
+  quit_requested_ = true;
+  queue_condition_.notify_all();
+  lock.unlock();
+  writer_thread_->join();
+  writer_thread_.reset();
+  lock.lock();
+  
+  // Append the index and point the header to it.
+  const uint64_t index_offset = file_size_;
+  const uint32_t index_entry_count = index_.size();
+  file_.write(reinterpret_cast<const char*>(index_.data()),
+              index_.size() * sizeof(SessionIndexEntry));
+  file_.seekp(offsetof(SessionFileHeader, index_entry_count));
+  file_.write(reinterpret_cast<const char*>(&index_entry_count), sizeof(index_entry_count));
+  file_.seekp(offsetof(SessionFileHeader, index_offset));
+  file_.write(reinterpret_cast<const char*>(&index_offset), sizeof(index_offset));
+  write_failed_ |= !file_;
+  file_.close();
+  
+  if (dropped_image_count_ > 0) {
+    LOG(WARNING) << "Dropped " << dropped_image_count_ << " images from the"
+                 << " session recording since the writer could not keep up.";
+  }
+  if (write_failed_) {
+    LOG(ERROR) << "Writing the session file failed.";
+    return false;
+  }
+  LOG(INFO) << "Recorded " << index_.size() << " records to the session file.";
+  return true;
+}
+
+int SessionRecorder::record_count() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return index_.size() + queue_.size();
+}
+
+int SessionRecorder::dropped_image_count() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return dropped_image_count_;
+}
+
+void SessionRecorder::AddDepthImage(const DepthImage& image) {
+  SessionIndexEntry entry;
+  memset(&entry, 0, sizeof(entry));
+  entry.type = kSessionDepthImageRecord;
+  entry.timestamp_ns = image.timestamp_ns();
+  
+  std::lock_guard<std::mutex> lock(mutex_);
+  QueueRecord(entry, image);
+}
+
+void SessionRecorder::AddColorImage(const ColorImage& image) {
+  SessionIndexEntry entry;
+  memset(&entry, 0, sizeof(entry));
+  entry.type = kSessionColorImageRecord;
+  entry.timestamp_ns = image.timestamp_ns();
+  WritePose(image.G_T_C(), entry.pose);
+  
+  std::lock_guard<std::mutex> lock(mutex_);
+  QueueRecord(entry, image);
+}
+
+void SessionRecorder::AddCameraPose(const Sophus::SE3f& G_T_C, uint64_t timestamp_ns) {
+  SessionIndexEntry entry;
+  memset(&entry, 0, sizeof(entry));
+  entry.type = kSessionCameraPoseRecord;
+  entry.timestamp_ns = timestamp_ns;
+  WritePose(G_T_C, entry.pose);
+  
+  std::lock_guard<std::mutex> lock(mutex_);
+  QueueRecord(entry, cv::Mat());
+}
+
+void SessionRecorder::AddObserverPose(const Sophus::SE3f& G_T_observer, uint64_t timestamp_ns) {
+  SessionIndexEntry entry;
+  memset(&entry, 0, sizeof(entry));
+  entry.type = kSessionObserverPoseRecord;
+  entry.timestamp_ns = timestamp_ns;
+  WritePose(G_T_observer, entry.pose);
+  
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (timestamp_ns != last_observer_pose_timestamp_) {
+    QueueRecord(entry, cv::Mat());
+    last_observer_pose_timestamp_ = timestamp_ns;
+  }
+}
+
+void SessionRecorder::QueueRecord(const SessionIndexEntry& entry, const cv::Mat& image) {
+  const bool is_image = (entry.type == kSessionDepthImageRecord ||
+                         entry.type == kSessionColorImageRecord);
+  if (!open_ || (is_image && image.empty())) {
+    return;
+  }
+  if (is_image) {
+    if (queued_image_count_ >= max_queued_images_) {
+      ++ dropped_image_count_;
+      LOG_FIRST_N(WARNING, 1) << "The session recording queue is full, dropping images.";
+      return;
+    }
+    ++ queued_image_count_;
+  }
+  queue_.push_back(QueuedRecord{entry, image});
+  queue_condition_.notify_one();
+}
+
+void SessionRecorder::WriterThreadMain() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    queue_condition_.wait(lock, [this]() {
+      return quit_requested_ || !queue_.empty();
+    });
+    if (queue_.empty()) {
+      // Quit requested and all records are written.
+      return;
+    }
+    QueuedRecord record = queue_.front();
+    queue_.pop_front();
+    
+    if (!record.image.empty()) {
+      lock.unlock();
+      WriteImage(&record.entry, record.image);
+      lock.lock();
+      -- queued_image_count_;
+    }
+    index_.push_back(record.entry);
+  }
+}
+
+void SessionRecorder::WriteImage(SessionIndexEntry* entry, const cv::Mat& image) {
+  // The rows are stored without padding.
+  const cv::Mat continuous_image = image.isContinuous() ? image : image.clone();
+  entry->width = image.cols;
+  entry->height = image.rows;
+  entry->offset = file_size_;
+  entry->size = continuous_image.total() * continuous_image.elemSize();
+  file_.write(reinterpret_cast<const char*>(continuous_image.data), entry->size);
+  file_size_ += entry->size;
+  WritePadding(&file_, &file_size_);
+  
+  if (!file_ && !write_failed_) {
+    LOG(ERROR) << "Writing to the session file failed.";
+    write_failed_ = true;
+  }
+}
+
+SessionReader::SessionReader()
+    : mapping_(nullptr),
+      mapping_size_(0) {}
+
+SessionReader::~SessionReader() {
+  Close();
+}
+
+bool SessionReader::Open(const std::string& path) {
+  Close();
+  
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOG(ERROR) << "Cannot open session file: " << path;
+    return false;
+  }
+  struct stat file_status;
+  if (fstat(fd, &file_status) != 0 ||
+      file_status.st_size < static_cast<off_t>(sizeof(SessionFileHeader))) {
+    LOG(ERROR) << "Not a session file: " << path;
+    close(fd);
+    return false;
+  }
+  mapping_size_ = file_status.st_size;
+  void* mapping = mmap(nullptr, mapping_size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping stays valid after closing the file descriptor.
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    LOG(ERROR) << "Cannot map session file: " << path;
+    mapping_size_ = 0;
+    return false;
+  }
+  mapping_ = static_cast<const uint8_t*>(mapping);
+  
+  SessionFileHeader header;
+  memcpy(&header, mapping_, sizeof(header));
+  if (memcmp(header.magic, kSessionMagic, sizeof(header.magic)) != 0 ||
+      header.version != kSessionVersion) {
+    LOG(ERROR) << "Not a session file of version " << kSessionVersion << ": " << path;
+    Close();
+    return false;
+  }
+  if (header.index_offset == 0 ||
+      header.index_offset > mapping_size_ ||
+      (mapping_size_ - header.index_offset) / sizeof(SessionIndexEntry) < header.index_entry_count) {
+    LOG(ERROR) << "The session file has no valid index (was the recording closed?): " << path;
+    Close();
+    return false;
+  }
+  depth_intrinsics_ = ReadIntrinsics(header.depth_size, header.depth_parameters);
+  color_intrinsics_ = ReadIntrinsics(header.color_size, header.color_parameters);
+  
+  const SessionIndexEntry* index =
+      reinterpret_cast<const SessionIndexEntry*>(mapping_ + header.index_offset);
+  for (uint32_t i = 0; i < header.index_entry_count; ++ i) {
+    SessionIndexEntry entry;
+    memcpy(&entry, &index[i], sizeof(entry));
+    
+    if (entry.type == kSessionDepthImageRecord ||
+        entry.type == kSessionColorImageRecord) {
+      const uint64_t pixel_size =
+          (entry.type == kSessionDepthImageRecord) ? sizeof(uint16_t) : (3 * sizeof(uint8_t));
+      if (entry.offset > header.index_offset ||
+          entry.size > header.index_offset - entry.offset ||
+          entry.size != static_cast<uint64_t>(entry.width) * entry.height * pixel_size) {
+        LOG(ERROR) << "Invalid image record in session file: " << path;
+        Close();
+        return false;
+      }
+      ImageRecord record;
+      record.timestamp_ns = entry.timestamp_ns;
+      record.width = entry.width;
+      record.height = entry.height;
+      record.data = mapping_ + entry.offset;
+      record.G_T_C = ReadPose(entry.pose);
+      if (entry.type == kSessionDepthImageRecord) {
+        depth_images_.push_back(record);
+      } else {
+        color_images_.push_back(record);
+      }
+    } else if (entry.type == kSessionCameraPoseRecord ||
+               entry.type == kSessionObserverPoseRecord) {
+      PoseRecord record;
+      record.timestamp_ns = entry.timestamp_ns;
+      record.pose = ReadPose(entry.pose);
+      if (entry.type == kSessionCameraPoseRecord) {
+        camera_poses_.push_back(record);
+      } else {
+        observer_poses_.push_back(record);
+      }
+    } else {
+      LOG(WARNING) << "Ignoring unknown record type " << entry.type
+                   << " in session file: " << path;
+    }
+  }
+  
+  // The callbacks may have been called from different threads, so the records
+  // are not necessarily in timestamp order.
+  auto image_order = [](const ImageRecord& a, const ImageRecord& b) {
+    return a.timestamp_ns < b.timestamp_ns;
+  };
+  auto pose_order = [](const PoseRecord& a, const PoseRecord& b) {
+    return a.timestamp_ns < b.timestamp_ns;
+  };
+  std::stable_sort(depth_images_.begin(), depth_images_.end(), image_order);
+  std::stable_sort(color_images_.begin(), color_images_.end(), image_order);
+  std::stable_sort(camera_poses_.begin(), camera_poses_.end(), pose_order);
+  std::stable_sort(observer_poses_.begin(), observer_poses_.end(), pose_order);
+  
+  LOG(INFO) << "Opened session with " << depth_images_.size() << " depth images, "
+            << color_images_.size() << " color images, " << camera_poses_.size()
+            << " camera poses and " << observer_poses_.size() << " observer poses.";
+  return true;
+}
+
+void SessionReader::GetDepthImage(int index, DepthImage* image) const {
+  const ImageRecord& record = depth_images_.at(index);
+  // The data is not modified, see the class comment.
+  image->cv::Mat_<uint16_t>::operator=(cv::Mat_<uint16_t>(
+      record.height, record.width,
+      reinterpret_cast<uint16_t*>(const_cast<uint8_t*>(record.data))));
+  image->set_timestamp_ns(record.timestamp_ns);
+  image->set_pinned_memory(nullptr);
+}
+
+void SessionReader::GetColorImage(int index, ColorImage* image) const {
+  const ImageRecord& record = color_images_.at(index);
+  // The data is not modified, see the class comment.
+  image->cv::Mat_<cv::Vec3b>::operator=(cv::Mat_<cv::Vec3b>(
+      record.height, record.width,
+      reinterpret_cast<cv::Vec3b*>(const_cast<uint8_t*>(record.data))));
+  image->set_timestamp_ns(record.timestamp_ns);
+  image->set_G_T_C(record.G_T_C);
+  image->set_pinned_memory(nullptr);
+}
+
+void SessionReader::GetCameraPose(int index, Sophus::SE3f* G_T_C, uint64_t* timestamp_ns) const {
+  const PoseRecord& record = camera_poses_.at(index);
+  *G_T_C = record.pose;
+  *timestamp_ns = record.timestamp_ns;
+}
+
+void SessionReader::GetObserverPose(int index, Sophus::SE3f* G_T_observer, uint64_t* timestamp_ns) const {
+  const PoseRecord& record = observer_poses_.at(index);
+  *G_T_observer = record.pose;
+  *timestamp_ns = record.timestamp_ns;
+}
+
+void SessionReader::Prefetch() const {
+  if (mapping_) {
+    madvise(const_cast<uint8_t*>(mapping_), mapping_size_, MADV_WILLNEED);
+  }
+}
+
+void SessionReader::Close() {
+  if (mapping_) {
+    munmap(const_cast<uint8_t*>(mapping_), mapping_size_);
+    mapping_ = nullptr;
+    mapping_size_ = 0;
+  }
+  depth_images_.clear();
+  color_images_.clear();
+  camera_poses_.clear();
+  observer_poses_.clear();
+}
+
+}  // namespace view_correction
@@ -0,0 +1,254 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef VIEW_CORRECTION_SESSION_FILE_H_
+#define VIEW_CORRECTION_SESSION_FILE_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <Eigen/StdVector>
+#include <sophus/se3.hpp>
+
+#include "view_correction/view_correction_display.h"
+
+namespace view_correction {
+
+// Recorded sessions are stored in a single binary file which can be replayed
+// from a read-only memory mapping without decoding or copying the images. The
+// file consists of:
+//
+// - A header with a magic number, the format version, the depth and color
+//   camera intrinsics, and the location of the index.
+// - The raw pixel data of the recorded images, each starting at a multiple of
+//   kSessionDataAlignment bytes: 16-bit depth images in millimeters and color
+//   images with interleaved 8-bit RGB channels, both without row padding.
+// - An index at the end with one entry per record, which holds the record type,
+//   timestamp, and image size and location. The poses are stored in the index
+//   entries themselves: the camera poses (given to ColorCameraPoseCallback()),
+//   the observer poses, and the G_T_C of the color images.
+//
+// All values are stored in the byte order of the recording machine. The index
+// is written when the recording is closed, so a session whose recording was
+// not closed cannot be read.
+
+// Alignment of the image data in the file (and thus in the mapping), which
+// allows efficient copies from it.
+constexpr int kSessionDataAlignment = 64;
+
+// Index entry as stored in the file.
+struct SessionIndexEntry {
+  // One of the kSession...Record constants in session_file.cc.
+  uint32_t type;
+  
+  // Image size in pixels (zero for poses).
+  uint32_t width;
+  uint32_t height;
+  
+  uint32_t reserved;
+  
+  uint64_t timestamp_ns;
+  
+  // Location of the image data in the file (zero for poses).
+  uint64_t offset;
+  uint64_t size;
+  
+  // Pose as translation (x, y, z) followed by the rotation quaternion
+  // (x, y, z, w).
+  float pose[7];
+  
+  uint32_t padding;
+};
+
+// Records the inputs of ViewCorrectionDisplay to a session file (see above).
+// The display records its inputs itself if --vc_record_session is given.
+//
+// The Add...() functions only queue the records, which are written by a
+// background thread, such that the input callbacks never wait for the file.
+// The queued images share their data with the caller's images, which must
+// thus not be modified afterwards. At most max_queued_images images are
+// queued; further images are dropped (and counted) until the writer caught
+// up.
+//
+// Thread-safe.
+class SessionRecorder {
+ public:
+  explicit SessionRecorder(int max_queued_images);
+  
+  // Closes the recording if it is open.
+  ~SessionRecorder();
+  
+  // Creates the file, writes the header and starts the writer thread.
+  // Returns false if the file cannot be created.
+  bool Open(const std::string& path,
+            const Intrinsics& depth_intrinsics,
+            const Intrinsics& color_intrinsics);
+  
+  // Writes the queued records and the index and closes the file. Returns
+  // false if writing failed.
+  bool Close();
+  
+  void AddDepthImage(const DepthImage& image);
+  void AddColorImage(const ColorImage& image);
+  void AddCameraPose(const Sophus::SE3f& G_T_C, uint64_t timestamp_ns);
+  
+  // The timestamp must be in the time base of the camera poses, such that the
+  // replay can interleave them. Observer poses which have the same timestamp
+  // as the previously added one are ignored, such that the latest received
+  // pose can be added every frame.
+  void AddObserverPose(const Sophus::SE3f& G_T_observer, uint64_t timestamp_ns);
+  
+  // Returns the number of records which were written or are queued.
+  int record_count();
+  
+  // Returns the number of images which were dropped since the queue was full.
+  int dropped_image_count();
+  
+ private:
+  struct QueuedRecord {
+    SessionIndexEntry entry;
+    // Empty for poses.
+    cv::Mat image;
+  };
+  
+  SessionRecorder(const SessionRecorder&) = delete;
+  SessionRecorder& operator=(const SessionRecorder&) = delete;
+  
+  // Queues the record unless the recording is closed, or if it has an image
+  // and the queue is full. The mutex must be locked.
+  void QueueRecord(const SessionIndexEntry& entry, const cv::Mat& image);
+  
+  void WriterThreadMain();
+  
+  // Appends the data, padded to kSessionDataAlignment, and sets the location
+  // of the entry. Only called by the writer thread.
+  void WriteImage(SessionIndexEntry* entry, const cv::Mat& image);
+  
+  const int max_queued_images_;
+  
+  // Protected by mutex_.
+  std::mutex mutex_;
+  std::condition_variable queue_condition_;
+  std::deque<QueuedRecord> queue_;
+  int queued_image_count_;
+  int dropped_image_count_;
+  bool open_;
+  bool quit_requested_;
+  std::vector<SessionIndexEntry> index_;
+  uint64_t last_observer_pose_timestamp_;
+  
+  // Only accessed by the writer thread while it runs.
+  std::ofstream file_;
+  uint64_t file_size_;
+  bool write_failed_;
+  
+  std::unique_ptr<std::thread> writer_thread_;
+};
+
+// Reads a session file through a read-only memory mapping of the whole file.
+// The images returned by the accessors share the mapped memory, so they stay
+// valid only as long as the reader and must not be modified. The records of
+// each type are ordered by timestamp.
+//
+// The accessors are thread-safe.
+class SessionReader {
+ public:
+  SessionReader();
+  
+  // Unmaps the file.
+  ~SessionReader();
+  
+  // Maps the file and reads its index. Returns false if the file cannot be
+  // mapped or is not a valid session file.
+  bool Open(const std::string& path);
+  
+  inline const Intrinsics& depth_intrinsics() const { return depth_intrinsics_; }
+  inline const Intrinsics& color_intrinsics() const { return color_intrinsics_; }
+  
+  inline int depth_image_count() const { return depth_images_.size(); }
+  inline int color_image_count() const { return color_images_.size(); }
+  inline int camera_pose_count() const { return camera_poses_.size(); }
+  inline int observer_pose_count() const { return observer_poses_.size(); }
+  
+  // Sets the image to refer to the mapped data of the index-th depth image.
+  void GetDepthImage(int index, DepthImage* image) const;
+  
+  // Sets the image to refer to the mapped data of the index-th color image,
+  // with its timestamp and G_T_C.
+  void GetColorImage(int index, ColorImage* image) const;
+  
+  void GetCameraPose(int index, Sophus::SE3f* G_T_C, uint64_t* timestamp_ns) const;
+  void GetObserverPose(int index, Sophus::SE3f* G_T_observer, uint64_t* timestamp_ns) const;
+  
+  // Hints to the kernel that the whole file will be read soon, such that the
+  // pages are read ahead instead of being faulted in during the replay.
+  void Prefetch() const;
+  
+ private:
+  struct ImageRecord {
+    uint64_t timestamp_ns;
+    int width;
+    int height;
+    const uint8_t* data;
+    Sophus::SE3f G_T_C;
+  };
+  
+  struct PoseRecord {
+    uint64_t timestamp_ns;
+    Sophus::SE3f pose;
+  };
+  
+  typedef std::vector<ImageRecord, Eigen::aligned_allocator<ImageRecord>> ImageRecords;
+  typedef std::vector<PoseRecord, Eigen::aligned_allocator<PoseRecord>> PoseRecords;
+  
+  SessionReader(const SessionReader&) = delete;
+  SessionReader& operator=(const SessionReader&) = delete;
+  
+  void Close();
+  
+  const uint8_t* mapping_;
+  size_t mapping_size_;
+  
+  Intrinsics depth_intrinsics_;
+  Intrinsics color_intrinsics_;
+  ImageRecords depth_images_;
+  ImageRecords color_images_;
+  PoseRecords camera_poses_;
+  PoseRecords observer_poses_;
+};
+
+}  // namespace view_correction
+
+#endif  // VIEW_CORRECTION_SESSION_FILE_H_
@@ -0,0 +1,234 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "view_correction/shader_program_cache.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "view_correction/opengl_util.h"
+
+namespace view_correction {
+
+namespace {
+
+constexpr char kProgramBinaryMagic[4] = {'V', 'C', 'P', 'B'};
+
+// Header of a program binary cache file, followed by the binary.
+struct ProgramBinaryHeader {
+  char magic[4];
+  uint32_t binary_format;
+  uint64_t key;
+  uint64_t length;
+};
+
+// 64-bit FNV-1a hash, which (unlike std::hash) is the same for all builds.
+uint64_t HashString(const std::string& string, uint64_t hash = 14695981039346656037ull) {
+  for (char c : string) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+std::string GetGLString(GLenum name) {
+  const GLubyte* string = glGetString(name);
+  return string ? reinterpret_cast<const char*>(string) : "";
+}
+
+GLuint CompileShader(GLenum type, const std::string& src) {
+  GLuint shader = glCreateShader(type);
+  const GLchar* src_ptr = static_cast<const GLchar*>(src.c_str());
+  glShaderSource(shader, 1, &src_ptr, NULL);
+  glCompileShader(shader);
+  
+  GLint compiled;
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+  if (!compiled) {
+    GLint length;
+    glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+    std::unique_ptr<GLchar[]> log(
+        reinterpret_cast<GLchar*>(new uint8_t[length]));
+    glGetShaderInfoLog(shader, length, &length, log.get());
+    LOG(FATAL) << "GL Shader Compilation Error: " << log.get();
+  }
+  return shader;
+}
+
+}  // namespace
+
+ShaderProgramCache::ShaderProgramCache(const std::string& cache_directory)
+    : cache_directory_(cache_directory) {
+  driver_ = GetGLString(GL_VENDOR) + "\n" + GetGLString(GL_RENDERER) + "\n" +
+            GetGLString(GL_VERSION);
+  
+  GLint num_binary_formats = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_binary_formats);
+  CHECK_OPENGL_NO_ERROR();
+  use_binaries_ = !cache_directory_.empty() && num_binary_formats > 0;
+  if (!cache_directory_.empty() && !use_binaries_) {
+    LOG(INFO) << "The OpenGL driver does not support program binaries, not caching them.";
+  }
+}
+
+ShaderProgramCache::~ShaderProgramCache() {
+  for (const auto& item : programs_) {
+    glDeleteProgram(item.second);
+  }
+}
+
+GLuint ShaderProgramCache::GetProgram(
+    const std::string& vertex_shader_src,
+    const std::string& fragment_shader_src) {
+  const std::string sources = vertex_shader_src + '\0' + fragment_shader_src;
+  auto it = programs_.find(sources);
+  if (it != programs_.end()) {
+    return it->second;
+  }
+  
+  const uint64_t key = HashString(sources, HashString(driver_ + '\0'));
+  GLuint program = use_binaries_ ? LoadProgramBinary(key) : 0;
+  if (program == 0) {
+    GLuint vertex_shader = CompileShader(GL_VERTEX_SHADER, vertex_shader_src);
+    GLuint fragment_shader = CompileShader(GL_FRAGMENT_SHADER, fragment_shader_src);
+    
+    program = glCreateProgram();
+    glAttachShader(program, fragment_shader);
+    glAttachShader(program, vertex_shader);
+    if (use_binaries_) {
+      glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+    glLinkProgram(program);
+    
+    GLint linked;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+      GLint length;
+      glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+      std::unique_ptr<GLchar[]> log(
+          reinterpret_cast<GLchar*>(new uint8_t[length]));
+      glGetProgramInfoLog(program, length, &length, log.get());
+      LOG(FATAL) << "GL Program Linker Error: " << log.get();
+    }
+    
+    // The linked program does not need the shader objects anymore.
+    glDetachShader(program, vertex_shader);
+    glDetachShader(program, fragment_shader);
+    glDeleteShader(vertex_shader);
+    glDeleteShader(fragment_shader);
+    CHECK_OPENGL_NO_ERROR();
+    
+    if (use_binaries_) {
+      SaveProgramBinary(key, program);
+    }
+  }
+  
+  programs_[sources] = program;
+  return program;
+}
+
+std::string ShaderProgramCache::GetBinaryPath(uint64_t key) const {
+  std::ostringstream path;
+  path << cache_directory_ << "/" << std::hex << std::setw(16)
+       << std::setfill('0') << key << ".bin";
+  return path.str();
+}
+
+GLuint ShaderProgramCache::LoadProgramBinary(uint64_t key) {
+  std::ifstream file_stream(GetBinaryPath(key), std::ios::in | std::ios::binary);
+  if (!file_stream) {
+    return 0;
+  }
+  ProgramBinaryHeader header;
+  if (!file_stream.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+      memcmp(header.magic, kProgramBinaryMagic, sizeof(kProgramBinaryMagic)) != 0 ||
+      header.key != key) {
+    return 0;
+  }
+  std::vector<char> binary(header.length);
+  if (!file_stream.read(binary.data(), binary.size())) {
+    return 0;
+  }
+  
+  GLuint program = glCreateProgram();
+  glProgramBinary(program, header.binary_format, binary.data(), binary.size());
+  GLint linked = GL_FALSE;
+  glGetProgramiv(program, GL_LINK_STATUS, &linked);
+  if (!linked) {
+    // The driver does not accept the binary anymore. Clear the error
+    // (GL_INVALID_ENUM for an unknown format) and compile the program.
+    glDeleteProgram(program);
+    while (glGetError() != GL_NO_ERROR) {}
+    return 0;
+  }
+  return program;
+}
+
+void ShaderProgramCache::SaveProgramBinary(uint64_t key, GLuint program) {
+  GLint length = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0) {
+    return;
+  }
+  std::vector<char> binary(length);
+  GLenum binary_format;
+  glGetProgramBinary(program, length, &length, &binary_format, binary.data());
+  CHECK_OPENGL_NO_ERROR();
+  
+  ProgramBinaryHeader header;
+  memcpy(header.magic, kProgramBinaryMagic, sizeof(kProgramBinaryMagic));
+  header.binary_format = binary_format;
+  header.key = key;
+  header.length = length;
+  
+  // Write to a temporary file first, such that other processes which start
+  // at the same time never read a partial binary.
+  mkdir(cache_directory_.c_str(), 0755);
+  const std::string path = GetBinaryPath(key);
+  const std::string temp_path = path + "." + std::to_string(getpid()) + ".tmp";
+  std::ofstream file_stream(temp_path, std::ios::out | std::ios::binary | std::ios::trunc);
+  file_stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file_stream.write(binary.data(), length);
+  file_stream.close();
+  if (!file_stream || std::rename(temp_path.c_str(), path.c_str()) != 0) {
+    LOG(WARNING) << "Cannot write the shader program binary: " << path;
+    std::remove(temp_path.c_str());
+  }
+}
+
+}  // namespace view_correction
@@ -0,0 +1,98 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef VIEW_CORRECTION_SHADER_PROGRAM_CACHE_H_
+#define VIEW_CORRECTION_SHADER_PROGRAM_CACHE_H_
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+#ifdef ANDROID
+#include <EGL/egl.h>
+#include <GLES3/gl3.h>
+#else
+#include <GL/glew.h>
+#include <GL/gl.h>
+#endif
+
+namespace view_correction {
+
+// Compiles and links the GLSL programs of an OpenGL context, and shares each
+// program between all of its users with the same shader sources (e.g., the
+// MeshRenderers which are re-created on target resolution changes). If a
+// cache directory is given, the linked program binaries are additionally
+// stored there with glGetProgramBinary(), keyed by a hash of the driver
+// (vendor, renderer and version strings) and the shader sources, and loaded
+// with glProgramBinary() on later starts instead of compiling the shaders
+// again. Binaries which the driver rejects (e.g., after a driver update with
+// the same version string) are silently replaced.
+//
+// All functions must be called with the OpenGL context current. Not
+// thread-safe.
+class ShaderProgramCache {
+ public:
+  // If cache_directory is empty, the program binaries are not persisted. The
+  // directory is created when the first binary is written.
+  explicit ShaderProgramCache(const std::string& cache_directory);
+  
+  // Deletes all programs.
+  ~ShaderProgramCache();
+  
+  // Returns the linked program for the given sources. The program is owned by
+  // the cache and must not be deleted by the caller. Aborts if compiling or
+  // linking fails.
+  GLuint GetProgram(const std::string& vertex_shader_src,
+                    const std::string& fragment_shader_src);
+  
+ private:
+  ShaderProgramCache(const ShaderProgramCache&) = delete;
+  ShaderProgramCache& operator=(const ShaderProgramCache&) = delete;
+  
+  // Returns the path of the binary cache file for the given key.
+  std::string GetBinaryPath(uint64_t key) const;
+  
+  // Tries to create the program from the binary cache file. Returns 0 if
+  // there is no usable binary.
+  GLuint LoadProgramBinary(uint64_t key);
+  
+  void SaveProgramBinary(uint64_t key, GLuint program);
+  
+  std::string cache_directory_;
+  // Whether the driver supports program binaries (and cache_directory_ is not
+  // empty).
+  bool use_binaries_;
+  // Description of the driver which is part of the key.
+  std::string driver_;
+  // Indexed by the concatenated shader sources.
+  std::unordered_map<std::string, GLuint> programs_;
+};
+
+}  // namespace view_correction
+
+#endif  // VIEW_CORRECTION_SHADER_PROGRAM_CACHE_H_
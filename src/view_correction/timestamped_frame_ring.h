@@ -0,0 +1,122 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef VIEW_CORRECTION_TIMESTAMPED_FRAME_RING_H_
+#define VIEW_CORRECTION_TIMESTAMPED_FRAME_RING_H_
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace view_correction {
+
+// Bounded ring buffer of timestamped frames which is shared between one
+// producer thread (calling Push()) and one consumer thread (calling all other
+// functions). Neither side ever blocks the other: the producer publishes each
+// frame in its own node using atomic pointer exchanges, and the consumer looks
+// frames up with a binary search over the retained timestamps. If the ring is
+// full, Push() overwrites the oldest frame.
+//
+// Nodes replaced by the producer are only deleted by the consumer at the start
+// of its next call, at which point it is guaranteed not to reference them
+// anymore. The frames themselves are returned as copies.
+//
+// T must provide timestamp_ns(), and frames must be pushed with
+// non-decreasing timestamps.
+template <typename T>
+class TimestampedFrameRing {
+ public:
+  explicit TimestampedFrameRing(int capacity);
+  ~TimestampedFrameRing();
+  
+  // Producer side: appends a frame, overwriting the oldest one if the ring is
+  // full. Must not be called concurrently with itself (checked in debug
+  // builds).
+  void Push(const T& frame);
+  
+  // Consumer side: each function returns false if no suitable frame is
+  // retained, and leaves frame untouched in this case.
+  
+  // Returns the oldest retained frame.
+  bool GetOldest(T* frame);
+  
+  // Returns the latest frame.
+  bool GetLatest(T* frame);
+  
+  // Returns the retained frame with the timestamp closest to timestamp_ns.
+  // Returns false if timestamp_ns is not within the range of the retained
+  // timestamps, including both ends of the range. In case of a tie, the older frame is returned.
+  bool FindClosest(uint64_t timestamp_ns, T* frame);
+  
+  // Returns the latest frame with a timestamp of at most timestamp_ns.
+  bool FindLatestNotAfter(uint64_t timestamp_ns, T* frame);
+  
+  // Returns the number of frames pushed so far. This can be used by the consumer
+  // to check for new frames.
+  inline uint64_t push_count() const {
+    return push_count_.load(std::memory_order_acquire);
+  }
+  
+  inline int capacity() const { return static_cast<int>(slots_.size()); }
+  
+ private:
+  struct Node {
+    uint64_t sequence;
+    T frame;
+    Node* next_retired;
+  };
+  
+  // Returns the node holding the frame with the given sequence number, or null
+  // if it has been overwritten already.
+  const Node* GetNode(uint64_t sequence) const;
+  
+  // Returns the sequence numbers of the retained frames as [*begin, *end).
+  void GetRange(uint64_t* begin, uint64_t* end) const;
+  
+  // Returns the first sequence number in [begin, end) whose frame is newer
+  // than timestamp_ns. Overwritten frames are treated as being older.
+  uint64_t FindFirstAfter(uint64_t begin, uint64_t end, uint64_t timestamp_ns) const;
+  
+  // Deletes the nodes which were replaced by the producer.
+  void DeleteRetiredNodes();
+  
+  std::vector<std::atomic<Node*>> slots_;
+  std::atomic<uint64_t> push_count_;
+  
+  // Set while Push() runs, for detecting concurrent producers.
+  std::atomic<bool> push_in_progress_;
+  
+  // Singly-linked list of nodes which were replaced by the producer.
+  std::atomic<Node*> retired_nodes_;
+};
+
+}  // namespace view_correction
+
+#include "view_correction/timestamped_frame_ring_inl.h"
+
+#endif  // VIEW_CORRECTION_TIMESTAMPED_FRAME_RING_H_
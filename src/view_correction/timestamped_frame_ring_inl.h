@@ -0,0 +1,194 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef VIEW_CORRECTION_TIMESTAMPED_FRAME_RING_INL_H_
+#define VIEW_CORRECTION_TIMESTAMPED_FRAME_RING_INL_H_
+
+#include <glog/logging.h>
+
+namespace view_correction {
+
+template <typename T>
+TimestampedFrameRing<T>::TimestampedFrameRing(int capacity)
+    : slots_(capacity),
+      push_count_(0),
+      push_in_progress_(false),
+      retired_nodes_(nullptr) {
+  CHECK_GT(capacity, 0);
+  for (std::atomic<Node*>& slot : slots_) {
+    slot.store(nullptr, std::memory_order_relaxed);
+  }
+}
+
+template <typename T>
+TimestampedFrameRing<T>::~TimestampedFrameRing() {
+  DeleteRetiredNodes();
+  for (std::atomic<Node*>& slot : slots_) {
+    delete slot.load(std::memory_order_acquire);
+  }
+}
+
+template <typename T>
+void TimestampedFrameRing<T>::Push(const T& frame) {
+  DCHECK(!push_in_progress_.exchange(true, std::memory_order_acquire))
+      << "Push() must only be called by a single producer thread.";
+  const uint64_t sequence = push_count_.load(std::memory_order_relaxed);
+  Node* node = new Node{sequence, frame, nullptr};
+  Node* replaced_node =
+      slots_[sequence % slots_.size()].exchange(node, std::memory_order_acq_rel);
+  push_count_.store(sequence + 1, std::memory_order_release);
+  
+  // Hand the replaced node over to the consumer, which might still read it.
+  if (replaced_node) {
+    replaced_node->next_retired = retired_nodes_.load(std::memory_order_relaxed);
+    while (!retired_nodes_.compare_exchange_weak(
+        replaced_node->next_retired, replaced_node,
+        std::memory_order_release, std::memory_order_relaxed)) {}
+  }
+  push_in_progress_.store(false, std::memory_order_release);
+}
+
+template <typename T>
+bool TimestampedFrameRing<T>::GetOldest(T* frame) {
+  DeleteRetiredNodes();
+  uint64_t begin, end;
+  GetRange(&begin, &end);
+  // The oldest frames might get overwritten while searching.
+  for (uint64_t sequence = begin; sequence < end; ++ sequence) {
+    const Node* node = GetNode(sequence);
+    if (node) {
+      *frame = node->frame;
+      return true;
+    }
+  }
+  return false;
+}
+
+template <typename T>
+bool TimestampedFrameRing<T>::GetLatest(T* frame) {
+  DeleteRetiredNodes();
+  uint64_t begin, end;
+  GetRange(&begin, &end);
+  const Node* node = (begin < end) ? GetNode(end - 1) : nullptr;
+  if (!node) {
+    return false;
+  }
+  *frame = node->frame;
+  return true;
+}
+
+template <typename T>
+bool TimestampedFrameRing<T>::FindClosest(uint64_t timestamp_ns, T* frame) {
+  DeleteRetiredNodes();
+  uint64_t begin, end;
+  GetRange(&begin, &end);
+  const uint64_t next = FindFirstAfter(begin, end, timestamp_ns);
+  if (next == begin) {
+    return false;
+  }
+  if (next == end) {
+    // Only an exact match with the newest frame lies within the range. This
+    // also covers the oldest frame if it is the only one retained.
+    const Node* newest_node = GetNode(end - 1);
+    if (!newest_node || newest_node->frame.timestamp_ns() != timestamp_ns) {
+      return false;
+    }
+    *frame = newest_node->frame;
+    return true;
+  }
+  const Node* prev_node = GetNode(next - 1);
+  const Node* next_node = GetNode(next);
+  if (!prev_node || !next_node) {
+    return false;
+  }
+  
+  if (timestamp_ns - prev_node->frame.timestamp_ns() >
+      next_node->frame.timestamp_ns() - timestamp_ns) {
+    *frame = next_node->frame;
+  } else {
+    *frame = prev_node->frame;
+  }
+  return true;
+}
+
+template <typename T>
+bool TimestampedFrameRing<T>::FindLatestNotAfter(uint64_t timestamp_ns, T* frame) {
+  DeleteRetiredNodes();
+  uint64_t begin, end;
+  GetRange(&begin, &end);
+  const uint64_t next = FindFirstAfter(begin, end, timestamp_ns);
+  const Node* node = (next > begin) ? GetNode(next - 1) : nullptr;
+  if (!node) {
+    return false;
+  }
+  *frame = node->frame;
+  return true;
+}
+
+template <typename T>
+const typename TimestampedFrameRing<T>::Node* TimestampedFrameRing<T>::GetNode(
+    uint64_t sequence) const {
+  const Node* node =
+      slots_[sequence % slots_.size()].load(std::memory_order_acquire);
+  return (node && node->sequence == sequence) ? node : nullptr;
+}
+
+template <typename T>
+void TimestampedFrameRing<T>::GetRange(uint64_t* begin, uint64_t* end) const {
+  *end = push_count_.load(std::memory_order_acquire);
+  *begin = (*end > slots_.size()) ? (*end - slots_.size()) : 0;
+}
+
+template <typename T>
+uint64_t TimestampedFrameRing<T>::FindFirstAfter(
+    uint64_t begin, uint64_t end, uint64_t timestamp_ns) const {
+  while (begin < end) {
+    const uint64_t middle = begin + (end - begin) / 2;
+    const Node* node = GetNode(middle);
+    if (!node || node->frame.timestamp_ns() <= timestamp_ns) {
+      begin = middle + 1;
+    } else {
+      end = middle;
+    }
+  }
+  return begin;
+}
+
+template <typename T>
+void TimestampedFrameRing<T>::DeleteRetiredNodes() {
+  Node* node = retired_nodes_.exchange(nullptr, std::memory_order_acquire);
+  while (node) {
+    Node* next = node->next_retired;
+    delete node;
+    node = next;
+  }
+}
+
+}  // namespace view_correction
+
+#endif  // VIEW_CORRECTION_TIMESTAMPED_FRAME_RING_INL_H_
@@ -0,0 +1,106 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// Checks the lookups of TimestampedFrameRing on a single thread. Run without
+// arguments; exits with a failed CHECK if a lookup returns the wrong frame.
+
+#include <cstdint>
+
+#include <glog/logging.h>
+
+#include "view_correction/timestamped_frame_ring.h"
+
+namespace {
+
+struct TestFrame {
+  uint64_t timestamp_ns() const { return timestamp; }
+  
+  uint64_t timestamp;
+};
+
+uint64_t FindClosestTimestamp(
+    view_correction::TimestampedFrameRing<TestFrame>* ring,
+    uint64_t timestamp_ns, bool* found) {
+  TestFrame frame{0};
+  *found = ring->FindClosest(timestamp_ns, &frame);
+  return frame.timestamp;
+}
+
+void TestFindClosestSingleFrame() {
+  view_correction::TimestampedFrameRing<TestFrame> ring(4);
+  ring.Push(TestFrame{100});
+  
+  bool found;
+  CHECK_EQ(FindClosestTimestamp(&ring, 100, &found), 100u);
+  CHECK(found);
+  FindClosestTimestamp(&ring, 99, &found);
+  CHECK(!found);
+  FindClosestTimestamp(&ring, 101, &found);
+  CHECK(!found);
+}
+
+void TestFindClosestRangeEnds() {
+  // Overwrite the first frames so that the retained range does not start at
+  // sequence 0.
+  view_correction::TimestampedFrameRing<TestFrame> ring(3);
+  for (uint64_t timestamp = 100; timestamp <= 500; timestamp += 100) {
+    ring.Push(TestFrame{timestamp});
+  }
+  
+  bool found;
+  // Exact match with the oldest retained frame.
+  CHECK_EQ(FindClosestTimestamp(&ring, 300, &found), 300u);
+  CHECK(found);
+  // Exact match with the newest frame.
+  CHECK_EQ(FindClosestTimestamp(&ring, 500, &found), 500u);
+  CHECK(found);
+  // Just outside of the retained range.
+  FindClosestTimestamp(&ring, 299, &found);
+  CHECK(!found);
+  FindClosestTimestamp(&ring, 501, &found);
+  CHECK(!found);
+  // Inside of the range, including a tie which returns the older frame.
+  CHECK_EQ(FindClosestTimestamp(&ring, 440, &found), 400u);
+  CHECK(found);
+  CHECK_EQ(FindClosestTimestamp(&ring, 460, &found), 500u);
+  CHECK(found);
+  CHECK_EQ(FindClosestTimestamp(&ring, 350, &found), 300u);
+  CHECK(found);
+}
+
+}  // namespace
+
+int main(int /*argc*/, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  
+  TestFindClosestSingleFrame();
+  TestFindClosestRangeEnds();
+  
+  LOG(INFO) << "All TimestampedFrameRing tests passed.";
+  return 0;
+}
@@ -0,0 +1,377 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "view_correction/video_encoder.h"
+
+#include <glog/logging.h>
+
+#ifdef VIEW_CORRECTION_NVENC
+#include <cuda.h>
+#include <nvEncodeAPI.h>
+
+#include "view_correction/cuda_util.h"
+#endif
+
+namespace view_correction {
+
+#ifdef VIEW_CORRECTION_NVENC
+
+#define NVENC_CHECKED_CALL(nvenc_call)                              \
+  do {                                                              \
+    NVENCSTATUS status = (nvenc_call);                              \
+    CHECK_EQ(status, NV_ENC_SUCCESS) << "NVENC call failed: "       \
+                                     << #nvenc_call;                \
+  } while (false)
+
+struct VideoEncoder::Session {
+  NV_ENCODE_API_FUNCTION_LIST api;
+  void* encoder;
+  NV_ENC_INITIALIZE_PARAMS initialize_params;
+  NV_ENC_CONFIG config;
+  GUID codec_guid;
+};
+
+bool VideoEncoder::IsAvailable() {
+  return true;
+}
+
+VideoEncoder::VideoEncoder(
+    int max_width, int max_height, cudaStream_t stream,
+    const Settings& settings, const std::string& output_path)
+    : max_width_((max_width + 1) / 2 * 2),
+      max_height_((max_height + 1) / 2 * 2),
+      width_(max_width_),
+      height_(max_height_),
+      stream_(stream),
+      settings_(settings),
+      session_(new Session()),
+      oldest_index_(0),
+      pending_count_(0),
+      frame_index_(0),
+      force_idr_(false) {
+  CHECK_GT(settings.bitrate_kbps, 0);
+  CHECK_GT(settings.frame_rate, 0);
+  CHECK_GT(settings.vbv_frames, 0);
+  CHECK_GE(settings.idr_interval, 0);
+  CHECK_GT(settings.buffer_count, 0);
+  
+  output_.open(output_path, std::ios::out | std::ios::binary);
+  if (!output_) {
+    LOG(FATAL) << "Cannot open the video output: " << output_path;
+  }
+  
+  // The encoder is bound to the CUDA context of the runtime, which must have
+  // been created before.
+  CUDA_CHECKED_CALL(cudaFree(nullptr));
+  CUcontext cuda_context;
+  CHECK_EQ(cuCtxGetCurrent(&cuda_context), CUDA_SUCCESS);
+  
+  NV_ENCODE_API_FUNCTION_LIST* api = &session_->api;
+  *api = {NV_ENCODE_API_FUNCTION_LIST_VER};
+  NVENC_CHECKED_CALL(NvEncodeAPICreateInstance(api));
+  
+  NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS session_params = {NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS_VER};
+  session_params.device = cuda_context;
+  session_params.deviceType = NV_ENC_DEVICE_TYPE_CUDA;
+  session_params.apiVersion = NVENCAPI_VERSION;
+  NVENC_CHECKED_CALL(api->nvEncOpenEncodeSessionEx(&session_params, &session_->encoder));
+  void* encoder = session_->encoder;
+  
+  // Start from the fastest preset with ultra-low-latency tuning (which
+  // disables B-frames and lookahead), and use a constant bitrate with a small
+  // rate control buffer, such that each frame can be sent as soon as it is
+  // encoded.
+  session_->codec_guid = (settings.codec == Codec::kHEVC) ?
+      NV_ENC_CODEC_HEVC_GUID : NV_ENC_CODEC_H264_GUID;
+  NV_ENC_PRESET_CONFIG preset_config = {NV_ENC_PRESET_CONFIG_VER, {NV_ENC_CONFIG_VER}};
+  NVENC_CHECKED_CALL(api->nvEncGetEncodePresetConfigEx(
+      encoder, session_->codec_guid, NV_ENC_PRESET_P1_GUID,
+      NV_ENC_TUNING_INFO_ULTRA_LOW_LATENCY, &preset_config));
+  NV_ENC_CONFIG* config = &session_->config;
+  *config = preset_config.presetCfg;
+  config->version = NV_ENC_CONFIG_VER;
+  config->gopLength = (settings.idr_interval > 0) ?
+      settings.idr_interval : NVENC_INFINITE_GOPLENGTH;
+  config->frameIntervalP = 1;
+  
+  const uint32_t bitrate = 1000 * settings.bitrate_kbps;
+  const uint32_t vbv_size = bitrate * settings.vbv_frames / settings.frame_rate;
+  config->rcParams.rateControlMode = NV_ENC_PARAMS_RC_CBR;
+  config->rcParams.averageBitRate = bitrate;
+  config->rcParams.maxBitRate = bitrate;
+  config->rcParams.vbvBufferSize = vbv_size;
+  config->rcParams.vbvInitialDelay = vbv_size;
+  config->rcParams.zeroReorderDelay = 1;
+  
+  // The parameter sets are repeated with each IDR frame, and the color
+  // description matches ConvertTargetResultToNV12CUDA().
+  if (settings.codec == Codec::kHEVC) {
+    NV_ENC_CONFIG_HEVC* hevc_config = &config->encodeCodecConfig.hevcConfig;
+    hevc_config->idrPeriod = config->gopLength;
+    hevc_config->repeatSPSPPS = 1;
+    NV_ENC_CONFIG_HEVC_VUI_PARAMETERS* vui = &hevc_config->hevcVUIParameters;
+    vui->videoSignalTypePresentFlag = 1;
+    vui->videoFormat = NV_ENC_VUI_VIDEO_FORMAT_UNSPECIFIED;
+    vui->videoFullRangeFlag = 0;
+    vui->colourDescriptionPresentFlag = 1;
+    vui->colourPrimaries = NV_ENC_VUI_COLOR_PRIMARIES_BT709;
+    vui->transferCharacteristics = NV_ENC_VUI_TRANSFER_CHARACTERISTIC_BT709;
+    vui->colourMatrix = NV_ENC_VUI_MATRIX_COEFFS_BT709;
+  } else {
+    NV_ENC_CONFIG_H264* h264_config = &config->encodeCodecConfig.h264Config;
+    h264_config->idrPeriod = config->gopLength;
+    h264_config->repeatSPSPPS = 1;
+    NV_ENC_CONFIG_H264_VUI_PARAMETERS* vui = &h264_config->h264VUIParameters;
+    vui->videoSignalTypePresentFlag = 1;
+    vui->videoFormat = NV_ENC_VUI_VIDEO_FORMAT_UNSPECIFIED;
+    vui->videoFullRangeFlag = 0;
+    vui->colourDescriptionPresentFlag = 1;
+    vui->colourPrimaries = NV_ENC_VUI_COLOR_PRIMARIES_BT709;
+    vui->transferCharacteristics = NV_ENC_VUI_TRANSFER_CHARACTERISTIC_BT709;
+    vui->colourMatrix = NV_ENC_VUI_MATRIX_COEFFS_BT709;
+  }
+  
+  // The maximum size is given such that the encoder can be reconfigured for
+  // the dynamic target render resolution without re-creating the session.
+  NV_ENC_INITIALIZE_PARAMS* initialize_params = &session_->initialize_params;
+  *initialize_params = {NV_ENC_INITIALIZE_PARAMS_VER};
+  initialize_params->encodeGUID = session_->codec_guid;
+  initialize_params->presetGUID = NV_ENC_PRESET_P1_GUID;
+  initialize_params->tuningInfo = NV_ENC_TUNING_INFO_ULTRA_LOW_LATENCY;
+  initialize_params->encodeWidth = width_;
+  initialize_params->encodeHeight = height_;
+  initialize_params->darWidth = width_;
+  initialize_params->darHeight = height_;
+  initialize_params->maxEncodeWidth = max_width_;
+  initialize_params->maxEncodeHeight = max_height_;
+  initialize_params->frameRateNum = settings.frame_rate;
+  initialize_params->frameRateDen = 1;
+  initialize_params->enablePTD = 1;
+  initialize_params->encodeConfig = config;
+  NVENC_CHECKED_CALL(api->nvEncInitializeEncoder(encoder, initialize_params));
+  
+  // Read the input after the work which the caller enqueued on the stream,
+  // instead of synchronizing with the host.
+  NVENC_CHECKED_CALL(api->nvEncSetIOCudaStreams(
+      encoder,
+      reinterpret_cast<NV_ENC_CUSTREAM_PTR>(&stream_),
+      reinterpret_cast<NV_ENC_CUSTREAM_PTR>(&stream_)));
+  
+  buffers_.resize(settings.buffer_count);
+  for (FrameBuffer& buffer : buffers_) {
+    void* nv12_image;
+    CUDA_CHECKED_CALL(cudaMallocPitch(
+        &nv12_image, &buffer.pitch, max_width_, max_height_ + max_height_ / 2));
+    buffer.nv12_image = static_cast<uint8_t*>(nv12_image);
+    
+    NV_ENC_REGISTER_RESOURCE register_resource = {NV_ENC_REGISTER_RESOURCE_VER};
+    register_resource.resourceType = NV_ENC_INPUT_RESOURCE_TYPE_CUDADEVICEPTR;
+    register_resource.resourceToRegister = nv12_image;
+    register_resource.width = max_width_;
+    register_resource.height = max_height_;
+    register_resource.pitch = buffer.pitch;
+    register_resource.bufferFormat = NV_ENC_BUFFER_FORMAT_NV12;
+    register_resource.bufferUsage = NV_ENC_INPUT_IMAGE;
+    NVENC_CHECKED_CALL(api->nvEncRegisterResource(encoder, &register_resource));
+    buffer.registered_resource = register_resource.registeredResource;
+    buffer.mapped_resource = nullptr;
+    
+    NV_ENC_CREATE_BITSTREAM_BUFFER create_bitstream = {NV_ENC_CREATE_BITSTREAM_BUFFER_VER};
+    NVENC_CHECKED_CALL(api->nvEncCreateBitstreamBuffer(encoder, &create_bitstream));
+    buffer.bitstream = create_bitstream.bitstreamBuffer;
+  }
+}
+
+VideoEncoder::~VideoEncoder() {
+  const NV_ENCODE_API_FUNCTION_LIST& api = session_->api;
+  void* encoder = session_->encoder;
+  
+  // Signal the end of the stream, which flushes the encoder.
+  NV_ENC_PIC_PARAMS end_of_stream = {NV_ENC_PIC_PARAMS_VER};
+  end_of_stream.encodePicFlags = NV_ENC_PIC_FLAG_EOS;
+  NVENC_CHECKED_CALL(api.nvEncEncodePicture(encoder, &end_of_stream));
+  while (pending_count_ > 0) {
+    FinishOldest(true);
+  }
+  
+  for (FrameBuffer& buffer : buffers_) {
+    api.nvEncDestroyBitstreamBuffer(encoder, buffer.bitstream);
+    api.nvEncUnregisterResource(encoder, buffer.registered_resource);
+    cudaFree(buffer.nv12_image);
+  }
+  api.nvEncDestroyEncoder(encoder);
+}
+
+uint8_t* VideoEncoder::BeginFrame(int width, int height, size_t* pitch) {
+  width = (width + 1) / 2 * 2;
+  height = (height + 1) / 2 * 2;
+  CHECK_LE(width, max_width_);
+  CHECK_LE(height, max_height_);
+  
+  const int buffer_count = buffers_.size();
+  FinishEncoded();
+  if (pending_count_ == buffer_count) {
+    FinishOldest(true);
+  }
+  if (width != width_ || height != height_) {
+    // Retrieve the frames of the old size before resetting the encoder.
+    while (pending_count_ > 0) {
+      FinishOldest(true);
+    }
+    Reconfigure(width, height);
+  }
+  
+  FrameBuffer* buffer = &buffers_[(oldest_index_ + pending_count_) % buffer_count];
+  *pitch = buffer->pitch;
+  return buffer->nv12_image;
+}
+
+void VideoEncoder::EndFrame() {
+  const NV_ENCODE_API_FUNCTION_LIST& api = session_->api;
+  void* encoder = session_->encoder;
+  FrameBuffer* buffer = &buffers_[(oldest_index_ + pending_count_) % buffers_.size()];
+  
+  NV_ENC_MAP_INPUT_RESOURCE map_resource = {NV_ENC_MAP_INPUT_RESOURCE_VER};
+  map_resource.registeredResource = buffer->registered_resource;
+  NVENC_CHECKED_CALL(api.nvEncMapInputResource(encoder, &map_resource));
+  buffer->mapped_resource = map_resource.mappedResource;
+  
+  NV_ENC_PIC_PARAMS picture_params = {NV_ENC_PIC_PARAMS_VER};
+  picture_params.pictureStruct = NV_ENC_PIC_STRUCT_FRAME;
+  picture_params.inputBuffer = map_resource.mappedResource;
+  picture_params.bufferFmt = map_resource.mappedBufferFmt;
+  picture_params.inputWidth = width_;
+  picture_params.inputHeight = height_;
+  picture_params.inputPitch = buffer->pitch;
+  picture_params.outputBitstream = buffer->bitstream;
+  picture_params.inputTimeStamp = frame_index_;
+  if (force_idr_) {
+    picture_params.encodePicFlags = NV_ENC_PIC_FLAG_FORCEIDR | NV_ENC_PIC_FLAG_OUTPUT_SPSPPS;
+    force_idr_ = false;
+  }
+  // Without B-frames, the encoder does not ask for more input before it
+  // outputs a frame.
+  NVENC_CHECKED_CALL(api.nvEncEncodePicture(encoder, &picture_params));
+  
+  ++ frame_index_;
+  ++ pending_count_;
+  
+  // Write out the frames which finished in the meantime (usually the
+  // previous one), such that they do not wait for their buffer to be reused.
+  FinishEncoded();
+}
+
+bool VideoEncoder::FinishOldest(bool wait) {
+  const NV_ENCODE_API_FUNCTION_LIST& api = session_->api;
+  void* encoder = session_->encoder;
+  FrameBuffer* buffer = &buffers_[oldest_index_];
+  
+  // Blocks until the frame has been encoded, unless wait is false.
+  NV_ENC_LOCK_BITSTREAM lock_bitstream = {NV_ENC_LOCK_BITSTREAM_VER};
+  lock_bitstream.outputBitstream = buffer->bitstream;
+  lock_bitstream.doNotWait = wait ? 0 : 1;
+  const NVENCSTATUS lock_status =
+      api.nvEncLockBitstream(encoder, &lock_bitstream);
+  if (!wait && lock_status == NV_ENC_ERR_LOCK_BUSY) {
+    return false;
+  }
+  CHECK_EQ(lock_status, NV_ENC_SUCCESS)
+      << "NVENC call failed: nvEncLockBitstream";
+  output_.write(static_cast<const char*>(lock_bitstream.bitstreamBufferPtr),
+                lock_bitstream.bitstreamSizeInBytes);
+  output_.flush();
+  NVENC_CHECKED_CALL(api.nvEncUnlockBitstream(encoder, buffer->bitstream));
+  if (!output_) {
+    LOG(ERROR) << "Cannot write to the video output, dropping frame.";
+    output_.clear();
+  }
+  
+  NVENC_CHECKED_CALL(api.nvEncUnmapInputResource(encoder, buffer->mapped_resource));
+  buffer->mapped_resource = nullptr;
+  
+  oldest_index_ = (oldest_index_ + 1) % buffers_.size();
+  -- pending_count_;
+  return true;
+}
+
+void VideoEncoder::FinishEncoded() {
+  while (pending_count_ > 0 && FinishOldest(false)) {}
+}
+
+void VideoEncoder::Reconfigure(int width, int height) {
+  width_ = width;
+  height_ = height;
+  
+  NV_ENC_INITIALIZE_PARAMS* initialize_params = &session_->initialize_params;
+  initialize_params->encodeWidth = width_;
+  initialize_params->encodeHeight = height_;
+  initialize_params->darWidth = width_;
+  initialize_params->darHeight = height_;
+  
+  NV_ENC_RECONFIGURE_PARAMS reconfigure_params = {NV_ENC_RECONFIGURE_PARAMS_VER};
+  reconfigure_params.reInitEncodeParams = *initialize_params;
+  reconfigure_params.resetEncoder = 1;
+  reconfigure_params.forceIDR = 1;
+  NVENC_CHECKED_CALL(session_->api.nvEncReconfigureEncoder(
+      session_->encoder, &reconfigure_params));
+  force_idr_ = true;
+}
+
+#else  // VIEW_CORRECTION_NVENC
+
+struct VideoEncoder::Session {};
+
+bool VideoEncoder::IsAvailable() {
+  return false;
+}
+
+VideoEncoder::VideoEncoder(
+    int /*max_width*/, int /*max_height*/, cudaStream_t /*stream*/,
+    const Settings& /*settings*/, const std::string& /*output_path*/) {
+  LOG(FATAL) << "The video encoder requires building with the VIEW_CORRECTION_NVENC CMake option.";
+}
+
+VideoEncoder::~VideoEncoder() {}
+
+uint8_t* VideoEncoder::BeginFrame(int /*width*/, int /*height*/, size_t* /*pitch*/) {
+  return nullptr;
+}
+
+void VideoEncoder::EndFrame() {}
+
+bool VideoEncoder::FinishOldest(bool /*wait*/) {
+  return false;
+}
+
+void VideoEncoder::FinishEncoded() {}
+
+void VideoEncoder::Reconfigure(int /*width*/, int /*height*/) {}
+
+#endif  // VIEW_CORRECTION_NVENC
+
+}  // namespace view_correction
@@ -0,0 +1,167 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef VIEW_CORRECTION_VIDEO_ENCODER_H_
+#define VIEW_CORRECTION_VIDEO_ENCODER_H_
+
+#include <stdint.h>
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <cuda_runtime.h>
+
+namespace view_correction {
+
+// Encodes the final images to an H.264 or HEVC elementary stream with the
+// GPU's hardware video encoder (NVENC), for streaming the corrected view. The
+// images are passed to the encoder in device memory: the caller converts each
+// image to NV12 on its CUDA stream into the buffer returned by BeginFrame(),
+// and EndFrame() enqueues the encoding on the same stream. Thus, nothing is
+// read back to the host except for the encoded bitstream.
+//
+// The frames are encoded into a ring of buffers. Each call to BeginFrame()
+// and EndFrame() writes out the bitstreams of the frames which have finished
+// encoding without waiting for the others, such that a frame is normally
+// written one frame after it was submitted. Only if all buffers are still
+// being encoded does BeginFrame() wait for the oldest one. The output file
+// may also be a named pipe which a streaming server reads from.
+//
+// Only available if the VIEW_CORRECTION_NVENC CMake option is enabled, which
+// requires the NVENC header of the Video Codec SDK. Otherwise, IsAvailable()
+// returns false and the constructor must not be called.
+class VideoEncoder {
+ public:
+  enum class Codec {
+    kH264 = 0,
+    kHEVC
+  };
+  
+  struct Settings {
+    Codec codec = Codec::kH264;
+    
+    // Target bitrate of the constant bitrate rate control.
+    int bitrate_kbps = 8000;
+    
+    // Frame rate which the rate control assumes.
+    int frame_rate = 60;
+    
+    // Size of the rate control buffer in frames (at the target bitrate). This
+    // limits how much larger than average a frame may become, so a smaller
+    // buffer reduces the latency of transmitting the frames at the cost of
+    // quality. One frame gives the lowest latency.
+    float vbv_frames = 1;
+    
+    // Number of frames between two IDR frames, or 0 to only start with one.
+    // Periodic IDR frames allow observers to join the stream, the parameter
+    // sets are repeated before each of them.
+    int idr_interval = 0;
+    
+    // Number of frames in the ring, i.e., the number of frames which may be
+    // in the encoder before BeginFrame() waits.
+    int buffer_count = 2;
+  };
+  
+  // Returns whether the encoder has been compiled in.
+  static bool IsAvailable();
+  
+  // Creates an encoding session on the current CUDA device for images of up
+  // to the given size (which is rounded up to even numbers) and opens the
+  // output file. The work is ordered with the given stream.
+  VideoEncoder(int max_width, int max_height, cudaStream_t stream,
+               const Settings& settings, const std::string& output_path);
+  
+  // Encodes and writes the remaining frames and ends the stream.
+  ~VideoEncoder();
+  
+  // Returns the NV12 device buffer for the next frame of the given size
+  // (which must not exceed the maximum size). The caller must write the image
+  // on the stream given to the constructor, with the UV plane starting
+  // max_height() rows after the Y plane. If the size changed since the last
+  // frame, the encoder is reconfigured and the next frame becomes an IDR
+  // frame. If all buffers are in use, this first waits for the oldest frame.
+  uint8_t* BeginFrame(int width, int height, size_t* pitch);
+  
+  // Enqueues encoding the frame which has been written to the buffer returned
+  // by the last call to BeginFrame().
+  void EndFrame();
+  
+  // The maximum image size rounded up to even numbers.
+  inline int max_width() const { return max_width_; }
+  inline int max_height() const { return max_height_; }
+  
+ private:
+  struct FrameBuffer {
+    uint8_t* nv12_image;
+    size_t pitch;
+    void* registered_resource;
+    // Non-null while the frame is being encoded.
+    void* mapped_resource;
+    void* bitstream;
+  };
+  
+  VideoEncoder(const VideoEncoder&) = delete;
+  VideoEncoder& operator=(const VideoEncoder&) = delete;
+  
+  // Writes the bitstream of the oldest pending frame. If wait is false, this
+  // returns false without writing if the frame is still being encoded.
+  bool FinishOldest(bool wait);
+  
+  // Writes the bitstreams of the pending frames which have been encoded.
+  void FinishEncoded();
+  
+  // Changes the encoded image size, forcing an IDR frame.
+  void Reconfigure(int width, int height);
+  
+  int max_width_;
+  int max_height_;
+  int width_;
+  int height_;
+  
+  cudaStream_t stream_;
+  Settings settings_;
+  std::ofstream output_;
+  
+  // The NVENC session and its parameters. Their types are hidden such that
+  // the NVENC header is only needed for compiling video_encoder.cc.
+  struct Session;
+  std::unique_ptr<Session> session_;
+  
+  std::vector<FrameBuffer> buffers_;
+  // Index of the oldest pending frame.
+  int oldest_index_;
+  int pending_count_;
+  int64_t frame_index_;
+  bool force_idr_;
+};
+
+}  // namespace view_correction
+
+#endif  // VIEW_CORRECTION_VIDEO_ENCODER_H_
@@ -29,8 +29,12 @@
 #include "view_correction/view_correction_display.h"
 #include "view_correction/view_correction_display.cuh"
 
+#include <cmath>
+#include <condition_variable>
 #include <fstream>
+#include <functional>
 #include <iomanip>
+#include <thread>
 
 #include <cuda_runtime.h>
 #include <opencv2/core/core.hpp>
@@ -42,15 +46,37 @@
 #include "view_correction/cuda_buffer.h"
 #include "view_correction/cuda_buffer_adapter.h"
 #include "view_correction/forward_declarations.h"
+#include "view_correction/framebuffer_readback.h"
+#include "view_correction/image_writer.h"
+#include "view_correction/inpainting_autotuner.h"
+#include "view_correction/inpainting_deadline.h"
+#include "view_correction/inpainting_workspace.h"
+#include "view_correction/latency_metrics.h"
+#include "view_correction/mesh_chunk_cache.h"
+#include "view_correction/cuda_block_compaction.cuh"
 #include "view_correction/cuda_buffer_visualization.h"
 #include "view_correction/cuda_convolution_inpainting.cuh"
 #include "view_correction/cuda_convolution_inpainting_rgb.cuh"
+#include "view_correction/cuda_depth_warp.cuh"
+#include "view_correction/cuda_distortion_lut.cuh"
+#include "view_correction/cuda_evaluation.cuh"
+#include "view_correction/cuda_foveated_inpainting.cuh"
+#include "view_correction/cuda_hole_map.cuh"
+#include "view_correction/cuda_interop_cache.h"
 #include "view_correction/cuda_tv_inpainting_functions.cuh"
+#include "view_correction/cuda_visualization.cuh"
 #include "view_correction/flags.h"
 #include "view_correction/mesh_renderer.h"
+#include "view_correction/meshing_scheduler.h"
+#include "view_correction/nvtx_range.h"
 #include "view_correction/opengl_util.h"
+#include "view_correction/pinned_host_memory_pool.h"
 #include "view_correction/position_receiver.h"
+#include "view_correction/resolution_controller.h"
+#include "view_correction/session_file.h"
+#include "view_correction/shader_program_cache.h"
 #include "view_correction/util.h"
+#include "view_correction/video_encoder.h"
 
 namespace view_correction {
 
@@ -60,9 +86,199 @@ constexpr float kMaxDepthForDisplay = 4.5f;
 constexpr float kMinDepthForRendering = 0.1f;
 constexpr float kMaxDepthForRendering = 50.f;
 
+// Target frame inpainting workspace phases (see
+// d_->target_inpainting_workspace).
+static constexpr int kTargetDepthInpaintingPhase = 0;
+static constexpr int kTargetColorInpaintingPhase = 1;
+
 static constexpr double kNanosecondsToSeconds = 1e-9;
 // static constexpr double kSecondsToNanoseconds = 1e9;
 
+// Only the latest depth image is used, so this just needs to leave some slack
+// for the camera thread.
+static constexpr int kDepthImageRingCapacity = 2;
+// Caches about one second of color images at 60 Hz.
+static constexpr int kYUVImageRingCapacity = 64;
+// Number of color camera poses kept for pose interpolation and prediction.
+static constexpr int kPoseHistoryCapacity = 256;
+// Number of final image readbacks which may be in flight before waiting.
+static constexpr int kFinalImageReadbackBufferCount = 3;
+
+// Makes the given device current on the calling thread from the construction
+// of the object until its destruction or until End() is called, and restores
+// the previously current device afterwards. A negative device keeps the
+// current device (such that meshing_device can be passed directly).
+class CUDADeviceScope {
+ public:
+  explicit CUDADeviceScope(int device)
+      : previous_device_(-1) {
+    if (device >= 0) {
+      CUDA_CHECKED_CALL(cudaGetDevice(&previous_device_));
+      CUDA_CHECKED_CALL(cudaSetDevice(device));
+    }
+  }
+  
+  ~CUDADeviceScope() {
+    End();
+  }
+  
+  void End() {
+    if (previous_device_ >= 0) {
+      CUDA_CHECKED_CALL(cudaSetDevice(previous_device_));
+      previous_device_ = -1;
+    }
+  }
+  
+ private:
+  CUDADeviceScope(const CUDADeviceScope&) = delete;
+  CUDADeviceScope& operator=(const CUDADeviceScope&) = delete;
+  
+  int previous_device_;
+};
+
+// Timing events and statistics of one run of the pipeline.
+struct FrameTimings {
+  void Create() {
+    cudaEventCreate(&render_or_upload_depth_start_event);
+    cudaEventCreate(&meshing_start_event);
+    cudaEventCreate(&meshing_upload_end_event);
+    cudaEventCreate(&meshing_downsampling_end_event);
+    cudaEventCreate(&meshing_gradient_mags_end_event);
+    cudaEventCreate(&meshing_inpainting_end_event);
+    cudaEventCreate(&meshing_end_event);
+    
+    cudaEventCreate(&rendering_start_event);
+    cudaEventCreate(&rendering_end_event);
+    cudaEventCreate(&color_reprojection_end_event);
+    cudaEventCreate(&last_frame_reprojection_end_event);
+    cudaEventCreate(&target_depth_inpainting_end_event);
+    cudaEventCreate(&target_color_inpainting_end_event);
+    cudaEventCreateWithFlags(&statistics_end_event, cudaEventDisableTiming);
+    
+    CUDA_CHECKED_CALL(cudaHostAlloc(
+        reinterpret_cast<void**>(&compaction_counters),
+        3 * kBlockCompactionCounterCount * sizeof(int), cudaHostAllocDefault));
+    pending = false;
+  }
+  
+  void Destroy() {
+    cudaEventDestroy(render_or_upload_depth_start_event);
+    cudaEventDestroy(meshing_start_event);
+    cudaEventDestroy(meshing_upload_end_event);
+    cudaEventDestroy(meshing_downsampling_end_event);
+    cudaEventDestroy(meshing_gradient_mags_end_event);
+    cudaEventDestroy(meshing_inpainting_end_event);
+    cudaEventDestroy(meshing_end_event);
+    
+    cudaEventDestroy(rendering_start_event);
+    cudaEventDestroy(rendering_end_event);
+    cudaEventDestroy(color_reprojection_end_event);
+    cudaEventDestroy(last_frame_reprojection_end_event);
+    cudaEventDestroy(target_depth_inpainting_end_event);
+    cudaEventDestroy(target_color_inpainting_end_event);
+    cudaEventDestroy(statistics_end_event);
+    
+    cudaFreeHost(compaction_counters);
+  }
+  
+  // Returns the page-locked copy of the BlockCompactionBuffers counters for
+  // the source depth (0), target depth (1) or target color (2) inpainting.
+  int* compaction_counters_for(int index) {
+    return compaction_counters + index * kBlockCompactionCounterCount;
+  }
+  
+  cudaEvent_t render_or_upload_depth_start_event;
+  cudaEvent_t meshing_start_event;
+  cudaEvent_t meshing_upload_end_event;
+  cudaEvent_t meshing_downsampling_end_event;
+  cudaEvent_t meshing_gradient_mags_end_event;
+  cudaEvent_t meshing_inpainting_end_event;
+  cudaEvent_t meshing_end_event;
+  
+  cudaEvent_t rendering_start_event;
+  cudaEvent_t rendering_end_event;
+  cudaEvent_t color_reprojection_end_event;
+  cudaEvent_t last_frame_reprojection_end_event;
+  cudaEvent_t target_depth_inpainting_end_event;
+  cudaEvent_t target_color_inpainting_end_event;
+  // Recorded after all events and statistics downloads of the run.
+  cudaEvent_t statistics_end_event;
+  
+  // Whether the run is waiting to be collected, and which of its parts ran.
+  bool pending;
+  bool has_meshing;
+  bool has_rendering;
+  
+  uint32_t src_depth_pixel_count;
+  uint32_t target_depth_pixel_count;
+  uint32_t target_color_pixel_count;
+  int src_saved_block_iterations;
+  int target_depth_saved_block_iterations;
+  int target_color_saved_block_iterations;
+  int src_iterations;
+  int target_depth_iterations;
+  int target_color_iterations;
+  InpaintingResidual src_residual;
+  InpaintingResidual target_depth_residual;
+  InpaintingResidual target_color_residual;
+  
+  // If the pixel counts are only available on the GPU, they are downloaded
+  // asynchronously to this page-locked memory.
+  bool pixel_counts_on_gpu;
+  int* compaction_counters;
+};
+
+// Color and depth display textures for one target frame result, registered
+// with CUDA such that the result can be written to them.
+struct DisplayTextureSlot {
+  GLuint color_texture;
+  cudaGraphicsResource_t color_texture_resource;
+  GLuint depth_texture;
+  cudaGraphicsResource_t depth_texture_resource;
+  // Surface objects for writing to the mapped textures, created once instead
+  // of in every frame.
+  CUDAArrayObjectCache color_texture_cache;
+  CUDAArrayObjectCache depth_texture_cache;
+  // Recorded on the stream after the result has been written to the textures.
+  cudaEvent_t written_event;
+  // Index of the frame whose result is in the textures, or -1 if none.
+  int64_t frame_index = -1;
+};
+
+// A target view which is set up and rendered together with the other views
+// of a frame by the pipeline run for the first view (both eyes with
+// --vc_stereo, or the views of RenderViews()).
+struct BatchedTargetView {
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  
+  Sophus::SE3f target_T_src;
+  float fx;
+  float fy;
+  float cx;
+  float cy;
+  
+  // Rendering of the view, which is kept until the view's own run. Not
+  // allocated for the first view, which is rendered into the target frame
+  // buffers directly, and with --vc_cuda_depth_warp, with which each run
+  // rasterizes its own view.
+  CUDABufferPtr<float> rendered_depth;
+  CUDABufferPtr<uint8_t> rendered_intensity;
+  
+  // Result of the view for RenderViews(). Allocated on first use.
+  CUDABufferPtr<uchar4> result_color;
+  CUDABufferPtr<float> result_depth;
+  
+  // Pose and intrinsics of the result, from which the view's next rendering
+  // is warm-started and made temporally consistent (views are identified by
+  // their index across RenderViews() calls).
+  Sophus::SE3f last_target_T_G;
+  float last_target_fx_inv;
+  float last_target_fy_inv;
+  float last_target_cx_inv;
+  float last_target_cy_inv;
+  bool have_previous_result = false;
+};
+
 struct ViewCorrectionDisplayImpl {
   // ### Observer position receiver ###
   
@@ -70,10 +286,16 @@ struct ViewCorrectionDisplayImpl {
   
   // ### Inputs ###
   
-  // UV part of source color image.
+  // Source color image as uploaded, with interleaved RGB channels (i.e., with
+  // 3 * width columns).
+  CUDABufferPtr<uint8_t> rgb_image_gpu;
+  // UV part of source color image. Not computed if FLAGS_vc_project_rgb_image
+  // is set.
   CUDABufferPtr<uint16_t> uv_image_gpu;
   // Image pyramid of Y part of source color image ordered by resolution,
-  // highest resolution image at index 0.
+  // highest resolution image at index 0. The levels between the first and
+  // the last one are only written if the pyramid is too deep to compute it
+  // in one kernel (see ComputePyramidAndGradientMagnitudeDiv2CUDA()).
   std::vector<CUDABufferPtr<uint8_t>> y_image_gpu;
   // Source depth image (in millimeters).
   CUDABufferPtr<uint16_t> depth_image_gpu;
@@ -82,9 +304,37 @@ struct ViewCorrectionDisplayImpl {
   // magnitude, use:
   // gradient_magnitude_div_sqrt2 * sqrt(2)
   CUDABufferPtr<uint8_t> gradient_magnitude_div_sqrt2;
+  // Continuation of the y_image_gpu pyramid below depth image resolution,
+  // matching the levels of src_tv_pyramid. Only allocated for the
+  // coarse-to-fine TV inpainting modes.
+  std::vector<CUDABufferPtr<uint8_t>> coarse_y_image_gpu;
   
   cudaTextureObject_t gradient_magnitude_div_sqrt2_texture;
   cudaTextureObject_t depth_image_gpu_texture;
+  // Textures of y_image_gpu[0] and uv_image_gpu for the projection of the
+  // color image onto the target frame (see CreateYUVImageTexturesCUDA()).
+  cudaTextureObject_t y_image_texture;
+  cudaTextureObject_t uv_image_texture;
+  // Lookup table for projecting into the color image if the color camera has
+  // distortion, null for a pinhole camera.
+  std::unique_ptr<DistortionLUT> yuv_distortion_lut;
+  
+  // Memory of the inpainting solvers' scratch buffers below. The buffers only
+  // exist for the selected --vc_inpainting_method. Source frame inpainting
+  // may run concurrently with the target frame, so it has its own workspace.
+  // The target frame depth and color inpainting run one after another on the
+  // target stream and share their scratch memory (see
+  // kTargetDepthInpaintingPhase and kTargetColorInpaintingPhase). The target
+  // frame workspace is re-created if the target resolution changes.
+  std::unique_ptr<InpaintingWorkspace> src_inpainting_workspace;
+  std::unique_ptr<InpaintingWorkspace> target_inpainting_workspace;
+  
+  // Kernel configurations of the source and target frame convolution depth
+  // inpainting. Selected by the autotuner with
+  // --vc_autotune_inpainting_kernels, the defaults otherwise.
+  std::unique_ptr<InpaintingAutotuner> inpainting_autotuner;
+  ConvolutionInpaintingConfig src_convolution_config;
+  ConvolutionInpaintingConfig target_convolution_config;
   
   // ### Source frame TV inpainting ###
   
@@ -92,20 +342,44 @@ struct ViewCorrectionDisplayImpl {
   CUDABufferPtr<bool> src_tv_dual_flag;
   CUDABufferPtr<int16_t> src_tv_dual_x;
   CUDABufferPtr<int16_t> src_tv_dual_y;
-  CUDABufferPtr<float> src_tv_u_bar;
+  CUDABufferPtr<InpaintingStateT> src_tv_u_bar;
   CUDABufferPtr<uint8_t> src_tv_max_change;
   CUDABufferPtr<float> src_tv_max_change_float;
   // Inpainted source frame depth image (in meters).
   CUDABufferPtr<float> src_inpainted_depth_map;
-  CUDABufferPtr<float> src_inpainted_depth_map_alternate;
+  // Applied to the inpainted depth map while meshing it.
+  OcclusionSafetyFilter src_occlusion_filter;
   CUDABufferPtr<uint16_t> src_block_coordinates;
   CUDABufferPtr<unsigned char> src_block_activities;
+  // Only allocated for TV inpainting or if FLAGS_vc_device_resident_inpainting
+  // is set.
+  std::unique_ptr<BlockCompactionBuffers> src_compaction_buffers;
+  // Number of block iterations skipped by TV inpainting in the last call to
+  // CreateMeshedInpaintedDepthMap().
+  int src_tv_saved_block_iterations;
+  // Number of inpainting iterations done in the last call to
+  // CreateMeshedInpaintedDepthMap().
+  int src_inpainting_iterations;
+  // Convergence state of the inpainting in the last call to
+  // CreateMeshedInpaintedDepthMap().
+  InpaintingResidual src_inpainting_residual;
+  InpaintingMode src_tv_inpainting_mode;
+  // Only allocated for the coarse-to-fine TV inpainting modes.
+  std::unique_ptr<TVInpaintingPyramid> src_tv_pyramid;
+  // Only allocated if FLAGS_vc_incremental_source_update is set (and the
+  // inpainting method supports it).
+  std::unique_ptr<DirtyTileBuffers> src_dirty_tile_buffers;
 
   // ### Meshed inpainted depth map ###
   
   bool have_meshed_inpainted_depth_map = false;
+  // Pose of the meshed depth map and the timestamp of its color image. Both
+  // are always updated together.
   Sophus::SE3f G_T_src_C_;
   uint64_t G_T_src_C_timestamp_;
+  // Timestamp of the latest color image taken from the input, which may not
+  // have been meshed (yet).
+  uint64_t consumed_yuv_timestamp_;
   cudaGraphicsResource_t vertex_buffer_resource;
   cudaGraphicsResource_t color_buffer_resource;
   cudaGraphicsResource_t index_buffer_resource;
@@ -113,6 +387,11 @@ struct ViewCorrectionDisplayImpl {
   GLuint color_buffer;
   GLuint index_buffer;
   int num_mesh_indices;
+  // If non-null, the mesh is output as a compacted list of triangles which
+  // only contains its valid quads (see --vc_compact_mesh_indices), or as an
+  // adaptively decimated list of triangles (see --vc_decimate_mesh). Used for
+  // either the synchronous or the asynchronous meshing.
+  std::unique_ptr<MeshIndexCompactionBuffers> mesh_index_compaction_buffers;
   
   cudaGraphicsResource_t raw_vertex_buffer_resource;
   cudaGraphicsResource_t raw_color_buffer_resource;
@@ -122,57 +401,201 @@ struct ViewCorrectionDisplayImpl {
   GLuint raw_index_buffer;
   int raw_num_mesh_indices;
   
+  // ### Input staging ###
+  
+  // Page-locked memory for input images and for staging the uploads of input
+  // images in pageable memory. Null if disabled.
+  std::unique_ptr<PinnedHostMemoryPool> pinned_input_pool;
+  
+  // Input images in GPU memory (see GPUImage) whose copies have been enqueued,
+  // with an event recorded after each copy. They are kept referenced until
+  // the copy has finished, see ReleaseFinishedGPUImages(). Accessed by the
+  // asynchronous source meshing thread as well.
+  std::vector<std::pair<std::shared_ptr<GPUImage>, cudaEvent_t>> gpu_images_in_use;
+  std::mutex gpu_images_in_use_mutex;
+  // Unpacked RGBX color image, for GPU images in graphics resources with four
+  // channels. Allocated on first use.
+  CUDABufferPtr<uchar4> gpu_image_rgbx;
+  
+  // ### Asynchronous source frame meshing ###
+  
+  // If enabled, CreateMeshedInpaintedDepthMap() runs in source_meshing_thread
+  // on source_stream and writes to the back buffers below. Once it has
+  // finished, the render thread swaps them with the front buffers
+  // (y_image_gpu[0], uv_image_gpu, vertex_buffer, ...) which are used for
+  // rendering the target view. All OpenGL interop calls stay in the render
+  // thread, which has the OpenGL context.
+  bool async_source_meshing = false;
+  // Source frame work always runs on source_stream, also if it is meshed
+  // synchronously, such that it can overlap with the remaining target frame
+  // work of the previous frame on stream.
+  cudaStream_t source_stream;
+  // Recorded on stream once the target frame does not read the source frame
+  // inputs (rgb_image_gpu, y_image_gpu[0], uv_image_gpu) anymore. The
+  // synchronous source meshing waits for it before overwriting them.
+  cudaEvent_t source_inputs_released_event;
+  // Recorded on source_stream after synchronous source meshing. The target
+  // frame work waits for it before using the mesh.
+  cudaEvent_t source_mesh_ready_event;
+  std::unique_ptr<std::thread> source_meshing_thread;
+  std::mutex source_meshing_mutex;
+  std::condition_variable source_meshing_condition;
+  bool source_meshing_quit_requested = false;
+  bool source_meshing_job_pending = false;
+  bool source_meshing_job_enqueued = false;
+  // Only accessed by the render thread.
+  bool source_meshing_in_flight = false;
+  DepthImage source_meshing_depth_image;
+  ColorImage source_meshing_rgb_image;
+  Sophus::SE3f source_meshing_G_T_src_C;
+  uint32_t source_meshing_num_pixels_to_inpaint;
+  cudaEvent_t source_meshing_input_ready_event;
+  cudaEvent_t source_meshing_done_event;
+  
+  CUDABufferPtr<uint8_t> rgb_image_gpu_back;
+  CUDABufferPtr<uint8_t> y_image_gpu_back;
+  CUDABufferPtr<uint16_t> uv_image_gpu_back;
+  cudaTextureObject_t y_image_texture_back;
+  cudaTextureObject_t uv_image_texture_back;
+  // Copy of the source frame depth rendered from the mesh input, such that
+  // the renderer's result can be unmapped before meshing starts.
+  CUDABufferPtr<float> src_rendered_depth;
+  cudaTextureObject_t src_rendered_depth_texture;
+  cudaGraphicsResource_t back_vertex_buffer_resource;
+  cudaGraphicsResource_t back_color_buffer_resource;
+  cudaGraphicsResource_t back_index_buffer_resource;
+  GLuint back_vertex_buffer;
+  GLuint back_color_buffer;
+  GLuint back_index_buffer;
+  // Valid while source_meshing_in_flight is true.
+  float* back_vertex_buffer_pointer;
+  uint8_t* back_color_buffer_pointer;
+  uint32_t* back_index_buffer_pointer;
+  
+  // ### Meshing device ###
+  
+  // With --vc_meshing_device, the asynchronous source frame meshing runs on
+  // meshing_device, while the target frame work stays on render_device (which
+  // has the OpenGL context). source_stream and the buffers which are only used
+  // for meshing (depth_image_gpu, the pyramid levels above 0 of y_image_gpu,
+  // the source inpainting buffers, ...) are then allocated on the meshing
+  // device. The meshing job writes its results to the meshing_* buffers below
+  // and copies them to the back buffers on the render device at its end
+  // (see CopyMeshingResultsToRenderDevice()). meshing_device is -1 if the
+  // meshing runs on the render device.
+  int render_device = 0;
+  int meshing_device = -1;
+  CUDABufferPtr<uint8_t> meshing_rgb_image;
+  CUDABufferPtr<uint8_t> meshing_y_image;
+  CUDABufferPtr<uint16_t> meshing_uv_image;
+  CUDABufferPtr<float> meshing_vertices;
+  CUDABufferPtr<uint8_t> meshing_colors;
+  CUDABufferPtr<uint32_t> meshing_indices;
+  
   // ### Mesh renderer ###
   
+  // Shared by the mesh renderers and the display program. Declared before
+  // the renderers such that it is destroyed after them.
+  std::unique_ptr<ShaderProgramCache> shader_program_cache;
   std::unique_ptr<MeshRenderer> src_mesh_renderer_;
   std::unique_ptr<MeshRenderer> mesh_renderer_;
   std::unique_ptr<MeshRenderer> tsdf_mesh_renderer_;
   
+  // Persistent GPU copy of the reconstruction chunks given to
+  // MeshChunkCallback(). Only allocated for mesh input.
+  std::unique_ptr<MeshChunkCache> mesh_chunk_cache;
+  
   // ### Target frame buffers ###
   
   CUDABufferPtr<float> target_rendered_depth;
   cudaTextureObject_t target_rendered_depth_texture;
   CUDABufferPtr<uchar4> target_rendered_color;
   
+  // Z-buffer of WarpMeshDepthCUDA() (only allocated for --vc_cuda_depth_warp)
+  // and the rendered intensity. The OpenGL rendering is copied into
+  // target_rendered_depth and target_rendered_intensity right after
+  // rendering, such that mesh_renderer_'s render target does not stay mapped
+  // during the inpainting.
+  CUDABufferPtr<uint2> target_warp_z_buffer;
+  CUDABufferPtr<uint8_t> target_rendered_intensity;
+  cudaTextureObject_t target_rendered_intensity_texture;
+  
+  // Views of the current frame, which are set up and rendered by the run for
+  // the first view (see RunPipeline()). batched_view_count is the number of
+  // views which were set up for the frame, and batched_views_rendered tells
+  // whether their renderings were kept for the runs of the other views. Both
+  // are reset at the start of the first view's run.
+  std::vector<std::unique_ptr<BatchedTargetView>> batched_views;
+  int batched_view_count = 0;
+  bool batched_views_rendered = false;
+  
+  // Previous target frame result reprojected into the current target frame,
+  // used as initial guess for the inpainting with
+  // --vc_warm_start_target_inpainting.
+  CUDABufferPtr<float> target_warm_start_depth;
+  CUDABufferPtr<uchar4> target_warm_start_color;
+  
   CUDABufferPtr<bool> target_tv_flag;
   CUDABufferPtr<bool> target_tv_dual_flag;
   CUDABufferPtr<int16_t> target_tv_dual_x;
   CUDABufferPtr<int16_t> target_tv_dual_y;
-  CUDABufferPtr<float> target_tv_u_bar;
+  CUDABufferPtr<InpaintingStateT> target_tv_u_bar;
   CUDABufferPtr<uint8_t> target_tv_max_change;
   CUDABufferPtr<float> target_tv_max_change_float;
   CUDABufferPtr<float> target_inpainted_depth_map;
   CUDABufferPtr<uint16_t> target_block_coordinates;
   CUDABufferPtr<unsigned char> target_block_activities;
+  // Only allocated for TV inpainting or if FLAGS_vc_device_resident_inpainting
+  // is set.
+  std::unique_ptr<BlockCompactionBuffers> target_compaction_buffers;
+  std::unique_ptr<BlockCompactionBuffers> target_color_compaction_buffers;
+  
+#if CUDART_VERSION >= 10020
+  // Executable graph of the target frame pipeline if
+  // FLAGS_vc_target_cuda_graph is set. It is updated in place with the graph
+  // captured in each frame, and only re-instantiated if the update fails
+  // because the sequence of operations changed.
+  cudaGraphExec_t target_graph_exec;
+  bool have_target_graph_exec;
+#endif
 
   CUDABufferPtr<bool> target_color_tv_flag;
   CUDABufferPtr<bool> target_color_tv_dual_flag;
-  CUDABufferPtr<float> target_color_tv_dual_x_r;
-  CUDABufferPtr<float> target_color_tv_dual_x_g;
-  CUDABufferPtr<float> target_color_tv_dual_x_b;
-  CUDABufferPtr<float> target_color_tv_dual_y_r;
-  CUDABufferPtr<float> target_color_tv_dual_y_g;
-  CUDABufferPtr<float> target_color_tv_dual_y_b;
-  CUDABufferPtr<float> target_color_tv_u_bar_r;
-  CUDABufferPtr<float> target_color_tv_u_bar_g;
-  CUDABufferPtr<float> target_color_tv_u_bar_b;
+  CUDABufferPtr<InpaintingColorStateT> target_color_tv_dual_x;
+  CUDABufferPtr<InpaintingColorStateT> target_color_tv_dual_y;
+  CUDABufferPtr<InpaintingColorStateT> target_color_tv_u_bar;
   CUDABufferPtr<uint8_t> target_color_tv_max_change;
   CUDABufferPtr<float> target_color_tv_max_change_float;
+  // Only allocated for convolution inpainting.
   CUDABufferPtr<uchar4> target_inpainted_color_rgb;
-  CUDABufferPtr<float> target_inpainted_color_r;
-  CUDABufferPtr<float> target_inpainted_color_g;
-  CUDABufferPtr<float> target_inpainted_color_b;
+  // Only allocated for TV inpainting.
+  CUDABufferPtr<float4> target_inpainted_color_float;
+  
+  // Coarse level of --vc_foveated_inpainting, null otherwise.
+  std::unique_ptr<FoveatedInpaintingBuffers> foveated_inpainting_buffers;
+  
+  // Holes of target_rendered_depth and target_rendered_color, shared by the
+  // target frame inpainting passes (with --vc_target_hole_map).
+  std::unique_ptr<HoleMap> target_hole_map;
+  
+  // Normalized gaze point, see SetGazePoint().
+  std::mutex gaze_point_mutex;
+  float gaze_point_x = 0.5f;
+  float gaze_point_y = 0.5f;
   
   // ### Rendering to screen ###
   
-  GLuint display_color_texture;
-  cudaGraphicsResource_t display_color_texture_resource;
-  GLuint display_depth_texture;
-  cudaGraphicsResource_t display_depth_texture_resource;
+  // Ring of display textures (see --vc_display_ring_size). Each displayed
+  // frame writes its result to the next slot, and the screen shows the latest
+  // slot whose result is finished.
+  std::vector<std::unique_ptr<DisplayTextureSlot>> display_slots;
+  // Number of frames written to the display slots so far.
+  int64_t display_frame_count = 0;
+  // Index of the frame whose slot was displayed last, or -1 if none.
+  int64_t displayed_frame_index = -1;
   
+  // Owned by shader_program_cache.
   GLuint display_shader_program;
-  GLuint display_vertex_shader;
-  GLuint display_fragment_shader;
   GLint display_a_position_location;
   GLint display_a_tex_coord_location;
   GLint display_u_color_texture_location;
@@ -184,6 +607,83 @@ struct ViewCorrectionDisplayImpl {
   
 //   ARRenderer ar_renderer;
   
+  // ### Image output ###
+  
+  // Writes the debug and result images in the background. Only allocated if
+  // images are written.
+  std::unique_ptr<ImageWriter> image_writer;
+  // Reads back the final images from the framebuffer for writing them.
+  std::unique_ptr<FramebufferReadback> final_image_readback;
+  // Encodes the final images for --vc_video_output. Only allocated if this is
+  // used.
+  std::unique_ptr<VideoEncoder> video_encoder;
+  
+  // ### Headless output ###
+  
+  // Result of the latest frame for --vc_headless, which is written here
+  // instead of to the display textures (see GetHeadlessResult()).
+  CUDABufferPtr<uchar4> headless_color_result;
+  CUDABufferPtr<float> headless_depth_result;
+  // Recorded on the stream after the result has been written.
+  cudaEvent_t headless_result_event;
+  bool have_headless_result = false;
+  
+  // ### Session recording ###
+  
+  // Records the inputs if --vc_record_session is given, null otherwise.
+  std::unique_ptr<SessionRecorder> session_recorder;
+  
+  // ### Evaluation ###
+  
+  // Buffers of --vc_evaluate_vs_previous_frame. Allocated on first use.
+  CUDABufferPtr<uint8_t> evaluation_color_image;
+  CUDABufferPtr<uchar4> evaluation_reference_image;
+  CUDABufferPtr<uchar4> evaluation_difference_image;
+  std::unique_ptr<ImageComparisonBuffers> evaluation_buffers;
+  
+  // Results file of the run, with one line per evaluated frame, and the sums
+  // of the metrics for the summary. If the file cannot be opened, the
+  // results are only summarized in the log. The PSNR of identical frames is
+  // infinite, so these frames are counted separately and excluded from its
+  // mean.
+  std::ofstream evaluation_results;
+  bool evaluation_results_unavailable = false;
+  double evaluation_mean_l1_sum = 0;
+  double evaluation_psnr_sum = 0;
+  double evaluation_ssim_sum = 0;
+  int evaluation_frame_count = 0;
+  int evaluation_identical_frame_count = 0;
+  
+  // ### Frame reuse ###
+  
+  // Incremented whenever the inputs of the target frame rendering change (the
+  // meshed inpainted depth map with its color image, or the mesh chunks), such
+  // that the previous frame is not re-presented anymore (see
+  // --vc_reuse_frames).
+  uint64_t target_input_version = 0;
+  
+  // Target view and input version of the latest fully rendered frame, if it
+  // may be re-presented.
+  bool have_reusable_frame = false;
+  Sophus::SE3f reusable_frame_target_T_G;
+  float reusable_frame_fx;
+  float reusable_frame_fy;
+  float reusable_frame_cx;
+  float reusable_frame_cy;
+  uint64_t reusable_frame_input_version;
+  
+  // Number of frames for which the previous frame was re-presented.
+  int64_t reused_frame_count = 0;
+  
+  // ### Multi-view output ###
+  
+  // Views of the RenderViews() call in progress, empty otherwise.
+  ViewCorrectionDisplay::TargetViews requested_views;
+  // Number of views whose results were written by the latest RenderViews().
+  int view_result_count = 0;
+  // Recorded on the stream after the results have been written.
+  cudaEvent_t view_results_event;
+  
   // ### Other ###
   
   // Pose of the last rendering (for propagating it to the next one).
@@ -196,34 +696,365 @@ struct ViewCorrectionDisplayImpl {
   
   int output_frame_index;
   
-  // Events for timing.
-  cudaEvent_t render_or_upload_depth_start_event;
-  cudaEvent_t meshing_start_event;
-  cudaEvent_t meshing_upload_end_event;
-  cudaEvent_t meshing_downsampling_end_event;
-  cudaEvent_t meshing_gradient_mags_end_event;
-  cudaEvent_t meshing_inpainting_end_event;
-  cudaEvent_t meshing_end_event;
-  
-  cudaEvent_t rendering_start_event;
-  cudaEvent_t rendering_end_event;
-  cudaEvent_t color_reprojection_end_event;
-  cudaEvent_t last_frame_reprojection_end_event;
-  cudaEvent_t target_depth_inpainting_end_event;
-  cudaEvent_t target_color_inpainting_end_event;
+  // Timing events and statistics. The frames alternate between the two
+  // entries of frame_timings, such that the timings of a frame can be
+  // collected while rendering the next one without waiting for the GPU.
+  FrameTimings frame_timings[2];
+  int frame_timings_index;
+  // Used by the asynchronous source meshing thread.
+  FrameTimings source_meshing_timings;
+  std::unique_ptr<LatencyMetrics> latency_metrics;
+  int collected_frame_timings_count;
+  
+  // Chooses the target frame resolution from the measured frame times. Null
+  // unless --vc_dynamic_resolution is set.
+  std::unique_ptr<ResolutionController> resolution_controller;
+  // Set once the controller chose a new resolution, which is applied at
+  // the start of the next frame.
+  bool target_resolution_change_pending = false;
+  
+  // Decides whether new input frames are meshed. Null unless
+  // --vc_adaptive_meshing is set.
+  std::unique_ptr<MeshingScheduler> meshing_scheduler;
+  
+  // GPU time per iteration of the inpainting solvers, learned from the frame
+  // timings for limiting the iterations to the inpainting time budgets (see
+  // --vc_target_inpainting_budget_ms and --vc_source_inpainting_budget_ms).
+  IterationCostEstimate src_iteration_cost;
+  IterationCostEstimate target_depth_iteration_cost;
+  IterationCostEstimate target_color_iteration_cost;
   
   // CUDA stream.
   cudaStream_t stream;
+  
+  // If set, stream was passed to ShareResources() and is shared with other
+  // displays, and the target frame inpainting workspace is allocated from
+  // target_inpainting_arena (if not null).
+  bool use_shared_stream;
+  InpaintingArena* target_inpainting_arena;
 };
 
+// Returns the maximum number of views which are rendered together in a frame.
+static int GetTargetViewCapacity() {
+  return std::max(FLAGS_vc_stereo ? 2 : 1, FLAGS_vc_max_target_views);
+}
+
+// Copies the rows of an input image in GPU memory to the destination on the
+// stream, mapping its graphics resource if it has no device pointer.
+static void CopyGPUImageCUDA(
+    cudaStream_t stream,
+    GPUImage* image,
+    size_t row_bytes,
+    void* destination,
+    size_t destination_pitch) {
+  if (image->ready_event) {
+    cudaStreamWaitEvent(stream, image->ready_event, 0);
+  }
+  if (image->device_data) {
+    CUDA_CHECKED_CALL(cudaMemcpy2DAsync(
+        destination, destination_pitch, image->device_data, image->pitch,
+        row_bytes, image->height, cudaMemcpyDeviceToDevice, stream));
+  } else {
+    CHECK(image->resource) << "A GPUImage requires device_data or a resource.";
+    CUDA_CHECKED_CALL(cudaGraphicsMapResources(1, &image->resource, stream));
+    cudaArray_t array;
+    CUDA_CHECKED_CALL(cudaGraphicsSubResourceGetMappedArray(&array, image->resource, 0, 0));
+    CUDA_CHECKED_CALL(cudaMemcpy2DFromArrayAsync(
+        destination, destination_pitch, array, 0, 0, row_bytes, image->height,
+        cudaMemcpyDeviceToDevice, stream));
+    CUDA_CHECKED_CALL(cudaGraphicsUnmapResources(1, &image->resource, stream));
+  }
+}
+
+// Keeps the GPU image referenced until the work enqueued on the stream so far
+// has finished.
+static void KeepGPUImageUntilRead(
+    ViewCorrectionDisplayImpl* d,
+    cudaStream_t stream,
+    const std::shared_ptr<GPUImage>& image) {
+  cudaEvent_t read_event;
+  cudaEventCreateWithFlags(&read_event, cudaEventDisableTiming);
+  cudaEventRecord(read_event, stream);
+  std::lock_guard<std::mutex> lock(d->gpu_images_in_use_mutex);
+  d->gpu_images_in_use.emplace_back(image, read_event);
+}
+
+// Releases the references to the GPU images whose copies have finished (which
+// calls their release callbacks unless the images are still cached as input).
+static void ReleaseFinishedGPUImages(ViewCorrectionDisplayImpl* d) {
+  std::vector<std::shared_ptr<GPUImage>> finished_images;
+  std::unique_lock<std::mutex> lock(d->gpu_images_in_use_mutex);
+  for (std::size_t i = 0; i < d->gpu_images_in_use.size(); ) {
+    if (cudaEventQuery(d->gpu_images_in_use[i].second) == cudaSuccess) {
+      cudaEventDestroy(d->gpu_images_in_use[i].second);
+      finished_images.push_back(d->gpu_images_in_use[i].first);
+      d->gpu_images_in_use.erase(d->gpu_images_in_use.begin() + i);
+    } else {
+      ++ i;
+    }
+  }
+  lock.unlock();
+  
+  // The release callbacks are called here, without holding the lock.
+  finished_images.clear();
+}
+
+// Uploads the depth image to depth_image_gpu, or copies it on the GPU if it is
+// stored in GPU memory.
+static void UploadDepthImage(
+    ViewCorrectionDisplayImpl* d,
+    cudaStream_t stream,
+    const DepthImage& image) {
+  if (!image.gpu_image()) {
+    CUDABufferAdapter(d->depth_image_gpu.get()).UploadAsync(
+        stream, image, d->pinned_input_pool.get());
+    return;
+  }
+  
+  GPUImage* gpu_image = image.gpu_image().get();
+  CHECK_EQ(gpu_image->channels, 1);
+  CHECK_EQ(gpu_image->width, d->depth_image_gpu->width());
+  CHECK_EQ(gpu_image->height, d->depth_image_gpu->height());
+  CopyGPUImageCUDA(stream, gpu_image, gpu_image->width * sizeof(uint16_t),
+                   d->depth_image_gpu->ToCUDA().address(),
+                   d->depth_image_gpu->ToCUDA().pitch());
+  KeepGPUImageUntilRead(d, stream, image.gpu_image());
+}
+
+// Uploads the color image to rgb_image_gpu, or copies it on the GPU if it is
+// stored in GPU memory.
+static void UploadColorImage(
+    ViewCorrectionDisplayImpl* d,
+    cudaStream_t stream,
+    const ColorImage& image,
+    CUDABuffer<uint8_t>* rgb_image_gpu) {
+  if (!image.gpu_image()) {
+    CHECK_EQ(image.rows, rgb_image_gpu->height());
+    CHECK_EQ(3 * image.cols, rgb_image_gpu->width());
+    const cv::Mat_<uint8_t> rgb_image_bytes(
+        image.rows, 3 * image.cols, image.data, image.step);
+    CUDABufferAdapter(rgb_image_gpu).UploadAsync(
+        stream, rgb_image_bytes, d->pinned_input_pool.get());
+    return;
+  }
+  
+  GPUImage* gpu_image = image.gpu_image().get();
+  CHECK_EQ(gpu_image->height, rgb_image_gpu->height());
+  CHECK_EQ(3 * gpu_image->width, rgb_image_gpu->width());
+  if (gpu_image->channels == 3) {
+    CopyGPUImageCUDA(stream, gpu_image, 3 * gpu_image->width,
+                     rgb_image_gpu->ToCUDA().address(),
+                     rgb_image_gpu->ToCUDA().pitch());
+  } else {
+    CHECK_EQ(gpu_image->channels, 4);
+    CUDABuffer_<uchar4> rgbx_image;
+    if (gpu_image->device_data) {
+      // Read the channels in place.
+      if (gpu_image->ready_event) {
+        cudaStreamWaitEvent(stream, gpu_image->ready_event, 0);
+      }
+      rgbx_image = CUDABuffer_<uchar4>(
+          const_cast<uchar4*>(static_cast<const uchar4*>(gpu_image->device_data)),
+          gpu_image->height, gpu_image->width, gpu_image->pitch);
+    } else {
+      if (!d->gpu_image_rgbx ||
+          d->gpu_image_rgbx->width() != gpu_image->width ||
+          d->gpu_image_rgbx->height() != gpu_image->height) {
+        d->gpu_image_rgbx.reset(new CUDABuffer<uchar4>(gpu_image->height, gpu_image->width));
+      }
+      CopyGPUImageCUDA(stream, gpu_image, gpu_image->width * sizeof(uchar4),
+                       d->gpu_image_rgbx->ToCUDA().address(),
+                       d->gpu_image_rgbx->ToCUDA().pitch());
+      rgbx_image = d->gpu_image_rgbx->ToCUDA();
+    }
+    PackRGBXToRGBCUDA(stream, rgbx_image, rgb_image_gpu);
+  }
+  KeepGPUImageUntilRead(d, stream, image.gpu_image());
+}
+
+// Returns whether the previous frame may be re-presented instead of rendering
+// the target frame again (see --vc_reuse_frames). This requires a single
+// target view per frame which is not rendered again for evaluation, and that
+// all inputs of the target frame are tracked by target_input_version (which
+// the TSDF rendering of the mesh input is not).
+static bool UsingFrameReuse() {
+  return FLAGS_vc_reuse_frames && !RenderingStereo() &&
+         !FLAGS_vc_evaluate_rgb_frame_inpainting &&
+         !FLAGS_vc_evaluate_vs_previous_frame &&
+         !(UsingMeshInput() && FLAGS_vc_render_tsdf_in_target);
+}
+
+// Enables the meshing device to write directly to the memory of the render
+// device, which makes the copies of the meshing results peer-to-peer copies.
+// Without peer access, these copies are staged through host memory by CUDA.
+static void EnableMeshingDevicePeerAccess(int meshing_device, int render_device) {
+  int can_access_peer = 0;
+  CUDA_CHECKED_CALL(cudaDeviceCanAccessPeer(
+      &can_access_peer, meshing_device, render_device));
+  if (!can_access_peer) {
+    LOG(WARNING) << "Device " << meshing_device << " cannot access device "
+                 << render_device << " directly, the meshing results will be"
+                 << " copied through host memory.";
+    return;
+  }
+  CUDADeviceScope device_scope(meshing_device);
+  cudaError_t result = cudaDeviceEnablePeerAccess(render_device, 0);
+  if (result == cudaErrorPeerAccessAlreadyEnabled) {
+    // Clear the error state.
+    cudaGetLastError();
+  } else {
+    CUDA_CHECKED_CALL(result);
+  }
+}
+
+// Copies a buffer to a buffer of the same size which may be on another device.
+template <typename T>
+static void CopyBufferAcrossDevices(
+    const CUDABuffer<T>& src, cudaStream_t stream, CUDABuffer<T>* dest) {
+  CHECK_EQ(src.width(), dest->width());
+  CHECK_EQ(src.height(), dest->height());
+  CUDA_CHECKED_CALL(cudaMemcpy2DAsync(
+      dest->ToCUDA().address(), dest->ToCUDA().pitch(),
+      src.ToCUDA().address(), src.ToCUDA().pitch(),
+      src.width() * sizeof(T), src.height(), cudaMemcpyDefault, stream));
+}
+
+// Creates the vertex, color and index buffers for a meshed depth map and
+// registers them with CUDA. CUDA only writes them unless it also renders them
+// (--vc_cuda_depth_warp).
+static void CreateMeshBuffers(
+    int num_vertices,
+    int num_indices,
+    GLuint* vertex_buffer,
+    GLuint* color_buffer,
+    GLuint* index_buffer,
+    cudaGraphicsResource_t* vertex_buffer_resource,
+    cudaGraphicsResource_t* color_buffer_resource,
+    cudaGraphicsResource_t* index_buffer_resource) {
+  CHECK_OPENGL_NO_ERROR();
+  glGenBuffers(1, vertex_buffer);
+  glBindBuffer(GL_ARRAY_BUFFER, *vertex_buffer);
+  glBufferData(GL_ARRAY_BUFFER, num_vertices * 3 * sizeof(float),  // NOLINT
+               nullptr, GL_STREAM_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  CHECK_OPENGL_NO_ERROR();
+  
+  glGenBuffers(1, color_buffer);
+  glBindBuffer(GL_ARRAY_BUFFER, *color_buffer);
+  glBufferData(GL_ARRAY_BUFFER, num_vertices * sizeof(uint8_t),  // NOLINT
+               nullptr, GL_STREAM_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  CHECK_OPENGL_NO_ERROR();
+
+  glGenBuffers(1, index_buffer);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, *index_buffer);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+               num_indices * sizeof(uint32_t),  // NOLINT
+               nullptr, GL_STREAM_DRAW);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  CHECK_OPENGL_NO_ERROR();
+  
+  const unsigned int register_flags =
+      FLAGS_vc_cuda_depth_warp ? cudaGraphicsRegisterFlagsNone :
+                                 cudaGraphicsRegisterFlagsWriteDiscard;
+  CUDA_CHECKED_CALL(cudaGraphicsGLRegisterBuffer(
+      vertex_buffer_resource, *vertex_buffer, register_flags));
+  CUDA_CHECKED_CALL(cudaGraphicsGLRegisterBuffer(
+      color_buffer_resource, *color_buffer, register_flags));
+  CUDA_CHECKED_CALL(cudaGraphicsGLRegisterBuffer(
+      index_buffer_resource, *index_buffer, register_flags));
+}
+
+static void DestroyMeshBuffers(
+    GLuint* vertex_buffer,
+    GLuint* color_buffer,
+    GLuint* index_buffer,
+    cudaGraphicsResource_t vertex_buffer_resource,
+    cudaGraphicsResource_t color_buffer_resource,
+    cudaGraphicsResource_t index_buffer_resource) {
+  cudaGraphicsUnregisterResource(vertex_buffer_resource);
+  cudaGraphicsUnregisterResource(color_buffer_resource);
+  cudaGraphicsUnregisterResource(index_buffer_resource);
+  glDeleteBuffers(1, vertex_buffer);
+  glDeleteBuffers(1, color_buffer);
+  glDeleteBuffers(1, index_buffer);
+}
+
+// Returns whether any of the inpainting solvers runs with a time budget, whose
+// iteration cost estimates are learned from the frame timings.
+static bool UsingInpaintingDeadlines() {
+  return FLAGS_vc_target_inpainting_budget_ms > 0 ||
+         FLAGS_vc_source_inpainting_budget_ms > 0;
+}
+
+// Starts capturing the work enqueued on d->stream into a CUDA graph. Only
+// captures from the calling thread are restricted, such that the asynchronous
+// meshing thread is not affected.
+static void BeginTargetGraphCapture(ViewCorrectionDisplayImpl* d) {
+#if CUDART_VERSION >= 10020
+  CUDA_CHECKED_CALL(cudaStreamBeginCapture(
+      d->stream, cudaStreamCaptureModeThreadLocal));
+#else
+  (void) d;
+  LOG(FATAL) << "CUDA graphs require CUDA 10.2 or newer.";
+#endif
+}
+
+// Ends the capture started with BeginTargetGraphCapture() and launches the
+// captured graph on d->stream. The existing executable graph is updated with
+// the parameters of the new capture if possible, otherwise it is
+// re-instantiated.
+static void EndTargetGraphCaptureAndLaunch(ViewCorrectionDisplayImpl* d) {
+#if CUDART_VERSION >= 10020
+  cudaGraph_t graph;
+  CUDA_CHECKED_CALL(cudaStreamEndCapture(d->stream, &graph));
+  
+  bool updated = false;
+  if (d->have_target_graph_exec) {
+#if CUDART_VERSION >= 12000
+    cudaGraphExecUpdateResultInfo update_result;
+    updated = (cudaGraphExecUpdate(d->target_graph_exec, graph, &update_result) == cudaSuccess);
+#else
+    cudaGraphNode_t error_node;
+    cudaGraphExecUpdateResult update_result;
+    updated = (cudaGraphExecUpdate(d->target_graph_exec, graph, &error_node, &update_result) == cudaSuccess);
+#endif
+    if (!updated) {
+      // Reset the error state of the failed update.
+      cudaGetLastError();
+      cudaGraphExecDestroy(d->target_graph_exec);
+      d->have_target_graph_exec = false;
+    }
+  }
+  if (!d->have_target_graph_exec) {
+    LOG(INFO) << "Instantiating CUDA graph for the target frame pipeline.";
+#if CUDART_VERSION >= 12000
+    CUDA_CHECKED_CALL(cudaGraphInstantiate(&d->target_graph_exec, graph, 0));
+#else
+    CUDA_CHECKED_CALL(cudaGraphInstantiate(&d->target_graph_exec, graph, nullptr, nullptr, 0));
+#endif
+    d->have_target_graph_exec = true;
+  }
+  
+  CUDA_CHECKED_CALL(cudaGraphLaunch(d->target_graph_exec, d->stream));
+  CUDA_CHECKED_CALL(cudaGraphDestroy(graph));
+#else
+  (void) d;
+  LOG(FATAL) << "CUDA graphs require CUDA 10.2 or newer.";
+#endif
+}
+
 ViewCorrectionDisplay::ViewCorrectionDisplay(
     int width, int height, int offset_x, int offset_y,
     TargetViewMode target_view_mode,
     const Intrinsics& depth_intrinsics,
     const Intrinsics& yuv_intrinsics)
     : target_view_mode_(target_view_mode),
+      input_pose_history_(kPoseHistoryCapacity),
       input_mesh_(new MeshStub()),
-      latest_depth_image_timestamp_(0),
+      input_depth_images_(kDepthImageRingCapacity),
+      input_yuv_images_(kYUVImageRingCapacity),
+      used_depth_image_count_(0),
       depth_intrinsics_(depth_intrinsics),
       depth_fx_(depth_intrinsics_.fx),
       depth_fy_(depth_intrinsics_.fy),
@@ -242,16 +1073,77 @@ ViewCorrectionDisplay::ViewCorrectionDisplay(
   LOG(INFO) << "Initializing ViewCorrectionDisplay of size " << width << " x " << height;
   
   d_->have_previous_rendering_ = false;
+  d_->use_shared_stream = false;
+  d_->target_inpainting_arena = nullptr;
+#if CUDART_VERSION >= 10020
+  d_->have_target_graph_exec = false;
+#endif
+  
+  if (!FLAGS_vc_record_session.empty()) {
+    d_->session_recorder.reset(
+        new SessionRecorder(FLAGS_vc_record_session_queue_size));
+    if (!d_->session_recorder->Open(FLAGS_vc_record_session,
+                                    depth_intrinsics, yuv_intrinsics)) {
+      d_->session_recorder.reset();
+    }
+  }
   
   // The Tango tablet's screen is 1920 x 1200 at 323 ppi.
   // The pixel size should remain square. Some suggested resolutions are in the
   // comments:
   target_render_width_  = 480;  // 384;  480;  640;  960;  1920;
   target_render_height_ = 300;  // 240;  300;  400;  600;  1200;
-  if (FLAGS_vc_evaluate_stereo) {
+  if (RenderingStereo()) {
     target_render_width_ /= 2;
   }
   
+  if (FLAGS_vc_dynamic_resolution) {
+    if (RenderingStereo() || FLAGS_vc_evaluate_rgb_frame_inpainting ||
+        FLAGS_vc_evaluate_vs_previous_frame) {
+      LOG(WARNING) << "Dynamic resolution is not supported with stereo"
+                   << " rendering or the evaluation flags, using a fixed"
+                   << " resolution instead.";
+    } else {
+      std::vector<TargetResolution> ladder;
+      if (!ResolutionController::ParseLadder(FLAGS_vc_dynamic_resolution_ladder, &ladder)) {
+        LOG(FATAL) << "Cannot parse --vc_dynamic_resolution_ladder: "
+                   << FLAGS_vc_dynamic_resolution_ladder;
+      }
+      TargetResolution initial_resolution;
+      initial_resolution.width = target_render_width_;
+      initial_resolution.height = target_render_height_;
+      d_->resolution_controller.reset(new ResolutionController(
+          ladder, ResolutionController::FindLevel(ladder, initial_resolution),
+          FLAGS_vc_dynamic_resolution_budget_ms,
+          FLAGS_vc_dynamic_resolution_upscale_fraction,
+          FLAGS_vc_dynamic_resolution_window));
+      target_render_width_ = d_->resolution_controller->resolution().width;
+      target_render_height_ = d_->resolution_controller->resolution().height;
+    }
+  }
+  
+  if (FLAGS_vc_adaptive_meshing) {
+    if (!UsingDepthCameraInput() || FLAGS_vc_debug || FLAGS_vc_write_images ||
+        FLAGS_vc_evaluate_rgb_frame_inpainting || FLAGS_vc_evaluate_vs_previous_frame) {
+      LOG(WARNING) << "Adaptive meshing is only supported with depth camera"
+                   << " input and without debug or evaluation flags, meshing"
+                   << " each new input frame instead.";
+    } else {
+      d_->meshing_scheduler.reset(new MeshingScheduler(
+          FLAGS_vc_adaptive_meshing_max_rotation_deg,
+          FLAGS_vc_adaptive_meshing_max_translation,
+          FLAGS_vc_adaptive_meshing_max_depth_change,
+          FLAGS_vc_adaptive_meshing_max_skipped_frames,
+          FLAGS_vc_adaptive_meshing_budget_ms));
+    }
+  }
+  
+  if (FLAGS_vc_target_inpainting_budget_ms > 0 &&
+      (FLAGS_vc_target_depth_inpainting_budget_fraction <= 0 ||
+       FLAGS_vc_target_depth_inpainting_budget_fraction >= 1)) {
+    LOG(FATAL) << "--vc_target_depth_inpainting_budget_fraction must be in (0, 1).";
+  }
+  
   // Initialize UDP receiver if required.
   if (target_view_mode_ == TargetViewMode::kReceiveFromUDP) {
     constexpr uint16_t udp_pose_port = 9999;
@@ -262,94 +1154,233 @@ ViewCorrectionDisplay::ViewCorrectionDisplay(
   }
   
   d_->output_frame_index = 0;
+  
+  if (FLAGS_vc_pinned_input_slab_count > 0) {
+    // Every image in the input rings may hold a slab, so the pool is sized
+    // for full rings plus the images in use by the pipeline and the staging
+    // of uploads. Otherwise, the allocations fall back to pageable memory.
+    const size_t slab_size = std::max(
+        yuv_intrinsics_.width * yuv_intrinsics_.height * sizeof(cv::Vec3b),
+        depth_intrinsics_.width * depth_intrinsics_.height * sizeof(uint16_t));
+    const int slab_count = kDepthImageRingCapacity + kYUVImageRingCapacity +
+                           FLAGS_vc_pinned_input_slab_count;
+    d_->pinned_input_pool.reset(new PinnedHostMemoryPool(slab_size, slab_count));
+    LOG(INFO) << "Allocated " << slab_count << " page-locked input slabs of "
+              << slab_size << " bytes each.";
+  }
+  
+  if (FLAGS_vc_write_images || FLAGS_vc_write_stereo_result) {
+    d_->image_writer.reset(new ImageWriter(
+        FLAGS_vc_image_writer_threads, FLAGS_vc_image_writer_queue_size));
+  }
 }
 
 ViewCorrectionDisplay::~ViewCorrectionDisplay() {
-  cudaEventDestroy(d_->render_or_upload_depth_start_event);
-  cudaEventDestroy(d_->meshing_start_event);
-  cudaEventDestroy(d_->meshing_upload_end_event);
-  cudaEventDestroy(d_->meshing_downsampling_end_event);
-  cudaEventDestroy(d_->meshing_gradient_mags_end_event);
-  cudaEventDestroy(d_->meshing_inpainting_end_event);
-  cudaEventDestroy(d_->meshing_end_event);
-  
-  cudaEventDestroy(d_->rendering_start_event);
-  cudaEventDestroy(d_->rendering_end_event);
-  cudaEventDestroy(d_->color_reprojection_end_event);
-  cudaEventDestroy(d_->last_frame_reprojection_end_event);
-  cudaEventDestroy(d_->target_depth_inpainting_end_event);
-  cudaEventDestroy(d_->target_color_inpainting_end_event);
+  if (d_->evaluation_frame_count > 0) {
+    // Summary of the evaluation results file.
+    const int count = d_->evaluation_frame_count;
+    const int psnr_count = count - d_->evaluation_identical_frame_count;
+    std::ostringstream summary;
+    summary << "mean L1 " << (d_->evaluation_mean_l1_sum / count) << ", PSNR ";
+    if (psnr_count > 0) {
+      summary << (d_->evaluation_psnr_sum / psnr_count) << " dB";
+    } else {
+      summary << "inf";
+    }
+    if (d_->evaluation_identical_frame_count > 0) {
+      summary << " (excluding " << d_->evaluation_identical_frame_count
+              << " identical frames)";
+    }
+    if (FLAGS_vc_evaluate_ssim) {
+      summary << ", SSIM " << (d_->evaluation_ssim_sum / count);
+    }
+    if (d_->evaluation_results.is_open()) {
+      d_->evaluation_results << "# mean over " << count << " frames: " << summary.str() << std::endl;
+    }
+    LOG(INFO) << "Evaluation vs. previous frame over " << count << " frames: "
+              << summary.str();
+  }
+  
+  if (d_->pinned_input_pool && d_->pinned_input_pool->exhausted_count() > 0) {
+    LOG(WARNING) << d_->pinned_input_pool->exhausted_count()
+                 << " input image allocations or upload stagings used pageable"
+                 << " memory since all " << d_->pinned_input_pool->slab_count()
+                 << " page-locked slabs were in use (see"
+                 << " --vc_pinned_input_slab_count).";
+  }
+  
+  // Write the pending images. The readback needs the OpenGL context.
+  d_->final_image_readback.reset();
+  d_->image_writer.reset();
+  // Write the pending frames of the video output. This needs the stream.
+  d_->video_encoder.reset();
+  
+  if (d_->source_meshing_thread) {
+    // Stop the asynchronous meshing thread and wait for its last job.
+    std::unique_lock<std::mutex> lock(d_->source_meshing_mutex);
+    d_->source_meshing_quit_requested = true;
+    lock.unlock();
+    d_->source_meshing_condition.notify_all();
+    d_->source_meshing_thread->join();
+    
+    cudaStreamSynchronize(d_->source_stream);
+    if (d_->source_meshing_in_flight) {
+      cudaGraphicsResource_t back_resources[3] = {
+          d_->back_vertex_buffer_resource, d_->back_color_buffer_resource,
+          d_->back_index_buffer_resource};
+      cudaGraphicsUnmapResources(3, back_resources, d_->stream);
+    }
+    
+    DestroyMeshBuffers(
+        &d_->back_vertex_buffer, &d_->back_color_buffer, &d_->back_index_buffer,
+        d_->back_vertex_buffer_resource, d_->back_color_buffer_resource,
+        d_->back_index_buffer_resource);
+    if (UsingMeshInput()) {
+      cudaDestroyTextureObject(d_->src_rendered_depth_texture);
+    }
+    cudaDestroyTextureObject(d_->y_image_texture_back);
+    cudaDestroyTextureObject(d_->uv_image_texture_back);
+    cudaEventDestroy(d_->source_meshing_input_ready_event);
+    cudaEventDestroy(d_->source_meshing_done_event);
+  }
+  
+  cudaStreamSynchronize(d_->source_stream);
+  ReleaseFinishedGPUImages(d_.get());
+  cudaEventDestroy(d_->source_inputs_released_event);
+  cudaEventDestroy(d_->source_mesh_ready_event);
+  cudaStreamDestroy(d_->source_stream);
+  
+  for (FrameTimings& timings : d_->frame_timings) {
+    timings.Destroy();
+  }
+  d_->source_meshing_timings.Destroy();
+  
+#if CUDART_VERSION >= 10020
+  if (d_->have_target_graph_exec) {
+    cudaGraphExecDestroy(d_->target_graph_exec);
+  }
+#endif
   
   if (UsingDepthCameraInput()) {
     cudaDestroyTextureObject(d_->depth_image_gpu_texture);
   }
   cudaDestroyTextureObject(d_->gradient_magnitude_div_sqrt2_texture);
+  cudaDestroyTextureObject(d_->y_image_texture);
+  cudaDestroyTextureObject(d_->uv_image_texture);
+  d_->yuv_distortion_lut.reset();
   
   cudaDestroyTextureObject(d_->target_rendered_depth_texture);
+  cudaDestroyTextureObject(d_->target_rendered_intensity_texture);
   
-  cudaGraphicsUnregisterResource(d_->display_color_texture_resource);
-  glDeleteTextures(1, &d_->display_color_texture);
-  cudaGraphicsUnregisterResource(d_->display_depth_texture_resource);
-  glDeleteTextures(1, &d_->display_depth_texture);
+  DestroyDisplaySlots();
+  if (FLAGS_vc_headless) {
+    cudaEventDestroy(d_->headless_result_event);
+  }
+  cudaEventDestroy(d_->view_results_event);
   
-  cudaGraphicsUnregisterResource(d_->vertex_buffer_resource);
-  cudaGraphicsUnregisterResource(d_->color_buffer_resource);
-  cudaGraphicsUnregisterResource(d_->index_buffer_resource);
-  glDeleteBuffers(1, &d_->vertex_buffer);
-  glDeleteBuffers(1, &d_->color_buffer);
-  glDeleteBuffers(1, &d_->index_buffer);
+  DestroyMeshBuffers(
+      &d_->vertex_buffer, &d_->color_buffer, &d_->index_buffer,
+      d_->vertex_buffer_resource, d_->color_buffer_resource,
+      d_->index_buffer_resource);
   
   if (FLAGS_vc_evaluate_rgb_frame_inpainting) {
-    cudaGraphicsUnregisterResource(d_->raw_vertex_buffer_resource);
-    cudaGraphicsUnregisterResource(d_->raw_color_buffer_resource);
-    cudaGraphicsUnregisterResource(d_->raw_index_buffer_resource);
-    glDeleteBuffers(1, &d_->raw_vertex_buffer);
-    glDeleteBuffers(1, &d_->raw_color_buffer);
-    glDeleteBuffers(1, &d_->raw_index_buffer);
+    DestroyMeshBuffers(
+        &d_->raw_vertex_buffer, &d_->raw_color_buffer, &d_->raw_index_buffer,
+        d_->raw_vertex_buffer_resource, d_->raw_color_buffer_resource,
+        d_->raw_index_buffer_resource);
   }
 }
 
+void ViewCorrectionDisplay::ShareResources(
+    cudaStream_t stream, InpaintingArena* target_inpainting_arena) {
+  d_->stream = stream;
+  d_->use_shared_stream = true;
+  d_->target_inpainting_arena = target_inpainting_arena;
+}
+
 void ViewCorrectionDisplay::Init() {
   GLenum error_code;
   while ((error_code = glGetError()) != GL_NO_ERROR) {}
   CHECK_OPENGL_NO_ERROR();
   
   d_->G_T_src_C_timestamp_ = -std::numeric_limits<float>::infinity();
+  d_->consumed_yuv_timestamp_ = d_->G_T_src_C_timestamp_;
   
   const int yuv_width = yuv_intrinsics_.width;
   const int yuv_height = yuv_intrinsics_.height;
   const int depth_width = depth_intrinsics_.width;
   const int depth_height = depth_intrinsics_.height;
   
-  // Create CUDA stream.
-  cudaStreamCreate(&d_->stream);
+  // Choose the device for the source frame meshing. The render device is the
+  // one which is current here.
+  CUDA_CHECKED_CALL(cudaGetDevice(&d_->render_device));
+  if (FLAGS_vc_meshing_device >= 0 && FLAGS_vc_meshing_device != d_->render_device) {
+    if (!FLAGS_vc_async_source_meshing || !UsingDepthCameraInput() ||
+        FLAGS_vc_debug || FLAGS_vc_write_images ||
+        FLAGS_vc_evaluate_rgb_frame_inpainting ||
+        FLAGS_vc_evaluate_vs_previous_frame) {
+      LOG(WARNING) << "--vc_meshing_device requires --vc_async_source_meshing"
+                   << " and depth camera input, and is not supported with"
+                   << " debug or evaluation flags. Meshing on the render"
+                   << " device instead.";
+    } else {
+      d_->meshing_device = FLAGS_vc_meshing_device;
+      EnableMeshingDevicePeerAccess(d_->meshing_device, d_->render_device);
+    }
+  }
+  
+  // Create CUDA streams. The source frame work runs on the meshing device.
+  if (!d_->use_shared_stream) {
+    cudaStreamCreate(&d_->stream);
+  }
+  CUDADeviceScope meshing_device_scope(d_->meshing_device);
+  cudaStreamCreate(&d_->source_stream);
+  d_->source_meshing_timings.Create();
+  meshing_device_scope.End();
+  cudaEventCreateWithFlags(&d_->source_inputs_released_event, cudaEventDisableTiming);
+  cudaEventCreateWithFlags(&d_->source_mesh_ready_event, cudaEventDisableTiming);
   
   // Create CUDA events.
-  cudaEventCreate(&d_->render_or_upload_depth_start_event);
-  cudaEventCreate(&d_->meshing_start_event);
-  cudaEventCreate(&d_->meshing_upload_end_event);
-  cudaEventCreate(&d_->meshing_downsampling_end_event);
-  cudaEventCreate(&d_->meshing_gradient_mags_end_event);
-  cudaEventCreate(&d_->meshing_inpainting_end_event);
-  cudaEventCreate(&d_->meshing_end_event);
-  
-  cudaEventCreate(&d_->rendering_start_event);
-  cudaEventCreate(&d_->rendering_end_event);
-  cudaEventCreate(&d_->color_reprojection_end_event);
-  cudaEventCreate(&d_->last_frame_reprojection_end_event);
-  cudaEventCreate(&d_->target_depth_inpainting_end_event);
-  cudaEventCreateWithFlags(&d_->target_color_inpainting_end_event, cudaEventBlockingSync);
-  
-  // Create input data buffers.
-  d_->depth_image_gpu.reset(new CUDABuffer<uint16_t>(depth_height, depth_width));
-  d_->gradient_magnitude_div_sqrt2.reset(new CUDABuffer<uint8_t>(depth_height, depth_width));
+  for (FrameTimings& timings : d_->frame_timings) {
+    timings.Create();
+  }
+  d_->frame_timings_index = 0;
+  d_->collected_frame_timings_count = 0;
+  d_->latency_metrics.reset(new LatencyMetrics(FLAGS_vc_timings_window));
+  
+  // Create input data buffers. The color images which the target frame reads
+  // are created on the render device, the rest on the meshing device.
+  d_->rgb_image_gpu.reset(new CUDABuffer<uint8_t>(yuv_height, 3 * yuv_width));
   d_->uv_image_gpu.reset(new CUDABuffer<uint16_t>(yuv_height / 2, yuv_width / 2));
   int num_y_pyramid_levels = log2(yuv_height / depth_height) + 1.5;
   d_->y_image_gpu.resize(num_y_pyramid_levels);
-  for (int i = 0; i < num_y_pyramid_levels; ++ i) {
+  d_->y_image_gpu[0].reset(new CUDABuffer<uint8_t>(yuv_height, yuv_width));
+  
+  CreateYUVImageTexturesCUDA(
+      *d_->y_image_gpu[0], *d_->uv_image_gpu,
+      &d_->y_image_texture, &d_->uv_image_texture);
+  if (yuv_intrinsics_.HasDistortion()) {
+    // Computed once here, such that the distortion does not add any cost per
+    // frame compared to a pinhole camera.
+    d_->yuv_distortion_lut.reset(new DistortionLUT(
+        d_->stream, yuv_width, yuv_height,
+        yuv_intrinsics_.fx, yuv_intrinsics_.fy,
+        yuv_intrinsics_.cx, yuv_intrinsics_.cy,
+        yuv_intrinsics_.k1, yuv_intrinsics_.k2, yuv_intrinsics_.k3));
+  }
+  
+  CUDADeviceScope meshing_buffers_scope(d_->meshing_device);
+  d_->depth_image_gpu.reset(new CUDABuffer<uint16_t>(depth_height, depth_width));
+  d_->gradient_magnitude_div_sqrt2.reset(new CUDABuffer<uint8_t>(depth_height, depth_width));
+  for (int i = 1; i < num_y_pyramid_levels; ++ i) {
     d_->y_image_gpu[i].reset(new CUDABuffer<uint8_t>(
         yuv_height / exp2(i), yuv_width / exp2(i)));
   }
+  if (d_->meshing_device >= 0) {
+    d_->meshing_rgb_image.reset(new CUDABuffer<uint8_t>(yuv_height, 3 * yuv_width));
+    d_->meshing_y_image.reset(new CUDABuffer<uint8_t>(yuv_height, yuv_width));
+    d_->meshing_uv_image.reset(new CUDABuffer<uint16_t>(yuv_height / 2, yuv_width / 2));
+  }
   
   d_->gradient_magnitude_div_sqrt2->CreateTextureObject(
       cudaAddressModeClamp, cudaAddressModeClamp, cudaFilterModePoint,
@@ -364,150 +1395,336 @@ void ViewCorrectionDisplay::Init() {
   }
   
   // Create source frame inpainting buffers.
-  d_->src_tv_flag.reset(new CUDABuffer<bool>(depth_height, depth_width));
-  d_->src_tv_dual_flag.reset(new CUDABuffer<bool>(depth_height, depth_width));
-  d_->src_tv_dual_x.reset(new CUDABuffer<int16_t>(depth_height, depth_width));
-  d_->src_tv_dual_y.reset(new CUDABuffer<int16_t>(depth_height, depth_width));
-  d_->src_tv_u_bar.reset(new CUDABuffer<float>(depth_height, depth_width));
-  d_->src_tv_max_change.reset(new CUDABuffer<uint8_t>(1, depth_height * depth_width));
-  d_->src_tv_max_change_float.reset(new CUDABuffer<float>(1, depth_height * depth_width));
+  InpaintingWorkspace* workspace = new InpaintingWorkspace();
+  d_->src_inpainting_workspace.reset(workspace);
+  const int kAllPhases = InpaintingWorkspace::kAllPhases;
+  if (FLAGS_vc_inpainting_method == vc_inpainting_method::TV) {
+    workspace->Add(kAllPhases, depth_height, depth_width, &d_->src_tv_flag);
+    workspace->Add(kAllPhases, depth_height, depth_width, &d_->src_tv_dual_flag);
+    workspace->Add(kAllPhases, depth_height, depth_width, &d_->src_tv_dual_x);
+    workspace->Add(kAllPhases, depth_height, depth_width, &d_->src_tv_dual_y);
+    workspace->Add(kAllPhases, depth_height, depth_width, &d_->src_tv_u_bar);
+    workspace->Add(kAllPhases, 1, depth_height * depth_width, &d_->src_tv_max_change_float);
+    workspace->Add(kAllPhases, depth_height, depth_width, &d_->src_block_activities);
+  } else {
+    workspace->Add(kAllPhases, 1, depth_height * depth_width, &d_->src_tv_max_change);
+  }
+  workspace->Add(kAllPhases, 1, depth_height * depth_width, &d_->src_block_coordinates);
+  workspace->Allocate();
   d_->src_inpainted_depth_map.reset(new CUDABuffer<float>(depth_height, depth_width));
-  d_->src_inpainted_depth_map_alternate.reset(new CUDABuffer<float>(depth_height, depth_width));
-  d_->src_block_coordinates.reset(new CUDABuffer<uint16_t>(
-      1, depth_height * depth_width));
-  d_->src_block_activities.reset(new CUDABuffer<unsigned char>(
-      depth_height, depth_width));
+  if (FLAGS_vc_occlusion_safety_radius > kMaxOcclusionSafetyRadius) {
+    LOG(WARNING) << "--vc_occlusion_safety_radius is limited to "
+                 << kMaxOcclusionSafetyRadius << ".";
+  }
+  d_->src_occlusion_filter.radius = std::max(0, std::min<int>(
+      kMaxOcclusionSafetyRadius, FLAGS_vc_occlusion_safety_radius));
+  d_->src_occlusion_filter.threshold = FLAGS_vc_occlusion_safety_threshold;
+  d_->src_tv_saved_block_iterations = 0;
+  d_->src_inpainting_iterations = 0;
+  if (FLAGS_vc_tv_inpainting_mode == vc_tv_inpainting_mode::classic) {
+    d_->src_tv_inpainting_mode = kIMClassic;
+  } else if (FLAGS_vc_tv_inpainting_mode == vc_tv_inpainting_mode::coarse_to_fine) {
+    d_->src_tv_inpainting_mode = kIMCoarseToFine;
+  } else if (FLAGS_vc_tv_inpainting_mode == vc_tv_inpainting_mode::coarse_to_fine_adaptive) {
+    d_->src_tv_inpainting_mode = kIMCoarseToFineAdaptive;
+  } else {
+    LOG(FATAL) << "Unknown TV inpainting mode: " << FLAGS_vc_tv_inpainting_mode;
+  }
+  if (FLAGS_vc_inpainting_method == vc_inpainting_method::TV &&
+      d_->src_tv_inpainting_mode != kIMClassic) {
+    CHECK_GE(FLAGS_vc_tv_pyramid_levels, 1);
+    d_->src_tv_pyramid.reset(new TVInpaintingPyramid(
+        depth_width, depth_height, FLAGS_vc_tv_pyramid_levels));
+    for (const TVInpaintingPyramid::Level& level : d_->src_tv_pyramid->levels) {
+      d_->coarse_y_image_gpu.emplace_back(new CUDABuffer<uint8_t>(
+          level.depth_input->height(), level.depth_input->width()));
+    }
+  }
+  if (FLAGS_vc_autotune_inpainting_kernels &&
+      FLAGS_vc_inpainting_method == vc_inpainting_method::convolution) {
+    d_->inpainting_autotuner.reset(
+        new InpaintingAutotuner(FLAGS_vc_inpainting_autotune_cache));
+    // The source frame is inpainted on the meshing device, which is current
+    // here.
+    d_->src_convolution_config = d_->inpainting_autotuner->SelectConvolutionConfig(
+        d_->source_stream, depth_width, depth_height,
+        FLAGS_vc_use_weights_for_inpainting,
+        FLAGS_vc_device_resident_inpainting && FLAGS_vc_persistent_inpainting_kernel);
+  }
+  if (FLAGS_vc_inpainting_method == vc_inpainting_method::TV) {
+    d_->src_compaction_buffers.reset(new BlockCompactionBuffers(
+        GetTVInpaintingBlockCount(depth_width, depth_height)));
+  } else if (FLAGS_vc_device_resident_inpainting) {
+    d_->src_compaction_buffers.reset(new BlockCompactionBuffers(
+        GetConvolutionInpaintingBlockCount(depth_width, depth_height,
+                                           d_->src_convolution_config)));
+  }
+  if (FLAGS_vc_incremental_source_update) {
+    if (FLAGS_vc_inpainting_method == vc_inpainting_method::convolution) {
+      d_->src_dirty_tile_buffers.reset(
+          new DirtyTileBuffers(depth_width, depth_height));
+    } else {
+      LOG(WARNING) << "--vc_incremental_source_update is only supported for"
+                   << " convolution inpainting, ignoring it.";
+    }
+  }
 
   // Create vertex and index buffer for meshed inpainted depth map.
   const int num_vertices = depth_width * depth_height;
   d_->num_mesh_indices = MeshRenderer::GetIndexCount(depth_width, depth_height);
+  d_->raw_num_mesh_indices = d_->num_mesh_indices;
+  int index_buffer_size = d_->num_mesh_indices;
+  if (FLAGS_vc_compact_mesh_indices || FLAGS_vc_decimate_mesh) {
+    d_->mesh_index_compaction_buffers.reset(
+        new MeshIndexCompactionBuffers(depth_width, depth_height));
+    index_buffer_size = std::max(
+        index_buffer_size,
+        MeshRenderer::GetMaxTriangleIndexCount(depth_width, depth_height));
+  }
+  if (d_->meshing_device >= 0) {
+    d_->meshing_vertices.reset(new CUDABuffer<float>(1, 3 * num_vertices));
+    d_->meshing_colors.reset(new CUDABuffer<uint8_t>(1, num_vertices));
+    d_->meshing_indices.reset(new CUDABuffer<uint32_t>(1, index_buffer_size));
+  }
+  meshing_buffers_scope.End();
+  
+  // Tune all target resolutions which the dynamic resolution may choose on
+  // the render device now, such that changing the resolution later only
+  // looks them up instead of stalling a frame. The current one is selected
+  // in InitTargetFrameBuffers().
+  if (d_->inpainting_autotuner && d_->resolution_controller) {
+    for (const TargetResolution& resolution : d_->resolution_controller->ladder()) {
+      d_->inpainting_autotuner->SelectConvolutionConfig(
+          d_->stream, resolution.width, resolution.height,
+          FLAGS_vc_use_weights_for_inpainting,
+          FLAGS_vc_device_resident_inpainting && FLAGS_vc_persistent_inpainting_kernel);
+    }
+  }
 
-  CHECK_OPENGL_NO_ERROR();
-  glGenBuffers(1, &d_->vertex_buffer);
-  glBindBuffer(GL_ARRAY_BUFFER, d_->vertex_buffer);
-  glBufferData(GL_ARRAY_BUFFER, num_vertices * 3 * sizeof(float),  // NOLINT
-               nullptr, GL_STREAM_DRAW);
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
-  CHECK_OPENGL_NO_ERROR();
-  
-  glGenBuffers(1, &d_->color_buffer);
-  glBindBuffer(GL_ARRAY_BUFFER, d_->color_buffer);
-  glBufferData(GL_ARRAY_BUFFER, num_vertices * sizeof(uint8_t),  // NOLINT
-               nullptr, GL_STREAM_DRAW);
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
-  CHECK_OPENGL_NO_ERROR();
-
-  glGenBuffers(1, &d_->index_buffer);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, d_->index_buffer);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-               d_->num_mesh_indices * sizeof(uint32_t),  // NOLINT
-               nullptr, GL_STREAM_DRAW);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-  CHECK_OPENGL_NO_ERROR();
-  
-  CUDA_CHECKED_CALL(cudaGraphicsGLRegisterBuffer(
-      &d_->vertex_buffer_resource, d_->vertex_buffer,
-      cudaGraphicsRegisterFlagsWriteDiscard));
-  CUDA_CHECKED_CALL(cudaGraphicsGLRegisterBuffer(
-      &d_->color_buffer_resource, d_->color_buffer,
-      cudaGraphicsRegisterFlagsWriteDiscard));
-  CUDA_CHECKED_CALL(cudaGraphicsGLRegisterBuffer(
-      &d_->index_buffer_resource, d_->index_buffer,
-      cudaGraphicsRegisterFlagsWriteDiscard));
+  CreateMeshBuffers(
+      num_vertices, index_buffer_size,
+      &d_->vertex_buffer, &d_->color_buffer, &d_->index_buffer,
+      &d_->vertex_buffer_resource, &d_->color_buffer_resource,
+      &d_->index_buffer_resource);
   
   if (FLAGS_vc_evaluate_rgb_frame_inpainting) {
-    CHECK_OPENGL_NO_ERROR();
-    glGenBuffers(1, &d_->raw_vertex_buffer);
-    glBindBuffer(GL_ARRAY_BUFFER, d_->raw_vertex_buffer);
-    glBufferData(GL_ARRAY_BUFFER, num_vertices * 3 * sizeof(float),  // NOLINT
-                nullptr, GL_STREAM_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    CHECK_OPENGL_NO_ERROR();
+    CreateMeshBuffers(
+        num_vertices, d_->num_mesh_indices,
+        &d_->raw_vertex_buffer, &d_->raw_color_buffer, &d_->raw_index_buffer,
+        &d_->raw_vertex_buffer_resource, &d_->raw_color_buffer_resource,
+        &d_->raw_index_buffer_resource);
+  }
+  
+  // Create the back buffers for asynchronous meshing and start its thread.
+  // Debug output and evaluation expect the source frame to be processed
+  // synchronously, so fall back to this in these cases.
+  d_->async_source_meshing = FLAGS_vc_async_source_meshing;
+  if (d_->async_source_meshing &&
+      (FLAGS_vc_debug || FLAGS_vc_write_images ||
+       FLAGS_vc_evaluate_rgb_frame_inpainting ||
+       FLAGS_vc_evaluate_vs_previous_frame)) {
+    LOG(WARNING) << "Asynchronous source meshing is not supported with debug"
+                 << " or evaluation flags, meshing synchronously instead.";
+    d_->async_source_meshing = false;
+  }
+  if (d_->async_source_meshing) {
+    cudaEventCreateWithFlags(&d_->source_meshing_input_ready_event, cudaEventDisableTiming);
+    // Recorded on source_stream, so it must be created on its device.
+    CUDADeviceScope done_event_scope(d_->meshing_device);
+    cudaEventCreateWithFlags(&d_->source_meshing_done_event, cudaEventDisableTiming);
+    done_event_scope.End();
     
-    glGenBuffers(1, &d_->raw_color_buffer);
-    glBindBuffer(GL_ARRAY_BUFFER, d_->raw_color_buffer);
-    glBufferData(GL_ARRAY_BUFFER, num_vertices * sizeof(uint8_t),  // NOLINT
-                nullptr, GL_STREAM_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    CHECK_OPENGL_NO_ERROR();
-
-    glGenBuffers(1, &d_->raw_index_buffer);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, d_->raw_index_buffer);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                d_->num_mesh_indices * sizeof(uint32_t),  // NOLINT
-                nullptr, GL_STREAM_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    CHECK_OPENGL_NO_ERROR();
+    d_->rgb_image_gpu_back.reset(new CUDABuffer<uint8_t>(yuv_height, 3 * yuv_width));
+    d_->y_image_gpu_back.reset(new CUDABuffer<uint8_t>(yuv_height, yuv_width));
+    d_->uv_image_gpu_back.reset(new CUDABuffer<uint16_t>(yuv_height / 2, yuv_width / 2));
+    CreateYUVImageTexturesCUDA(
+        *d_->y_image_gpu_back, *d_->uv_image_gpu_back,
+        &d_->y_image_texture_back, &d_->uv_image_texture_back);
+    if (UsingMeshInput()) {
+      d_->src_rendered_depth.reset(new CUDABuffer<float>(depth_height, depth_width));
+      d_->src_rendered_depth->CreateTextureObject(
+          cudaAddressModeClamp, cudaAddressModeClamp, cudaFilterModePoint,
+          cudaReadModeElementType, false, &d_->src_rendered_depth_texture);
+      d_->depth_image_gpu_texture = d_->src_rendered_depth_texture;
+    }
+    CreateMeshBuffers(
+        num_vertices, index_buffer_size,
+        &d_->back_vertex_buffer, &d_->back_color_buffer, &d_->back_index_buffer,
+        &d_->back_vertex_buffer_resource, &d_->back_color_buffer_resource,
+        &d_->back_index_buffer_resource);
     
-    CUDA_CHECKED_CALL(cudaGraphicsGLRegisterBuffer(
-        &d_->raw_vertex_buffer_resource, d_->raw_vertex_buffer,
-        cudaGraphicsRegisterFlagsWriteDiscard));
-    CUDA_CHECKED_CALL(cudaGraphicsGLRegisterBuffer(
-        &d_->raw_color_buffer_resource, d_->raw_color_buffer,
-        cudaGraphicsRegisterFlagsWriteDiscard));
-    CUDA_CHECKED_CALL(cudaGraphicsGLRegisterBuffer(
-        &d_->raw_index_buffer_resource, d_->raw_index_buffer,
-        cudaGraphicsRegisterFlagsWriteDiscard));
+    d_->source_meshing_thread.reset(new std::thread(
+        std::bind(&ViewCorrectionDisplay::SourceMeshingThreadMain, this)));
   }
   
   // Initialize mesh renderer.
   // TODO: could use one renderer with the maximum of the image sizes.
-  d_->src_mesh_renderer_.reset(new MeshRenderer(depth_width, depth_height, MeshRenderer::kRenderDepthOnly));
-  d_->mesh_renderer_.reset(new MeshRenderer(target_render_width_, target_render_height_, MeshRenderer::kRenderDepthAndIntensity));
-  if (UsingMeshInput() && FLAGS_vc_render_tsdf_in_target) {
-    d_->tsdf_mesh_renderer_.reset(new MeshRenderer(target_render_width_, target_render_height_, MeshRenderer::kRenderDepthAndColor));
+  d_->shader_program_cache.reset(new ShaderProgramCache(FLAGS_vc_shader_cache_directory));
+  d_->src_mesh_renderer_.reset(new MeshRenderer(
+      depth_width, depth_height, MeshRenderer::kRenderDepthOnly, 1,
+      d_->shader_program_cache.get()));
+  if (UsingMeshInput()) {
+    d_->mesh_chunk_cache.reset(new MeshChunkCache());
   }
   
-  // Initialize target frame buffers.
-  d_->target_rendered_depth.reset(new CUDABuffer<float>(target_render_height_, target_render_width_));
-  d_->target_rendered_depth->CreateTextureObject(
-      cudaAddressModeClamp, cudaAddressModeClamp, cudaFilterModePoint,
-      cudaReadModeElementType, false, &d_->target_rendered_depth_texture);
-  d_->target_rendered_color.reset(new CUDABuffer<uchar4>(target_render_height_, target_render_width_));
-  d_->target_tv_flag.reset(new CUDABuffer<bool>(target_render_height_, target_render_width_));
-  d_->target_tv_dual_flag.reset(new CUDABuffer<bool>(target_render_height_, target_render_width_));
-  d_->target_tv_dual_x.reset(new CUDABuffer<int16_t>(target_render_height_, target_render_width_));
-  d_->target_tv_dual_y.reset(new CUDABuffer<int16_t>(target_render_height_, target_render_width_));
-  d_->target_tv_u_bar.reset(new CUDABuffer<float>(target_render_height_, target_render_width_));
-  d_->target_tv_max_change.reset(new CUDABuffer<uint8_t>(
-      1, target_render_height_ * target_render_width_));
-  d_->target_tv_max_change_float.reset(new CUDABuffer<float>(
-      1, target_render_height_ * target_render_width_));
-  d_->target_inpainted_depth_map.reset(new CUDABuffer<float>(target_render_height_, target_render_width_));
-  d_->target_block_coordinates.reset(new CUDABuffer<uint16_t>(
-      1, target_render_height_ * target_render_width_));
-  d_->target_block_activities.reset(new CUDABuffer<unsigned char>(
-      target_render_height_, target_render_width_));
-  d_->target_color_tv_flag.reset(new CUDABuffer<bool>(target_render_height_, target_render_width_));
-  d_->target_color_tv_dual_flag.reset(new CUDABuffer<bool>(target_render_height_, target_render_width_));
-  d_->target_color_tv_dual_x_r.reset(new CUDABuffer<float>(target_render_height_, target_render_width_));
-  d_->target_color_tv_dual_x_g.reset(new CUDABuffer<float>(target_render_height_, target_render_width_));
-  d_->target_color_tv_dual_x_b.reset(new CUDABuffer<float>(target_render_height_, target_render_width_));
-  d_->target_color_tv_dual_y_r.reset(new CUDABuffer<float>(target_render_height_, target_render_width_));
-  d_->target_color_tv_dual_y_g.reset(new CUDABuffer<float>(target_render_height_, target_render_width_));
-  d_->target_color_tv_dual_y_b.reset(new CUDABuffer<float>(target_render_height_, target_render_width_));
-  d_->target_color_tv_u_bar_r.reset(new CUDABuffer<float>(target_render_height_, target_render_width_));
-  d_->target_color_tv_u_bar_g.reset(new CUDABuffer<float>(target_render_height_, target_render_width_));
-  d_->target_color_tv_u_bar_b.reset(new CUDABuffer<float>(target_render_height_, target_render_width_));
-  d_->target_color_tv_max_change.reset(new CUDABuffer<uint8_t>(1, target_render_height_ * target_render_width_));
-  d_->target_color_tv_max_change_float.reset(new CUDABuffer<float>(1, target_render_height_ * target_render_width_));
-  d_->target_inpainted_color_rgb.reset(new CUDABuffer<uchar4>(target_render_height_, target_render_width_));
-  d_->target_inpainted_color_r.reset(new CUDABuffer<float>(target_render_height_, target_render_width_));
-  d_->target_inpainted_color_g.reset(new CUDABuffer<float>(target_render_height_, target_render_width_));
-  d_->target_inpainted_color_b.reset(new CUDABuffer<float>(target_render_height_, target_render_width_));
+  InitTargetFrameBuffers();
+  if (FLAGS_vc_target_cuda_graph && !UseTargetCUDAGraph()) {
+    LOG(WARNING) << "Not capturing the target frame pipeline into a CUDA graph"
+                 << " since the configuration does not allow it (see"
+                 << " --vc_target_cuda_graph).";
+  }
   
   // Initialize shader program for display.
   InitDisplay();
   
+  if (!FLAGS_vc_video_output.empty()) {
+    InitVideoOutput();
+  }
+  
 //   // Initialize shader for AR rendering.
 //   if (FLAGS_vc_ar_demo) {
 //     InitAR();
 //   }
 }
 
+void ViewCorrectionDisplay::InitTargetFrameBuffers() {
+  const int height = target_render_height_;
+  const int width = target_render_width_;
+  
+  // Initialize mesh renderers.
+  if (!FLAGS_vc_cuda_depth_warp) {
+    // All views of a frame are rendered into one render target.
+    d_->mesh_renderer_.reset(new MeshRenderer(
+        width, height, MeshRenderer::kRenderDepthAndIntensity,
+        GetTargetViewCapacity(), d_->shader_program_cache.get()));
+  }
+  if (UsingMeshInput() && FLAGS_vc_render_tsdf_in_target) {
+    d_->tsdf_mesh_renderer_.reset(new MeshRenderer(
+        width, height, MeshRenderer::kRenderDepthAndColor, 1,
+        d_->shader_program_cache.get()));
+  }
+  
+  // Initialize target frame buffers.
+  d_->target_rendered_depth.reset(new CUDABuffer<float>(height, width));
+  d_->target_rendered_depth->CreateTextureObject(
+      cudaAddressModeClamp, cudaAddressModeClamp, cudaFilterModePoint,
+      cudaReadModeElementType, false, &d_->target_rendered_depth_texture);
+  d_->target_rendered_color.reset(new CUDABuffer<uchar4>(height, width));
+  if (FLAGS_vc_cuda_depth_warp) {
+    d_->target_warp_z_buffer.reset(new CUDABuffer<uint2>(height, width));
+  }
+  d_->target_rendered_intensity.reset(new CUDABuffer<uint8_t>(height, width));
+  d_->target_rendered_intensity->CreateTextureObject(
+      cudaAddressModeClamp, cudaAddressModeClamp, cudaFilterModePoint,
+      cudaReadModeElementType, false,
+      &d_->target_rendered_intensity_texture);
+  d_->batched_views.resize(GetTargetViewCapacity());
+  for (std::size_t i = 0; i < d_->batched_views.size(); ++ i) {
+    BatchedTargetView* view = new BatchedTargetView();
+    d_->batched_views[i].reset(view);
+    if (i > 0 && !FLAGS_vc_cuda_depth_warp) {
+      view->rendered_depth.reset(new CUDABuffer<float>(height, width));
+      view->rendered_intensity.reset(new CUDABuffer<uint8_t>(height, width));
+    }
+  }
+  d_->batched_view_count = 0;
+  d_->view_result_count = 0;
+  if (FLAGS_vc_headless) {
+    d_->headless_color_result.reset(new CUDABuffer<uchar4>(height, width));
+    d_->headless_depth_result.reset(new CUDABuffer<float>(height, width));
+    d_->have_headless_result = false;
+  }
+  if (FLAGS_vc_warm_start_target_inpainting || FLAGS_vc_stereo) {
+    d_->target_warm_start_depth.reset(new CUDABuffer<float>(height, width));
+    d_->target_warm_start_color.reset(new CUDABuffer<uchar4>(height, width));
+  }
+  
+  const bool use_tv_inpainting =
+      FLAGS_vc_inpainting_method == vc_inpainting_method::TV;
+  InpaintingWorkspace* workspace = new InpaintingWorkspace();
+  d_->target_inpainting_workspace.reset(workspace);
+  if (use_tv_inpainting) {
+    workspace->Add(kTargetDepthInpaintingPhase, height, width, &d_->target_tv_flag);
+    workspace->Add(kTargetDepthInpaintingPhase, height, width, &d_->target_tv_dual_flag);
+    workspace->Add(kTargetDepthInpaintingPhase, height, width, &d_->target_tv_dual_x);
+    workspace->Add(kTargetDepthInpaintingPhase, height, width, &d_->target_tv_dual_y);
+    workspace->Add(kTargetDepthInpaintingPhase, height, width, &d_->target_tv_u_bar);
+    workspace->Add(kTargetDepthInpaintingPhase, 1, height * width, &d_->target_tv_max_change_float);
+    workspace->Add(kTargetDepthInpaintingPhase, height, width, &d_->target_block_activities);
+    
+    workspace->Add(kTargetColorInpaintingPhase, height, width, &d_->target_color_tv_flag);
+    workspace->Add(kTargetColorInpaintingPhase, height, width, &d_->target_color_tv_dual_flag);
+    workspace->Add(kTargetColorInpaintingPhase, height, width, &d_->target_color_tv_dual_x);
+    workspace->Add(kTargetColorInpaintingPhase, height, width, &d_->target_color_tv_dual_y);
+    workspace->Add(kTargetColorInpaintingPhase, height, width, &d_->target_color_tv_u_bar);
+    workspace->Add(kTargetColorInpaintingPhase, 1, height * width, &d_->target_color_tv_max_change_float);
+  } else {
+    workspace->Add(kTargetDepthInpaintingPhase, 1, height * width, &d_->target_tv_max_change);
+    workspace->Add(kTargetColorInpaintingPhase, 1, height * width, &d_->target_color_tv_max_change);
+  }
+  // The block coordinates are used by both target frame phases.
+  workspace->Add(InpaintingWorkspace::kAllPhases, 1, height * width, &d_->target_block_coordinates);
+  workspace->Allocate(d_->target_inpainting_arena);
+  LOG(INFO) << "Target frame inpainting scratch memory: "
+            << (workspace->size() / (1024 * 1024.0)) << " MiB";
+  
+  d_->target_inpainted_depth_map.reset(new CUDABuffer<float>(height, width));
+  if (use_tv_inpainting) {
+    d_->target_inpainted_color_float.reset(new CUDABuffer<float4>(height, width));
+  } else {
+    d_->target_inpainted_color_rgb.reset(new CUDABuffer<uchar4>(height, width));
+  }
+  if (d_->inpainting_autotuner) {
+    // Cached since Init() for the resolutions of the dynamic resolution.
+    d_->target_convolution_config = d_->inpainting_autotuner->SelectConvolutionConfig(
+        d_->stream, width, height, FLAGS_vc_use_weights_for_inpainting,
+        FLAGS_vc_device_resident_inpainting && FLAGS_vc_persistent_inpainting_kernel);
+  }
+  if (use_tv_inpainting) {
+    const int target_block_count = GetTVInpaintingBlockCount(width, height);
+    d_->target_compaction_buffers.reset(new BlockCompactionBuffers(target_block_count));
+    d_->target_color_compaction_buffers.reset(new BlockCompactionBuffers(target_block_count));
+  } else if (FLAGS_vc_device_resident_inpainting) {
+    // The depth is inpainted with the selected configuration, the color with
+    // the blocks of the default one.
+    d_->target_compaction_buffers.reset(new BlockCompactionBuffers(
+        GetConvolutionInpaintingBlockCount(width, height,
+                                           d_->target_convolution_config)));
+    d_->target_color_compaction_buffers.reset(new BlockCompactionBuffers(
+        GetConvolutionInpaintingBlockCount(width, height,
+                                           ConvolutionInpaintingConfig())));
+  }
+  if (FLAGS_vc_persistent_inpainting_kernel && d_->async_source_meshing &&
+      d_->meshing_device < 0 && d_->target_compaction_buffers &&
+      d_->src_compaction_buffers) {
+    // The persistent kernels of the source and target frame passes may run
+    // concurrently on the same device, so each gets half of it.
+    d_->target_compaction_buffers->persistent_kernel_share = 2;
+    d_->src_compaction_buffers->persistent_kernel_share = 2;
+  }
+  if (FLAGS_vc_foveated_inpainting) {
+    d_->foveated_inpainting_buffers.reset(new FoveatedInpaintingBuffers(
+        width, height, FLAGS_vc_foveation_downsampling));
+  }
+  if (FLAGS_vc_target_hole_map) {
+    d_->target_hole_map.reset(new HoleMap(width, height));
+  }
+}
+
 void ViewCorrectionDisplay::InitDisplay() {
-  // Create vertex shader.
-  const GLchar* vertex_shader_src[] = {
+  cudaEventCreateWithFlags(&d_->view_results_event, cudaEventDisableTiming);
+  
+  if (FLAGS_vc_headless) {
+    // There is no screen to display on, the results stay in CUDA buffers.
+    cudaEventCreateWithFlags(&d_->headless_result_event, cudaEventDisableTiming);
+    if (FLAGS_vc_write_images || FLAGS_vc_write_stereo_result) {
+      LOG(WARNING) << "The final images are not written in headless mode.";
+    }
+    return;
+  }
+  
+  // Create shader program.
+  const std::string vertex_shader_src =
       "#version 300 es\n"
       "in vec4 a_position;\n"
       "in vec2 a_tex_coord;\n"
@@ -515,25 +1732,8 @@ void ViewCorrectionDisplay::InitDisplay() {
       "void main() {\n"
       "  v_tex_coord = a_tex_coord;\n"
       "  gl_Position = a_position;\n"
-      "}\n"};
-
-  d_->display_vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-  glShaderSource(d_->display_vertex_shader, 1, vertex_shader_src, NULL);
-  glCompileShader(d_->display_vertex_shader);
-
-  GLint compiled;
-  glGetShaderiv(d_->display_vertex_shader, GL_COMPILE_STATUS, &compiled);
-  if (!compiled) {
-    GLint length;
-    glGetShaderiv(d_->display_vertex_shader, GL_INFO_LOG_LENGTH, &length);
-    std::unique_ptr<GLchar[]> log(
-        reinterpret_cast<GLchar*>(new uint8_t[length]));
-    glGetShaderInfoLog(d_->display_vertex_shader, length, &length, log.get());
-    LOG(FATAL) << "GL Shader Compilation Error: " << log.get();
-  }
-
-  // Create fragment shader.
-  const GLchar* fragment_shader_src[] = {
+      "}\n";
+  const std::string fragment_shader_src =
       "#version 300 es\n"
       "uniform sampler2D color_texture;\n"
       "uniform sampler2D depth_texture;\n"
@@ -546,39 +1746,10 @@ void ViewCorrectionDisplay::InitDisplay() {
       "  highp float depth = texture(depth_texture, v_tex_coord).r;\n"
       "  highp float ndc_depth = (proj22 * depth + proj23) / depth;\n"  // (projection * pos).z / (projection * pos).w
       "  gl_FragDepth = 0.5 * ndc_depth + 0.5;\n"
-      "}\n"};
-
-  d_->display_fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-  glShaderSource(d_->display_fragment_shader, 1, fragment_shader_src, NULL);
-  glCompileShader(d_->display_fragment_shader);
-
-  glGetShaderiv(d_->display_fragment_shader, GL_COMPILE_STATUS, &compiled);
-  if (!compiled) {
-    GLint length;
-    glGetShaderiv(d_->display_fragment_shader, GL_INFO_LOG_LENGTH, &length);
-    std::unique_ptr<GLchar[]> log(
-        reinterpret_cast<GLchar*>(new uint8_t[length]));
-    glGetShaderInfoLog(d_->display_fragment_shader, length, &length, log.get());
-    LOG(FATAL) << "GL Shader Compilation Error: " << log.get();
-  }
+      "}\n";
+  d_->display_shader_program = d_->shader_program_cache->GetProgram(
+      vertex_shader_src, fragment_shader_src);
   
-  // Create shader program.
-  d_->display_shader_program = glCreateProgram();
-  glAttachShader(d_->display_shader_program, d_->display_fragment_shader);
-  glAttachShader(d_->display_shader_program, d_->display_vertex_shader);
-  glLinkProgram(d_->display_shader_program);
-
-  GLint linked;
-  glGetProgramiv(d_->display_shader_program, GL_LINK_STATUS, &linked);
-  if (!linked) {
-    GLint length;
-    glGetProgramiv(d_->display_shader_program, GL_INFO_LOG_LENGTH, &length);
-    std::unique_ptr<GLchar[]> log(
-        reinterpret_cast<GLchar*>(new uint8_t[length]));
-    glGetProgramInfoLog(d_->display_shader_program, length, &length, log.get());
-    LOG(FATAL) << "GL Program Linker Error: " << log.get();
-  }
-
   glUseProgram(d_->display_shader_program);
 
   // Get attributes.
@@ -591,43 +1762,166 @@ void ViewCorrectionDisplay::InitDisplay() {
   
   glUseProgram(0);
   
-  // Create color display texture.
-  glGenTextures(1, &d_->display_color_texture);
-  glBindTexture(GL_TEXTURE_2D, d_->display_color_texture);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, target_render_width_,
-               target_render_height_, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-  CUDA_CHECKED_CALL(cudaGraphicsGLRegisterImage(
-      &d_->display_color_texture_resource, d_->display_color_texture,
-      GL_TEXTURE_2D, cudaGraphicsRegisterFlagsWriteDiscard));
-  
-  // Create depth display texture.
-  glGenTextures(1, &d_->display_depth_texture);
-  glBindTexture(GL_TEXTURE_2D, d_->display_depth_texture);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, target_render_width_,
-               target_render_height_, 0, GL_RED, GL_FLOAT, NULL);
-  CUDA_CHECKED_CALL(cudaGraphicsGLRegisterImage(
-      &d_->display_depth_texture_resource, d_->display_depth_texture,
-      GL_TEXTURE_2D, cudaGraphicsRegisterFlagsWriteDiscard));
+  // Create the display texture slots.
+  CHECK_GE(FLAGS_vc_display_ring_size, 1);
+  int display_ring_size = FLAGS_vc_display_ring_size;
+  if (display_ring_size > 1 &&
+      (FLAGS_vc_debug || FLAGS_vc_write_images || FLAGS_vc_write_stereo_result ||
+       RenderingStereo() || FLAGS_vc_evaluate_rgb_frame_inpainting)) {
+    LOG(WARNING) << "Deferred display is not supported with debug, stereo or"
+                 << " evaluation flags, displaying each frame directly instead.";
+    display_ring_size = 1;
+  }
+  CreateDisplaySlots(display_ring_size);
+  
+  if (d_->image_writer) {
+    d_->final_image_readback.reset(new FramebufferReadback(
+        kFinalImageReadbackBufferCount, d_->image_writer.get()));
+  }
+}
+
+void ViewCorrectionDisplay::InitVideoOutput() {
+  if (!VideoEncoder::IsAvailable()) {
+    LOG(ERROR) << "Not writing --vc_video_output: the video encoder requires"
+               << " building with the VIEW_CORRECTION_NVENC CMake option.";
+    return;
+  }
+  if (RenderingStereo()) {
+    LOG(WARNING) << "The video output is not supported with stereo rendering.";
+    return;
+  }
+  
+  VideoEncoder::Settings settings;
+  if (FLAGS_vc_video_codec == vc_video_codec::h264) {
+    settings.codec = VideoEncoder::Codec::kH264;
+  } else if (FLAGS_vc_video_codec == vc_video_codec::hevc) {
+    settings.codec = VideoEncoder::Codec::kHEVC;
+  } else {
+    LOG(FATAL) << "Unknown --vc_video_codec: " << FLAGS_vc_video_codec;
+  }
+  settings.bitrate_kbps = FLAGS_vc_video_bitrate_kbps;
+  settings.frame_rate = FLAGS_vc_video_frame_rate;
+  settings.vbv_frames = FLAGS_vc_video_vbv_frames;
+  settings.idr_interval = FLAGS_vc_video_idr_interval;
+  settings.buffer_count = FLAGS_vc_video_buffer_count;
+  
+  // The video has the target render resolution. The encoder is created for
+  // the largest resolution of the dynamic resolution ladder, such that it is
+  // only reconfigured if the resolution changes.
+  int max_width = target_render_width_;
+  int max_height = target_render_height_;
+  if (d_->resolution_controller) {
+    for (const TargetResolution& resolution : d_->resolution_controller->ladder()) {
+      max_width = std::max(max_width, resolution.width);
+      max_height = std::max(max_height, resolution.height);
+    }
+  }
+  d_->video_encoder.reset(new VideoEncoder(
+      max_width, max_height, d_->stream, settings, FLAGS_vc_video_output));
+}
+
+void ViewCorrectionDisplay::CreateDisplaySlots(int count) {
+  d_->display_slots.resize(count);
+  for (std::unique_ptr<DisplayTextureSlot>& slot : d_->display_slots) {
+    slot.reset(new DisplayTextureSlot());
+    
+    // Create color display texture.
+    glGenTextures(1, &slot->color_texture);
+    glBindTexture(GL_TEXTURE_2D, slot->color_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, target_render_width_,
+                 target_render_height_, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    CUDA_CHECKED_CALL(cudaGraphicsGLRegisterImage(
+        &slot->color_texture_resource, slot->color_texture,
+        GL_TEXTURE_2D,
+        cudaGraphicsRegisterFlagsSurfaceLoadStore |
+            cudaGraphicsRegisterFlagsWriteDiscard));
+    
+    // Create depth display texture.
+    glGenTextures(1, &slot->depth_texture);
+    glBindTexture(GL_TEXTURE_2D, slot->depth_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, target_render_width_,
+                 target_render_height_, 0, GL_RED, GL_FLOAT, NULL);
+    CUDA_CHECKED_CALL(cudaGraphicsGLRegisterImage(
+        &slot->depth_texture_resource, slot->depth_texture,
+        GL_TEXTURE_2D,
+        cudaGraphicsRegisterFlagsSurfaceLoadStore |
+            cudaGraphicsRegisterFlagsWriteDiscard));
+    
+    cudaEventCreateWithFlags(&slot->written_event, cudaEventDisableTiming);
+  }
+  d_->display_frame_count = 0;
+  d_->displayed_frame_index = -1;
+}
+
+void ViewCorrectionDisplay::DestroyDisplaySlots() {
+  for (const std::unique_ptr<DisplayTextureSlot>& slot : d_->display_slots) {
+    cudaEventDestroy(slot->written_event);
+    cudaGraphicsUnregisterResource(slot->color_texture_resource);
+    glDeleteTextures(1, &slot->color_texture);
+    cudaGraphicsUnregisterResource(slot->depth_texture_resource);
+    glDeleteTextures(1, &slot->depth_texture);
+  }
+  d_->display_slots.clear();
+}
+
+void ViewCorrectionDisplay::ChangeTargetResolution() {
+  const TargetResolution& resolution = d_->resolution_controller->resolution();
+  LOG(INFO) << "Changing the target frame resolution from "
+            << target_render_width_ << " x " << target_render_height_
+            << " to " << resolution.width << " x " << resolution.height;
+  
+  // The display slots are written and the target frame buffers are used on
+  // stream only.
+  CUDA_CHECKED_CALL(cudaStreamSynchronize(d_->stream));
+  
+#if CUDART_VERSION >= 10020
+  if (d_->have_target_graph_exec) {
+    cudaGraphExecDestroy(d_->target_graph_exec);
+    d_->have_target_graph_exec = false;
+  }
+#endif
+  cudaDestroyTextureObject(d_->target_rendered_depth_texture);
+  cudaDestroyTextureObject(d_->target_rendered_intensity_texture);
+  const int display_ring_size = d_->display_slots.size();
+  DestroyDisplaySlots();
+  
+  target_render_width_ = resolution.width;
+  target_render_height_ = resolution.height;
+  InitTargetFrameBuffers();
+  CreateDisplaySlots(display_ring_size);
+  
+  // The previous result cannot be reprojected (or re-presented) since the
+  // buffers are new.
+  d_->have_previous_rendering_ = false;
+  d_->have_reusable_frame = false;
 }
 
 bool ViewCorrectionDisplay::Render() {
   // Clear OpenGL errors which happened before.
   while (glGetError() != GL_NO_ERROR);
   
+  // Hand the final images of earlier frames whose readback has finished to
+  // the image writer.
+  if (d_->final_image_readback) {
+    d_->final_image_readback->Poll();
+  }
+  ReleaseFinishedGPUImages(d_.get());
+  
   // Run pipeline normally.
   RunPipeline(true, true, false);
   
-  if (FLAGS_vc_evaluate_stereo) {
-    // Render the right image (the first one was the left one).
-    RunPipeline(false, true, true);
+  if (RenderingStereo()) {
+    // Render the right image (the first one was the left one). With
+    // --vc_stereo, it was set up and rendered together with the left one.
+    RunPipeline(false, true, true, FLAGS_vc_stereo ? 1 : 0);
   }
   
   // If enabled, also render the same image with different settings for
@@ -636,68 +1930,142 @@ bool ViewCorrectionDisplay::Render() {
     RunPipeline(false, false, false);
   }
   
+  // The display time set with SetNextDisplayTime() only applies to this frame.
+  have_next_display_time_ = false;
+  
+  return true;
+}
+
+bool ViewCorrectionDisplay::RenderViews(const TargetViews& views) {
+  CHECK(!views.empty());
+  CHECK_LE(static_cast<int>(views.size()), FLAGS_vc_max_target_views)
+      << "Increase --vc_max_target_views to render more views.";
+  CHECK(!RenderingStereo() && !FLAGS_vc_evaluate_rgb_frame_inpainting &&
+        !FLAGS_vc_evaluate_vs_previous_frame)
+      << "Rendering multiple views is not supported with stereo rendering or"
+      << " the evaluation flags.";
+  
+  // Clear OpenGL errors which happened before.
+  while (glGetError() != GL_NO_ERROR);
+  
+  if (d_->final_image_readback) {
+    d_->final_image_readback->Poll();
+  }
+  ReleaseFinishedGPUImages(d_.get());
+  
+  // Update the input once and render all views in the run for the first
+  // view. The following runs only inpaint their view.
+  d_->requested_views = views;
+  d_->view_result_count = 0;
+  for (int i = 0; i < static_cast<int>(views.size()); ++ i) {
+    RunPipeline(i == 0, true, false, i);
+  }
+  d_->requested_views.clear();
+  cudaEventRecord(d_->view_results_event, d_->stream);
+  
+  return true;
+}
+
+int64_t ViewCorrectionDisplay::reused_frame_count() const {
+  return d_->reused_frame_count;
+}
+
+bool ViewCorrectionDisplay::GetViewResult(
+    int view_index,
+    const CUDABuffer<uchar4>** color,
+    const CUDABuffer<float>** depth,
+    cudaEvent_t* ready_event) {
+  if (view_index < 0 || view_index >= d_->view_result_count) {
+    return false;
+  }
+  const BatchedTargetView& view = *d_->batched_views[view_index];
+  *color = view.result_color.get();
+  *depth = view.result_depth.get();
+  *ready_event = d_->view_results_event;
   return true;
 }
 
-bool ViewCorrectionDisplay::RunPipeline(bool update_data, bool inpaint_in_rgb_frame, bool render_stereo_image) {
+bool ViewCorrectionDisplay::RunPipeline(bool update_data, bool inpaint_in_rgb_frame, bool render_stereo_image, int view_index) {
+  NVTXRange pipeline_range("RunPipeline");
+  pipeline_range.AddValue("view index", view_index);
   if (!FLAGS_vc_evaluate_vs_previous_frame) {
     ++ d_->output_frame_index;
   }
   
+  // Forget the views of the previous frame before anything can return early,
+  // such that the runs of the other views do not inpaint stale renderings.
+  if (view_index == 0) {
+    d_->batched_view_count = 0;
+    d_->batched_views_rendered = false;
+  }
+  
+  // The resolution is only changed at the start of a frame, since the views
+  // of a frame are rendered into the target frame buffers together.
+  if (d_->target_resolution_change_pending && view_index == 0) {
+    ChangeTargetResolution();
+    d_->target_resolution_change_pending = false;
+  }
+  
+  FrameTimings* timings = &d_->frame_timings[d_->frame_timings_index];
+  
   // If using depth camera input and a new depth map & color image pair is
   // available, or using mesh input, update the meshed inpainted depth map.
-  // NOTE(puzzlepaint): This could be done asynchronously to the render loop,
-  // possibly even with a lower frequency.
+  // With asynchronous source meshing, this is done in the background and new
+  // input is only taken once the previous meshing job has finished.
+  NVTXRange ingest_range("Ingest");
+  bool source_meshing_idle = true;
+  if (update_data && d_->async_source_meshing) {
+    source_meshing_idle = PollAsynchronousMeshing();
+  }
+  
   DepthImage new_depth_image;
   ColorImage new_yuv_image;
   bool have_new_input = false;
-  if (update_data) {
-    std::unique_lock<std::mutex> input_lock(input_mutex_);
+  if (update_data && source_meshing_idle && d_->mesh_chunk_cache) {
+    // Upload the mesh chunks which changed since the last frame. The updates
+    // are taken under the lock, but uploaded without holding it.
+    MeshChunkUpdates mesh_chunk_updates;
+    {
+      std::lock_guard<std::mutex> input_lock(input_mutex_);
+      mesh_chunk_updates.swap(pending_mesh_chunk_updates_);
+    }
+    if (!mesh_chunk_updates.empty()) {
+      d_->mesh_chunk_cache->Update(mesh_chunk_updates);
+      ++ d_->target_input_version;
+      VLOG(1) << "Uploaded " << mesh_chunk_updates.size() << " mesh chunk updates ("
+              << d_->mesh_chunk_cache->last_upload_size() << " bytes), "
+              << d_->mesh_chunk_cache->chunk_count() << " chunks in total.";
+    }
+  }
+  
+  if (update_data && source_meshing_idle) {
     // Check for new input in the case of using the depth camera images directly.
-    if (!input_depth_image_.empty()) {
-      new_depth_image = input_depth_image_;
-      
+    const uint64_t depth_image_count = input_depth_images_.push_count();
+    if (depth_image_count != used_depth_image_count_ &&
+        input_depth_images_.GetLatest(&new_depth_image)) {
       // Search for the yuv image with the closest timestamp to the input depth image.
-      if (!input_yuv_images_.empty() &&
-          input_yuv_images_.front().timestamp_ns() > new_depth_image.timestamp_ns()) {
+      ColorImage oldest_yuv_image;
+      if (!input_yuv_images_.GetOldest(&oldest_yuv_image)) {
+        LOG(WARNING) << "No color image available yet for depth image.";
+      } else if (oldest_yuv_image.timestamp_ns() > new_depth_image.timestamp_ns()) {
         LOG(ERROR) << "No suitable color image cached anymore for depth"
-                   << " image. Increase the caching time.";
-        new_yuv_image = input_yuv_images_.front();
-      } else {
-        for (int i = 0; i < static_cast<int>(input_yuv_images_.size()) - 1; ++ i) {
-          uint64_t prev_timestamp = input_yuv_images_[i].timestamp_ns();
-          uint64_t next_timestamp = input_yuv_images_[i + 1].timestamp_ns();
-          if (prev_timestamp <= new_depth_image.timestamp_ns() &&
-              next_timestamp >= new_depth_image.timestamp_ns()) {
-            // Choose YUV image which is closest to the depth image.
-            if (new_depth_image.timestamp_ns() - prev_timestamp >
-                next_timestamp - new_depth_image.timestamp_ns()) {
-              new_yuv_image = input_yuv_images_[i + 1];
-              break;
-            } else {
-              new_yuv_image = input_yuv_images_[i];
-              break;
-            }
-          }
-        }
-        
-        if (new_yuv_image.empty()) {
-          if (input_yuv_images_.empty()) {
-            LOG(WARNING) << "No color image available yet for depth image.";
-          } else {
-            // No color image available which is newer than the last depth image.
-            // Wait longer. This may happen for datasets with sparse color image
-            // recording.
-            LOG(WARNING) << "No color image available which is newer than the"
-                        << " last depth image. Using last one.";
-            new_yuv_image = input_yuv_images_.back();
-          }
-        }
+                   << " image. Increase the cache capacity.";
+        new_yuv_image = oldest_yuv_image;
+      } else if (!input_yuv_images_.FindClosest(
+                     new_depth_image.timestamp_ns(), &new_yuv_image)) {
+        // No color image available which is newer than the last depth image.
+        // Wait longer. This may happen for datasets with sparse color image
+        // recording.
+        LOG(WARNING) << "No color image available which is newer than the"
+                     << " last depth image. Using last one.";
+        input_yuv_images_.GetLatest(&new_yuv_image);
       }
     }
-    if (!new_depth_image.empty() && !new_yuv_image.empty()) {
+    
+    std::unique_lock<std::mutex> input_lock(input_mutex_);
+    if (new_depth_image.has_content() && new_yuv_image.has_content()) {
       have_new_input = true;
-      input_depth_image_.release();
+      used_depth_image_count_ = depth_image_count;
       if (FLAGS_vc_evaluate_vs_previous_frame) {
         if (!input_mesh_->empty()) {
           mesh_to_render = input_mesh_;
@@ -706,34 +2074,31 @@ bool ViewCorrectionDisplay::RunPipeline(bool update_data, bool inpaint_in_rgb_fr
     }
     
     // Check for new input in the case of using meshes.
-    if (!FLAGS_vc_evaluate_vs_previous_frame && !input_mesh_->empty() && !input_yuv_images_.empty()) {
+    const bool have_mesh_chunks =
+        d_->mesh_chunk_cache && !d_->mesh_chunk_cache->empty();
+    if (!FLAGS_vc_evaluate_vs_previous_frame &&
+        (!input_mesh_->empty() || have_mesh_chunks) &&
+        input_yuv_images_.push_count() > 0) {
       have_new_input = true;
-      mesh_to_render = input_mesh_;
+      mesh_to_render = input_mesh_->empty() ? nullptr : input_mesh_;
       
       // Choose the latest YUV image for which the pose is available without waiting.
+      // Older images are left to be overwritten in the ring.
       uint64_t latest_timestamp = GetCurrentTimestamp();
-      
-      int num_images_to_delete = 0;
-      new_yuv_image = input_yuv_images_.front();
-      for (size_t i = 1; i < input_yuv_images_.size(); ++ i) {
-        if (input_yuv_images_[i].timestamp_ns() <= latest_timestamp) {
-          new_yuv_image = input_yuv_images_[i];
-          num_images_to_delete = i - 1;
-        }
-      }
-      
-      for (int i = 0; i < num_images_to_delete; ++ i) {
-        input_yuv_images_.erase(input_yuv_images_.begin());
+      if (!input_yuv_images_.FindLatestNotAfter(latest_timestamp, &new_yuv_image)) {
+        input_yuv_images_.GetOldest(&new_yuv_image);
       }
       
       // Set have_new_input = false if the chosen image is not new.
       // NOTE: Comment this out for performance measurements (to simulate live mode where new color images are available in every frame)!
-      if (new_yuv_image.timestamp_ns() <= d_->G_T_src_C_timestamp_) {
+      if (new_yuv_image.timestamp_ns() <= d_->consumed_yuv_timestamp_) {
         have_new_input = false;
       }
     }
     input_lock.unlock();
   }
+  ingest_range.AddValue("new input", have_new_input);
+  ingest_range.End();
   if (FLAGS_vc_evaluate_vs_previous_frame &&
       (!have_new_input ||
           (!last_yuv_image_.empty() && new_yuv_image.timestamp_ns() == last_yuv_image_.timestamp_ns()))) {
@@ -741,41 +2106,65 @@ bool ViewCorrectionDisplay::RunPipeline(bool update_data, bool inpaint_in_rgb_fr
   }
   
   uint32_t num_src_depth_pixels_to_inpaint = 0;
+  Sophus::SE3f G_T_src_C;
   if (have_new_input) {
     if (FLAGS_vc_evaluate_vs_previous_frame) {
       d_->output_frame_index = 1000 * kNanosecondsToSeconds * new_yuv_image.timestamp_ns();
     }
     
     // Get pose of yuv image.
-    bool success = GetYUVImagePose(new_yuv_image, &d_->G_T_src_C_);
-    d_->G_T_src_C_timestamp_ = new_yuv_image.timestamp_ns();
+    bool success = GetYUVImagePose(new_yuv_image, &G_T_src_C);
+    d_->consumed_yuv_timestamp_ = new_yuv_image.timestamp_ns();
     if (!success) {
       // Show red screen to signal that something went wrong.
-      glViewport(offset_x_, offset_y_, width_, height_);
-      glClearColor(0.9, 0.1, 0.1, 1.0);
-      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+      ClearScreen(0.9, 0.1, 0.1);
       return true;
     }
     
+    // Keep the current mesh if the camera and the scene barely changed since
+    // it was created. The input frame is consumed either way.
+    if (d_->meshing_scheduler) {
+      const bool mesh = d_->meshing_scheduler->ShouldMesh(G_T_src_C, new_depth_image);
+      LatencyMetrics* metrics = d_->latency_metrics.get();
+      metrics->AddSample("S_meshed", mesh ? 1 : 0);
+      metrics->AddSample("S_change_score", d_->meshing_scheduler->last_change_score());
+      metrics->AddSample("S_depth_change_ratio", d_->meshing_scheduler->last_depth_change_ratio());
+      pipeline_range.AddValue("meshed", mesh);
+      have_new_input = mesh;
+    }
+    if (have_new_input && !d_->async_source_meshing) {
+      d_->G_T_src_C_ = G_T_src_C;
+      d_->G_T_src_C_timestamp_ = new_yuv_image.timestamp_ns();
+    }
+    
 //     // Use latest "device" pose for the image (should be very close) for
 //     // consistency (the other way returned different poses).
 //     std::unique_lock<std::mutex> input_lock(input_mutex_);
 //     d_->G_T_src_C_ = input_G_T_C_;
 //     d_->G_T_src_C_timestamp_ = input_G_T_C_timestamp_;
 //     input_lock.unlock();
+  }
+  
+  if (have_new_input && d_->async_source_meshing) {
+    StartAsynchronousMeshing(new_depth_image, new_yuv_image, G_T_src_C);
+  } else if (have_new_input) {
+    // The source frame work runs on source_stream. It must not overwrite the
+    // source frame inputs before the previous target frame has projected them.
+    cudaStreamWaitEvent(d_->source_stream, d_->source_inputs_released_event, 0);
     
     // Render or upload depth map.
-    cudaEventRecord(d_->render_or_upload_depth_start_event, d_->stream);
-    if (mesh_to_render) {
+    NVTXRange upload_range("RenderOrUploadDepth");
+    cudaEventRecord(timings->render_or_upload_depth_start_event, d_->source_stream);
+    if (HaveMeshToRender()) {
       // Render depth image from mesh.
-      RenderDepthImageFromMesh(*mesh_to_render, d_->G_T_src_C_);
+      RenderDepthImageFromMesh(d_->G_T_src_C_);
       d_->depth_image_gpu_texture =
           d_->src_mesh_renderer_->MapDepthResultAsTexture(
               cudaAddressModeClamp, cudaAddressModeClamp, cudaFilterModePoint,
-              false, d_->stream);
+              false, d_->source_stream);
     } else {
       // Upload depth map.
-      d_->depth_image_gpu->UploadPitchedAsync(d_->stream, new_depth_image.step, reinterpret_cast<const uint16_t*>(new_depth_image.data));
+      UploadDepthImage(d_.get(), d_->source_stream, new_depth_image);
     }
     
     // Debug: show initial depth map.
@@ -783,60 +2172,74 @@ bool ViewCorrectionDisplay::RunPipeline(bool update_data, bool inpaint_in_rgb_fr
       if (UsingMeshInput()) {
         CUDABuffer<float> temp_depth_buffer(d_->depth_image_gpu->height(),
                                             d_->depth_image_gpu->width());
-        temp_depth_buffer.SetTo(d_->depth_image_gpu_texture, d_->stream);
+        temp_depth_buffer.SetTo(d_->depth_image_gpu_texture, d_->source_stream);
         std::ostringstream filename;
         filename << "debug_images/" << d_->output_frame_index << "_0_source_depth.png";
-        CUDABufferVisualization(temp_depth_buffer).DisplayDepthMap(kMinDepthForDisplay, kMaxDepthForDisplay, "0 - Source frame depth rendering", false, FLAGS_vc_write_images ? filename.str().c_str() : nullptr);
+        CUDABufferVisualization(temp_depth_buffer).DisplayDepthMap(kMinDepthForDisplay, kMaxDepthForDisplay, "0 - Source frame depth rendering", false, FLAGS_vc_write_images ? filename.str().c_str() : nullptr, d_->image_writer.get());
       } else {
-        cv::Mat_<float> buffer_cpu(d_->depth_image_gpu->height(),
-                                   d_->depth_image_gpu->width());
-        for (int y = 0; y < buffer_cpu.rows; ++y) {
-          for (int x = 0; x < buffer_cpu.cols; ++x) {
-            buffer_cpu(y, x) = (1 / 1000.f) * *(reinterpret_cast<const uint16_t*>(new_depth_image.data + y * new_depth_image.step) + x);
-          }
-        }
-        cv::Mat mat =
-            util::GetInvDepthColoredDepthmapMat(buffer_cpu, kMinDepthForDisplay, kMaxDepthForDisplay);
+        // Colorize the uploaded depth map (in millimeters) on the GPU.
+        CUDABuffer<uchar4> colormap(d_->depth_image_gpu->height(),
+                                    d_->depth_image_gpu->width());
+        InvDepthColormapCUDA(d_->source_stream, *d_->depth_image_gpu, 1 / 1000.f,
+                             kMinDepthForDisplay, kMaxDepthForDisplay, &colormap);
+        cudaStreamSynchronize(d_->source_stream);
+        cv::Mat mat = DownloadBGRAImageAsBGR(colormap);
         if (FLAGS_vc_debug) {
           cv::imshow("0 - Source frame depth input", mat);
         }
         if (FLAGS_vc_write_images) {
           std::ostringstream filename;
           filename << "debug_images/" << d_->output_frame_index << "_0_source_depth.png";
-          cv::imwrite(filename.str(), mat);
+          d_->image_writer->Write(filename.str(), mat);
         }
       }
     }
+    upload_range.End();
     
-    CreateMeshedInpaintedDepthMap(new_yuv_image, &num_src_depth_pixels_to_inpaint);
+    CreateMeshedInpaintedDepthMap(new_yuv_image, false, timings, &num_src_depth_pixels_to_inpaint);
     
-    if (mesh_to_render) {
+    if (HaveMeshToRender()) {
       d_->src_mesh_renderer_->UnmapDepthResult(d_->depth_image_gpu_texture,
-                                               d_->stream);
+                                               d_->source_stream);
     }
+    
+    // Hand the mesh and the source frame inputs over to the target frame work.
+    cudaEventRecord(d_->source_mesh_ready_event, d_->source_stream);
+    cudaStreamWaitEvent(d_->stream, d_->source_mesh_ready_event, 0);
+    ++ d_->target_input_version;
   }
   
   if (!d_->have_meshed_inpainted_depth_map) {
     // No depth input yet.
-    glViewport(offset_x_, offset_y_, width_, height_);
-    glClearColor(0.1, 0.1, 0.1, 1.0);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    ClearScreen(0.1, 0.1, 0.1);
     return true;
   }
   
   // Get latest available color camera pose.
-  // NOTE: The correct pose to use would be the expected pose at the time at
-  // which the result of this rendering iteration is displayed.
   bool pose_retrieval_result = GetCurrentColorCameraPose(&G_T_latest_C, &G_T_latest_C_timestamp);
   if (!pose_retrieval_result) {
     LOG(ERROR) << "Cannot get latest color camera pose";
     // Show red screen to signal that something went wrong.
-    glViewport(offset_x_, offset_y_, width_, height_);
-    glClearColor(0.9, 0.1, 0.1, 1.0);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    ClearScreen(0.9, 0.1, 0.1);
     return true;
   }
   
+  // Predict the pose at the time at which the result of this rendering
+  // iteration is displayed. Fall back to the latest pose if that fails.
+  Sophus::SE3f G_T_display_C = G_T_latest_C;
+  uint64_t display_timestamp;
+  if (have_next_display_time_) {
+    display_timestamp = std::chrono::duration<double, std::nano>(
+        next_display_time_ - start_time_).count();
+  } else {
+    display_timestamp = GetCurrentTimestamp() +
+        static_cast<int64_t>(1000 * 1000 * FLAGS_vc_display_time_offset_ms);
+  }
+  uint64_t max_extrapolation_ns = 1000 * 1000 * FLAGS_vc_max_pose_extrapolation_ms;
+  if (!PredictColorCameraPose(display_timestamp, max_extrapolation_ns, &G_T_display_C)) {
+    G_T_display_C = G_T_latest_C;
+  }
+  
 //   if (update_data) {
 //     std::unique_lock<std::mutex> input_lock(input_mutex_);
 //     G_T_latest_C = input_G_T_C_;
@@ -854,16 +2257,57 @@ bool ViewCorrectionDisplay::RunPipeline(bool update_data, bool inpaint_in_rgb_fr
   float target_fy;
   float target_cx;
   float target_cy;
-  if (!SetupTargetView(G_T_latest_C, render_stereo_image, &target_T_src, &target_fx,
-                       &target_fy, &target_cx, &target_cy)) {
+  // The views of the frame are all set up in the run for the first view.
+  if (view_index == 0) {
+    if (!d_->requested_views.empty()) {
+      for (std::size_t i = 0; i < d_->requested_views.size(); ++ i) {
+        const TargetView& requested_view = d_->requested_views[i];
+        BatchedTargetView* view = d_->batched_views[i].get();
+        view->target_T_src = requested_view.target_T_G * d_->G_T_src_C_;
+        view->fx = requested_view.fx;
+        view->fy = requested_view.fy;
+        view->cx = requested_view.cx;
+        view->cy = requested_view.cy;
+      }
+      d_->batched_view_count = d_->requested_views.size();
+    } else {
+      BatchedTargetView* view = d_->batched_views[0].get();
+      if (SetupTargetView(G_T_display_C, render_stereo_image, &view->target_T_src,
+                          &view->fx, &view->fy, &view->cx, &view->cy)) {
+        d_->batched_view_count = 1;
+        if (FLAGS_vc_stereo) {
+          BatchedTargetView* right_view = d_->batched_views[1].get();
+          CHECK(SetupTargetView(G_T_display_C, true, &right_view->target_T_src,
+                                &right_view->fx, &right_view->fy,
+                                &right_view->cx, &right_view->cy))
+              << "The right eye view depends on the same input as the left"
+              << " eye view.";
+          d_->batched_view_count = 2;
+        }
+      }
+    }
+  }
+  // The other views need the renderings kept by the first view's run, unless
+  // each run rasterizes its own view.
+  const bool have_target_view =
+      view_index < d_->batched_view_count &&
+      (view_index == 0 || FLAGS_vc_cuda_depth_warp ||
+       d_->batched_views_rendered);
+  if (have_target_view) {
+    const BatchedTargetView& view = *d_->batched_views[view_index];
+    target_T_src = view.target_T_src;
+    target_fx = view.fx;
+    target_fy = view.fy;
+    target_cx = view.cx;
+    target_cy = view.cy;
+  }
+  if (!have_target_view) {
     if (FLAGS_vc_evaluate_vs_previous_frame && have_new_input) {
       last_yuv_image_ = new_yuv_image;
       last_yuv_image_G_T_C_ = d_->G_T_src_C_;
     }
     
-    glViewport(offset_x_, offset_y_, width_, height_);
-    glClearColor(0.1, 0.1, 0.1, 1.0);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    ClearScreen(0.1, 0.1, 0.1);
     return true;
   }
   
@@ -873,43 +2317,124 @@ bool ViewCorrectionDisplay::RunPipeline(bool update_data, bool inpaint_in_rgb_fr
   const float target_cx_inv = -target_cx / target_fx;
   const float target_cy_inv = -target_cy / target_fy;
   
-  cudaEventRecord(d_->rendering_start_event, d_->stream);
+  // Re-present the previous frame instead of running the target frame
+  // pipeline again if its inputs did not change and the target view did not
+  // move measurably since then.
+  const bool may_reuse_frame =
+      UsingFrameReuse() && view_index == 0 && d_->requested_views.empty();
+  const Sophus::SE3f target_T_G = target_T_src * d_->G_T_src_C_.inverse();
+  if (may_reuse_frame && d_->have_reusable_frame &&
+      d_->reusable_frame_input_version == d_->target_input_version &&
+      d_->reusable_frame_fx == target_fx && d_->reusable_frame_fy == target_fy &&
+      d_->reusable_frame_cx == target_cx && d_->reusable_frame_cy == target_cy) {
+    const Sophus::SE3f view_change = target_T_G * d_->reusable_frame_target_T_G.inverse();
+    const float rotation_change_deg = view_change.so3().log().norm() * 180.f / M_PI;
+    // Displacement of the target view's origin.
+    const float translation_change = view_change.inverse().translation().norm();
+    if (rotation_change_deg <= FLAGS_vc_reuse_frames_max_rotation_deg &&
+        translation_change <= FLAGS_vc_reuse_frames_max_translation) {
+      pipeline_range.AddValue("reused", 1);
+      ++ d_->reused_frame_count;
+      RepresentPreviousFrame();
+      return true;
+    }
+  }
+  
+  cudaEventRecord(timings->rendering_start_event, d_->stream);
+  NVTXRange render_range("RenderTargetMesh");
   
   // Render meshed depth map into the target frame to get the initial target
   // depth map and the inpainting weights.
   constexpr float kRenderMinDepth = 0.1f;
   constexpr float kRenderMaxDepth = 50.f;
-  d_->mesh_renderer_->RenderMesh(
-      inpaint_in_rgb_frame ? d_->vertex_buffer : d_->raw_vertex_buffer,
-      inpaint_in_rgb_frame ? d_->color_buffer : d_->raw_color_buffer,
-      inpaint_in_rgb_frame ? d_->index_buffer : d_->raw_index_buffer,
-      d_->num_mesh_indices,
-      target_T_src,
-      target_fx, target_fy, target_cx, target_cy,
-      kRenderMinDepth, kRenderMaxDepth);
-  cudaTextureObject_t rendered_depth_texture =
-      d_->mesh_renderer_->MapDepthResultAsTexture(
-          cudaAddressModeClamp, cudaAddressModeClamp, cudaFilterModePoint,
-          false, d_->stream);
-  cudaTextureObject_t rendered_intensity_texture =
-      d_->mesh_renderer_->MapIntensityResultAsTexture(
-          cudaAddressModeClamp, cudaAddressModeClamp, cudaFilterModePoint,
-          cudaReadModeElementType, false, d_->stream);
-  
-  // Copy the depth to a CUDA buffer, which allows to modify it. It will be
-  // accessed from there later, so unmap the original. The intensity texture
-  // is kept for longer.
-  d_->target_rendered_depth->SetTo(rendered_depth_texture, d_->stream);
-  d_->mesh_renderer_->UnmapDepthResult(rendered_depth_texture, d_->stream);
+  const bool render_triangle_list =
+      inpaint_in_rgb_frame && d_->mesh_index_compaction_buffers;
+  // The rendered depth and intensity end up in d_->target_rendered_depth and
+  // d_->target_rendered_intensity. PrepareTargetFrameCUDA() reads the depth
+  // and writes the final one in place.
+  const cudaTextureObject_t rendered_depth_texture = d_->target_rendered_depth_texture;
+  const cudaTextureObject_t rendered_intensity_texture = d_->target_rendered_intensity_texture;
+  if (FLAGS_vc_cuda_depth_warp) {
+    // Rasterize with CUDA directly into the target frame buffers.
+    WarpMeshDepthCUDA(
+        d_->stream,
+        inpaint_in_rgb_frame ? d_->vertex_buffer_resource : d_->raw_vertex_buffer_resource,
+        inpaint_in_rgb_frame ? d_->color_buffer_resource : d_->raw_color_buffer_resource,
+        inpaint_in_rgb_frame ? d_->index_buffer_resource : d_->raw_index_buffer_resource,
+        inpaint_in_rgb_frame ? d_->num_mesh_indices : d_->raw_num_mesh_indices,
+        !render_triangle_list,
+        CUDAMatrix3x4(target_T_src.matrix3x4()),
+        target_fx, target_fy, target_cx, target_cy,
+        kRenderMinDepth, kRenderMaxDepth,
+        d_->target_warp_z_buffer.get(),
+        d_->target_rendered_depth.get(),
+        d_->target_rendered_intensity.get());
+  } else if (GetTargetViewCapacity() > 1) {
+    if (view_index == 0) {
+      // Render all views of the frame in one pass and keep the results of
+      // the other views for their runs.
+      const int count = d_->batched_view_count;
+      std::vector<Sophus::SE3f, Eigen::aligned_allocator<Sophus::SE3f>> transformations(count);
+      std::vector<float> fx(count), fy(count), cx(count), cy(count);
+      std::vector<CUDABuffer<float>*> depth_results(count);
+      std::vector<CUDABuffer<uint8_t>*> intensity_results(count);
+      for (int i = 0; i < count; ++ i) {
+        const BatchedTargetView& view = *d_->batched_views[i];
+        transformations[i] = view.target_T_src;
+        fx[i] = view.fx;
+        fy[i] = view.fy;
+        cx[i] = view.cx;
+        cy[i] = view.cy;
+        depth_results[i] = (i == 0) ? d_->target_rendered_depth.get() : view.rendered_depth.get();
+        intensity_results[i] = (i == 0) ? d_->target_rendered_intensity.get() : view.rendered_intensity.get();
+      }
+      d_->mesh_renderer_->RenderMeshViews(
+          count,
+          inpaint_in_rgb_frame ? d_->vertex_buffer : d_->raw_vertex_buffer,
+          inpaint_in_rgb_frame ? d_->color_buffer : d_->raw_color_buffer,
+          inpaint_in_rgb_frame ? d_->index_buffer : d_->raw_index_buffer,
+          inpaint_in_rgb_frame ? d_->num_mesh_indices : d_->raw_num_mesh_indices,
+          render_triangle_list ? GL_TRIANGLES : GL_TRIANGLE_STRIP,
+          transformations.data(),
+          fx.data(), fy.data(), cx.data(), cy.data(),
+          kRenderMinDepth, kRenderMaxDepth);
+      d_->mesh_renderer_->CopyDepthAndIntensityResults(
+          d_->stream, count, depth_results.data(), intensity_results.data());
+      d_->batched_views_rendered = true;
+    } else {
+      const BatchedTargetView& view = *d_->batched_views[view_index];
+      d_->target_rendered_depth->SetTo(*view.rendered_depth, d_->stream);
+      d_->target_rendered_intensity->SetTo(*view.rendered_intensity, d_->stream);
+    }
+  } else {
+    d_->mesh_renderer_->RenderMesh(
+        inpaint_in_rgb_frame ? d_->vertex_buffer : d_->raw_vertex_buffer,
+        inpaint_in_rgb_frame ? d_->color_buffer : d_->raw_color_buffer,
+        inpaint_in_rgb_frame ? d_->index_buffer : d_->raw_index_buffer,
+        inpaint_in_rgb_frame ? d_->num_mesh_indices : d_->raw_num_mesh_indices,
+        render_triangle_list ? GL_TRIANGLES : GL_TRIANGLE_STRIP,
+        target_T_src,
+        target_fx, target_fy, target_cx, target_cy,
+        kRenderMinDepth, kRenderMaxDepth);
+    // Copy both results out with a single map and unmap, such that the
+    // render target is released before the inpainting.
+    CUDABuffer<float>* depth_result = d_->target_rendered_depth.get();
+    CUDABuffer<uint8_t>* intensity_result = d_->target_rendered_intensity.get();
+    d_->mesh_renderer_->CopyDepthAndIntensityResults(
+        d_->stream, 1, &depth_result, &intensity_result);
+  }
   
-  cudaEventRecord(d_->rendering_end_event, d_->stream);
+  cudaEventRecord(timings->rendering_end_event, d_->stream);
+  render_range.End();
   
   // Debug.
   if (FLAGS_vc_debug || FLAGS_vc_write_images) {
     // Display rendered depth map.
+    CUDABuffer<float> temp_depth_buffer(target_render_height_, target_render_width_);
+    temp_depth_buffer.SetTo(rendered_depth_texture, d_->stream);
     std::ostringstream filename;
     filename << "debug_images/" << d_->output_frame_index << "_4_target_rendered_depth.png";
-    CUDABufferVisualization(*d_->target_rendered_depth).DisplayDepthMap(kMinDepthForDisplay, kMaxDepthForDisplay, "4 - Target frame rendered depth", false, FLAGS_vc_write_images ? filename.str().c_str() : nullptr);
+    CUDABufferVisualization(temp_depth_buffer).DisplayDepthMap(kMinDepthForDisplay, kMaxDepthForDisplay, "4 - Target frame rendered depth", false, FLAGS_vc_write_images ? filename.str().c_str() : nullptr, d_->image_writer.get());
     
     // Display rendered gradient magnitudes for weights.
     CUDABuffer<uint8_t> temp_intensity_buffer(target_render_height_, target_render_width_);
@@ -919,69 +2444,34 @@ bool ViewCorrectionDisplay::RunPipeline(bool update_data, bool inpaint_in_rgb_fr
     CUDABufferVisualization(temp_intensity_buffer).Display(0, 255, "5 - Target frame rendered intensities for weights", false, FLAGS_vc_write_images ? filename2.str().c_str() : nullptr);
   }
   
-  // Get partial color image for target frame by projecting the yuv image onto
-  // the target depth map.
-  ProjectImageOntoDepthMapCUDA(
-      d_->stream,
-      d_->target_rendered_depth_texture,
-      *d_->y_image_gpu.front(),
-      *d_->uv_image_gpu,
-      yuv_intrinsics_.fx,
-      yuv_intrinsics_.fy,
-      yuv_intrinsics_.cx,
-      yuv_intrinsics_.cy,
-      0 /*yuv_intrinsics_.distortion_coefficients()(0, 0)*/,  // TODO: Assuming pinhole camera
-      0 /*yuv_intrinsics_.distortion_coefficients()(1, 0)*/,  // TODO: Assuming pinhole camera
-      0 /*yuv_intrinsics_.distortion_coefficients()(2, 0)*/,  // TODO: Assuming pinhole camera
-      target_fx_inv,
-      target_fy_inv,
-      target_cx_inv,
-      target_cy_inv,
-      CUDAMatrix3x4(target_T_src.inverse().matrix3x4()),
-      d_->target_rendered_color.get());
-  
-  cudaEventRecord(d_->color_reprojection_end_event, d_->stream);
-  
-  // Debug.
-  if (FLAGS_vc_debug || FLAGS_vc_write_images) {
-    cv::Mat_<cv::Vec4b> mat(d_->target_rendered_color->height(), d_->target_rendered_color->width());
-    uchar4* buffer = new uchar4[d_->target_rendered_color->height() * d_->target_rendered_color->width()];
-    d_->target_rendered_color->DebugDownload(buffer);
-    for (int y = 0; y < d_->target_rendered_color->height(); ++ y) {
-      for (int x = 0; x < d_->target_rendered_color->width(); ++ x) {
-        const uchar4& value = buffer[x + y * d_->target_rendered_color->width()];
-        // Flip R and B.
-        mat(y, x) = cv::Vec4b(value.z, value.y, value.x, value.w);
-      }
-    }
-    delete[] buffer;
-    if (FLAGS_vc_debug) {
-      cv::imshow("6 - Target frame rendered colors", mat);
-    }
-    if (FLAGS_vc_write_images) {
-      std::ostringstream filename;
-      filename << "debug_images/" << d_->output_frame_index << "_6_target_rendered_colors.png";
-      cv::imwrite(filename.str(), mat);
-    }
-  }
-  
   // In case of using the TSDF reconstruction, also render the reconstruction
   // into the target frame and use it to fill all regions that are not covered
-  // by the meshed_inpainted_depth_map rendering.
+  // by the meshed_inpainted_depth_map rendering (in PrepareTargetFrameCUDA()).
+  cudaTextureObject_t tsdf_rendering_depth_texture = 0;
+  cudaTextureObject_t tsdf_rendering_color_texture = 0;
   if (UsingMeshInput() && FLAGS_vc_render_tsdf_in_target) {
     Sophus::SE3f target_T_G = target_T_src * d_->G_T_src_C_.inverse();
     
     d_->tsdf_mesh_renderer_->BeginRenderingMeshesDepthAndColor(
         target_T_G, target_fx, target_fy, target_cx, target_cy, kMinDepthForRendering,
         kMaxDepthForRendering);
-    d_->tsdf_mesh_renderer_->RenderMeshDepthAndColor(mesh_to_render->vertex_position_data, mesh_to_render->vertex_color_data, mesh_to_render->face_data, mesh_to_render->face_count);
+    if (mesh_to_render) {
+      d_->tsdf_mesh_renderer_->RenderMeshDepthAndColor(mesh_to_render->vertex_position_data, mesh_to_render->vertex_color_data, mesh_to_render->face_data, mesh_to_render->face_count);
+    }
+    const int drawn_chunk_count = d_->mesh_chunk_cache->RenderDepthAndColor(
+        d_->tsdf_mesh_renderer_->GetViewFrustum(
+            target_T_G, target_fx, target_fy, target_cx, target_cy,
+            kMinDepthForRendering, kMaxDepthForRendering),
+        d_->tsdf_mesh_renderer_.get());
+    VLOG(2) << "Target view: drew " << drawn_chunk_count << " of "
+            << d_->mesh_chunk_cache->chunk_count() << " mesh chunks.";
     d_->tsdf_mesh_renderer_->EndRenderingMeshesDepthAndColor();
     
-    cudaTextureObject_t tsdf_rendering_depth_texture =      
+    tsdf_rendering_depth_texture =
         d_->tsdf_mesh_renderer_->MapDepthResultAsTexture(
             cudaAddressModeClamp, cudaAddressModeClamp, cudaFilterModePoint,
             false, d_->stream);
-    cudaTextureObject_t tsdf_rendering_color_texture =
+    tsdf_rendering_color_texture =
         d_->tsdf_mesh_renderer_->MapColorResultAsTexture(
             cudaAddressModeClamp, cudaAddressModeClamp, cudaFilterModePoint,
             cudaReadModeElementType, false, d_->stream);
@@ -991,17 +2481,17 @@ bool ViewCorrectionDisplay::RunPipeline(bool update_data, bool inpaint_in_rgb_fr
       // Display rendered depth map.
       CUDABuffer<float> temp_depth_buffer(target_render_height_, target_render_width_);
       temp_depth_buffer.SetTo(tsdf_rendering_depth_texture, d_->stream);
-      cudaDeviceSynchronize();
+      cudaStreamSynchronize(d_->stream);
       std::ostringstream filename;
       filename << "debug_images/" << d_->output_frame_index << "_6b_target_tsdf_rendered_depth.png";
-      CUDABufferVisualization(temp_depth_buffer).DisplayDepthMap(kMinDepthForDisplay, kMaxDepthForDisplay, "6 b - TSDF rendered depth", false, FLAGS_vc_write_images ? filename.str().c_str() : nullptr);
+      CUDABufferVisualization(temp_depth_buffer).DisplayDepthMap(kMinDepthForDisplay, kMaxDepthForDisplay, "6 b - TSDF rendered depth", false, FLAGS_vc_write_images ? filename.str().c_str() : nullptr, d_->image_writer.get());
       
       // Display rendered gradient magnitudes for weights.
       CUDABuffer<uchar4> temp_color_buffer(target_render_height_, target_render_width_);
       temp_color_buffer.SetTo(tsdf_rendering_color_texture, d_->stream);
+      cudaStreamSynchronize(d_->stream);
       cv::Mat_<cv::Vec4b> temp_color_buffer_mat(target_render_height_, target_render_width_);
       temp_color_buffer.Download(reinterpret_cast<cv::Mat_<uchar4>*>(&temp_color_buffer_mat));
-      cudaDeviceSynchronize();
       cv::Mat_<cv::Vec3b> temp_color_buffer_mat2(target_render_height_, target_render_width_);
       for (int y = 0; y < target_render_height_; ++ y) {
         for (int x = 0; x < target_render_width_; ++ x) {
@@ -1015,28 +2505,152 @@ bool ViewCorrectionDisplay::RunPipeline(bool update_data, bool inpaint_in_rgb_fr
       if (FLAGS_vc_write_images) {
         std::ostringstream filename;
         filename << "debug_images/" << d_->output_frame_index << "_6c_target_tsdf_rendered_colors.png";
-        cv::imwrite(filename.str(), temp_color_buffer_mat2);
+        d_->image_writer->Write(filename.str(), temp_color_buffer_mat2);
       }
     }
-    
-    // Insert result into output (d_->target_rendered_depth,
-    // d_->target_rendered_color) for pixels which are not set yet.
-    CopyValidToInvalidPixelsCUDA(
+  }
+  
+  // Capture the following work up to the end of the target color inpainting
+  // into a CUDA graph instead of launching it directly if configured. The
+  // stage timing events cannot be recorded in the capture, so they are all
+  // recorded after the graph launch and the whole graph is timed as the color
+  // reprojection stage.
+  const bool capture_target_graph = UseTargetCUDAGraph();
+  if (capture_target_graph) {
+    BeginTargetGraphCapture(d_.get());
+  }
+  
+  NVTXRange reprojection_range("ColorReprojection");
+  // Get the target depth map and the partial color image for the target frame
+  // by projecting the yuv image onto the rendered depth map (and filling in
+  // the TSDF rendering) in one pass.
+  const DistortionLUT_ yuv_distortion =
+      d_->yuv_distortion_lut ? d_->yuv_distortion_lut->ToCUDA() : DistortionLUT_();
+  if (FLAGS_vc_project_rgb_image) {
+    PrepareTargetFrameCUDA(
         d_->stream,
+        rendered_depth_texture,
         tsdf_rendering_depth_texture,
         tsdf_rendering_color_texture,
+        *d_->rgb_image_gpu,
+        yuv_intrinsics_.fx,
+        yuv_intrinsics_.fy,
+        yuv_intrinsics_.cx,
+        yuv_intrinsics_.cy,
+        yuv_distortion,
+        target_fx_inv,
+        target_fy_inv,
+        target_cx_inv,
+        target_cy_inv,
+        CUDAMatrix3x4(target_T_src.inverse().matrix3x4()),
         d_->target_rendered_depth.get(),
-        d_->target_rendered_color.get());
-    
+        d_->target_rendered_color.get(),
+        d_->target_hole_map.get());
+  } else {
+    PrepareTargetFrameCUDA(
+        d_->stream,
+        rendered_depth_texture,
+        tsdf_rendering_depth_texture,
+        tsdf_rendering_color_texture,
+        d_->y_image_texture,
+        d_->uv_image_texture,
+        yuv_intrinsics_.width,
+        yuv_intrinsics_.height,
+        yuv_intrinsics_.fx,
+        yuv_intrinsics_.fy,
+        yuv_intrinsics_.cx,
+        yuv_intrinsics_.cy,
+        yuv_distortion,
+        target_fx_inv,
+        target_fy_inv,
+        target_cx_inv,
+        target_cy_inv,
+        CUDAMatrix3x4(target_T_src.inverse().matrix3x4()),
+        d_->target_rendered_depth.get(),
+        d_->target_rendered_color.get(),
+        d_->target_hole_map.get());
+  }
+  if (tsdf_rendering_depth_texture != 0) {
     d_->tsdf_mesh_renderer_->UnmapColorResult(tsdf_rendering_color_texture, d_->stream);
     d_->tsdf_mesh_renderer_->UnmapDepthResult(tsdf_rendering_depth_texture, d_->stream);
   }
   
+  if (!capture_target_graph) {
+    cudaEventRecord(timings->color_reprojection_end_event, d_->stream);
+    cudaEventRecord(d_->source_inputs_released_event, d_->stream);
+  }
+  reprojection_range.End();
+  
+  // Debug.
+  if (FLAGS_vc_debug || FLAGS_vc_write_images) {
+    cv::Mat_<cv::Vec4b> mat(d_->target_rendered_color->height(), d_->target_rendered_color->width());
+    uchar4* buffer = new uchar4[d_->target_rendered_color->height() * d_->target_rendered_color->width()];
+    d_->target_rendered_color->DebugDownload(buffer);
+    for (int y = 0; y < d_->target_rendered_color->height(); ++ y) {
+      for (int x = 0; x < d_->target_rendered_color->width(); ++ x) {
+        const uchar4& value = buffer[x + y * d_->target_rendered_color->width()];
+        // Flip R and B.
+        mat(y, x) = cv::Vec4b(value.z, value.y, value.x, value.w);
+      }
+    }
+    delete[] buffer;
+    if (FLAGS_vc_debug) {
+      cv::imshow("6 - Target frame rendered colors", mat);
+    }
+    if (FLAGS_vc_write_images) {
+      std::ostringstream filename;
+      filename << "debug_images/" << d_->output_frame_index << "_6_target_rendered_colors.png";
+      d_->image_writer->Write(filename.str(), mat);
+    }
+  }
+  
+  NVTXRange last_frame_range("LastFrameReprojection");
+  
   // Render (some of) the last frame into pixels that are still invalid to get
   // temporal consistency. It is a good idea to fix the exposure time if using
   // this (or know the differences and adapt the colors accordingly).
-  if (FLAGS_vc_ensure_target_frame_temporal_consistency && d_->have_previous_rendering_) {
-    if (FLAGS_vc_inpainting_method == vc_inpainting_method::convolution) {
+  // For warm-starting the inpainting, the last frame is rendered into separate
+  // buffers instead, such that it only serves as the initial guess. With
+  // --vc_stereo, the right eye is always warm-started from the left eye's
+  // result, which was rendered just before. With RenderViews(), each view is
+  // propagated from its own result of the previous frame instead of from the
+  // last rendering, which belongs to another observer.
+  BatchedTargetView* propagated_view =
+      d_->requested_views.empty() ? nullptr : d_->batched_views[view_index].get();
+  const bool have_previous_result = propagated_view ?
+      propagated_view->have_previous_result : d_->have_previous_rendering_;
+  const bool warm_start_inpainting =
+      (FLAGS_vc_warm_start_target_inpainting ||
+       (FLAGS_vc_stereo && render_stereo_image)) &&
+      have_previous_result;
+  // Whether holes of the target frame are filled after they were counted into
+  // the hole map, which must then be recomputed before the inpainting.
+  bool target_holes_changed = false;
+  if ((FLAGS_vc_ensure_target_frame_temporal_consistency &&
+       have_previous_result) || warm_start_inpainting) {
+    CUDABuffer<float>* reprojected_depth = d_->target_rendered_depth.get();
+    CUDABuffer<uchar4>* reprojected_color = d_->target_rendered_color.get();
+    if (warm_start_inpainting) {
+      reprojected_depth = d_->target_warm_start_depth.get();
+      reprojected_color = d_->target_warm_start_color.get();
+      reprojected_depth->Clear(0.f, d_->stream);
+      reprojected_color->Clear(make_uchar4(0, 0, 0, 0), d_->stream);
+    } else {
+      target_holes_changed = true;
+    }
+    
+    if (propagated_view) {
+      ForwardReprojectToInvalidPixelsCUDA(
+          d_->stream,
+          CUDAMatrix3x4((target_T_src * d_->G_T_src_C_.cast<float>().inverse() * propagated_view->last_target_T_G.inverse()).matrix3x4()),
+          propagated_view->last_target_fx_inv, propagated_view->last_target_fy_inv,
+          propagated_view->last_target_cx_inv, propagated_view->last_target_cy_inv,
+          *propagated_view->result_depth,
+          *propagated_view->result_color,
+          target_fx, target_fy, target_cx, target_cy,
+          reprojected_depth,
+          reprojected_color);
+    } else if (FLAGS_vc_inpainting_method == vc_inpainting_method::convolution) {
       ForwardReprojectToInvalidPixelsCUDA(
           d_->stream,
           CUDAMatrix3x4((target_T_src * d_->G_T_src_C_.cast<float>().inverse() * d_->last_target_T_G_.inverse()).matrix3x4()),
@@ -1044,30 +2658,28 @@ bool ViewCorrectionDisplay::RunPipeline(bool update_data, bool inpaint_in_rgb_fr
           *d_->target_inpainted_depth_map,
           *d_->target_inpainted_color_rgb,
           target_fx, target_fy, target_cx, target_cy,
-          d_->target_rendered_depth.get(),
-          d_->target_rendered_color.get());
+          reprojected_depth,
+          reprojected_color);
     } else if (FLAGS_vc_inpainting_method == vc_inpainting_method::TV) {
       ForwardReprojectToInvalidPixelsCUDA(
           d_->stream,
           CUDAMatrix3x4((target_T_src * d_->G_T_src_C_.cast<float>().inverse() * d_->last_target_T_G_.inverse()).matrix3x4()),
           d_->last_target_fx_inv, d_->last_target_fy_inv, d_->last_target_cx_inv, d_->last_target_cy_inv,
           *d_->target_inpainted_depth_map,
-          *d_->target_inpainted_color_r,
-          *d_->target_inpainted_color_g,
-          *d_->target_inpainted_color_b,
+          *d_->target_inpainted_color_float,
           target_fx, target_fy, target_cx, target_cy,
-          d_->target_rendered_depth.get(),
-          d_->target_rendered_color.get());
+          reprojected_depth,
+          reprojected_color);
     }
     
     if (FLAGS_vc_debug || FLAGS_vc_write_images) {
       std::ostringstream filename;
       filename << "debug_images/" << d_->output_frame_index << "_6d_target_propagated_depth.png";
-      CUDABufferVisualization(*d_->target_rendered_depth).DisplayDepthMap(kMinDepthForDisplay, kMaxDepthForDisplay, "6 d - Old frame propagated depth", false, FLAGS_vc_write_images ? filename.str().c_str() : nullptr);
+      CUDABufferVisualization(*reprojected_depth).DisplayDepthMap(kMinDepthForDisplay, kMaxDepthForDisplay, "6 d - Old frame propagated depth", false, FLAGS_vc_write_images ? filename.str().c_str() : nullptr, d_->image_writer.get());
       
+      cudaStreamSynchronize(d_->stream);
       cv::Mat_<cv::Vec4b> temp_color_buffer_mat(target_render_height_, target_render_width_);
-      d_->target_rendered_color->Download(reinterpret_cast<cv::Mat_<uchar4>*>(&temp_color_buffer_mat));
-      cudaDeviceSynchronize();
+      reprojected_color->Download(reinterpret_cast<cv::Mat_<uchar4>*>(&temp_color_buffer_mat));
       cv::Mat_<cv::Vec3b> temp_color_buffer_mat2(target_render_height_, target_render_width_);
       for (int y = 0; y < target_render_height_; ++ y) {
         for (int x = 0; x < target_render_width_; ++ x) {
@@ -1081,17 +2693,66 @@ bool ViewCorrectionDisplay::RunPipeline(bool update_data, bool inpaint_in_rgb_fr
       if (FLAGS_vc_write_images) {
         std::ostringstream filename;
         filename << "debug_images/" << d_->output_frame_index << "_6e_target_propagated_colors.png";
-        cv::imwrite(filename.str(), temp_color_buffer_mat2);
+        d_->image_writer->Write(filename.str(), temp_color_buffer_mat2);
       }
     }
   }
   
-  cudaEventRecord(d_->last_frame_reprojection_end_event, d_->stream);
+  if (!capture_target_graph) {
+    cudaEventRecord(timings->last_frame_reprojection_end_event, d_->stream);
+  }
+  last_frame_range.End();
+  
+  // Deadlines for the target frame inpainting. The depth inpainting gets its
+  // share of the budget, the color inpainting the remainder.
+  const bool use_target_deadlines = FLAGS_vc_target_inpainting_budget_ms > 0;
+  InpaintingDeadline target_depth_deadline;
+  InpaintingDeadline target_color_deadline;
+  if (use_target_deadlines) {
+    target_depth_deadline = MakeInpaintingDeadline(
+        FLAGS_vc_target_inpainting_budget_ms *
+            FLAGS_vc_target_depth_inpainting_budget_fraction,
+        d_->target_depth_iteration_cost.ms_per_iteration());
+    target_color_deadline = MakeInpaintingDeadline(
+        FLAGS_vc_target_inpainting_budget_ms,
+        d_->target_color_iteration_cost.ms_per_iteration());
+  }
+  InpaintingResidual target_depth_residual;
+  InpaintingResidual target_color_residual;
+  
+  // With foveated inpainting, fill the holes outside of the region around the
+  // gaze point on the coarse level, such that only the holes within the region
+  // remain for the full-resolution inpainting below.
+  if (d_->foveated_inpainting_buffers) {
+    NVTXRange periphery_range("PeripheryInpainting");
+    FoveationRegion region;
+    {
+      std::lock_guard<std::mutex> lock(d_->gaze_point_mutex);
+      region.center_x = d_->gaze_point_x * target_render_width_;
+      region.center_y = d_->gaze_point_y * target_render_height_;
+    }
+    region.radius = FLAGS_vc_foveation_radius *
+                    std::max(target_render_width_, target_render_height_);
+    InpaintPeripheryCUDA(
+        d_->stream,
+        region,
+        d_->target_rendered_depth.get(),
+        d_->target_rendered_color.get(),
+        d_->foveated_inpainting_buffers.get());
+    target_holes_changed = true;
+  }
+  if (d_->target_hole_map && target_holes_changed) {
+    d_->target_hole_map->Compute(
+        d_->stream, *d_->target_rendered_depth, *d_->target_rendered_color);
+  }
   
   // Inpaint partial target frame depth map.
+  NVTXRange target_depth_range("TargetDepthInpainting");
   uint32_t num_target_depth_pixels_to_inpaint = 0;
+  int num_target_depth_saved_block_iterations = 0;
+  int num_target_depth_iterations = 0;
   if (FLAGS_vc_inpainting_method == vc_inpainting_method::convolution) {
-  InpaintDepthMapWithConvolutionCUDA(
+  num_target_depth_iterations = InpaintDepthMapWithConvolutionCUDA(
       d_->stream,
       FLAGS_vc_use_weights_for_inpainting,
       std::max(d_->target_inpainted_depth_map->width(), d_->target_inpainted_depth_map->height()),
@@ -1099,12 +2760,20 @@ bool ViewCorrectionDisplay::RunPipeline(bool update_data, bool inpaint_in_rgb_fr
       1.0f,
       rendered_intensity_texture,
       d_->target_rendered_depth_texture,
+      warm_start_inpainting ? d_->target_warm_start_depth.get() : nullptr,
+      nullptr,
       d_->target_tv_max_change.get() /*used for max_change*/,
       d_->target_inpainted_depth_map.get(),
       d_->target_block_coordinates.get(),
-      &num_target_depth_pixels_to_inpaint);
+      &num_target_depth_pixels_to_inpaint,
+      d_->target_compaction_buffers.get(),
+      FLAGS_vc_device_resident_inpainting && FLAGS_vc_persistent_inpainting_kernel,
+      use_target_deadlines ? &target_depth_deadline : nullptr,
+      &target_depth_residual,
+      d_->target_hole_map.get(),
+      d_->target_convolution_config);
   } else if (FLAGS_vc_inpainting_method == vc_inpainting_method::TV) {
-    InpaintDepthMapCUDA(d_->stream, kIMClassic,  // kIMAdaptive,
+    num_target_depth_iterations = InpaintDepthMapCUDA(d_->stream, kIMClassic,  // kIMAdaptive,
                         true, 800, 1e-3f, 1.0f, rendered_intensity_texture,
                         d_->target_rendered_depth_texture,
                         d_->target_tv_flag.get(),
@@ -1112,83 +2781,112 @@ bool ViewCorrectionDisplay::RunPipeline(bool update_data, bool inpaint_in_rgb_fr
                         d_->target_tv_dual_x.get(), d_->target_tv_dual_y.get(),
                         d_->target_tv_u_bar.get(), d_->target_tv_max_change_float.get(),
                         d_->target_inpainted_depth_map.get(),
-                        d_->target_block_coordinates.get(), d_->target_block_activities.get());
+                        d_->target_block_coordinates.get(), d_->target_block_activities.get(),
+                        nullptr,
+                        warm_start_inpainting ? d_->target_warm_start_depth.get() : nullptr,
+                        d_->target_compaction_buffers.get(),
+                        &num_target_depth_saved_block_iterations,
+                        use_target_deadlines ? &target_depth_deadline : nullptr,
+                        &target_depth_residual,
+                        d_->target_hole_map.get());
+  }
+  
+  // If the depth inpainting was only enqueued, the host did not wait for it.
+  // Reserve its estimated GPU time in the color inpainting deadline.
+  if (use_target_deadlines && FLAGS_vc_device_resident_inpainting &&
+      FLAGS_vc_inpainting_method == vc_inpainting_method::convolution) {
+    target_color_deadline.time -=
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<float, std::milli>(
+                num_target_depth_iterations *
+                d_->target_depth_iteration_cost.ms_per_iteration()));
   }
 
-  cudaEventRecord(d_->target_depth_inpainting_end_event, d_->stream);
+  if (!capture_target_graph) {
+    cudaEventRecord(timings->target_depth_inpainting_end_event, d_->stream);
+  }
+  target_depth_range.AddValue("iterations", num_target_depth_iterations);
+  target_depth_range.AddValue("pixels to inpaint", num_target_depth_pixels_to_inpaint);
+  target_depth_range.End();
   
   // Debug.
   if (FLAGS_vc_debug || FLAGS_vc_write_images) {
     std::ostringstream filename;
     filename << "debug_images/" << d_->output_frame_index << "_7_target_inpainted_depth.png";
-    CUDABufferVisualization(*d_->target_inpainted_depth_map).DisplayDepthMap(kMinDepthForDisplay, kMaxDepthForDisplay, "7 - Target frame inpainted depth", false, FLAGS_vc_write_images ? filename.str().c_str() : nullptr);
+    CUDABufferVisualization(*d_->target_inpainted_depth_map).DisplayDepthMap(kMinDepthForDisplay, kMaxDepthForDisplay, "7 - Target frame inpainted depth", false, FLAGS_vc_write_images ? filename.str().c_str() : nullptr, d_->image_writer.get());
   }
   
   // Inpaint partial target frame color image.
+  NVTXRange target_color_range("TargetColorInpainting");
   uint32_t num_target_color_pixels_to_inpaint = 0;
+  int num_target_color_saved_block_iterations = 0;
+  int num_target_color_iterations = 0;
   if (FLAGS_vc_inpainting_method == vc_inpainting_method::convolution) {
-    InpaintImageWithConvolutionCUDA(
+    num_target_color_iterations = InpaintImageWithConvolutionCUDA(
         d_->stream,
         FLAGS_vc_use_weights_for_inpainting,
         std::max(d_->target_rendered_color->width(), d_->target_rendered_color->height()),
         1e-2f,
         rendered_intensity_texture,
         *d_->target_rendered_color,
+        warm_start_inpainting ? d_->target_warm_start_color.get() : nullptr,
         d_->target_color_tv_max_change.get()  /*used for max_change*/,
         d_->target_inpainted_color_rgb.get(),
         d_->target_block_coordinates.get(),
-        &num_target_color_pixels_to_inpaint);
+        &num_target_color_pixels_to_inpaint,
+        d_->target_color_compaction_buffers.get(),
+        use_target_deadlines ? &target_color_deadline : nullptr,
+        &target_color_residual,
+        d_->target_hole_map.get());
   } else if (FLAGS_vc_inpainting_method == vc_inpainting_method::TV) {
-    InpaintImageCUDA(
+    num_target_color_iterations = InpaintImageCUDA(
         d_->stream,
         800,
         1e-2f,
         rendered_intensity_texture,
         *d_->target_rendered_color,
+        warm_start_inpainting ? d_->target_warm_start_color.get() : nullptr,
         d_->target_color_tv_flag.get(),
         d_->target_color_tv_dual_flag.get(),
-        d_->target_color_tv_dual_x_r.get(),
-        d_->target_color_tv_dual_x_g.get(),
-        d_->target_color_tv_dual_x_b.get(),
-        d_->target_color_tv_dual_y_r.get(),
-        d_->target_color_tv_dual_y_g.get(),
-        d_->target_color_tv_dual_y_b.get(),
-        d_->target_color_tv_u_bar_r.get(),
-        d_->target_color_tv_u_bar_g.get(),
-        d_->target_color_tv_u_bar_b.get(),
+        d_->target_color_tv_dual_x.get(),
+        d_->target_color_tv_dual_y.get(),
+        d_->target_color_tv_u_bar.get(),
         d_->target_color_tv_max_change_float.get(),
-        d_->target_inpainted_color_r.get(),
-        d_->target_inpainted_color_g.get(),
-        d_->target_inpainted_color_b.get(),
-        d_->target_block_coordinates.get());
+        d_->target_inpainted_color_float.get(),
+        d_->target_block_coordinates.get(),
+        d_->target_color_compaction_buffers.get(),
+        &num_target_color_saved_block_iterations,
+        use_target_deadlines ? &target_color_deadline : nullptr,
+        &target_color_residual,
+        d_->target_hole_map.get());
   }
-  
-  cudaEventRecord(d_->target_color_inpainting_end_event, d_->stream);
-  
-  d_->mesh_renderer_->UnmapIntensityResult(rendered_intensity_texture, d_->stream);
+  target_color_range.AddValue("iterations", num_target_color_iterations);
+  target_color_range.AddValue("pixels to inpaint", num_target_color_pixels_to_inpaint);
+  target_color_range.End();
+  
+  if (capture_target_graph) {
+    EndTargetGraphCaptureAndLaunch(d_.get());
+    cudaEventRecord(d_->source_inputs_released_event, d_->stream);
+    cudaEventRecord(timings->color_reprojection_end_event, d_->stream);
+    cudaEventRecord(timings->last_frame_reprojection_end_event, d_->stream);
+    cudaEventRecord(timings->target_depth_inpainting_end_event, d_->stream);
+  }
+  cudaEventRecord(timings->target_color_inpainting_end_event, d_->stream);
   
   // Debug.
   if (FLAGS_vc_debug || FLAGS_vc_write_images) {
-    cv::Mat_<cv::Vec3b> mat(d_->target_inpainted_color_rgb->height(), d_->target_inpainted_color_rgb->width());
+    cv::Mat_<cv::Vec3b> mat(target_render_height_, target_render_width_);
     if (FLAGS_vc_inpainting_method == vc_inpainting_method::TV) {
-      float* buffer_r = new float[d_->target_inpainted_color_rgb->height() * d_->target_inpainted_color_rgb->width()];
-      float* buffer_g = new float[d_->target_inpainted_color_rgb->height() * d_->target_inpainted_color_rgb->width()];
-      float* buffer_b = new float[d_->target_inpainted_color_rgb->height() * d_->target_inpainted_color_rgb->width()];
-      d_->target_inpainted_color_r->DebugDownload(buffer_r);
-      d_->target_inpainted_color_g->DebugDownload(buffer_g);
-      d_->target_inpainted_color_b->DebugDownload(buffer_b);
-      for (int y = 0; y < d_->target_inpainted_color_r->height(); ++ y) {
-        for (int x = 0; x < d_->target_inpainted_color_r->width(); ++ x) {
+      float4* buffer_rgb = new float4[d_->target_inpainted_color_float->height() * d_->target_inpainted_color_float->width()];
+      d_->target_inpainted_color_float->DebugDownload(buffer_rgb);
+      for (int y = 0; y < d_->target_inpainted_color_float->height(); ++ y) {
+        for (int x = 0; x < d_->target_inpainted_color_float->width(); ++ x) {
+          const float4& rgb = buffer_rgb[x + y * d_->target_inpainted_color_float->width()];
           // Flip R and B.
-          mat(y, x) = cv::Vec3b(
-              255.99f * buffer_b[x + y * d_->target_inpainted_color_rgb->width()],
-              255.99f * buffer_g[x + y * d_->target_inpainted_color_rgb->width()],
-              255.99f * buffer_r[x + y * d_->target_inpainted_color_rgb->width()]);
+          mat(y, x) = cv::Vec3b(255.99f * rgb.z, 255.99f * rgb.y, 255.99f * rgb.x);
         }
       }
-      delete[] buffer_r;
-      delete[] buffer_g;
-      delete[] buffer_b;
+      delete[] buffer_rgb;
     } else if (FLAGS_vc_inpainting_method == vc_inpainting_method::convolution) {
       uchar4* buffer_rgbx = new uchar4[d_->target_inpainted_color_rgb->height() * d_->target_inpainted_color_rgb->width()];
       d_->target_inpainted_color_rgb->DebugDownload(buffer_rgbx);
@@ -1201,107 +2899,98 @@ bool ViewCorrectionDisplay::RunPipeline(bool update_data, bool inpaint_in_rgb_fr
       }
       delete[] buffer_rgbx;
     }
-    if (FLAGS_vc_debug) {
-      cv::imshow("8 - Target frame inpainted colors", mat);
-    }
-    if (FLAGS_vc_write_images) {
-      std::ostringstream filename;
-      filename << "debug_images/" << d_->output_frame_index << "_8_target_inpainted_colors.png";
-      cv::imwrite(filename.str(), mat);
-    }
-    
-    // Evaluate against last frame.
-    if (FLAGS_vc_evaluate_vs_previous_frame && !last_yuv_image_.empty()) {
-      // Undistort previous frame.
-      ColorImage undistorted_yuv_image = last_yuv_image_;  // TODO: Could perform image undistortion here
-      
-      // Scale undistorted frame to target render resolution.
-      cv::resize(undistorted_yuv_image, undistorted_yuv_image, cv::Size(target_render_width_, target_render_height_), 0, 0, CV_INTER_AREA);
-      
-      // Show / write undistorted previous frame.
-      if (FLAGS_vc_debug) {
-        cv::imshow("Last frame (undistorted)", undistorted_yuv_image);
-      }
-      if (FLAGS_vc_write_images) {
-        std::ostringstream filename;
-        filename << "debug_images/" << d_->output_frame_index << "_last_frame_undistorted.png";
-        cv::imwrite(filename.str(), undistorted_yuv_image);
-      }
-      
-      // Difference image of target_inpainted_color (mat) to undistorted_yuv_image.
-      cv::Mat_<cv::Vec3b> difference_image(target_render_height_, target_render_width_);
-      for (int y = 0; y < target_render_height_; ++ y) {
-        for (int x = 0; x < target_render_width_; ++ x) {
-          bool masked_out = false;  //validity_map(y, x) != 0;
-          if (masked_out) {
-            difference_image(y, x) = cv::Vec3b(0, 0, 0);
-          } else {
-            difference_image(y, x) = cv::Vec3b(
-                std::abs(mat(y, x)[0] - undistorted_yuv_image(y, x)[0]),
-                std::abs(mat(y, x)[1] - undistorted_yuv_image(y, x)[1]),
-                std::abs(mat(y, x)[2] - undistorted_yuv_image(y, x)[2]));
-          }
-        }
-      }
-      if (FLAGS_vc_debug) {
-        cv::imshow("Difference: last frame (undistorted) - predicted last frame", difference_image);
-      }
-      if (FLAGS_vc_write_images) {
-        std::ostringstream filename;
-        filename << "debug_images/" << d_->output_frame_index << "_difference_image.png";
-        cv::imwrite(filename.str(), difference_image);
-      }
-      
-      if (FLAGS_vc_write_images) {
-        // Compute total L1 differences.
-        constexpr int kBorderSize = 40;
-        float difference_sum = 0;
-        int difference_pixel_count = 0;
-        for (int y = kBorderSize; y < target_render_height_ - kBorderSize; ++ y) {
-          for (int x = kBorderSize; x < target_render_width_ - kBorderSize; ++ x) {
-            bool masked_out = false;  // validity_map(y, x) != 0;
-            if (!masked_out) {
-              difference_sum +=
-                  difference_image(y, x)[0] + difference_image(y, x)[1] + difference_image(y, x)[2];
-              ++ difference_pixel_count;
-            }
-          }
-        }
-        
-        // Write to file.
-        std::ostringstream filename;
-        filename << "debug_images/" << d_->output_frame_index << "_difference.txt";
-        std::ofstream file_stream(filename.str(), std::ios::out);
-        file_stream << (difference_sum / difference_pixel_count) << std::endl;
-        file_stream.close();
-      }
-    }
+    if (FLAGS_vc_debug) {
+      cv::imshow("8 - Target frame inpainted colors", mat);
+    }
+    if (FLAGS_vc_write_images) {
+      std::ostringstream filename;
+      filename << "debug_images/" << d_->output_frame_index << "_8_target_inpainted_colors.png";
+      d_->image_writer->Write(filename.str(), mat);
+    }
+  }
+  
+  // Evaluate against last frame.
+  if (FLAGS_vc_evaluate_vs_previous_frame && !last_yuv_image_.empty()) {
+    EvaluateVsPreviousFrame();
   }
   
   CHECK_OPENGL_NO_ERROR();
-  if (FLAGS_vc_evaluate_stereo) {
-    if (render_stereo_image) {
-      glViewport(offset_x_ + width_ / 2, offset_y_, width_ / 2, height_);
+  if (!FLAGS_vc_headless && d_->requested_views.empty()) {
+    if (RenderingStereo()) {
+      if (render_stereo_image) {
+        glViewport(offset_x_ + width_ / 2, offset_y_, width_ / 2, height_);
+      } else {
+        glViewport(offset_x_, offset_y_, width_ / 2, height_);
+      }
     } else {
-      glViewport(offset_x_, offset_y_, width_ / 2, height_);
+      glViewport(offset_x_, offset_y_, width_, height_);
     }
+    glClear(GL_DEPTH_BUFFER_BIT);
+    CHECK_OPENGL_NO_ERROR();
+  }
+  
+  if (propagated_view) {
+    // The result is stored for the view by StoreViewResult() below. The
+    // target frame buffers now hold the result of this view, so the next
+    // Render() must not propagate them.
+    propagated_view->have_previous_result = true;
+    propagated_view->last_target_T_G = target_T_src * d_->G_T_src_C_.cast<float>().inverse();
+    propagated_view->last_target_fx_inv = target_fx_inv;
+    propagated_view->last_target_fy_inv = target_fy_inv;
+    propagated_view->last_target_cx_inv = target_cx_inv;
+    propagated_view->last_target_cy_inv = target_cy_inv;
+    d_->have_previous_rendering_ = false;
   } else {
-    glViewport(offset_x_, offset_y_, width_, height_);
+    d_->have_previous_rendering_ = true;
+    d_->last_target_T_G_ = target_T_src * d_->G_T_src_C_.cast<float>().inverse();
+    d_->last_target_fx_inv = target_fx_inv;
+    d_->last_target_fy_inv = target_fy_inv;
+    d_->last_target_cx_inv = target_cx_inv;
+    d_->last_target_cy_inv = target_cy_inv;
   }
-  glClear(GL_DEPTH_BUFFER_BIT);
-  CHECK_OPENGL_NO_ERROR();
   
-  d_->have_previous_rendering_ = true;
-  d_->last_target_T_G_ = target_T_src * d_->G_T_src_C_.cast<float>().inverse();
-  d_->last_target_fx_inv = target_fx_inv;
-  d_->last_target_fy_inv = target_fy_inv;
-  d_->last_target_cx_inv = target_cx_inv;
-  d_->last_target_cy_inv = target_cy_inv;
+  d_->have_reusable_frame = may_reuse_frame;
+  if (may_reuse_frame) {
+    d_->reusable_frame_target_T_G = target_T_G;
+    d_->reusable_frame_fx = target_fx;
+    d_->reusable_frame_fy = target_fy;
+    d_->reusable_frame_cx = target_cx;
+    d_->reusable_frame_cy = target_cy;
+    d_->reusable_frame_input_version = d_->target_input_version;
+  }
   
   // Render color image (target_inpainted_color) and depth image
   // (target_inpainted_depth_map) with a shader to the screen which sets the
-  // fragment depth according to the depth map.
-  DisplayOnScreen();
+  // fragment depth according to the depth map. In headless mode and for
+  // RenderViews(), only copy them to the output buffers.
+  NVTXRange display_range("Display");
+  if (!d_->requested_views.empty()) {
+    StoreViewResult(view_index);
+  } else if (FLAGS_vc_headless) {
+    StoreHeadlessResult();
+  } else {
+    DisplayOnScreen();
+  }
+  display_range.End();
+  
+  // Stream the final image. It is converted to NV12 on the GPU and encoded
+  // from device memory, after the display on the same stream.
+  if (d_->video_encoder && d_->requested_views.empty()) {
+    NVTXRange video_encoding_range("VideoEncoding");
+    size_t nv12_pitch;
+    uint8_t* nv12_image = d_->video_encoder->BeginFrame(
+        target_render_width_, target_render_height_, &nv12_pitch);
+    if (FLAGS_vc_inpainting_method == vc_inpainting_method::TV) {
+      ConvertTargetResultToNV12CUDA(
+          d_->stream, *d_->target_inpainted_color_float, nv12_image,
+          nv12_pitch, d_->video_encoder->max_height());
+    } else if (FLAGS_vc_inpainting_method == vc_inpainting_method::convolution) {
+      ConvertTargetResultToNV12CUDA(
+          d_->stream, *d_->target_inpainted_color_rgb, nv12_image,
+          nv12_pitch, d_->video_encoder->max_height());
+    }
+    d_->video_encoder->EndFrame();
+  }
   
 //   // Render augmented reality content.
 //   if (FLAGS_vc_ar_demo) {
@@ -1312,27 +3001,14 @@ bool ViewCorrectionDisplay::RunPipeline(bool update_data, bool inpaint_in_rgb_fr
 //         kMaxDepthForRendering);
 //   }
   
-  if (FLAGS_vc_write_images || (render_stereo_image && FLAGS_vc_write_stereo_result)) {
+  if (d_->final_image_readback &&
+      (FLAGS_vc_write_images || (render_stereo_image && FLAGS_vc_write_stereo_result))) {
     std::ostringstream filename;
     filename << "debug_images/" << d_->output_frame_index << "_9_final_image_with_AR_demo.png";
     
-    cv::Mat_<cv::Vec3b> final_image_mat(height_, width_, cv::Vec3b(0, 0, 0));
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    glPixelStorei(GL_PACK_ALIGNMENT, 1);
-    glReadPixels(offset_x_, offset_y_, width_, height_, GL_RGB, GL_UNSIGNED_BYTE,
-                  final_image_mat.data);
-    for (int y = 0; y < height_; ++ y) {
-      for (int x = 0; x < width_; ++ x) {
-        std::swap(final_image_mat(y, x)[0], final_image_mat(y, x)[2]);
-      }
-    }
-    for (int y = 0; y < height_ / 2; ++ y) {
-      for (int x = 0; x < width_; ++ x) {
-        std::swap(final_image_mat(y, x), final_image_mat(height_ - 1 - y, x));
-      }
-    }
-    cv::imwrite(filename.str(), final_image_mat);
+    // The image is written once the readback has finished, which is polled
+    // for in the following frames.
+    d_->final_image_readback->Read(offset_x_, offset_y_, width_, height_, filename.str());
   }
   
   if (FLAGS_vc_evaluate_vs_previous_frame && have_new_input) {
@@ -1340,79 +3016,75 @@ bool ViewCorrectionDisplay::RunPipeline(bool update_data, bool inpaint_in_rgb_fr
     last_yuv_image_G_T_C_ = d_->G_T_src_C_;
   }
   
-  // Timing.
-  if (FLAGS_vc_do_timings || FLAGS_vc_save_timings) {
-    cudaEventSynchronize(d_->target_color_inpainting_end_event);
-//     sm::timing::Timing* timing = &sm::timing::Timing::Instance();
-    std::ofstream timing_file_stream;
-    if (FLAGS_vc_save_timings) {
-#ifdef ANDROID
-      timing_file_stream.open("/sdcard/view_correction_timings.txt", std::ios::out | std::ios::app);
-#else
-      timing_file_stream.open("view_correction_timings.txt", std::ios::out | std::ios::app);
-#endif
-      timing_file_stream << d_->output_frame_index << std::endl;
+  // Timing. The timings of this frame are collected while rendering the next
+  // one, such that this does not wait for the GPU. The dynamic resolution
+  // controller and the inpainting iteration cost estimates are driven by these
+  // timings as well.
+  if (FLAGS_vc_do_timings || FLAGS_vc_save_timings || d_->resolution_controller ||
+      UsingInpaintingDeadlines() || d_->meshing_scheduler) {
+    // With asynchronous source meshing, the meshing events are recorded by
+    // the meshing thread and do not relate to this frame.
+    timings->has_meshing = have_new_input && !d_->async_source_meshing;
+    timings->has_rendering = true;
+    timings->src_depth_pixel_count = num_src_depth_pixels_to_inpaint;
+    timings->target_depth_pixel_count = num_target_depth_pixels_to_inpaint;
+    timings->target_color_pixel_count = num_target_color_pixels_to_inpaint;
+    timings->src_saved_block_iterations =
+        timings->has_meshing ? d_->src_tv_saved_block_iterations : 0;
+    timings->target_depth_saved_block_iterations = num_target_depth_saved_block_iterations;
+    timings->target_color_saved_block_iterations = num_target_color_saved_block_iterations;
+    timings->src_iterations =
+        timings->has_meshing ? d_->src_inpainting_iterations : 0;
+    timings->target_depth_iterations = num_target_depth_iterations;
+    timings->target_color_iterations = num_target_color_iterations;
+    if (timings->has_meshing) {
+      timings->src_residual = d_->src_inpainting_residual;
     }
-    float elapsed_time;
-    
-    if (have_new_input) {
-      cudaEventElapsedTime(&elapsed_time, d_->render_or_upload_depth_start_event, d_->meshing_start_event);
-//       timing->AddTime(timing->GetHandle("VC Meshing 1 - Uploading / rendering depth image"), 0.001 * elapsed_time);
-      if (FLAGS_vc_save_timings) { timing_file_stream << "M1 " << elapsed_time << std::endl; }
-      
-      cudaEventElapsedTime(&elapsed_time, d_->meshing_start_event, d_->meshing_upload_end_event);
-//       timing->AddTime(timing->GetHandle("VC Meshing 2 - Uploading color image"), 0.001 * elapsed_time);
-      if (FLAGS_vc_save_timings) { timing_file_stream << "M2 " << elapsed_time << std::endl; }
-      
-      cudaEventElapsedTime(&elapsed_time, d_->meshing_upload_end_event, d_->meshing_downsampling_end_event);
-//       timing->AddTime(timing->GetHandle("VC Meshing 3 - Downsampling color image"), 0.001 * elapsed_time);
-      if (FLAGS_vc_save_timings) { timing_file_stream << "M3 " << elapsed_time << std::endl; }
-      
-      cudaEventElapsedTime(&elapsed_time, d_->meshing_downsampling_end_event, d_->meshing_gradient_mags_end_event);
-//       timing->AddTime(timing->GetHandle("VC Meshing 4 - Computing gradient magnitudes"), 0.001 * elapsed_time);
-      if (FLAGS_vc_save_timings) { timing_file_stream << "M4 " << elapsed_time << std::endl; }
-      
-      cudaEventElapsedTime(&elapsed_time, d_->meshing_gradient_mags_end_event, d_->meshing_inpainting_end_event);
-//       timing->AddTime(timing->GetHandle("VC Meshing 5 - Inpainting depth"), 0.001 * elapsed_time);
-      if (FLAGS_vc_save_timings) { timing_file_stream << "M5 " << elapsed_time << std::endl; }
-      if (FLAGS_vc_save_timings) { timing_file_stream << "M5_pixel_count " << num_src_depth_pixels_to_inpaint << std::endl; }
-      
-      cudaEventElapsedTime(&elapsed_time, d_->meshing_inpainting_end_event, d_->meshing_end_event);
-//       timing->AddTime(timing->GetHandle("VC Meshing 6 - Meshing inpainted depth"), 0.001 * elapsed_time);
-      if (FLAGS_vc_save_timings) { timing_file_stream << "M6 " << elapsed_time << std::endl; }
+    timings->target_depth_residual = target_depth_residual;
+    timings->target_color_residual = target_color_residual;
+    timings->pixel_counts_on_gpu =
+        FLAGS_vc_device_resident_inpainting &&
+        FLAGS_vc_inpainting_method == vc_inpainting_method::convolution;
+    if (timings->pixel_counts_on_gpu) {
+      if (timings->has_meshing) {
+        d_->src_compaction_buffers->counters->DownloadAsync(
+            d_->stream, timings->compaction_counters_for(0));
+      }
+      d_->target_compaction_buffers->counters->DownloadAsync(
+          d_->stream, timings->compaction_counters_for(1));
+      d_->target_color_compaction_buffers->counters->DownloadAsync(
+          d_->stream, timings->compaction_counters_for(2));
     }
+    cudaEventRecord(timings->statistics_end_event, d_->stream);
+    timings->pending = true;
     
-    cudaEventElapsedTime(&elapsed_time, d_->rendering_start_event, d_->rendering_end_event);
-//     timing->AddTime(timing->GetHandle("VC Rendering 1 - Rendering meshed depth map"), 0.001 * elapsed_time);
-    if (FLAGS_vc_save_timings) { timing_file_stream << "R1 " << elapsed_time << std::endl; }
-    
-    cudaEventElapsedTime(&elapsed_time, d_->rendering_end_event, d_->color_reprojection_end_event);
-//     timing->AddTime(timing->GetHandle("VC Rendering 2 - Reprojecting color"), 0.001 * elapsed_time);
-    if (FLAGS_vc_save_timings) { timing_file_stream << "R2 " << elapsed_time << std::endl; }
-    
-    cudaEventElapsedTime(&elapsed_time, d_->color_reprojection_end_event, d_->last_frame_reprojection_end_event);
-//     timing->AddTime(timing->GetHandle("VC Rendering 2b - Reprojecting last frame"), 0.001 * elapsed_time);
-    if (FLAGS_vc_save_timings) { timing_file_stream << "R2b " << elapsed_time << std::endl; }
-    
-    cudaEventElapsedTime(&elapsed_time, d_->last_frame_reprojection_end_event, d_->target_depth_inpainting_end_event);
-//     timing->AddTime(timing->GetHandle("VC Rendering 3 - Inpainting depth"), 0.001 * elapsed_time);
-    if (FLAGS_vc_save_timings) { timing_file_stream << "R3 " << elapsed_time << std::endl; }
-    if (FLAGS_vc_save_timings) { timing_file_stream << "R3_pixel_count " << num_target_depth_pixels_to_inpaint << std::endl; }
+    d_->frame_timings_index = 1 - d_->frame_timings_index;
+    CollectFrameTimings(&d_->frame_timings[d_->frame_timings_index]);
     
-    cudaEventElapsedTime(&elapsed_time, d_->target_depth_inpainting_end_event, d_->target_color_inpainting_end_event);
-//     timing->AddTime(timing->GetHandle("VC Rendering 4 - Inpainting color"), 0.001 * elapsed_time);
-    if (FLAGS_vc_save_timings) { timing_file_stream << "R4 " << elapsed_time << std::endl; }
-    if (FLAGS_vc_save_timings) { timing_file_stream << "R4_pixel_count " << num_target_color_pixels_to_inpaint << std::endl; }
-    
-    if (FLAGS_vc_save_timings) {
-      timing_file_stream.close();
-    }
-    
-    constexpr int kLogTimingsInterval = 20;
-    static int log_counter = 0;
-    ++log_counter;
-    if (log_counter % kLogTimingsInterval == 0) {
-      // TODO: Could print timings to the screen here
+    ++ d_->collected_frame_timings_count;
+    if (FLAGS_vc_timings_interval > 0 &&
+        d_->collected_frame_timings_count % FLAGS_vc_timings_interval == 0) {
+      if (FLAGS_vc_do_timings) {
+        for (const std::string& name : d_->latency_metrics->GetMetricNames()) {
+          MetricSummary summary;
+          d_->latency_metrics->GetSummary(name, &summary);
+          LOG(INFO) << name << ": mean " << summary.mean << ", p50 " << summary.p50
+                    << ", p95 " << summary.p95 << ", p99 " << summary.p99;
+        }
+      }
+      if (FLAGS_vc_save_timings) {
+        std::string timings_path = FLAGS_vc_timings_file;
+        if (timings_path.empty()) {
+#ifdef ANDROID
+          timings_path = "/sdcard/view_correction_timings.csv";
+#else
+          timings_path = "view_correction_timings.csv";
+#endif
+        }
+        if (!d_->latency_metrics->WriteToFile(timings_path)) {
+          LOG(ERROR) << "Cannot write timings to " << timings_path;
+        }
+      }
     }
   }
 
@@ -1424,63 +3096,236 @@ bool ViewCorrectionDisplay::RunPipeline(bool update_data, bool inpaint_in_rgb_fr
   return true;
 }
 
+LatencyMetrics* ViewCorrectionDisplay::latency_metrics() {
+  return d_->latency_metrics.get();
+}
+
+bool ViewCorrectionDisplay::UseTargetCUDAGraph() {
+#if CUDART_VERSION >= 10020
+  // The captured work must not synchronize with the host (which rules out
+  // TV inpainting, whose convergence checks run on the CPU, and the debug
+  // output) and must not map graphics resources (which rules out rendering
+  // the TSDF reconstruction in between). With --vc_stereo, only the right eye
+  // is warm-started by default, so the two eyes would capture different work
+  // and the graph could not be updated in place. For the same reason, the
+  // inpainting deadlines are not supported: they limit the number of
+  // iteration launches on the host differently in every frame.
+  return FLAGS_vc_target_cuda_graph &&
+         (!FLAGS_vc_stereo || FLAGS_vc_warm_start_target_inpainting) &&
+         !UsingInpaintingDeadlines() &&
+         FLAGS_vc_device_resident_inpainting &&
+         FLAGS_vc_inpainting_method == vc_inpainting_method::convolution &&
+         !FLAGS_vc_debug && !FLAGS_vc_write_images &&
+         !(UsingMeshInput() && FLAGS_vc_render_tsdf_in_target);
+#else
+  return false;
+#endif
+}
+
+void ViewCorrectionDisplay::CollectFrameTimings(FrameTimings* timings) {
+  if (!timings->pending) {
+    return;
+  }
+  timings->pending = false;
+  
+  // Do not wait for the GPU. The run should have finished long ago, otherwise
+  // its timings are dropped.
+  cudaError_t status = cudaEventQuery(timings->statistics_end_event);
+  if (status == cudaErrorNotReady) {
+    VLOG(1) << "Dropping the timings of a run which has not finished yet.";
+    return;
+  }
+  CUDA_CHECKED_CALL(status);
+  
+  LatencyMetrics* metrics = d_->latency_metrics.get();
+  // Returns the elapsed time, or -1 if it is not available.
+  auto add_elapsed_time = [&](const char* name, cudaEvent_t start_event, cudaEvent_t end_event) {
+    float elapsed_time;
+    if (cudaEventElapsedTime(&elapsed_time, start_event, end_event) == cudaSuccess) {
+      metrics->AddSample(name, elapsed_time);
+      return elapsed_time;
+    }
+    return -1.f;
+  };
+  // Adds the available values of an inpainting residual.
+  auto add_residual = [&](const std::string& prefix, const InpaintingResidual& residual) {
+    if (residual.max_change_rate >= 0) {
+      metrics->AddSample(prefix + "_max_change_rate", residual.max_change_rate);
+    }
+    if (residual.unconverged_block_fraction >= 0) {
+      metrics->AddSample(prefix + "_unconverged_fraction", residual.unconverged_block_fraction);
+    }
+    metrics->AddSample(prefix + "_deadline_reached", residual.deadline_reached ? 1 : 0);
+  };
+  
+  if (timings->pixel_counts_on_gpu) {
+    // The iteration counts returned by the inpainting functions are the
+    // enqueued ones in this case. Use the converged iteration if available.
+    auto read_counters = [](const int* counters, uint32_t* pixel_count, int* iterations) {
+      *pixel_count = counters[kPixelToInpaintCountIndex];
+      if (counters[kConvergedIterationIndex] >= 0) {
+        *iterations = counters[kConvergedIterationIndex];
+      }
+    };
+    if (timings->has_meshing) {
+      read_counters(timings->compaction_counters_for(0),
+                    &timings->src_depth_pixel_count, &timings->src_iterations);
+    }
+    if (timings->has_rendering) {
+      read_counters(timings->compaction_counters_for(1),
+                    &timings->target_depth_pixel_count, &timings->target_depth_iterations);
+      read_counters(timings->compaction_counters_for(2),
+                    &timings->target_color_pixel_count, &timings->target_color_iterations);
+    }
+  }
+  
+  if (timings->has_meshing) {
+    // The depth input of the asynchronous meshing job is prepared outside of
+    // the timed part.
+    if (timings->has_rendering) {
+      add_elapsed_time("M1", timings->render_or_upload_depth_start_event, timings->meshing_start_event);
+    }
+    add_elapsed_time("M2", timings->meshing_start_event, timings->meshing_upload_end_event);
+    add_elapsed_time("M3", timings->meshing_upload_end_event, timings->meshing_downsampling_end_event);
+    add_elapsed_time("M4", timings->meshing_downsampling_end_event, timings->meshing_gradient_mags_end_event);
+    const float src_inpainting_time =
+        add_elapsed_time("M5", timings->meshing_gradient_mags_end_event, timings->meshing_inpainting_end_event);
+    metrics->AddSample("M5_pixel_count", timings->src_depth_pixel_count);
+    metrics->AddSample("M5_saved_block_iterations", timings->src_saved_block_iterations);
+    metrics->AddSample("M5_iterations", timings->src_iterations);
+    add_residual("M5", timings->src_residual);
+    d_->src_iteration_cost.AddSample(src_inpainting_time, timings->src_iterations);
+    add_elapsed_time("M6", timings->meshing_inpainting_end_event, timings->meshing_end_event);
+    
+    float meshing_time;
+    if (d_->meshing_scheduler &&
+        cudaEventElapsedTime(&meshing_time, timings->meshing_start_event,
+                             timings->meshing_end_event) == cudaSuccess) {
+      d_->meshing_scheduler->AddMeshingTime(meshing_time);
+    }
+  }
+  
+  if (timings->has_rendering) {
+    add_elapsed_time("R1", timings->rendering_start_event, timings->rendering_end_event);
+    add_elapsed_time("R2", timings->rendering_end_event, timings->color_reprojection_end_event);
+    add_elapsed_time("R2b", timings->color_reprojection_end_event, timings->last_frame_reprojection_end_event);
+    const float target_depth_inpainting_time =
+        add_elapsed_time("R3", timings->last_frame_reprojection_end_event, timings->target_depth_inpainting_end_event);
+    metrics->AddSample("R3_pixel_count", timings->target_depth_pixel_count);
+    metrics->AddSample("R3_saved_block_iterations", timings->target_depth_saved_block_iterations);
+    metrics->AddSample("R3_iterations", timings->target_depth_iterations);
+    add_residual("R3", timings->target_depth_residual);
+    d_->target_depth_iteration_cost.AddSample(
+        target_depth_inpainting_time, timings->target_depth_iterations);
+    const float target_color_inpainting_time =
+        add_elapsed_time("R4", timings->target_depth_inpainting_end_event, timings->target_color_inpainting_end_event);
+    metrics->AddSample("R4_pixel_count", timings->target_color_pixel_count);
+    metrics->AddSample("R4_saved_block_iterations", timings->target_color_saved_block_iterations);
+    metrics->AddSample("R4_iterations", timings->target_color_iterations);
+    add_residual("R4", timings->target_color_residual);
+    d_->target_color_iteration_cost.AddSample(
+        target_color_inpainting_time, timings->target_color_iterations);
+    add_elapsed_time("R_total", timings->rendering_start_event, timings->target_color_inpainting_end_event);
+    
+    float total_time;
+    if (d_->meshing_scheduler &&
+        cudaEventElapsedTime(&total_time, timings->rendering_start_event,
+                             timings->target_color_inpainting_end_event) == cudaSuccess) {
+      d_->meshing_scheduler->AddRenderingTime(total_time);
+    }
+    if (d_->resolution_controller &&
+        cudaEventElapsedTime(&total_time, timings->rendering_start_event,
+                             timings->target_color_inpainting_end_event) == cudaSuccess &&
+        d_->resolution_controller->AddFrameTime(total_time)) {
+      d_->target_resolution_change_pending = true;
+    }
+  }
+}
+
 void ViewCorrectionDisplay::DisplayOnScreen() {
-  // Copy and convert the color image result to an RGB8 texture.
-  cudaArray_t display_color_texture_array;
-  CUDA_CHECKED_CALL(cudaGraphicsMapResources(1, &d_->display_color_texture_resource, d_->stream));
-  CUDA_CHECKED_CALL(cudaGraphicsSubResourceGetMappedArray(
-      &display_color_texture_array, d_->display_color_texture_resource, 0, 0));
-  
-  cudaResourceDesc display_color_texture_resource_desc;
-  display_color_texture_resource_desc.resType = cudaResourceTypeArray;
-  display_color_texture_resource_desc.res.array.array = display_color_texture_array;
-  cudaSurfaceObject_t display_color_texture_surface;
-  cudaCreateSurfaceObject(&display_color_texture_surface, &display_color_texture_resource_desc);
+  // Write the result of this frame to the next display slot. If the ring is
+  // full, this first waits until the frame which used this slot last has been
+  // written.
+  const int num_slots = d_->display_slots.size();
+  const int64_t frame_index = d_->display_frame_count;
+  ++ d_->display_frame_count;
+  DisplayTextureSlot* write_slot = d_->display_slots[frame_index % num_slots].get();
+  if (write_slot->frame_index >= 0) {
+    cudaEventSynchronize(write_slot->written_event);
+  }
+  
+  // Map the color and depth textures with a single call.
+  cudaGraphicsResource_t display_resources[2] = {
+      write_slot->color_texture_resource, write_slot->depth_texture_resource};
+  cudaArray_t display_arrays[2];
+  MapGraphicsResourceArrays(2, display_resources, d_->stream, display_arrays);
+  
+  // Write the color image result (converted to RGB8) and the depth map result
+  // to the textures in a single pass.
+  cudaSurfaceObject_t display_color_texture_surface =
+      write_slot->color_texture_cache.GetSurfaceObject(display_arrays[0]);
+  cudaSurfaceObject_t display_depth_texture_surface =
+      write_slot->depth_texture_cache.GetSurfaceObject(display_arrays[1]);
   if (FLAGS_vc_inpainting_method == vc_inpainting_method::TV) {
-    CopyFloatColorImageToRgb8SurfaceCUDA(
+    CopyTargetResultToDisplaySurfacesCUDA(
         d_->stream,
-        *d_->target_inpainted_color_r,
-        *d_->target_inpainted_color_g,
-        *d_->target_inpainted_color_b,
-        display_color_texture_surface);
+        *d_->target_inpainted_color_float,
+        *d_->target_inpainted_depth_map,
+        display_color_texture_surface,
+        display_depth_texture_surface);
   } else if (FLAGS_vc_inpainting_method == vc_inpainting_method::convolution) {
-    CopyColorImageToRgb8SurfaceCUDA(
+    CopyTargetResultToDisplaySurfacesCUDA(
         d_->stream,
         *d_->target_inpainted_color_rgb,
-        display_color_texture_surface);
-  }
-  cudaDestroySurfaceObject(display_color_texture_surface);
-  
-  CUDA_CHECKED_CALL(cudaGraphicsUnmapResources(1, &d_->display_color_texture_resource, d_->stream));
-  
-  // Copy the depth map result to a float texture.
-  cudaArray_t display_depth_texture_array;
-  CUDA_CHECKED_CALL(cudaGraphicsMapResources(1, &d_->display_depth_texture_resource, d_->stream));
-  CUDA_CHECKED_CALL(cudaGraphicsSubResourceGetMappedArray(
-      &display_depth_texture_array, d_->display_depth_texture_resource, 0, 0));
-  
-  cudaMemcpy2DToArrayAsync(
-      display_depth_texture_array,
-      0, 0, /* offset */
-      d_->target_inpainted_depth_map->ToCUDA().address(),
-      d_->target_inpainted_depth_map->ToCUDA().pitch(),
-      d_->target_inpainted_depth_map->width() * sizeof(float),
-      d_->target_inpainted_depth_map->height(),
-      cudaMemcpyDeviceToDevice,
-      d_->stream);
-  
-//   cudaResourceDesc display_depth_texture_resource_desc;
-//   display_depth_texture_resource_desc.resType = cudaResourceTypeArray;
-//   display_depth_texture_resource_desc.res.array.array = display_depth_texture_array;
-//   cudaSurfaceObject_t display_depth_texture_surface;
-//   cudaCreateSurfaceObject(&display_depth_texture_surface, &display_depth_texture_resource_desc); 
-//   CopyFloatColorImageToRgb8SurfaceCUDA(
-//       d_->stream,
-//       *d_->target_inpainted_color,
-//       display_depth_texture_surface);
-//   cudaDestroySurfaceObject(display_depth_texture_surface);
-  
-  CUDA_CHECKED_CALL(cudaGraphicsUnmapResources(1, &d_->display_depth_texture_resource, d_->stream));
+        *d_->target_inpainted_depth_map,
+        display_color_texture_surface,
+        display_depth_texture_surface);
+  }
+  
+  CUDA_CHECKED_CALL(cudaGraphicsUnmapResources(2, display_resources, d_->stream));
+  cudaEventRecord(write_slot->written_event, d_->stream);
+  write_slot->frame_index = frame_index;
+  
+  // Choose the slot to display: the latest earlier frame whose result has been
+  // written, or the oldest one in the ring if none has finished yet. Without
+  // earlier frames (or with a single slot), the current frame is displayed.
+  int64_t display_frame_index = frame_index;
+  for (int64_t i = frame_index - 1; i > frame_index - num_slots && i >= 0; -- i) {
+    display_frame_index = i;
+    if (cudaEventQuery(d_->display_slots[i % num_slots]->written_event) == cudaSuccess) {
+      break;
+    }
+  }
+  DrawDisplaySlot(display_frame_index);
+}
+
+void ViewCorrectionDisplay::RepresentPreviousFrame() {
+  if (FLAGS_vc_headless) {
+    // The headless result buffers still contain the previous frame.
+    return;
+  }
+  
+  glViewport(offset_x_, offset_y_, width_, height_);
+  glClear(GL_DEPTH_BUFFER_BIT);
+  
+  // Show the latest frame whose result has been written since the displayed
+  // one, or the displayed one again. No slot has been written in between, so
+  // all of these frames are still in the ring.
+  const int num_slots = d_->display_slots.size();
+  int64_t display_frame_index = d_->displayed_frame_index;
+  for (int64_t i = d_->display_frame_count - 1; i > d_->displayed_frame_index; -- i) {
+    if (cudaEventQuery(d_->display_slots[i % num_slots]->written_event) == cudaSuccess) {
+      display_frame_index = i;
+      break;
+    }
+  }
+  DrawDisplaySlot(display_frame_index);
+}
+
+void ViewCorrectionDisplay::DrawDisplaySlot(int64_t frame_index) {
+  d_->displayed_frame_index = frame_index;
+  const DisplayTextureSlot* display_slot =
+      d_->display_slots[frame_index % d_->display_slots.size()].get();
   
   // Render textured quad.
   static GLfloat box[] = {
@@ -1498,9 +3343,9 @@ void ViewCorrectionDisplay::DisplayOnScreen() {
   glDisable(GL_CULL_FACE);
 
   glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, d_->display_color_texture);
+  glBindTexture(GL_TEXTURE_2D, display_slot->color_texture);
   glActiveTexture(GL_TEXTURE1);
-  glBindTexture(GL_TEXTURE_2D, d_->display_depth_texture);
+  glBindTexture(GL_TEXTURE_2D, display_slot->depth_texture);
   CHECK_OPENGL_NO_ERROR();
 
   glUseProgram(d_->display_shader_program);
@@ -1533,6 +3378,160 @@ void ViewCorrectionDisplay::DisplayOnScreen() {
   CHECK_OPENGL_NO_ERROR();
 }
 
+// Copies the inpainted color and depth of the target frame to the given
+// buffers.
+static void CopyTargetResultToBuffers(
+    ViewCorrectionDisplayImpl* d,
+    CUDABuffer<uchar4>* color,
+    CUDABuffer<float>* depth) {
+  if (FLAGS_vc_inpainting_method == vc_inpainting_method::TV) {
+    CopyTargetResultToBuffersCUDA(
+        d->stream,
+        *d->target_inpainted_color_float,
+        *d->target_inpainted_depth_map,
+        color,
+        depth);
+  } else if (FLAGS_vc_inpainting_method == vc_inpainting_method::convolution) {
+    CopyTargetResultToBuffersCUDA(
+        d->stream,
+        *d->target_inpainted_color_rgb,
+        *d->target_inpainted_depth_map,
+        color,
+        depth);
+  }
+}
+
+void ViewCorrectionDisplay::StoreHeadlessResult() {
+  CopyTargetResultToBuffers(d_.get(), d_->headless_color_result.get(),
+                            d_->headless_depth_result.get());
+  cudaEventRecord(d_->headless_result_event, d_->stream);
+  d_->have_headless_result = true;
+}
+
+void ViewCorrectionDisplay::EvaluateVsPreviousFrame() {
+  const int width = target_render_width_;
+  const int height = target_render_height_;
+  if (!d_->evaluation_buffers ||
+      d_->evaluation_reference_image->width() != width ||
+      d_->evaluation_reference_image->height() != height) {
+    d_->evaluation_reference_image.reset(new CUDABuffer<uchar4>(height, width));
+    d_->evaluation_difference_image.reset(new CUDABuffer<uchar4>(height, width));
+    d_->evaluation_buffers.reset(new ImageComparisonBuffers(width, height));
+  }
+  if (!d_->evaluation_results.is_open() && !d_->evaluation_results_unavailable) {
+    d_->evaluation_results.open(FLAGS_vc_evaluation_results_path, std::ios::out);
+    if (!d_->evaluation_results) {
+      LOG(ERROR) << "Cannot write evaluation results to: "
+                 << FLAGS_vc_evaluation_results_path
+                 << ". Only logging their summary at the end.";
+      d_->evaluation_results_unavailable = true;
+    } else {
+      d_->evaluation_results << "# frame_index mean_l1 psnr ssim" << std::endl;
+    }
+  }
+  
+  // Upload the last frame and scale it to the target render resolution.
+  // TODO: Could perform image undistortion here
+  if (!d_->evaluation_color_image ||
+      d_->evaluation_color_image->height() != last_yuv_image_.rows ||
+      d_->evaluation_color_image->width() != 3 * last_yuv_image_.cols) {
+    d_->evaluation_color_image.reset(new CUDABuffer<uint8_t>(
+        last_yuv_image_.rows, 3 * last_yuv_image_.cols));
+  }
+  const cv::Mat_<uint8_t> last_image_bytes(
+      last_yuv_image_.rows, 3 * last_yuv_image_.cols, last_yuv_image_.data,
+      last_yuv_image_.step);
+  CUDABufferAdapter(d_->evaluation_color_image.get()).UploadAsync(
+      d_->stream, last_image_bytes, d_->pinned_input_pool.get());
+  ResizeRGBImageAreaCUDA(d_->stream, *d_->evaluation_color_image,
+                         d_->evaluation_reference_image.get());
+  
+  // Compare the predicted last frame to it.
+  constexpr int kBorderSize = 40;
+  const bool show_images = FLAGS_vc_debug || FLAGS_vc_write_images;
+  CUDABuffer<uchar4>* difference_image =
+      show_images ? d_->evaluation_difference_image.get() : nullptr;
+  ImageComparisonMetrics metrics;
+  if (FLAGS_vc_inpainting_method == vc_inpainting_method::TV) {
+    CompareImagesCUDA(d_->stream, *d_->target_inpainted_color_float,
+                      *d_->evaluation_reference_image, kBorderSize,
+                      FLAGS_vc_evaluate_ssim, d_->evaluation_buffers.get(),
+                      difference_image, &metrics);
+  } else {
+    CompareImagesCUDA(d_->stream, *d_->target_inpainted_color_rgb,
+                      *d_->evaluation_reference_image, kBorderSize,
+                      FLAGS_vc_evaluate_ssim, d_->evaluation_buffers.get(),
+                      difference_image, &metrics);
+  }
+  
+  if (d_->evaluation_results.is_open()) {
+    d_->evaluation_results << d_->output_frame_index << " " << metrics.mean_l1
+                           << " " << metrics.psnr << " " << metrics.ssim
+                           << std::endl;
+  }
+  d_->evaluation_mean_l1_sum += metrics.mean_l1;
+  if (std::isinf(metrics.psnr)) {
+    ++ d_->evaluation_identical_frame_count;
+  } else {
+    d_->evaluation_psnr_sum += metrics.psnr;
+  }
+  d_->evaluation_ssim_sum += metrics.ssim;
+  ++ d_->evaluation_frame_count;
+  
+  // Show / write undistorted previous frame and the difference image.
+  if (show_images) {
+    // The reference has the channel order of the color input.
+    cv::Mat last_frame = DownloadBGRAImageAsBGR(*d_->evaluation_reference_image);
+    cv::Mat difference = DownloadBGRAImageAsBGR(*d_->evaluation_difference_image);
+    if (FLAGS_vc_debug) {
+      cv::imshow("Last frame (undistorted)", last_frame);
+      cv::imshow("Difference: last frame (undistorted) - predicted last frame", difference);
+    }
+    if (FLAGS_vc_write_images) {
+      std::ostringstream filename;
+      filename << "debug_images/" << d_->output_frame_index << "_last_frame_undistorted.png";
+      d_->image_writer->Write(filename.str(), last_frame);
+      filename.str("");
+      filename << "debug_images/" << d_->output_frame_index << "_difference_image.png";
+      d_->image_writer->Write(filename.str(), difference);
+    }
+  }
+}
+
+void ViewCorrectionDisplay::StoreViewResult(int view_index) {
+  BatchedTargetView* view = d_->batched_views[view_index].get();
+  if (!view->result_color) {
+    view->result_color.reset(new CUDABuffer<uchar4>(target_render_height_, target_render_width_));
+    view->result_depth.reset(new CUDABuffer<float>(target_render_height_, target_render_width_));
+  }
+  CopyTargetResultToBuffers(d_.get(), view->result_color.get(),
+                            view->result_depth.get());
+  d_->view_result_count = std::max(d_->view_result_count, view_index + 1);
+}
+
+bool ViewCorrectionDisplay::GetHeadlessResult(
+    const CUDABuffer<uchar4>** color,
+    const CUDABuffer<float>** depth,
+    cudaEvent_t* ready_event) {
+  CHECK(FLAGS_vc_headless) << "Only available with --vc_headless.";
+  if (!d_->have_headless_result) {
+    return false;
+  }
+  *color = d_->headless_color_result.get();
+  *depth = d_->headless_depth_result.get();
+  *ready_event = d_->headless_result_event;
+  return true;
+}
+
+void ViewCorrectionDisplay::ClearScreen(float red, float green, float blue) {
+  if (FLAGS_vc_headless) {
+    return;
+  }
+  glViewport(offset_x_, offset_y_, width_, height_);
+  glClearColor(red, green, blue, 1.0);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
 // void ViewCorrectionDisplay::InitAR() {
 //   // GFX engine.
 //   startGFX();
@@ -1574,41 +3573,105 @@ void ViewCorrectionDisplay::DisplayOnScreen() {
 
 void ViewCorrectionDisplay::ColorCameraPoseCallback(
     const Sophus::SE3f& G_T_C, uint64_t timestamp) {
+  if (d_->session_recorder) {
+    d_->session_recorder->AddCameraPose(G_T_C, timestamp);
+  }
+  
   std::lock_guard<std::mutex> input_lock(input_mutex_);
   
-  input_G_T_C_ = G_T_C;
-  input_G_T_C_timestamp_ = timestamp;
+  input_pose_history_.AddPose(G_T_C, timestamp);
 }
 
-void ViewCorrectionDisplay::YUVImageCallback(const ColorImage& image) {
-  constexpr float kYUVImageCacheDuration = 1.0f;
+void ViewCorrectionDisplay::ObserverPoseCallback(
+    const Sophus::SE3f& G_T_observer, uint64_t timestamp) {
+  CHECK(target_view_mode_ == TargetViewMode::kObserverPoseCallback);
+  // The position receiver keeps the poses in steady_clock time (which
+  // SetupTargetView() converts back for recording).
+  const uint64_t start_time_ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          start_time_.time_since_epoch()).count();
+  d_->position_receiver.AddObserverPose(G_T_observer, start_time_ns + timestamp);
+}
+
+template <typename ImageT>
+static void AllocateInputImage(
+    PinnedHostMemoryPool* pool, int rows, int cols, ImageT* image) {
+  typedef typename ImageT::value_type ElementT;
+  std::shared_ptr<uint8_t> memory;
+  if (pool && rows * cols * sizeof(ElementT) <= pool->slab_size()) {
+    memory = pool->Acquire();
+    if (!memory) {
+      LOG_FIRST_N(WARNING, 1) << "All page-locked input slabs are in use, "
+                              << "allocating the input image in pageable "
+                              << "memory (see --vc_pinned_input_slab_count).";
+    }
+  }
   
+  // Release the old data first, since create() would otherwise keep using
+  // it if it has the right size.
+  image->release();
+  if (memory) {
+    image->cv::Mat_<ElementT>::operator=(cv::Mat_<ElementT>(
+        rows, cols, reinterpret_cast<ElementT*>(memory.get())));
+  } else {
+    image->create(rows, cols);
+  }
+  image->set_pinned_memory(memory);
+}
+
+void ViewCorrectionDisplay::AllocateColorImage(int rows, int cols, ColorImage* image) {
+  AllocateInputImage(d_->pinned_input_pool.get(), rows, cols, image);
+}
+
+void ViewCorrectionDisplay::AllocateDepthImage(int rows, int cols, DepthImage* image) {
+  AllocateInputImage(d_->pinned_input_pool.get(), rows, cols, image);
+}
+
+void ViewCorrectionDisplay::YUVImageCallback(const ColorImage& image) {
+  NVTXRange range("YUVImageCallback");
   if (image.empty()) {
     return;
   }
-  
-  std::lock_guard<std::mutex> input_lock(input_mutex_);
-  
-  // Cache new image.
-  input_yuv_images_.push_back(image);
-  
-  // Delete cached images which are too old.
-  if (!input_yuv_images_.empty()) {
-    const double min_timestamp = UsingDepthCameraInput() ?
-        (kNanosecondsToSeconds * latest_depth_image_timestamp_ - kYUVImageCacheDuration) :
-        (kNanosecondsToSeconds * input_yuv_images_.back().timestamp_ns() - kYUVImageCacheDuration);
-    while (!input_yuv_images_.empty() &&
-           kNanosecondsToSeconds * input_yuv_images_.front().timestamp_ns() < min_timestamp) {
-      input_yuv_images_.erase(input_yuv_images_.begin());
-    }
+  if (d_->session_recorder) {
+    d_->session_recorder->AddColorImage(image);
   }
+  
+  // Cache new image. The oldest cached image is overwritten if the ring is full.
+  input_yuv_images_.Push(image);
 }
 
 void ViewCorrectionDisplay::DepthImageCallback(const DepthImage& image) {
+  NVTXRange range("DepthImageCallback");
+  if (d_->session_recorder) {
+    d_->session_recorder->AddDepthImage(image);
+  }
+  
   // Save input depth map.
-  std::lock_guard<std::mutex> input_lock(input_mutex_);
-  latest_depth_image_timestamp_ = image.timestamp_ns();
-  input_depth_image_ = image;
+  input_depth_images_.Push(image);
+}
+
+void ViewCorrectionDisplay::YUVImageCallback(
+    const std::shared_ptr<GPUImage>& image,
+    uint64_t timestamp_ns,
+    const Sophus::SE3f& G_T_C) {
+  NVTXRange range("YUVImageCallback");
+  CHECK(image->channels == 3 || image->channels == 4);
+  ColorImage color_image;
+  color_image.set_timestamp_ns(timestamp_ns);
+  color_image.set_G_T_C(G_T_C);
+  color_image.set_gpu_image(image);
+  input_yuv_images_.Push(color_image);
+}
+
+void ViewCorrectionDisplay::DepthImageCallback(
+    const std::shared_ptr<GPUImage>& image,
+    uint64_t timestamp_ns) {
+  NVTXRange range("DepthImageCallback");
+  CHECK_EQ(image->channels, 1);
+  DepthImage depth_image;
+  depth_image.set_timestamp_ns(timestamp_ns);
+  depth_image.set_gpu_image(image);
+  input_depth_images_.Push(depth_image);
 }
 
 void ViewCorrectionDisplay::MeshCallback(const std::shared_ptr<MeshStub>& mesh) {
@@ -1618,189 +3681,498 @@ void ViewCorrectionDisplay::MeshCallback(const std::shared_ptr<MeshStub>& mesh)
   input_mesh_ = mesh;
 }
 
-void ViewCorrectionDisplay::RenderDepthImageFromMesh(const MeshStub& mesh,
-                                                     const Sophus::SE3f& G_T_C) {
+void ViewCorrectionDisplay::MeshChunkCallback(const MeshChunkUpdates& updates) {
+  std::lock_guard<std::mutex> input_lock(input_mutex_);
+  
+  // Later updates of a chunk replace earlier ones which were not uploaded yet.
+  for (const auto& update : updates) {
+    pending_mesh_chunk_updates_[update.first] = update.second;
+  }
+}
+
+bool ViewCorrectionDisplay::HaveMeshToRender() const {
+  return mesh_to_render || (d_->mesh_chunk_cache && !d_->mesh_chunk_cache->empty());
+}
+
+void ViewCorrectionDisplay::SetGazePoint(float x, float y) {
+  std::lock_guard<std::mutex> lock(d_->gaze_point_mutex);
+  d_->gaze_point_x = x;
+  d_->gaze_point_y = y;
+}
+
+void ViewCorrectionDisplay::RenderDepthImageFromMesh(const Sophus::SE3f& G_T_C) {
   Sophus::SE3f C_T_G = G_T_C.inverse();
   
   d_->src_mesh_renderer_->BeginRenderingMeshesDepth(
       C_T_G, depth_fx_, depth_fy_, depth_cx_, depth_cy_, kMinDepthForRendering,
       kMaxDepthForRendering);
-  d_->src_mesh_renderer_->RenderMeshDepth(mesh.vertex_position_data, mesh.face_data, mesh.face_count);
+  if (mesh_to_render) {
+    d_->src_mesh_renderer_->RenderMeshDepth(mesh_to_render->vertex_position_data, mesh_to_render->face_data, mesh_to_render->face_count);
+  }
+  const int drawn_chunk_count = d_->mesh_chunk_cache->RenderDepth(
+      d_->src_mesh_renderer_->GetViewFrustum(
+          C_T_G, depth_fx_, depth_fy_, depth_cx_, depth_cy_,
+          kMinDepthForRendering, kMaxDepthForRendering),
+      d_->src_mesh_renderer_.get());
+  VLOG(2) << "Source view: drew " << drawn_chunk_count << " of "
+          << d_->mesh_chunk_cache->chunk_count() << " mesh chunks.";
   d_->src_mesh_renderer_->EndRenderingMeshesDepth();
 }
 
 void ViewCorrectionDisplay::CreateMeshedInpaintedDepthMap(
     const ColorImage& rgb_image,
+    bool use_back_buffers,
+    FrameTimings* timings,
     uint32_t* num_src_depth_pixels_to_inpaint) {
-  cudaEventRecord(d_->meshing_start_event, d_->stream);
-  
-  if (FLAGS_vc_debug) {
+  NVTXRange meshing_range("CreateMeshedInpaintedDepthMap");
+  cudaStream_t stream = d_->source_stream;
+  CUDABuffer<uint8_t>* rgb_image_gpu =
+      use_back_buffers ? d_->rgb_image_gpu_back.get() : d_->rgb_image_gpu.get();
+  CUDABuffer<uint8_t>* y_image_gpu =
+      use_back_buffers ? d_->y_image_gpu_back.get() : d_->y_image_gpu[0].get();
+  CUDABuffer<uint16_t>* uv_image_gpu =
+      use_back_buffers ? d_->uv_image_gpu_back.get() : d_->uv_image_gpu.get();
+  // On a separate meshing device, write to its own buffers, which are copied
+  // to the back buffers by CopyMeshingResultsToRenderDevice().
+  const bool use_meshing_device = use_back_buffers && d_->meshing_device >= 0;
+  if (use_meshing_device) {
+    rgb_image_gpu = d_->meshing_rgb_image.get();
+    y_image_gpu = d_->meshing_y_image.get();
+    uv_image_gpu = d_->meshing_uv_image.get();
+  }
+  float* back_vertices =
+      use_meshing_device ? d_->meshing_vertices->ToCUDA().address() :
+                           d_->back_vertex_buffer_pointer;
+  uint8_t* back_colors =
+      use_meshing_device ? d_->meshing_colors->ToCUDA().address() :
+                           d_->back_color_buffer_pointer;
+  uint32_t* back_indices =
+      use_meshing_device ? d_->meshing_indices->ToCUDA().address() :
+                           d_->back_index_buffer_pointer;
+  
+  cudaEventRecord(timings->meshing_start_event, stream);
+  
+  // (Images in GPU memory are not shown.)
+  if (FLAGS_vc_debug && !rgb_image.empty()) {
     cv::imshow("0 b - RGB input", rgb_image);
   }
-  if (FLAGS_vc_write_images) {
+  if (FLAGS_vc_write_images && !rgb_image.empty()) {
     std::ostringstream filename;
     filename << "debug_images/" << d_->output_frame_index << "_0b_source_yuv_input.png";
-    cv::imwrite(filename.str(), rgb_image);
+    d_->image_writer->Write(filename.str(), rgb_image.clone());
   }
   
-  // Upload color image.
-  // (NOTE: if it seems to be worth it, could try to use color image from GPU to
-  //  avoid upload. Probably need to render it to a standard texture to be able
-  //  to access it from CUDA?)
+  // Upload color image, or copy it on the GPU if it is given in GPU memory
+  // (see GPUImage).
+  UploadColorImage(d_.get(), stream, rgb_image, rgb_image_gpu);
   
   // TODO: Color images were provided as YUV on Tango.
   //       We convert RGB to YUV here to simulate that, but it would be better to just use RGB.
-  cv::Mat_<uint8_t> y_mat(rgb_image.rows, rgb_image.cols);
-  for (int y = 0; y < rgb_image.rows; ++ y) {
-    for (int x = 0; x < rgb_image.cols; ++ x) {
-      const cv::Vec3b& rgb = rgb_image(y, x);
-      y_mat(y, x) = 0.299 * rgb(0) + 0.587 * rgb(1) + 0.114 * rgb(2);  // NOTE: Assuming RGB order in rgb_image (not BGR!)
-    }
-  }
-  
-  cv::Mat_<uint16_t> uv_mat(rgb_image.rows / 2, rgb_image.cols / 2);
-  for (int y = 0; y < uv_mat.rows; ++ y) {
-    for (int x = 0; x < uv_mat.cols; ++ x) {
-      const cv::Vec3b& rgb = rgb_image(2 * y, 2 * x);  // NOTE: could also average the corresponding 2x2 pixels
-      uint8_t u = -0.169 * rgb(0) - 0.331 * rgb(1) + 0.499 * rgb(2) + 128;  // NOTE: Assuming RGB order in rgb_image (not BGR!)
-      uint8_t v = 0.499 * rgb(0) - 0.418 * rgb(1) - 0.813 * rgb(2) + 128;  // NOTE: Assuming RGB order in rgb_image (not BGR!)
-      
-      uv_mat(y, x) = (u << 8) | v;
-    }
-  }
-  
-  d_->y_image_gpu[0]->UploadPitchedAsync(
-      d_->stream, y_mat.step, y_mat.data);
-  d_->uv_image_gpu->UploadPitchedAsync(
-      d_->stream, uv_mat.step, reinterpret_cast<uint16_t*>(uv_mat.data));
-  
-  cudaEventRecord(d_->meshing_upload_end_event, d_->stream);
-  
-  // Downsample color image intensities to depth image resolution.
-  for (int i = 0; i < static_cast<int>(d_->y_image_gpu.size()) - 1; ++ i) {
-    // Downsample d_->y_image_gpu[i] to d_->y_image_gpu[i + 1].
-    DownsampleImageToHalfSizeCUDA(
-        d_->stream, *d_->y_image_gpu[i], d_->y_image_gpu[i + 1].get());
+  //       The UV channels are not required if projecting the RGB image directly.
+  ConvertRGBToYUVCUDA(
+      stream, *rgb_image_gpu, FLAGS_vc_average_uv, y_image_gpu,
+      FLAGS_vc_project_rgb_image ? nullptr : uv_image_gpu);
+  
+  cudaEventRecord(timings->meshing_upload_end_event, stream);
+  
+  // Downsample color image intensities to depth image resolution and compute
+  // the gradient magnitudes there in one kernel. The pyramid levels above 0
+  // are only used here and are therefore shared with the asynchronous meshing
+  // stage. Only the last of them is written (see
+  // ComputePyramidAndGradientMagnitudeDiv2CUDA()), so the downsampling stage
+  // timing includes the gradient magnitudes.
+  std::vector<CUDABuffer<uint8_t>*> y_image_levels;
+  for (int i = 1; i < static_cast<int>(d_->y_image_gpu.size()); ++ i) {
+    y_image_levels.push_back(d_->y_image_gpu[i].get());
   }
+  ComputePyramidAndGradientMagnitudeDiv2CUDA(
+      stream, *y_image_gpu, y_image_levels,
+      d_->gradient_magnitude_div_sqrt2.get());
+  CUDABuffer<uint8_t>* downsampled_y_image_gpu =
+      y_image_levels.empty() ? y_image_gpu : y_image_levels.back();
   
-  cudaEventRecord(d_->meshing_downsampling_end_event, d_->stream);
+  cudaEventRecord(timings->meshing_downsampling_end_event, stream);
   
   // Debug.
   if (FLAGS_vc_debug || FLAGS_vc_write_images) {
     std::ostringstream filename;
     filename << "debug_images/" << d_->output_frame_index << "_1_source_y_input_downsampled.png";
-    CUDABufferVisualization(*d_->y_image_gpu.back()).Display(0, 255, "1 - Y input (downsampled)", false, FLAGS_vc_write_images ? filename.str().c_str() : nullptr);
+    CUDABufferVisualization(*downsampled_y_image_gpu).Display(0, 255, "1 - Y input (downsampled)", false, FLAGS_vc_write_images ? filename.str().c_str() : nullptr, d_->image_writer.get());
   }
   
-  // Compute gradient magnitudes for downsampled color image.
-  ComputeGradientMagnitudeDiv2CUDA(d_->stream, *d_->y_image_gpu.back(),
-                                   d_->gradient_magnitude_div_sqrt2.get());
-  
-  cudaEventRecord(d_->meshing_gradient_mags_end_event, d_->stream);
+  cudaEventRecord(timings->meshing_gradient_mags_end_event, stream);
   
   // Debug.
   if (FLAGS_vc_debug || FLAGS_vc_write_images) {
     std::ostringstream filename;
     filename << "debug_images/" << d_->output_frame_index << "_2_source_y_input_gradient_magnitudes.png";
-    CUDABufferVisualization(*d_->gradient_magnitude_div_sqrt2).Display(0, 255, "2 - Y input gradient magnitudes", false, FLAGS_vc_write_images ? filename.str().c_str() : nullptr);
+    CUDABufferVisualization(*d_->gradient_magnitude_div_sqrt2).Display(0, 255, "2 - Y input gradient magnitudes", false, FLAGS_vc_write_images ? filename.str().c_str() : nullptr, d_->image_writer.get());
   }
   
-  // Inpaint depth map using color image gradients as weights.
+  // Determine the tiles which changed since the last frame, such that only
+  // these have to be re-inpainted and re-meshed. The Y image is at depth map
+  // resolution here.
   const float depth_scaling_factor =
       UsingDepthCameraInput() ? (1.f / 1000.f * std::numeric_limits<uint16_t>::max()) : 1.f;
+  if (d_->src_dirty_tile_buffers) {
+    UpdateDirtyTilesCUDA(
+        stream, depth_scaling_factor, d_->depth_image_gpu_texture,
+        *downsampled_y_image_gpu, FLAGS_vc_dirty_tile_depth_threshold,
+        FLAGS_vc_dirty_tile_intensity_threshold,
+        d_->src_dirty_tile_buffers.get());
+  }
+  
+  // Compute the gradient magnitudes for the coarser levels of the TV
+  // inpainting pyramid by continuing the Y image pyramid.
+  if (d_->src_tv_pyramid) {
+    for (int i = 0; i < static_cast<int>(d_->coarse_y_image_gpu.size()); ++ i) {
+      DownsampleImageToHalfSizeCUDA(
+          stream, *downsampled_y_image_gpu, d_->coarse_y_image_gpu[i].get());
+      downsampled_y_image_gpu = d_->coarse_y_image_gpu[i].get();
+      ComputeGradientMagnitudeDiv2CUDA(
+          stream, *downsampled_y_image_gpu,
+          d_->src_tv_pyramid->levels[i].gradient_magnitude_div_sqrt2.get());
+    }
+  }
+  
+  // Inpaint depth map using color image gradients as weights.
+  NVTXRange src_inpainting_range("SourceDepthInpainting");
+  const bool use_src_deadline = FLAGS_vc_source_inpainting_budget_ms > 0;
+  InpaintingDeadline src_deadline;
+  if (use_src_deadline) {
+    src_deadline = MakeInpaintingDeadline(
+        FLAGS_vc_source_inpainting_budget_ms,
+        d_->src_iteration_cost.ms_per_iteration());
+  }
   if (FLAGS_vc_inpainting_method == vc_inpainting_method::convolution) {
-    InpaintDepthMapWithConvolutionCUDA(
-        d_->stream,
+    d_->src_inpainting_iterations = InpaintDepthMapWithConvolutionCUDA(
+        stream,
         FLAGS_vc_use_weights_for_inpainting,
         std::max(d_->src_inpainted_depth_map->width(), d_->src_inpainted_depth_map->height()),
         1e-3f,
         depth_scaling_factor,
         d_->gradient_magnitude_div_sqrt2_texture,
         d_->depth_image_gpu_texture,
+        nullptr,
+        d_->src_dirty_tile_buffers ? d_->src_dirty_tile_buffers->inpainting_tiles.get() : nullptr,
         d_->src_tv_max_change.get() /*used for max_change*/,
         d_->src_inpainted_depth_map.get(),
         d_->src_block_coordinates.get(),
-        num_src_depth_pixels_to_inpaint);
+        num_src_depth_pixels_to_inpaint,
+        d_->src_compaction_buffers.get(),
+        FLAGS_vc_device_resident_inpainting && FLAGS_vc_persistent_inpainting_kernel,
+        use_src_deadline ? &src_deadline : nullptr,
+        &d_->src_inpainting_residual,
+        nullptr,
+        d_->src_convolution_config);
   } else if (FLAGS_vc_inpainting_method == vc_inpainting_method::TV) {
-    InpaintDepthMapCUDA(
-        d_->stream, kIMClassic,  // kIMAdaptive,
+    d_->src_inpainting_iterations = InpaintDepthMapCUDA(
+        stream, d_->src_tv_inpainting_mode,
         true, 1500, 1e-3f, depth_scaling_factor,
         d_->gradient_magnitude_div_sqrt2_texture, d_->depth_image_gpu_texture,
         d_->src_tv_flag.get(),
         d_->src_tv_dual_flag.get(),
         d_->src_tv_dual_x.get(), d_->src_tv_dual_y.get(), d_->src_tv_u_bar.get(),
         d_->src_tv_max_change_float.get(), d_->src_inpainted_depth_map.get(),
-        d_->src_block_coordinates.get(), d_->src_block_activities.get());
+        d_->src_block_coordinates.get(), d_->src_block_activities.get(),
+        d_->src_tv_pyramid.get(),
+        nullptr,
+        d_->src_compaction_buffers.get(),
+        &d_->src_tv_saved_block_iterations,
+        use_src_deadline ? &src_deadline : nullptr,
+        &d_->src_inpainting_residual,
+        nullptr);
   }
+  src_inpainting_range.AddValue("iterations", d_->src_inpainting_iterations);
+  src_inpainting_range.AddValue("pixels to inpaint", *num_src_depth_pixels_to_inpaint);
+  src_inpainting_range.End();
 
-  cudaEventRecord(d_->meshing_inpainting_end_event, d_->stream);
+  cudaEventRecord(timings->meshing_inpainting_end_event, stream);
   
   // Debug.
   if (FLAGS_vc_debug || FLAGS_vc_write_images) {
     std::ostringstream filename;
     filename << "debug_images/" << d_->output_frame_index << "_3_source_inpainted_depth.png";
-    CUDABufferVisualization(*d_->src_inpainted_depth_map).DisplayDepthMap(kMinDepthForDisplay, kMaxDepthForDisplay, "3 - Source frame inpainted depth", false, FLAGS_vc_write_images ? filename.str().c_str() : nullptr);
-  }
-  
-  constexpr bool kDeleteAlmostOccludedPixels = false;
-  if (kDeleteAlmostOccludedPixels) {
-    // Delete all background pixels which are close to foreground pixels. This
-    // helps to prevent foreground objects from being projected onto the
-    // background if occlusion boundaries are imprecise.
-    constexpr int occlusion_safety_radius = 2;  // In pixels.
-    constexpr float occlusion_threshold = occlusion_safety_radius * 0.07f;  // In meters.
-    DeleteAlmostOccludedPixelsCUDA(
-        d_->stream,
-        occlusion_safety_radius,
-        occlusion_threshold,
-        *d_->src_inpainted_depth_map,
-        d_->src_inpainted_depth_map_alternate.get());
-    std::swap(d_->src_inpainted_depth_map, d_->src_inpainted_depth_map_alternate);
-    
-    // Debug.
-    if (FLAGS_vc_debug || FLAGS_vc_write_images) {
-      std::ostringstream filename;
-      filename << "debug_images/" << d_->output_frame_index << "_3b_source_masked_inpainted_depth.png";
-      CUDABufferVisualization(*d_->src_inpainted_depth_map).DisplayDepthMap(kMinDepthForDisplay, kMaxDepthForDisplay, "3 - Source frame masked inpainted depth", false, FLAGS_vc_write_images ? filename.str().c_str() : nullptr);
-    }
+    CUDABufferVisualization(*d_->src_inpainted_depth_map).DisplayDepthMap(kMinDepthForDisplay, kMaxDepthForDisplay, "3 - Source frame inpainted depth", false, FLAGS_vc_write_images ? filename.str().c_str() : nullptr, d_->image_writer.get());
   }
   
   // Mesh inpainted depth map. Set colors differently on discontinuities.
-  MeshDepthmapCUDA(
-      d_->src_inpainted_depth_map->ToCUDA(),
-      depth_fx_inv_, depth_fy_inv_, depth_cx_inv_, depth_cy_inv_,
-      d_->stream,
-      d_->vertex_buffer_resource,
-      d_->color_buffer_resource,
-      d_->index_buffer_resource);
+  // The back buffers have been mapped by StartAsynchronousMeshing(). Only the
+  // front buffers always contain the previous mesh, so only they can be
+  // updated incrementally.
+  const CUDABuffer<uint8_t>* meshing_tiles =
+      (d_->src_dirty_tile_buffers && !FLAGS_vc_async_source_meshing) ?
+      d_->src_dirty_tile_buffers->meshing_tiles.get() : nullptr;
+  if (use_back_buffers && FLAGS_vc_decimate_mesh) {
+    MeshDepthmapDecimatedCUDA(
+        d_->src_inpainted_depth_map->ToCUDA(),
+        depth_fx_inv_, depth_fy_inv_, depth_cx_inv_, depth_cy_inv_,
+        FLAGS_vc_mesh_decimation_threshold,
+        stream,
+        back_vertices,
+        back_colors,
+        back_indices,
+        d_->mesh_index_compaction_buffers.get(),
+        d_->src_occlusion_filter);
+  } else if (use_back_buffers) {
+    MeshDepthmapCUDA(
+        d_->src_inpainted_depth_map->ToCUDA(),
+        depth_fx_inv_, depth_fy_inv_, depth_cx_inv_, depth_cy_inv_,
+        stream,
+        back_vertices,
+        back_colors,
+        back_indices,
+        nullptr,
+        d_->mesh_index_compaction_buffers.get(),
+        d_->src_occlusion_filter);
+  } else if (FLAGS_vc_decimate_mesh) {
+    MeshDepthmapDecimatedCUDA(
+        d_->src_inpainted_depth_map->ToCUDA(),
+        depth_fx_inv_, depth_fy_inv_, depth_cx_inv_, depth_cy_inv_,
+        FLAGS_vc_mesh_decimation_threshold,
+        stream,
+        d_->vertex_buffer_resource,
+        d_->color_buffer_resource,
+        d_->index_buffer_resource,
+        d_->mesh_index_compaction_buffers.get(),
+        d_->src_occlusion_filter);
+  } else {
+    MeshDepthmapCUDA(
+        d_->src_inpainted_depth_map->ToCUDA(),
+        depth_fx_inv_, depth_fy_inv_, depth_cx_inv_, depth_cy_inv_,
+        stream,
+        d_->vertex_buffer_resource,
+        d_->color_buffer_resource,
+        d_->index_buffer_resource,
+        meshing_tiles,
+        d_->mesh_index_compaction_buffers.get(),
+        d_->src_occlusion_filter);
+  }
   
-  cudaEventRecord(d_->meshing_end_event, d_->stream);
+  cudaEventRecord(timings->meshing_end_event, stream);
   
   if (FLAGS_vc_evaluate_rgb_frame_inpainting) {
     // Also create a mesh from the original depth map.
     if (UsingMeshInput()) {
       CUDABuffer<float> temp_depth_buffer(d_->depth_image_gpu->height(),
                                           d_->depth_image_gpu->width());
-      temp_depth_buffer.SetTo(d_->depth_image_gpu_texture, d_->stream);
+      temp_depth_buffer.SetTo(d_->depth_image_gpu_texture, stream);
       MeshDepthmapCUDA(
           temp_depth_buffer.ToCUDA(),
           depth_fx_inv_, depth_fy_inv_, depth_cx_inv_, depth_cy_inv_,
-          d_->stream,
+          stream,
           d_->raw_vertex_buffer_resource,
           d_->raw_color_buffer_resource,
-          d_->raw_index_buffer_resource);
+          d_->raw_index_buffer_resource,
+          nullptr,
+          nullptr,
+          OcclusionSafetyFilter());
     } else {
       MeshDepthmapMMCUDA(
           d_->depth_image_gpu->ToCUDA(),
           depth_fx_inv_, depth_fy_inv_, depth_cx_inv_, depth_cy_inv_,
-          d_->stream,
+          stream,
           d_->raw_vertex_buffer_resource,
           d_->raw_color_buffer_resource,
           d_->raw_index_buffer_resource);
     }
   }
   
+  if (!use_back_buffers) {
+    // The triangle count of a compacted mesh is required on the host for
+    // rendering it.
+    if (d_->mesh_index_compaction_buffers) {
+      d_->num_mesh_indices =
+          d_->mesh_index_compaction_buffers->WaitForIndexCount();
+    }
+    d_->have_meshed_inpainted_depth_map = true;
+  }
+}
+
+void ViewCorrectionDisplay::StartAsynchronousMeshing(
+    const DepthImage& depth_image,
+    const ColorImage& rgb_image,
+    const Sophus::SE3f& G_T_src_C) {
+  CHECK(!d_->source_meshing_in_flight);
+  
+  // Rendering the depth image and mapping the back buffers needs the OpenGL
+  // context, so this is done here in the render thread. The meshing thread
+  // waits for source_meshing_input_ready_event before using the results.
+  if (HaveMeshToRender()) {
+    RenderDepthImageFromMesh(G_T_src_C);
+    cudaTextureObject_t rendered_depth_texture =
+        d_->src_mesh_renderer_->MapDepthResultAsTexture(
+            cudaAddressModeClamp, cudaAddressModeClamp, cudaFilterModePoint,
+            false, d_->stream);
+    d_->src_rendered_depth->SetTo(rendered_depth_texture, d_->stream);
+    d_->src_mesh_renderer_->UnmapDepthResult(rendered_depth_texture,
+                                             d_->stream);
+  }
+  
+  cudaGraphicsResource_t back_resources[3] = {
+      d_->back_vertex_buffer_resource, d_->back_color_buffer_resource,
+      d_->back_index_buffer_resource};
+  CUDA_CHECKED_CALL(cudaGraphicsMapResources(3, back_resources, d_->stream));
+  size_t buffer_size;
+  CUDA_CHECKED_CALL(cudaGraphicsResourceGetMappedPointer(
+      reinterpret_cast<void**>(&d_->back_vertex_buffer_pointer), &buffer_size,
+      d_->back_vertex_buffer_resource));
+  CUDA_CHECKED_CALL(cudaGraphicsResourceGetMappedPointer(
+      reinterpret_cast<void**>(&d_->back_color_buffer_pointer), &buffer_size,
+      d_->back_color_buffer_resource));
+  CUDA_CHECKED_CALL(cudaGraphicsResourceGetMappedPointer(
+      reinterpret_cast<void**>(&d_->back_index_buffer_pointer), &buffer_size,
+      d_->back_index_buffer_resource));
+  
+  // This also orders the meshing job after all rendering work which is still
+  // reading from the buffers that become the back buffers after a swap.
+  cudaEventRecord(d_->source_meshing_input_ready_event, d_->stream);
+  
+  std::unique_lock<std::mutex> lock(d_->source_meshing_mutex);
+  d_->source_meshing_depth_image = depth_image;
+  d_->source_meshing_rgb_image = rgb_image;
+  d_->source_meshing_G_T_src_C = G_T_src_C;
+  d_->source_meshing_job_pending = true;
+  d_->source_meshing_job_enqueued = false;
+  lock.unlock();
+  d_->source_meshing_condition.notify_all();
+  
+  d_->source_meshing_in_flight = true;
+}
+
+bool ViewCorrectionDisplay::PollAsynchronousMeshing() {
+  if (!d_->source_meshing_in_flight) {
+    return true;
+  }
+  
+  std::unique_lock<std::mutex> lock(d_->source_meshing_mutex);
+  if (!d_->source_meshing_job_enqueued) {
+    return false;
+  }
+  lock.unlock();
+  
+  cudaError_t status = cudaEventQuery(d_->source_meshing_done_event);
+  if (status == cudaErrorNotReady) {
+    return false;
+  }
+  CUDA_CHECKED_CALL(status);
+  
+  cudaGraphicsResource_t back_resources[3] = {
+      d_->back_vertex_buffer_resource, d_->back_color_buffer_resource,
+      d_->back_index_buffer_resource};
+  CUDA_CHECKED_CALL(cudaGraphicsUnmapResources(3, back_resources, d_->stream));
+  
+  // Swap the finished result in for rendering.
+  std::swap(d_->rgb_image_gpu, d_->rgb_image_gpu_back);
+  std::swap(d_->y_image_gpu[0], d_->y_image_gpu_back);
+  std::swap(d_->uv_image_gpu, d_->uv_image_gpu_back);
+  std::swap(d_->y_image_texture, d_->y_image_texture_back);
+  std::swap(d_->uv_image_texture, d_->uv_image_texture_back);
+  std::swap(d_->vertex_buffer, d_->back_vertex_buffer);
+  std::swap(d_->color_buffer, d_->back_color_buffer);
+  std::swap(d_->index_buffer, d_->back_index_buffer);
+  std::swap(d_->vertex_buffer_resource, d_->back_vertex_buffer_resource);
+  std::swap(d_->color_buffer_resource, d_->back_color_buffer_resource);
+  std::swap(d_->index_buffer_resource, d_->back_index_buffer_resource);
+  if (d_->mesh_index_compaction_buffers) {
+    // The index count has been downloaded before source_meshing_done_event.
+    d_->num_mesh_indices = d_->mesh_index_compaction_buffers->index_count();
+  }
+  // Take the pose and the timestamp of the finished job as one snapshot.
+  lock.lock();
+  d_->G_T_src_C_ = d_->source_meshing_G_T_src_C;
+  d_->G_T_src_C_timestamp_ = d_->source_meshing_rgb_image.timestamp_ns();
+  lock.unlock();
   d_->have_meshed_inpainted_depth_map = true;
+  ++ d_->target_input_version;
+  
+  if (FLAGS_vc_do_timings || FLAGS_vc_save_timings || UsingInpaintingDeadlines() ||
+      d_->meshing_scheduler) {
+    FrameTimings* timings = &d_->source_meshing_timings;
+    timings->has_meshing = true;
+    timings->has_rendering = false;
+    timings->src_depth_pixel_count = d_->source_meshing_num_pixels_to_inpaint;
+    timings->src_saved_block_iterations = d_->src_tv_saved_block_iterations;
+    timings->src_iterations = d_->src_inpainting_iterations;
+    timings->src_residual = d_->src_inpainting_residual;
+    timings->pixel_counts_on_gpu =
+        FLAGS_vc_device_resident_inpainting &&
+        FLAGS_vc_inpainting_method == vc_inpainting_method::convolution;
+    timings->pending = true;
+    CollectFrameTimings(timings);
+  }
+  
+  d_->source_meshing_in_flight = false;
+  return true;
+}
+
+void ViewCorrectionDisplay::CopyMeshingResultsToRenderDevice() {
+  cudaStream_t stream = d_->source_stream;
+  const int num_vertices = d_->meshing_colors->width();
+  CUDA_CHECKED_CALL(cudaMemcpyPeerAsync(
+      d_->back_vertex_buffer_pointer, d_->render_device,
+      d_->meshing_vertices->ToCUDA().address(), d_->meshing_device,
+      3 * num_vertices * sizeof(float), stream));
+  CUDA_CHECKED_CALL(cudaMemcpyPeerAsync(
+      d_->back_color_buffer_pointer, d_->render_device,
+      d_->meshing_colors->ToCUDA().address(), d_->meshing_device,
+      num_vertices * sizeof(uint8_t), stream));
+  // The index count of a compacted mesh is not known on the host at this
+  // point, so the whole index buffer is copied.
+  CUDA_CHECKED_CALL(cudaMemcpyPeerAsync(
+      d_->back_index_buffer_pointer, d_->render_device,
+      d_->meshing_indices->ToCUDA().address(), d_->meshing_device,
+      d_->meshing_indices->width() * sizeof(uint32_t), stream));
+  
+  // The target frame samples the colors of the source frame.
+  CopyBufferAcrossDevices(*d_->meshing_rgb_image, stream, d_->rgb_image_gpu_back.get());
+  CopyBufferAcrossDevices(*d_->meshing_y_image, stream, d_->y_image_gpu_back.get());
+  if (!FLAGS_vc_project_rgb_image) {
+    CopyBufferAcrossDevices(*d_->meshing_uv_image, stream, d_->uv_image_gpu_back.get());
+  }
+}
+
+void ViewCorrectionDisplay::SourceMeshingThreadMain() {
+  // The current device is per thread.
+  CUDA_CHECKED_CALL(cudaSetDevice(
+      (d_->meshing_device >= 0) ? d_->meshing_device : d_->render_device));
+  
+  while (true) {
+    std::unique_lock<std::mutex> lock(d_->source_meshing_mutex);
+    d_->source_meshing_condition.wait(lock, [&]{
+      return d_->source_meshing_job_pending || d_->source_meshing_quit_requested;
+    });
+    if (d_->source_meshing_quit_requested) {
+      return;
+    }
+    DepthImage depth_image = d_->source_meshing_depth_image;
+    ColorImage rgb_image = d_->source_meshing_rgb_image;
+    d_->source_meshing_job_pending = false;
+    lock.unlock();
+    
+    cudaStreamWaitEvent(d_->source_stream, d_->source_meshing_input_ready_event, 0);
+    if (UsingDepthCameraInput()) {
+      UploadDepthImage(d_.get(), d_->source_stream, depth_image);
+    }
+    
+    CreateMeshedInpaintedDepthMap(rgb_image, true, &d_->source_meshing_timings,
+                                  &d_->source_meshing_num_pixels_to_inpaint);
+    if (d_->meshing_device >= 0) {
+      CopyMeshingResultsToRenderDevice();
+    }
+    if ((FLAGS_vc_do_timings || FLAGS_vc_save_timings || UsingInpaintingDeadlines() ||
+         d_->meshing_scheduler) &&
+        FLAGS_vc_device_resident_inpainting &&
+        FLAGS_vc_inpainting_method == vc_inpainting_method::convolution) {
+      d_->src_compaction_buffers->counters->DownloadAsync(
+          d_->source_stream, d_->source_meshing_timings.compaction_counters_for(0));
+    }
+    cudaEventRecord(d_->source_meshing_timings.statistics_end_event, d_->source_stream);
+    cudaEventRecord(d_->source_meshing_done_event, d_->source_stream);
+    
+    lock.lock();
+    d_->source_meshing_job_enqueued = true;
+  }
 }
 
 bool ViewCorrectionDisplay::SetupTargetView(
@@ -1824,7 +4196,8 @@ bool ViewCorrectionDisplay::SetupTargetView(
   // Determine the observer position in the camera frame of this device, at the
   // current point in time.
   Eigen::Vector3f latest_camera_observer_position = Eigen::Vector3f::Zero();
-  if (target_view_mode_ == TargetViewMode::kReceiveFromUDP) {
+  if (target_view_mode_ == TargetViewMode::kReceiveFromUDP ||
+      target_view_mode_ == TargetViewMode::kObserverPoseCallback) {
 //     // DEBUG: fix the pose to some global point.
 //     static int counter = 0;
 //     static Eigen::Vector3f fixed_global_observer;
@@ -1840,6 +4213,26 @@ bool ViewCorrectionDisplay::SetupTargetView(
     // Listen for new observer pose messages.
     // d_->position_receiver.ReceiveNonBlocking();
     
+    // Read the latest observer pose once, without waiting for the receive
+    // thread. Only its position is used, since the screen defines the view
+    // direction.
+    ObserverPose observer_pose;
+    const bool have_observer_pose =
+        d_->position_receiver.GetLatestObserverPose(&observer_pose);
+    if (have_observer_pose && d_->session_recorder) {
+      // Record the pose in the time base of the camera poses, such that the
+      // replay can interleave them.
+      const uint64_t start_time_ns =
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              start_time_.time_since_epoch()).count();
+      d_->session_recorder->AddObserverPose(
+          observer_pose.G_T_observer,
+          (observer_pose.receive_timestamp_ns > start_time_ns) ?
+              (observer_pose.receive_timestamp_ns - start_time_ns) : 0);
+    }
+    const Eigen::Vector3f received_observer_position =
+        observer_pose.G_T_observer.translation();
+    
     // Set to true to assume that the pose is a fixed observer position
     // (as with target_view_mode_ == TargetViewMode::kFixedOffset). Set to false
     // to asssume that it is a global map pose.
@@ -1848,7 +4241,7 @@ bool ViewCorrectionDisplay::SetupTargetView(
     if (kPoseIsRelative) {
       const char* position_filename = "/sdcard/view_correction_last_observer_position.txt";
       
-      if (!d_->position_receiver.received_any_observer_position()) {
+      if (!have_observer_pose) {
         // Use default pose or try to load it from file.
         latest_camera_observer_position =
             Eigen::Vector3f(-0.05f, 0.05f, -0.50f);  // Default.
@@ -1872,10 +4265,8 @@ bool ViewCorrectionDisplay::SetupTargetView(
         }
       } else {
         // Use received pose.
-        if (latest_camera_observer_position !=
-            d_->position_receiver.last_received_observer_position()) {
-          latest_camera_observer_position =
-              d_->position_receiver.last_received_observer_position();
+        if (latest_camera_observer_position != received_observer_position) {
+          latest_camera_observer_position = received_observer_position;
           
           // Save the new position as the new default.
           std::ofstream file_stream(position_filename, std::ios::out);
@@ -1883,20 +4274,18 @@ bool ViewCorrectionDisplay::SetupTargetView(
           file_stream.close();
         }
         
-        latest_camera_observer_position =
-            d_->position_receiver.last_received_observer_position();
+        latest_camera_observer_position = received_observer_position;
       }
     } else {
       // Check that we received at least one observer pose.
-      if (!d_->position_receiver.received_any_observer_position()) {
+      if (!have_observer_pose) {
         // No pose input yet.
         return false;
       }
       
       // Here, I assume that the observer position we get is at the current
       // time and expressed in the same coordinate system as this device's pose.
-      const Eigen::Vector3f global_observer_position =
-          d_->position_receiver.last_received_observer_position();
+      const Eigen::Vector3f global_observer_position = received_observer_position;
       
       // Transform the observer position into the camera frame of this device,
       // at the current point in time.
@@ -1917,7 +4306,7 @@ bool ViewCorrectionDisplay::SetupTargetView(
     // debug_observer_stream << "v " << global_observer_position.transpose() << std::endl;
   } else if (target_view_mode_ == TargetViewMode::kFixedOffset) {
     // Set a fixed observer position.
-    if (FLAGS_vc_evaluate_stereo) {
+    if (RenderingStereo()) {
       constexpr float kEyeDistance = 0.06f;
       if (render_stereo_image) {
         latest_camera_observer_position =
@@ -1940,7 +4329,7 @@ bool ViewCorrectionDisplay::SetupTargetView(
   Eigen::Vector3f screen_top_right(24.766f / 1000.f, -3.6885f / 1000.f, -10.633f / 1000.f);
   Eigen::Vector3f screen_bottom_left(-125.23f / 1000.f, 90.944f / 1000.f, -33.147f / 1000.f);
   
-  if (FLAGS_vc_evaluate_stereo) {
+  if (RenderingStereo()) {
     Eigen::Vector3f screen_right = screen_top_right - screen_top_left;
     if (render_stereo_image) {
       screen_top_left += screen_right / 2;
@@ -1961,7 +4350,7 @@ bool ViewCorrectionDisplay::SetupTargetView(
   
   // Validate the calibration against the expected size of the screen.
   constexpr float kMetersPerInch = 0.0254f;
-  float x_pixels_per_meter = 323.f / kMetersPerInch * target_render_width_ / (FLAGS_vc_evaluate_stereo ? (1920.f / 2) : 1920.f);
+  float x_pixels_per_meter = 323.f / kMetersPerInch * target_render_width_ / (RenderingStereo() ? (1920.f / 2) : 1920.f);
   float y_pixels_per_meter = 323.f / kMetersPerInch * target_render_height_ / 1200.f;
 #ifndef ANDROID
   float expected_screen_width_meters = target_render_width_ / x_pixels_per_meter;
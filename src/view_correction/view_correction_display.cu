@@ -28,14 +28,117 @@
 
 #include "view_correction/view_correction_display.cuh"
 
+#include <cstring>
+
+#include <cub/cub.cuh>
 #include <glog/logging.h>
 
+#include "view_correction/cuda_hole_map.cuh"
 #include "view_correction/cuda_util.h"
 #include "view_correction/helper_math.h"
 
 namespace view_correction {
 constexpr float kSqrt2 = 1.4142135623731f;
 
+__forceinline__ __device__ uint8_t ClampToUint8(float value) {
+  return static_cast<uint8_t>(::max(0.f, ::min(255.f, value)));
+}
+
+template<bool average_uv>
+__global__ void ConvertRGBToYUVCUDAKernel(
+    CUDABuffer_<uint8_t> rgb_image,
+    CUDABuffer_<uint8_t> y_image,
+    CUDABuffer_<uint16_t> uv_image) {
+  const unsigned int x = blockIdx.x * blockDim.x + threadIdx.x;
+  const unsigned int y = blockIdx.y * blockDim.y + threadIdx.y;
+  
+  // NOTE: Assuming RGB order in rgb_image (not BGR!)
+  if (x < y_image.width() && y < y_image.height()) {
+    const float r = rgb_image(y, 3 * x + 0);
+    const float g = rgb_image(y, 3 * x + 1);
+    const float b = rgb_image(y, 3 * x + 2);
+    y_image(y, x) = ClampToUint8(0.299f * r + 0.587f * g + 0.114f * b);
+  }
+  
+  const unsigned int uv_x = x / 2;
+  const unsigned int uv_y = y / 2;
+  if (uv_image.address() != nullptr && x % 2 == 0 && y % 2 == 0 &&
+      uv_x < uv_image.width() && uv_y < uv_image.height()) {
+    float r = rgb_image(y, 3 * x + 0);
+    float g = rgb_image(y, 3 * x + 1);
+    float b = rgb_image(y, 3 * x + 2);
+    if (average_uv) {
+      r = 0.25f * (r + rgb_image(y, 3 * x + 3) + rgb_image(y + 1, 3 * x + 0) + rgb_image(y + 1, 3 * x + 3));
+      g = 0.25f * (g + rgb_image(y, 3 * x + 4) + rgb_image(y + 1, 3 * x + 1) + rgb_image(y + 1, 3 * x + 4));
+      b = 0.25f * (b + rgb_image(y, 3 * x + 5) + rgb_image(y + 1, 3 * x + 2) + rgb_image(y + 1, 3 * x + 5));
+    }
+    const uint8_t u = ClampToUint8(-0.169f * r - 0.331f * g + 0.499f * b + 128);
+    const uint8_t v = ClampToUint8(0.499f * r - 0.418f * g - 0.813f * b + 128);
+    uv_image(uv_y, uv_x) = (u << 8) | v;
+  }
+}
+
+void ConvertRGBToYUVCUDA(
+    cudaStream_t stream,
+    const CUDABuffer<uint8_t>& rgb_image,
+    bool average_uv,
+    CUDABuffer<uint8_t>* y_image,
+    CUDABuffer<uint16_t>* uv_image) {
+  CHECK_NOTNULL(y_image);
+  CHECK_EQ(rgb_image.width(), 3 * y_image->width());
+  CHECK_EQ(rgb_image.height(), y_image->height());
+  if (uv_image) {
+    CHECK_LE(2 * uv_image->width(), y_image->width());
+    CHECK_LE(2 * uv_image->height(), y_image->height());
+  }
+  
+  constexpr int kBlockWidth = 32;
+  constexpr int kBlockHeight = 8;
+  dim3 grid_dim(cuda_util::GetBlockCount(y_image->width(), kBlockWidth),
+                cuda_util::GetBlockCount(y_image->height(), kBlockHeight));
+  dim3 block_dim(kBlockWidth, kBlockHeight);
+  if (average_uv) {
+    ConvertRGBToYUVCUDAKernel<true><<<grid_dim, block_dim, 0, stream>>>(
+        rgb_image.ToCUDA(), y_image->ToCUDA(),
+        uv_image ? uv_image->ToCUDA() : CUDABuffer_<uint16_t>());
+  } else {
+    ConvertRGBToYUVCUDAKernel<false><<<grid_dim, block_dim, 0, stream>>>(
+        rgb_image.ToCUDA(), y_image->ToCUDA(),
+        uv_image ? uv_image->ToCUDA() : CUDABuffer_<uint16_t>());
+  }
+  CHECK_CUDA_NO_ERROR();
+}
+
+__global__ void PackRGBXToRGBCUDAKernel(
+    CUDABuffer_<uchar4> rgbx_image,
+    CUDABuffer_<uint8_t> rgb_image) {
+  const int x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+  if (x < rgbx_image.width() && y < rgbx_image.height()) {
+    const uchar4 rgbx = rgbx_image(y, x);
+    rgb_image(y, 3 * x + 0) = rgbx.x;
+    rgb_image(y, 3 * x + 1) = rgbx.y;
+    rgb_image(y, 3 * x + 2) = rgbx.z;
+  }
+}
+
+void PackRGBXToRGBCUDA(
+    cudaStream_t stream,
+    const CUDABuffer_<uchar4>& rgbx_image,
+    CUDABuffer<uint8_t>* rgb_image) {
+  CHECK_EQ(3 * rgbx_image.width(), rgb_image->width());
+  CHECK_EQ(rgbx_image.height(), rgb_image->height());
+  
+  constexpr int kBlockWidth = 32;
+  constexpr int kBlockHeight = 8;
+  dim3 grid_dim(cuda_util::GetBlockCount(rgbx_image.width(), kBlockWidth),
+                cuda_util::GetBlockCount(rgbx_image.height(), kBlockHeight));
+  dim3 block_dim(kBlockWidth, kBlockHeight);
+  PackRGBXToRGBCUDAKernel<<<grid_dim, block_dim, 0, stream>>>(
+      rgbx_image, rgb_image->ToCUDA());
+  CHECK_CUDA_NO_ERROR();
+}
+
 __global__ void DownsampleImageToHalfSizeCUDAKernel(
     CUDABuffer_<uint8_t> target,
     cudaTextureObject_t source_texture) {
@@ -73,6 +176,16 @@ void DownsampleImageToHalfSizeCUDA(
   cudaDestroyTextureObject(source_texture);
 }
 
+// Returns the gradient magnitude divided by sqrt(2) for the pixel with the
+// given intensity and the intensities of its right and bottom neighbors.
+__forceinline__ __device__ uint8_t GradientMagnitudeDiv2(
+    int intensity, int intensity_px, int intensity_py) {
+  const float dx = intensity_px - intensity;
+  const float dy = intensity_py - intensity;
+  const float gradient_magnitude = sqrtf(dx * dx + dy * dy) / kSqrt2;
+  return min(255u, static_cast<uint8_t>(gradient_magnitude));
+}
+
 __global__ void ComputeGradientMagnitudeDiv2CUDAKernel(
     CUDABuffer_<uint8_t> output,
     cudaTextureObject_t image_texture) {
@@ -82,16 +195,10 @@ __global__ void ComputeGradientMagnitudeDiv2CUDAKernel(
   const int width = output.width();
   const int height = output.height();
   if (x < width && y < height) {
-    // NOTE: Use of shared memory might lead to slight performance benefit.
     const int intensity = tex2D<uint8_t>(image_texture, x + 0, y + 0);
     const int intensity_px = tex2D<uint8_t>(image_texture, x + 1, y + 0);
     const int intensity_py = tex2D<uint8_t>(image_texture, x + 0, y + 1);
-    
-    const float dx = intensity_px - intensity;
-    const float dy = intensity_py - intensity;
-    const float gradient_magnitude = sqrtf(dx * dx + dy * dy) / kSqrt2;
-    
-    output(y, x) = min(255u, static_cast<uint8_t>(gradient_magnitude));
+    output(y, x) = GradientMagnitudeDiv2(intensity, intensity_px, intensity_py);
   }
 }
 
@@ -117,33 +224,275 @@ void ComputeGradientMagnitudeDiv2CUDA(
   cudaDestroyTextureObject(image_texture);
 }
 
+// Tile size (in pixels of the last pyramid level) and thread block size of
+// ComputePyramidAndGradientMagnitudeDiv2CUDAKernel().
+constexpr int kPyramidTileSize = 16;
+
+// Maximum number of pyramid levels which are computed by
+// ComputePyramidAndGradientMagnitudeDiv2CUDAKernel(), limited by the shared
+// memory for the tile of the input image.
+constexpr int kMaxFusedPyramidLevels = 3;
+
+// Computes a tile of the last level of the image pyramid with kLevels
+// levels above the input image and its gradient magnitudes. Each thread block
+// loads the tile's footprint in the input image (with a border of one pixel
+// of the last level for the gradients) into shared memory and downsamples it
+// there level by level, such that the intermediate levels never go to global
+// memory. Coordinates outside of a level are clamped to it before
+// downsampling, which reproduces the clamping texture lookups of
+// DownsampleImageToHalfSizeCUDAKernel() and
+// ComputeGradientMagnitudeDiv2CUDAKernel().
+template<int kLevels>
+__global__ void ComputePyramidAndGradientMagnitudeDiv2CUDAKernel(
+    CUDABuffer_<uint8_t> image,
+    CUDABuffer_<uint8_t> last_level,
+    CUDABuffer_<uint8_t> gradient_magnitude_div_sqrt2) {
+  // Side lengths of the tile's footprint in the input and in the first
+  // downsampled level.
+  constexpr int kRegionSize = (kPyramidTileSize + 1) << kLevels;
+  constexpr int kHalfRegionSize = (kLevels > 0) ? (kRegionSize / 2) : 1;
+  __shared__ uint8_t region[kRegionSize * kRegionSize];
+  __shared__ uint8_t half_region[kHalfRegionSize * kHalfRegionSize];
+  
+  const int thread_index = threadIdx.x + threadIdx.y * kPyramidTileSize;
+  constexpr int kThreadCount = kPyramidTileSize * kPyramidTileSize;
+  
+  // Load the footprint in the input image.
+  int origin_x = (blockIdx.x * kPyramidTileSize) << kLevels;
+  int origin_y = (blockIdx.y * kPyramidTileSize) << kLevels;
+  for (int i = thread_index; i < kRegionSize * kRegionSize; i += kThreadCount) {
+    const int x = min(origin_x + i % kRegionSize, image.width() - 1);
+    const int y = min(origin_y + i / kRegionSize, image.height() - 1);
+    region[i] = image(y, x);
+  }
+  __syncthreads();
+  
+  // Downsample level by level, alternating between the two buffers. Pixel
+  // (x, y) of a level is the rounded average of the 2x2 pixels at (2 x, 2 y)
+  // of the previous level.
+  int level_width = image.width();
+  int level_height = image.height();
+  int region_size = kRegionSize;
+  uint8_t* source = region;
+  uint8_t* target = half_region;
+  #pragma unroll
+  for (int level = 0; level < kLevels; ++ level) {
+    level_width /= 2;
+    level_height /= 2;
+    origin_x /= 2;
+    origin_y /= 2;
+    const int source_size = region_size;
+    region_size /= 2;
+    for (int i = thread_index; i < region_size * region_size; i += kThreadCount) {
+      const int x = min(origin_x + i % region_size, level_width - 1) - origin_x;
+      const int y = min(origin_y + i / region_size, level_height - 1) - origin_y;
+      const uint8_t* source_pixel = source + 2 * x + 2 * y * source_size;
+      target[i] = (source_pixel[0] + source_pixel[1] +
+                   source_pixel[source_size] + source_pixel[source_size + 1] + 2) / 4;
+    }
+    __syncthreads();
+    uint8_t* temp = source;
+    source = target;
+    target = temp;
+  }
+  
+  // Write the last level and its gradient magnitudes.
+  const int x = origin_x + threadIdx.x;
+  const int y = origin_y + threadIdx.y;
+  if (x < gradient_magnitude_div_sqrt2.width() &&
+      y < gradient_magnitude_div_sqrt2.height()) {
+    const uint8_t* pixel = source + threadIdx.x + threadIdx.y * region_size;
+    if (kLevels > 0) {
+      last_level(y, x) = pixel[0];
+    }
+    gradient_magnitude_div_sqrt2(y, x) =
+        GradientMagnitudeDiv2(pixel[0], pixel[1], pixel[region_size]);
+  }
+}
+
+void ComputePyramidAndGradientMagnitudeDiv2CUDA(
+    cudaStream_t stream,
+    const CUDABuffer<uint8_t>& image,
+    const std::vector<CUDABuffer<uint8_t>*>& levels,
+    CUDABuffer<uint8_t>* gradient_magnitude_div_sqrt2) {
+  CHECK_NOTNULL(gradient_magnitude_div_sqrt2);
+  const int level_count = static_cast<int>(levels.size());
+  if (level_count > kMaxFusedPyramidLevels) {
+    // The footprint would not fit into shared memory. Downsample level by
+    // level instead.
+    const CUDABuffer<uint8_t>* source = &image;
+    for (CUDABuffer<uint8_t>* level : levels) {
+      DownsampleImageToHalfSizeCUDA(stream, *source, level);
+      source = level;
+    }
+    ComputeGradientMagnitudeDiv2CUDA(stream, *source, gradient_magnitude_div_sqrt2);
+    return;
+  }
+  
+  const CUDABuffer<uint8_t>& last_level = (level_count > 0) ? *levels.back() : image;
+  CHECK_EQ(last_level.width(), image.width() >> level_count);
+  CHECK_EQ(last_level.height(), image.height() >> level_count);
+  CHECK_EQ(gradient_magnitude_div_sqrt2->width(), last_level.width());
+  CHECK_EQ(gradient_magnitude_div_sqrt2->height(), last_level.height());
+  
+  dim3 gridDim(cuda_util::GetBlockCount(last_level.width(), kPyramidTileSize),
+               cuda_util::GetBlockCount(last_level.height(), kPyramidTileSize));
+  dim3 blockDim(kPyramidTileSize, kPyramidTileSize);
+  const CUDABuffer_<uint8_t> last_level_output =
+      (level_count > 0) ? levels.back()->ToCUDA() : CUDABuffer_<uint8_t>();
+  if (level_count == 0) {
+    ComputePyramidAndGradientMagnitudeDiv2CUDAKernel<0><<<gridDim, blockDim, 0, stream>>>(
+        image.ToCUDA(), last_level_output, gradient_magnitude_div_sqrt2->ToCUDA());
+  } else if (level_count == 1) {
+    ComputePyramidAndGradientMagnitudeDiv2CUDAKernel<1><<<gridDim, blockDim, 0, stream>>>(
+        image.ToCUDA(), last_level_output, gradient_magnitude_div_sqrt2->ToCUDA());
+  } else if (level_count == 2) {
+    ComputePyramidAndGradientMagnitudeDiv2CUDAKernel<2><<<gridDim, blockDim, 0, stream>>>(
+        image.ToCUDA(), last_level_output, gradient_magnitude_div_sqrt2->ToCUDA());
+  } else {
+    ComputePyramidAndGradientMagnitudeDiv2CUDAKernel<3><<<gridDim, blockDim, 0, stream>>>(
+        image.ToCUDA(), last_level_output, gradient_magnitude_div_sqrt2->ToCUDA());
+  }
+  CHECK_CUDA_NO_ERROR();
+}
+
+// Block size of MeshDepthmapCUDAKernel().
+constexpr int kMeshingBlockWidth = 32;
+constexpr int kMeshingBlockHeight = 32;
 
+// Loads the depths of a (kMeshingBlockWidth + 2) x (kMeshingBlockHeight + 2)
+// pixel tile starting at (tile_min_x, tile_min_y) like
+// MeshDepthmapCUDAKernel(), while applying the occlusion safety filter (see
+// OcclusionSafetyFilter). The minimum depth in the window around each pixel is
+// computed separably in shared memory, first along the rows of the tile
+// extended by the filter radius and then along its columns. Tile entries
+// outside of the image get the filtered depth of the pixel they are clamped
+// to, as for the unfiltered tile. Must be called by all threads of the block.
+__device__ void LoadOcclusionFilteredDepthTile(
+    const CUDABuffer_<float>& depthmap,
+    int tile_min_x,
+    int tile_min_y,
+    int radius,
+    float threshold,
+    float depth_tile[kMeshingBlockHeight + 2][kMeshingBlockWidth + 2]) {
+  // Depth used for invalid pixels, which must not delete their neighbors.
+  constexpr float kNoDepth = 1e30f;
+  constexpr int kTileWidth = kMeshingBlockWidth + 2;
+  constexpr int kTileHeight = kMeshingBlockHeight + 2;
+  constexpr int kMaxInputWidth = kTileWidth + 2 * kMaxOcclusionSafetyRadius;
+  constexpr int kMaxInputHeight = kTileHeight + 2 * kMaxOcclusionSafetyRadius;
+  __shared__ float input_tile[kMaxInputHeight][kMaxInputWidth];
+  __shared__ float row_min_tile[kMaxInputHeight][kTileWidth];
+  
+  const int width = depthmap.width();
+  const int height = depthmap.height();
+  const int input_width = kTileWidth + 2 * radius;
+  const int input_height = kTileHeight + 2 * radius;
+  const int thread_index = threadIdx.x + threadIdx.y * blockDim.x;
+  const int thread_count = blockDim.x * blockDim.y;
+  
+  for (int i = thread_index; i < input_width * input_height; i += thread_count) {
+    const int input_x = i % input_width;
+    const int input_y = i / input_width;
+    const int px = ::min(width - 1, ::max(0, tile_min_x - radius + input_x));
+    const int py = ::min(height - 1, ::max(0, tile_min_y - radius + input_y));
+    input_tile[input_y][input_x] = depthmap(py, px);
+  }
+  __syncthreads();
+  
+  for (int i = thread_index; i < kTileWidth * input_height; i += thread_count) {
+    const int tile_x = i % kTileWidth;
+    const int input_y = i / kTileWidth;
+    float min_depth = kNoDepth;
+    for (int dx = 0; dx <= 2 * radius; ++ dx) {
+      const float depth = input_tile[input_y][tile_x + dx];
+      min_depth = ::min(min_depth, (depth > 0.f) ? depth : kNoDepth);
+    }
+    row_min_tile[input_y][tile_x] = min_depth;
+  }
+  __syncthreads();
+  
+  for (int i = thread_index; i < kTileWidth * kTileHeight; i += thread_count) {
+    const int tile_x = i % kTileWidth;
+    const int tile_y = i / kTileWidth;
+    const int source_x = ::min(width - 1, ::max(0, tile_min_x + tile_x)) - tile_min_x;
+    const int source_y = ::min(height - 1, ::max(0, tile_min_y + tile_y)) - tile_min_y;
+    float min_depth = kNoDepth;
+    for (int dy = 0; dy <= 2 * radius; ++ dy) {
+      min_depth = ::min(min_depth, row_min_tile[source_y + dy][source_x]);
+    }
+    const float depth = input_tile[source_y + radius][source_x + radius];
+    depth_tile[tile_y][tile_x] = (min_depth < depth - threshold) ? 0.f : depth;
+  }
+}
+
+// If compact_indices is true, writes a flag for each quad to quad_flags
+// instead of writing the triangle strip indices to index_buffer. If
+// filter_occlusions is true, the occlusion safety filter with the given
+// radius and threshold is applied to the depths before meshing them.
+template<bool compact_indices, bool filter_occlusions>
 __global__ void MeshDepthmapCUDAKernel(
     const float fx_inv,
     const float fy_inv,
     const float cx_inv,
     const float cy_inv,
+    int occlusion_radius,
+    float occlusion_threshold,
     CUDABuffer_<float> depthmap,
     float* vertex_buffer,
     uint8_t* color_buffer,
-    uint32_t* index_buffer) {
+    uint32_t* index_buffer,
+    const uint8_t* update_tiles,
+    uint8_t* quad_flags) {
+  // Blocks of tiles which are not updated keep their previous output.
+  if (update_tiles && !update_tiles[blockIdx.x + blockIdx.y * gridDim.x]) {
+    return;
+  }
+  
   constexpr float kJumpThreshold = 0.070f; // In m.  TODO(puzzlepaint): 1) Make tunable. 2) This should depend on the depth instead of being constant.
+  constexpr int kTileWidth = kMeshingBlockWidth + 2;
+  constexpr int kTileHeight = kMeshingBlockHeight + 2;
   
   const int x = blockIdx.x * blockDim.x + threadIdx.x;
   const int y = blockIdx.y * blockDim.y + threadIdx.y;
 
   const int width = depthmap.width();
   const int height = depthmap.height();
+  
+  // Load the depths of the block and of a one pixel border around it into
+  // shared memory, such that each depth is read from global memory only once
+  // instead of five times. Clamping the coordinates to the image makes the
+  // neighbors outside of the image equal to the pixel itself.
+  __shared__ float depth_tile[kTileHeight][kTileWidth];
+  const int tile_min_x = blockIdx.x * blockDim.x - 1;
+  const int tile_min_y = blockIdx.y * blockDim.y - 1;
+  if (filter_occlusions) {
+    LoadOcclusionFilteredDepthTile(
+        depthmap, tile_min_x, tile_min_y, occlusion_radius,
+        occlusion_threshold, depth_tile);
+  } else {
+    for (int i = threadIdx.x + threadIdx.y * blockDim.x;
+         i < kTileWidth * kTileHeight;
+         i += blockDim.x * blockDim.y) {
+      const int tile_x = i % kTileWidth;
+      const int tile_y = i / kTileWidth;
+      const int px = ::min(width - 1, ::max(0, tile_min_x + tile_x));
+      const int py = ::min(height - 1, ::max(0, tile_min_y + tile_y));
+      depth_tile[tile_y][tile_x] = depthmap(py, px);
+    }
+  }
+  __syncthreads();
 
   if (x < width && y < height) {
     // Get depths and normalized image coordinates.
+    const int tx = threadIdx.x + 1;
+    const int ty = threadIdx.y + 1;
     const float2 nxy = make_float2(fx_inv * x + cx_inv, fy_inv * y + cy_inv);
-    const float depth = depthmap(y, x);
-    // TODO: This might benefit from shared memory or texture use.
-    const float depth_top = (y > 0) ? depthmap(y - 1, x) : depth;
-    const float depth_left = (x > 0) ? depthmap(y, x - 1) : depth;
-    const float depth_bottom = (y < height - 1) ? depthmap(y + 1, x) : depth;
-    const float depth_right = (x < width - 1) ? depthmap(y, x + 1) : depth;
+    const float depth = depth_tile[ty][tx];
+    const float depth_top = depth_tile[ty - 1][tx];
+    const float depth_left = depth_tile[ty][tx - 1];
+    const float depth_bottom = depth_tile[ty + 1][tx];
+    const float depth_right = depth_tile[ty][tx + 1];
     
     // Write vertex position.
     const int vertex_index = 3 * (x + y * width);
@@ -164,7 +513,7 @@ __global__ void MeshDepthmapCUDAKernel(
     const int index10 = index11 - 1;
     const int index01 = index11 - width;
     if (x > 0 && y > 0) {
-      const float depth_top_left = depthmap(y - 1, x - 1);
+      const float depth_top_left = depth_tile[ty - 1][tx - 1];
       float depth_difference =
           max(max(fabs(depth_top_left - depth_left),
                   fabs(depth_top_left - depth_top)),
@@ -174,6 +523,10 @@ __global__ void MeshDepthmapCUDAKernel(
           depth_difference < kJumpThreshold &&
           depth_top_left > 0.f && depth_left > 0.f &&
           depth_top > 0.f && depth > 0.f;
+      if (compact_indices) {
+        quad_flags[(x - 1) + (y - 1) * (width - 1)] = create_quad ? 1 : 0;
+        return;
+      }
       const int i = 2 + 4 * ((x - 1) + (y - 1) * width);
       if (create_quad) {
         // The last two vertices are actually unnecessary, but we need to write
@@ -188,7 +541,7 @@ __global__ void MeshDepthmapCUDAKernel(
         index_buffer[i + 2] = index01;
         index_buffer[i + 3] = index11;
       }
-    } else if (x == 0) {
+    } else if (x == 0 && !compact_indices) {
       // TODO(puzzlepaint): This could be written in an extra kernel for
       // perhaps slightly better performance.
       if (y == 0) {
@@ -207,55 +560,682 @@ __global__ void MeshDepthmapCUDAKernel(
   }
 }
 
-void MeshDepthmapCUDA(
-    const CUDABuffer_<float>& depthmap,
+// Writes the two triangles of each selected quad, with the same orientation as
+// in the triangle strip output by MeshDepthmapCUDAKernel<false>().
+__global__ void WriteCompactedMeshIndicesCUDAKernel(
+    int width,
+    const int* selected_quads,
+    const int* selected_quad_count,
+    uint32_t* index_buffer,
+    int* index_count) {
+  const int i = blockIdx.x * blockDim.x + threadIdx.x;
+  
+  if (i == 0) {
+    *index_count = 6 * *selected_quad_count;
+  }
+  
+  if (i < *selected_quad_count) {
+    const int quad = selected_quads[i];
+    const int quad_x = quad % (width - 1);
+    const int quad_y = quad / (width - 1);
+    const uint32_t index00 = quad_x + quad_y * width;
+    const uint32_t index01 = index00 + 1;
+    const uint32_t index10 = index00 + width;
+    const uint32_t index11 = index10 + 1;
+    
+    uint32_t* out = index_buffer + 6 * i;
+    out[0] = index00;
+    out[1] = index10;
+    out[2] = index01;
+    out[3] = index01;
+    out[4] = index10;
+    out[5] = index11;
+  }
+}
+
+// Size of the quadtree handled by each thread block of
+// DecimateMeshCUDAKernel() (in quads), which is also the largest cell size.
+// The cells of level l have a size of (2 << l) quads.
+constexpr int kDecimationTileSize = 32;
+constexpr int kDecimationLevelCount = 5;
+constexpr int kDecimationCellCount = 16 * 16 + 8 * 8 + 4 * 4 + 2 * 2 + 1;
+
+// Returns the index of a cell in the per-block cell array, in which the levels
+// are stored consecutively, starting with the finest one.
+__forceinline__ __device__ int DecimationCellIndex(
+    int level, int cell_x, int cell_y) {
+  int offset = 0;
+  for (int l = 0; l < level; ++ l) {
+    const int cells_per_side = kDecimationTileSize >> (l + 1);
+    offset += cells_per_side * cells_per_side;
+  }
+  return offset + cell_x + cell_y * (kDecimationTileSize >> (level + 1));
+}
+
+// Returns the inverse depth of the triangle fan of a cell (with top-left
+// vertex (x0, y0) and the given size) at the vertex (x, y). All coordinates
+// are relative to depth_tile. Within each triangle of the fan, the inverse
+// depth is an affine function of the image coordinates, so it is interpolated
+// linearly from the center vertex to the point on the cell border which lies
+// on the ray through (x, y), and along the border between its two vertices.
+__forceinline__ __device__ float ComputeFanInverseDepth(
+    const float (*depth_tile)[kDecimationTileSize + 1],
+    int x0, int y0, int size, int x, int y) {
+  const int half_size = size / 2;
+  const int center_x = x0 + half_size;
+  const int center_y = y0 + half_size;
+  const float center_inv_depth = 1.f / depth_tile[center_y][center_x];
+  const int dx = x - center_x;
+  const int dy = y - center_y;
+  if (dx == 0 && dy == 0) {
+    return center_inv_depth;
+  }
+  
+  float border_inv_depth;
+  float t;
+  if (::abs(dx) >= ::abs(dy)) {
+    // The ray intersects the left or right border.
+    t = half_size / static_cast<float>(::abs(dx));
+    const int border_x = center_x + ((dx > 0) ? half_size : -half_size);
+    const float border_y = center_y + t * dy;
+    const int border_y_floor = static_cast<int>(floorf(border_y));
+    const int border_y_ceil = ::min(border_y_floor + 1, y0 + size);
+    const float factor = border_y - border_y_floor;
+    border_inv_depth =
+        (1.f - factor) / depth_tile[border_y_floor][border_x] +
+        factor / depth_tile[border_y_ceil][border_x];
+  } else {
+    // The ray intersects the top or bottom border.
+    t = half_size / static_cast<float>(::abs(dy));
+    const int border_y = center_y + ((dy > 0) ? half_size : -half_size);
+    const float border_x = center_x + t * dx;
+    const int border_x_floor = static_cast<int>(floorf(border_x));
+    const int border_x_ceil = ::min(border_x_floor + 1, x0 + size);
+    const float factor = border_x - border_x_floor;
+    border_inv_depth =
+        (1.f - factor) / depth_tile[border_y][border_x_floor] +
+        factor / depth_tile[border_y][border_x_ceil];
+  }
+  return center_inv_depth + (border_inv_depth - center_inv_depth) / t;
+}
+
+// Returns the vertex index of the k-th vertex on the border of a cell, going
+// clockwise (in image coordinates) from the top-left vertex (x0, y0).
+__forceinline__ __device__ uint32_t CellBorderVertexIndex(
+    int x0, int y0, int size, int k, int width) {
+  int x, y;
+  if (k < size) {
+    x = x0 + k;
+    y = y0;
+  } else if (k < 2 * size) {
+    x = x0 + size;
+    y = y0 + (k - size);
+  } else if (k < 3 * size) {
+    x = x0 + size - (k - 2 * size);
+    y = y0 + size;
+  } else {
+    x = x0;
+    y = y0 + size - (k - 3 * size);
+  }
+  return x + y * width;
+}
+
+// Writes the 4 * size triangles of the fan of a cell, with the same
+// orientation as the triangles output by MeshDepthmapCUDAKernel().
+__device__ void WriteCellTriangleFan(
+    int x0, int y0, int size, int width, uint32_t* out) {
+  const uint32_t center = (x0 + size / 2) + (y0 + size / 2) * width;
+  const int border_vertex_count = 4 * size;
+  for (int k = 0; k < border_vertex_count; ++ k) {
+    out[3 * k + 0] = center;
+    out[3 * k + 1] = CellBorderVertexIndex(
+        x0, y0, size, (k + 1) % border_vertex_count, width);
+    out[3 * k + 2] = CellBorderVertexIndex(x0, y0, size, k, width);
+  }
+}
+
+// Each thread block handles a tile of kDecimationTileSize x
+// kDecimationTileSize quads, with one thread per quad. The cells of the
+// quadtree are merged bottom-up. Each thread outputs the two triangles of its
+// quad if it is valid and not part of a merged cell, and the triangle fans of
+// the cells at its position in each level which are merged while their parent
+// is not.
+__global__ void DecimateMeshCUDAKernel(
+    float planarity_threshold,
+    CUDABuffer_<float> depthmap,
+    const uint8_t* quad_flags,
+    uint32_t* index_buffer,
+    int* index_count) {
+  constexpr int kTileVertexCount = kDecimationTileSize + 1;
+  
+  __shared__ float depth_tile[kTileVertexCount][kTileVertexCount];
+  __shared__ uint8_t cell_merged[kDecimationCellCount];
+  __shared__ int block_index_count;
+  __shared__ int block_index_offset;
+  
+  const int width = depthmap.width();
+  const int height = depthmap.height();
+  const int tile_min_x = blockIdx.x * kDecimationTileSize;
+  const int tile_min_y = blockIdx.y * kDecimationTileSize;
+  const int thread_index = threadIdx.x + threadIdx.y * blockDim.x;
+  
+  for (int i = thread_index; i < kTileVertexCount * kTileVertexCount;
+       i += blockDim.x * blockDim.y) {
+    const int tile_x = i % kTileVertexCount;
+    const int tile_y = i / kTileVertexCount;
+    const int px = ::min(width - 1, tile_min_x + tile_x);
+    const int py = ::min(height - 1, tile_min_y + tile_y);
+    depth_tile[tile_y][tile_x] = depthmap(py, px);
+  }
+  if (thread_index < kDecimationCellCount) {
+    cell_merged[thread_index] = 1;
+  }
+  if (thread_index == 0) {
+    block_index_count = 0;
+  }
+  __syncthreads();
+  
+  // A cell can only be merged if all of its quads are valid ...
+  const int tx = threadIdx.x;
+  const int ty = threadIdx.y;
+  const int quad_x = tile_min_x + tx;
+  const int quad_y = tile_min_y + ty;
+  const bool quad_valid =
+      quad_x < width - 1 && quad_y < height - 1 &&
+      quad_flags[quad_x + quad_y * (width - 1)];
+  if (!quad_valid) {
+    for (int l = 0; l < kDecimationLevelCount; ++ l) {
+      cell_merged[DecimationCellIndex(l, tx >> (l + 1), ty >> (l + 1))] = 0;
+    }
+  }
+  
+  // ... and if the depths of its interior vertices are close to its triangle
+  // fan. Each thread checks the top-left vertex of its quad.
+  const float depth = depth_tile[ty][tx];
+  for (int l = 0; l < kDecimationLevelCount; ++ l) {
+    const int size = 2 << l;
+    if (tx % size != 0 && ty % size != 0) {
+      const float fan_inv_depth = ComputeFanInverseDepth(
+          depth_tile, tx & ~(size - 1), ty & ~(size - 1), size, tx, ty);
+      // NOTE: This is also false for NaN values.
+      if (!(fabs(depth * fan_inv_depth - 1.f) <= planarity_threshold)) {
+        cell_merged[DecimationCellIndex(l, tx >> (l + 1), ty >> (l + 1))] = 0;
+      }
+    }
+  }
+  __syncthreads();
+  
+  // Only merge cells whose children are merged such that they form a
+  // quadtree.
+  for (int l = 1; l < kDecimationLevelCount; ++ l) {
+    const int cells_per_side = kDecimationTileSize >> (l + 1);
+    if (tx < cells_per_side && ty < cells_per_side) {
+      const bool children_merged =
+          cell_merged[DecimationCellIndex(l - 1, 2 * tx + 0, 2 * ty + 0)] &&
+          cell_merged[DecimationCellIndex(l - 1, 2 * tx + 1, 2 * ty + 0)] &&
+          cell_merged[DecimationCellIndex(l - 1, 2 * tx + 0, 2 * ty + 1)] &&
+          cell_merged[DecimationCellIndex(l - 1, 2 * tx + 1, 2 * ty + 1)];
+      if (!children_merged) {
+        cell_merged[DecimationCellIndex(l, tx, ty)] = 0;
+      }
+    }
+    __syncthreads();
+  }
+  
+  // Determine the number of indices output by this thread and reserve space
+  // for them, first within the block and then in the index buffer.
+  const bool output_quad =
+      quad_valid && !cell_merged[DecimationCellIndex(0, tx >> 1, ty >> 1)];
+  int output_levels = 0;
+  int thread_index_count = output_quad ? 6 : 0;
+  for (int l = 0; l < kDecimationLevelCount; ++ l) {
+    const int cells_per_side = kDecimationTileSize >> (l + 1);
+    if (tx < cells_per_side && ty < cells_per_side &&
+        cell_merged[DecimationCellIndex(l, tx, ty)] &&
+        (l == kDecimationLevelCount - 1 ||
+         !cell_merged[DecimationCellIndex(l + 1, tx >> 1, ty >> 1)])) {
+      output_levels |= 1 << l;
+      thread_index_count += 3 * 4 * (2 << l);
+    }
+  }
+  int thread_index_offset = 0;
+  if (thread_index_count > 0) {
+    thread_index_offset = atomicAdd(&block_index_count, thread_index_count);
+  }
+  __syncthreads();
+  if (thread_index == 0 && block_index_count > 0) {
+    block_index_offset = atomicAdd(index_count, block_index_count);
+  }
+  __syncthreads();
+  if (thread_index_count == 0) {
+    return;
+  }
+  
+  uint32_t* out = index_buffer + block_index_offset + thread_index_offset;
+  if (output_quad) {
+    const uint32_t index00 = quad_x + quad_y * width;
+    const uint32_t index01 = index00 + 1;
+    const uint32_t index10 = index00 + width;
+    const uint32_t index11 = index10 + 1;
+    out[0] = index00;
+    out[1] = index10;
+    out[2] = index01;
+    out[3] = index01;
+    out[4] = index10;
+    out[5] = index11;
+    out += 6;
+  }
+  for (int l = 0; l < kDecimationLevelCount; ++ l) {
+    if (output_levels & (1 << l)) {
+      const int size = 2 << l;
+      WriteCellTriangleFan(tile_min_x + tx * size, tile_min_y + ty * size,
+                           size, width, out);
+      out += 3 * 4 * size;
+    }
+  }
+}
+
+MeshIndexCompactionBuffers::MeshIndexCompactionBuffers(int width, int height)
+    : max_quad_count((width - 1) * (height - 1)) {
+  quad_flags.reset(new CUDABuffer<uint8_t>(1, max_quad_count));
+  selected_quads.reset(new CUDABuffer<int>(1, max_quad_count));
+  selected_quad_count.reset(new CUDABuffer<int>(1, 1));
+  index_count_gpu.reset(new CUDABuffer<int>(1, 1));
+  
+  // Determine the temporary storage size required by the CUB algorithm (no
+  // work is done if passing a null pointer).
+  cub_temp_storage_bytes = 0;
+  CUDA_CHECKED_CALL(cub::DeviceSelect::Flagged(
+      nullptr, cub_temp_storage_bytes, cub::CountingInputIterator<int>(0),
+      quad_flags->ToCUDA().address(), selected_quads->ToCUDA().address(),
+      selected_quad_count->ToCUDA().address(), max_quad_count));
+  cub_temp_storage.reset(new CUDABuffer<uint8_t>(1, cub_temp_storage_bytes));
+  
+  CUDA_CHECKED_CALL(cudaHostAlloc(
+      reinterpret_cast<void**>(&index_count_cpu), sizeof(int),
+      cudaHostAllocDefault));
+  *index_count_cpu = 0;
+  cudaEventCreateWithFlags(&index_count_downloaded_event,
+                           cudaEventDisableTiming);
+}
+
+MeshIndexCompactionBuffers::~MeshIndexCompactionBuffers() {
+  cudaEventDestroy(index_count_downloaded_event);
+  cudaFreeHost(index_count_cpu);
+}
+
+int MeshIndexCompactionBuffers::WaitForIndexCount() {
+  CUDA_CHECKED_CALL(cudaEventSynchronize(index_count_downloaded_event));
+  return index_count();
+}
+
+static void DownloadMeshIndexCountAsync(
+    cudaStream_t stream,
+    MeshIndexCompactionBuffers* compaction_buffers) {
+  compaction_buffers->index_count_gpu->DownloadAsync(
+      stream, compaction_buffers->index_count_cpu);
+  cudaEventRecord(compaction_buffers->index_count_downloaded_event, stream);
+}
+
+// Launches MeshDepthmapCUDAKernel() with or without the occlusion safety
+// filter.
+template<bool compact_indices>
+static void LaunchMeshDepthmapCUDAKernel(
     const float fx_inv,
     const float fy_inv,
     const float cx_inv,
     const float cy_inv,
+    const OcclusionSafetyFilter& occlusion_filter,
+    const CUDABuffer_<float>& depthmap,
+    cudaStream_t stream,
+    float* vertex_buffer,
+    uint8_t* color_buffer,
+    uint32_t* index_buffer,
+    const uint8_t* update_tiles,
+    uint8_t* quad_flags) {
+  CHECK_GE(occlusion_filter.radius, 0);
+  CHECK_LE(occlusion_filter.radius, kMaxOcclusionSafetyRadius);
+  const dim3 grid_dim(cuda_util::GetBlockCount(depthmap.width(),
+                                               kMeshingBlockWidth),
+                      cuda_util::GetBlockCount(depthmap.height(),
+                                               kMeshingBlockHeight));
+  const dim3 block_dim(kMeshingBlockWidth, kMeshingBlockHeight);
+  if (occlusion_filter.radius > 0) {
+    MeshDepthmapCUDAKernel<compact_indices, true><<<grid_dim, block_dim, 0, stream>>>(
+        fx_inv, fy_inv, cx_inv, cy_inv,
+        occlusion_filter.radius, occlusion_filter.threshold, depthmap,
+        vertex_buffer, color_buffer, index_buffer, update_tiles, quad_flags);
+  } else {
+    MeshDepthmapCUDAKernel<compact_indices, false><<<grid_dim, block_dim, 0, stream>>>(
+        fx_inv, fy_inv, cx_inv, cy_inv, 0, 0.f, depthmap,
+        vertex_buffer, color_buffer, index_buffer, update_tiles, quad_flags);
+  }
+  CHECK_CUDA_NO_ERROR();
+}
+
+// Maps the vertex, color and index buffers of a mesh for use with CUDA.
+static void MapMeshBuffers(
     cudaStream_t stream,
     cudaGraphicsResource_t vertex_buffer,
     cudaGraphicsResource_t color_buffer,
-    cudaGraphicsResource_t index_buffer) {
-  // Map buffers.
-  float* vertex_buffer_pointer;
+    cudaGraphicsResource_t index_buffer,
+    float** vertex_buffer_pointer,
+    uint8_t** color_buffer_pointer,
+    uint32_t** index_buffer_pointer) {
   size_t vertex_buffer_size;
   CUDA_CHECKED_CALL(cudaGraphicsMapResources(1, &vertex_buffer, stream));
   CUDA_CHECKED_CALL(cudaGraphicsResourceGetMappedPointer(
-      reinterpret_cast<void**>(&vertex_buffer_pointer), &vertex_buffer_size,
+      reinterpret_cast<void**>(vertex_buffer_pointer), &vertex_buffer_size,
       vertex_buffer));
   
-  uint8_t* color_buffer_pointer;
   size_t color_buffer_size;
   CUDA_CHECKED_CALL(cudaGraphicsMapResources(1, &color_buffer, stream));
   CUDA_CHECKED_CALL(cudaGraphicsResourceGetMappedPointer(
-      reinterpret_cast<void**>(&color_buffer_pointer), &color_buffer_size,
+      reinterpret_cast<void**>(color_buffer_pointer), &color_buffer_size,
       color_buffer));
   
-  uint32_t* index_buffer_pointer;
   size_t index_buffer_size;
   CUDA_CHECKED_CALL(cudaGraphicsMapResources(1, &index_buffer, stream));
   CUDA_CHECKED_CALL(cudaGraphicsResourceGetMappedPointer(
-      reinterpret_cast<void**>(&index_buffer_pointer), &index_buffer_size,
+      reinterpret_cast<void**>(index_buffer_pointer), &index_buffer_size,
       index_buffer));
+}
+
+static void UnmapMeshBuffers(
+    cudaStream_t stream,
+    cudaGraphicsResource_t vertex_buffer,
+    cudaGraphicsResource_t color_buffer,
+    cudaGraphicsResource_t index_buffer) {
+  CUDA_CHECKED_CALL(cudaGraphicsUnmapResources(1, &index_buffer, stream));
+  CUDA_CHECKED_CALL(cudaGraphicsUnmapResources(1, &color_buffer, stream));
+  CUDA_CHECKED_CALL(cudaGraphicsUnmapResources(1, &vertex_buffer, stream));
+}
+
+void MeshDepthmapCUDA(
+    const CUDABuffer_<float>& depthmap,
+    const float fx_inv,
+    const float fy_inv,
+    const float cx_inv,
+    const float cy_inv,
+    cudaStream_t stream,
+    cudaGraphicsResource_t vertex_buffer,
+    cudaGraphicsResource_t color_buffer,
+    cudaGraphicsResource_t index_buffer,
+    const CUDABuffer<uint8_t>* update_tiles,
+    MeshIndexCompactionBuffers* compaction_buffers,
+    const OcclusionSafetyFilter& occlusion_filter) {
+  float* vertex_buffer_pointer;
+  uint8_t* color_buffer_pointer;
+  uint32_t* index_buffer_pointer;
+  MapMeshBuffers(stream, vertex_buffer, color_buffer, index_buffer,
+                 &vertex_buffer_pointer, &color_buffer_pointer,
+                 &index_buffer_pointer);
   
   // Run kernel.
-  constexpr int kBlockWidth = 32;
-  constexpr int kBlockHeight = 32;
-  const dim3 grid_dim(cuda_util::GetBlockCount(depthmap.width(),
-                                               kBlockWidth),
-                      cuda_util::GetBlockCount(depthmap.height(),
-                                               kBlockHeight));
-  const dim3 block_dim(kBlockWidth, kBlockHeight);
-  MeshDepthmapCUDAKernel<<<grid_dim, block_dim, 0, stream>>>(
-      fx_inv, fy_inv, cx_inv, cy_inv, depthmap, vertex_buffer_pointer,
-      color_buffer_pointer, index_buffer_pointer);
+  MeshDepthmapCUDA(depthmap, fx_inv, fy_inv, cx_inv, cy_inv, stream,
+                   vertex_buffer_pointer, color_buffer_pointer,
+                   index_buffer_pointer, update_tiles, compaction_buffers,
+                   occlusion_filter);
+  
+  UnmapMeshBuffers(stream, vertex_buffer, color_buffer, index_buffer);
+}
+
+void MeshDepthmapCUDA(
+    const CUDABuffer_<float>& depthmap,
+    const float fx_inv,
+    const float fy_inv,
+    const float cx_inv,
+    const float cy_inv,
+    cudaStream_t stream,
+    float* vertex_buffer,
+    uint8_t* color_buffer,
+    uint32_t* index_buffer,
+    const CUDABuffer<uint8_t>* update_tiles,
+    MeshIndexCompactionBuffers* compaction_buffers,
+    const OcclusionSafetyFilter& occlusion_filter) {
+  const uint8_t* update_tiles_pointer = nullptr;
+  if (update_tiles) {
+    CHECK_EQ(update_tiles->width(),
+             cuda_util::GetBlockCount(depthmap.width(), kMeshingBlockWidth) *
+             cuda_util::GetBlockCount(depthmap.height(), kMeshingBlockHeight));
+    update_tiles_pointer = update_tiles->ToCUDA().address();
+  }
+  if (!compaction_buffers) {
+    LaunchMeshDepthmapCUDAKernel<false>(
+        fx_inv, fy_inv, cx_inv, cy_inv, occlusion_filter, depthmap, stream,
+        vertex_buffer, color_buffer, index_buffer, update_tiles_pointer,
+        nullptr);
+    return;
+  }
+  
+  const int quad_count = (depthmap.width() - 1) * (depthmap.height() - 1);
+  CHECK_LE(quad_count, compaction_buffers->max_quad_count);
+  LaunchMeshDepthmapCUDAKernel<true>(
+      fx_inv, fy_inv, cx_inv, cy_inv, occlusion_filter, depthmap, stream,
+      vertex_buffer, color_buffer, index_buffer, update_tiles_pointer,
+      compaction_buffers->quad_flags->ToCUDA().address());
+  
+  // Select the valid quads and write their triangles.
+  CUDA_CHECKED_CALL(cub::DeviceSelect::Flagged(
+      compaction_buffers->cub_temp_storage->ToCUDA().address(),
+      compaction_buffers->cub_temp_storage_bytes,
+      cub::CountingInputIterator<int>(0),
+      compaction_buffers->quad_flags->ToCUDA().address(),
+      compaction_buffers->selected_quads->ToCUDA().address(),
+      compaction_buffers->selected_quad_count->ToCUDA().address(),
+      quad_count, stream));
+  
+  constexpr int kBlockWidth = 256;
+  WriteCompactedMeshIndicesCUDAKernel<<<cuda_util::GetBlockCount(quad_count, kBlockWidth), kBlockWidth, 0, stream>>>(
+      depthmap.width(),
+      compaction_buffers->selected_quads->ToCUDA().address(),
+      compaction_buffers->selected_quad_count->ToCUDA().address(),
+      index_buffer,
+      compaction_buffers->index_count_gpu->ToCUDA().address());
   CHECK_CUDA_NO_ERROR();
   
-  // Unmap buffers.
-  CUDA_CHECKED_CALL(cudaGraphicsUnmapResources(1, &index_buffer, stream));
-  CUDA_CHECKED_CALL(cudaGraphicsUnmapResources(1, &color_buffer, stream));
-  CUDA_CHECKED_CALL(cudaGraphicsUnmapResources(1, &vertex_buffer, stream));
+  DownloadMeshIndexCountAsync(stream, compaction_buffers);
+}
+
+void MeshDepthmapDecimatedCUDA(
+    const CUDABuffer_<float>& depthmap,
+    const float fx_inv,
+    const float fy_inv,
+    const float cx_inv,
+    const float cy_inv,
+    float planarity_threshold,
+    cudaStream_t stream,
+    cudaGraphicsResource_t vertex_buffer,
+    cudaGraphicsResource_t color_buffer,
+    cudaGraphicsResource_t index_buffer,
+    MeshIndexCompactionBuffers* compaction_buffers,
+    const OcclusionSafetyFilter& occlusion_filter) {
+  float* vertex_buffer_pointer;
+  uint8_t* color_buffer_pointer;
+  uint32_t* index_buffer_pointer;
+  MapMeshBuffers(stream, vertex_buffer, color_buffer, index_buffer,
+                 &vertex_buffer_pointer, &color_buffer_pointer,
+                 &index_buffer_pointer);
+  
+  MeshDepthmapDecimatedCUDA(depthmap, fx_inv, fy_inv, cx_inv, cy_inv,
+                            planarity_threshold, stream,
+                            vertex_buffer_pointer, color_buffer_pointer,
+                            index_buffer_pointer, compaction_buffers,
+                            occlusion_filter);
+  
+  UnmapMeshBuffers(stream, vertex_buffer, color_buffer, index_buffer);
+}
+
+void MeshDepthmapDecimatedCUDA(
+    const CUDABuffer_<float>& depthmap,
+    const float fx_inv,
+    const float fy_inv,
+    const float cx_inv,
+    const float cy_inv,
+    float planarity_threshold,
+    cudaStream_t stream,
+    float* vertex_buffer,
+    uint8_t* color_buffer,
+    uint32_t* index_buffer,
+    MeshIndexCompactionBuffers* compaction_buffers,
+    const OcclusionSafetyFilter& occlusion_filter) {
+  CHECK_NOTNULL(compaction_buffers);
+  const int width = depthmap.width();
+  const int height = depthmap.height();
+  CHECK_LE((width - 1) * (height - 1), compaction_buffers->max_quad_count);
+  
+  // Write the vertices and the quad flags.
+  LaunchMeshDepthmapCUDAKernel<true>(
+      fx_inv, fy_inv, cx_inv, cy_inv, occlusion_filter, depthmap, stream,
+      vertex_buffer, color_buffer, index_buffer, nullptr,
+      compaction_buffers->quad_flags->ToCUDA().address());
+  
+  // Merge planar cells and write the triangles.
+  CUDA_CHECKED_CALL(cudaMemsetAsync(
+      compaction_buffers->index_count_gpu->ToCUDA().address(), 0, sizeof(int),
+      stream));
+  const dim3 decimation_grid_dim(
+      cuda_util::GetBlockCount(width - 1, kDecimationTileSize),
+      cuda_util::GetBlockCount(height - 1, kDecimationTileSize));
+  const dim3 decimation_block_dim(kDecimationTileSize, kDecimationTileSize);
+  DecimateMeshCUDAKernel<<<decimation_grid_dim, decimation_block_dim, 0, stream>>>(
+      planarity_threshold, depthmap,
+      compaction_buffers->quad_flags->ToCUDA().address(), index_buffer,
+      compaction_buffers->index_count_gpu->ToCUDA().address());
+  CHECK_CUDA_NO_ERROR();
+  
+  DownloadMeshIndexCountAsync(stream, compaction_buffers);
+}
+
+// The dirty tiles coincide with the thread blocks of MeshDepthmapCUDAKernel()
+// and with the update tiles of InpaintDepthMapWithConvolutionCUDA().
+constexpr int kDirtyTileSize = 32;
+static_assert(kDirtyTileSize == kMeshingBlockWidth &&
+              kDirtyTileSize == kMeshingBlockHeight,
+              "The dirty tiles must match the meshing blocks.");
+
+// Number of tiles around each dirty tile which are re-inpainted, such that the
+// inpainting of a changed hole is not only determined by the previous result
+// around it.
+constexpr int kInpaintingHaloTiles = 1;
+// The inpainting blocks are smaller than a tile and may extend from a
+// re-inpainted tile into its neighbor, and the mesh of a tile depends on the
+// depths in the neighboring tiles. Thus the mesh may change up to two tiles
+// further.
+constexpr int kMeshingHaloTiles = kInpaintingHaloTiles + 2;
+
+// Uses one thread block per tile.
+__global__ void DetectDirtyTilesCUDAKernel(
+    float depth_scaling_factor,
+    cudaTextureObject_t depth_map,
+    CUDABuffer_<uint8_t> y_image,
+    float depth_change_threshold,
+    int intensity_change_threshold,
+    bool all_dirty,
+    CUDABuffer_<float> reference_depth,
+    CUDABuffer_<uint8_t> reference_y,
+    CUDABuffer_<uint8_t> dirty_tiles) {
+  const int x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+  const bool in_image = x < y_image.width() && y < y_image.height();
+  
+  float depth = 0;
+  uint8_t intensity = 0;
+  bool changed = all_dirty;
+  if (in_image) {
+    depth = depth_scaling_factor * tex2D<float>(depth_map, x, y);
+    intensity = y_image(y, x);
+    const float old_depth = reference_depth(y, x);
+    changed |=
+        (depth > 0) != (old_depth > 0) ||
+        fabs(depth - old_depth) > depth_change_threshold * old_depth ||
+        ::abs(static_cast<int>(intensity) - static_cast<int>(reference_y(y, x))) >
+            intensity_change_threshold;
+  }
+  
+  const bool tile_dirty = __syncthreads_or(changed);
+  if (tile_dirty && in_image) {
+    reference_depth(y, x) = depth;
+    reference_y(y, x) = intensity;
+  }
+  if (threadIdx.x == 0 && threadIdx.y == 0) {
+    dirty_tiles(0, blockIdx.x + blockIdx.y * gridDim.x) = tile_dirty ? 1 : 0;
+  }
+}
+
+// Uses one thread per tile.
+__global__ void DilateDirtyTilesCUDAKernel(
+    int tiles_x,
+    int tiles_y,
+    CUDABuffer_<uint8_t> dirty_tiles,
+    CUDABuffer_<uint8_t> inpainting_tiles,
+    CUDABuffer_<uint8_t> meshing_tiles) {
+  const int tile_x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int tile_y = blockIdx.y * blockDim.y + threadIdx.y;
+  if (tile_x >= tiles_x || tile_y >= tiles_y) {
+    return;
+  }
+  
+  // Find the Chebyshev distance to the closest dirty tile.
+  int distance = kMeshingHaloTiles + 1;
+  for (int y = ::max(0, tile_y - kMeshingHaloTiles);
+       y <= ::min(tiles_y - 1, tile_y + kMeshingHaloTiles); ++ y) {
+    for (int x = ::max(0, tile_x - kMeshingHaloTiles);
+         x <= ::min(tiles_x - 1, tile_x + kMeshingHaloTiles); ++ x) {
+      if (dirty_tiles(0, x + y * tiles_x)) {
+        distance = ::min(distance, ::max(::abs(x - tile_x), ::abs(y - tile_y)));
+      }
+    }
+  }
+  
+  const int tile = tile_x + tile_y * tiles_x;
+  inpainting_tiles(0, tile) = (distance <= kInpaintingHaloTiles) ? 1 : 0;
+  meshing_tiles(0, tile) = (distance <= kMeshingHaloTiles) ? 1 : 0;
+}
+
+DirtyTileBuffers::DirtyTileBuffers(int width, int height)
+    : tiles_x(cuda_util::GetBlockCount(width, kDirtyTileSize)),
+      tiles_y(cuda_util::GetBlockCount(height, kDirtyTileSize)),
+      have_reference(false) {
+  reference_depth.reset(new CUDABuffer<float>(height, width));
+  reference_y.reset(new CUDABuffer<uint8_t>(height, width));
+  dirty_tiles.reset(new CUDABuffer<uint8_t>(1, tiles_x * tiles_y));
+  inpainting_tiles.reset(new CUDABuffer<uint8_t>(1, tiles_x * tiles_y));
+  meshing_tiles.reset(new CUDABuffer<uint8_t>(1, tiles_x * tiles_y));
+}
+
+void UpdateDirtyTilesCUDA(
+    cudaStream_t stream,
+    float depth_scaling_factor,
+    cudaTextureObject_t depth_map,
+    const CUDABuffer<uint8_t>& y_image,
+    float depth_change_threshold,
+    int intensity_change_threshold,
+    DirtyTileBuffers* buffers) {
+  CHECK_EQ(y_image.width(), buffers->reference_y->width());
+  CHECK_EQ(y_image.height(), buffers->reference_y->height());
+  
+  const dim3 grid_dim(buffers->tiles_x, buffers->tiles_y);
+  const dim3 block_dim(kDirtyTileSize, kDirtyTileSize);
+  DetectDirtyTilesCUDAKernel<<<grid_dim, block_dim, 0, stream>>>(
+      depth_scaling_factor, depth_map, y_image.ToCUDA(),
+      depth_change_threshold, intensity_change_threshold,
+      !buffers->have_reference,
+      buffers->reference_depth->ToCUDA(), buffers->reference_y->ToCUDA(),
+      buffers->dirty_tiles->ToCUDA());
+  CHECK_CUDA_NO_ERROR();
+  buffers->have_reference = true;
+  
+  constexpr int kBlockWidth = 16;
+  constexpr int kBlockHeight = 16;
+  const dim3 dilation_grid_dim(
+      cuda_util::GetBlockCount(buffers->tiles_x, kBlockWidth),
+      cuda_util::GetBlockCount(buffers->tiles_y, kBlockHeight));
+  const dim3 dilation_block_dim(kBlockWidth, kBlockHeight);
+  DilateDirtyTilesCUDAKernel<<<dilation_grid_dim, dilation_block_dim, 0, stream>>>(
+      buffers->tiles_x, buffers->tiles_y, buffers->dirty_tiles->ToCUDA(),
+      buffers->inpainting_tiles->ToCUDA(), buffers->meshing_tiles->ToCUDA());
+  CHECK_CUDA_NO_ERROR();
 }
 
 __global__ void MeshDepthmapMMCUDAKernel(
@@ -398,17 +1378,135 @@ void MeshDepthmapMMCUDA(
   CUDA_CHECKED_CALL(cudaGraphicsUnmapResources(1, &vertex_buffer, stream));
 }
 
+// Projects the point with normalized image coordinates (nx, ny) into the image
+// with the given intrinsics and distortion, and returns its pixel coordinates
+// in (*px, *py). Returns false if the point is not covered by the distortion
+// LUT, i.e., it projects outside of the image.
+__forceinline__ __device__ bool ProjectNormalizedPoint(
+    float nx,
+    float ny,
+    float fx,
+    float fy,
+    float cx,
+    float cy,
+    const DistortionLUT_& distortion,
+    float* px,
+    float* py) {
+  if (distortion.texture == 0) {
+    *px = fx * nx + cx;
+    *py = fy * ny + cy;
+    return true;
+  }
+  
+  const float lut_x = distortion.scale_x * nx + distortion.offset_x;
+  const float lut_y = distortion.scale_y * ny + distortion.offset_y;
+  if (!(lut_x >= 0.5f && lut_y >= 0.5f &&
+        lut_x <= distortion.width - 0.5f &&
+        lut_y <= distortion.height - 0.5f)) {
+    return false;
+  }
+  const float2 pixel = tex2D<float2>(distortion.texture, lut_x, lut_y);
+  *px = pixel.x;
+  *py = pixel.y;
+  return true;
+}
+
+// Returns the color of the image at the projection of the pixel (x, y) with
+// depth depth_z, or (0, 0, 0, 0) if there is none. If sample_rgb is true,
+// samples the interleaved RGB image rgb_image (at the nearest pixel) instead of
+// the textures y_texture and uv_texture (with bilinear interpolation).
+template<bool sample_rgb>
+__forceinline__ __device__ uchar4 ProjectImageOntoDepthPixel(
+    int x,
+    int y,
+    float depth_z,
+    cudaTextureObject_t y_texture,
+    cudaTextureObject_t uv_texture,
+    const CUDABuffer_<uint8_t>& rgb_image,
+    int image_width,
+    int image_height,
+    float yuv_fx,
+    float yuv_fy,
+    float yuv_cx,
+    float yuv_cy,
+    const DistortionLUT_& yuv_distortion,
+    float depth_fx_inv,
+    float depth_fy_inv,
+    float depth_cx_center_inv,
+    float depth_cy_center_inv,
+    const CUDAMatrix3x4& depth_frame_to_yuv_frame) {
+  // Unproject pixel into depth space.
+  const float depth_x = depth_z * (depth_fx_inv * x + depth_cx_center_inv);
+  const float depth_y = depth_z * (depth_fy_inv * y + depth_cy_center_inv);
+  
+  // Transform into yuv camera space.
+  const CUDAMatrix3x4& T = depth_frame_to_yuv_frame;
+  const float yuv_x = T.row0.x * depth_x + T.row0.y * depth_y +
+                      T.row0.z * depth_z + T.row0.w;
+  const float yuv_y = T.row1.x * depth_x + T.row1.y * depth_y +
+                      T.row1.z * depth_z + T.row1.w;
+  const float yuv_z = T.row2.x * depth_x + T.row2.y * depth_y +
+                      T.row2.z * depth_z + T.row2.w;
+  
+  // Project onto yuv image.
+  // Note: ignoring the case of points behind the camera.
+  float px;
+  float py;
+  if (!ProjectNormalizedPoint(yuv_x / yuv_z, yuv_y / yuv_z, yuv_fx, yuv_fy,
+                              yuv_cx, yuv_cy, yuv_distortion, &px, &py)) {
+    return make_uchar4(0, 0, 0, 0);
+  }
+  
+  // Look up color at projected position.
+  // NOTE: Special case for Tango tablet images. Since these images contain
+  //       some metadata in the first few rows, we must skip these rows here
+  //       or the inpainting-extrapolation will be terrible.
+  const int kTopRowSkip = 0; //4;
+  const int kBottomRowSkip = 0; //2;
+  if (depth_z > 0.f && px >= 0 && py >= kTopRowSkip && px < image_width && py < image_height - kBottomRowSkip) {
+    if (sample_rgb) {
+      const int ipx = px;
+      const int ipy = py;
+      return make_uchar4(
+          rgb_image(ipy, 3 * ipx + 0),
+          rgb_image(ipy, 3 * ipx + 1),
+          rgb_image(ipy, 3 * ipx + 2), 255);
+    } else {
+      // The textures use non-normalized coordinates with pixel centers at
+      // (x + 0.5, y + 0.5), like the pixel coordinates.
+      const float color_y = 255.f * tex2D<float>(y_texture, px, py);
+      const float2 color_vu =
+          255.f * tex2D<float2>(uv_texture, 0.5f * px, 0.5f * py);
+      const float color_u = color_vu.y;
+      const float color_v = color_vu.x;
+      
+      // Convert YUV color to RGB.
+      const int color_r = color_y + 1.4075f * (color_v - 128);
+      const int color_g = color_y - 0.3455f * (color_u - 128) - (0.7169f * (color_v - 128));
+      const int color_b = color_y + 1.7790f * (color_u - 128);
+      
+      return make_uchar4(
+          max(min(color_r, 255), 0),
+          max(min(color_g, 255), 0),
+          max(min(color_b, 255), 0), 255);
+    }
+  }
+  return make_uchar4(0, 0, 0, 0);
+}
+
+template<bool sample_rgb>
 __global__ void ProjectImageOntoDepthMapCUDAKernel(
     cudaTextureObject_t depth_texture,
-    CUDABuffer_<uint8_t> y_image,
-    CUDABuffer_<uint16_t> uv_image,
+    cudaTextureObject_t y_texture,
+    cudaTextureObject_t uv_texture,
+    CUDABuffer_<uint8_t> rgb_image,
+    int image_width,
+    int image_height,
     float yuv_fx,
     float yuv_fy,
     float yuv_cx,
     float yuv_cy,
-    float yuv_k1,
-    float yuv_k2,
-    float yuv_k3,
+    DistortionLUT_ yuv_distortion,
     float depth_fx_inv,
     float depth_fy_inv,
     float depth_cx_center_inv,
@@ -420,73 +1518,122 @@ __global__ void ProjectImageOntoDepthMapCUDAKernel(
   const int width = output.width();
   const int height = output.height();
   if (x < width && y < height) {
-    // Unproject pixel into depth space.
     const float depth_z = tex2D<float>(depth_texture, x, y);
-    const float depth_x = depth_z * (depth_fx_inv * x + depth_cx_center_inv);
-    const float depth_y = depth_z * (depth_fy_inv * y + depth_cy_center_inv);
-    
-    // Transform into yuv camera space.
-    const CUDAMatrix3x4& T = depth_frame_to_yuv_frame;
-    const float yuv_x = T.row0.x * depth_x + T.row0.y * depth_y +
-                        T.row0.z * depth_z + T.row0.w;
-    const float yuv_y = T.row1.x * depth_x + T.row1.y * depth_y +
-                        T.row1.z * depth_z + T.row1.w;
-    const float yuv_z = T.row2.x * depth_x + T.row2.y * depth_y +
-                        T.row2.z * depth_z + T.row2.w;
-    
-    // Project onto yuv image.
-    // Note: ignoring the case of points behind the camera.
-    const float yuv_d_nx = yuv_x / yuv_z;
-    const float yuv_d_ny = yuv_y / yuv_z;
-    const float r2 = yuv_d_nx * yuv_d_nx + yuv_d_ny * yuv_d_ny;
-    const float factor = 1.0f + r2 * (yuv_k1 + r2 * (yuv_k2 + r2 * yuv_k3));
-    const float yuv_nx = factor * yuv_d_nx;
-    const float yuv_ny = factor * yuv_d_ny;
-    
-    // Look up color at projected position.
-    // Note: not applying interpolation.
-    const int px = yuv_fx * yuv_nx + yuv_cx;
-    const int py = yuv_fy * yuv_ny + yuv_cy;
-    uchar4 color_output;
-    // NOTE: Special case for Tango tablet images. Since these images contain
-    //       some metadata in the first few rows, we must skip these rows here
-    //       or the inpainting-extrapolation will be terrible.
-    const int kTopRowSkip = 0; //4;
-    const int kBottomRowSkip = 0; //2;
-    if (depth_z > 0.f && px >= 0 && py >= kTopRowSkip && px < y_image.width() && py < y_image.height() - kBottomRowSkip) {
-      const uint8_t color_y = y_image(py, px);
-      const uint16_t color_uv = uv_image(py / 2, px / 2);
-      const uint8_t color_u = color_uv >> 8;
-      const uint8_t color_v = color_uv & 0x00FF;
-      
-      // Convert YUV color to RGB.
-      const int color_r = color_y + 1.4075f * (color_v - 128);
-      const int color_g = color_y - 0.3455f * (color_u - 128) - (0.7169f * (color_v - 128));
-      const int color_b = color_y + 1.7790f * (color_u - 128);
+    output(y, x) = ProjectImageOntoDepthPixel<sample_rgb>(
+        x, y, depth_z, y_texture, uv_texture, rgb_image, image_width,
+        image_height, yuv_fx, yuv_fy, yuv_cx, yuv_cy, yuv_distortion,
+        depth_fx_inv, depth_fy_inv, depth_cx_center_inv, depth_cy_center_inv,
+        depth_frame_to_yuv_frame);
+  }
+}
 
-      color_output = make_uchar4(
-          max(min(color_r, 255), 0),
-          max(min(color_g, 255), 0),
-          max(min(color_b, 255), 0), 255);
+// Fuses copying the rendered depth map, filling its pixels without depth
+// from the TSDF rendering (if fill_from_tsdf is true) and projecting the
+// image onto it. If depth_hole_cells is given, also counts the depth and color
+// holes into level 0 of a HoleMap. Must be launched with 32x32 blocks.
+template<bool sample_rgb, bool fill_from_tsdf>
+__global__ void PrepareTargetFrameCUDAKernel(
+    cudaTextureObject_t rendered_depth_texture,
+    cudaTextureObject_t tsdf_depth_texture,
+    cudaTextureObject_t tsdf_color_texture,
+    cudaTextureObject_t y_texture,
+    cudaTextureObject_t uv_texture,
+    CUDABuffer_<uint8_t> rgb_image,
+    int image_width,
+    int image_height,
+    float yuv_fx,
+    float yuv_fy,
+    float yuv_cx,
+    float yuv_cy,
+    DistortionLUT_ yuv_distortion,
+    float depth_fx_inv,
+    float depth_fy_inv,
+    float depth_cx_center_inv,
+    float depth_cy_center_inv,
+    CUDAMatrix3x4 depth_frame_to_yuv_frame,
+    CUDABuffer_<float> depth_output,
+    CUDABuffer_<uchar4> color_output,
+    CUDABuffer_<uint16_t> depth_hole_cells,
+    CUDABuffer_<uint16_t> color_hole_cells) {
+  const int x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int y = blockIdx.y * blockDim.y + threadIdx.y;
+  const int width = depth_output.width();
+  const int height = depth_output.height();
+  float depth_z = 1.f;
+  uchar4 color = make_uchar4(0, 0, 0, 1);
+  if (x < width && y < height) {
+    depth_z = tex2D<float>(rendered_depth_texture, x, y);
+    if (fill_from_tsdf && !(depth_z > 0.f)) {
+      // The projection would not yield a color for this pixel, so it is not
+      // attempted.
+      const float tsdf_depth = tex2D<float>(tsdf_depth_texture, x, y);
+      if (tsdf_depth > 0.f) {
+        depth_z = tsdf_depth;
+        color = tex2D<uchar4>(tsdf_color_texture, x, y);
+      } else {
+        color = make_uchar4(0, 0, 0, 0);
+      }
     } else {
-      color_output = make_uchar4(0, 0, 0, 0);
+      color = ProjectImageOntoDepthPixel<sample_rgb>(
+          x, y, depth_z, y_texture, uv_texture, rgb_image, image_width,
+          image_height, yuv_fx, yuv_fy, yuv_cx, yuv_cy, yuv_distortion,
+          depth_fx_inv, depth_fy_inv, depth_cx_center_inv,
+          depth_cy_center_inv, depth_frame_to_yuv_frame);
     }
-    output(y, x) = color_output;
+    depth_output(y, x) = depth_z;
+    color_output(y, x) = color;
   }
+  
+  // The initial values outside of the image do not count as holes.
+  if (depth_hole_cells.address() != nullptr) {
+    CountHoleMapCells(depth_z == 0, color.w == 0, depth_hole_cells,
+                      color_hole_cells);
+  }
+}
+
+void CreateYUVImageTexturesCUDA(
+    const CUDABuffer<uint8_t>& y_image,
+    const CUDABuffer<uint16_t>& uv_image,
+    cudaTextureObject_t* y_texture,
+    cudaTextureObject_t* uv_texture) {
+  y_image.CreateTextureObject(
+      cudaAddressModeClamp, cudaAddressModeClamp, cudaFilterModeLinear,
+      cudaReadModeNormalizedFloat, false, y_texture);
+  
+  // The (u << 8) | v values are stored little-endian, so reading them as two
+  // 8-bit channels yields (v, u), which can be filtered separately.
+  cudaResourceDesc resource_desc;
+  memset(&resource_desc, 0, sizeof(resource_desc));
+  resource_desc.resType = cudaResourceTypePitch2D;
+  resource_desc.res.pitch2D.devPtr = uv_image.ToCUDA().address();
+  resource_desc.res.pitch2D.pitchInBytes = uv_image.ToCUDA().pitch();
+  resource_desc.res.pitch2D.width = uv_image.width();
+  resource_desc.res.pitch2D.height = uv_image.height();
+  resource_desc.res.pitch2D.desc = cudaCreateChannelDesc<uchar2>();
+  
+  cudaTextureDesc texture_desc;
+  memset(&texture_desc, 0, sizeof(texture_desc));
+  texture_desc.addressMode[0] = cudaAddressModeClamp;
+  texture_desc.addressMode[1] = cudaAddressModeClamp;
+  texture_desc.filterMode = cudaFilterModeLinear;
+  texture_desc.readMode = cudaReadModeNormalizedFloat;
+  texture_desc.normalizedCoords = 0;
+  CUDA_CHECKED_CALL(cudaCreateTextureObject(
+      uv_texture, &resource_desc, &texture_desc, nullptr));
 }
 
 void ProjectImageOntoDepthMapCUDA(
     cudaStream_t stream,
     cudaTextureObject_t depth_texture,
-    const CUDABuffer<uint8_t>& y_image,
-    const CUDABuffer<uint16_t>& uv_image,
+    cudaTextureObject_t y_texture,
+    cudaTextureObject_t uv_texture,
+    int image_width,
+    int image_height,
     float yuv_fx,
     float yuv_fy,
     float yuv_cx,
     float yuv_cy,
-    float yuv_k1,
-    float yuv_k2,
-    float yuv_k3,
+    const DistortionLUT_& yuv_distortion,
     float depth_fx_inv,
     float depth_fy_inv,
     float depth_cx_center_inv,
@@ -500,169 +1647,379 @@ void ProjectImageOntoDepthMapCUDA(
                       cuda_util::GetBlockCount(output->height(),
                                                kBlockHeight));
   const dim3 block_dim(kBlockWidth, kBlockHeight);
-  ProjectImageOntoDepthMapCUDAKernel<<<grid_dim, block_dim, 0, stream>>>(
-      depth_texture, y_image.ToCUDA(), uv_image.ToCUDA(), yuv_fx, yuv_fy,
-      yuv_cx, yuv_cy, yuv_k1, yuv_k2, yuv_k3, depth_fx_inv, depth_fy_inv,
+  ProjectImageOntoDepthMapCUDAKernel<false><<<grid_dim, block_dim, 0, stream>>>(
+      depth_texture, y_texture, uv_texture,
+      CUDABuffer_<uint8_t>(), image_width, image_height,
+      yuv_fx, yuv_fy,
+      yuv_cx, yuv_cy, yuv_distortion, depth_fx_inv, depth_fy_inv,
       depth_cx_center_inv, depth_cy_center_inv, depth_frame_to_yuv_frame,
       output->ToCUDA());
   CHECK_CUDA_NO_ERROR();
 }
 
-__global__ void CopyFloatColorImageToRgb8SurfaceCUDAKernel(
-    CUDABuffer_<float> color_image_r,
-    CUDABuffer_<float> color_image_g,
-    CUDABuffer_<float> color_image_b,
-    cudaSurfaceObject_t surface) {
-  const int x = blockIdx.x * blockDim.x + threadIdx.x;
-  const int y = blockIdx.y * blockDim.y + threadIdx.y;
-  const int width = color_image_r.width();
-  const int height = color_image_r.height();
-  if (x < width && y < height) {
-    const float r = color_image_r(y, x);
-    const float g = color_image_g(y, x);
-    const float b = color_image_b(y, x);
-    uchar4 data = make_uchar4(255.99f * r,
-                              255.99f * g,
-                              255.99f * b,
-                              255);
-    surf2Dwrite(data, surface, x * sizeof(uchar4), y, cudaBoundaryModeTrap);
-  }
+void ProjectImageOntoDepthMapCUDA(
+    cudaStream_t stream,
+    cudaTextureObject_t depth_texture,
+    const CUDABuffer<uint8_t>& rgb_image,
+    float yuv_fx,
+    float yuv_fy,
+    float yuv_cx,
+    float yuv_cy,
+    const DistortionLUT_& yuv_distortion,
+    float depth_fx_inv,
+    float depth_fy_inv,
+    float depth_cx_center_inv,
+    float depth_cy_center_inv,
+    const CUDAMatrix3x4& depth_frame_to_yuv_frame,
+    CUDABuffer<uchar4>* output) {
+  constexpr int kBlockWidth = 32;
+  constexpr int kBlockHeight = 32;
+  const dim3 grid_dim(cuda_util::GetBlockCount(output->width(),
+                                               kBlockWidth),
+                      cuda_util::GetBlockCount(output->height(),
+                                               kBlockHeight));
+  const dim3 block_dim(kBlockWidth, kBlockHeight);
+  ProjectImageOntoDepthMapCUDAKernel<true><<<grid_dim, block_dim, 0, stream>>>(
+      depth_texture, 0, 0,
+      rgb_image.ToCUDA(), rgb_image.width() / 3, rgb_image.height(),
+      yuv_fx, yuv_fy,
+      yuv_cx, yuv_cy, yuv_distortion, depth_fx_inv, depth_fy_inv,
+      depth_cx_center_inv, depth_cy_center_inv, depth_frame_to_yuv_frame,
+      output->ToCUDA());
+  CHECK_CUDA_NO_ERROR();
 }
 
-void CopyFloatColorImageToRgb8SurfaceCUDA(
+template<bool sample_rgb>
+void PrepareTargetFrameCUDAImpl(
     cudaStream_t stream,
-    const CUDABuffer<float>& color_image_r,
-    const CUDABuffer<float>& color_image_g,
-    const CUDABuffer<float>& color_image_b,
-    cudaSurfaceObject_t surface) {
+    cudaTextureObject_t rendered_depth_texture,
+    cudaTextureObject_t tsdf_depth_texture,
+    cudaTextureObject_t tsdf_color_texture,
+    cudaTextureObject_t y_texture,
+    cudaTextureObject_t uv_texture,
+    const CUDABuffer_<uint8_t>& rgb_image,
+    int image_width,
+    int image_height,
+    float yuv_fx,
+    float yuv_fy,
+    float yuv_cx,
+    float yuv_cy,
+    const DistortionLUT_& yuv_distortion,
+    float depth_fx_inv,
+    float depth_fy_inv,
+    float depth_cx_center_inv,
+    float depth_cy_center_inv,
+    const CUDAMatrix3x4& depth_frame_to_yuv_frame,
+    CUDABuffer<float>* depth_output,
+    CUDABuffer<uchar4>* color_output,
+    HoleMap* hole_map) {
+  CHECK_EQ(depth_output->width(), color_output->width());
+  CHECK_EQ(depth_output->height(), color_output->height());
+  const CUDABuffer_<uint16_t> depth_hole_cells =
+      hole_map ? hole_map->level0(kDepthHoleMap)->ToCUDA() : CUDABuffer_<uint16_t>();
+  const CUDABuffer_<uint16_t> color_hole_cells =
+      hole_map ? hole_map->level0(kColorHoleMap)->ToCUDA() : CUDABuffer_<uint16_t>();
   constexpr int kBlockWidth = 32;
   constexpr int kBlockHeight = 32;
-  const dim3 grid_dim(cuda_util::GetBlockCount(color_image_r.width(),
+  const dim3 grid_dim(cuda_util::GetBlockCount(depth_output->width(),
                                                kBlockWidth),
-                      cuda_util::GetBlockCount(color_image_r.height(),
+                      cuda_util::GetBlockCount(depth_output->height(),
                                                kBlockHeight));
   const dim3 block_dim(kBlockWidth, kBlockHeight);
-  CopyFloatColorImageToRgb8SurfaceCUDAKernel<<<grid_dim, block_dim, 0, stream>>>(
-      color_image_r.ToCUDA(),
-      color_image_g.ToCUDA(),
-      color_image_b.ToCUDA(),
-      surface);
+  if (tsdf_depth_texture != 0) {
+    PrepareTargetFrameCUDAKernel<sample_rgb, true><<<grid_dim, block_dim, 0, stream>>>(
+        rendered_depth_texture, tsdf_depth_texture, tsdf_color_texture,
+        y_texture, uv_texture, rgb_image, image_width, image_height,
+        yuv_fx, yuv_fy, yuv_cx, yuv_cy, yuv_distortion,
+        depth_fx_inv, depth_fy_inv, depth_cx_center_inv, depth_cy_center_inv,
+        depth_frame_to_yuv_frame, depth_output->ToCUDA(),
+        color_output->ToCUDA(), depth_hole_cells, color_hole_cells);
+  } else {
+    PrepareTargetFrameCUDAKernel<sample_rgb, false><<<grid_dim, block_dim, 0, stream>>>(
+        rendered_depth_texture, 0, 0,
+        y_texture, uv_texture, rgb_image, image_width, image_height,
+        yuv_fx, yuv_fy, yuv_cx, yuv_cy, yuv_distortion,
+        depth_fx_inv, depth_fy_inv, depth_cx_center_inv, depth_cy_center_inv,
+        depth_frame_to_yuv_frame, depth_output->ToCUDA(),
+        color_output->ToCUDA(), depth_hole_cells, color_hole_cells);
+  }
   CHECK_CUDA_NO_ERROR();
+  
+  if (hole_map) {
+    hole_map->BuildPyramid(stream);
+  }
+}
+
+void PrepareTargetFrameCUDA(
+    cudaStream_t stream,
+    cudaTextureObject_t rendered_depth_texture,
+    cudaTextureObject_t tsdf_depth_texture,
+    cudaTextureObject_t tsdf_color_texture,
+    cudaTextureObject_t y_texture,
+    cudaTextureObject_t uv_texture,
+    int image_width,
+    int image_height,
+    float yuv_fx,
+    float yuv_fy,
+    float yuv_cx,
+    float yuv_cy,
+    const DistortionLUT_& yuv_distortion,
+    float depth_fx_inv,
+    float depth_fy_inv,
+    float depth_cx_center_inv,
+    float depth_cy_center_inv,
+    const CUDAMatrix3x4& depth_frame_to_yuv_frame,
+    CUDABuffer<float>* depth_output,
+    CUDABuffer<uchar4>* color_output,
+    HoleMap* hole_map) {
+  PrepareTargetFrameCUDAImpl<false>(
+      stream, rendered_depth_texture, tsdf_depth_texture, tsdf_color_texture,
+      y_texture, uv_texture, CUDABuffer_<uint8_t>(),
+      image_width, image_height,
+      yuv_fx, yuv_fy, yuv_cx, yuv_cy, yuv_distortion,
+      depth_fx_inv, depth_fy_inv, depth_cx_center_inv, depth_cy_center_inv,
+      depth_frame_to_yuv_frame, depth_output, color_output, hole_map);
+}
+
+void PrepareTargetFrameCUDA(
+    cudaStream_t stream,
+    cudaTextureObject_t rendered_depth_texture,
+    cudaTextureObject_t tsdf_depth_texture,
+    cudaTextureObject_t tsdf_color_texture,
+    const CUDABuffer<uint8_t>& rgb_image,
+    float yuv_fx,
+    float yuv_fy,
+    float yuv_cx,
+    float yuv_cy,
+    const DistortionLUT_& yuv_distortion,
+    float depth_fx_inv,
+    float depth_fy_inv,
+    float depth_cx_center_inv,
+    float depth_cy_center_inv,
+    const CUDAMatrix3x4& depth_frame_to_yuv_frame,
+    CUDABuffer<float>* depth_output,
+    CUDABuffer<uchar4>* color_output,
+    HoleMap* hole_map) {
+  PrepareTargetFrameCUDAImpl<true>(
+      stream, rendered_depth_texture, tsdf_depth_texture, tsdf_color_texture,
+      0, 0, rgb_image.ToCUDA(),
+      rgb_image.width() / 3, rgb_image.height(),
+      yuv_fx, yuv_fy, yuv_cx, yuv_cy, yuv_distortion,
+      depth_fx_inv, depth_fy_inv, depth_cx_center_inv, depth_cy_center_inv,
+      depth_frame_to_yuv_frame, depth_output, color_output, hole_map);
 }
 
-__global__ void CopyColorImageToRgb8SurfaceCUDAKernel(
-    CUDABuffer_<uchar4> color_rgbx,
-    cudaSurfaceObject_t surface) {
+__forceinline__ __device__ uchar4 ToDisplayColor(const uchar4& rgbx) {
+  return make_uchar4(rgbx.x, rgbx.y, rgbx.z, 255);
+}
+
+__forceinline__ __device__ uchar4 ToDisplayColor(const float4& rgb) {
+  return make_uchar4(255.99f * rgb.x,
+                     255.99f * rgb.y,
+                     255.99f * rgb.z,
+                     255);
+}
+
+template<typename ColorT>
+__global__ void CopyTargetResultToDisplaySurfacesCUDAKernel(
+    CUDABuffer_<ColorT> color_image,
+    CUDABuffer_<float> depth_map,
+    cudaSurfaceObject_t color_surface,
+    cudaSurfaceObject_t depth_surface) {
   const int x = blockIdx.x * blockDim.x + threadIdx.x;
   const int y = blockIdx.y * blockDim.y + threadIdx.y;
-  const int width = color_rgbx.width();
-  const int height = color_rgbx.height();
+  const int width = color_image.width();
+  const int height = color_image.height();
   if (x < width && y < height) {
-    const uchar4 rgbx = color_rgbx(y, x);
-    uchar4 data = make_uchar4(rgbx.x, rgbx.y, rgbx.z, 255);
-    surf2Dwrite(data, surface, x * sizeof(uchar4), y, cudaBoundaryModeTrap);
+    surf2Dwrite(ToDisplayColor(color_image(y, x)), color_surface,
+                x * sizeof(uchar4), y, cudaBoundaryModeTrap);
+    surf2Dwrite(depth_map(y, x), depth_surface, x * sizeof(float), y,
+                cudaBoundaryModeTrap);
   }
 }
 
-void CopyColorImageToRgb8SurfaceCUDA(
+template<typename ColorT>
+void CopyTargetResultToDisplaySurfacesCUDAImpl(
     cudaStream_t stream,
-    const CUDABuffer<uchar4>& color_rgbx,
-    cudaSurfaceObject_t surface) {
+    const CUDABuffer<ColorT>& color_image,
+    const CUDABuffer<float>& depth_map,
+    cudaSurfaceObject_t color_surface,
+    cudaSurfaceObject_t depth_surface) {
+  CHECK_EQ(color_image.width(), depth_map.width());
+  CHECK_EQ(color_image.height(), depth_map.height());
   constexpr int kBlockWidth = 32;
   constexpr int kBlockHeight = 32;
-  const dim3 grid_dim(cuda_util::GetBlockCount(color_rgbx.width(),
+  const dim3 grid_dim(cuda_util::GetBlockCount(color_image.width(),
                                                kBlockWidth),
-                      cuda_util::GetBlockCount(color_rgbx.height(),
+                      cuda_util::GetBlockCount(color_image.height(),
                                                kBlockHeight));
   const dim3 block_dim(kBlockWidth, kBlockHeight);
-  CopyColorImageToRgb8SurfaceCUDAKernel<<<grid_dim, block_dim, 0, stream>>>(
-      color_rgbx.ToCUDA(),
-      surface);
+  CopyTargetResultToDisplaySurfacesCUDAKernel<<<grid_dim, block_dim, 0, stream>>>(
+      color_image.ToCUDA(),
+      depth_map.ToCUDA(),
+      color_surface,
+      depth_surface);
   CHECK_CUDA_NO_ERROR();
 }
 
-__global__ void CopyValidToInvalidPixelsCUDAKernel(
-    cudaTextureObject_t src_depth_texture,
-    cudaTextureObject_t src_color_texture,
-    CUDABuffer_<float> dest_depth,
-    CUDABuffer_<uchar4> dest_color) {
+void CopyTargetResultToDisplaySurfacesCUDA(
+    cudaStream_t stream,
+    const CUDABuffer<float4>& color_image,
+    const CUDABuffer<float>& depth_map,
+    cudaSurfaceObject_t color_surface,
+    cudaSurfaceObject_t depth_surface) {
+  CopyTargetResultToDisplaySurfacesCUDAImpl(
+      stream, color_image, depth_map, color_surface, depth_surface);
+}
+
+void CopyTargetResultToDisplaySurfacesCUDA(
+    cudaStream_t stream,
+    const CUDABuffer<uchar4>& color_rgbx,
+    const CUDABuffer<float>& depth_map,
+    cudaSurfaceObject_t color_surface,
+    cudaSurfaceObject_t depth_surface) {
+  CopyTargetResultToDisplaySurfacesCUDAImpl(
+      stream, color_rgbx, depth_map, color_surface, depth_surface);
+}
+
+template<typename ColorT>
+__global__ void CopyTargetResultToBuffersCUDAKernel(
+    CUDABuffer_<ColorT> color_image,
+    CUDABuffer_<float> depth_map,
+    CUDABuffer_<uchar4> color_output,
+    CUDABuffer_<float> depth_output) {
   const int x = blockIdx.x * blockDim.x + threadIdx.x;
   const int y = blockIdx.y * blockDim.y + threadIdx.y;
-  const int width = dest_depth.width();
-  const int height = dest_depth.height();
+  const int width = color_image.width();
+  const int height = color_image.height();
   if (x < width && y < height) {
-    const float dest_depth_value = dest_depth(y, x);
-    if (dest_depth_value <= 0.f) {
-      const float src_depth_value = tex2D<float>(src_depth_texture, x, y);
-      if (src_depth_value > 0.f) {
-        dest_depth(y, x) = src_depth_value;
-        dest_color(y, x) = tex2D<uchar4>(src_color_texture, x, y);
-      }
-    }
+    color_output(y, x) = ToDisplayColor(color_image(y, x));
+    depth_output(y, x) = depth_map(y, x);
   }
 }
 
-void CopyValidToInvalidPixelsCUDA(
+template<typename ColorT>
+void CopyTargetResultToBuffersCUDAImpl(
     cudaStream_t stream,
-    cudaTextureObject_t src_depth_texture,
-    cudaTextureObject_t src_color_texture,
-    CUDABuffer<float>* dest_depth,
-    CUDABuffer<uchar4>* dest_color) {
+    const CUDABuffer<ColorT>& color_image,
+    const CUDABuffer<float>& depth_map,
+    CUDABuffer<uchar4>* color_output,
+    CUDABuffer<float>* depth_output) {
+  CHECK_EQ(color_image.width(), depth_map.width());
+  CHECK_EQ(color_image.height(), depth_map.height());
+  CHECK_EQ(color_image.width(), color_output->width());
+  CHECK_EQ(color_image.height(), color_output->height());
+  CHECK_EQ(color_image.width(), depth_output->width());
+  CHECK_EQ(color_image.height(), depth_output->height());
   constexpr int kBlockWidth = 32;
   constexpr int kBlockHeight = 32;
-  const dim3 grid_dim(cuda_util::GetBlockCount(dest_depth->width(),
+  const dim3 grid_dim(cuda_util::GetBlockCount(color_image.width(),
                                                kBlockWidth),
-                      cuda_util::GetBlockCount(dest_depth->height(),
+                      cuda_util::GetBlockCount(color_image.height(),
                                                kBlockHeight));
   const dim3 block_dim(kBlockWidth, kBlockHeight);
-  CopyValidToInvalidPixelsCUDAKernel<<<grid_dim, block_dim, 0, stream>>>(
-      src_depth_texture, src_color_texture, dest_depth->ToCUDA(), dest_color->ToCUDA());
+  CopyTargetResultToBuffersCUDAKernel<<<grid_dim, block_dim, 0, stream>>>(
+      color_image.ToCUDA(),
+      depth_map.ToCUDA(),
+      color_output->ToCUDA(),
+      depth_output->ToCUDA());
   CHECK_CUDA_NO_ERROR();
 }
 
-__global__ void DeleteAlmostOccludedPixelsCUDAKernel(
-    int radius,
-    float occlusion_threshold,
-    CUDABuffer_<float> src_depth_map,
-    CUDABuffer_<float> dest_depth_map) {
-  const int x = blockIdx.x * blockDim.x + threadIdx.x;
-  const int y = blockIdx.y * blockDim.y + threadIdx.y;
-  const int width = dest_depth_map.width();
-  const int height = dest_depth_map.height();
-  if (x < width && y < height) {
-    // Only testing a few selected points here. This should be okay given the
-    // assumption that the depth maps are reasonably smooth (which they should
-    // be).
-    bool almost_occluded = false;
-    float depth_threshold = src_depth_map(y, x) - occlusion_threshold;
-    
-    almost_occluded |= (x > radius && src_depth_map(y, x - radius) < depth_threshold);
-    almost_occluded |= (y > radius && src_depth_map(y - radius, x) < depth_threshold);
-    almost_occluded |= (x < width - radius && src_depth_map(y, x + radius) < depth_threshold);
-    almost_occluded |= (y < height - radius && src_depth_map(y + radius, x) < depth_threshold);
-    
-    dest_depth_map(y, x) = almost_occluded ? 0 : (depth_threshold + occlusion_threshold);
+void CopyTargetResultToBuffersCUDA(
+    cudaStream_t stream,
+    const CUDABuffer<float4>& color_image,
+    const CUDABuffer<float>& depth_map,
+    CUDABuffer<uchar4>* color_output,
+    CUDABuffer<float>* depth_output) {
+  CopyTargetResultToBuffersCUDAImpl(
+      stream, color_image, depth_map, color_output, depth_output);
+}
+
+void CopyTargetResultToBuffersCUDA(
+    cudaStream_t stream,
+    const CUDABuffer<uchar4>& color_rgbx,
+    const CUDABuffer<float>& depth_map,
+    CUDABuffer<uchar4>* color_output,
+    CUDABuffer<float>* depth_output) {
+  CopyTargetResultToBuffersCUDAImpl(
+      stream, color_rgbx, depth_map, color_output, depth_output);
+}
+
+// Each thread converts a 2x2 pixel block, which shares one chroma sample.
+template<typename ColorT>
+__global__ void ConvertTargetResultToNV12CUDAKernel(
+    CUDABuffer_<ColorT> color_image,
+    uint8_t* nv12_image,
+    size_t nv12_pitch,
+    int nv12_luma_rows) {
+  const int block_x = blockIdx.x * blockDim.x + threadIdx.x;
+  const int block_y = blockIdx.y * blockDim.y + threadIdx.y;
+  const int width = color_image.width();
+  const int height = color_image.height();
+  if (2 * block_x < width && 2 * block_y < height) {
+    float u_sum = 0;
+    float v_sum = 0;
+    for (int dy = 0; dy < 2; ++ dy) {
+      const int y = ::min(2 * block_y + dy, height - 1);
+      uint8_t* y_row = nv12_image + (2 * block_y + dy) * nv12_pitch;
+      for (int dx = 0; dx < 2; ++ dx) {
+        const int x = ::min(2 * block_x + dx, width - 1);
+        const uchar4 rgb = ToDisplayColor(color_image(y, x));
+        y_row[2 * block_x + dx] =
+            16.5f + 0.1826f * rgb.x + 0.6142f * rgb.y + 0.0620f * rgb.z;
+        u_sum += -0.1006f * rgb.x - 0.3386f * rgb.y + 0.4392f * rgb.z;
+        v_sum += 0.4392f * rgb.x - 0.3989f * rgb.y - 0.0403f * rgb.z;
+      }
+    }
+    uint8_t* uv_row = nv12_image + (nv12_luma_rows + block_y) * nv12_pitch;
+    uv_row[2 * block_x + 0] = 128.5f + 0.25f * u_sum;
+    uv_row[2 * block_x + 1] = 128.5f + 0.25f * v_sum;
   }
 }
 
-void DeleteAlmostOccludedPixelsCUDA(
+template<typename ColorT>
+void ConvertTargetResultToNV12CUDAImpl(
     cudaStream_t stream,
-    int radius,
-    float occlusion_threshold,
-    const CUDABuffer<float>& src_depth_map,
-    CUDABuffer<float>* dest_depth_map) {
+    const CUDABuffer<ColorT>& color_image,
+    uint8_t* nv12_image,
+    size_t nv12_pitch,
+    int nv12_luma_rows) {
+  const int block_columns = (color_image.width() + 1) / 2;
+  const int block_rows = (color_image.height() + 1) / 2;
   constexpr int kBlockWidth = 32;
-  constexpr int kBlockHeight = 32;
-  const dim3 grid_dim(cuda_util::GetBlockCount(dest_depth_map->width(),
-                                               kBlockWidth),
-                      cuda_util::GetBlockCount(dest_depth_map->height(),
-                                               kBlockHeight));
+  constexpr int kBlockHeight = 8;
+  const dim3 grid_dim(cuda_util::GetBlockCount(block_columns, kBlockWidth),
+                      cuda_util::GetBlockCount(block_rows, kBlockHeight));
   const dim3 block_dim(kBlockWidth, kBlockHeight);
-  DeleteAlmostOccludedPixelsCUDAKernel<<<grid_dim, block_dim, 0, stream>>>(
-      radius, occlusion_threshold, src_depth_map.ToCUDA(), dest_depth_map->ToCUDA());
+  ConvertTargetResultToNV12CUDAKernel<<<grid_dim, block_dim, 0, stream>>>(
+      color_image.ToCUDA(),
+      nv12_image,
+      nv12_pitch,
+      nv12_luma_rows);
   CHECK_CUDA_NO_ERROR();
 }
 
+void ConvertTargetResultToNV12CUDA(
+    cudaStream_t stream,
+    const CUDABuffer<float4>& color_image,
+    uint8_t* nv12_image,
+    size_t nv12_pitch,
+    int nv12_luma_rows) {
+  ConvertTargetResultToNV12CUDAImpl(
+      stream, color_image, nv12_image, nv12_pitch, nv12_luma_rows);
+}
+
+void ConvertTargetResultToNV12CUDA(
+    cudaStream_t stream,
+    const CUDABuffer<uchar4>& color_rgbx,
+    uint8_t* nv12_image,
+    size_t nv12_pitch,
+    int nv12_luma_rows) {
+  ConvertTargetResultToNV12CUDAImpl(
+      stream, color_rgbx, nv12_image, nv12_pitch, nv12_luma_rows);
+}
+
 __forceinline__ __device__ float4 uchar4ToFloat4(const uchar4& input) {
   return make_float4(input.x, input.y, input.z, input.w);
 }
@@ -785,9 +2142,7 @@ __global__ void ForwardReprojectToInvalidPixelsCUDAKernel(
     float src_cx_inv,
     float src_cy_inv,
     CUDABuffer_<float> src_depths,
-    CUDABuffer_<float> src_r,
-    CUDABuffer_<float> src_g,
-    CUDABuffer_<float> src_b,
+    CUDABuffer_<float4> src_colors,
     float dest_fx,
     float dest_fy,
     float dest_cx,
@@ -822,7 +2177,7 @@ __global__ void ForwardReprojectToInvalidPixelsCUDAKernel(
         
         if (dest_px >= 0 && dest_py >= 0 &&
             ix >= 0 && iy >= 0 &&
-            ix < src_r.width() && iy < src_r.height() &&
+            ix < src_colors.width() && iy < src_colors.height() &&
             dest_depths(iy, ix) <= 0) {
           // NOTE: In principle, this should use locking to prevent simultaneous
           //       access.
@@ -831,10 +2186,16 @@ __global__ void ForwardReprojectToInvalidPixelsCUDAKernel(
           // (Note: Kernel without the center pixel seems to work just as well.)
           // Note: Proper rounding (addition of 0.5f before conversion to uchar)
           //       is important, otherwise the colors slowly go to black.
+          const float4 color_sum =
+              src_colors(y, x) +
+              src_colors(y, max(0, x - 1)) +
+              src_colors(max(0, y - 1), x) +
+              src_colors(y, min(src_colors.width() - 1, x + 1)) +
+              src_colors(min(src_colors.height() - 1, y + 1), x);
           dest_colors(iy, ix) = make_uchar4(
-            0.5f + 255.99f * 0.2f * (src_r(y, x) + src_r(y, max(0, x - 1)) + src_r(max(0, y - 1), x) + src_r(y, min(src_r.width() - 1, x + 1)) + src_r(min(src_r.height() - 1, y + 1), x)),
-            0.5f + 255.99f * 0.2f * (src_g(y, x) + src_g(y, max(0, x - 1)) + src_g(max(0, y - 1), x) + src_g(y, min(src_r.width() - 1, x + 1)) + src_g(min(src_r.height() - 1, y + 1), x)),
-            0.5f + 255.99f * 0.2f * (src_b(y, x) + src_b(y, max(0, x - 1)) + src_b(max(0, y - 1), x) + src_b(y, min(src_r.width() - 1, x + 1)) + src_b(min(src_r.height() - 1, y + 1), x)),
+            0.5f + 255.99f * 0.2f * color_sum.x,
+            0.5f + 255.99f * 0.2f * color_sum.y,
+            0.5f + 255.99f * 0.2f * color_sum.z,
             255);
         }
       }
@@ -850,9 +2211,7 @@ void ForwardReprojectToInvalidPixelsCUDA(
     float src_cx_inv,
     float src_cy_inv,
     const CUDABuffer<float>& src_depths,
-    const CUDABuffer<float>& src_r,
-    const CUDABuffer<float>& src_g,
-    const CUDABuffer<float>& src_b,
+    const CUDABuffer<float4>& src_colors,
     float dest_fx,
     float dest_fy,
     float dest_cx,
@@ -873,9 +2232,7 @@ void ForwardReprojectToInvalidPixelsCUDA(
       src_cx_inv,
       src_cy_inv,
       src_depths.ToCUDA(),
-      src_r.ToCUDA(),
-      src_g.ToCUDA(),
-      src_b.ToCUDA(),
+      src_colors.ToCUDA(),
       dest_fx,
       dest_fy,
       dest_cx,
@@ -884,4 +2241,68 @@ void ForwardReprojectToInvalidPixelsCUDA(
       dest_colors->ToCUDA());
   CHECK_CUDA_NO_ERROR();
 }
+
+// All of the kernels below are launched with 32x32 blocks and no dynamic
+// shared memory.
+KernelOccupancy GetMeshDepthmapKernelOccupancy(bool compact_indices,
+                                               bool filter_occlusions) {
+  constexpr int kBlockSize = kMeshingBlockWidth * kMeshingBlockHeight;
+  if (compact_indices && filter_occlusions) {
+    return cuda_util::ComputeKernelOccupancy(
+        MeshDepthmapCUDAKernel<true, true>, kBlockSize, 0);
+  } else if (compact_indices) {
+    return cuda_util::ComputeKernelOccupancy(
+        MeshDepthmapCUDAKernel<true, false>, kBlockSize, 0);
+  } else if (filter_occlusions) {
+    return cuda_util::ComputeKernelOccupancy(
+        MeshDepthmapCUDAKernel<false, true>, kBlockSize, 0);
+  } else {
+    return cuda_util::ComputeKernelOccupancy(
+        MeshDepthmapCUDAKernel<false, false>, kBlockSize, 0);
+  }
+}
+
+KernelOccupancy GetDecimateMeshKernelOccupancy() {
+  return cuda_util::ComputeKernelOccupancy(
+      DecimateMeshCUDAKernel, kDecimationTileSize * kDecimationTileSize, 0);
+}
+
+KernelOccupancy GetProjectImageOntoDepthMapKernelOccupancy(bool sample_rgb) {
+  if (sample_rgb) {
+    return cuda_util::ComputeKernelOccupancy(
+        ProjectImageOntoDepthMapCUDAKernel<true>, 32 * 32, 0);
+  } else {
+    return cuda_util::ComputeKernelOccupancy(
+        ProjectImageOntoDepthMapCUDAKernel<false>, 32 * 32, 0);
+  }
+}
+
+KernelOccupancy GetPrepareTargetFrameKernelOccupancy(bool sample_rgb) {
+  if (sample_rgb) {
+    return cuda_util::ComputeKernelOccupancy(
+        PrepareTargetFrameCUDAKernel<true, false>, 32 * 32, 0);
+  } else {
+    return cuda_util::ComputeKernelOccupancy(
+        PrepareTargetFrameCUDAKernel<false, false>, 32 * 32, 0);
+  }
+}
+
+KernelOccupancy GetForwardReprojectToInvalidPixelsKernelOccupancy(
+    bool float_colors) {
+  if (float_colors) {
+    void (*kernel)(
+        CUDAMatrix3x4, float, float, float, float, CUDABuffer_<float>,
+        CUDABuffer_<float4>, float, float, float, float, CUDABuffer_<float>,
+        CUDABuffer_<uchar4>) =
+            ForwardReprojectToInvalidPixelsCUDAKernel;
+    return cuda_util::ComputeKernelOccupancy(kernel, 32 * 32, 0);
+  } else {
+    void (*kernel)(
+        CUDAMatrix3x4, float, float, float, float, CUDABuffer_<float>,
+        CUDABuffer_<uchar4>, float, float, float, float, CUDABuffer_<float>,
+        CUDABuffer_<uchar4>) = ForwardReprojectToInvalidPixelsCUDAKernel;
+    return cuda_util::ComputeKernelOccupancy(kernel, 32 * 32, 0);
+  }
+}
+
 }  // namespace view_correction
@@ -29,12 +29,37 @@
 #ifndef VIEW_CORRECTION_VIEW_CORRECTION_DISPLAY_CUH_
 #define VIEW_CORRECTION_VIEW_CORRECTION_DISPLAY_CUH_
 
+#include <vector>
+
 #include <cuda_runtime.h>
 
 #include "view_correction/cuda_buffer.h"
+#include "view_correction/cuda_distortion_lut.cuh"
+#include "view_correction/cuda_util.h"
+#include "view_correction/forward_declarations.h"
 
 namespace view_correction {
 
+// Converts an RGB image, stored interleaved in a buffer with 3 * width
+// columns, to its Y channel and to the half-resolution UV channels packed as
+// (u << 8) | v. If average_uv is true, the UV values are computed from the
+// average color of each 2x2 pixel block, otherwise from its top-left pixel.
+// uv_image may be null to only compute the Y channel.
+void ConvertRGBToYUVCUDA(
+    cudaStream_t stream,
+    const CUDABuffer<uint8_t>& rgb_image,
+    bool average_uv,
+    CUDABuffer<uint8_t>* y_image,
+    CUDABuffer<uint16_t>* uv_image);
+
+// Packs an image with interleaved 8-bit RGBX channels into a buffer with 3 *
+// width columns of interleaved RGB channels (dropping the fourth channel), as
+// used for rgb_image_gpu.
+void PackRGBXToRGBCUDA(
+    cudaStream_t stream,
+    const CUDABuffer_<uchar4>& rgbx_image,
+    CUDABuffer<uint8_t>* rgb_image);
+
 void DownsampleImageToHalfSizeCUDA(
     cudaStream_t stream,
     const CUDABuffer<uint8_t>& source,
@@ -45,12 +70,90 @@ void ComputeGradientMagnitudeDiv2CUDA(
     const CUDABuffer<uint8_t>& image,
     CUDABuffer<uint8_t>* output);
 
+// Downsamples image to half size levels.size() times like
+// DownsampleImageToHalfSizeCUDA() and computes the gradient magnitudes of the
+// result like ComputeGradientMagnitudeDiv2CUDA(), in a single kernel for up to
+// three levels. Only the last level is written to its buffer in levels (the
+// others are only used for fallback with more levels). With no levels, only
+// computes the gradient magnitudes of image.
+void ComputePyramidAndGradientMagnitudeDiv2CUDA(
+    cudaStream_t stream,
+    const CUDABuffer<uint8_t>& image,
+    const std::vector<CUDABuffer<uint8_t>*>& levels,
+    CUDABuffer<uint8_t>* gradient_magnitude_div_sqrt2);
+
+// Buffers for outputting the mesh of a depth map as a compacted list of
+// triangles (GL_TRIANGLES) which only contains the valid quads, instead of as
+// a triangle strip with a fixed number of indices. Also used by
+// MeshDepthmapDecimatedCUDA().
+struct MeshIndexCompactionBuffers {
+  // Allocates the buffers for meshing depth maps of the given size.
+  MeshIndexCompactionBuffers(int width, int height);
+  
+  ~MeshIndexCompactionBuffers();
+  
+  // Waits for the index count of the last meshing run which used these
+  // buffers to be downloaded and returns it.
+  int WaitForIndexCount();
+  
+  // Returns the index count of the last meshing run which used these buffers.
+  // Only valid once the stream has passed this run (for example, after
+  // synchronizing with an event recorded after it).
+  int index_count() const { return *index_count_cpu; }
+  
+  int max_quad_count;
+  
+  // Whether each quad of the mesh is valid, stored at
+  // (x - 1) + (y - 1) * (width - 1) for the quad with bottom-right vertex
+  // (x, y), and the indices of the selected quads.
+  CUDABufferPtr<uint8_t> quad_flags;
+  CUDABufferPtr<int> selected_quads;
+  CUDABufferPtr<int> selected_quad_count;
+  // Number of indices written to the index buffer.
+  CUDABufferPtr<int> index_count_gpu;
+  
+  CUDABufferPtr<uint8_t> cub_temp_storage;
+  size_t cub_temp_storage_bytes;
+  
+  // Page-locked copy of index_count_gpu, downloaded after each meshing run,
+  // and an event recorded after the download.
+  int* index_count_cpu;
+  cudaEvent_t index_count_downloaded_event;
+};
+
+// Largest supported radius of the occlusion safety filter.
+constexpr int kMaxOcclusionSafetyRadius = 4;
+
+// Filter which can be applied while meshing a depth map to delete all pixels
+// which are more than threshold (in meters) behind the closest valid pixel
+// within a (2 * radius + 1) x (2 * radius + 1) pixel window around them. This
+// prevents foreground objects from being projected onto the background if the
+// occlusion boundaries are imprecise. A radius of 0 disables the filter. As
+// the window stays within the neighboring 32x32 pixel tiles, the dependency
+// of the mesh of a tile on its neighbors (see DirtyTileBuffers) is unchanged.
+struct OcclusionSafetyFilter {
+  int radius = 0;
+  float threshold = 0;
+};
+
 // The vertex buffer must have space for at least
 //     depthmap.width() * depthmap.height()
 // entires, the index buffer must have space for at least
 //     2 + 4 * (depthmap.height() - 2) +
 //     4 * (depthmap.width() - 1) * (depthmap.height() - 1)
-// entries.
+// entries (as given by MeshRenderer::GetIndexCount()) for a triangle strip.
+// If compaction_buffers is non-null, the mesh is instead output as a list of
+// triangles containing only the valid quads, for which the index buffer must
+// have space for at least
+//     6 * (depthmap.width() - 1) * (depthmap.height() - 1)
+// entries (as given by MeshRenderer::GetMaxTriangleIndexCount()). The number
+// of indices written is then available from the compaction buffers.
+// If update_tiles is non-null, only the vertices and quads of the 32x32 pixel
+// tiles with a non-zero flag are written (see DirtyTileBuffers), while the
+// others keep the output of the previous call. This requires the buffers (and
+// the compaction buffers, if given) to be the same as in the previous call.
+// The depths are filtered with occlusion_filter before meshing them, without
+// modifying depthmap.
 void MeshDepthmapCUDA(
     const CUDABuffer_<float>& depthmap,
     const float fx_inv,
@@ -60,7 +163,109 @@ void MeshDepthmapCUDA(
     cudaStream_t stream,
     cudaGraphicsResource_t vertex_buffer,
     cudaGraphicsResource_t color_buffer,
-    cudaGraphicsResource_t index_buffer);
+    cudaGraphicsResource_t index_buffer,
+    const CUDABuffer<uint8_t>* update_tiles,
+    MeshIndexCompactionBuffers* compaction_buffers,
+    const OcclusionSafetyFilter& occlusion_filter);
+
+// Variant of MeshDepthmapCUDA() which writes to buffers that are already
+// mapped (or otherwise accessible) as device pointers.
+void MeshDepthmapCUDA(
+    const CUDABuffer_<float>& depthmap,
+    const float fx_inv,
+    const float fy_inv,
+    const float cx_inv,
+    const float cy_inv,
+    cudaStream_t stream,
+    float* vertex_buffer,
+    uint8_t* color_buffer,
+    uint32_t* index_buffer,
+    const CUDABuffer<uint8_t>* update_tiles,
+    MeshIndexCompactionBuffers* compaction_buffers,
+    const OcclusionSafetyFilter& occlusion_filter);
+
+// Variant of MeshDepthmapCUDA() which outputs an adaptively decimated list of
+// triangles. Planar regions of valid quads are merged into cells of up to
+// 32x32 quads, which are aligned in a quadtree and triangulated as a fan
+// around their center vertex that includes all vertices on the cell border.
+// This keeps the mesh free of cracks (T-junctions). A cell is planar if the
+// depth of each of its interior vertices deviates by at most
+// planarity_threshold * depth from the triangle fan. Quads at depth jumps are
+// not merged and keep the full resolution. The vertex buffer is written as
+// for MeshDepthmapCUDA(), the index buffer must have space for at least
+//     6 * (depthmap.width() - 1) * (depthmap.height() - 1)
+// entries.
+void MeshDepthmapDecimatedCUDA(
+    const CUDABuffer_<float>& depthmap,
+    const float fx_inv,
+    const float fy_inv,
+    const float cx_inv,
+    const float cy_inv,
+    float planarity_threshold,
+    cudaStream_t stream,
+    cudaGraphicsResource_t vertex_buffer,
+    cudaGraphicsResource_t color_buffer,
+    cudaGraphicsResource_t index_buffer,
+    MeshIndexCompactionBuffers* compaction_buffers,
+    const OcclusionSafetyFilter& occlusion_filter);
+
+void MeshDepthmapDecimatedCUDA(
+    const CUDABuffer_<float>& depthmap,
+    const float fx_inv,
+    const float fy_inv,
+    const float cx_inv,
+    const float cy_inv,
+    float planarity_threshold,
+    cudaStream_t stream,
+    float* vertex_buffer,
+    uint8_t* color_buffer,
+    uint32_t* index_buffer,
+    MeshIndexCompactionBuffers* compaction_buffers,
+    const OcclusionSafetyFilter& occlusion_filter);
+
+// Tracks which 32x32 pixel tiles of the source depth map and of the Y image
+// (at depth map resolution) changed since they were last used, such that the
+// inpainting and meshing of the source frame can be restricted to the changed
+// regions. All tile flags are stored in row-major order with one entry per
+// tile.
+struct DirtyTileBuffers {
+  // Allocates the buffers for images of the given size.
+  DirtyTileBuffers(int width, int height);
+  
+  int tiles_x;
+  int tiles_y;
+  
+  // Whether reference_depth and reference_y have been initialized. If not,
+  // all tiles are treated as dirty.
+  bool have_reference;
+  // Scaled depths and intensities of each tile at the last time it was dirty.
+  CUDABufferPtr<float> reference_depth;
+  CUDABufferPtr<uint8_t> reference_y;
+  
+  // Whether each tile changed in the last call to UpdateDirtyTilesCUDA().
+  CUDABufferPtr<uint8_t> dirty_tiles;
+  // The dirty tiles dilated by the halo of tiles which must be re-inpainted,
+  // for the update_tiles parameter of InpaintDepthMapWithConvolutionCUDA().
+  CUDABufferPtr<uint8_t> inpainting_tiles;
+  // The tiles whose mesh may change due to re-inpainting the inpainting
+  // tiles, for the update_tiles parameter of MeshDepthmapCUDA().
+  CUDABufferPtr<uint8_t> meshing_tiles;
+};
+
+// Compares the given depth map (scaled by depth_scaling_factor) and Y image to
+// the reference of the dirty tile buffers and updates all tile flags. A tile is
+// dirty if the validity of a depth changes, if a depth changes by more than
+// depth_change_threshold times the reference depth, or if an intensity changes
+// by more than intensity_change_threshold. The reference is updated for the
+// dirty tiles only, such that slow changes eventually mark a tile as dirty.
+void UpdateDirtyTilesCUDA(
+    cudaStream_t stream,
+    float depth_scaling_factor,
+    cudaTextureObject_t depth_map,
+    const CUDABuffer<uint8_t>& y_image,
+    float depth_change_threshold,
+    int intensity_change_threshold,
+    DirtyTileBuffers* buffers);
 
 void MeshDepthmapMMCUDA(
     const CUDABuffer_<uint16_t>& depthmap_in_mm,
@@ -73,18 +278,35 @@ void MeshDepthmapMMCUDA(
     cudaGraphicsResource_t color_buffer,
     cudaGraphicsResource_t index_buffer);
 
+// Creates the textures for sampling a YUV image with bilinear interpolation in
+// ProjectImageOntoDepthMapCUDA() and PrepareTargetFrameCUDA(). Both read the
+// channels normalized to [0, 1], the uv_texture returns the packed channels of
+// uv_image as (v, u). You must destroy them after use with
+// cudaDestroyTextureObject().
+void CreateYUVImageTexturesCUDA(
+    const CUDABuffer<uint8_t>& y_image,
+    const CUDABuffer<uint16_t>& uv_image,
+    cudaTextureObject_t* y_texture,
+    cudaTextureObject_t* uv_texture);
+
+// Projects the YUV image, given by the textures from
+// CreateYUVImageTexturesCUDA() and the size of its Y channel, onto the depth
+// map and outputs the bilinearly interpolated color for each pixel, or
+// (0, 0, 0, 0) if there is none. The image is distorted according to
+// yuv_distortion, which may be a default-constructed DistortionLUT_ for a
+// pinhole camera.
 void ProjectImageOntoDepthMapCUDA(
     cudaStream_t stream,
     cudaTextureObject_t depth_texture,
-    const CUDABuffer<uint8_t>& y_image,
-    const CUDABuffer<uint16_t>& uv_image,
+    cudaTextureObject_t y_texture,
+    cudaTextureObject_t uv_texture,
+    int image_width,
+    int image_height,
     float yuv_fx,
     float yuv_fy,
     float yuv_cx,
     float yuv_cy,
-    float yuv_k1,
-    float yuv_k2,
-    float yuv_k3,
+    const DistortionLUT_& yuv_distortion,
     float depth_fx_inv,
     float depth_fy_inv,
     float depth_cx_center_inv,
@@ -92,31 +314,132 @@ void ProjectImageOntoDepthMapCUDA(
     const CUDAMatrix3x4& depth_frame_to_yuv_frame,
     CUDABuffer<uchar4>* output);
 
-void CopyFloatColorImageToRgb8SurfaceCUDA(
+// Variant of ProjectImageOntoDepthMapCUDA() which samples an RGB image, stored
+// interleaved in a buffer with 3 * width columns, instead of a YUV image. Since
+// this layout cannot be sampled with texture filtering, the nearest pixel is
+// used.
+void ProjectImageOntoDepthMapCUDA(
     cudaStream_t stream,
-    const CUDABuffer<float>& color_r,
-    const CUDABuffer<float>& color_g,
-    const CUDABuffer<float>& color_b,
-    cudaSurfaceObject_t surface);
+    cudaTextureObject_t depth_texture,
+    const CUDABuffer<uint8_t>& rgb_image,
+    float yuv_fx,
+    float yuv_fy,
+    float yuv_cx,
+    float yuv_cy,
+    const DistortionLUT_& yuv_distortion,
+    float depth_fx_inv,
+    float depth_fy_inv,
+    float depth_cx_center_inv,
+    float depth_cy_center_inv,
+    const CUDAMatrix3x4& depth_frame_to_yuv_frame,
+    CUDABuffer<uchar4>* output);
 
-void CopyColorImageToRgb8SurfaceCUDA(
+// Prepares the target frame for the inpainting in a single pass: reads the
+// rendered depth from rendered_depth_texture (which may be a texture of
+// depth_output), writes it to depth_output and projects the image onto it
+// like ProjectImageOntoDepthMapCUDA(). If tsdf_depth_texture is not 0, pixels
+// without depth take the depth and color from the TSDF rendering in
+// tsdf_depth_texture and tsdf_color_texture instead. If hole_map is not null,
+// the depth and color holes of the outputs are counted into it in the same
+// pass and its pyramid is built, such that the inpainting passes on the
+// outputs can share it.
+void PrepareTargetFrameCUDA(
+    cudaStream_t stream,
+    cudaTextureObject_t rendered_depth_texture,
+    cudaTextureObject_t tsdf_depth_texture,
+    cudaTextureObject_t tsdf_color_texture,
+    cudaTextureObject_t y_texture,
+    cudaTextureObject_t uv_texture,
+    int image_width,
+    int image_height,
+    float yuv_fx,
+    float yuv_fy,
+    float yuv_cx,
+    float yuv_cy,
+    const DistortionLUT_& yuv_distortion,
+    float depth_fx_inv,
+    float depth_fy_inv,
+    float depth_cx_center_inv,
+    float depth_cy_center_inv,
+    const CUDAMatrix3x4& depth_frame_to_yuv_frame,
+    CUDABuffer<float>* depth_output,
+    CUDABuffer<uchar4>* color_output,
+    HoleMap* hole_map);
+
+// Variant of PrepareTargetFrameCUDA() which samples an interleaved RGB image.
+void PrepareTargetFrameCUDA(
+    cudaStream_t stream,
+    cudaTextureObject_t rendered_depth_texture,
+    cudaTextureObject_t tsdf_depth_texture,
+    cudaTextureObject_t tsdf_color_texture,
+    const CUDABuffer<uint8_t>& rgb_image,
+    float yuv_fx,
+    float yuv_fy,
+    float yuv_cx,
+    float yuv_cy,
+    const DistortionLUT_& yuv_distortion,
+    float depth_fx_inv,
+    float depth_fy_inv,
+    float depth_cx_center_inv,
+    float depth_cy_center_inv,
+    const CUDAMatrix3x4& depth_frame_to_yuv_frame,
+    CUDABuffer<float>* depth_output,
+    CUDABuffer<uchar4>* color_output,
+    HoleMap* hole_map);
+
+// Writes the target frame result to the color and depth display textures in
+// a single pass. The color is converted to 8 bit per channel, the float4
+// variant expects RGB colors in [0, 1] in the x, y, z components, as output
+// by InpaintImageCUDA().
+void CopyTargetResultToDisplaySurfacesCUDA(
+    cudaStream_t stream,
+    const CUDABuffer<float4>& color_image,
+    const CUDABuffer<float>& depth_map,
+    cudaSurfaceObject_t color_surface,
+    cudaSurfaceObject_t depth_surface);
+
+void CopyTargetResultToDisplaySurfacesCUDA(
     cudaStream_t stream,
     const CUDABuffer<uchar4>& color_rgbx,
-    cudaSurfaceObject_t surface);
+    const CUDABuffer<float>& depth_map,
+    cudaSurfaceObject_t color_surface,
+    cudaSurfaceObject_t depth_surface);
 
-void CopyValidToInvalidPixelsCUDA(
+// Variant of CopyTargetResultToDisplaySurfacesCUDA() which writes to CUDA
+// buffers instead of the display textures (for --vc_headless).
+void CopyTargetResultToBuffersCUDA(
     cudaStream_t stream,
-    cudaTextureObject_t src_depth_texture,
-    cudaTextureObject_t src_color_texture,
-    CUDABuffer<float>* dest_depth,
-    CUDABuffer<uchar4>* dest_color);
+    const CUDABuffer<float4>& color_image,
+    const CUDABuffer<float>& depth_map,
+    CUDABuffer<uchar4>* color_output,
+    CUDABuffer<float>* depth_output);
 
-void DeleteAlmostOccludedPixelsCUDA(
+void CopyTargetResultToBuffersCUDA(
     cudaStream_t stream,
-    int radius,
-    float occlusion_threshold,
-    const CUDABuffer<float>& src_depth_map,
-    CUDABuffer<float>* dest_depth_map);
+    const CUDABuffer<uchar4>& color_rgbx,
+    const CUDABuffer<float>& depth_map,
+    CUDABuffer<uchar4>* color_output,
+    CUDABuffer<float>* depth_output);
+
+// Converts the color result of the target frame to an NV12 image in device
+// memory (for the VideoEncoder): the Y plane with the given pitch, and the
+// interleaved UV plane with the same pitch starting nv12_luma_rows rows after
+// it. Uses limited-range BT.709. The NV12 image size is the color image size
+// rounded up to even numbers, the last column and row are repeated if
+// necessary.
+void ConvertTargetResultToNV12CUDA(
+    cudaStream_t stream,
+    const CUDABuffer<float4>& color_image,
+    uint8_t* nv12_image,
+    size_t nv12_pitch,
+    int nv12_luma_rows);
+
+void ConvertTargetResultToNV12CUDA(
+    cudaStream_t stream,
+    const CUDABuffer<uchar4>& color_rgbx,
+    uint8_t* nv12_image,
+    size_t nv12_pitch,
+    int nv12_luma_rows);
 
 void ForwardReprojectToInvalidPixelsCUDA(
     cudaStream_t stream,
@@ -142,15 +465,27 @@ void ForwardReprojectToInvalidPixelsCUDA(
     float src_cx_inv,
     float src_cy_inv,
     const CUDABuffer<float>& src_depths,
-    const CUDABuffer<float>& src_r,
-    const CUDABuffer<float>& src_g,
-    const CUDABuffer<float>& src_b,
+    const CUDABuffer<float4>& src_colors,
     float dest_fx,
     float dest_fy,
     float dest_cx,
     float dest_cy,
     CUDABuffer<float>* dest_depths,
     CUDABuffer<uchar4>* dest_colors);
+
+// Return the theoretical occupancy of the kernels used by the functions above
+// (for benchmarking). compact_indices selects the variant of
+// MeshDepthmapCUDA() which outputs quad flags for compaction,
+// filter_occlusions the one which applies the occlusion safety filter, and
+// float_colors the variant of ForwardReprojectToInvalidPixelsCUDA() which
+// takes float4 colors.
+KernelOccupancy GetMeshDepthmapKernelOccupancy(bool compact_indices,
+                                               bool filter_occlusions);
+KernelOccupancy GetDecimateMeshKernelOccupancy();
+KernelOccupancy GetProjectImageOntoDepthMapKernelOccupancy(bool sample_rgb);
+KernelOccupancy GetPrepareTargetFrameKernelOccupancy(bool sample_rgb);
+KernelOccupancy GetForwardReprojectToInvalidPixelsKernelOccupancy(
+    bool float_colors);
 }  // namespace view_correction
 
 #endif  // VIEW_CORRECTION_VIEW_CORRECTION_DISPLAY_CUH_
@@ -31,6 +31,7 @@
 
 #include <chrono>
 #include <cstdarg>
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <string>
@@ -44,12 +45,20 @@
 #include <GL/gl.h>
 #endif
 
+#include <cuda_runtime.h>
 #include <glog/logging.h>
 #include <opencv2/core/core.hpp>
 #include <sophus/se3.hpp>
 
+#include "view_correction/forward_declarations.h"
+#include "view_correction/mesh_chunk_cache.h"
+#include "view_correction/pose_history.h"
+#include "view_correction/timestamped_frame_ring.h"
+
 namespace view_correction {
 
+struct FrameTimings;
+class LatencyMetrics;
 struct ViewCorrectionDisplayImpl;
 
 
@@ -83,6 +92,17 @@ struct Intrinsics {
   // Image size
   int width;
   int height;
+  
+  // Radial distortion coefficients of the color camera, which distorts the
+  // normalized image coordinates x as (1 + k1 r^2 + k2 r^4 + k3 r^6) x with
+  // r = |x|. Zero for a pinhole camera. Ignored for the depth camera.
+  float k1 = 0;
+  float k2 = 0;
+  float k3 = 0;
+  
+  inline bool HasDistortion() const {
+    return k1 != 0 || k2 != 0 || k3 != 0;
+  }
 };
 
 
@@ -94,13 +114,60 @@ struct TimestampedSE3f {
 };
 
 
+// Input image which is already stored in GPU memory, for example by a camera
+// pipeline which writes to CUDA device memory, a GL texture or an EGLImage.
+// Such images are read in place on the GPU by the display, without going
+// through host memory (see the GPU image overloads of DepthImageCallback()
+// and YUVImageCallback()). Depth images have a single uint16_t channel in
+// millimeters. Color images are interleaved 8-bit RGB (channels == 3) or RGBX
+// (channels == 4, the fourth channel is ignored).
+struct GPUImage {
+  // Calls release_callback.
+  inline ~GPUImage() {
+    if (release_callback) {
+      release_callback();
+    }
+  }
+  
+  int width = 0;
+  int height = 0;
+  int channels = 1;
+  
+  // Either device memory with the given row pitch in bytes ...
+  const void* device_data = nullptr;
+  size_t pitch = 0;
+  
+  // ... or, if device_data is null, a graphics resource which is registered
+  // with CUDA as an image (for example, a GL texture registered with
+  // cudaGraphicsGLRegisterImage() or an EGLImage registered with
+  // cudaGraphicsEGLRegisterImage()). It is mapped on the display's streams
+  // while it is read, and must not be mapped otherwise at that time. Its
+  // elements must have the size of a pixel (2 bytes for depth images and
+  // channels bytes for color images).
+  cudaGraphicsResource_t resource = nullptr;
+  
+  // If not null, the image is only read after this event, which the producer
+  // may record after writing the image.
+  cudaEvent_t ready_event = nullptr;
+  
+  // Called once the display does not read the image anymore, such that the
+  // producer may reuse its memory. This happens after the GPU has finished
+  // reading it, or when the image is dropped from the input cache without
+  // having been used. Called from the threads which pass the input or call
+  // Render().
+  std::function<void()> release_callback;
+};
+
+
 class DepthImage : public cv::Mat_<uint16_t> {
 public:
   inline DepthImage() {}
   
   inline DepthImage(const DepthImage& other)
       : cv::Mat_<uint16_t>(other),
-        timestamp_ns_(other.timestamp_ns_) {}
+        timestamp_ns_(other.timestamp_ns_),
+        pinned_memory_(other.pinned_memory_),
+        gpu_image_(other.gpu_image_) {}
   
   inline void set_timestamp_ns(uint64_t timestamp_ns) {
     timestamp_ns_ = timestamp_ns;
@@ -110,8 +177,31 @@ public:
     return timestamp_ns_;
   }
   
+  // Keeps the page-locked memory alive which the image data is stored in
+  // (see ViewCorrectionDisplay::AllocateDepthImage()).
+  inline void set_pinned_memory(const std::shared_ptr<uint8_t>& memory) {
+    pinned_memory_ = memory;
+  }
+  
+  // Set for images which are stored in GPU memory, in which case the
+  // cv::Mat part is empty.
+  inline void set_gpu_image(const std::shared_ptr<GPUImage>& gpu_image) {
+    gpu_image_ = gpu_image;
+  }
+  
+  inline const std::shared_ptr<GPUImage>& gpu_image() const {
+    return gpu_image_;
+  }
+  
+  // Returns whether the image has content, in host or in GPU memory.
+  inline bool has_content() const {
+    return !empty() || gpu_image_;
+  }
+  
 private:
   uint64_t timestamp_ns_;
+  std::shared_ptr<uint8_t> pinned_memory_;
+  std::shared_ptr<GPUImage> gpu_image_;
 };
 
 
@@ -123,7 +213,10 @@ public:
   
   inline ColorImage(const ColorImage& other)
       : cv::Mat_<cv::Vec3b>(other),
-        timestamp_ns_(other.timestamp_ns_) {}
+        timestamp_ns_(other.timestamp_ns_),
+        G_T_C_(other.G_T_C_),
+        pinned_memory_(other.pinned_memory_),
+        gpu_image_(other.gpu_image_) {}
   
   
   inline void set_timestamp_ns(uint64_t timestamp_ns) {
@@ -143,9 +236,32 @@ public:
     return G_T_C_;
   }
   
+  // Keeps the page-locked memory alive which the image data is stored in
+  // (see ViewCorrectionDisplay::AllocateColorImage()).
+  inline void set_pinned_memory(const std::shared_ptr<uint8_t>& memory) {
+    pinned_memory_ = memory;
+  }
+  
+  // Set for images which are stored in GPU memory, in which case the
+  // cv::Mat part is empty.
+  inline void set_gpu_image(const std::shared_ptr<GPUImage>& gpu_image) {
+    gpu_image_ = gpu_image;
+  }
+  
+  inline const std::shared_ptr<GPUImage>& gpu_image() const {
+    return gpu_image_;
+  }
+  
+  // Returns whether the image has content, in host or in GPU memory.
+  inline bool has_content() const {
+    return !empty() || gpu_image_;
+  }
+  
 private:
   uint64_t timestamp_ns_;
   Sophus::SE3f G_T_C_;  // camera-to-global transformation
+  std::shared_ptr<uint8_t> pinned_memory_;
+  std::shared_ptr<GPUImage> gpu_image_;
 };
 
 
@@ -155,9 +271,28 @@ class ViewCorrectionDisplay {
   
   enum class TargetViewMode {
     kFixedOffset = 0,
-    kReceiveFromUDP
+    kReceiveFromUDP,
+    // Like kReceiveFromUDP, but the observer poses are given to
+    // ObserverPoseCallback() instead, for example when replaying a session.
+    kObserverPoseCallback
   };
   
+  // A target view given to RenderViews().
+  struct TargetView {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    
+    // Global-to-view transformation.
+    Sophus::SE3f target_T_G;
+    
+    // Pinhole intrinsics of the view at the target render resolution (see
+    // target_render_width() and target_render_height()).
+    float fx;
+    float fy;
+    float cx;
+    float cy;
+  };
+  typedef std::vector<TargetView, Eigen::aligned_allocator<TargetView>> TargetViews;
+  
   ViewCorrectionDisplay(
       int width, int height, int offset_x, int offset_y,
       TargetViewMode target_view_mode,
@@ -166,10 +301,64 @@ class ViewCorrectionDisplay {
   
   virtual ~ViewCorrectionDisplay();
   
+  // Makes the display run its rendering and target frame inpainting on the
+  // given stream instead of an own one, and place the target frame
+  // inpainting scratch buffers in the given arena (if not null), which may be
+  // shared with other displays that use the same stream. Both must outlive
+  // the display. Must be called before Init(). Used by ViewCorrectionServer.
+  void ShareResources(cudaStream_t stream, InpaintingArena* target_inpainting_arena);
+  
   void Init();
   
   bool Render();
   
+  // Alternative to Render() for several observers: renders and inpaints
+  // the given views (at most --vc_max_target_views) for the latest input.
+  // The input is updated once for all views, and the views are rendered from
+  // the meshed depth map together with a single draw call. They are then
+  // inpainted one after another, since all stages of the target frame
+  // pipeline work in the single-view target frame buffers (batching their
+  // inpainting along the grid z dimension would need per-view copies of all
+  // of these buffers and is not done). Each view is warm-started and made
+  // temporally consistent from its own result of the previous call, so a
+  // view index must keep referring to the same observer across calls. Their
+  // results are not drawn to the screen but kept in CUDA buffers, see
+  // GetViewResult().
+  // Not supported together with stereo rendering or the evaluation flags.
+  bool RenderViews(const TargetViews& views);
+  
+  // Returns the result of the view with the given index from the latest call
+  // to RenderViews(), like GetHeadlessResult() does for Render(). The
+  // results of all views share the ready event. Returns false if the view
+  // has not been rendered.
+  bool GetViewResult(int view_index,
+                     const CUDABuffer<uchar4>** color,
+                     const CUDABuffer<float>** depth,
+                     cudaEvent_t* ready_event);
+  
+  // Returns the number of frames for which Render() re-presented the previous
+  // frame instead of rendering a new one, see --vc_reuse_frames.
+  int64_t reused_frame_count() const;
+  
+  // Returns the current target render resolution.
+  inline int target_render_width() const { return target_render_width_; }
+  inline int target_render_height() const { return target_render_height_; }
+  
+  // Allocates an input image of the given size in page-locked memory if
+  // possible, or in pageable memory otherwise. Images passed to
+  // YUVImageCallback() and DepthImageCallback() which were allocated with
+  // these functions can be uploaded to the GPU without staging them first.
+  // Thread-safe, may be called before Init().
+  void AllocateColorImage(int rows, int cols, ColorImage* image);
+  void AllocateDepthImage(int rows, int cols, DepthImage* image);
+  
+  // The input image callbacks below do not lock: the color callbacks and the
+  // depth callbacks each feed a single-producer ring buffer. All calls to the
+  // color callbacks (of both variants) must thus come from one thread at a
+  // time, and likewise for the depth callbacks, with non-decreasing
+  // timestamps. The color and depth callbacks may run concurrently with each
+  // other and with Render().
+  
   // Must be called to update the class with new input YUV images.
   void YUVImageCallback(const ColorImage& image);
   
@@ -177,8 +366,33 @@ class ViewCorrectionDisplay {
   // Depth images are expected in millimeters in uint16_t format.
   void DepthImageCallback(const DepthImage& image);
   
+  // Variants of YUVImageCallback() and DepthImageCallback() for images which
+  // are stored in GPU memory (see GPUImage). The images are copied on the GPU
+  // into the pipeline's input buffers when they are used, and released
+  // afterwards. Since up to the input cache capacity of images may be kept for
+  // matching the depth and color timestamps, the producer should cycle
+  // through enough buffers. The debug output, the evaluation and the session
+  // recording only support images in host memory and skip these images.
+  void YUVImageCallback(const std::shared_ptr<GPUImage>& image,
+                        uint64_t timestamp_ns,
+                        const Sophus::SE3f& G_T_C);
+  void DepthImageCallback(const std::shared_ptr<GPUImage>& image,
+                          uint64_t timestamp_ns);
+  
   // Must be called to update the class with new scene reconstructions (if using mesh input; otherwise, use DepthImageCallback()).
   void MeshCallback(const std::shared_ptr<MeshStub>& mesh);
+  
+  // Alternative to MeshCallback() for reconstructions which are divided into
+  // chunks: adds, replaces or (for null chunks) removes the given chunks. The
+  // chunks are kept on the GPU, such that only the changed ones are uploaded
+  // in the next frame. May be called from any thread.
+  void MeshChunkCallback(const MeshChunkUpdates& updates);
+  
+  // Sets the point which the observer looks at, in normalized coordinates of
+  // the target view ((0, 0) is the top-left and (1, 1) the bottom-right
+  // corner). With --vc_foveated_inpainting, the region around it is inpainted
+  // at full resolution. Defaults to the center. May be called from any thread.
+  void SetGazePoint(float x, float y);
 
   
   // For demonstration purposes only, should be replaced with your own timestamp handling.
@@ -186,9 +400,42 @@ class ViewCorrectionDisplay {
     start_time_ = start_time;
   }
   
+  // Sets the time at which the result of the next Render() will be displayed,
+  // for example the vsync predicted by a FramePacer. The target view of that
+  // frame is then rendered with the color camera pose predicted for this time
+  // instead of for --vc_display_time_offset_ms after the frame start. Only
+  // applies to the next Render() call.
+  inline void SetNextDisplayTime(std::chrono::steady_clock::time_point display_time) {
+    next_display_time_ = display_time;
+    have_next_display_time_ = true;
+  }
+  
   // For demonstration purposes only, should be replaced by pose polling in GetCurrentColorCameraPose().
   void ColorCameraPoseCallback(const Sophus::SE3f& G_T_C, uint64_t timestamp);
   
+  // Sets the latest observer pose in TargetViewMode::kObserverPoseCallback,
+  // with a timestamp in the time base of ColorCameraPoseCallback(). Must be
+  // called from one thread at a time.
+  void ObserverPoseCallback(const Sophus::SE3f& G_T_observer, uint64_t timestamp);
+  
+  // Returns the per-stage timings and inpainting statistics, which are
+  // collected if --vc_do_timings or --vc_save_timings is set. Only valid
+  // after Init(). The metrics may be accessed from any thread, and the
+  // application may add its own metrics, for example frame times.
+  LatencyMetrics* latency_metrics();
+  
+  // Returns the result of the latest rendered frame in headless mode
+  // (--vc_headless), in which it is not drawn to the screen: the color image
+  // (RGB with 8 bit per channel, the fourth channel is 255) and the depth map
+  // of the target view at the current render resolution. The buffers are
+  // written on the GPU asynchronously; ready_event is recorded once they are
+  // complete and may be, for example, waited for on another stream. They
+  // are overwritten by the next Render() and re-allocated if the render
+  // resolution changes. Returns false if no frame has been rendered yet.
+  bool GetHeadlessResult(const CUDABuffer<uchar4>** color,
+                         const CUDABuffer<float>** depth,
+                         cudaEvent_t* ready_event);
+  
  private:
   uint64_t GetCurrentTimestamp() {
     LOG(ERROR) << "This function is a stub. You have to replace it with your function to get the current timestamp.";
@@ -202,10 +449,17 @@ class ViewCorrectionDisplay {
   bool GetCurrentColorCameraPose(Sophus::SE3f* result, uint64_t* timestamp_of_result) {
     LOG(ERROR) << "This function is a stub. You have to replace it with your function to get the current color camera pose.";
     
-    *result = input_G_T_C_;
-    *timestamp_of_result = input_G_T_C_timestamp_;
-    
-    return true;  // return false to signal failure
+    std::lock_guard<std::mutex> input_lock(input_mutex_);
+    return input_pose_history_.GetLatestPose(result, timestamp_of_result);  // return false to signal failure
+  }
+  
+  // Predicts the color camera pose at the given (future) timestamp, extrapolating
+  // for at most max_extrapolation_ns beyond the latest known pose. This uses
+  // the poses received by ColorCameraPoseCallback(); a tracking system with
+  // its own (e.g., IMU based) prediction may be queried here instead.
+  bool PredictColorCameraPose(uint64_t timestamp, uint64_t max_extrapolation_ns, Sophus::SE3f* result) {
+    std::lock_guard<std::mutex> input_lock(input_mutex_);
+    return input_pose_history_.GetPose(timestamp, max_extrapolation_ns, result);  // return false to signal failure
   }
   
   bool GetYUVImagePose(const ColorImage& image, Sophus::SE3f* G_T_C) {
@@ -218,8 +472,50 @@ class ViewCorrectionDisplay {
   
   void InitDisplay();
   
+  // Creates the hardware video encoder for --vc_video_output.
+  void InitVideoOutput();
+  
+  // Creates the buffers and renderers which have the size of the target frame
+  // (target_render_width_ x target_render_height_).
+  void InitTargetFrameBuffers();
+  
+  // Creates the ring of display textures with the given number of slots, or
+  // destroys it.
+  void CreateDisplaySlots(int count);
+  void DestroyDisplaySlots();
+  
+  // Changes the target frame render resolution to the one chosen by the
+  // dynamic resolution controller (see --vc_dynamic_resolution). Waits for
+  // the pending target frame work and re-creates the target frame buffers.
+  void ChangeTargetResolution();
+  
   void DisplayOnScreen();
   
+  // Displays the result of the previous frame again instead of a new one (for
+  // --vc_reuse_frames).
+  void RepresentPreviousFrame();
+  
+  // Draws the display slot which contains the result of the given frame to
+  // the screen.
+  void DrawDisplaySlot(int64_t frame_index);
+  
+  // Writes the result of the frame to the headless output buffers instead of
+  // displaying it (for --vc_headless).
+  void StoreHeadlessResult();
+  
+  // Writes the result of the run to the result buffers of the given view of
+  // RenderViews().
+  void StoreViewResult(int view_index);
+  
+  // Compares the target frame color result to the last color image (for
+  // --vc_evaluate_vs_previous_frame) on the GPU and appends the metrics to the
+  // results file.
+  void EvaluateVsPreviousFrame();
+  
+  // Clears the screen to the given color (to signal the state if there is no
+  // result to display). Does nothing in headless mode.
+  void ClearScreen(float red, float green, float blue);
+  
 //   void InitAR();
   
   // Runs the view correction pipeline.
@@ -228,22 +524,61 @@ class ViewCorrectionDisplay {
   // inpaint_in_rgb_frame: If true, inpaints depth in the rgb frame first,
   //                       using gradient based weights. If false, skips this
   //                       step.
-  bool RunPipeline(bool update_data, bool inpaint_in_rgb_frame, bool render_stereo_image);
+  // view_index: Index of the view among the views which are rendered
+  //             together in the frame (the eyes with --vc_stereo, or the
+  //             views of RenderViews()). The views are set up and rendered by
+  //             the run for view 0, the following runs only inpaint them.
+  bool RunPipeline(bool update_data, bool inpaint_in_rgb_frame, bool render_stereo_image, int view_index = 0);
   
   void RenderARContent(uint64_t timestamp,
                        const Sophus::SE3f& target_T_G,
                        float fx, float fy, float cx, float cy, float min_depth,
                        float max_depth);
   
-  // Renders a depth map from a mesh.
-  void RenderDepthImageFromMesh(const MeshStub& mesh,
-                                const Sophus::SE3f& G_T_C);
+  // Renders a depth map from mesh_to_render and the mesh chunks.
+  void RenderDepthImageFromMesh(const Sophus::SE3f& G_T_C);
+  
+  // Returns whether there is a mesh (mesh_to_render or mesh chunks) to render
+  // the depth from.
+  bool HaveMeshToRender() const;
   
   // Computes a meshed inpainted depth map from the input depth image and yuv image.
+  // If use_back_buffers is true, runs on the source meshing stream and writes
+  // to the back buffers used by the asynchronous meshing stage. The meshing
+  // timing events are recorded in timings.
   void CreateMeshedInpaintedDepthMap(
       const ColorImage& rgb_image,
+      bool use_back_buffers,
+      FrameTimings* timings,
       uint32_t* num_src_depth_pixels_to_inpaint);
   
+  // Returns whether the target frame pipeline is captured into a CUDA graph,
+  // see FLAGS_vc_target_cuda_graph.
+  bool UseTargetCUDAGraph();
+  
+  // Adds the timings of a finished run of the pipeline to the latency
+  // metrics. Does nothing if timings is not pending. Does not wait for the
+  // GPU: the timings are dropped if the run has not finished yet.
+  void CollectFrameTimings(FrameTimings* timings);
+  
+  // Hands the given input over to the asynchronous meshing stage. Must only
+  // be called while the stage is idle.
+  void StartAsynchronousMeshing(
+      const DepthImage& depth_image,
+      const ColorImage& rgb_image,
+      const Sophus::SE3f& G_T_src_C);
+  
+  // Checks whether the asynchronous meshing stage finished. If so, swaps its
+  // result in for rendering. Returns true if the stage is idle afterwards.
+  bool PollAsynchronousMeshing();
+  
+  // Copies the results of a meshing job on the meshing device to the back
+  // buffers on the render device. Enqueued on the source meshing stream.
+  void CopyMeshingResultsToRenderDevice();
+  
+  // Main function of the asynchronous meshing thread.
+  void SourceMeshingThreadMain();
+  
   // Sets up the virtual camera view relative to the source frame.
   bool SetupTargetView(
       const Sophus::SE3f& G_T_latest_C,
@@ -261,14 +596,18 @@ class ViewCorrectionDisplay {
   int target_render_height_;
   TargetViewMode target_view_mode_;
   
-  // New input.
+  // New input. The image rings are filled by the camera threads and read by
+  // the render thread without locking. input_mutex_ guards the other members.
   std::mutex input_mutex_;
-  Sophus::SE3f input_G_T_C_;
-  uint64_t input_G_T_C_timestamp_;
-  DepthImage input_depth_image_;
+  PoseHistory input_pose_history_;
   std::shared_ptr<MeshStub> input_mesh_;
-  std::vector<ColorImage> input_yuv_images_;
-  uint64_t latest_depth_image_timestamp_;
+  // Chunk updates received since the last frame, by chunk ID.
+  MeshChunkUpdates pending_mesh_chunk_updates_;
+  TimestampedFrameRing<DepthImage> input_depth_images_;
+  TimestampedFrameRing<ColorImage> input_yuv_images_;
+  // Value of input_depth_images_.push_count() when the latest depth image was
+  // used by the render thread.
+  uint64_t used_depth_image_count_;
   
   // Last pose used for view correction.
   Sophus::SE3f G_T_latest_C;
@@ -301,6 +640,10 @@ class ViewCorrectionDisplay {
   // For getting the current timestamp.
   std::chrono::steady_clock::time_point start_time_;
   
+  // See SetNextDisplayTime().
+  std::chrono::steady_clock::time_point next_display_time_;
+  bool have_next_display_time_ = false;
+  
   // Hidden implementation details (to not propagate CUDA includes).
   std::unique_ptr<ViewCorrectionDisplayImpl> d_;
 };
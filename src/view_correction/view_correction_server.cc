@@ -0,0 +1,242 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "view_correction/view_correction_server.h"
+
+#include <algorithm>
+#include <limits>
+
+#include <glog/logging.h>
+
+#include "view_correction/cuda_util.h"
+#include "view_correction/inpainting_workspace.h"
+
+namespace view_correction {
+
+struct ViewCorrectionServer::Stream {
+  int index;
+  cudaStream_t stream;
+  
+  // Target frame inpainting scratch memory of the sessions on this stream.
+  InpaintingArena target_inpainting_arena;
+  
+  int session_count;
+};
+
+struct ViewCorrectionServer::Session {
+  std::unique_ptr<ViewCorrectionDisplay> display;
+  Stream* stream;
+  
+  // Whether RequestFrame() was called since the last rendered frame.
+  bool frame_requested;
+  
+  // Accumulated GPU time of the session's frames in milliseconds.
+  double gpu_time_ms;
+  
+  // Recorded on the session's stream around its latest frame. If
+  // timing_in_flight is set, the frame's time has not been collected yet.
+  cudaEvent_t frame_start_event;
+  cudaEvent_t frame_end_event;
+  bool timing_in_flight;
+};
+
+ViewCorrectionServer::ViewCorrectionServer(int stream_count) {
+  CHECK_GE(stream_count, 1);
+  streams_.resize(stream_count);
+  for (int i = 0; i < stream_count; ++ i) {
+    Stream* stream = new Stream();
+    streams_[i].reset(stream);
+    stream->index = i;
+    CUDA_CHECKED_CALL(cudaStreamCreate(&stream->stream));
+    stream->session_count = 0;
+  }
+}
+
+ViewCorrectionServer::~ViewCorrectionServer() {
+  while (!sessions_.empty()) {
+    RemoveSession(sessions_.back()->display.get());
+  }
+  for (std::unique_ptr<Stream>& stream : streams_) {
+    cudaStreamDestroy(stream->stream);
+  }
+}
+
+ViewCorrectionDisplay* ViewCorrectionServer::AddSession(
+    int width, int height, int offset_x, int offset_y,
+    ViewCorrectionDisplay::TargetViewMode target_view_mode,
+    const Intrinsics& depth_intrinsics,
+    const Intrinsics& yuv_intrinsics) {
+  Stream* stream = streams_[0].get();
+  for (std::unique_ptr<Stream>& candidate : streams_) {
+    if (candidate->session_count < stream->session_count) {
+      stream = candidate.get();
+    }
+  }
+  
+  Session* session = new Session();
+  session->display.reset(new ViewCorrectionDisplay(
+      width, height, offset_x, offset_y, target_view_mode,
+      depth_intrinsics, yuv_intrinsics));
+  session->stream = stream;
+  session->frame_requested = false;
+  session->timing_in_flight = false;
+  CUDA_CHECKED_CALL(cudaEventCreate(&session->frame_start_event));
+  CUDA_CHECKED_CALL(cudaEventCreate(&session->frame_end_event));
+  
+  // Attaching the session's workspace may re-create the buffers of the other
+  // sessions on the stream in a larger arena.
+  CUDA_CHECKED_CALL(cudaStreamSynchronize(stream->stream));
+  session->display->ShareResources(stream->stream, &stream->target_inpainting_arena);
+  session->display->Init();
+  ++ stream->session_count;
+  
+  std::lock_guard<std::mutex> lock(pending_mutex_);
+  // Start at the least GPU time of the existing sessions such that the new
+  // session does not get precedence over all of them until it catches up.
+  double min_gpu_time_ms = 0;
+  for (std::size_t i = 0; i < sessions_.size(); ++ i) {
+    min_gpu_time_ms = (i == 0) ? sessions_[i]->gpu_time_ms :
+                      std::min(min_gpu_time_ms, sessions_[i]->gpu_time_ms);
+  }
+  session->gpu_time_ms = min_gpu_time_ms;
+  sessions_.emplace_back(session);
+  
+  LOG(INFO) << "Added view correction session on stream " << stream->index
+            << " (" << sessions_.size() << " sessions, shared inpainting memory: "
+            << (stream->target_inpainting_arena.size() / (1024 * 1024.0))
+            << " MiB)";
+  return session->display.get();
+}
+
+void ViewCorrectionServer::RemoveSession(ViewCorrectionDisplay* display) {
+  Session* session = FindSession(display);
+  CUDA_CHECKED_CALL(cudaStreamSynchronize(session->stream->stream));
+  cudaEventDestroy(session->frame_start_event);
+  cudaEventDestroy(session->frame_end_event);
+  -- session->stream->session_count;
+  
+  std::lock_guard<std::mutex> lock(pending_mutex_);
+  for (auto it = sessions_.begin(); it != sessions_.end(); ++ it) {
+    if (it->get() == session) {
+      sessions_.erase(it);
+      break;
+    }
+  }
+}
+
+void ViewCorrectionServer::RequestFrame(ViewCorrectionDisplay* display) {
+  std::lock_guard<std::mutex> lock(pending_mutex_);
+  Session* session = FindSession(display);
+  if (session->frame_requested) {
+    return;
+  }
+  session->frame_requested = true;
+  
+  // A session which was idle must not catch up on the GPU time which it did
+  // not use, so its time is raised to the least one of the waiting sessions.
+  double min_gpu_time_ms = std::numeric_limits<double>::infinity();
+  for (std::unique_ptr<Session>& other : sessions_) {
+    if (other.get() != session && other->frame_requested) {
+      min_gpu_time_ms = std::min(min_gpu_time_ms, other->gpu_time_ms);
+    }
+  }
+  if (min_gpu_time_ms != std::numeric_limits<double>::infinity()) {
+    session->gpu_time_ms = std::max(session->gpu_time_ms, min_gpu_time_ms);
+  }
+}
+
+int ViewCorrectionServer::RenderPendingFrames(int max_frames) {
+  CollectGPUTimes();
+  
+  int rendered_frames = 0;
+  while (rendered_frames < max_frames) {
+    Session* next_session = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(pending_mutex_);
+      for (std::unique_ptr<Session>& session : sessions_) {
+        if (session->frame_requested &&
+            (!next_session || session->gpu_time_ms < next_session->gpu_time_ms)) {
+          next_session = session.get();
+        }
+      }
+      if (!next_session) {
+        break;
+      }
+      next_session->frame_requested = false;
+    }
+    
+    if (next_session->timing_in_flight) {
+      // The events of the session's previous frame are re-used, so its time
+      // has to be collected first. This only waits if the previous frame of
+      // the same session is still running.
+      CUDA_CHECKED_CALL(cudaEventSynchronize(next_session->frame_end_event));
+      CollectGPUTimes();
+    }
+    
+    cudaStream_t stream = next_session->stream->stream;
+    CUDA_CHECKED_CALL(cudaEventRecord(next_session->frame_start_event, stream));
+    next_session->display->Render();
+    CUDA_CHECKED_CALL(cudaEventRecord(next_session->frame_end_event, stream));
+    next_session->timing_in_flight = true;
+    ++ rendered_frames;
+  }
+  return rendered_frames;
+}
+
+ViewCorrectionServer::Session* ViewCorrectionServer::FindSession(
+    ViewCorrectionDisplay* display) {
+  for (std::unique_ptr<Session>& session : sessions_) {
+    if (session->display.get() == display) {
+      return session.get();
+    }
+  }
+  LOG(FATAL) << "The display is not a session of this server.";
+  return nullptr;
+}
+
+void ViewCorrectionServer::CollectGPUTimes() {
+  std::lock_guard<std::mutex> lock(pending_mutex_);
+  for (std::unique_ptr<Session>& session : sessions_) {
+    if (!session->timing_in_flight) {
+      continue;
+    }
+    cudaError_t result = cudaEventQuery(session->frame_end_event);
+    if (result == cudaErrorNotReady) {
+      // Reset the error state, which is checked after kernel launches.
+      cudaGetLastError();
+      continue;
+    }
+    CUDA_CHECKED_CALL(result);
+    
+    float elapsed_ms;
+    CUDA_CHECKED_CALL(cudaEventElapsedTime(
+        &elapsed_ms, session->frame_start_event, session->frame_end_event));
+    session->gpu_time_ms += elapsed_ms;
+    session->timing_in_flight = false;
+  }
+}
@@ -0,0 +1,111 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef VIEW_CORRECTION_VIEW_CORRECTION_SERVER_H_
+#define VIEW_CORRECTION_VIEW_CORRECTION_SERVER_H_
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <cuda_runtime.h>
+
+#include "view_correction/view_correction_display.h"
+
+namespace view_correction {
+
+// Hosts several ViewCorrectionDisplay sessions in one process, for example
+// one per remote viewer on a GPU server. All sessions use the OpenGL context
+// which is current on the thread that uses the server (and thereby one CUDA
+// context), and their target frame pipelines are distributed over a fixed
+// pool of CUDA streams. Sessions on the same stream never run concurrently
+// on the GPU, so they share the scratch memory of the target frame
+// inpainting (see InpaintingArena). The source frame processing of each
+// session keeps its own stream and buffers.
+//
+// Frames are requested per session with RequestFrame() (from any thread) and
+// rendered with RenderPendingFrames() (on the OpenGL thread). The pending
+// sessions are served in the order of their accumulated GPU time, such that
+// a session with expensive frames does not starve the others.
+class ViewCorrectionServer {
+ public:
+  // Creates the given number of CUDA streams.
+  explicit ViewCorrectionServer(int stream_count);
+  
+  // Removes all remaining sessions. Must be called while the OpenGL context
+  // is current.
+  ~ViewCorrectionServer();
+  
+  // Creates and initializes a session on the least used stream. The
+  // parameters are the same as for the ViewCorrectionDisplay constructor.
+  // The session is owned by the server and may be used (for passing input
+  // to it and reading its results) until RemoveSession() is called.
+  ViewCorrectionDisplay* AddSession(
+      int width, int height, int offset_x, int offset_y,
+      ViewCorrectionDisplay::TargetViewMode target_view_mode,
+      const Intrinsics& depth_intrinsics,
+      const Intrinsics& yuv_intrinsics);
+  
+  // Waits for the pending work of the session and destroys it.
+  void RemoveSession(ViewCorrectionDisplay* session);
+  
+  // Marks that the session should render a new frame in the next call to
+  // RenderPendingFrames(). Thread-safe.
+  void RequestFrame(ViewCorrectionDisplay* session);
+  
+  // Renders at most max_frames of the requested frames, one per session,
+  // choosing the sessions with the least accumulated GPU time first. Returns
+  // the number of rendered frames.
+  int RenderPendingFrames(int max_frames);
+  
+  inline int session_count() const { return static_cast<int>(sessions_.size()); }
+  
+ private:
+  struct Session;
+  struct Stream;
+  
+  ViewCorrectionServer(const ViewCorrectionServer&) = delete;
+  ViewCorrectionServer& operator=(const ViewCorrectionServer&) = delete;
+  
+  // Returns the session object of the given display.
+  Session* FindSession(ViewCorrectionDisplay* display);
+  
+  // Adds the GPU times of the completed frames to their sessions without
+  // blocking.
+  void CollectGPUTimes();
+  
+  std::vector<std::unique_ptr<Stream>> streams_;
+  std::vector<std::unique_ptr<Session>> sessions_;
+  
+  // Protects the pending flags and GPU times of the sessions.
+  std::mutex pending_mutex_;
+};
+
+}  // namespace view_correction
+
+#endif  // VIEW_CORRECTION_VIEW_CORRECTION_SERVER_H_
@@ -0,0 +1,78 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include "view_correction/view_frustum.h"
+
+namespace view_correction {
+
+constexpr int ViewFrustum::kPlaneCount;
+
+ViewFrustum::ViewFrustum(
+    const Sophus::SE3f& C_T_G,
+    float fx, float fy, float cx, float cy,
+    int width, int height,
+    float min_depth, float max_depth) {
+  // Planes in the camera frame. A point is projected to the pixel
+  // (fx * x / z + cx, fy * y / z + cy), and the image covers
+  // [-0.5, width - 0.5] x [-0.5, height - 0.5] in pixel coordinates.
+  const Eigen::Vector4f camera_planes[kPlaneCount] = {
+      Eigen::Vector4f(fx, 0, cx + 0.5f, 0),                 // left
+      Eigen::Vector4f(-fx, 0, width - 0.5f - cx, 0),        // right
+      Eigen::Vector4f(0, fy, cy + 0.5f, 0),                 // top
+      Eigen::Vector4f(0, -fy, height - 0.5f - cy, 0),       // bottom
+      Eigen::Vector4f(0, 0, 1, -min_depth),                 // near
+      Eigen::Vector4f(0, 0, -1, max_depth)};                // far
+  
+  // With x_C = R * x_G + t, n * x_C + d = (R^T n) * x_G + (n * t + d).
+  const Eigen::Matrix3f R = C_T_G.rotationMatrix();
+  const Eigen::Vector3f t = C_T_G.translation();
+  for (int i = 0; i < kPlaneCount; ++ i) {
+    const Eigen::Vector3f n = camera_planes[i].head<3>();
+    planes_[i].head<3>() = R.transpose() * n;
+    planes_[i](3) = n.dot(t) + camera_planes[i](3);
+  }
+}
+
+bool ViewFrustum::Intersects(const Eigen::AlignedBox3f& box) const {
+  if (box.isEmpty()) {
+    return false;
+  }
+  const Eigen::Vector3f center = box.center();
+  const Eigen::Vector3f half_extent = 0.5f * box.sizes();
+  for (int i = 0; i < kPlaneCount; ++ i) {
+    // The box is outside if even its corner furthest along the plane normal
+    // is outside.
+    const Eigen::Vector3f n = planes_[i].head<3>();
+    if (n.dot(center) + n.cwiseAbs().dot(half_extent) + planes_[i](3) < 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace view_correction
@@ -0,0 +1,69 @@
+// Copyright 2018 ETH Zürich
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software
+//    without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef VIEW_CORRECTION_VIEW_FRUSTUM_H_
+#define VIEW_CORRECTION_VIEW_FRUSTUM_H_
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <sophus/se3.hpp>
+
+namespace view_correction {
+
+// View frustum of a pinhole camera rendering with MeshRenderer, used to skip
+// geometry which cannot be visible before drawing it. The frustum planes are
+// stored in the global frame, such that boxes in the global frame can be
+// tested without transforming them.
+class ViewFrustum {
+ public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  
+  // C_T_G is the transformation from the global frame to the camera frame,
+  // and the intrinsics use the origin-at-pixel-center convention (as for
+  // MeshRenderer). The frustum covers the image of the given size between the
+  // given depths.
+  ViewFrustum(const Sophus::SE3f& C_T_G,
+              float fx, float fy, float cx, float cy,
+              int width, int height,
+              float min_depth, float max_depth);
+  
+  // Returns false if the axis-aligned box (in the global frame) is certainly
+  // outside of the frustum. May return true for some boxes outside of the
+  // frustum which are close to its corners.
+  bool Intersects(const Eigen::AlignedBox3f& box) const;
+  
+ private:
+  static constexpr int kPlaneCount = 6;
+  
+  // Planes (n, d) in the global frame with n * x + d >= 0 inside the frustum.
+  Eigen::Vector4f planes_[kPlaneCount];
+};
+
+}  // namespace view_correction
+
+#endif  // VIEW_CORRECTION_VIEW_FRUSTUM_H_